@@ -0,0 +1,806 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+/* micro benchmark of the core modules of adif, built and run by 'make bench'
+ *
+ *   adifbench [-q] [-t maxthreads] [-f filter] [-o file]
+ *
+ *     -q  quick run with 1/10 of the operations
+ *     -t  the largest thread count of the multi-thread cases, default is
+ *         the number of CPUs up to 8. the counts run are 1, 2, 4 ... max
+ *     -f  run only the cases whose name contains the filter
+ *     -o  write the JSON result into file instead of stdout
+ *
+ * each case runs its operation over a range of indexes in every thread.
+ * the time of each batch of BENCH_BATCH operations is taken by the cycle
+ * counter and divided into the per-operation latency, of which p50 and p99
+ * are reported, so the cost of reading the clock is not in the result.
+ * ops_per_sec is of all the threads over the wall time */
+
+#include "adifall.ext"
+#include "heap.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION  "unknown"
+#endif
+
+#define BENCH_BATCH    32
+#define BENCH_THREADS  8
+#define BENCH_THRMAX   64
+
+typedef void BenchOp (void * arg, int tid, long i);
+
+typedef struct bench_s {
+    FILE     * fp;
+    char     * filter;
+    int        quick;
+    int        maxthreads;
+    int        count;          //results emitted
+} Bench;
+
+typedef struct bench_run_s {
+    BenchOp  * op;
+    void     * arg;
+    long       ops;            //operations of each thread
+    int        started;
+    uint32   * samples;        //cycles of each batch, ops/BENCH_BATCH of each thread
+} BenchRun;
+
+typedef struct bench_thr_s {
+    BenchRun * run;
+    int        tid;
+} BenchThr;
+
+static Bench  g_bench;
+
+
+/* the group of cases runs if any of their names, separated by space in
+ * names, contains the filter */
+static int bench_group (char * names)
+{
+    return !g_bench.filter || strstr(names, g_bench.filter) != NULL;
+}
+
+static long bench_ops (long ops)
+{
+    if (g_bench.quick) ops /= 10;
+
+    return ops < BENCH_BATCH ? BENCH_BATCH : ops / BENCH_BATCH * BENCH_BATCH;
+}
+
+static int bench_cmp_u32 (const void * a, const void * b)
+{
+    uint32  x = *(uint32 *)a, y = *(uint32 *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void * bench_thread (void * varg)
+{
+    BenchThr * thr = (BenchThr *)varg;
+    BenchRun * run = thr->run;
+    uint32   * samples = run->samples + thr->tid * (run->ops / BENCH_BATCH);
+    uint64     t0, t1;
+    long       i, k, from;
+
+    while (!__atomic_load_n(&run->started, __ATOMIC_ACQUIRE)) ;
+
+    from = (long)thr->tid * run->ops;
+
+    for (i = 0; i < run->ops; i += BENCH_BATCH) {
+        t0 = btime_cycles();
+        for (k = 0; k < BENCH_BATCH; k++)
+            (*run->op)(run->arg, thr->tid, from + i + k);
+        t1 = btime_cycles();
+
+        samples[i / BENCH_BATCH] = (t1 - t0) > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (uint32)(t1 - t0);
+    }
+
+    return NULL;
+}
+
+/* run op for ops times in each of threads, thread t takes the indexes from
+ * t * ops. the result is emitted if name passes the filter. param is the
+ * JSON members of the case parameters */
+static void bench_measure (char * name, char * param, int threads, long ops,
+                           BenchOp * op, void * arg)
+{
+    BenchRun        run;
+    BenchThr        thr[BENCH_THRMAX];
+    pthread_t       tid[BENCH_THRMAX];
+    struct timespec ts0, ts1;
+    double          sec, nsop, rate;
+    long            nsamp;
+    int             t;
+
+    if (threads < 1) threads = 1;
+    if (threads > BENCH_THRMAX) threads = BENCH_THRMAX;
+
+    memset(&run, 0, sizeof(run));
+    run.op = op;
+    run.arg = arg;
+    run.ops = ops;
+
+    nsamp = threads * (ops / BENCH_BATCH);
+    run.samples = kzalloc(nsamp * sizeof(uint32));
+    if (!run.samples) return;
+
+    for (t = 0; t < threads; t++) {
+        thr[t].run = &run;
+        thr[t].tid = t;
+        pthread_create(&tid[t], NULL, bench_thread, &thr[t]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    __atomic_store_n(&run.started, 1, __ATOMIC_RELEASE);
+
+    for (t = 0; t < threads; t++) pthread_join(tid[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+    if (g_bench.filter && !strstr(name, g_bench.filter)) {
+        kfree(run.samples);
+        return;
+    }
+
+    sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+    if (sec <= 0) sec = 1e-9;
+    rate = (double)ops * threads / sec;
+
+    qsort(run.samples, nsamp, sizeof(uint32), bench_cmp_u32);
+
+    /* nano-seconds of one cycle over the batch */
+    nsop = (double)btime_cycles_ns(1000000000ULL) / 1e9 / BENCH_BATCH;
+
+    fprintf(g_bench.fp, "%s\n    {\"name\": \"%s\", %s%s\"threads\": %d, \"ops\": %ld, "
+            "\"ops_per_sec\": %.0f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}",
+            g_bench.count > 0 ? "," : "", name, param, param[0] ? ", " : "",
+            threads, ops * threads, rate,
+            run.samples[nsamp / 2] * nsop,
+            run.samples[nsamp * 99 / 100] * nsop);
+    fflush(g_bench.fp);
+    g_bench.count++;
+
+    if (g_bench.fp != stdout)
+        fprintf(stderr, "%-22s %-34s threads=%-3d %14.0f ops/s\n", name, param, threads, rate);
+
+    kfree(run.samples);
+}
+
+/* run the case for 1, 2, 4 ... up to maxthreads */
+static void bench_measure_mt (char * name, char * param, long ops, BenchOp * op, void * arg)
+{
+    int  t;
+
+    for (t = 1; t <= g_bench.maxthreads; t *= 2)
+        bench_measure(name, param, t, ops, op, arg);
+
+    if (t / 2 < g_bench.maxthreads)
+        bench_measure(name, param, g_bench.maxthreads, ops, op, arg);
+}
+
+
+/* n distinct keys of keylen bytes ended by NUL in a random order. the keys
+ * are in one block, freed by kfree(keys[-1]) through bench_keys_free */
+static char ** bench_keys (long n, int keylen)
+{
+    char  ** keys = NULL;
+    char   * p = NULL;
+    char   * tmp = NULL;
+    long     i, j;
+    int      w = keylen < 8 ? keylen : 8;
+
+    keys = kalloc((n + 1) * sizeof(char *));
+    p = kalloc(n * (keylen + 1));
+    if (!keys || !p) {
+        if (keys) kfree(keys);
+        if (p) kfree(p);
+        return NULL;
+    }
+
+    keys[0] = p;
+    keys++;
+
+    for (i = 0; i < n; i++) {
+        keys[i] = p + i * (keylen + 1);
+        memset(keys[i], 'k', keylen - w);
+        sprintf(keys[i] + keylen - w, "%0*lx", w, i);
+    }
+
+    for (i = n - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = keys[i]; keys[i] = keys[j]; keys[j] = tmp;
+    }
+
+    return keys;
+}
+
+static void bench_keys_free (char ** keys)
+{
+    if (!keys) return;
+
+    kfree(keys[-1]);
+    kfree(keys - 1);
+}
+
+/* n distinct uint64 values in a random order */
+static uint64 * bench_vals (long n)
+{
+    uint64  * vals = NULL;
+    uint64    tmp;
+    long      i, j;
+
+    vals = kalloc(n * sizeof(uint64));
+    if (!vals) return NULL;
+
+    for (i = 0; i < n; i++) vals[i] = (uint64)i * 2654435761ULL;
+
+    for (i = n - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = vals[i]; vals[i] = vals[j]; vals[j] = tmp;
+    }
+
+    return vals;
+}
+
+
+/* ht_* and fast_ht_* with the string keys */
+
+typedef struct {
+    void    * tab;
+    char   ** keys;
+    int       keylen;
+    long      num;
+} KeyCase;
+
+static int ht_cmp_str (void * a, void * b)
+{
+    return strcmp((char *)a, (char *)b);
+}
+
+static void op_ht_set (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    ht_set(kc->tab, kc->keys[i], kc->keys[i]);
+}
+
+static void op_ht_get (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    ht_get(kc->tab, kc->keys[(i * 7) % kc->num]);
+}
+
+static void op_ht_delete (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    ht_delete(kc->tab, kc->keys[i]);
+}
+
+static void op_fast_ht_set (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    fast_ht_set(kc->tab, kc->keys[i], kc->keylen, kc->keys[i], kc->keylen);
+}
+
+static void op_fast_ht_get (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    fast_ht_get(kc->tab, kc->keys[(i * 7) % kc->num], kc->keylen, NULL, NULL);
+}
+
+static void op_fast_ht_del (void * arg, int tid, long i)
+{
+    KeyCase * kc = (KeyCase *)arg;
+    fast_ht_del(kc->tab, kc->keys[i], kc->keylen, NULL, NULL);
+}
+
+static void bench_hashtab ()
+{
+    static int  keylens[] = { 8, 32, 128 };
+    KeyCase     kc;
+    char        param[128];
+    long        num = bench_ops(200000);
+    int         i;
+
+    if (!bench_group("ht_set ht_get ht_delete fast_ht_set fast_ht_get fast_ht_del"))
+        return;
+
+    for (i = 0; i < (int)(sizeof(keylens) / sizeof(int)); i++) {
+        memset(&kc, 0, sizeof(kc));
+        kc.keylen = keylens[i];
+        kc.num = num;
+        kc.keys = bench_keys(num, kc.keylen);
+        if (!kc.keys) return;
+
+        sprintf(param, "\"keylen\": %d, \"num\": %ld", kc.keylen, num);
+
+        if (bench_group("ht_set ht_get ht_delete")) {
+            kc.tab = ht_new(1024, ht_cmp_str);
+            ht_set_hash_func(kc.tab, wy_string_hash);
+            bench_measure("ht_set", param, 1, num, op_ht_set, &kc);
+            bench_measure("ht_get", param, 1, num, op_ht_get, &kc);
+            bench_measure("ht_delete", param, 1, num, op_ht_delete, &kc);
+            ht_free(kc.tab);
+        }
+
+        if (bench_group("fast_ht_set fast_ht_get fast_ht_del")) {
+            kc.tab = fast_ht_new(1024);
+            bench_measure("fast_ht_set", param, 1, num, op_fast_ht_set, &kc);
+            bench_measure("fast_ht_get", param, 1, num, op_fast_ht_get, &kc);
+            bench_measure("fast_ht_del", param, 1, num, op_fast_ht_del, &kc);
+            fast_ht_free(kc.tab);
+        }
+
+        bench_keys_free(kc.keys);
+    }
+}
+
+
+/* rbtree_*, heap_* and arr_* with the uint64 values */
+
+typedef struct {
+    void    * obj;
+    uint64  * vals;
+    long      num;
+} ValCase;
+
+static int cmp_u64 (void * a, void * b)
+{
+    uint64  x = *(uint64 *)a, y = *(uint64 *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void op_rbtree_insert (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    rbtree_insert(vc->obj, &vc->vals[i], &vc->vals[i], NULL);
+}
+
+static void op_rbtree_get (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    rbtree_get(vc->obj, &vc->vals[(i * 7) % vc->num]);
+}
+
+static void op_rbtree_delete (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    rbtree_delete(vc->obj, &vc->vals[i]);
+}
+
+static void op_heap_push (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    heap_push(vc->obj, &vc->vals[i]);
+}
+
+static void op_heap_pop (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    heap_pop(vc->obj);
+}
+
+static void op_arr_push (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    arr_push(vc->obj, &vc->vals[i]);
+}
+
+static void op_arr_find_by (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    arr_find_by(vc->obj, &vc->vals[(i * 7) % vc->num], cmp_u64);
+}
+
+static void op_arr_pop (void * arg, int tid, long i)
+{
+    ValCase * vc = (ValCase *)arg;
+    arr_pop(vc->obj);
+}
+
+static void bench_sorted ()
+{
+    static long  nums[] = { 1000, 100000, 1000000 };
+    ValCase      vc;
+    char         param[64];
+    long         num;
+    int          i;
+
+    if (!bench_group("rbtree_insert rbtree_get rbtree_delete heap_push heap_pop "
+                     "arr_push arr_find_by arr_pop"))
+        return;
+
+    for (i = 0; i < (int)(sizeof(nums) / sizeof(long)); i++) {
+        num = bench_ops(nums[i]);
+
+        memset(&vc, 0, sizeof(vc));
+        vc.num = num;
+        vc.vals = bench_vals(num);
+        if (!vc.vals) return;
+
+        sprintf(param, "\"num\": %ld", num);
+
+        if (bench_group("rbtree_insert rbtree_get rbtree_delete")) {
+            vc.obj = rbtree_new(cmp_u64, 1);
+            bench_measure("rbtree_insert", param, 1, num, op_rbtree_insert, &vc);
+            bench_measure("rbtree_get", param, 1, num, op_rbtree_get, &vc);
+            bench_measure("rbtree_delete", param, 1, num, op_rbtree_delete, &vc);
+            rbtree_free(vc.obj);
+        }
+
+        if (bench_group("heap_push heap_pop")) {
+            vc.obj = heap_new(cmp_u64, 64);
+            bench_measure("heap_push", param, 1, num, op_heap_push, &vc);
+            bench_measure("heap_pop", param, 1, num, op_heap_pop, &vc);
+            heap_free(vc.obj);
+        }
+
+        if (bench_group("arr_push arr_find_by arr_pop")) {
+            vc.obj = arr_new(4);
+            bench_measure("arr_push", param, 1, num, op_arr_push, &vc);
+            arr_sort_by(vc.obj, cmp_u64);
+            bench_measure("arr_find_by", param, 1, num, op_arr_find_by, &vc);
+            bench_measure("arr_pop", param, 1, num, op_arr_pop, &vc);
+            arr_free(vc.obj);
+        }
+
+        kfree(vc.vals);
+    }
+}
+
+
+/* mpool and bpool shared by the threads. each thread keeps a ring of the
+ * units fetched, every op recycles the oldest and fetches a new one */
+
+#define POOL_RING  64
+
+typedef struct {
+    void    * pool;
+    int       unitsize;
+    void    * ring[BENCH_THRMAX][POOL_RING];
+} PoolCase;
+
+static void op_mpool (void * arg, int tid, long i)
+{
+    PoolCase * pc = (PoolCase *)arg;
+    void    ** slot = &pc->ring[tid][i % POOL_RING];
+
+    if (*slot) mpool_recycle(pc->pool, *slot);
+    *slot = mpool_fetch(pc->pool);
+}
+
+static void op_bpool (void * arg, int tid, long i)
+{
+    PoolCase * pc = (PoolCase *)arg;
+    void    ** slot = &pc->ring[tid][i % POOL_RING];
+
+    if (*slot) bpool_recycle(pc->pool, *slot);
+    *slot = bpool_fetch(pc->pool);
+}
+
+static void bench_pool ()
+{
+    static int  sizes[] = { 64, 1024 };
+    PoolCase  * pc = NULL;
+    char        param[64];
+    long        num = bench_ops(1000000);
+    int         i, t, k;
+
+    if (!bench_group("mpool_fetch_recycle bpool_fetch_recycle")) return;
+
+    pc = kzalloc(sizeof(*pc));
+    if (!pc) return;
+
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(int)); i++) {
+        pc->unitsize = sizes[i];
+        sprintf(param, "\"unitsize\": %d", sizes[i]);
+
+        if (bench_group("mpool_fetch_recycle")) {
+            pc->pool = mpool_alloc();
+            mpool_set_unitsize(pc->pool, sizes[i]);
+            mpool_set_allocnum(pc->pool, 256);
+            memset(pc->ring, 0, sizeof(pc->ring));
+
+            bench_measure_mt("mpool_fetch_recycle", param, num, op_mpool, pc);
+
+            for (t = 0; t < BENCH_THRMAX; t++) {
+                for (k = 0; k < POOL_RING; k++)
+                    if (pc->ring[t][k]) mpool_recycle(pc->pool, pc->ring[t][k]);
+            }
+            mpool_free(pc->pool);
+        }
+
+        if (bench_group("bpool_fetch_recycle")) {
+            pc->pool = bpool_init(NULL);
+            bpool_set_unitsize(pc->pool, sizes[i]);
+            bpool_set_allocnum(pc->pool, 256);
+            memset(pc->ring, 0, sizeof(pc->ring));
+
+            bench_measure_mt("bpool_fetch_recycle", param, num, op_bpool, pc);
+
+            for (t = 0; t < BENCH_THRMAX; t++) {
+                for (k = 0; k < POOL_RING; k++)
+                    if (pc->ring[t][k]) bpool_recycle(pc->pool, pc->ring[t][k]);
+            }
+            bpool_clean(pc->pool);
+        }
+    }
+
+    kfree(pc);
+}
+
+
+/* frame_* as the buffer of a stream: append the data at the tail and
+ * remove it from the head */
+
+typedef struct {
+    frame_p   frm;
+    uint8   * data;
+    int       size;
+} FrameCase;
+
+static void op_frame_put_del (void * arg, int tid, long i)
+{
+    FrameCase * fc = (FrameCase *)arg;
+
+    frame_put_nlast(fc->frm, fc->data, fc->size);
+    if (frame_size(fc->frm) >= 16 * fc->size)
+        frame_del_first(fc->frm, 8 * fc->size);
+}
+
+static void op_frame_appendf (void * arg, int tid, long i)
+{
+    FrameCase * fc = (FrameCase *)arg;
+
+    frame_appendf(fc->frm, "%ld:%s;", i, "value");
+    if (frame_size(fc->frm) >= 65536) frame_empty(fc->frm);
+}
+
+static void bench_frame ()
+{
+    static int  sizes[] = { 16, 256, 4096 };
+    FrameCase   fc;
+    char        param[64];
+    long        num = bench_ops(1000000);
+    int         i;
+
+    if (!bench_group("frame_put_del frame_appendf")) return;
+
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(int)); i++) {
+        fc.size = sizes[i];
+        fc.data = kzalloc(fc.size);
+        fc.frm = frame_new(0);
+        if (!fc.data || !fc.frm) return;
+
+        sprintf(param, "\"datasize\": %d", fc.size);
+        bench_measure("frame_put_del", param, 1, num, op_frame_put_del, &fc);
+
+        frame_free(fc.frm);
+        kfree(fc.data);
+    }
+
+    fc.frm = frame_new(0);
+    bench_measure("frame_appendf", "", 1, num, op_frame_appendf, &fc);
+    frame_free(fc.frm);
+}
+
+
+/* json_decode of a document into a new object, and json_encode of the
+ * decoded object. each thread has its own objects */
+
+typedef struct {
+    frame_p   text;
+    void    * obj[BENCH_THRMAX];
+    char    * buf[BENCH_THRMAX];
+    int       buflen;
+} JsonCase;
+
+static void op_json_decode (void * arg, int tid, long i)
+{
+    JsonCase * jc = (JsonCase *)arg;
+    void     * obj = json_init(0, 0);
+
+    json_decode(obj, frameP(jc->text), frameL(jc->text), 1, 0);
+    json_clean(obj);
+}
+
+static void op_json_encode (void * arg, int tid, long i)
+{
+    JsonCase * jc = (JsonCase *)arg;
+
+    json_encode(jc->obj[tid], jc->buf[tid], jc->buflen);
+}
+
+static void bench_json ()
+{
+    static int  members[] = { 10, 100, 1000 };
+    JsonCase  * jc = NULL;
+    char        param[64];
+    long        num;
+    int         i, k, t;
+
+    if (!bench_group("json_decode json_encode")) return;
+
+    jc = kzalloc(sizeof(*jc));
+    if (!jc) return;
+
+    for (i = 0; i < (int)(sizeof(members) / sizeof(int)); i++) {
+        jc->text = frame_new(0);
+
+        frame_put_last(jc->text, '{');
+        for (k = 0; k < members[i]; k++) {
+            if (k % 4 == 0)
+                frame_appendf(jc->text, "\"name%d\": \"value of member %d\", ", k, k);
+            else if (k % 4 == 1)
+                frame_appendf(jc->text, "\"count%d\": %d, ", k, k * 1237);
+            else if (k % 4 == 2)
+                frame_appendf(jc->text, "\"list%d\": [1, 2.5, \"three\", true], ", k);
+            else
+                frame_appendf(jc->text, "\"obj%d\": {\"id\": %d, \"ok\": false}, ", k, k);
+        }
+        frame_append(jc->text, "\"end\": null}");
+
+        num = bench_ops(100000 / members[i] * 10);
+        sprintf(param, "\"members\": %d, \"bytes\": %d", members[i], frameL(jc->text));
+
+        bench_measure_mt("json_decode", param, num, op_json_decode, jc);
+
+        jc->buflen = frameL(jc->text) * 2 + 1024;
+        for (t = 0; t < g_bench.maxthreads; t++) {
+            jc->obj[t] = json_init(0, 0);
+            json_decode(jc->obj[t], frameP(jc->text), frameL(jc->text), 1, 0);
+            jc->buf[t] = kalloc(jc->buflen);
+        }
+
+        bench_measure_mt("json_encode", param, num, op_json_encode, jc);
+
+        for (t = 0; t < g_bench.maxthreads; t++) {
+            json_clean(jc->obj[t]);
+            kfree(jc->buf[t]);
+        }
+        frame_free(jc->text);
+    }
+
+    kfree(jc);
+}
+
+
+/* the searches of patmat over the text with the pattern at the end */
+
+typedef struct {
+    uint8   * text;
+    int       len;
+    char    * pat;
+    int       patlen;
+} PatCase;
+
+static void op_kmp_find (void * arg, int tid, long i)
+{
+    PatCase * pc = (PatCase *)arg;
+    kmp_find_bytes(pc->text, pc->len, pc->pat, pc->patlen, NULL);
+}
+
+static void op_bm_find (void * arg, int tid, long i)
+{
+    PatCase * pc = (PatCase *)arg;
+    bm_find_bytes(pc->text, pc->len, pc->pat, pc->patlen, NULL);
+}
+
+static void op_sun_find (void * arg, int tid, long i)
+{
+    PatCase * pc = (PatCase *)arg;
+    sun_find_bytes(pc->text, pc->len, pc->pat, pc->patlen, NULL);
+}
+
+static void op_pat_find (void * arg, int tid, long i)
+{
+    PatCase * pc = (PatCase *)arg;
+    pat_find(pc->text, pc->len, pc->pat, pc->patlen);
+}
+
+static void bench_patmat ()
+{
+    static int  lens[] = { 1024, 65536, 1048576 };
+    static int  patlens[] = { 4, 16, 64 };
+    PatCase     pc;
+    char        param[64];
+    char        pat[65];
+    long        num;
+    int         i, j, k;
+
+    if (!bench_group("kmp_find_bytes bm_find_bytes sun_find_bytes pat_find")) return;
+
+    for (i = 0; i < (int)(sizeof(lens) / sizeof(int)); i++) {
+        pc.len = lens[i];
+        pc.text = kalloc(pc.len);
+        if (!pc.text) return;
+
+        /* the text of few letters makes the partial matches often */
+        for (k = 0; k < pc.len; k++) pc.text[k] = 'a' + random() % 4;
+
+        num = bench_ops(1000000000L / lens[i] / 16);
+
+        for (j = 0; j < (int)(sizeof(patlens) / sizeof(int)); j++) {
+            pc.patlen = patlens[j];
+            for (k = 0; k < pc.patlen; k++) pat[k] = 'a' + random() % 4;
+            pat[pc.patlen - 1] = 'z';
+            pat[pc.patlen] = '\0';
+            pc.pat = pat;
+
+            memcpy(pc.text + pc.len - pc.patlen, pat, pc.patlen);
+
+            sprintf(param, "\"datasize\": %d, \"patlen\": %d", pc.len, pc.patlen);
+
+            bench_measure("kmp_find_bytes", param, 1, num, op_kmp_find, &pc);
+            bench_measure("bm_find_bytes", param, 1, num, op_bm_find, &pc);
+            bench_measure("sun_find_bytes", param, 1, num, op_sun_find, &pc);
+            bench_measure_mt("pat_find", param, num, op_pat_find, &pc);
+
+            memset(pc.text + pc.len - pc.patlen, 'a', pc.patlen);
+        }
+
+        kfree(pc.text);
+    }
+}
+
+
+int main (int argc, char ** argv)
+{
+    btime_t  now;
+    int      i, ncpu;
+
+    memset(&g_bench, 0, sizeof(g_bench));
+    g_bench.fp = stdout;
+
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    g_bench.maxthreads = ncpu < 1 ? 1 : (ncpu > BENCH_THREADS ? BENCH_THREADS : ncpu);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            g_bench.quick = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            g_bench.maxthreads = atoi(argv[++i]);
+            if (g_bench.maxthreads < 1) g_bench.maxthreads = 1;
+            if (g_bench.maxthreads > BENCH_THRMAX) g_bench.maxthreads = BENCH_THRMAX;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            g_bench.filter = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            g_bench.fp = fopen(argv[++i], "w");
+            if (!g_bench.fp) {
+                fprintf(stderr, "failed to open %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-q] [-t maxthreads] [-f filter] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    srandom(20200101);
+    btime(&now);
+
+    /* calibrate the cycle counter before the timed runs */
+    btime_cycles_hz();
+
+    fprintf(g_bench.fp, "{\n  \"adif_version\": \"%s\",\n  \"time\": %ld,\n"
+            "  \"cpus\": %d,\n  \"cycles_hz\": %llu,\n  \"quick\": %d,\n  \"results\": [",
+            BENCH_VERSION, now.s, ncpu, (unsigned long long)btime_cycles_hz(), g_bench.quick);
+
+    bench_hashtab();
+    bench_sorted();
+    bench_pool();
+    bench_frame();
+    bench_json();
+    bench_patmat();
+
+    fprintf(g_bench.fp, "\n  ]\n}\n");
+
+    if (g_bench.fp != stdout) fclose(g_bench.fp);
+
+    return 0;
+}
+
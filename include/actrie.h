@@ -43,8 +43,69 @@ typedef struct actrie_ {
     unsigned    build_failjump : 1;
     unsigned    reverse        : 1;
 
+    /* double-array automaton compiled by actrie_compile or loaded from file.
+     * a loaded trie has no nodes, patterns can not be added or deleted */
+    void      * dat;
+    unsigned    frozen         : 1;
+
 } actrie_t, *actrie_p;
 
+
+/* the compiled automaton is a double-array trie: the transition of state s
+ * by byte ch goes to t = unit[s].base + cmap[ch] if unit[t].check == s.
+ * bytes are mapped to codes 1..codes ordered by frequency, those not in any
+ * pattern map to 0 and reset the matching to root. fail is the failure link,
+ * dict the nearest state on the failure chain ending a pattern, word the
+ * pattern index of the state or -1.
+ *
+ * the file saved by actrie_save has the same layout as the memory block:
+ * header, para[words], wlen[words], unit[size], fail[size], dict[size],
+ * word[size]. the para pointers are saved as integers, they make sense
+ * after loading when the patterns are added with integer ids as para */
+
+#define ACDAT_MAGIC    0x41444341   //"ACDA"
+#define ACDAT_VERSION  1
+
+typedef struct acdat_hdr_ {
+    uint32     magic;
+    uint32     version;
+    uint32     reverse;
+    uint32     codes;
+    uint32     size;
+    uint32     words;
+    uint16     cmap[256];
+} acdat_hdr_t;
+
+typedef struct acdat_ {
+    acdat_hdr_t * hdr;
+
+    uint64      * para;
+    uint32      * wlen;
+
+    daunit_t    * unit;
+    int32       * fail;
+    int32       * dict;
+    int32       * word;
+
+    void        * mem;
+    int64         memlen;
+
+    /* mapped from the file by actrie_load */
+    void        * mapbase;
+    int64         maplen;
+} acdat_t;
+
+/* one match reported by actrie_match_batch, pos is the offset of the
+ * pattern in the input */
+typedef struct acmatch_ {
+    int        input;
+    int        pos;
+    int        len;
+    void     * para;
+} acmatch_t;
+
+#define AC_BATCH_LANES  8
+
 void * actrie_init (int entries, void * matchcb, int reverse);
 int    actrie_free (void * vac);
 
@@ -58,6 +119,29 @@ int    actrie_get (void * vac, void * p, int len, void ** pvar);
 int    actrie_match (void * vtrie, void * vbyte, int len, void ** pres, int * reslen, void ** pvar);
 int    actrie_fwmaxmatch (void * vtrie, void * vbyte, int len, void ** pres, int * reslen, void ** pvar);
 
+/* freeze the trie into the double-array automaton, actrie_match, actrie_get
+ * and actrie_fwmaxmatch run on it afterwards. adding or deleting patterns
+ * drops the automaton, compile it again after updating */
+int    actrie_compile (void * vac);
+
+/* match num inputs on the automaton, the trie is compiled if not yet.
+ * AC_BATCH_LANES inputs are advanced in turn by one byte so that the
+ * transition loads of them overlap. lens[i] < 0 means the string length.
+ *
+ * the matches are stored into mats up to maxmat, those of one input are in
+ * the order of position, the inputs are interleaved. counts[i] receives
+ * the number of matches of input i if counts is not NULL. return the total
+ * number of matches that may exceed maxmat, or negative on error */
+int    actrie_match_batch (void * vac, void ** inputs, int * lens, int num,
+                           acmatch_t * mats, int maxmat, int * counts);
+
+/* save the automaton into file, the trie is compiled if not yet */
+int    actrie_save (void * vac, char * file);
+
+/* load the automaton saved by actrie_save. the file is mapped read-only on
+ * UNIX, the processes loading the same file share its pages */
+void * actrie_load (char * file, void * matchcb);
+
 #ifdef __cplusplus
 }
 #endif
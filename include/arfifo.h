@@ -26,6 +26,45 @@ void * ar_fifo_front (void * vaf);
 void * ar_fifo_back  (void * vaf);
 
 
+/* lock-free bounded rings, the size is rounded up to power of 2.
+ * mpmc_ring allows any number of producers and consumers, spsc_ring is
+ * for one producer thread and one consumer thread only.
+ * NULL can not be stored since pop returns NULL when empty.
+ * push returns 0 or -1 when full, the batch calls return the number of
+ * values pushed or popped. the _wait calls block on futex at most ms
+ * milli-seconds, negative ms waits forever */
+
+void * mpmc_ring_new  (int size);
+void   mpmc_ring_free (void * vmr);
+
+int    mpmc_ring_size (void * vmr);
+int    mpmc_ring_num  (void * vmr);
+
+int    mpmc_ring_push (void * vmr, void * value);
+void * mpmc_ring_pop  (void * vmr);
+
+int    mpmc_ring_push_batch (void * vmr, void ** values, int num);
+int    mpmc_ring_pop_batch  (void * vmr, void ** values, int max);
+
+int    mpmc_ring_push_wait (void * vmr, void * value, int ms);
+void * mpmc_ring_pop_wait  (void * vmr, int ms);
+
+void * spsc_ring_new  (int size);
+void   spsc_ring_free (void * vsr);
+
+int    spsc_ring_size (void * vsr);
+int    spsc_ring_num  (void * vsr);
+
+int    spsc_ring_push (void * vsr, void * value);
+void * spsc_ring_pop  (void * vsr);
+
+int    spsc_ring_push_batch (void * vsr, void ** values, int num);
+int    spsc_ring_pop_batch  (void * vsr, void ** values, int max);
+
+int    spsc_ring_push_wait (void * vsr, void * value, int ms);
+void * spsc_ring_pop_wait  (void * vsr, int ms);
+
+
 /******************************************
 FIFO example:
 
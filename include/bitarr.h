@@ -36,9 +36,34 @@ int bitarr_and (bitarr_t * dst, bitarr_t * src);
 int bitarr_or  (bitarr_t * dst, bitarr_t * src);
 int bitarr_xor (bitarr_t * dst, bitarr_t * src);
 
+/* index of the first bit at or after from, or the last bit at or before
+   from, whose value is val. 64 bits are checked in one step, -1 if none */
+int bitarr_next (bitarr_t * bar, int from, int val);
+int bitarr_prev (bitarr_t * bar, int from, int val);
+
+#define bitarr_next_set(bar, from)    bitarr_next(bar, from, 1)
+#define bitarr_next_unset(bar, from)  bitarr_next(bar, from, 0)
+
 int bitarr_filled (bitarr_t * bar);
 int bitarr_zero   (bitarr_t * bar);
 
+/* number of bits set in all, or in num bits from from. the words are
+ * counted by popcnt or AVX2 when the CPU has them */
+int bitarr_count       (bitarr_t * bar);
+int bitarr_count_range (bitarr_t * bar, int from, int num);
+
+/* set num bits from from to val, the array grows if they go beyond */
+int bitarr_set_range   (bitarr_t * bar, int from, int num, int val);
+
+/* rank/select directory built over bar, keeping the ones before every
+ * 512 bits. it is a snapshot, rebuild it after bar is changed.
+ * bitarr_rank returns the number of ones in [0, ind), bitarr_select the
+ * index of the one of rank k counting from 0, or -1 */
+void * bitarr_rank_build (bitarr_t * bar);
+void   bitarr_rank_free  (void * vrank);
+int    bitarr_rank       (void * vrank, int ind);
+int    bitarr_select     (void * vrank, int k);
+
 void bitarr_print (bitarr_t * bar);
 
 int  bit_mask_get (uint32 * bitmap, uint8 ch);
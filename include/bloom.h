@@ -37,19 +37,80 @@ typedef struct bloom_s {
     double      bpe;
 
     uint8     * bitarr;
+    void      * bitmem;
+
+    /* blocked filter sets all bits of a key in one 512-bit block,
+     * a lookup touches one cache line only */
+    uint8       blocked;
+    int64       blocks;
+
+    /* counting filter keeps a 4-bit counter for each position instead of
+     * one bit, keys can be deleted by bloom_del */
+    uint8       counting;
+
+    /* bit array mapped from the file saved by bloom_save */
+    void      * mapbase;
+    int64       maplen;
+
+    /* hash of the double hashing, saved in the file with the seed */
+    uint32      hashkind;
+    uint64      seed;
 
 } bloom_t, *bloom_p;
 
+#define BLOOM_HASH_MURMUR  0
+#define BLOOM_HASH_WY      1
+
 bloom_p  bloom_new (uint64 entries, double error);
+bloom_p  bloom_new_blocked (uint64 entries, double error);
+bloom_p  bloom_new_counting (uint64 entries, double error);
 void     bloom_free (bloom_t * bf);
 
+/* select the hash before any key is added. seed 0 of BLOOM_HASH_WY means
+ * a random one, murmur hash always uses the fixed seed */
+int      bloom_set_hash (bloom_t * bf, int hashkind, uint64 seed);
+
 int      bloom_add   (bloom_t * bf, void * key, int keylen);
 int      bloom_check (bloom_t * bf, void * key, int keylen);
+int      bloom_del   (bloom_t * bf, void * key, int keylen);
+
+int      bloom_check_batch (bloom_t * bf, void ** keys, int * keylens, int num, uint8 * result);
+
+int      bloom_save (bloom_t * bf, char * file);
+bloom_p  bloom_load (char * file, int mapshare);
 
+int      bloom_reset (bloom_t * bf);
 int      blomm_reset (bloom_t * bf);
 
 void     bloom_print (bloom_t * bloom);
 
+
+/* scalable bloom filter chains sub-filters of growing size, the error rate
+ * holds when the keys exceed the entries given to sbloom_new */
+
+#define SBLOOM_MAXNUM  32
+
+typedef struct sbloom_s {
+
+    int64       entries;
+    double      error;
+
+    /* keys added to the newest sub-filter and to all */
+    int64       count;
+    int64       total;
+
+    int         num;
+    bloom_t   * filter[SBLOOM_MAXNUM];
+
+} sbloom_t, *sbloom_p;
+
+sbloom_p sbloom_new  (uint64 entries, double error);
+void     sbloom_free (sbloom_t * sbf);
+
+int      sbloom_add   (sbloom_t * sbf, void * key, int keylen);
+int      sbloom_check (sbloom_t * sbf, void * key, int keylen);
+int      sbloom_reset (sbloom_t * sbf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,15 +28,47 @@ int       bpool_set_freefunc    (bpool_t * pool, void * free);
 int       bpool_set_getsizefunc (bpool_t * pool, void * getsize);
 
 int       bpool_set_unitsize  (bpool_t * pool, int size);
+int       bpool_unitsize      (bpool_t * pool);
 int       bpool_set_allocnum  (bpool_t * pool, int escl);
 int       bpool_set_freesize  (bpool_t * pool, int size);
 
+/* allocate the units aligned to align bytes, a power of 2, such as the
+ * buffers of O_DIRECT I/O. should be set before pool is used */
+int       bpool_set_align     (bpool_t * pool, int align);
+
 void    * bpool_fetch   (bpool_t * pool);
 int       bpool_recycle (bpool_t * pool, void * unit);
 
+/* enable per-thread magazines of depth units in front of the locked pool.
+ * the units cached in magazines are counted as exhausted. depth 0 disables
+ * the magazines. should be set before pool is used */
+int       bpool_set_tlcache (bpool_t * pool, int depth);
+
+/* statistics of the magazine owned by the calling thread. return the number
+ * of units currently cached by it */
+int       bpool_tlcache_stat (bpool_t * pool, ulong * hit, ulong * miss,
+                              ulong * recycle, ulong * flush);
+
+/* NUMA-aware pool keeps one sub-pool for each memory node. the units are
+ * fetched from the sub-pool of the node that the calling thread runs on,
+ * and allocated by that thread, so that their pages are placed on the node
+ * by first-touch. the aligned units are bound to the node by mbind. a unit
+ * is always recycled to the sub-pool it came from, whichever thread
+ * recycles it. the settings of pool are copied to the sub-pools, so it
+ * should be called after setting up pool, before it is used.
+ * return the number of sub-pools, 1 on the single-node machine where it
+ * does nothing, or < 0 on failure */
+int       bpool_set_numa (bpool_t * pool, int on);
+
+/* the statistics of the NUMA-aware pool are summed over all the nodes */
 int       bpool_get_state (bpool_t * pool, int * allocated, int * remaining,
                            int * exhausted, int * fifonum, int * refifonum);
 
+/* the statistics of the sub-pool of node. node 0 is the whole pool if
+ * it's not NUMA-aware. return -2 if node is out of range */
+int       bpool_get_node_state (bpool_t * pool, int node, int * allocated, int * remaining,
+                                int * exhausted, int * fifonum, int * refifonum);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _BPTREE_H_
+#define _BPTREE_H_
+
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* B+tree ordered map with the comparator and callbacks of rbtree_t. the
+ * entries are kept in leaves of BPT_ORDER (key, obj) pairs, leaves are
+ * linked for range scanning, inner nodes hold BPT_ORDER children.
+ *
+ * cmp is called as cmp(obj, key) like rbtree. when cmp is NULL, the keys
+ * are integers cast to pointers and compared as signed long, the search
+ * inside a node is done by AVX2 or NEON if available.
+ *
+ * duplicate keys are allowed, the obj inserted later is placed before the
+ * existing ones with the same key */
+
+#define BPT_ORDER     32
+#define BPT_MAXDEPTH  16
+
+typedef struct BPTNode {
+    uint16           leaf;
+    uint16           num;     //entries of leaf, or separators of inner node
+
+    struct BPTNode * prev;
+    struct BPTNode * next;
+
+    /* leaf: key and obj of entries. inner: key[i] is the separator before
+     * ptr[i+1], the least key (or obj if cmp exists) of that subtree */
+    void           * key[BPT_ORDER];
+    void           * ptr[BPT_ORDER];
+} BPTNode, bptnode_t, *bptnode_p;
+
+typedef struct BPTree {
+    bptnode_t   * root;
+    bptnode_t   * head;
+    bptnode_t   * tail;
+
+    int           num;
+    int           depth;
+    int           nodes;
+
+    rbtcmp_t    * cmp;
+} BPTree, bptree_t, *bptree_p;
+
+
+void * bptree_new  (rbtcmp_t * cmp);
+void   bptree_free (void * vbpt);
+void   bptree_free_all (void * vbpt, int (*freefunc)());
+
+void   bptree_zero (void * vbpt);
+
+int    bptree_num  (void * vbpt);
+
+void * bptree_get  (void * vbpt, void * key);
+int    bptree_mget (void * vbpt, void * key, void ** plist, int listsize);
+
+void * bptree_min (void * vbpt);
+void * bptree_max (void * vbpt);
+
+/* return 1 if inserted, 0 if the same obj with equal key exists */
+int    bptree_insert (void * vbpt, void * key, void * obj);
+
+/* build the tree from num entries sorted by key ascending, the tree must
+ * be empty. the leaves are filled up, return -3 if not sorted */
+int    bptree_load (void * vbpt, void ** keys, void ** objs, int num);
+
+void * bptree_delete  (void * vbpt, void * key);
+int    bptree_mdelete (void * vbpt, void * key, void ** plist, int listnum);
+
+void * bptree_delete_min (void * vbpt);
+void * bptree_delete_max (void * vbpt);
+
+/* callback is called as cb(cbpara, key, obj, index) in key order.
+ * bptree_range visits the entries that lokey <= key <= hikey, a NULL
+ * bound is not limited when cmp exists. return the number visited */
+int    bptree_inorder (void * vbpt, rbtcb_t * cb, void * cbpara);
+int    bptree_range   (void * vbpt, void * lokey, void * hikey, rbtcb_t * cb, void * cbpara);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
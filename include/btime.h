@@ -48,6 +48,42 @@ btime_t btime_diff (btime_t * time0, btime_t * time1);
 /* return the milli-seconds result of 'time1 - time0' */
 long btime_diff_ms (btime_t * time0, btime_t * time1);
 
+
+/* the coarse clock is read from the kernel tick without the hardware
+ * counter, costing some nanoseconds with the resolution of 1-4 ms. it is
+ * fine for log stamps and timeouts but not for latency measurement.
+ * the monotonic clocks count from an unspecified start, never stepped by
+ * the wall clock adjustment, so the timer deadlines and intervals are to
+ * be taken with them. all return micro-seconds as btime does */
+long btime_coarse      (btime_t * tp);
+long btime_mono        (btime_t * tp);
+long btime_mono_coarse (btime_t * tp);
+
+/* get the current monotonic time and add the specified milli-seconds */
+void btime_mono_add    (btime_t * tp, long ms);
+
+/* the CPU cycle counter, rdtsc on x86 and the virtual counter on aarch64,
+ * for sub-microsecond measurement of short intervals. the counter is not
+ * synchronized across sockets on old hardware, so measure on one thread.
+ * btime_cycles_hz calibrates the counter against the monotonic clock on
+ * first call, taking about 10 ms */
+uint64 btime_cycles      ();
+uint64 btime_cycles_hz   ();
+int64  btime_cycles_ns   (uint64 cycles);
+
+
+/* the strings of the current second, formatted by the first caller in a
+ * new second and shared by all threads, so the Date header and the log
+ * timestamp cost no gmtime/localtime per call. the string returned stays
+ * intact for BTIME_SLOTS seconds at least, and *plen returns its length.
+ *   btime_gmtstr:    Sun, 06 Nov 1994 08:49:37 GMT
+ *   btime_localstr:  2018-03-21 19:01:21            */
+
+#define BTIME_SLOTS  64
+
+char * btime_gmtstr   (int * plen);
+char * btime_localstr (int * plen);
+
 #ifdef __cplusplus
 }
 #endif 
@@ -25,6 +25,54 @@ typedef struct byte_iter_ {
 #define iter_back(iter, n)  (((n)<iter_offset(iter))?((iter)->cur-=(n)):((iter)->cur=0))
 #define iter_seekto(iter, n)  (((n)<(iter)->textlen)?((iter)->cur=(n)):((iter)->cur=(iter)->textlen))
 
+/* the integer of byte order at the byte pointer p */
+#define bytes_uint16BE(p)  ((uint16)(((p)[0] << 8) | (p)[1]))
+#define bytes_uint16LE(p)  ((uint16)(((p)[1] << 8) | (p)[0]))
+#define bytes_uint32BE(p)  (((uint32)(p)[0] << 24) | ((uint32)(p)[1] << 16) | \
+                            ((uint32)(p)[2] << 8) | (uint32)(p)[3])
+#define bytes_uint32LE(p)  (((uint32)(p)[3] << 24) | ((uint32)(p)[2] << 16) | \
+                            ((uint32)(p)[1] << 8) | (uint32)(p)[0])
+#define bytes_uint64BE(p)  (((uint64)bytes_uint32BE(p) << 32) | bytes_uint32BE((p) + 4))
+#define bytes_uint64LE(p)  (((uint64)bytes_uint32LE((p) + 4) << 32) | bytes_uint32LE(p))
+
+#define bytes_put16BE(p, v)  ((p)[0] = (uint8)((v) >> 8), (p)[1] = (uint8)(v))
+#define bytes_put16LE(p, v)  ((p)[0] = (uint8)(v), (p)[1] = (uint8)((v) >> 8))
+#define bytes_put32BE(p, v)  ((p)[0] = (uint8)((v) >> 24), (p)[1] = (uint8)((v) >> 16), \
+                              (p)[2] = (uint8)((v) >> 8), (p)[3] = (uint8)(v))
+#define bytes_put32LE(p, v)  ((p)[0] = (uint8)(v), (p)[1] = (uint8)((v) >> 8), \
+                              (p)[2] = (uint8)((v) >> 16), (p)[3] = (uint8)((v) >> 24))
+#define bytes_put64BE(p, v)  (bytes_put32BE(p, (uint32)((uint64)(v) >> 32)), \
+                              bytes_put32BE((p) + 4, (uint32)(v)))
+#define bytes_put64LE(p, v)  (bytes_put32LE(p, (uint32)(v)), \
+                              bytes_put32LE((p) + 4, (uint32)((uint64)(v) >> 32)))
+
+/* the fast access for the codec of many fields: check the room once by
+ * iter_reserve, then put or fetch the fields with no bounds check.
+ * the iter argument is evaluated more than once */
+#define iter_reserve(iter, n)  (iter_rest(iter) >= (n))
+
+#define iter_put_uint8(iter, v)     ((iter)->text[(iter)->cur++] = (uint8)(v))
+#define iter_put_uint16BE(iter, v)  (bytes_put16BE(iter_cur(iter), (uint16)(v)), (iter)->cur += 2)
+#define iter_put_uint16LE(iter, v)  (bytes_put16LE(iter_cur(iter), (uint16)(v)), (iter)->cur += 2)
+#define iter_put_uint32BE(iter, v)  (bytes_put32BE(iter_cur(iter), (uint32)(v)), (iter)->cur += 4)
+#define iter_put_uint32LE(iter, v)  (bytes_put32LE(iter_cur(iter), (uint32)(v)), (iter)->cur += 4)
+#define iter_put_uint64BE(iter, v)  (bytes_put64BE(iter_cur(iter), (uint64)(v)), (iter)->cur += 8)
+#define iter_put_uint64LE(iter, v)  (bytes_put64LE(iter_cur(iter), (uint64)(v)), (iter)->cur += 8)
+
+#define iter_fetch_uint8(iter)     ((iter)->text[(iter)->cur++])
+#define iter_fetch_uint16BE(iter)  ((iter)->cur += 2, bytes_uint16BE(iter_cur(iter) - 2))
+#define iter_fetch_uint16LE(iter)  ((iter)->cur += 2, bytes_uint16LE(iter_cur(iter) - 2))
+#define iter_fetch_uint32BE(iter)  ((iter)->cur += 4, bytes_uint32BE(iter_cur(iter) - 4))
+#define iter_fetch_uint32LE(iter)  ((iter)->cur += 4, bytes_uint32LE(iter_cur(iter) - 4))
+#define iter_fetch_uint64BE(iter)  ((iter)->cur += 8, bytes_uint64BE(iter_cur(iter) - 8))
+#define iter_fetch_uint64LE(iter)  ((iter)->cur += 8, bytes_uint64LE(iter_cur(iter) - 8))
+
+/* zigzag maps the signed to unsigned, 0, -1, 1, -2 ... to 0, 1, 2, 3 ... */
+#define zigzag_encode(v)  (((uint64)(v) << 1) ^ (uint64)((int64)(v) >> 63))
+#define zigzag_decode(u)  ((int64)((uint64)(u) >> 1) ^ -(int64)((u) & 1))
+
+#define VARINT_MAX  10
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -62,6 +110,24 @@ int iter_set_uint32LE (ByteIter * iter, uint32 val);
 int iter_set_uint64BE (ByteIter * iter, uint64 val);
 int iter_set_uint64LE (ByteIter * iter, uint64 val);
 
+/* LEB128 varint, 7 bits per byte from the low, the high bit set if one
+ * more byte follows. the signed is zigzag encoded first. get returns -100
+ * if the varint is cut off, -101 if it is longer than VARINT_MAX bytes */
+int iter_varint_size  (uint64 val);
+int iter_get_varint   (ByteIter * iter, uint64 * pval);
+int iter_set_varint   (ByteIter * iter, uint64 val);
+int iter_get_svarint  (ByteIter * iter, int64 * pval);
+int iter_set_svarint  (ByteIter * iter, int64 val);
+
+/* get or set num integers of big endian if bigendian is set, little endian
+ * otherwise. nothing is done and -100 returned if the rest is not enough */
+int iter_get_uint16_array (ByteIter * iter, uint16 * vals, int num, int bigendian);
+int iter_get_uint32_array (ByteIter * iter, uint32 * vals, int num, int bigendian);
+int iter_get_uint64_array (ByteIter * iter, uint64 * vals, int num, int bigendian);
+int iter_set_uint16_array (ByteIter * iter, uint16 * vals, int num, int bigendian);
+int iter_set_uint32_array (ByteIter * iter, uint32 * vals, int num, int bigendian);
+int iter_set_uint64_array (ByteIter * iter, uint64 * vals, int num, int bigendian);
+
 
 /* skip to next, once any char of the given char array is encountered, stop skipping*/
 int iter_skipTo (ByteIter * iter, uint8 * chs, int charnum);
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _CHARCONV_H_
+#define _CHARCONV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UNIX
+
+/* converter of charset pair, opened once and used for many conversions.
+ * GBK, GB2312, GB18030 and BIG5 from and to UTF-8 are transcoded by the
+ * code tables, which are built from iconv on first use and shared by all
+ * the converters of process. the other pairs
+ * go through the iconv handle kept open in the converter.
+ *
+ * the converter is a stream: if the input ends within a multibyte char,
+ * the incomplete bytes are kept and completed by the next call unless it
+ * is the last. the invalid or unmapped bytes are copied through as they
+ * are, the same as conv_charset does.
+ *
+ * charconv_get returns the converter of the pair from the cache of the
+ * calling thread, which keeps the last CHARCONV_CACHE pairs. it is reset
+ * for the new conversion and owned by the cache, never closed by caller */
+
+#define CHARCONV_CACHE  8
+
+void * charconv_open  (char * srcchset, char * dstchset);
+void   charconv_close (void * vconv);
+
+/* drop the kept incomplete bytes and the iconv shift state */
+void   charconv_reset (void * vconv);
+
+void * charconv_get   (char * srcchset, char * dstchset);
+
+/* convert srclen bytes at psrc into pdst of *dstlen bytes, *dstlen returns
+ * the bytes written. last set flushes the kept bytes at the end.
+ * return the source bytes taken, which is less than srclen if pdst filled
+ * up, or < 0 on failure */
+int    charconv_run   (void * vconv, void * psrc, int srclen, void * pdst, int * dstlen, int last);
+
+/* convert and append to the end of frame, return the bytes appended */
+int    charconv_frame (void * vconv, void * psrc, int srclen, frame_p dst, int last);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -32,6 +32,18 @@ int coding_gbk_check     (void * pbyte, int len);
 int coding_gb18030_check (void * pbyte, int len);
 int coding_utf8_check    (void * pbyte, int len);
 
+/* validate the whole byte stream, return the length of the longest valid
+ * prefix, which is len if all valid, or the offset of the first bad char.
+ * coding_utf8_valid is strict as RFC 3629, rejecting overlong forms,
+ * surrogates and values beyond U+10FFFF, and runs the SIMD lookup of
+ * Keiser and Lemire. the ASCII runs are skipped a block at a time */
+int coding_utf8_valid    (void * pbyte, int len);
+int coding_gbk_valid     (void * pbyte, int len);
+int coding_gb18030_valid (void * pbyte, int len);
+
+/* the length of the leading run of ASCII bytes */
+int coding_ascii_span    (void * pbyte, int len);
+
 int coding_string_trunc (void * psrc, int srclen, void * pdst, int dstlen, int chset);
 
 int coding_charset_scan  (void * pbyte, int len, int * ascii, int * unicode, int * utf8,
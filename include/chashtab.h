@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _CHASHTAB_H_
+#define _CHASHTAB_H_
+
+#include "hashtab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* concurrent hash table with the callback model of hashtab_t. the
+ * comparing function is called as cmp(value, key), the hash function as
+ * hashfunc(key), the default one is the case-insensitive string hash.
+ *
+ * writers lock one of CHT_STRIPES spinlocks chosen by the hash value,
+ * readers take no lock, they walk the chains in an epoch read section and
+ * the removed nodes are freed after the grace period. the bucket table
+ * grows to double size when the load factor exceeds the limit, the buckets
+ * are moved to the new table a few at a time by the writers.
+ *
+ * the values are owned by the caller. a value got by cht_get may be
+ * deleted by other threads at the same time, so its lifetime should be
+ * managed by the caller, such as by reference count */
+
+#define CHT_STRIPES        256
+#define CHT_LOAD_LIMIT     100
+#define CHT_REHASH_STEP    4
+
+void * cht_new  (int num, HashTabCmp * cmp);
+void   cht_free (void * vcht);
+
+/* free the values by vfunc and the table */
+void   cht_free_all (void * vcht, void * vfunc);
+
+void   cht_set_hash_func  (void * vcht, HashFunc * hashfunc);
+void   cht_set_load_limit (void * vcht, int percent);
+
+int    cht_num (void * vcht);
+int    cht_len (void * vcht);
+
+void * cht_get (void * vcht, void * key);
+
+/* return 0 if value is added, 1 if the key exists and nothing changed */
+int    cht_set (void * vcht, void * key, void * value);
+
+/* add value if the key does not exist. return the existing value,
+ * or value itself when added */
+void * cht_get_or_set (void * vcht, void * key, void * value);
+
+/* set value for the key, return the replaced old value or NULL if added */
+void * cht_replace (void * vcht, void * key, void * value);
+
+void * cht_delete (void * vcht, void * key);
+
+/* the values added or deleted during traversing may be missed */
+void   cht_traverse (void * vcht, void * usrInfo, void (*check)(void *, void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
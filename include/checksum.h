@@ -24,6 +24,19 @@ extern "C" {
 */
 uint32 calcrc32 (uint32 crc, uint8 * buf, uint32 len);
 
+/* CRC-32C with the Castagnoli polynomial, same usage as calcrc32 */
+uint32 calcrc32c (uint32 crc, uint8 * buf, uint32 len);
+
+/*
+   Combine two CRC-32 (CRC-32C) check values into one. For two sequences
+   of bytes seq1 and seq2 with lengths len1 and len2, check values were
+   calculated for each, crc1 and crc2. return the check value of seq1 and
+   seq2 concatenated, requiring only crc1, crc2 and len2. so the pieces of
+   a large buffer can be checksummed in parallel.
+*/
+uint32 crc32_combine (uint32 crc1, uint32 crc2, int64 len2);
+uint32 crc32c_combine (uint32 crc1, uint32 crc2, int64 len2);
+
 
 /*
    Update a running Adler-32 checksum with the bytes buf[0..len-1] and
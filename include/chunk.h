@@ -134,6 +134,20 @@ typedef struct chunk_ {
 
     int64           seekpos;
 
+    /* cumulative end offsets of entities, an index for locating position.
+     * entend[idxhead + i] is the end offset of entity i in entity_list,
+     * ckend is that in HTTP chunk format. the first idxnum entities are
+     * indexed, the appended ones are indexed on next lookup */
+    int64         * entend;
+    int64         * ckend;
+    int             idxhead;
+    int             idxnum;
+    int             idxsize;
+
+    /* the file entities are accessed by mapping windows of mapwin bytes */
+    int64           mapwin;
+    uint8           mapadvise;
+
     uint8         * loadbuf;
     int             lblen;
     int             lbsize;
@@ -141,6 +155,18 @@ typedef struct chunk_ {
     ProcessNotify * procnotify;
     void          * procnotifypara;
 
+    /* the deflating stage set by chunk_set_zip */
+    void          * zip;
+
+    /* the small buffers coalesced by chunk_set_coalesce, not in
+     * entity_list till flushed. pendtime is in micro-seconds of the
+     * coarse monotonic clock */
+    uint8         * pend;
+    int             pendlen;
+    int             pendmax;
+    int             pendwait;
+    long            pendtime;
+
 } chunk_t, *chunk_p;
 
 void * chunk_new   (int buflen);
@@ -179,6 +205,11 @@ int    chunk_go_ahead (void * vck, void * msg, int64 offset, int64 step);
 int    chunk_add_buffer       (void * vck, void * pbuf, int64 len);
 int    chunk_add_strip_buffer (void * vck, void * pbuf, int64 len, char * escch, int chlen);
 
+/* add the base64 of pbuf as a buffer entity, encoded from pbuf directly.
+ * st of base64_state_t carries the octets not making a triplet over the
+ * calls of a stream, and last pads the end. NULL st encodes pbuf alone */
+int    chunk_add_base64       (void * vck, void * st, void * pbuf, int64 len, int last);
+
 int    chunk_prepend_bufptr (void * vck, void * pbuf, int64 len, uint8 isheader);
 int    chunk_add_bufptr     (void * vck, void * pbuf, int64 len, void * porig);
 int    chunk_remove_bufptr  (void * vck, void * pbuf);
@@ -194,8 +225,55 @@ int    chunk_add_cbdata (void * vck, void * fetchfunc, void * fetchobj, int64 of
 
 int    chunk_add_process_notify (void * vck, void * movefunc, void * movepara);
 
+/* the file entities read by chunk_at, chunk_ptr and the scanning routines are
+ * mapped in windows of winsize bytes aligned to winsize, CHUNK_MAPWIN if 0.
+ * a window is kept till the position moves out of it. if advise is not 0,
+ * the window is advised as sequential and the next window in the moving
+ * direction is read ahead asynchronously */
+#define CHUNK_MAPWIN  (2048*1024)
+
+int    chunk_set_mapwin (void * vck, int64 winsize, int advise);
+
+/* coalesce the buffers shorter than maxsize added by chunk_add_buffer into
+ * one entity of up to maxsize bytes, so that a stream of tiny writes, such
+ * as the events of SSE, goes out as a few HTTP chunks with one size line
+ * each, instead of one entity and 3 iovecs per write. the pending bytes
+ * are not part of the chunk till flushed: when maxsize is reached, another
+ * kind of entity is added, by chunk_set_end or chunk_flush, or when the
+ * chunk is read after they waited latency milli-seconds. latency 0 flushes
+ * at each read, so the writes between two sends are merged. maxsize 0
+ * turns it off. chunk_flush_timeout returns the milli-seconds till the
+ * pending bytes are due, 0 if due now, -1 if none pending, for the caller
+ * to arm the timer of sending */
+int    chunk_set_coalesce  (void * vck, int maxsize, int latency);
+int    chunk_flush         (void * vck);
+int    chunk_flush_timeout (void * vck);
+
 int    chunk_remove (void * vck, int64 pos, int httpchunk);
 
+/* compress the content of chunk lazily as it is read by chunk_read,
+ * chunk_read_ptr, chunk_vec_get and chunk_writev. the entities added so
+ * far, except the header entities, become the source of the stream, which
+ * can't be added to afterwards. the buffer, file and callback entities are
+ * deflated block by block, no more than CHUNK_ZIP_WINDOW compressed bytes
+ * ahead of the read position, and the source entities deflated are freed.
+ * chunk_remove releases the output sent. the size of chunk grows with the
+ * output and the end is set when the stream finishes, so it is sent in
+ * HTTP chunk format or without Content-Length.
+ *
+ * if cachedir is given and the source is one whole file by chunk_is_file,
+ * the output is also saved into cachedir, named by the inode, mtime and
+ * size of the file. once saved, the compressed file is added as a file
+ * entity instead of compressing again, and 1 is returned with the size
+ * known. level is 0-9 of zlib, -1 for the default */
+#define CHUNK_ZIP_GZIP     1
+#define CHUNK_ZIP_DEFLATE  2   //zlib format of HTTP Content-Encoding deflate
+#define CHUNK_ZIP_RAW      3
+
+#define CHUNK_ZIP_WINDOW   (256*1024)
+
+int    chunk_set_zip (void * vck, int ziptype, int level, char * cachedir);
+
 
 typedef struct {
     uint8         vectype;  //0-unknown  1-mem buffer  1-file
@@ -216,6 +294,22 @@ int    chunk_vec_get (void * vck, int64 pos, chunk_vec_t * pvec, int httpchunk);
 
 int    chunk_writev (void * vck, int fd, int64 offset, int64 * actnum, int httpchunk);
 
+/* zerocopy send context of one socket. the buffers of chunk_add_bufptr in
+ * a large run are sent with MSG_ZEROCOPY, porig is passed to relfunc when
+ * kernel completes with it, or after sent if done by copy. on the systems
+ * without MSG_ZEROCOPY, all are sent by copy */
+typedef void ZeroCopyRelease (void * para, void * porig);
+
+void * chunk_zc_new     (SOCKET fd, ZeroCopyRelease * relfunc, void * relpara);
+void   chunk_zc_free    (void * vzc);
+int    chunk_zc_enabled (void * vzc);
+int    chunk_zc_pending (void * vzc);
+
+/* should be called when socket reports error-queue readable (EPOLLERR) */
+int    chunk_zc_reap    (void * vzc);
+
+int    chunk_writev_zc  (void * vck, void * vzc, int64 offset, int64 * actnum, int httpchunk);
+
 /* access the content of chunk for getting char at offset, pattern matching etc */
 
 typedef struct ckpos_vec {
@@ -39,6 +39,40 @@ int     conf_set_hexlong  (void * conf, char * sect, char * key, long value);
 int     conf_set_double   (void * conf, char * sect, char * key, double value);
 int     conf_set_bool     (void * conf, char * sect, char * key, uint8 value);
 
+/* conf_compile parses the values of all the keys found by conf_get_xxx into
+ * a hashed table of typed values, once. conf_lookup gives the handle of a
+ * key, negative if not found, and conf_hget_xxx reads the value by handle
+ * with no string compare or convert, returning what conf_get_xxx returns.
+ * the calls of conf_set_xxx take effect on the handles after conf_compile
+ * again, which is not safe with the readers using the conf at the time.
+ * a handle keeps naming the same key in the conf compiled again and in the
+ * snapshots reloaded by conf_snap_reload, a key gone reads as missing.
+ * conf_snap_new and conf_snap_reload compile the conf they publish */
+typedef int conf_handle_t;
+
+int           conf_compile  (void * conf);
+conf_handle_t conf_lookup   (void * conf, char * sect, char * key);
+
+char  * conf_hget_string  (void * conf, conf_handle_t h);
+int     conf_hget_int     (void * conf, conf_handle_t h);
+uint32  conf_hget_ulong   (void * conf, conf_handle_t h);
+long    conf_hget_hexlong (void * conf, conf_handle_t h);
+double  conf_hget_double  (void * conf, conf_handle_t h);
+uint8   conf_hget_bool    (void * conf, conf_handle_t h);
+
+/* versioned snapshots for hot reload. readers get the current conf between
+ * conf_snap_enter and conf_snap_leave without lock, and use conf_get_xxx
+ * on it. the strings got are valid till conf_snap_leave.
+ * conf_snap_reload builds a new conf from file and publishes it, the old
+ * one is freed after all readers using it have left. file NULL means the
+ * file of current snapshot */
+void  * conf_snap_new     (char * file);
+int     conf_snap_free    (void * vsnap);
+int     conf_snap_reload  (void * vsnap, char * file);
+
+void  * conf_snap_enter   (void * vsnap);
+void    conf_snap_leave   (void * vsnap);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _DABUILD_H_
+#define _DABUILD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* builder of double-array trie. the transition of state s by code c goes
+ * to t = unit[s].base + c if unit[t].check == s, codes start from 1 and
+ * the root is the state 0. leaf states have base 0.
+ *
+ * the free slots are linked in ascending order, a slot failing too many
+ * times as the slot of the first child is dropped from the list, this keeps
+ * the base searching short at the cost of a few unused slots.
+ *
+ * besides the units, up to DAB_MAXEXT int32 arrays are kept as long as the
+ * units for the per-state data, the new slots of them are set to the given
+ * initial values when the arrays grow */
+
+#define DAB_MAXEXT   4
+#define DAB_MAXTRY   16
+
+typedef struct daunit_ {
+    int32      base;
+    int32      check;
+} daunit_t;
+
+typedef struct dabuild_ {
+    daunit_t  * unit;
+    int32     * ext[DAB_MAXEXT];
+    int32       extinit[DAB_MAXEXT];
+    int         extnum;
+
+    uint8     * used;
+    uint8     * tried;
+    int32     * nextfree;
+    int32     * prevfree;
+    int32       freehead;
+    int32       freetail;
+
+    int         size;
+    int         maxslot;
+    int         maxbase;
+} dabuild_t;
+
+/* the root slot 0 is taken at init */
+int  dab_init (dabuild_t * bd, int extnum, int32 * extinit);
+void dab_free (dabuild_t * bd);
+
+/* make the arrays hold the slot need */
+int  dab_grow (dabuild_t * bd, int64 need);
+
+/* find a base for the children codes in ascending order, the slots
+ * base + codes[i] are taken, the check of them is set to parent */
+int  dab_place (dabuild_t * bd, int parent, int * codes, int num);
+
+/* the array size that any base + code of maxcode stays inside */
+int  dab_size (dabuild_t * bd, int maxcode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
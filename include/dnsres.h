@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifdef UNIX
+
+#ifndef _DNSRES_H_
+#define _DNSRES_H_
+
+#include "tsock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* non-blocking DNS resolver as a UDP client of the nameservers in
+ * resolv.conf, instead of calling getaddrinfo on the caller's thread.
+ * A and AAAA are queried together, and a thread of the resolver receives
+ * the answers and retries the queries timed out on the next nameserver.
+ *
+ * the answers are cached by name for the least TTL of the records, in
+ * shards of their own locks, and the names of /etc/hosts never expire.
+ * names that don't exist are cached for negttl seconds. the lookups of
+ * one name while its query is in flight wait for that query instead of
+ * sending another one. numeric addresses are parsed without a query.
+ *
+ * the search domains of resolv.conf are not applied, the names are looked
+ * up as they are given */
+
+#define DNS_OK          0
+#define DNS_ENOTFOUND  -1     //name doesn't exist or has no address
+#define DNS_ETIMEOUT   -2     //no answer from all the nameservers
+#define DNS_ESERVER    -3     //nameservers failed or refused
+#define DNS_ENOMEM     -4
+
+#define DNS_NS_MAX      8
+
+/* addr is the list of num addresses as sock_addr_acquire gives, IPv4 ones
+ * first, each with port and socktype of the lookup. it's freed after the
+ * callback returns, the callback keeps it by copying *addr and setting
+ * addr->next NULL, then frees it by sock_addr_freenext */
+typedef void DnsResolveCB (void * para, char * host, ep_sockaddr_t * addr, int num, int err);
+
+/* resolvconf NULL means /etc/resolv.conf, 127.0.0.1 is used if it gives no
+ * nameserver. timeout is the milli-seconds of one try, retries the tries
+ * more before DNS_ETIMEOUT. the values <= 0 take 2000 ms and 2 */
+void * dns_resolver_new  (char * resolvconf, int timeout, int retries);
+void   dns_resolver_free (void * vres);
+
+/* replace the nameservers of resolv.conf with ip:port added one by one */
+int    dns_nameserver_add (void * vres, char * ip, int port);
+
+/* seconds a name not found is cached, and the most seconds of a TTL */
+void   dns_ttl_set (void * vres, int negttl, int maxttl);
+
+/* look up host. the callback is called before return if the answer is in
+ * the cache or host is numeric, and 1 is returned. otherwise 0 returns and
+ * the callback is called by the resolver thread when the query finishes.
+ * return < 0 on error without calling back */
+int    dns_resolve (void * vres, char * host, int port, int socktype,
+                    DnsResolveCB * cb, void * para);
+
+/* wait at most ms for the lookup and fill addr as sock_addr_acquire does,
+ * return the number of addresses or the error < 0 */
+int    dns_resolve_wait (void * vres, ep_sockaddr_t * addr, char * host, int port,
+                         int socktype, int ms);
+
+/* remove host from the cache, or all the names resolved if host is NULL */
+void   dns_cache_flush (void * vres, char * host);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#endif
+
@@ -51,11 +51,28 @@ arr_t * arr_dup(arr_t * ar);
 /* call qsort to sort all the members with given comparing function */
 void arr_sort_by (arr_t * ar, ArrCmp * cmp);
 
+/* sort num units of size bytes like qsort by the workers of thpool_t and
+ * the calling thread, cmp gets the pointers to units. it is a merge sort
+ * of the runs sorted by qsort, and qsort when pool is NULL or num is small */
+int  qsort_parallel (void * base, long num, int size, int (*cmp)(void *, void *), void * pool);
+
+/* same as arr_sort_by, the sorting is parallelized in pool */
+void arr_psort_by (arr_t * ar, ArrCmp * cmp, void * pool);
+
+/* merge the members of num arrays sorted by cmp into one new array. the
+ * members are not duplicated, equal ones are taken in order of lists */
+arr_t * arr_merge (arr_t ** lists, int num, ArrCmp * cmp);
+
 
 /* the array should be sorted beforehand, or the member count is not greater
  *  than 1. seek a position that suits for the new member, and insert it */
 int arr_insert_by (arr_t * ar, void * item, ArrCmp * cmp);
 
+/* insert num items into the sorted array, cmp gets the members like
+ * arr_insert_by. the batch is sorted and merged from the end by galloping,
+ * each member is moved once. return the number of members */
+int arr_insert_batch_by (arr_t * ar, void ** items, int num, ArrCmp * cmp);
+
 
 int arr_findloc_by (arr_t * ar, void * pattern, ArrCmp * cmp, int * found);
 
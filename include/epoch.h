@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* epoch based reclamation for read-mostly data. readers bracket their use
+ * of a published object by epoch_enter/epoch_leave which only store the
+ * current epoch into the record of calling thread. writers build a new
+ * object, publish it by epoch_publish, and the old one is freed once all
+ * the readers that might see it have left.
+ *
+ *     ep = epoch_new();
+ *
+ *     reader:                        writer:
+ *     epoch_enter(ep);               newtab = build_table();
+ *     tab = epoch_deref(&g_tab);     epoch_publish(ep, &g_tab, newtab, table_free);
+ *     ... use tab ...
+ *     epoch_leave(ep);
+ *
+ * the read sections can be nested, and must not call epoch_synchronize */
+
+void * epoch_new  ();
+
+/* the objects retired are freed at once, readers should have gone */
+void   epoch_free (void * vep);
+
+void   epoch_enter (void * vep);
+void   epoch_leave (void * vep);
+
+/* freefunc is called as freefunc(obj) after the grace period */
+int    epoch_retire (void * vep, void * obj, void * freefunc);
+
+/* free the retired objects that no reader can see, return the number freed */
+int    epoch_reclaim (void * vep);
+
+/* wait till the readers entered before have left, then reclaim */
+void   epoch_synchronize (void * vep);
+
+/* replace the pointer in *slot with obj, retire the old one by freefunc */
+int    epoch_publish (void * vep, void ** slot, void * obj, void * freefunc);
+
+#define epoch_deref(slot) __atomic_load_n((void **)(slot), __ATOMIC_ACQUIRE)
+
+int    epoch_retired (void * vep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
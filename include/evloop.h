@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* reactor of non-blocking sockets. readiness is waited by epoll in
+ * edge-triggered mode on Linux and by kqueue with EV_CLEAR on FreeBSD and
+ * OSX. each loop drains the readable socket into the read frame of
+ * connection with frame_tcp_nbzc_recv, flushes the pending send frame
+ * when writable, and fires the btime_t based timers between the waits.
+ *
+ * one loop is run by one thread. evloop_pool starts a loop per core, the
+ * listening socket is accepted in one loop and the new connections can be
+ * spread to others by evloop_pool_next.
+ *
+ * evconn_add, evtimer_add and evloop_stop may be called from any thread,
+ * other evconn calls must be made in the thread running the loop */
+
+#define EV_READ      0x01   //data appended into evconn_rcvfrm
+#define EV_WRITE     0x02   //send frame is flushed, more can be sent
+#define EV_CLOSE     0x04   //peer closed or socket error, conn is freed after callback
+
+#define EVLOOP_MAXEVENTS  1024
+
+/* return negative to close the connection */
+typedef int EvConnCB   (void * para, void * conn, int event);
+
+/* the accepted fd is non-blocking, return negative to close it */
+typedef int EvAcceptCB (void * para, void * listener, SOCKET fd);
+
+/* the timer is freed after callback returns */
+typedef int EvTimerCB  (void * para, void * timer);
+
+/* the connections and listeners still open are not closed by evloop_free */
+void * evloop_new  (int maxevents);
+void   evloop_free (void * vloop);
+
+/* wait for events at most waitms, or till the nearest timer expires,
+ * return the number of events and timers handled */
+int    evloop_once (void * vloop, int waitms);
+int    evloop_run  (void * vloop);
+void   evloop_stop (void * vloop);
+
+int    evloop_conns (void * vloop);
+
+
+void * evconn_add   (void * vloop, SOCKET fd, EvConnCB * cb, void * para);
+void * evlisten_add (void * vloop, SOCKET fd, EvAcceptCB * cb, void * para);
+
+/* the socket is closed and conn is freed in the end of current iteration */
+int    evconn_close (void * vconn);
+
+/* the bytes that can not be sent now are kept and flushed when writable.
+ * return the bytes sent immediately or negative on socket error */
+int    evconn_send  (void * vconn, void * pbyte, int len);
+int    evconn_sendfrm (void * vconn, frame_p frm);
+int    evconn_pending (void * vconn);
+
+SOCKET   evconn_fd     (void * vconn);
+frame_p  evconn_rcvfrm (void * vconn);
+void   * evconn_para   (void * vconn);
+void   * evconn_loop   (void * vconn);
+
+
+void * evtimer_add (void * vloop, long ms, EvTimerCB * cb, void * para);
+
+/* cancel the timer that has not fired yet */
+int    evtimer_del (void * vtimer);
+
+
+/* run num loops in their own threads, each is bound to one CPU core.
+ * num <= 0 means the number of online CPUs */
+void * evloop_pool_new  (int num, int maxevents);
+void   evloop_pool_free (void * vpool);
+
+int    evloop_pool_num  (void * vpool);
+void * evloop_pool_get  (void * vpool, int index);
+void * evloop_pool_next (void * vpool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
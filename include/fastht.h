@@ -14,6 +14,12 @@ extern "C" {
 #define HASH_A  1
 #define HASH_B 2
 
+/* wyhash based, HASH_WY_A and HASH_WY_B are the two halves of one 64-bit
+ * hash, HASH_WY_OFFSET is an independent one. case-insensitive as above */
+#define HASH_WY_OFFSET  3
+#define HASH_WY_A       4
+#define HASH_WY_B       5
+
 #pragma pack(push ,1)
 
 typedef struct fash_hash_node {
@@ -35,6 +41,15 @@ typedef struct fash_hash_tab {
     int            num;
     FastHashNode * ptab;
 
+    /* hash by wyhash with the seed instead of the crypt table */
+    uint8          wyhash;
+    uint64         seed;
+
+    /* read-only image loaded by fast_ht_mmap_load, ptab is NULL then */
+    void         * image;
+    ulong          imagelen;
+    uint8          mapped;
+
 } FastHashTab;
 
 
@@ -43,6 +58,10 @@ uint32 fast_hash_func (void * key, int keylen, int hashtype);
 void * fast_ht_new (ulong size);
 void   fast_ht_free (void * vht);
 
+/* hash the keys by wyhash with seed, 0 means a random one. it must be set
+ * before any value is stored */
+int    fast_ht_set_wyhash (void * vht, uint64 seed);
+
 void   fast_ht_free_all (void * vht, void * vfunc);
 void   fast_ht_free_member (void * vht, void * vfunc);
 void   fast_ht_zero    (void * vht);
@@ -53,6 +72,38 @@ void * fast_ht_get (void * vht, void * key, int keylen, void ** pval, int * vall
 int    fast_ht_set (void * vht, void * key, int keylen, void * value, int valuelen);
 void * fast_ht_del (void * vht, void * key, int keylen, void ** pval, int * vallen);
 
+/* look up num keys, keylens NULL means the keys are strings. vals[i] and
+ * vallens[i] get the result of keys[i] as fast_ht_get gives, vallens may
+ * be NULL. the home slots of each group of keys are prefetched before they
+ * are probed. return the number of keys found */
+int    fast_ht_get_batch (void * vht, void ** keys, int * keylens, int num,
+                          void ** vals, int * vallens);
+
+
+/* the image saved is position-independent: a header, the slot array and
+ * the value bytes located by offsets. the values of valuelen > 0 are saved
+ * as valuelen bytes, the others as the pointer value itself, which only
+ * makes sense for the integers stored as pointers. integers are in host
+ * byte order. return 0 on success, negative on failure */
+int    fast_ht_save (void * vht, char * file);
+
+/* map the saved image read-only and serve fast_ht_get from the mapped
+ * pages, which are shared by all the processes mapping the same file.
+ * the values returned point into the image. fast_ht_set and fast_ht_del
+ * fail on it, fast_ht_free unmaps it. populate reads all the pages in
+ * at once, otherwise they are faulted in by the lookups. the image is read
+ * into memory where mmap is not available */
+void * fast_ht_mmap_load (char * file, int populate);
+
+/* save the values of hashtab as an image of byte-string keys loaded by
+ * fast_ht_mmap_load. func gives the key and the value bytes of each value,
+ * or returns < 0 to skip it. the keys are kept in the image and compared
+ * case-insensitively by fast_ht_get, as the hash is. seed 0 means a random
+ * one */
+typedef int (FastHtDump) (void * value, void ** pkey, int * keylen, void ** pval, int * vallen);
+
+int    fast_ht_save_hashtab (void * vht, FastHtDump * func, uint64 seed, char * file);
+
 #ifdef __cplusplus
 }
 #endif
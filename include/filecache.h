@@ -24,6 +24,11 @@ int file_cache_setbuf  (void * vcache, void * pbuf, int buflen, int packsize);
 int file_cache_setfile (void * vcache, char * file, int64 offset);
 int file_cache_setcdn (void * vcache, void * pmedia, int64 offset, uint64 msize, void * cdnread);
 
+/* start a loader thread that keeps the next packs after the read position
+ * loaded in the background, so that reading does not stall on the pack
+ * boundaries. packs <= 0 stops the thread and loads the packs in place */
+int file_cache_set_prefetch (void * vcache, int packs);
+
 int file_cache_seek (void * vcache, int64 offset);
 int file_cache_at   (void * vcache, int64 offset);
 int file_cache_read (void * vcache, void * destbuf, int len, int nbmode);
@@ -47,6 +52,7 @@ long file_cache_rskip_over (void * vcache, long pos, int skiplimit, void * pat,
 
     fca = file_cache_init(12, 8192);
     file_cache_setfile(fca, "./zhizhuxia.mp4", 0);
+    file_cache_set_prefetch(fca, 4);
 
     file_cache_seek(fca, 133489L);
     file_cache_recv(fca, buf, 16384, 0);
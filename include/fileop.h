@@ -16,6 +16,9 @@
 
 #define SENDFILE_MAXSIZE  2147479552L
 
+/* bytes copied between two calls of the progress callback */
+#define FILE_COPY_STEP    (64*1024*1024)
+
 #ifdef __cplusplus
 extern "C" {
 #endif 
@@ -26,6 +29,17 @@ int filefd_write  (int fd, void * pbuf, int size);
 int filefd_writev (int fd, void * piov, int iovcnt, int64 * actnum);
 int filefd_copy   (int fdin, off_t offset, size_t length, int fdout, int64 * actnum);
 
+/* called every FILE_COPY_STEP bytes and at the end of copying, copying
+ * stops with -600 returned if the callback returns not zero */
+typedef int FileCopyProgress (void * para, int64 copied, int64 total);
+
+/* when fdout is a regular file, the range is reflinked with FICLONERANGE
+ * first, then copied in kernel with copy_file_range, both at the current
+ * offset of fdout. sendfile is used if the file system does not support
+ * them, and read/write loop at last */
+int filefd_copy_progress (int fdin, off_t offset, size_t length, int fdout, int64 * actnum,
+                          void * progress, void * para);
+
 long  file_read  (FILE * fp, void * buf, long readlen);
 long  file_write (FILE * fp, void * buf, long writelen);
 int64 file_seek  (FILE * fp, int64 pos, int whence);
@@ -45,6 +59,8 @@ int file_rollover (char * fname, int line);
 int file_lines (char * file);
 
 int file_copy (char * srcfile, off_t offset, size_t length, char * dstfile, int64 * actnum);
+int file_copy_progress (char * srcfile, off_t offset, size_t length, char * dstfile, int64 * actnum,
+                        void * progress, void * para);
 int file_copy2fp (char * srcfile, off_t offset, size_t length, FILE * fpout, int64 * actnum);
 
 int file_conv_charset (char * srcchst, char * dstchst, char * srcfile, char * dstfile);
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _FLAT_HTAB_H_
+#define _FLAT_HTAB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* flat hash table with open addressing. the control bytes are stored in a
+ * separate array, each one holding 7 bits of the key hash or FLAT_HT_EMPTY.
+ * 16 control bytes are compared at once via SSE2/NEON when looking up.
+ * linear probing is used and deletion shifts the following slots backward,
+ * so no tombstone is left. table doubles when load exceeds 7/8.
+ *
+ * like fastht, the key content is not stored. a key is identified by its
+ * 64-bit hash and an additional 32-bit check hash. the key is case-sensitive */
+
+#define FLAT_HT_GROUP  16
+#define FLAT_HT_EMPTY  0x80
+
+typedef struct flat_hash_slot {
+    uint64    hash;
+    uint32    check;
+    int       valuelen;
+    void    * value;
+} FlatHashSlot;
+
+typedef struct flat_hash_tab {
+
+    ulong          reqsize;
+    ulong          size;    /* power of 2 */
+    ulong          mask;
+
+    ulong          num;
+    ulong          growth_left;
+
+    /* size + FLAT_HT_GROUP bytes, the first group is mirrored at the end */
+    uint8        * ctrl;
+    FlatHashSlot * slots;
+
+} FlatHashTab;
+
+
+void * flat_ht_new (ulong size);
+void   flat_ht_free (void * vht);
+
+void   flat_ht_free_all (void * vht, void * vfunc);
+void   flat_ht_free_member (void * vht, void * vfunc);
+void   flat_ht_zero    (void * vht);
+
+int    flat_ht_num (void * vht);
+
+/* enlarge the table so that num entries can be stored without resizing */
+int    flat_ht_reserve (void * vht, ulong num);
+
+void * flat_ht_get (void * vht, void * key, int keylen, void ** pval, int * vallen);
+int    flat_ht_set (void * vht, void * key, int keylen, void * value, int valuelen);
+void * flat_ht_del (void * vht, void * key, int keylen, void ** pval, int * vallen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
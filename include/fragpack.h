@@ -7,7 +7,9 @@
 #define _FRAG_PACK_H_
 
 #include "mthread.h"
-#include "vstar.h"
+#include "rbtree.h"
+#include "mpool.h"
+#include "bitarr.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +20,14 @@ typedef struct frag_item {
     int64    length;
 } FragItem;
  
+/* the received ranges are coalesced and kept in a red-black tree ordered by
+ * offset, so adding, deleting and looking up are O(log n) with tens of
+ * thousands of fragments. the nodes are fetched from the mpool of pack.
+ *
+ * when the data are received in fixed-size blocks and the length is known,
+ * frag_pack_set_block switches the pack to a bitmap of blocks, a range is
+ * recorded only when it covers whole blocks then. */
+
 typedef struct FragPack_ {
 
     uint8              complete;
@@ -25,7 +35,15 @@ typedef struct FragPack_ {
     int64              rcvlen;
  
     CRITICAL_SECTION   packCS;
-    vstar_t          * pack_var;
+
+    rbtree_t         * tree;
+    mpool_t          * pool;
+    int                fragnum;
+
+    /* bitmap mode, blksize > 0 */
+    int64              blksize;
+    bitarr_t         * blkmap;
+    int                blkset;     //number of blocks received
 
 } FragPack;
 
@@ -35,6 +53,12 @@ void   frag_pack_free  (void * vfrag);
 int    frag_pack_zero (void * vfrag);
 
 void   frag_pack_set_length (void * vfrag, int64 length);
+
+/* switch to the bitmap mode of blksize blocks, the length should be set
+ * before. the received ranges are kept as far as they cover whole blocks.
+ * blksize <= 0 switches back to the tree */
+int    frag_pack_set_block  (void * vfrag, int64 blksize);
+
 int    frag_pack_complete   (void * vfrag);
 int64  frag_pack_length     (void * vfrag);
 int64  frag_pack_rcvlen     (void * vfrag, int * fragnum);
@@ -44,6 +68,11 @@ int    frag_pack_read (void * vfrag, int fd, int64 pos);
 int    frag_pack_write (void * vfrag, int fd, int64 pos);
 
 int    frag_pack_add (void * vfrag, int64 pos, int64 len);
+
+/* add num ranges under one lock, the contiguous neighbors in the
+ * array are merged before going into the pack. return 1 if any new data */
+int    frag_pack_add_n (void * vfrag, FragItem * items, int num);
+
 int    frag_pack_del (void * vfrag, int64 pos, int64 len);
 int    frag_pack_get (void * vfrag, int64 pos, int64 * actpos, int64 * actlen);
 
@@ -21,12 +21,32 @@ typedef struct FrameST_ {
 
     struct FrameST_ * next;
 
+    /* refcounted buffer shared with other frames, NULL if data is owned */
+    void     * share;
+
+    /* size class of the pool data is fetched from, 0 if by kalloc */
+    int        pool;
+
 } frame_t, *frame_p;
 
 frame_p frame_new    (int size);
 void    frame_free   (frame_t * frm);
 void    frame_delete (frame_p * pfrm);
 
+/* new frame viewing len bytes from pos of frm without copying. frm and all
+ * its slices share one refcounted buffer, which is released with the last
+ * of them. the shared bytes are copied on write: the frame_put, frame_set,
+ * frame_del, frame_replace, frame_grow and reading-in routines first call
+ * frame_unshare, that takes the buffer back if no other frame refers it, or
+ * copies the bytes of the frame out. removing from the ends and reading
+ * never copy. the code writing by frameP or frame_end directly should call
+ * frame_unshare first */
+frame_p frame_slice   (frame_p frm, int pos, int len);
+frame_p frame_share   (frame_p frm);
+
+int     frame_unshare (frame_p frm);
+int     frame_shared  (frame_p frm);
+
 int     frame_size (frame_p frm);
 //#define frame_size(frm)  ((frm) ? (frm)->size : 0)
 
@@ -47,6 +67,8 @@ char  * frame_string (frame_p frm);
 void    frame_strip  (frame_p frm);
 
 void    frame_empty (frame_p frm);
+
+/* copy the content into a new frame, see frame_share for no copying */
 frame_p frame_dup   (frame_p frm);
 
 void    frame_grow (frame_p frm, int addsize);
@@ -127,10 +149,23 @@ int     frame_tcp_nbzc_recv (frame_p frm, SOCKET fd, int * actnum, int * perr);
 int     frame_tcp_nb_recv (frame_p frm, SOCKET fd, int * actnum, int * perr);
 int     frame_tcp_nb_send (frame_p frm, SOCKET fd, int * actnum);
 
+/* batched datagrams by udp_recv_batch/udp_send_batch, one frame per message */
+struct udp_msg_s;
+int     frame_udp_recv_batch (frame_p * frms, int num, SOCKET fd, struct udp_msg_s * msgs, int * perr);
+int     frame_udp_send_batch (frame_p * frms, int num, SOCKET fd, struct udp_msg_s * msgs, int * perr);
+
 
 int     frame_bin_to_base64 (frame_p srcfrm, frame_p dstfrm);
 int     frame_base64_to_bin (frame_p srcfrm, frame_p dstfrm);
 
+/* stream coding appended to frm piece by piece, st is base64_state_t of
+ * strutil.h set by base64_state_init. the _end calls flush the partial
+ * triplet or quad kept in st. return the bytes appended */
+int     frame_base64_encode_put (frame_p frm, void * st, void * pbin, int len);
+int     frame_base64_encode_end (frame_p frm, void * st);
+int     frame_base64_decode_put (frame_p frm, void * st, void * pasc, int len);
+int     frame_base64_decode_end (frame_p frm, void * st);
+
 int     frame_bin_to_ascii (frame_p srcfrm, frame_p dstfrm);
 int     frame_ascii_to_bin (frame_p srcfrm, frame_p dstfrm);
 
@@ -16,11 +16,21 @@ typedef int (HashTabCmp) (void * a, void * b);
 typedef void (HashTabFree) (void * a);
 typedef ulong (HashFunc) (void * key);
 
+/* rehashing starts when num * 100 > len * HT_LOAD_LIMIT */
+#define HT_LOAD_LIMIT    100
+
+/* number of non-empty buckets moved per ht_set/ht_get/ht_delete */
+#define HT_REHASH_STEP   4
+
+#define HT_COLLIDE_MAX   50
+
 #pragma pack(push ,1)
 
 typedef struct hash_node {
-    int   count;
-    void * dptr;
+    int     count;
+    ulong   hash;   /* full hash value of the value when count is 1 */
+    void  * dptr;   /* the value when count is 1, or arr_t list of values */
+    arr_t * hlist;  /* full hash values of the value list when count > 1 */
 } hashnode_t;
 
 typedef struct HashTab_ {
@@ -36,9 +46,18 @@ typedef struct HashTab_ {
     HashFunc    * hashFunc;
     HashTabCmp  * cmp;
 
-#ifdef _DEBUG
-    int         collide_tab[50];
-#endif
+    /* the bucket table being migrated into ptab during incremental rehash.
+     * the buckets before rehash_idx have been moved already */
+    hashnode_t  * ptab_old;
+    int           len_old;
+    int           rehash_idx;
+    int           load_limit;
+
+    int         collide_tab[HT_COLLIDE_MAX];
+
+    /* built-in seeded hash set by ht_set_seed_hash */
+    uint8       hashkind;
+    uint64      seed;
 
 } hashtab_t;
 
@@ -51,6 +70,19 @@ ulong string_hash (void * key, int keylen, ulong seed);
 uint32 murmur_hash2    (void * key, int len, uint32 seed);
 uint64 murmur_hash2_64 (void * key, int len, uint64 seed);
 
+/* wyhash, much faster than the byte loops above for keys longer than a few
+ * bytes. keylen < 0 means the key is a NUL-terminated string */
+uint64 wy_hash        (void * key, int keylen, uint64 seed);
+uint64 wy_hash_nocase (void * key, int keylen, uint64 seed);
+
+/* the random seed read from /dev/urandom once per process */
+uint64 hash_random_seed ();
+
+/* HashFunc for ht_set_hash_func on NUL-terminated keys with the process
+ * seed. wy_string_hash is case-insensitive like the default string hash */
+ulong  wy_key_hash    (void * key);
+ulong  wy_string_hash (void * key);
+
 /* create an instance of HASH TABLE. first find a prime number near to the 
  * given number. set the comparing function. allocate hash nodes of the prime
  * number. set the default hash function provided by system. if succeeded, 
@@ -67,6 +99,25 @@ void ht_set_generic_hash (hashtab_t * ht);
 /* set the hash function as the user-defined function. */
 void ht_set_hash_func (hashtab_t * ht, HashFunc * hashfunc);
 
+/* hash the NUL-terminated keys by wyhash with a seed of the table. seed 0
+ * means a random one, so the buckets of keys are unpredictable against
+ * hash flooding. HT_HASH_FUNC returns to the function set before */
+#define HT_HASH_FUNC       0
+#define HT_HASH_WY         1
+#define HT_HASH_WY_NOCASE  2
+
+void ht_set_seed_hash (hashtab_t * ht, int hashkind, uint64 seed);
+
+/* set the load factor limit in percent. when the number of stored values
+ * exceeds len * percent / 100, a bucket table of double size is allocated
+ * and the values are moved into it a few buckets per operation. 0 disables
+ * the automatic growth. default is HT_LOAD_LIMIT */
+void ht_set_load_limit (hashtab_t * ht, int percent);
+
+/* enlarge the bucket table so that num values can be stored without
+ * exceeding the load factor limit. return 0 on success, -1 on failure */
+int ht_reserve (hashtab_t * ht, int num);
+
 
 /* release the space of the hash table instance. if the value numbers of 
  * the same hash value is greater than 1, then the stack instance will be
@@ -88,10 +139,23 @@ void ht_zero (hashtab_t * ht);
 /* return the actual number of hash value. */
 int ht_num (hashtab_t * ht);
 
+/* return the number of stored values divided by the bucket number */
+double ht_load_factor (hashtab_t * ht);
+
+/* copy the chain-length histogram into hist. hist[i] is the number of buckets
+ * storing i values, hist[0] is the number of buckets storing HT_COLLIDE_MAX
+ * or more. return the number of int copied */
+int ht_collide_stat (hashtab_t * ht, int * hist, int num);
+
 /* get the hash value that the key corresponds to. if the value corresponding
  * to the key is never set, NULL is returned. */
 void * ht_get (hashtab_t * ht, void * key);
 
+/* get the values of num keys into vals, NULL for the keys not set. the
+ * keys are hashed a group at a time and their buckets prefetched before
+ * any is compared, so the cache misses overlap. return the number found */
+int ht_mget_batch (hashtab_t * ht, void ** keys, int num, void ** vals);
+
 int ht_sort (hashtab_t * ht, HashTabCmp * cmp);
 
 /* get the hash value according to the index location. the index value must
@@ -17,11 +17,22 @@ typedef struct HeapST_ {
     int          num;
     heapcmp_t  * cmp;
     void      ** data;
+
+    int          arity;   //children of each node, 2 for binary heap
+    int          posoff;  //offset of int index in element, -1 if not kept
 } heap_t, *heap_p;
 
 heap_t * heap_dup (heap_t * hp);
 heap_t * heap_new (heapcmp_t * cmp, int len);
 
+/* d-ary heap, 4 children of each node keeps a level in one cache line */
+heap_t * heap_new_dary (heapcmp_t * cmp, int len, int arity);
+
+/* keep the position of each element in the int at offset of it, such as
+   offsetof(Task, heapidx). it is -1 after the element leaves the heap.
+   should be set before pushing */
+int      heap_set_index (heap_t * hp, int offset);
+
 void     heap_pop_free  (heap_t * hp, void * vfunc);
 void     heap_pop_kfree (heap_t * hp);
 void     heap_free      (heap_t * hp);
@@ -37,6 +48,13 @@ void     heap_down (heap_t * hp, int index, int num);
 int      heap_push (heap_t * hp, void * data);
 void   * heap_pop  (heap_t * hp);
 
+/* push num elements, heapified in bulk when more than present ones */
+int      heap_push_n (heap_t * hp, void ** ar, int num);
+
+/* restore the order after the key of element at index is changed */
+int      heap_update    (heap_t * hp, int index);
+void   * heap_remove_at (heap_t * hp, int index);
+
 void     heap_sort (heap_t * hp);
 
 int      heap_heapify (heap_t * hp);
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _IOURING_H_
+#define _IOURING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* io_uring submission path of Linux 5.x for socket and file I/O. requests
+ * are prepared into the submission queue, then many of them are sent to
+ * kernel by one io_uring_enter call of iouring_submit, and the results are
+ * collected from the completion queue by iouring_reap.
+ *
+ * the ring is driven by raw system calls, liburing is not needed. on the
+ * systems without io_uring, iouring_new returns NULL and callers should
+ * fall back to tcp_nb_recv/tcp_nb_send/filefd_read/filefd_write.
+ *
+ * one ring should be used by one thread only */
+
+#define IOURING_SQPOLL     0x01   //kernel thread polls the submission queue
+
+#define IOURING_LINK       0x01   //next request starts after this one completes
+
+typedef struct iouring_cqe_s {
+    void    * tag;     //tag given when preparing the request
+    int       res;     //bytes transferred, or -errno
+    uint32    flags;
+} iouring_cqe_t;
+
+int    iouring_supported ();
+
+void * iouring_new  (int entries, int flags);
+void   iouring_free (void * vring);
+
+/* the number of requests prepared but not yet submitted */
+int    iouring_pending (void * vring);
+
+/* registered buffers are pinned by kernel once, iouring_prep_read and
+ * iouring_prep_write use READ_FIXED/WRITE_FIXED on the memory in them */
+int    iouring_register_buffers   (void * vring, void ** bufs, int * lens, int num);
+int    iouring_unregister_buffers (void * vring);
+
+/* fetch num units from bpool and register them. the units are stored
+ * in units, and should be recycled to pool after unregistering */
+int    iouring_register_bpool (void * vring, bpool_t * pool, int num, void ** units);
+
+/* return -1 if there is no free entry in submission queue,
+ * iouring_submit should be called and then try again */
+int    iouring_prep_recv   (void * vring, SOCKET fd, void * pbuf, int size, int sflag, void * tag);
+int    iouring_prep_send   (void * vring, SOCKET fd, void * pbuf, int len, int sflag, void * tag);
+int    iouring_prep_read   (void * vring, int fd, void * pbuf, int size, int64 offset, int sflag, void * tag);
+int    iouring_prep_write  (void * vring, int fd, void * pbuf, int len, int64 offset, int sflag, void * tag);
+int    iouring_prep_writev (void * vring, int fd, void * iov, int iovcnt, int64 offset, int sflag, void * tag);
+int    iouring_prep_splice (void * vring, int fdin, int64 offin, int fdout, int64 offout,
+                            int len, int sflag, void * tag);
+
+/* send the prepared requests to kernel and wait for waitnr completions.
+ * return the number of requests submitted */
+int    iouring_submit (void * vring, int waitnr);
+
+/* the pending requests are submitted first. wait for at least waitnr
+ * completions, return the number of cqes stored */
+int    iouring_reap (void * vring, iouring_cqe_t * cqes, int max, int waitnr);
+
+/* synchronous helpers, the ring should have no request in flight.
+ * tcp_sendfile is done by splicing file to an internal pipe, then pipe
+ * to the socket. if the socket is not writable, the bytes in pipe are kept
+ * and sent first by the next call from the same file position.
+ * chunk_writev links the memory segments of chunk as writev requests and
+ * submits them in one batch */
+int    iouring_tcp_sendfile (void * vring, SOCKET fd, int srcfd, int64 offset, int64 size,
+                             int * actnum, int * perr);
+int    iouring_chunk_writev (void * vring, void * vck, int fd, int64 offset,
+                             int64 * actnum, int httpchunk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
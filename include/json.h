@@ -14,6 +14,7 @@ extern "C" {
 
 typedef struct json_value {
     uint8              valtype; //0-generic string value, 1-object value
+    uint8              escaped; //1-zero-copy value not yet stripped
  
     uint8            * value;
     int                valuelen;
@@ -38,6 +39,9 @@ typedef struct json_obj {
     CRITICAL_SECTION   objCS;
     hashtab_t        * objtab;
     int                bytenum;
+
+    void             * arena;    //nodes allocated from arena, no objCS
+    uint8              ownarena;
  
     uint8              kvsep;
     uint8              itemsep;
@@ -68,6 +72,14 @@ typedef struct json_obj {
 void * json_init  (int sptype, int cmtflag);
 int    json_clean (void * vobj);
 
+/* create the object whose items, values and sub-objects are allocated from
+ * arena. json_decode on it doesn't copy keys and values, they are slices of
+ * the input buffer, not NUL-terminated, which must be kept until the object
+ * is cleaned. escaped chars are stripped lazily when the value is accessed.
+ * if arena is NULL, an arena is created and released by json_clean.
+ * no lock is used, the object should be read-only when shared by threads */
+void * json_init_arena (int sptype, int cmtflag, void * arena);
+
 int    json_size (void * vobj);
 
 int    json_valuenum (void * vobj, void * key, int keylen);
@@ -127,6 +139,14 @@ int    json_decode_file (void * vobj, void * fn, int fnlen, int findobjbgn, int
 int    json_encode (void * vobj, void * pjson, int len);
 int    json_encode2 (void * vobj, frame_p objfrm);
 
+/* exact number of bytes json_encode and json_encode2 output */
+int    json_encode_size (void * vobj);
+
+/* string values of 512 bytes or more needing no escape are not copied but
+ * referenced by chunk or iovec, the object must be kept until sent */
+long   json_encode_chunk (void * vobj, void * chunk);
+int    json_encode_iovec (void * vobj, frame_p frm, void * iov, int iovmax);
+
 long   json_fca_decode (void * vobj, void * fca, long startpos, long length);
 
 #ifdef __cplusplus
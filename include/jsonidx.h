@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _JSON_INDEX_H_
+#define _JSON_INDEX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* structural index of JSON text. the input is scanned in blocks of 64 bytes,
+ * each char class is turned into a 64-bit mask via SSE2/AVX2/NEON compares.
+ * escaped quotes are removed by the odd-backslash-sequence carry, the string
+ * regions are derived from the prefix xor of the quote mask. the offsets of
+ * { } [ ] : , out of strings and of every unescaped double quote are output
+ * in order. a string is a pair of adjacent quote offsets in the index */
+
+/* flags reported by json_index_build */
+#define JSON_IDX_UNCLOSED   0x01  //string is not closed at the end of text
+#define JSON_IDX_SPECIAL    0x02  //' # / < $ met out of string, not strict JSON
+
+/* return the number of offsets stored in pos. if the pos array of size is
+ * too small, -1 is returned and caller should retry with a larger one.
+ * the number of offsets never exceeds length */
+int json_index_build (void * pjson, int length, uint32 * pos, int size, int * flag);
+
+/* pass over the text from pos, which is out of strings and inside depth
+ * levels of objects or arrays, by counting the brackets out of strings 64
+ * bytes at a time. return the offset after the bracket closing the outermost
+ * level, or -1 if it is not closed within length. the container opened at
+ * pos is skipped by json_index_skip(pjson, length, pos + 1, 1) */
+int json_index_skip (void * pjson, int length, int pos, int depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _JSON_QUERY_H_
+#define _JSON_QUERY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compiled paths matched in one forward scan of the raw JSON text, without
+ * decoding it into JsonObj. the paths take the syntax of json_mget, like
+ * http.server.location[0].errpage.504, where name[i] is the element i of
+ * the array of name, and [0] on a value that is not an array is the value
+ * itself. a negative index is not supported.
+ *
+ * only the members and elements on the way to some path are parsed, other
+ * values are passed over by json_index_skip counting brackets 64 bytes at a
+ * time, and the rest of an object or array is skipped once no path waits in
+ * it. the scan stops as soon as every path is found, the text beyond is not
+ * read or checked. the first match of a path wins. the member names are
+ * compared with the keys as they are in the text, escapes not decoded */
+
+#define JSON_QUERY_MAXPATH   64
+#define JSON_QUERY_MAXSTEP   32
+
+/* value types of the matched paths */
+#define JSON_QUERY_NONE      0   //not found
+#define JSON_QUERY_STRING    1   //the bytes between the quotes, escapes kept
+#define JSON_QUERY_SCALAR    2   //number, true, false or null
+#define JSON_QUERY_OBJECT    3   //from { to }
+#define JSON_QUERY_ARRAY     4   //from [ to ]
+
+/* paths are separated by commas, e.g. "user.id,route[2].host", len < 0
+ * means a string. return NULL if any path is malformed */
+void * json_query_compile (char * paths, int len);
+void   json_query_free    (void * vq);
+
+/* return the index of the path added, which its result is got by */
+int    json_query_add (void * vq, char * path, int len);
+int    json_query_num (void * vq);
+
+/* return the number of paths found, -1 if the text ends inside a value
+ * before all are found, -2 if it is malformed. found results stay valid */
+int    json_query_exec (void * vq, void * pjson, int length);
+
+/* read from startpos of the file cache in growing pieces till all paths
+ * are found, length < 0 means to the end of file. the results point into
+ * an internal buffer kept until next exec or free */
+long   json_query_fca  (void * vq, void * fca, long startpos, long length);
+
+/* return the type of the value of path i, its bytes in *pval and *vallen */
+int    json_query_get    (void * vq, int i, void ** pval, int * vallen);
+
+/* offset of the value of path i in the text, the file offset for fca,
+ * -1 if not found */
+long   json_query_offset (void * vq, int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _JSON_SAX_H_
+#define _JSON_SAX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* streaming JSON tokenizer. the text is fed piece by piece, no object tree
+ * is built and events are reported to the callback as soon as tokens are
+ * complete. a token straddling two pieces is accumulated in an internal
+ * frame, others are reported by pointer into the fed piece. memory is
+ * bounded by the longest token and the nesting depth.
+ *
+ * several top-level values may follow one another, e.g. newline-delimited
+ * JSON, JSON_SAX_DOC_END is reported after each one */
+
+#define JSON_SAX_OBJ_BEGIN   1   //key is the member name or NULL
+#define JSON_SAX_OBJ_END     2
+#define JSON_SAX_ARR_BEGIN   3   //key is the member name or NULL
+#define JSON_SAX_ARR_END     4
+#define JSON_SAX_VALUE       5   //key is NULL for array elements
+#define JSON_SAX_DOC_END     6
+
+#define JSON_SAX_MAXDEPTH    256
+#define JSON_SAX_MAXTOKEN    (16*1024*1024)
+
+/* depth counts the containers enclosing the token. quoted is 1 if val was
+ * a string, 0 for number, true, false or null.
+ * key and val are valid only during the callback. return negative to stop */
+typedef int JsonSaxCB (void * para, int event, int depth, uint8 * key, int keylen,
+                       uint8 * val, int vallen, int quoted);
+
+void * json_sax_new   (JsonSaxCB * cb, void * para, int strip);
+void   json_sax_free  (void * vsax);
+void   json_sax_reset (void * vsax);
+
+/* return the number of bytes consumed, if negative, the text is malformed
+ * or stopped by callback, json_sax_offset tells where */
+int    json_sax_feed   (void * vsax, void * pbyte, int len);
+int    json_sax_finish (void * vsax);
+int64  json_sax_offset (void * vsax);
+
+long   json_sax_fca   (void * vsax, void * fca, long startpos, long length);
+int64  json_sax_chunk (void * vsax, void * vck, int64 pos, int64 length, int httpchunk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
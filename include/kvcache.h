@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _KVCACHE_H_
+#define _KVCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* concurrent key-value cache bounded by a byte budget, in place of the
+ * hashtab plus dlist LRU relinked under one lock on every hit.
+ *
+ * the entries are spread in KVCACHE_SHARDS shards by the hash of key, each
+ * shard has its lock, hash buckets and a CLOCK ring, and evicts within its
+ * share of the budget. a hit only sets the referenced bit of the entry,
+ * the clock hand clears it and evicts the entries not referenced since the
+ * last sweep. the entries expired by TTL are dropped when they are looked
+ * up or met by the hand, or by kvcache_expire.
+ *
+ * a value is either a pointer kept as it is with its length, as fast_ht_set
+ * does, or a byte slice copied into the entry. the free callback is called
+ * for the pointer values when their entries are dropped. kvcache_get pins
+ * the entry so its value stays valid until kvcache_put, the pinned entries
+ * are never evicted, and a pinned one replaced or deleted is freed by the
+ * last kvcache_put */
+
+#define KVCACHE_SHARDS   16
+
+/* bytes charged for the entry, the default is keylen + vallen plus the
+ * entry header */
+typedef int  (KVCacheCost) (void * para, void * key, int keylen, void * value, int vallen);
+
+/* release the pointer value of a dropped entry */
+typedef void (KVCacheFree) (void * para, void * value, int vallen);
+
+typedef struct kvcache_stat_s {
+    int64    budget;
+    int64    bytes;     //cost of the cached entries
+    int      num;
+
+    uint64   hits;
+    uint64   misses;
+    uint64   inserts;
+    uint64   evicts;    //dropped by the clock hand for the budget
+    uint64   expires;   //dropped by TTL
+} kvcache_stat_t;
+
+/* ttl is the default milli-seconds an entry lives, 0 means never expire */
+void * kvcache_new  (int64 budget, int ttl);
+
+/* no entry may be pinned when the cache is freed */
+void   kvcache_free (void * vc);
+
+/* set before any entry is added */
+void   kvcache_set_callback (void * vc, void * costfunc, void * freefunc, void * para);
+
+/* add or replace the entry of key, keylen < 0 means a string key. ttl < 0
+ * takes the default of the cache, 0 never expires.
+ * kvcache_set keeps the pointer value, kvcache_set_copy copies vallen bytes.
+ * return 0 if added, 1 if replaced, < 0 if the entry can't be cached, with
+ * the pointer value not taken by the cache then */
+int    kvcache_set      (void * vc, void * key, int keylen, void * value, int vallen, int ttl);
+int    kvcache_set_copy (void * vc, void * key, int keylen, void * value, int vallen, int ttl);
+
+/* look up key and pin the entry, return the handle and the value in *pval
+ * and *vallen, or NULL if missed. the handle is released by kvcache_put */
+void * kvcache_get (void * vc, void * key, int keylen, void ** pval, int * vallen);
+void   kvcache_put (void * vc, void * handle);
+
+/* copy the value of key into pbuf of at most buflen bytes without pinning,
+ * return the value length, which may be more than buflen, or -1 if missed */
+int    kvcache_copy (void * vc, void * key, int keylen, void * pbuf, int buflen);
+
+/* return 0 if deleted, -1 if not found */
+int    kvcache_del (void * vc, void * key, int keylen);
+
+/* drop the entries expired, return the number dropped */
+int    kvcache_expire (void * vc);
+
+/* drop all the entries, the pinned ones are freed by their last kvcache_put */
+void   kvcache_clear (void * vc);
+
+int    kvcache_num  (void * vc);
+int    kvcache_stat (void * vc, kvcache_stat_t * st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
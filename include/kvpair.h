@@ -25,6 +25,17 @@ typedef struct kvpair_item {
 } KVPairItem;
  
  
+/* a pair decoded lazily, pointing into the source buffer */
+typedef struct kvpair_slice {
+    uint8            * name;
+    int                namelen;
+    uint8            * value;
+    int                valuelen;
+
+    uint8            * decval;  //URL-decoded copy of value made on first reading
+    int                declen;
+} KVPairSlice;
+
 typedef struct kvpair_obj {
  
     CRITICAL_SECTION   objCS;
@@ -33,6 +44,19 @@ typedef struct kvpair_obj {
  
     uint8              sepa[16];
     uint8              kvsep[8];
+
+    /* lazy decoding records the slices without copying */
+    uint8              lazy;
+    uint8              urldec;
+
+    KVPairSlice      * slice;
+    int                slicenum;
+    int                slicesize;
+
+    /* open-addressing index of slices, built when there are many */
+    int              * sliceidx;
+    int                idxsize;
+    int                idxnum;
 } KVPairObj;
 
 
@@ -40,6 +64,19 @@ void * kvpair_init  (int htsize, char * sepa, char * kvsep);
 int    kvpair_clean (void * vobj);
 int    kvpair_zero  (void * vobj);
 
+/* in lazy mode, kvpair_decode records the pairs as the slices of the source
+ * buffer instead of copying them into the hash table. the slices are
+ * searched linearly, the index is built only when there are more than
+ * KVPAIR_LINEAR_MAX of them. if urldec is set, a value is URL-decoded when
+ * it's read by kvpair_getP the first time.
+ * the source buffer must stay unchanged until kvpair_zero or kvpair_clean,
+ * and the values returned are not NUL-terminated. calling the functions
+ * other than kvpair_getP/kvpair_get/kvpair_get_xxx/kvpair_valuenum copies
+ * the slices into the hash table first */
+#define KVPAIR_LINEAR_MAX  16
+
+int    kvpair_set_lazy (void * vobj, int lazy, int urldec);
+
 int    kvpair_valuenum (void * vobj, void * key, int keylen);
 
 int    kvpair_num (void * vobj);
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _LINEIDX_H_
+#define _LINEIDX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* index of the line starts of a text file for random line access and for
+ * splitting the file evenly among parallel parsers.
+ *
+ * the file is split into ranges of LINEIDX_RANGE bytes, each one is mapped
+ * by file_mmap and scanned for the newlines 64 bytes at a time with AVX2
+ * where the CPU has it, by the workers of vpool, or of a pool created for
+ * the call when vpool is NULL and the file has more than one range. the
+ * offsets are kept in 4 bytes for the files below 4G, in 8 bytes beyond.
+ *
+ * the offsets are passed to fbuf_ptr, fbuf_read or file_cache_seek to read
+ * the lines. available on UNIX only */
+
+#define LINEIDX_RANGE  (16 * 1024 * 1024)
+
+void * lineidx_build (char * file, void * vpool);
+void   lineidx_free  (void * vli);
+
+/* the lines of the file, the last one may have no newline */
+int64  lineidx_lines    (void * vli);
+int64  lineidx_filesize (void * vli);
+
+/* the file offset where line starts, line counts from 0. line == lines
+ * gives the file size, -1 if out of range. the bytes of line are from
+ * its offset to the offset of line + 1 */
+int64  lineidx_offset (void * vli, int64 line);
+
+/* the line holding the byte at pos, -1 if out of the file */
+int64  lineidx_find   (void * vli, int64 pos);
+
+/* cut the file into parts of nearly equal bytes at the line starts, offs
+ * gets parts + 1 offsets from 0 to the file size. the part k is from
+ * offs[k] to offs[k+1], empty if the two are equal. return parts */
+int    lineidx_split  (void * vli, int parts, int64 * offs);
+
+/* the number of newline bytes in file without building the index,
+ * scanned in parallel as lineidx_build does */
+int64  lineidx_count  (char * file, void * vpool);
+
+/* the offset of the start of line scanned from the head of file by the
+ * calling thread, the file size if the file has not so many lines */
+int64  lineidx_seek   (char * file, int64 line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -21,63 +21,61 @@ extern "C" {
  * Memory block is divided into 2 parts: 
  *
  * The first one is header information of memory unit managment,
- * including location of unit, unit allocation status, unallocated
- * memory unit array, allocated memory unit array, etc.
- *
- * These two arrays store the index of memory unit as ascending order.
+ * including location of unit storage, unit allocation status and
+ * the free-unit bitmap of 3 levels. bit i of level 0 is set if unit i
+ * is free, bit j of level 1 is set if the 64 bits of word j in level 0
+ * are not all zero, and so on. allocating takes the lowest free unit
+ * along the summary words with 3 ctz, freeing sets the bits back, both
+ * are O(1).
  * 
  * The second part is the area of memory units allocated for storage.
  *
- * When a memory block initialized, calculate total unit number and
- * the size of header space, construct the 2 arrays: the unallocated 
- * memory unit array and allocated memory unit array.
+ * The header keeps only offsets, the block can be placed in the shared
+ * memory of ipc_shm_init and attached at different addresses.
  *
  * Note: all memory unit have the fixed size.
  */
 
 int mem_block_init (void * psb, int totalsize, int unitsize);
 
+/* the bitmap words are changed with atomic and/or/CAS, so the processes
+ * or threads sharing the block allocate and free without lock. it should
+ * be set once after mem_block_init, before the block is shared */
+int mem_block_set_lockfree (void * psb, int lockfree);
+
 /* return total number of memory unit in this block.*/
 int mem_block_total (void * psb);
 
 /* return available number of memory unit rested in this block. */
 int mem_block_restnum (void * psb);
 
-/* allocate one memory unit from the available memory unit list.
- * if all units are exhausted, return NULL. otherwise, take the first
- * unit away, memset the memory unit to zero.
- * before return the available memory unit, insert the index value of memory unit into 
- * allocated unit array with the ascending order. 
+/* allocate one memory unit from the free-unit bitmap.
+ * if all units are exhausted, return NULL. otherwise, take the lowest
+ * free unit away, memset the memory unit to zero.
  */
 void * mem_block_alloc (void * psb);
 
-/* recycle the memory unit into the unallocated unit array.
+/* recycle the memory unit into the free-unit bitmap.
  * check the memory pointer if it is in the range within the block, and if it is the 
- * memory unit margin location. if not, return error.
- * 
- * remove the index value of the unit from the allocated unit array, and insert the index value
- * into unallocated memory unit array with the ascending order.
+ * memory unit margin location. if not, return error. -400 if freed twice.
  */
 int mem_block_free (void * psb, void * pmem);
 
-/* find if the unit index does exist in the unallocated unit array, if exist, just return position. 
- * if not exist, insert the index to correct position, return the position */
+/* mark the unit index free. return 0, or -400 if it is free already.
+ * the 2 apis are the same now, the free units are not sorted any more */
 int mem_block_bsearch_recycle (void * psb, int memind);
-
-/* similar implementation as above api */
 int mem_block_sort_recycle (void * psb, int memind);
 
-/* find if the unit index does exist in the allocated unit array, if exist, just return position. 
- * if not exist, insert the index to correct position, return the position */
+/* mark the unit index allocated */
 int mem_block_unit_append (void * psb, int memind);
 
-/* find the unit in the allocated unit array with binary search. if found, just remove it */
+/* mark the allocated unit index free */
 int mem_block_unit_remove (void * psb, int memind);
 
 /* return the actual number of allocated memory unit */
 int mem_block_unit_num (void * psb);
 
-/* acquire the memory unit pointer from the allocated unit array, using array index. */
+/* acquire the qind-th allocated memory unit pointer in ascending order of unit index. */
 void * mem_block_unit_get (void * psb, int qind);
 
 /* print the detailed profile of the memory block */
@@ -12,15 +12,52 @@ extern "C" {
 
 void kmem_print();
 
+/* print the allocation counters aggregated by call-site file:line.
+ * only available when compiled with _MEMDBG */
+void kmem_site_print (FILE * fp);
+
+/* take a copy of all call-site counters. two snapshots can be compared by
+ * kmem_snapshot_diff, which prints the call-sites whose live allocations
+ * changed and returns the number of them */
+void * kmem_snapshot      ();
+void   kmem_snapshot_free (void * snap);
+int    kmem_snapshot_diff (void * oldsnap, void * newsnap, FILE * fp);
+
+/* the allocator under kalloc, kzalloc, krealloc and kfree, libc malloc by
+ * default. it may route all the allocations of the library to jemalloc,
+ * mimalloc or tcmalloc, or to a per-thread or per-node allocator. zalloc
+ * and free_sized may be NULL, then alloc + memset and free are used.
+ * free_sized gets the size given to kfree_sz, it is the size of alloc when
+ * compiled with _MEMDBG.
+ *
+ * the memory allocated by one backend can't be freed by another, so the
+ * backend should be set before the library allocates anything, and must
+ * stay valid as long as it is used. NULL restores libc */
+typedef struct kmem_backend_s {
+    void * (*alloc)      (void * ctx, size_t size);
+    void * (*zalloc)     (void * ctx, size_t size);
+    void * (*realloc)    (void * ctx, void * ptr, size_t size);
+    void   (*free)       (void * ctx, void * ptr);
+    void   (*free_sized) (void * ctx, void * ptr, size_t size);
+    void   * ctx;
+} KmemBackend;
+
+int           kmem_set_backend (KmemBackend * backend);
+KmemBackend * kmem_get_backend ();
+
 void * kalloc_dbg   (size_t size, char * file, int line);
 void * kzalloc_dbg  (size_t size, char * file, int line);
 void * krealloc_dbg (void * ptr, size_t size, char * file, int line);
 void   kfree_dbg    (void * ptr, char * file, int line);
 
+/* size must be the size given to kalloc or the last krealloc */
+void   kfree_sz_dbg (void * ptr, size_t size, char * file, int line);
+
 #define kalloc(size)        kalloc_dbg((size), __FILE__, __LINE__)
 #define kzalloc(size)       kzalloc_dbg((size), __FILE__, __LINE__)
 #define krealloc(ptr, size) krealloc_dbg((ptr), (size), __FILE__, __LINE__)
 #define kfree(ptr)          kfree_dbg((ptr), __FILE__, __LINE__)
+#define kfree_sz(ptr, size) kfree_sz_dbg((ptr), (size), __FILE__, __LINE__)
 
 
 void * mem_unit_init      (void * psb, size_t totalsize);
@@ -62,6 +99,72 @@ int    mupool_scan     (void * vpool);
 
 void   mupool_print (FILE * fp, void * vpool);
 
+/* bind the blocks allocated afterwards to the NUMA node, node -1 for the
+ * node of the thread whose allocation grows the pool */
+int    mupool_set_numa (void * vpool, int on, int node);
+
+
+/* arena is a bump-pointer region allocator without per-allocation header.
+ * memory allocated from arena can not be freed individually, arena_reset
+ * releases all of them at once in O(1) and keeps the blocks for reusing.
+ * the blocks of blksize are fetched from mpool if it's given, otherwise via
+ * kalloc. if grow is 0, only one block is used and allocation fails when
+ * it runs out. arena is not thread-safe */
+void * arena_init      (size_t blksize, void * mpool, int grow);
+void   arena_clean     (void * arena);
+void   arena_reset     (void * arena);
+
+void * arena_alloc     (void * arena, size_t size);
+void * arena_zalloc    (void * arena, size_t size);
+
+/* extend in place if pmem is the last allocation, otherwise copy */
+void * arena_realloc   (void * arena, void * pmem, size_t oldsize, size_t size);
+char * arena_strdup    (void * arena, char * str, int len);
+
+size_t arena_allocsize (void * arena);
+size_t arena_totalsize (void * arena);
+
+
+/* NUMA placement. mem_numa_nodes returns the number of memory nodes, 1 on
+ * the machines without NUMA. mem_numa_node returns the node of the cpu the
+ * calling thread runs on. mem_numa_bind makes the whole pages inside pmem
+ * prefer node, moving the pages already touched. node -1 takes the node of
+ * the calling thread. it does nothing on the single-node machine */
+int    mem_numa_nodes ();
+int    mem_numa_node  ();
+int    mem_numa_bind  (void * pmem, size_t size, int node);
+
+/* the pages the calling thread allocates from now on prefer node, and so
+ * do the threads and processes it creates. node -1 takes its own node */
+int    mem_numa_prefer (int node);
+
+
+/* huge page backing of the large allocations, such as the bucket tables
+ * of hashtab and fast_ht, the bit arrays and the big units of bpool. the
+ * allocations of threshold bytes or more are mapped aligned to 2M pages
+ * by mmap, the smaller ones come from kalloc. MEM_HUGE_THP advises the
+ * kernel to back the mapping by transparent huge pages, MEM_HUGE_TLB maps
+ * the pages reserved in hugetlbfs and falls back to THP when there are
+ * no free ones. the default is MEM_HUGE_THP above 8M. the threshold is at
+ * least 2M. the policy applies to the allocations made afterwards */
+#define MEM_HUGE_NONE  0
+#define MEM_HUGE_THP   1
+#define MEM_HUGE_TLB   2
+
+int    mem_huge_set (int policy, size_t threshold);
+int    mem_huge_get (size_t * pthreshold);
+
+/* memory allocated by kalloc_huge must be freed by kfree_huge */
+void * kalloc_huge   (size_t size);
+void * kzalloc_huge  (size_t size);
+void * krealloc_huge (void * ptr, size_t size);
+void   kfree_huge    (void * ptr);
+
+size_t khuge_size    (void * ptr);
+
+/* 1 if ptr is backed by the mapping of huge pages, 0 by the heap */
+int    khuge_mapped  (void * ptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* counters and histograms of the hot paths inside the library, off by
+ * default and turned on by metrics_enable. when off, each recording point
+ * costs one load and branch of metrics_on.
+ *
+ * each thread records into its own slab padded to the cache line, so the
+ * threads never share the line written. the slab of an exiting thread is
+ * folded into the retired totals. a snapshot sums the retired totals and
+ * all the live slabs, it is not atomic across the counters.
+ *
+ * the histogram is log-linear in the way of HDR histogram: the values
+ * below 8 have their own buckets, the others 8 buckets for each power of 2,
+ * so a value is kept within 12.5% */
+
+enum {
+    MC_MPOOL_HIT = 0,         //unit fetched from the free units of mpool
+    MC_MPOOL_MISS,            //mpool had no free unit and grew
+    MC_MPOOL_GROW_BYTES,
+    MC_BPOOL_HIT,
+    MC_BPOOL_MISS,
+    MC_BPOOL_GROW_BYTES,
+    MC_HT_GET,                //ht_get lookups
+    MC_FRAME_REALLOC,         //frame buffer moved to a larger one
+    MC_FRAME_REALLOC_BYTES,   //bytes copied by the moves
+    MC_FILECACHE_HIT,         //pack was loaded when accessed
+    MC_FILECACHE_MISS,        //pack had to be loaded or waited for
+    MC_TSOCK_RECV_EAGAIN,
+    MC_TSOCK_SEND_EAGAIN,
+    MC_NUM
+};
+
+enum {
+    MH_HT_PROBE = 0,          //keys compared by one ht_get
+    MH_FRAME_REALLOC_SIZE,    //new buffer size of frame realloc
+    MH_NUM
+};
+
+#define METRICS_BUCKETS  496
+
+extern int metrics_on;
+
+#define metric_add(id, n)     do { if (metrics_on) metrics_counter_add(id, n); } while (0)
+#define metric_inc(id)        metric_add(id, 1)
+#define metric_record(id, v)  do { if (metrics_on) metrics_hist_record(id, v); } while (0)
+
+void   metrics_enable  (int on);
+
+/* zero all the counters and histograms, the values recorded by other
+ * threads at the same time may be lost or kept */
+void   metrics_reset   ();
+
+void   metrics_counter_add (int id, uint64 n);
+void   metrics_hist_record (int id, uint64 val);
+
+uint64 metrics_counter (int id);
+
+/* the number and the sum of values recorded, the value at quantile q of
+ * 0.0 - 1.0 is the upper bound of its bucket */
+uint64 metrics_hist_count    (int id, uint64 * psum, uint64 * pmax);
+uint64 metrics_hist_quantile (int id, double q);
+
+char * metrics_counter_name (int id);
+char * metrics_hist_name    (int id);
+
+/* append the snapshot of all the metrics to frm, as a JSON object or as
+ * the Prometheus text format with the names prefixed adif_ */
+int    metrics_json       (frame_p frm);
+int    metrics_prometheus (frame_p frm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -32,6 +32,19 @@ int mime_type_get_by_mime    (void * vmtyp, char * mime, char ** pext, uint32 *
 
 void * mime_type_get (void * vmgmt, char * mime, uint32 mimeid, char * ext);
 
+/* versioned snapshots of mime table. readers get the current table between
+ * mime_snap_enter and mime_snap_leave without lock, and look it up by
+ * mime_type_get_xxx. the strings got are valid till mime_snap_leave.
+ * mime_snap_publish replaces the table by vmgmt built with mime_type_alloc
+ * and mime_type_add, the old one is freed after all readers have left.
+ * vmgmt NULL in mime_snap_new means the built-in table of mime_type_init */
+void * mime_snap_new     (void * vmgmt);
+void   mime_snap_free    (void * vsnap);
+int    mime_snap_publish (void * vsnap, void * vmgmt);
+
+void * mime_snap_enter   (void * vsnap);
+void   mime_snap_leave   (void * vsnap);
+
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,13 @@
 extern "C" {
 #endif
  
+/* srctype passed to PMatchSucc. for WM_SRC_FILERANGE, psrc points to the
+ * matched bytes in the mapped range, srclen is the bytes from psrc to the
+ * end of the range and pos is the file offset */
+#define WM_SRC_BYTES      0
+#define WM_SRC_FILECACHE  1
+#define WM_SRC_FILERANGE  2
+
 typedef int PMatchSucc (void * para, int srctype, void * psrc, long srclen, long pos,
                         int * skipnum, uint8 * pat, int patlen,
                         uint8 * pdst, int dstlen, int * repnum);
@@ -19,12 +26,26 @@ int    wm_free  (void * vbody);
 int    wm_reset (void * vbody);
 
 int    wm_pattern_add     (void * vbody, void * pat, int patlen, void * matchfunc, void * para);
+
+/* build the tables after adding patterns. on x86 CPUs with AVX2, a set of
+ * at most 48 patterns is searched by the Teddy prefilter 32 bytes at a
+ * time instead of Wu-Manber. the replace functions keep Wu-Manber */
 int    wm_pattern_precalc (void * vbody);
 
 long   wm_bytes_search     (void * vbody, void * pbyte, long bytelen, void ** foundobj, int foundexit);
 long   wm_filecache_search (void * vbody, void * fca, long pos, void ** foundobj, int foundexit);
 long   wm_file_search      (void * vbody, char * file);
 
+/* search file by the workers of thpool vpool, or of a pool created for the
+ * call when vpool is NULL. the file is split into ranges of rangelen bytes,
+ * default WM_RANGE_SIZE, each one is mapped and searched by a task with an
+ * overlap of the longest pattern length - 1. the callbacks are called by
+ * the calling thread in file offset order. return the number of matches.
+ * available on UNIX only */
+#define WM_RANGE_SIZE  (64 * 1024 * 1024)
+
+long   wm_file_search_parallel (void * vbody, char * file, void * vpool, long rangelen);
+
 long   wm_match_replace (void * vbody, void * fca, long pos, uint8 * pdst, int dstlen, int * cpbytes);
 long   wm_bytes_replace (void * vbody, uint8 * pbyte, long bytelen, uint8 * pdst, int dstlen, int * cpbytes);
 
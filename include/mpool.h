@@ -27,6 +27,27 @@ int    mpool_set_initfunc (mpool_t * mp, void * func);
 int    mpool_set_freefunc (mpool_t * mp, void * func);
 int    mpool_set_usizefunc (mpool_t * mp, void * func);
 
+/* enable per-thread magazines of depth units in front of the locked pool.
+ * fetching and recycling then take the lock only once per depth/2 units.
+ * the unit recycled into a magazine is verified against rmdup_tab when it is
+ * flushed back, not immediately. depth 0 disables the magazines. should be
+ * set before pool is used */
+int    mpool_set_tlcache (mpool_t * mp, int depth);
+
+/* statistics of the magazine owned by the calling thread. return the number
+ * of units currently cached by it */
+int    mpool_tlcache_stat (mpool_t * mp, ulong * hit, ulong * miss,
+                           ulong * recycle, ulong * flush);
+
+/* keep one sub-pool for each NUMA node. the units are fetched from the
+ * sub-pool of the node that the calling thread runs on, whose caches are
+ * allocated by that thread and bound to the node by mbind. a unit is always
+ * recycled to the sub-pool it came from. the settings of mp are copied to
+ * the sub-pools, so it should be called after setting up mp, before it is
+ * used. return the number of sub-pools, 1 on the single-node machine where
+ * it does nothing, or < 0 on failure */
+int    mpool_set_numa (mpool_t * mp, int on);
+
 int    mpool_allocnum (mpool_t * mp);
 int    mpool_unitsize (mpool_t * mp);
 int    mpool_freesize (mpool_t * mp);
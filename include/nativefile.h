@@ -24,17 +24,23 @@ extern "C" {
  * NF_WRITE -- open the file for write, if file exist, delete it or truncate to 0
  * NF_WRITEPLUS -- open the file for write, if file exist, reserve the file 
  * NF_EXEC -- create one file with executing privilege
+ * NF_DIRECT -- open with O_DIRECT if system supports, the buffers, lengths and
+ *              offsets of I/O should be aligned to NF_DIRECT_ALIGN. the buffers
+ *              may be fetched from a bpool set by bpool_set_align
  */
 #define NF_READPLUS   0x00000002
 #define NF_READ       0x00000001
 #define NF_WRITEPLUS  0x00000020
 #define NF_WRITE      0x00000010
 #define NF_EXEC       0x10000000
+#define NF_DIRECT     0x01000000  //O_DIRECT, bypass the page cache of kernel
 
 #define NF_MASK_RW    0x000000FF
 #define NF_MASK_R     0x0000000F
 #define NF_MASK_W     0x000000F0
 
+#define NF_DIRECT_ALIGN  4096
+
 typedef struct native_file_ { 
  
     CRITICAL_SECTION   fileCS;
@@ -73,6 +79,24 @@ int    native_file_resize (void * hfile, int64 newsize);
 
 int    native_file_fd (void * vhfile);
 
+/* positional I/O at the given offset, the file offset shared by
+ * native_file_read/write/seek is neither used nor changed, so they may be
+ * called from many threads at once. iov is the array of struct iovec.
+ * return the bytes transferred, less than asked only at the end of file */
+int    native_file_pread   (void * hfile, void * buf, int size, int64 offset);
+int    native_file_pwrite  (void * hfile, void * buf, int size, int64 offset);
+int64  native_file_preadv  (void * hfile, void * iov, int iovcnt, int64 offset);
+int64  native_file_pwritev (void * hfile, void * iov, int iovcnt, int64 offset);
+
+/* reserve the disk blocks of the range, the file size is extended if the
+ * range is beyond it */
+int    native_file_allocate (void * hfile, int64 offset, int64 len);
+
+/* write back the dirty pages of the range, len 0 to the end of file. wait
+ * for the writing to complete if wait is set. the metadata is not flushed,
+ * so it does not replace fsync for the size changed */
+int    native_file_sync_range (void * hfile, int64 offset, int64 len, int wait);
+
 int64  native_file_size   (void * hfile);
 int64  native_file_offset (void * hfile);
 
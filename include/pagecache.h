@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* process-wide cache of file pages shared by all the readers. the pages are
+ * keyed by (inode, mtime, page index), so the connections streaming the
+ * same file read it from the memory once loaded, and a modified file gets
+ * new keys while its old pages age out.
+ *
+ * the pages are spread in PCACHE_SHARDS shards by the hash of key, each
+ * shard has its lock and evicts by CLOCK within its share of the byte
+ * budget. a page is refcounted while being copied out, and the pinned
+ * pages are never evicted.
+ *
+ * file_cache, fbuf_read and the file entities of chunk read through the
+ * cache once pcache_init is called. pcache_init should be called before
+ * the readers start, pcache_clean after they stop */
+
+#define PCACHE_SHARDS     16
+#define PCACHE_PAGESIZE   (64*1024)
+
+typedef struct pcache_stat_s {
+    int64    budget;
+    int64    bytes;     //bytes of the cached pages
+    int      pages;
+
+    uint64   hits;
+    uint64   misses;
+    uint64   evicts;
+} pcache_stat_t;
+
+/* pagesize <= 0 takes PCACHE_PAGESIZE, it is rounded to 4K */
+int    pcache_init  (int64 budget, int pagesize);
+void   pcache_clean ();
+
+int    pcache_enabled ();
+
+/* copy len bytes at pos of the file opened as fd into pbuf. missed pages
+ * are loaded with pread, the file offset of fd is not changed.
+ * return the bytes copied, less than len at the end of file, or < 0 */
+int    pcache_read (int fd, long inode, time_t mtime, int64 pos, void * pbuf, int len);
+
+int    pcache_stat (pcache_stat_t * st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -121,6 +121,19 @@ void * sun_find_string  (void * pbyte, int len, void * pattern, int patlen, void
 void * sun_find_mbytes (void ** ppbyte, int * plen, int num, void * pattern, int patlen, void * pvec, int * pind);
 void * sun_find_mstring (void ** ppbyte, int * plen, int num, void * pattern, int patlen, void * pvec, int * pind);
 
+
+/* SIMD filter by the first and the last byte of pattern, AVX2, SSE2 or NEON
+ * is chosen at compile time, plain loop otherwise */
+void * simd_find_bytes (void * pbyte, int len, void * pattern, int patlen);
+
+/* find the first occurrence of pattern, the algorithm is chosen by patlen:
+ * SIMD filter up to PAT_SIMD_MAXLEN, Sunday up to PAT_SUN_MAXLEN, then
+ * Boyer-Moore. patlen < 0 means pattern is a NUL-terminated string */
+#define PAT_SIMD_MAXLEN  64
+#define PAT_SUN_MAXLEN   256
+
+void * pat_find (void * pbyte, int len, void * pattern, int patlen);
+
 #ifdef __cplusplus
 }
 #endif 
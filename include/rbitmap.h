@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _RBITMAP_H_
+#define _RBITMAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compressed bitmap of uint32 values in the way of Roaring bitmap. the
+ * values are grouped by their high 16 bits into containers sorted by the
+ * key, each container holds the low 16 bits either as a sorted array of
+ * uint16 when it has up to 4096 values, or as a bitmap of 8K bytes when it
+ * has more. a sparse set costs 2 bytes per value, a dense one 1 bit per
+ * value, while bitarr_t always costs 1 bit per value of the whole range.
+ *
+ * rbitmap_optimize turns the containers of long consecutive values into
+ * runs of start and length, 4 bytes per run. the run container is changed
+ * back to array or bitmap when it is written by set or unset.
+ *
+ * the intersection of arrays is done by SSE4.2 block compare, or galloping
+ * when one is much smaller, the bitmaps are combined and counted by AVX2
+ * where the CPU has it */
+
+#define RBITMAP_ARRAY_MAX  4096
+
+void * rbitmap_new   ();
+void   rbitmap_free  (void * vrb);
+void   rbitmap_zero  (void * vrb);
+
+/* return 1 if val is added or removed, 0 if it was there or not there */
+int    rbitmap_set   (void * vrb, uint32 val);
+int    rbitmap_unset (void * vrb, uint32 val);
+int    rbitmap_get   (void * vrb, uint32 val);
+
+int64  rbitmap_count (void * vrb);
+
+/* the first value at or after from, or -1 if none */
+int64  rbitmap_next  (void * vrb, uint32 from);
+
+/* the number of values less than val */
+int64  rbitmap_rank  (void * vrb, uint32 val);
+
+/* dst becomes the union or the intersection of dst and src */
+int    rbitmap_or    (void * vdst, void * vsrc);
+int    rbitmap_and   (void * vdst, void * vsrc);
+
+/* dst keeps the values not in src */
+int    rbitmap_andnot (void * vdst, void * vsrc);
+
+/* the number of values in both, without building the intersection */
+int64  rbitmap_and_count (void * va, void * vb);
+
+/* copy up to num values at or after from into vals in ascending order,
+ * return the number copied. iterate by from = vals[n - 1] + 1 */
+int    rbitmap_values (void * vrb, uint32 from, uint32 * vals, int num);
+
+/* convert the containers to runs where the runs take less space */
+int    rbitmap_optimize (void * vrb);
+
+/* memory bytes taken by the containers */
+int64  rbitmap_bytes (void * vrb);
+
+/* the portable serialized format of Roaring bitmap, readable by the other
+ * Roaring implementations. serialize returns the bytes written, or -100 if
+ * len is less than rbitmap_serial_size. deserialize validates the input
+ * and returns NULL if it is malformed */
+int64  rbitmap_serial_size (void * vrb);
+int64  rbitmap_serialize   (void * vrb, void * pbuf, int64 len);
+void * rbitmap_deserialize (void * pbuf, int64 len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -43,6 +43,14 @@ typedef struct RBTree {
     rbtcmp_t    * cmp;
     int           alloc_node;
 
+    /* offset of the rbtnode_t embedded in caller's object */
+    int           nodeoff;
+
+    /* pool that the allocated nodes are fetched from */
+    void        * pool;
+    void        * (*fetch)(void * pool);
+    int           (*recycle)(void * pool, void * unit);
+
     int           depth;
     int           layer[32];
     int           lwidth;
@@ -71,6 +79,22 @@ int    rbtnode_free (void * vnode, rbtfree_t * freefunc, int alloc_node);
 */   
 
 void * rbtree_new  (rbtcmp_t * cmp, int alloc_node);
+
+/* intrusive tree: the caller's object embeds an rbtnode_t at nodeoff, such
+   as offsetof(Conn, rbnode). nothing is allocated when inserting, cmp and
+   callbacks get the object and rbtree_obj converts the node to it.
+   rbtree_new(cmp, 0) is the same as nodeoff 0 */
+void * rbtree_new_embed (rbtcmp_t * cmp, int nodeoff);
+
+/* the allocated nodes (alloc_node = 1) are fetched from and recycled into
+   the mpool_t or bpool_t given by caller, whose unit size should not be less
+   than sizeof(rbtnode_t). the pool is not freed by tree and should be set
+   before inserting. NULL restores kzalloc/kfree */
+int    rbtree_set_mpool (void * vptree, void * mpool);
+int    rbtree_set_bpool (void * vptree, void * bpool);
+
+void * rbtree_obj (void * vptree, void * vnode);
+
 void   rbtree_free (void * ptree);
 void   rbtree_free_all (void * ptree, int (*freefunc)());
 
@@ -84,6 +108,12 @@ void * rbtree_get       (void * ptree, void * key);
 int    rbtree_mget_node (void * ptree, void * key, void ** plist, int listsize);
 int    rbtree_mget      (void * ptree, void * key, void ** plist, int listsize);
 
+/* get the objects of num keys into vals, NULL for the keys not found. the
+   descents of a group of keys go down the tree together one level a round,
+   the children stepped to are prefetched for the next round. return the
+   number of keys found */
+int    rbtree_get_batch (void * ptree, void ** keys, int num, void ** vals);
+
 void * rbtree_min_node (void * ptree);
 void * rbtree_min      (void * ptree);
 void * rbtree_max_node (void * ptree);
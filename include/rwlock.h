@@ -35,6 +35,68 @@ int    rwlock_read_unlock (void * vlock);
 int    rwlock_write_lock   (void * vlock);
 int    rwlock_write_unlock (void * vlock);
 
+
+/* big-reader lock. each CPU slot has its own reader counter on a separate
+ * cache line, readers touch only the slot of current CPU and never block
+ * each other. the writer raises the flag and waits for all slots drained,
+ * so writing is expensive and should be rare.
+ * brlock_read_lock returns the slot that must be passed to unlock */
+
+#define BRLOCK_MAXSLOT  64
+
+typedef struct brlock_slot_s {
+    int              count;
+    uint8            pad[60];
+} brlock_slot_t;
+
+typedef struct brlock_s {
+    uint8            alloc;
+    int              nslot;
+    int              writer;
+    pthread_mutex_t  wlock;
+
+    void           * slotmem;
+    brlock_slot_t  * slots;
+} brlock_t;
+
+void * brlock_init  (void * vlock);
+int    brlock_clean (void * vlock);
+
+int    brlock_read_lock   (void * vlock);
+int    brlock_read_unlock (void * vlock, int slot);
+
+int    brlock_write_lock   (void * vlock);
+int    brlock_write_unlock (void * vlock);
+
+
+/* sequence lock for small POD snapshots. readers never write shared memory,
+ * they copy the data and retry if a writer has run in the meanwhile:
+
+       do {
+           seq = seqlock_read_begin(lock);
+           copy = conf;
+       } while (seqlock_read_retry(lock, seq));
+ */
+
+typedef struct seqlock_s {
+    uint32           seq;
+    uint8            alloc;
+    pthread_mutex_t  wlock;
+} seqlock_t;
+
+void * seqlock_init  (void * vlock);
+int    seqlock_clean (void * vlock);
+
+uint32 seqlock_read_begin (void * vlock);
+int    seqlock_read_retry (void * vlock, uint32 start);
+
+int    seqlock_write_lock   (void * vlock);
+int    seqlock_write_unlock (void * vlock);
+
+/* copy len bytes of src into dst as a consistent snapshot */
+int    seqlock_read  (void * vlock, void * dst, void * src, int len);
+int    seqlock_write (void * vlock, void * dst, void * src, int len);
+
 #ifdef __cplusplus
 }
 #endif
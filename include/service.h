@@ -65,6 +65,55 @@ int   read_harddisk_info (HDiskInfo * pinfo);
 int daemonize (char * lockfile, char * pinstalldir);
 int exec_cmd  (char * cmdstr, char * argv[], int waitchild);
 
+/* master/worker supervisor of prefork workers. prefork_run forks num
+ * workers running work, and forks a new one in place of the worker that
+ * died, not sooner than 1 second after the dead one started.
+ *
+ * the listening sockets are opened by the master before prefork_run and
+ * inherited by all the workers. the SO_REUSEPORT shards given are split:
+ * worker i keeps shard i % num and closes the others.
+ *
+ * with affinity, worker i is pinned to the i-th cpu allowed to the master
+ * and its memory prefers the NUMA node of that cpu.
+ *
+ * the signals to the master:
+ *   SIGHUP   re-read the conf file by conf_mgmt_read into a new conf, hand
+ *            it to the reload callback, and restart the workers by it
+ *   SIGUSR2  restart the workers
+ *   SIGTERM, SIGINT  stop the workers and return from prefork_run
+ *
+ * the restart is rolling without downtime: a new worker is forked beside
+ * each old one, the old one is asked to quit by SIGTERM only after the new
+ * one calls prefork_ready, or after 5 seconds if it never does. the worker
+ * leaves its loop gracefully when prefork_quitting returns 1, the workers
+ * still running after the grace seconds of stopping are killed */
+
+typedef int PreforkMain   (void * para, int index, int cpu);
+typedef int PreforkReload (void * para, void * conf);
+
+void * prefork_new  (int num, PreforkMain * work, void * para);
+void   prefork_free (void * vpf);
+
+int    prefork_set_affinity (void * vpf, int on);
+int    prefork_set_shards   (void * vpf, SOCKET * fds, int num);
+int    prefork_set_grace    (void * vpf, int seconds);
+
+/* conf is made by conf_mgmt_init(file), prefork_run keeps the latest one
+ * which is got by prefork_conf. reload returns < 0 to refuse the new conf,
+ * the workers go on with the old one then */
+int    prefork_set_conf     (void * vpf, void * conf, char * file, PreforkReload * reload);
+void * prefork_conf         (void * vpf);
+
+/* run the master loop till SIGTERM or SIGINT, return 0 */
+int    prefork_run (void * vpf);
+
+/* called in the worker: its index or -1 in the master, its shard socket,
+ * whether it's asked to quit, and telling the master it's serving */
+int    prefork_index    ();
+SOCKET prefork_shard    ();
+int    prefork_quitting ();
+int    prefork_ready    ();
+
 #endif
 
 #ifdef __cplusplus
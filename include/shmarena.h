@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _SHM_ARENA_H_
+#define _SHM_ARENA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UNIX
+
+/* arena of memory shared by processes, such as the segment of ipc_shm_init
+ * or the MAP_SHARED mapping made before fork. the segment may be attached
+ * at different addresses in each process, so everything inside the arena
+ * refers to each other by the offset from the arena base, never by the
+ * absolute pointer. SHM_PTR/SHM_OFS do the conversion, offset 0 is NULL.
+ *
+ * the arena, the hash table and the ring are guarded by process-shared
+ * robust mutexes. when the holder dies, the next locker takes it over and
+ * the structure goes on being used.
+ *
+ * memory is allocated in power-of-2 classes from 32 bytes, each class
+ * keeps a free list, the new blocks are cut from the unused top.
+ *
+ * the structures created are found by other processes with the names
+ * bound in the arena:
+ *
+ *   creator:  arena = shm_arena_open("/var/run/app", 1, 64 << 20, &shmid);
+ *             ht = shm_ht_new(arena, 100000);
+ *             shm_arena_bind(arena, "urlindex", ht);
+ *   workers:  ht = shm_arena_lookup(arena, "urlindex");
+ *             shm_ht_get(ht, url, -1, buf, sizeof(buf));
+ */
+
+#define SHM_ROOT_NUM   16
+
+#define SHM_PTR(arena, ofs) ((ofs) ? (void *)((uint8 *)(arena) + (ofs)) : NULL)
+#define SHM_OFS(arena, ptr) ((ptr) ? (int64)((uint8 *)(ptr) - (uint8 *)(arena)) : 0)
+
+/* format size bytes at base as an arena, return base or NULL */
+void * shm_arena_init   (void * base, int64 size);
+
+/* check the arena formatted by another process, waiting up to waitms
+ * for the creator to finish formatting. return base or NULL */
+void * shm_arena_attach (void * base, int waitms);
+
+/* attach the System V segment of path/proj by ipc_shm_init, formatting it
+ * if created, or waiting for the creator if not */
+void * shm_arena_open   (char * path, int proj, int size, int * pshmid);
+
+int64  shm_arena_size   (void * arena);
+int64  shm_arena_used   (void * arena);
+
+void * shm_alloc   (void * arena, int size);
+void * shm_zalloc  (void * arena, int size);
+void   shm_free    (void * arena, void * p);
+
+/* bind the object in arena to name, NULL obj unbinds it. */
+int    shm_arena_bind   (void * arena, char * name, void * obj);
+void * shm_arena_lookup (void * arena, char * name);
+
+
+/* hash table in the arena. like fastht, the key is not stored but
+ * identified by its 64-bit wyhash and another 32-bit check hash, with the
+ * seed kept in the table so that all processes hash the same. the value is
+ * copied into the arena. the table doubles when 3/4 full */
+
+void * shm_ht_new  (void * arena, ulong size);
+void   shm_ht_free (void * vht);
+
+int    shm_ht_num  (void * vht);
+
+/* copy the value of key into pbuf of size bytes. return the value length,
+ * which may be greater than size, or -100 if not found */
+int    shm_ht_get  (void * vht, void * key, int keylen, void * pbuf, int size);
+
+/* return 1 if added, 0 if replaced, < 0 on failure */
+int    shm_ht_set  (void * vht, void * key, int keylen, void * value, int valuelen);
+int    shm_ht_del  (void * vht, void * key, int keylen);
+
+void   shm_ht_zero (void * vht);
+
+
+/* bounded ring queue of num items each up to unitsize bytes */
+
+void * shm_ring_new  (void * arena, int unitsize, int num);
+void   shm_ring_free (void * vring);
+
+int    shm_ring_num  (void * vring);
+
+/* return 0, -100 if full, -101 if len exceeds unitsize */
+int    shm_ring_push (void * vring, void * data, int len);
+
+/* copy the head item into pbuf of size bytes and remove it. return the
+ * item length, or -100 if empty */
+int    shm_ring_pop  (void * vring, void * pbuf, int size);
+
+#endif  //end if UNIX
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _SKETCH_H_
+#define _SKETCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* streaming sketches of bounded memory for the heavy hitters, the key
+ * frequencies and the quantiles of a stream, in place of keeping all the
+ * items in a heap or an array over the window.
+ *
+ * a sketch is not locked, each thread feeds its own one and the sketches
+ * are merged into one for the report. the serialized bytes are in little
+ * endian and can be shipped to the aggregator to be deserialized and merged.
+ * serialize returns the bytes written, or -100 if len is less than the
+ * serial size. deserialize validates the input and returns NULL if it is
+ * malformed */
+
+
+/* Space-Saving top-K. k counters are monitored in a min-heap of counts,
+ * an unmonitored key takes over the counter of the least count and takes
+ * that count as its error. any key occurring more than total / k times is
+ * monitored. count is an upper bound of the occurrences of key, count -
+ * error is a lower bound */
+
+typedef struct topk_item_s {
+    void     * key;
+    int        keylen;
+    uint64     count;
+    uint64     error;
+} topk_item_t;
+
+void * topk_new  (int k);
+void   topk_free (void * vtk);
+void   topk_zero (void * vtk);
+
+/* keylen < 0 means a string key */
+int    topk_add   (void * vtk, void * key, int keylen, uint64 count);
+
+/* the count of key, 0 if not monitored, its error in *perr */
+uint64 topk_count (void * vtk, void * key, int keylen, uint64 * perr);
+
+int    topk_num   (void * vtk);
+uint64 topk_total (void * vtk);
+
+/* copy at most num items of the largest counts in descending order, the
+ * keys point into the sketch till it is changed. return the number copied */
+int    topk_list  (void * vtk, topk_item_t * items, int num);
+
+/* add the counters of src into dst, a key not monitored by one sketch is
+ * taken as the least count of it if it is full, then dst keeps the k of
+ * the largest counts. k of the two may differ */
+int    topk_merge (void * vdst, void * vsrc);
+
+int64  topk_serial_size  (void * vtk);
+int64  topk_serialize    (void * vtk, void * pbuf, int64 len);
+void * topk_deserialize  (void * pbuf, int64 len);
+
+
+/* Count-Min sketch of depth rows of width counters. the count of key is
+ * never under the true one, and is over it by at most e / width * total
+ * with the probability 1 - exp(-depth). width of 2719 and depth of 5 give
+ * 0.1% of total at 99.3% for 106K bytes. the hash is fixed so the sketches
+ * of the same width and depth made in any processes can be merged */
+
+void * cms_new  (int width, int depth);
+void   cms_free (void * vcm);
+void   cms_zero (void * vcm);
+
+int    cms_add   (void * vcm, void * key, int keylen, uint64 count);
+uint64 cms_count (void * vcm, void * key, int keylen);
+uint64 cms_total (void * vcm);
+
+/* return -100 if the width or depth differs */
+int    cms_merge (void * vdst, void * vsrc);
+
+int64  cms_serial_size (void * vcm);
+int64  cms_serialize   (void * vcm, void * pbuf, int64 len);
+void * cms_deserialize (void * pbuf, int64 len);
+
+
+/* merging t-digest of the quantiles. the values are buffered and merged
+ * into centroids in bulk, the centroids near the both ends are kept small
+ * by the arcsine scale, so the tail quantiles like p99 and p999 are more
+ * accurate than the median. compression bounds the number of centroids,
+ * 100 keeps about 60 of them, 1K bytes serialized, for about 1% error at
+ * the median and 0.2% at p99. the queries merge the buffered values first */
+
+void * tdigest_new  (double compression);
+void   tdigest_free (void * vtd);
+void   tdigest_zero (void * vtd);
+
+int    tdigest_add  (void * vtd, double value, double weight);
+
+/* the value at q of 0.0 - 1.0, the minimum and maximum are kept exactly.
+ * 0 if nothing is added */
+double tdigest_quantile (void * vtd, double q);
+
+/* the fraction of the weight of values not greater than value */
+double tdigest_cdf      (void * vtd, double value);
+
+double tdigest_count    (void * vtd);
+
+int    tdigest_merge    (void * vdst, void * vsrc);
+
+int64  tdigest_serial_size (void * vtd);
+int64  tdigest_serialize   (void * vtd, void * pbuf, int64 len);
+void * tdigest_deserialize (void * pbuf, int64 len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -97,6 +97,9 @@ void * str_find_bytes (void * pstr, int len, void * pat, int patlen);
 void * str_rfind_bytes (void * pstr, int pos, void * pat, int patlen);
 
 
+/* the hex and base64 codecs below run the SSSE3/AVX2 kernels selected
+ * by the cpu at runtime, or the NEON kernels on aarch64 */
+
 /* convert the binary byte stream into ascii format stream, 
  * one byte will be converted into 2 byte, thus the result buffer pascii
  * should be twice than pbin */
@@ -112,6 +115,68 @@ int base64_to_bin (void * pasc, int asclen, void * pbin, int *binlen);
 /* convert binary octet stream to base64 encoded stream */
 int bin_to_base64 (void * pbin, int binlen, void * pasc, int * asclen);
 
+/* incremental base64 coding of a stream fed piece by piece. the encoder
+ * keeps the octets not making a triplet, the decoder keeps the partial
+ * quad till the next piece */
+typedef struct base64_state_s {
+    uint8    carry[3];
+    int      carrynum;
+
+    uint32   triplet;
+    int      quadpos;
+    int      ended;     //the padding '=' is met, the rest is ignored
+    int      invalid;   //number of the chars skipped not being base64
+    int      badpad;
+} base64_state_t;
+
+void base64_state_init (base64_state_t * st);
+
+/* pasc should have room of (binlen + 2) / 3 * 4 chars, and 4 chars for the
+ * final padded quad. return the chars written */
+int bin_to_base64_update (base64_state_t * st, void * pbin, int binlen, void * pasc);
+int bin_to_base64_final  (base64_state_t * st, void * pasc);
+
+/* pbin should have room of (asclen + 3) / 4 * 3 bytes, and 2 bytes for the
+ * final partial quad. return the bytes written */
+int base64_to_bin_update (base64_state_t * st, void * pasc, int asclen, void * pbin);
+int base64_to_bin_final  (base64_state_t * st, void * pbin);
+
+/* character set compiled from a char list for the skip functions. the
+ * membership test is a lookup in the 256-bit bitmap, the sets of up to
+ * CHSET_VECMAX chars are scanned by SIMD compares 16 or 32 bytes a time.
+ * the larger sets are scanned forward by the nibble table lookup, where the
+ * low nibble of a byte picks a row of the table and the high nibble picks
+ * a bit of the row. callers scanning with the same chars repeatedly can
+ * keep a compiled set and call the *_set versions */
+
+#define CHSET_VECMAX  8
+
+typedef struct char_set_s {
+    uint8    bitmap[32];
+    int      num;
+    uint8    chars[CHSET_VECMAX];
+
+    uint8    lorow[16];  //rows of the chars 0x00-0x7F, indexed by low nibble
+    uint8    hirow[16];  //rows of the chars 0x80-0xFF
+} chset_t;
+
+#define chset_has(set, ch)  ((set)->bitmap[(uint8)(ch) >> 3] & (1 << ((uint8)(ch) & 7)))
+
+void   chset_init (chset_t * set, void * chars, int num);
+void   chset_add  (chset_t * set, int ch);
+
+/* compile the 256-bit map of 8 words, bit (ch & 31) of word (ch >> 5) set
+ * for each member ch, as the escape maps of uri_encode */
+void   chset_init_map (chset_t * set, uint32 * bitvec);
+
+void * skip_to_set    (void * pbyte, int len, chset_t * set);
+void * skip_over_set  (void * pbyte, int len, chset_t * set);
+void * rskip_to_set   (void * pbyte, int len, chset_t * set);
+void * rskip_over_set (void * pbyte, int len, chset_t * set);
+
+void * skip_esc_to_set   (void * pbyte, int len, chset_t * set);
+void * skip_quote_to_set (void * pbyte, int len, chset_t * set);
+
 /* scan the byte stream untill encountering the given characters, in addition,
  * skip over all characters enclosed by "" */
 void * skipQuoteTo (void * pbyte, int len, void * tochars, int num);
@@ -159,6 +224,10 @@ void * json_strip_dup (void * psrc, size_t size);
       ESCAPE_MEMCACHED      5
       ESCAPE_MAIL_AUTH      6 */
 int uri_encode (void * psrc, size_t size, void * pdst, size_t dstlen, int type);
+
+/* encode the bytes set in the 256-bit map escvec, as frame_uri_encode.
+ * a NULL escvec takes the map of ESCAPE_URI */
+int uri_encode_vec (void * psrc, size_t size, void * pdst, size_t dstlen, uint32 * escvec);
 int uri_decode (void * psrc, int size, void * pdst, int dstlen);
 
 int html_escape (void * psrc, size_t size, void * pdst, size_t dstlen);
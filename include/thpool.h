@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _THPOOL_H_
+#define _THPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* work-stealing thread pool. each worker owns a Chase-Lev deque, the tasks
+ * posted from a worker are pushed to the bottom of its own deque and popped
+ * LIFO, idle workers steal from the top of others. the tasks posted from
+ * other threads go to a shared injection queue.
+ *
+ * thfuture_wait and thpool_parallel_for called by a worker execute other
+ * tasks while waiting, so tasks can post and wait for sub-tasks without
+ * deadlock.
+ *
+ * when the pool is NULL, tasks are executed at once by the calling thread.
+ * the pool is available on UNIX only, thpool_new returns NULL elsewhere */
+
+typedef void * ThTaskFunc  (void * arg);
+typedef void   ThRangeFunc (void * arg, long from, long to);
+
+#define THPOOL_AFFINITY  0x01   //bind worker i to CPU core i
+
+/* num <= 0 means the number of online CPUs */
+void * thpool_new  (int num, int flags);
+
+/* the tasks queued are executed before workers exit */
+void   thpool_free (void * vpool);
+
+int    thpool_num  (void * vpool);
+
+/* the number of tasks posted but not yet finished */
+long   thpool_pending (void * vpool);
+
+/* return 0 if the task is queued */
+int    thpool_post (void * vpool, ThTaskFunc * func, void * arg);
+
+/* queue num tasks of the same function, the workers are woken once */
+int    thpool_post_batch (void * vpool, ThTaskFunc * func, void ** args, int num);
+
+/* wait till all the tasks posted are finished. it returns at once when
+ * called by a task of the pool */
+void   thpool_wait (void * vpool);
+
+/* call func on [begin, end) split into ranges of grain, grain <= 0 lets the
+ * pool choose. the calling thread takes part and returns when all done */
+int    thpool_parallel_for (void * vpool, long begin, long end, long grain,
+                            ThRangeFunc * func, void * arg);
+
+
+/* the future holds the return value of func, it must be freed by
+ * thfuture_free even if it is not waited */
+void * thpool_submit (void * vpool, ThTaskFunc * func, void * arg);
+
+/* wait at most millisec, negative means forever. return 0 and store the
+ * value into result if the task is finished, -1 on timeout */
+int    thfuture_wait (void * vfut, int millisec, void ** result);
+int    thfuture_done (void * vfut);
+void   thfuture_free (void * vfut);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
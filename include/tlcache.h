@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _TLCACHE_H_
+#define _TLCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* thread-local unit cache placed in front of a locked pool. each thread owns
+ * a magazine holding at most depth units. fetching and recycling operate on
+ * the magazine without any lock. an empty magazine is refilled with depth/2
+ * units from the pool, a full one flushes depth/2 units back to the pool,
+ * both in one batch under the lock of the pool.
+ * the magazine of an exiting thread is flushed to the pool automatically. */
+
+/* fetch at most num units from pool into units, return the number fetched */
+typedef int (TLCacheRefill) (void * pool, void ** units, int num);
+
+/* give num units back to pool */
+typedef int (TLCacheFlush)  (void * pool, void ** units, int num);
+
+struct tl_cache_s;
+typedef struct tl_cache_s tlcache_t;
+
+tlcache_t * tlcache_new  (void * pool, int depth, void * refill, void * flush);
+
+/* flush all the magazines of all threads back to pool, and release them */
+void        tlcache_free (tlcache_t * tc);
+
+void      * tlcache_fetch   (tlcache_t * tc);
+
+/* return 0 if cached, -100 if the unit is already in the magazine */
+int         tlcache_recycle (tlcache_t * tc, void * unit);
+
+/* flush the magazine of the calling thread back to pool */
+int         tlcache_flush   (tlcache_t * tc);
+
+int         tlcache_depth   (tlcache_t * tc);
+
+/* statistics of the magazine owned by the calling thread */
+int         tlcache_stat    (tlcache_t * tc, ulong * hit, ulong * miss,
+                             ulong * recycle, ulong * flush);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
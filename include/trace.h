@@ -21,10 +21,38 @@ void   trlog_clean (void * vlog);
 int trlog_line (void * vlog);
 void trlog_rollover (void * vlog, int line);
 
+/* asynchronous mode. records are formatted into the ring buffer of calling
+ * thread without lock, one writer thread writes the rings to file by writev.
+ * when the ring of ringsize bytes is full, the record is dropped after
+ * waiting waitus micro-seconds and counted by trlog_drops. if maxline > 0,
+ * the oldest lines are rolled over once the log exceeds maxline lines */
+int    trlog_async      (void * vlog, int ringsize, int maxline, int waitus);
+void   trlog_async_stop (void * vlog);
+uint64 trlog_drops      (void * vlog);
+
 void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...);
 #define trlog(hlog, rectime, fmt, ...) trlogfile(hlog, rectime, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define tolog(rectime, fmt, ...) trlogfile(g_trace_log, rectime, NULL, __LINE__, fmt, ##__VA_ARGS__)
 
+/* binary records. the format string is registered once by trlog_bin_fmtid
+ * and written to binfile as a definition, each trlog_bin call writes only
+ * the format id, the time and the raw arguments without formatting.
+ * %s arguments are copied, %n is recorded as pointer and not rendered.
+ * binfile is appended, trlog_bin_decode renders it to the text of trlogfile.
+ * the call site of trbin caches its format id, it should log into one hlog */
+int  trlog_bin_open  (void * vlog, char * binfile);
+void trlog_bin_flush (void * vlog);
+int  trlog_bin_fmtid (void * vlog, char * file, int line, char * fmt);
+void trlog_bin       (void * vlog, int fmtid, int rectime, ...);
+long trlog_bin_decode (char * binfile, FILE * out);
+
+#define trbin(hlog, rectime, fmt, ...) do {                                   \
+    static int _trbin_fmtid = -1;                                            \
+    if (_trbin_fmtid < 0)                                                    \
+        _trbin_fmtid = trlog_bin_fmtid(hlog, __FILE__, __LINE__, fmt);       \
+    trlog_bin(hlog, _trbin_fmtid, rectime, ##__VA_ARGS__);                   \
+} while (0)
+
 void printOctet(FILE * fp, void * data, int start, int count, int margin);
 
 #ifdef __cplusplus
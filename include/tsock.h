@@ -305,6 +305,23 @@ int sock_nopush_unset (SOCKET fd);
 
 
 SOCKET tcp_listen       (char * localip, int port, void * psockopt);
+
+/* num listeners of one address by SO_REUSEPORT, for each worker or CPU to
+ * accept on its own socket. SO_REUSEPORT is set on psockopt's copy, the
+ * TCP_DEFER_ACCEPT and TCP_FASTOPEN of psockopt apply to all of them.
+ * cpusteer attaches a classic BPF program on Linux, so the connection is
+ * given to listener (CPU of the softirq % num), and to keep it on the
+ * cache of that CPU, the thread of listener i should run on CPU i.
+ * return the number of listeners put into fds, <0 on error */
+int    tcp_listen_sharded (char * localip, int port, void * psockopt, int num,
+                           int cpusteer, SOCKET * fds);
+
+/* accept up to num pending connections by accept4 on a non-blocking
+ * listener. the sockets are close-on-exec, and non-blocking if nonblk.
+ * addrs may be NULL. a return less than num means the backlog is drained,
+ * or *perr tells the error such as EMFILE that stopped accepting */
+int    tcp_accept_batch (SOCKET listenfd, SOCKET * fds, ep_sockaddr_t * addrs, int num,
+                         int nonblk, int * perr);
 SOCKET tcp_connect_full (char * host, int port, int nonblk, char * lip, int lport, int * succ);
 SOCKET tcp_connect      (char * host, int port, char * lip, int lport);
 SOCKET tcp_nb_connect   (char * host, int port, char * lip, int lport, int * consucc);
@@ -321,6 +338,33 @@ int tcp_sendfile (SOCKET fd, int srcfd, int64 offset, int64 size, int * actnum,
 
 SOCKET udp_listen (char * localip, int port, void * psockopt);
 
+/* batched UDP I/O by recvmmsg/sendmmsg. for receiving, pbuf and size are
+ * set by caller, len, addr and segsize are filled. for sending, pbuf, len
+ * and addr are set, segsize > 0 asks kernel to split pbuf into datagrams
+ * of segsize (UDP_SEGMENT). with udp_gro_set, kernel coalesces datagrams
+ * of one flow and segsize of the received message is reported */
+
+#define UDP_BATCH_MAX  64
+
+typedef struct udp_msg_s {
+    void                    * pbuf;
+    int                       size;
+    int                       len;
+    int                       segsize;
+    int                       flags;
+    socklen_t                 addrlen;
+    struct sockaddr_storage   addr;
+} udp_msg_t;
+
+int udp_gro_set    (SOCKET fd, int onoff);
+
+int udp_recv_batch (SOCKET fd, udp_msg_t * msgs, int num, int * perr);
+int udp_send_batch (SOCKET fd, udp_msg_t * msgs, int num, int * perr);
+
+/* fetch the buffers of msgs from bpool, or recycle them to it */
+int  udp_msg_bpool   (udp_msg_t * msgs, int num, void * pool);
+void udp_msg_recycle (udp_msg_t * msgs, int num, void * pool);
+
 
 #define ADDR_TYPE_UNKNOWN   0
 #define ADDR_TYPE_ETHERNET  1
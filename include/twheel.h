@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _TWHEEL_H_
+#define _TWHEEL_H_
+
+#include "btime.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* hashed hierarchical timing wheel. time is counted in ticks of tickms
+ * milli-seconds from the btime_t when wheel is created. the root wheel has
+ * TW_ROOT_SLOTS slots of one tick, each upper wheel has TW_LEVEL_SLOTS slots
+ * of the span of lower wheel, the timers in one slot of upper wheel are
+ * moved down when the lower wheel turns around. the timers are linked in
+ * doubly linked lists, adding, cancelling and re-arming are O(1).
+ *
+ * the ms given to twheel_add is counted from the time of last twheel_run,
+ * so adding needs no system call, and the timer expires in ms to ms+tickms
+ * after then. the timers beyond the span of all wheels are kept in the last
+ * slots and moved down again when they come.
+ *
+ * the timer nodes are fetched from the mpool_t of wheel. the wheel is not
+ * locked, it should be used in one thread such as the thread of evloop */
+
+#define TW_ROOT_BITS     8
+#define TW_LEVEL_BITS    6
+#define TW_LEVELS        5
+#define TW_ROOT_SLOTS    (1 << TW_ROOT_BITS)
+#define TW_LEVEL_SLOTS   (1 << TW_LEVEL_BITS)
+
+#define TW_BATCH         64
+
+/* the timer is freed after callback returns, except that it is re-armed
+ * by twheel_reset in callback */
+typedef int TWTimerCB (void * para, void * timer);
+
+/* the paras of expired timers without a TWTimerCB are given in batches of
+ * at most TW_BATCH, after these timers are freed */
+typedef int TWBatchCB (void * cbpara, void ** paras, int num);
+
+void * twheel_new  (int tickms);
+void   twheel_free (void * vtw);
+
+void   twheel_set_batch (void * vtw, TWBatchCB * cb, void * cbpara);
+
+int    twheel_num  (void * vtw);
+
+void * twheel_add   (void * vtw, long ms, TWTimerCB * cb, void * para);
+
+/* cancel the pending timer. return 0 if cancelled */
+int    twheel_del   (void * vtw, void * vtimer);
+
+/* re-arm the timer to expire ms after last run, such as an idle timeout
+ * that is extended whenever data comes */
+int    twheel_reset (void * vtw, void * vtimer, long ms);
+
+void * twheel_para  (void * vtimer);
+
+/* turn the wheels to now, or to current time if now is NULL, and call back
+ * the expired timers. now is the monotonic time of btime_mono, so that the
+ * wall clock adjustment does not fire or stall the timers.
+ * return the number of timers expired */
+int    twheel_run  (void * vtw, btime_t * now);
+
+/* the milli-seconds from now till the nearest slot holding timers, it may
+ * be earlier than the timers when they are to be moved down. return -1 if
+ * there is no timer */
+long   twheel_next_ms (void * vtw, btime_t * now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#ifndef _ULIST_H_
+#define _ULIST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* unrolled linked list. the data pointers are kept in chunks of UL_CHUNK_ITEMS
+ * slots, the chunks are doubly linked and fetched from the mpool_t of list.
+ * unlike dlist_t, the data need not reserve the 2 pointers of node. adding
+ * and removing at head and tail are O(1), one chunk is fetched every
+ * UL_CHUNK_ITEMS appends, and walking reads the pointers of one chunk in
+ * sequence, so it fits the FIFO queues of pending tasks or messages.
+ * the list is not locked. */
+
+#define UL_CHUNK_ITEMS  13
+
+typedef struct ulist_st ulist_t;
+
+ulist_t * ul_new ();
+void      ul_free (ulist_t * ul);
+
+/* release the list, and call the function to release each data */
+void      ul_free_all (ulist_t * ul, void * vfunc);
+
+/* remove all data and give the chunks back to the pool */
+void      ul_zero (ulist_t * ul);
+
+int       ul_num (ulist_t * ul);
+
+int       ul_prepend (ulist_t * ul, void * data);
+int       ul_append  (ulist_t * ul, void * data);
+
+void    * ul_rm_head (ulist_t * ul);
+void    * ul_rm_tail (ulist_t * ul);
+
+void    * ul_first (ulist_t * ul);
+void    * ul_last  (ulist_t * ul);
+
+/* return the data at loc, walking chunk by chunk from the nearer end */
+void    * ul_get (ulist_t * ul, int loc);
+
+/* return the index of data in the list, -1 if not found */
+int       ul_index (ulist_t * ul, void * data);
+
+/* call func(para, data) on each data from head on, stop if it returns
+ * not zero. return the number of data visited */
+int       ul_iterate (ulist_t * ul, int (*func)(void *, void *), void * para);
+
+/* return the first data that cmp(data, pattern) returns 0 */
+void    * ul_search (ulist_t * ul, void * pattern, int (*cmp)(void *, void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
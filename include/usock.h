@@ -30,6 +30,77 @@ int usock_connect (const char *name);
 int usock_nb_connect (const char * name, int * succ);
 
 
+/* a connected pair of SOCK_SEQPACKET sockets, whose message boundaries are
+ * kept, for a parent and the worker it forks. return 0 if all OK */
+int usock_pair (int * fds);
+
+/* pass nfd descriptors by SCM_RIGHTS along with len bytes of data. one
+ * byte is sent if len is 0, since the control data needs one byte at least.
+ * the receiver gets the descriptors at the byte they arrive with, they are
+ * opened close-on-exec. descriptors more than *nfd are closed at receiving.
+ * return the bytes sent or received, <0 on error */
+
+#define USOCK_FD_MAX     16
+
+int usock_send_fd (int fd, void * data, int len, int * fds, int nfd);
+int usock_recv_fd (int fd, void * buf, int size, int * fds, int * nfd);
+
+/* batched control messages by one sendmmsg/recvmmsg. for sending, pbuf,
+ * len and the nfd descriptors of fds are set. for receiving, pbuf, size
+ * and fds of fdsize are set, len and nfd are filled. return the number of
+ * messages sent or received, less than num if the socket would block */
+
+#define USOCK_BATCH_MAX  64
+
+typedef struct usock_msg_s {
+    void    * pbuf;
+    int       size;
+    int       len;
+    int     * fds;
+    int       fdsize;
+    int       nfd;
+    int       flags;
+} usock_msg_t;
+
+int usock_send_batch (int fd, usock_msg_t * msgs, int num, int * perr);
+int usock_recv_batch (int fd, usock_msg_t * msgs, int num, int * perr);
+
+
+/* buffer ring shared between two processes by a memfd. the producer
+ * allocates a region, fills it, and sends its position and length over
+ * the socket. the consumer, holding the memfd passed by usock_send_fd,
+ * reads the region in place and releases it. the payload never goes
+ * through the socket.
+ *
+ * one process allocates and the other releases, in the order allocated.
+ * a region never wraps: the bytes left at the end of the ring are skipped
+ * when a region doesn't fit in them. the positions increase monotonically,
+ * the offset in the ring is the position modulo its size */
+
+void * usring_create (int64 size);
+
+/* map the ring of memfd received from the creator. the ring owns memfd
+ * and closes it by usring_free */
+void * usring_open   (int memfd);
+void   usring_free   (void * vring);
+
+int    usring_fd     (void * vring);
+int64  usring_size   (void * vring);
+
+/* bytes not yet released by the consumer */
+int64  usring_used   (void * vring);
+
+/* allocate len bytes at the producer, return the position and the region
+ * in *pbuf, or -1 if the ring has no room before the consumer releases */
+int64  usring_alloc  (void * vring, int len, void ** pbuf);
+
+/* the region of pos and len at the consumer, NULL if it's not inside */
+void * usring_ptr    (void * vring, int64 pos, int len);
+
+/* the consumer is done with the region and all the ones before it */
+int    usring_release (void * vring, int64 pos, int len);
+
+
 #ifdef __cplusplus
 }
 #endif 
@@ -66,8 +66,50 @@ int    vstar_pop    (vstar_t * var);
  */
 
 void    vstar_sort_by       (vstar_t * var, int (*element_cmp)(void *, void *));
+
+/* same as vstar_sort_by, the sorting is parallelized in thpool_t pool */
+void    vstar_psort_by      (vstar_t * var, int (*element_cmp)(void *, void *), void * pool);
+
+/* stable LSD radix sort by the key of keylen bytes at keyoff of each unit.
+ * the integer key is 1, 2, 4 or 8 bytes in native byte order, the bytes
+ * key is ordered like memcmp */
+#define VSTAR_KEY_UINT   0
+#define VSTAR_KEY_INT    1
+#define VSTAR_KEY_BYTES  2
+
+int     vstar_radix_sort    (vstar_t * var, int keyoff, int keylen, int keytype);
+
+
+/* frozen lookup table of the integer keys of a sorted vstar_t, kept in
+ * Eytzinger (BFS) order so that the searching touches the cache lines in
+ * a row and prefetches 3 levels ahead, and needs no comparing callback.
+ * the key is 1, 2, 4 or 8 bytes like vstar_radix_sort, the table is not
+ * changed by later updates of the vstar */
+typedef struct EytzTab_ {
+    int       num;
+    int       keytype;
+
+    uint64  * key;    //key[1..num] in BFS order, signed ones are offset
+    int     * loc;    //index in vstar of key[i]
+    void    * mem;
+} eytz_t;
+
+void  * vstar_eytz_build (vstar_t * var, int keyoff, int keylen, int keytype);
+void    eytz_free    (void * vez);
+int     eytz_num     (void * vez);
+
+/* return the index in vstar of the first key not less than key, or num if
+ * all are less, the same as vstar_findloc_by. found is set if equal. the
+ * successor on a consistent-hash ring is at index 0 when num is returned.
+ * the signed key is passed as int64 cast to uint64 */
+int     eytz_findloc (void * vez, uint64 key, int * found);
 int     vstar_insert_by     (vstar_t * var, void * item, int (*pattern_cmp)(void *, void *));
 
+/* insert num units of contiguous items into the sorted array. the batch is
+ * sorted and merged from the end, each unit is moved once. return the
+ * number of units */
+int     vstar_insert_batch_by (vstar_t * var, void * items, int num, int (*element_cmp)(void *, void *));
+
 void  * vstar_find_by       (vstar_t * var, void * pattern, int (*pattern_cmp)(void *, void *));
 int     vstar_findloc_by    (vstar_t * ar, void * pattern, int (*cmp)(void *, void *), int * found);
 arr_t * vstar_find_all_by   (vstar_t * var, void * pattern, int (*pattern_cmp)(void *, void *));
@@ -25,6 +25,9 @@ typedef struct wordlib_ {
     uint8       charset;
     hashtab_t * subtab;
     void      * itempool;
+
+    /* compiled image mapped by word_lib_mmap, no word can be added then */
+    void      * image;
 } WordLib;
 
 
@@ -42,6 +45,15 @@ int    word_lib_del (void * vlib, void * pbyte, int bytelen);
  *  reslen return the lengthof the words; return value is the position
  * if not found, return value < 0 */
 int word_lib_fwmaxmatch (void * vwlib, void * pbyte, int len, void ** pres, int * reslen, void ** pvar);
+
+/* write the words into a binary image of double-array trie and value table.
+ * the varpara of words are saved as integers, the varfree is not saved */
+int    word_lib_compile (void * vwlib, char * file);
+
+/* map the image written by word_lib_compile read-only, processes mapping
+ * the same file share its pages. word_lib_get and word_lib_fwmaxmatch read
+ * the image directly, the library is freed by word_lib_clean */
+void * word_lib_mmap (char * file);
  
 #ifdef __cplusplus
 }
@@ -9,11 +9,22 @@
 #include "strutil.h"
 #include "arfifo.h"
 #include "dynarr.h"
+#include "dabuild.h"
 #include "actrie.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 void * acnode_alloc ();
 int    acnode_free (void * vnode);
 int    acnode_recursive_free (void * vnode);
+
+static void acdat_free (acdat_t * dat);
+static int  acdat_get (actrie_t * trie, uint8 * pbyte, int bytelen, void ** pvar);
+static int  acdat_match (actrie_t * trie, uint8 * pbyte, int len);
  
 static int acnode_cmp_item (void * a, void * b)
 {
@@ -163,6 +174,11 @@ int actrie_free (void *vtrie)
         acnode_recursive_free(trie->root);
     }
 
+    if (trie->dat) {
+        acdat_free(trie->dat);
+        trie->dat = NULL;
+    }
+
     if (trie->itempool) {
         mpool_free(trie->itempool);
         trie->itempool = NULL;
@@ -187,6 +203,13 @@ int actrie_add (void * vtrie, void * vbyte, int bytelen, void * para)
     if (!pbyte) return -2;
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return -3;
+
+    if (trie->frozen) return -20;
+
+    if (trie->dat) {
+        acdat_free(trie->dat);
+        trie->dat = NULL;
+    }
  
     if ((node = trie->root) == NULL) {
         trie->root = node = acnode_fetch(trie);
@@ -236,6 +259,13 @@ int actrie_del (void * vtrie, void * vbyte, int bytelen)
     if (!pbyte) return -2;
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return -3;
+
+    if (trie->frozen) return -20;
+
+    if (trie->dat) {
+        acdat_free(trie->dat);
+        trie->dat = NULL;
+    }
  
     node = trie->root;
     if (!node) return -100;
@@ -283,7 +313,7 @@ int actrie_failjump (void * vtrie)
 
     if (!trie) return -1;
 
-    if (trie->build_failjump) return 0;
+    if (trie->build_failjump || !trie->root) return 0;
 
     fifo = ar_fifo_new(4);
 
@@ -347,6 +377,9 @@ int actrie_get (void * vtrie, void * vbyte, int bytelen, void ** pvar)
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return 0;
 
+    if (trie->dat)
+        return acdat_get(trie, pbyte, bytelen, pvar);
+
     node = trie->root;
     if (!node) return 0;
 
@@ -392,6 +425,9 @@ int actrie_match (void * vtrie, void * vbyte, int len, void ** pres, int * resle
     if (len < 0) len = str_len(pbyte);
     if (len <= 0) return -3;
  
+    if (trie->dat)
+        return acdat_match(trie, pbyte, len);
+
     node = trie->root;
     if (!node) return -100;
 
@@ -472,3 +508,575 @@ int actrie_fwmaxmatch (void * vtrie, void * vbyte, int len, void ** pres, int *
     return -100;
 }
 
+
+/* the per-state arrays of the builder */
+#define ACB_FAIL  0
+#define ACB_DICT  1
+#define ACB_WORD  2
+
+static int64 acdat_memlen (uint32 size, uint32 words)
+{
+    return sizeof(acdat_hdr_t) + (int64)words * (sizeof(uint64) + sizeof(uint32)) +
+           (int64)size * (sizeof(daunit_t) + sizeof(int32) * 3);
+}
+
+/* set the array pointers into the block of file layout */
+static int acdat_layout (acdat_t * dat, void * mem, int64 len)
+{
+    acdat_hdr_t * hdr = (acdat_hdr_t *)mem;
+    uint8       * p = NULL;
+    int           i;
+
+    if (len < (int64)sizeof(*hdr)) return -1;
+
+    if (hdr->magic != ACDAT_MAGIC || hdr->version != ACDAT_VERSION)
+        return -2;
+
+    if (hdr->codes > 256 || hdr->size <= hdr->codes || hdr->size > (1 << 30))
+        return -3;
+
+    for (i = 0; i < 256; i++) {
+        if (hdr->cmap[i] > hdr->codes) return -3;
+    }
+
+    if (acdat_memlen(hdr->size, hdr->words) != len)
+        return -4;
+
+    p = (uint8 *)mem + sizeof(*hdr);
+
+    dat->hdr = hdr;
+    dat->para = (uint64 *)p;  p += (int64)hdr->words * sizeof(uint64);
+    dat->wlen = (uint32 *)p;  p += (int64)hdr->words * sizeof(uint32);
+    dat->unit = (daunit_t *)p;  p += (int64)hdr->size * sizeof(daunit_t);
+    dat->fail = (int32 *)p;  p += (int64)hdr->size * sizeof(int32);
+    dat->dict = (int32 *)p;  p += (int64)hdr->size * sizeof(int32);
+    dat->word = (int32 *)p;
+
+    dat->memlen = len;
+
+    return 0;
+}
+
+static void acdat_free (acdat_t * dat)
+{
+    if (!dat) return;
+
+#ifdef UNIX
+    if (dat->mapbase) {
+        munmap(dat->mapbase, dat->maplen);
+        dat->mapbase = NULL;
+    }
+#endif
+
+    if (dat->mem) {
+        kfree(dat->mem);
+        dat->mem = NULL;
+    }
+
+    kfree(dat);
+}
+
+int actrie_compile (void * vtrie)
+{
+    actrie_t    * trie = (actrie_t *)vtrie;
+    acnode_t    * root = NULL;
+    acnode_t    * node = NULL;
+    acnode_t    * subnode = NULL;
+    acnode_t    * subs[256];
+    acdat_t     * dat = NULL;
+    acdat_hdr_t * hdr = NULL;
+    dabuild_t     bd;
+    int32         extinit[3] = {0, 0, -1};
+    void        * fifo = NULL;
+    uint64      * para = NULL;
+    uint32      * wlen = NULL;
+    uint32        freq[256];
+    uint16        cmap[256];
+    int           codes[256];
+    int           i, j, k, num, ncode = 0;
+    int           nword = 0, widx = 0;
+    int           s, t, f, u, depth, base, size;
+    int           ret = 0;
+
+    if (!trie) return -1;
+
+    if (trie->dat) return 0;
+
+    if ((root = trie->root) == NULL) return -2;
+
+    memset(&bd, 0, sizeof(bd));
+    memset(freq, 0, sizeof(freq));
+    memset(cmap, 0, sizeof(cmap));
+
+    fifo = ar_fifo_new(4);
+    if (!fifo) return -3;
+
+    /* count the bytes on transitions, frequent bytes get small codes */
+    ar_fifo_push(fifo, root);
+
+    while (ar_fifo_num(fifo) > 0) {
+        node = ar_fifo_out(fifo);
+
+        if (node != root) {
+            freq[node->ch]++;
+            if (node->phrase_end) nword++;
+        }
+
+        for (i = 0; i < arr_num(node->sublist); i++) {
+            subnode = arr_value(node->sublist, i);
+            if (subnode) ar_fifo_push(fifo, subnode);
+        }
+    }
+
+    for (ncode = 0; ncode < 256; ncode++) {
+        for (k = -1, i = 0; i < 256; i++) {
+            if (freq[i] > 0 && cmap[i] == 0 && (k < 0 || freq[i] > freq[k]))
+                k = i;
+        }
+        if (k < 0) break;
+        cmap[k] = ncode + 1;
+    }
+
+    para = kzalloc((nword + 1) * sizeof(uint64));
+    wlen = kzalloc((nword + 1) * sizeof(uint32));
+    if (!para || !wlen || dab_init(&bd, 3, extinit) < 0) {
+        ret = -3;
+        goto end;
+    }
+
+    /* place the states in breadth-first order, the failure links of the
+     * children are found from the states of smaller depth already placed */
+    ar_fifo_zero(fifo);
+    ar_fifo_push(fifo, root);
+    ar_fifo_push(fifo, (void *)(long)0);
+    ar_fifo_push(fifo, (void *)(long)0);
+
+    while (ar_fifo_num(fifo) > 0) {
+        node = ar_fifo_out(fifo);
+        s = (int)(long)ar_fifo_out(fifo);
+        depth = (int)(long)ar_fifo_out(fifo);
+
+        for (num = 0, i = 0; i < arr_num(node->sublist); i++) {
+            subnode = arr_value(node->sublist, i);
+            if (!subnode) continue;
+
+            /* insert by code in ascending order */
+            for (j = num; j > 0 && codes[j - 1] > cmap[subnode->ch]; j--) {
+                codes[j] = codes[j - 1];
+                subs[j] = subs[j - 1];
+            }
+            codes[j] = cmap[subnode->ch];
+            subs[j] = subnode;
+            num++;
+        }
+
+        if (num == 0) continue;
+
+        base = dab_place(&bd, s, codes, num);
+        if (base < 0) {
+            ret = -4;
+            goto end;
+        }
+
+        for (i = 0; i < num; i++) {
+            t = base + codes[i];
+
+            if (subs[i]->phrase_end) {
+                bd.ext[ACB_WORD][t] = widx;
+                para[widx] = (uint64)(ulong)subs[i]->para;
+                wlen[widx] = depth + 1;
+                widx++;
+            }
+
+            bd.ext[ACB_FAIL][t] = 0;
+            for (f = s; f != 0; ) {
+                f = bd.ext[ACB_FAIL][f];
+                u = bd.unit[f].base + codes[i];
+                if (u < bd.size && bd.unit[u].check == f) {
+                    bd.ext[ACB_FAIL][t] = u;
+                    break;
+                }
+            }
+
+            f = bd.ext[ACB_FAIL][t];
+            bd.ext[ACB_DICT][t] = bd.ext[ACB_WORD][f] >= 0 ? f : bd.ext[ACB_DICT][f];
+
+            ar_fifo_push(fifo, subs[i]);
+            ar_fifo_push(fifo, (void *)(long)t);
+            ar_fifo_push(fifo, (void *)(long)(depth + 1));
+        }
+    }
+
+    /* any transition base + code must fall inside the array */
+    size = dab_size(&bd, ncode);
+    if (size < 257) size = 257;
+
+    if (dab_grow(&bd, size) < 0) {
+        ret = -3;
+        goto end;
+    }
+
+    dat = kzalloc(sizeof(*dat));
+    if (!dat) {
+        ret = -3;
+        goto end;
+    }
+
+    dat->mem = kzalloc(acdat_memlen(size, nword));
+    if (!dat->mem) {
+        ret = -3;
+        goto end;
+    }
+
+    hdr = (acdat_hdr_t *)dat->mem;
+    hdr->magic = ACDAT_MAGIC;
+    hdr->version = ACDAT_VERSION;
+    hdr->reverse = trie->reverse;
+    hdr->codes = ncode;
+    hdr->size = size;
+    hdr->words = nword;
+    memcpy(hdr->cmap, cmap, sizeof(cmap));
+
+    acdat_layout(dat, dat->mem, acdat_memlen(size, nword));
+
+    memcpy(dat->para, para, nword * sizeof(uint64));
+    memcpy(dat->wlen, wlen, nword * sizeof(uint32));
+    memcpy(dat->unit, bd.unit, size * sizeof(daunit_t));
+    memcpy(dat->fail, bd.ext[ACB_FAIL], size * sizeof(int32));
+    memcpy(dat->dict, bd.ext[ACB_DICT], size * sizeof(int32));
+    memcpy(dat->word, bd.ext[ACB_WORD], size * sizeof(int32));
+
+    /* the root has no parent */
+    dat->unit[0].check = -1;
+
+    trie->dat = dat;
+    dat = NULL;
+
+end:
+    if (dat) acdat_free(dat);
+    if (para) kfree(para);
+    if (wlen) kfree(wlen);
+    dab_free(&bd);
+    ar_fifo_free(fifo);
+
+    return ret;
+}
+
+int actrie_save (void * vtrie, char * file)
+{
+    actrie_t  * trie = (actrie_t *)vtrie;
+    acdat_t   * dat = NULL;
+    FILE      * fp = NULL;
+    int         ret = 0;
+
+    if (!trie || !file) return -1;
+
+    if (!trie->dat && (ret = actrie_compile(trie)) < 0)
+        return ret;
+
+    dat = (acdat_t *)trie->dat;
+
+    fp = fopen(file, "wb");
+    if (!fp) return -2;
+
+    if (fwrite(dat->hdr, 1, dat->memlen, fp) != (size_t)dat->memlen) {
+        fclose(fp);
+        return -3;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void * actrie_load (char * file, void * matchcb)
+{
+    actrie_t    * trie = NULL;
+    acdat_t     * dat = NULL;
+    int64         fsize = 0;
+#ifdef UNIX
+    struct stat   st;
+    void        * pmap = NULL;
+    int           fd = -1;
+#else
+    FILE        * fp = NULL;
+#endif
+
+    if (!file) return NULL;
+
+    dat = kzalloc(sizeof(*dat));
+    if (!dat) return NULL;
+
+#ifdef UNIX
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        kfree(dat);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (int64)sizeof(acdat_hdr_t)) {
+        close(fd);
+        kfree(dat);
+        return NULL;
+    }
+
+    fsize = st.st_size;
+    pmap = mmap(NULL, fsize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (pmap == MAP_FAILED) {
+        kfree(dat);
+        return NULL;
+    }
+
+    dat->mapbase = pmap;
+    dat->maplen = fsize;
+
+    if (acdat_layout(dat, pmap, fsize) < 0) {
+        acdat_free(dat);
+        return NULL;
+    }
+#else
+    fp = fopen(file, "rb");
+    if (!fp) {
+        kfree(dat);
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (fsize < (int64)sizeof(acdat_hdr_t) || (dat->mem = kalloc(fsize)) == NULL ||
+        fread(dat->mem, 1, fsize, fp) != (size_t)fsize ||
+        acdat_layout(dat, dat->mem, fsize) < 0)
+    {
+        fclose(fp);
+        acdat_free(dat);
+        return NULL;
+    }
+
+    fclose(fp);
+#endif
+
+    trie = kzalloc(sizeof(*trie));
+    if (!trie) {
+        acdat_free(dat);
+        return NULL;
+    }
+
+    trie->entries = 128;
+    trie->matchcb = matchcb;
+    trie->reverse = dat->hdr->reverse ? 1 : 0;
+    trie->build_failjump = 1;
+    trie->dat = dat;
+    trie->frozen = 1;
+
+    return trie;
+}
+
+/* follow the goto transitions only, return the length of the longest
+ * pattern that is the prefix of pbyte */
+static int acdat_get (actrie_t * trie, uint8 * pbyte, int bytelen, void ** pvar)
+{
+    acdat_t   * dat = (acdat_t *)trie->dat;
+    daunit_t  * unit = dat->unit;
+    uint16    * cmap = dat->hdr->cmap;
+    int32       s = 0, t;
+    int32       w = -1;
+    int         i, c;
+    uint8       ch;
+
+    for (i = 0; i < bytelen; i++) {
+        ch = trie->reverse ? pbyte[bytelen - 1 - i] : pbyte[i];
+
+        if ((c = cmap[ch]) == 0) break;
+
+        t = unit[s].base + c;
+        if (unit[t].check != s) break;
+
+        s = t;
+        if (dat->word[s] >= 0) w = dat->word[s];
+    }
+
+    if (w >= 0) {
+        if (pvar) *pvar = (void *)(ulong)dat->para[w];
+        return dat->wlen[w];
+    }
+
+    return 0;
+}
+
+static int acdat_match (actrie_t * trie, uint8 * pbyte, int len)
+{
+    acdat_t   * dat = (acdat_t *)trie->dat;
+    daunit_t  * unit = dat->unit;
+    int32     * fail = dat->fail;
+    int32     * dict = dat->dict;
+    int32     * word = dat->word;
+    uint16    * cmap = dat->hdr->cmap;
+    int32       s = 0, t, o;
+    int         i, c, plen;
+    uint8       ch;
+    int         mat = 0;
+
+    if (!trie->matchcb) return -200;
+
+    for (i = 0; i < len; i++) {
+        ch = trie->reverse ? pbyte[len - 1 - i] : pbyte[i];
+
+        /* the byte is not in any pattern */
+        if ((c = cmap[ch]) == 0) {
+            s = 0;
+            continue;
+        }
+
+        for ( ; ; ) {
+            t = unit[s].base + c;
+            if (unit[t].check == s) {
+                s = t;
+                break;
+            }
+            if (s == 0) break;
+            s = fail[s];
+        }
+
+        for (o = word[s] >= 0 ? s : dict[s]; o > 0; o = dict[o]) {
+            plen = dat->wlen[word[o]];
+            (*trie->matchcb)((void *)(ulong)dat->para[word[o]],
+                             pbyte, len,
+                             trie->reverse ? pbyte + len - 1 - i : pbyte + i - plen + 1,
+                             plen);
+            mat++;
+        }
+    }
+
+    return mat ? mat : -200;
+}
+
+
+/* take the next input of non-zero length into lane j */
+static int aclane_next (uint8 ** cur, uint8 ** end, int * input, int j, int reverse,
+                        void ** inputs, int * lens, int num, int * next)
+{
+    uint8  * pbyte = NULL;
+    int      k, len;
+
+    for (k = *next; k < num; k++) {
+        if ((pbyte = inputs[k]) == NULL) continue;
+
+        len = lens ? lens[k] : -1;
+        if (len < 0) len = str_len(pbyte);
+        if (len <= 0) continue;
+
+        if (reverse) {
+            cur[j] = pbyte + len - 1;
+            end[j] = pbyte - 1;
+        } else {
+            cur[j] = pbyte;
+            end[j] = pbyte + len;
+        }
+        input[j] = k;
+
+        *next = k + 1;
+        return 1;
+    }
+
+    *next = num;
+    return 0;
+}
+
+int actrie_match_batch (void * vtrie, void ** inputs, int * lens, int num,
+                        acmatch_t * mats, int maxmat, int * counts)
+{
+    actrie_t   * trie = (actrie_t *)vtrie;
+    acdat_t    * dat = NULL;
+    daunit_t   * unit = NULL;
+    int32      * fail = NULL;
+    int32      * dict = NULL;
+    int32      * word = NULL;
+    uint16     * cmap = NULL;
+    uint8      * cur[AC_BATCH_LANES];
+    uint8      * end[AC_BATCH_LANES];
+    int32        state[AC_BATCH_LANES];
+    int          input[AC_BATCH_LANES];
+    uint8      * p = NULL;
+    int32        s, t, o;
+    int          j, c, n = 0, next = 0;
+    int          plen, total = 0;
+    int          reverse, step;
+
+    if (!trie) return -1;
+    if (!inputs || num < 0) return -2;
+    if (!mats) maxmat = 0;
+
+    if (!trie->dat && actrie_compile(trie) < 0)
+        return -100;
+
+    dat = (acdat_t *)trie->dat;
+    unit = dat->unit;
+    fail = dat->fail;
+    dict = dat->dict;
+    word = dat->word;
+    cmap = dat->hdr->cmap;
+    reverse = trie->reverse;
+    step = reverse ? -1 : 1;
+
+    if (counts) memset(counts, 0, num * sizeof(int));
+
+    while (n < AC_BATCH_LANES &&
+           aclane_next(cur, end, input, n, reverse, inputs, lens, num, &next))
+        state[n++] = 0;
+
+    while (n > 0) {
+        for (j = 0; j < n; ) {
+            if ((p = cur[j]) == end[j]) {
+                /* the finished lane takes the next input or the last lane */
+                if (aclane_next(cur, end, input, j, reverse, inputs, lens, num, &next)) {
+                    state[j] = 0;
+                } else if (j < --n) {
+                    cur[j] = cur[n];
+                    end[j] = end[n];
+                    input[j] = input[n];
+                    state[j] = state[n];
+                }
+                continue;
+            }
+
+            cur[j] = p + step;
+            s = state[j];
+
+            if ((c = cmap[*p]) == 0) {
+                state[j++] = 0;
+                continue;
+            }
+
+            for ( ; ; ) {
+                t = unit[s].base + c;
+                if (unit[t].check == s) {
+                    s = t;
+                    break;
+                }
+                if (s == 0) break;
+                s = fail[s];
+            }
+            state[j] = s;
+
+            for (o = word[s] >= 0 ? s : dict[s]; o > 0; o = dict[o]) {
+                if (total < maxmat) {
+                    plen = dat->wlen[word[o]];
+                    mats[total].input = input[j];
+                    mats[total].pos = (int)(p - (uint8 *)inputs[input[j]]) - (reverse ? 0 : plen - 1);
+                    mats[total].len = plen;
+                    mats[total].para = (void *)(ulong)dat->para[word[o]];
+                }
+                if (counts) counts[input[j]]++;
+                total++;
+            }
+
+            j++;
+        }
+    }
+
+    return total;
+}
+
@@ -6,8 +6,15 @@
 #include "btype.h"
 #include "memory.h"
 #include "mthread.h"
+#include "btime.h"
 #include "arfifo.h"
 
+#if defined(_LINUX_)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
 #define MIN_AF_NODES  8
 typedef int FreeFunc (void * a);
 
@@ -203,3 +210,538 @@ void * ar_fifo_back (void * vaf)
     return ar_fifo_value(af, af->num - 1);
 }
 
+
+/* blocking wait of the lock-free rings. the waiter samples the futex word,
+ * registers itself and sleeps only if the ring state is unchanged, the
+ * other side bumps the word and wakes only when someone is waiting */
+
+typedef struct ring_waiter_ {
+    uint32    word;
+    int       waiters;
+} ringwait_t;
+
+static void ring_futex_wait (ringwait_t * rw, uint32 val, int ms)
+{
+#if defined(_LINUX_)
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    syscall(SYS_futex, &rw->word, FUTEX_WAIT_PRIVATE, val, ms >= 0 ? &ts : NULL, NULL, 0);
+#else
+    /* no futex, poll in short slices */
+    if (__atomic_load_n(&rw->word, __ATOMIC_ACQUIRE) == val)
+        usleep(ms >= 0 && ms < 1 ? 1000 : 500);
+#endif
+}
+
+static void ring_futex_wake (ringwait_t * rw)
+{
+    if (__atomic_load_n(&rw->waiters, __ATOMIC_SEQ_CST) <= 0)
+        return;
+
+    __atomic_add_fetch(&rw->word, 1, __ATOMIC_SEQ_CST);
+#if defined(_LINUX_)
+    syscall(SYS_futex, &rw->word, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, NULL, NULL, 0);
+#endif
+}
+
+typedef int RingReady (void * ring);
+
+/* wait till ready(ring) or ms elapsed, negative ms waits forever.
+ * return 0 if ready */
+static int ring_wait (ringwait_t * rw, RingReady * ready, void * ring, int ms)
+{
+    btime_t  deadline, now;
+    uint32   val;
+    long     left = ms;
+
+    if ((*ready)(ring)) return 0;
+    if (ms == 0) return -1;
+
+    if (ms > 0) btime_mono_add(&deadline, ms);
+
+    for ( ; ; ) {
+        val = __atomic_load_n(&rw->word, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&rw->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if ((*ready)(ring)) {
+            __atomic_sub_fetch(&rw->waiters, 1, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+
+        ring_futex_wait(rw, val, ms > 0 ? (int)left : -1);
+        __atomic_sub_fetch(&rw->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if ((*ready)(ring)) return 0;
+
+        if (ms > 0) {
+            btime_mono(&now);
+            left = btime_diff_ms(&now, &deadline);
+            if (left <= 0) return -1;
+        }
+    }
+}
+
+static int ring_size_pow2 (int size)
+{
+    int  num = MIN_AF_NODES;
+
+    while (num < size && num < (1 << 30)) num <<= 1;
+
+    return num;
+}
+
+
+/* bounded MPMC ring of D. Vyukov. each cell carries a sequence number,
+ * the producer owns the cell whose sequence equals the enqueue position and
+ * the consumer owns the one whose sequence is position + 1 */
+
+typedef struct mpmc_cell_ {
+    ulong     seq;
+    void    * data;
+} mpmc_cell_t;
+
+typedef struct mpmc_ring_ {
+    mpmc_cell_t * cells;
+    ulong         mask;
+    uint8         pad0[64 - sizeof(void *) - sizeof(ulong)];
+
+    ulong         enqpos;
+    uint8         pad1[64 - sizeof(ulong)];
+
+    ulong         deqpos;
+    uint8         pad2[64 - sizeof(ulong)];
+
+    ringwait_t    notempty;
+    ringwait_t    notfull;
+} mpmc_ring_t;
+
+void * mpmc_ring_new (int size)
+{
+    mpmc_ring_t * mr = NULL;
+    ulong         i;
+
+    mr = kzalloc(sizeof(*mr));
+    if (!mr) return NULL;
+
+    size = ring_size_pow2(size);
+
+    mr->cells = kzalloc(sizeof(mpmc_cell_t) * size);
+    if (!mr->cells) {
+        kfree(mr);
+        return NULL;
+    }
+
+    mr->mask = size - 1;
+    for (i = 0; i < (ulong)size; i++)
+        mr->cells[i].seq = i;
+
+    return mr;
+}
+
+void mpmc_ring_free (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+
+    if (!mr) return;
+
+    if (mr->cells) kfree(mr->cells);
+    kfree(mr);
+}
+
+int mpmc_ring_size (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+
+    if (!mr) return 0;
+
+    return (int)mr->mask + 1;
+}
+
+int mpmc_ring_num (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    ulong         enq, deq;
+
+    if (!mr) return 0;
+
+    deq = __atomic_load_n(&mr->deqpos, __ATOMIC_ACQUIRE);
+    enq = __atomic_load_n(&mr->enqpos, __ATOMIC_ACQUIRE);
+
+    return (enq > deq) ? (int)(enq - deq) : 0;
+}
+
+static int mpmc_ring_put (mpmc_ring_t * mr, void * value)
+{
+    mpmc_cell_t * cell = NULL;
+    ulong         pos, seq;
+    long          dif;
+
+    pos = __atomic_load_n(&mr->enqpos, __ATOMIC_RELAXED);
+
+    for ( ; ; ) {
+        cell = &mr->cells[pos & mr->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (long)seq - (long)pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&mr->enqpos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1;  //full
+        } else {
+            pos = __atomic_load_n(&mr->enqpos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = value;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void * mpmc_ring_get (mpmc_ring_t * mr)
+{
+    mpmc_cell_t * cell = NULL;
+    void        * value = NULL;
+    ulong         pos, seq;
+    long          dif;
+
+    pos = __atomic_load_n(&mr->deqpos, __ATOMIC_RELAXED);
+
+    for ( ; ; ) {
+        cell = &mr->cells[pos & mr->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (long)seq - (long)(pos + 1);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&mr->deqpos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return NULL;  //empty
+        } else {
+            pos = __atomic_load_n(&mr->deqpos, __ATOMIC_RELAXED);
+        }
+    }
+
+    value = cell->data;
+    __atomic_store_n(&cell->seq, pos + mr->mask + 1, __ATOMIC_RELEASE);
+
+    return value;
+}
+
+int mpmc_ring_push (void * vmr, void * value)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+
+    if (!mr || !value) return -1;
+
+    if (mpmc_ring_put(mr, value) < 0) return -1;
+
+    ring_futex_wake(&mr->notempty);
+    return 0;
+}
+
+void * mpmc_ring_pop (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    void        * value = NULL;
+
+    if (!mr) return NULL;
+
+    value = mpmc_ring_get(mr);
+    if (value) ring_futex_wake(&mr->notfull);
+
+    return value;
+}
+
+int mpmc_ring_push_batch (void * vmr, void ** values, int num)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    int           i;
+
+    if (!mr || !values) return 0;
+
+    for (i = 0; i < num; i++) {
+        if (!values[i] || mpmc_ring_put(mr, values[i]) < 0)
+            break;
+    }
+
+    if (i > 0) ring_futex_wake(&mr->notempty);
+    return i;
+}
+
+int mpmc_ring_pop_batch (void * vmr, void ** values, int max)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    int           i;
+
+    if (!mr || !values) return 0;
+
+    for (i = 0; i < max; i++) {
+        if ((values[i] = mpmc_ring_get(mr)) == NULL)
+            break;
+    }
+
+    if (i > 0) ring_futex_wake(&mr->notfull);
+    return i;
+}
+
+static int mpmc_ring_readable (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    mpmc_cell_t * cell = NULL;
+    ulong         pos;
+
+    pos = __atomic_load_n(&mr->deqpos, __ATOMIC_SEQ_CST);
+    cell = &mr->cells[pos & mr->mask];
+
+    return __atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) == pos + 1;
+}
+
+static int mpmc_ring_writable (void * vmr)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    mpmc_cell_t * cell = NULL;
+    ulong         pos;
+
+    pos = __atomic_load_n(&mr->enqpos, __ATOMIC_SEQ_CST);
+    cell = &mr->cells[pos & mr->mask];
+
+    return __atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) == pos;
+}
+
+int mpmc_ring_push_wait (void * vmr, void * value, int ms)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    btime_t       deadline, now;
+    long          left = ms;
+
+    if (!mr || !value) return -1;
+
+    if (ms > 0) btime_mono_add(&deadline, ms);
+
+    while (mpmc_ring_push(mr, value) < 0) {
+        if (ring_wait(&mr->notfull, mpmc_ring_writable, mr, (int)left) < 0)
+            return -1;
+
+        if (ms > 0) {
+            btime_mono(&now);
+            left = btime_diff_ms(&now, &deadline);
+            if (left <= 0) left = 0;
+        }
+    }
+
+    return 0;
+}
+
+void * mpmc_ring_pop_wait (void * vmr, int ms)
+{
+    mpmc_ring_t * mr = (mpmc_ring_t *)vmr;
+    btime_t       deadline, now;
+    void        * value = NULL;
+    long          left = ms;
+
+    if (!mr) return NULL;
+
+    if (ms > 0) btime_mono_add(&deadline, ms);
+
+    while ((value = mpmc_ring_pop(mr)) == NULL) {
+        if (ring_wait(&mr->notempty, mpmc_ring_readable, mr, (int)left) < 0)
+            return NULL;
+
+        if (ms > 0) {
+            btime_mono(&now);
+            left = btime_diff_ms(&now, &deadline);
+            if (left <= 0) left = 0;
+        }
+    }
+
+    return value;
+}
+
+
+/* bounded SPSC ring. head is advanced by the consumer and tail by the
+ * producer, each side keeps a copy of the other index to touch the shared
+ * cache line only when the copy says full or empty */
+
+typedef struct spsc_ring_ {
+    void       ** data;
+    ulong         mask;
+    uint8         pad0[64 - sizeof(void *) - sizeof(ulong)];
+
+    ulong         head;
+    ulong         tailcache;   //consumer copy of tail
+    uint8         pad1[64 - sizeof(ulong) * 2];
+
+    ulong         tail;
+    ulong         headcache;   //producer copy of head
+    uint8         pad2[64 - sizeof(ulong) * 2];
+
+    ringwait_t    notempty;
+    ringwait_t    notfull;
+} spsc_ring_t;
+
+void * spsc_ring_new (int size)
+{
+    spsc_ring_t * sr = NULL;
+
+    sr = kzalloc(sizeof(*sr));
+    if (!sr) return NULL;
+
+    size = ring_size_pow2(size);
+
+    sr->data = kzalloc(sizeof(void *) * size);
+    if (!sr->data) {
+        kfree(sr);
+        return NULL;
+    }
+
+    sr->mask = size - 1;
+
+    return sr;
+}
+
+void spsc_ring_free (void * vsr)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    if (!sr) return;
+
+    if (sr->data) kfree(sr->data);
+    kfree(sr);
+}
+
+int spsc_ring_size (void * vsr)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    if (!sr) return 0;
+
+    return (int)sr->mask + 1;
+}
+
+int spsc_ring_num (void * vsr)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    if (!sr) return 0;
+
+    return (int)(__atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE) -
+                 __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE));
+}
+
+int spsc_ring_push_batch (void * vsr, void ** values, int num)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+    ulong         tail, space;
+    int           i;
+
+    if (!sr || !values || num <= 0) return 0;
+
+    tail = sr->tail;
+    space = sr->mask + 1 - (tail - sr->headcache);
+    if (space < (ulong)num) {
+        sr->headcache = __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE);
+        space = sr->mask + 1 - (tail - sr->headcache);
+    }
+    if ((ulong)num > space) num = space;
+
+    for (i = 0; i < num; i++)
+        sr->data[(tail + i) & sr->mask] = values[i];
+
+    if (num > 0) {
+        __atomic_store_n(&sr->tail, tail + num, __ATOMIC_SEQ_CST);
+        ring_futex_wake(&sr->notempty);
+    }
+
+    return num;
+}
+
+int spsc_ring_pop_batch (void * vsr, void ** values, int max)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+    ulong         head, avail;
+    int           i;
+
+    if (!sr || !values || max <= 0) return 0;
+
+    head = sr->head;
+    avail = sr->tailcache - head;
+    if (avail < (ulong)max) {
+        sr->tailcache = __atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE);
+        avail = sr->tailcache - head;
+    }
+    if ((ulong)max > avail) max = avail;
+
+    for (i = 0; i < max; i++)
+        values[i] = sr->data[(head + i) & sr->mask];
+
+    if (max > 0) {
+        __atomic_store_n(&sr->head, head + max, __ATOMIC_SEQ_CST);
+        ring_futex_wake(&sr->notfull);
+    }
+
+    return max;
+}
+
+int spsc_ring_push (void * vsr, void * value)
+{
+    return spsc_ring_push_batch(vsr, &value, 1) == 1 ? 0 : -1;
+}
+
+void * spsc_ring_pop (void * vsr)
+{
+    void * value = NULL;
+
+    if (spsc_ring_pop_batch(vsr, &value, 1) != 1)
+        return NULL;
+
+    return value;
+}
+
+static int spsc_ring_readable (void * vsr)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    return __atomic_load_n(&sr->tail, __ATOMIC_SEQ_CST) != sr->head;
+}
+
+static int spsc_ring_writable (void * vsr)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    return sr->tail - __atomic_load_n(&sr->head, __ATOMIC_SEQ_CST) <= sr->mask;
+}
+
+int spsc_ring_push_wait (void * vsr, void * value, int ms)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+
+    if (!sr) return -1;
+
+    if (spsc_ring_push(sr, value) == 0) return 0;
+
+    if (ring_wait(&sr->notfull, spsc_ring_writable, sr, ms) < 0)
+        return -1;
+
+    return spsc_ring_push(sr, value);
+}
+
+void * spsc_ring_pop_wait (void * vsr, int ms)
+{
+    spsc_ring_t * sr = (spsc_ring_t *)vsr;
+    void        * value = NULL;
+
+    if (!sr) return NULL;
+
+    if ((value = spsc_ring_pop(sr)) != NULL) return value;
+
+    if (ring_wait(&sr->notempty, spsc_ring_readable, sr, ms) < 0)
+        return NULL;
+
+    return spsc_ring_pop(sr);
+}
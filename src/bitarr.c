@@ -6,12 +6,25 @@
 #include "btype.h"
 #include "memory.h"
 #include "bitarr.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define BITARR_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
  
 #define UNITBYTE  sizeof(uint64)
 #define UNITBIT   (sizeof(uint64) * 8)
 #define DIVBIT    6
 #define MODBITS   0x3F
 
+#define BIT_AND   0
+#define BIT_OR    1
+#define BIT_XOR   2
+
 
 bitarr_t * bitarr_alloc (int bitnum)
 {
@@ -24,7 +37,7 @@ bitarr_t * bitarr_alloc (int bitnum)
     bar->bitnum = bitnum;
     bar->unitnum = (bitnum + UNITBIT - 1) / UNITBIT;
 
-    bar->bitarr = kzalloc(bar->unitnum * UNITBYTE);
+    bar->bitarr = kzalloc_huge(bar->unitnum * UNITBYTE);
  
     return bar;
 }
@@ -37,7 +50,7 @@ void bitarr_init (bitarr_t * bar, int bitnum)
     bar->bitnum = bitnum;
     bar->unitnum = (bitnum + UNITBIT - 1) / UNITBIT;
 
-    bar->bitarr = kzalloc(bar->unitnum * UNITBYTE);
+    bar->bitarr = kzalloc_huge(bar->unitnum * UNITBYTE);
 }
 
 bitarr_t * bitarr_resize (bitarr_t * bar, int bitnum)
@@ -56,19 +69,28 @@ bitarr_t * bitarr_resize (bitarr_t * bar, int bitnum)
     unitnum = (bitnum + UNITBIT - 1) / UNITBIT;
  
     if (bar->unitnum < unitnum) {
-        bar->bitarr = krealloc(bar->bitarr, unitnum * UNITBYTE);
+        bar->bitarr = krealloc_huge(bar->bitarr, unitnum * UNITBYTE);
+        if (!bar->bitarr) {
+            bar->bitnum = bar->unitnum = 0;
+            return NULL;
+        }
         bar->unitnum = unitnum;
     }
  
-    /* all new allocated bits must be set 0 from original bit */
+    /* all new allocated bits must be set 0 from original bit, and the bits
+     * cut off by shrinking are cleared too */
+
+    if (bitnum < bar->bitnum) bar->bitnum = bitnum;
 
     arrind = bar->bitnum >> DIVBIT;
     bitoff = bar->bitnum & MODBITS;
 
-    if (bitoff > 0)
+    if (bitoff > 0) {
         bar->bitarr[arrind] &= (uint64)~0 >> (UNITBIT - bitoff);
+        arrind++;
+    }
 
-    for (arrind++ ; arrind < bar->unitnum; arrind++) {
+    for ( ; arrind < bar->unitnum; arrind++) {
         bar->bitarr[arrind] = 0;
     }
 
@@ -82,7 +104,7 @@ void bitarr_free (bitarr_t * bar)
     if (!bar) return;
  
     if (bar->bitarr) {
-        kfree(bar->bitarr);
+        kfree_huge(bar->bitarr);
         bar->bitarr = NULL;
     }
  
@@ -104,7 +126,7 @@ int bitarr_set (bitarr_t * bar, int ind)
     if (ind < 0) return -2;
  
     if (ind >= bar->bitnum) {
-        bitarr_resize(bar, ind);
+        if (!bitarr_resize(bar, ind + 1)) return -100;
     }
  
     arrind = ind >> DIVBIT;
@@ -125,7 +147,7 @@ int bitarr_unset (bitarr_t * bar, int ind)
     if (ind < 0) return -2;
  
     if (ind >= bar->bitnum) {
-        bitarr_resize(bar, ind);
+        if (!bitarr_resize(bar, ind + 1)) return -100;
     }
  
     arrind = ind >> DIVBIT;
@@ -146,7 +168,7 @@ int bitarr_get (bitarr_t * bar, int ind)
     if (ind < 0) return -2;
  
     if (ind >= bar->bitnum) {
-        bitarr_resize(bar, ind);
+        if (!bitarr_resize(bar, ind + 1)) return -100;
     }
  
     arrind = ind >> DIVBIT;
@@ -200,7 +222,8 @@ int bitarr_left (bitarr_t * bar, int bits)
 
     /* clear unused bits of last uint64 unit */
     bitoff = bar->bitnum & MODBITS;
-    bar->bitarr[unitnum - 1] &= (uint64)~0 >> (UNITBIT - bitoff);
+    if (bitoff > 0)
+        bar->bitarr[unitnum - 1] &= (uint64)~0 >> (UNITBIT - bitoff);
 
     return 0;
 }
@@ -248,132 +271,171 @@ int bitarr_right (bitarr_t * bar, int bits)
     return 0;
 }
 
-int bitarr_and (bitarr_t * dst, bitarr_t * src)
+/* the words of dst are combined with src a register at a time */
+static void bit_words_op (uint64 * dst, uint64 * src, int num, int op)
 {
-    int  unitnum = 0;
-    int  bitoff = 0;
     int  i = 0;
 
-    if (!dst || !src) return -1;
+#if defined(__AVX2__)
+    __m256i  a, b;
 
-    if (dst->bitnum <= src->bitnum) {
+    for ( ; i + 4 <= num; i += 4) {
+        a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        b = _mm256_loadu_si256((const __m256i *)(src + i));
 
-        unitnum = (dst->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = dst->bitnum & MODBITS;
+        if (op == BIT_AND) a = _mm256_and_si256(a, b);
+        else if (op == BIT_OR) a = _mm256_or_si256(a, b);
+        else a = _mm256_xor_si256(a, b);
 
-        for (i = 0; i < unitnum; i++) {
-            dst->bitarr[i] &= src->bitarr[i];
-        }
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+    }
+#endif
+
+    switch (op) {
+    case BIT_AND:
+        for ( ; i < num; i++) dst[i] &= src[i];
+        break;
+    case BIT_OR:
+        for ( ; i < num; i++) dst[i] |= src[i];
+        break;
+    default:
+        for ( ; i < num; i++) dst[i] ^= src[i];
+        break;
+    }
+}
 
-        if (bitoff > 0)
-            dst->bitarr[unitnum - 1] &= (uint64)~0 >> (UNITBIT - bitoff);
+/* the bits in the range of both are combined, the bits of dst beyond src
+ * are kept as they are */
+static int bitarr_op (bitarr_t * dst, bitarr_t * src, int op)
+{
+    int     bitnum = 0;
+    int     num = 0;
+    int     bitoff = 0;
+    uint64  mask, w;
 
-    } else {
+    if (!dst || !src) return -1;
 
-        unitnum = (src->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = src->bitnum & MODBITS;
- 
-        for (i = 0; i < unitnum - 1; i++) {
-            dst->bitarr[i] &= src->bitarr[i];
-        }
- 
-        dst->bitarr[unitnum - 1] &= ((uint64)~0 << bitoff) | src->bitarr[unitnum - 1];
+    bitnum = dst->bitnum < src->bitnum ? dst->bitnum : src->bitnum;
+    num = bitnum >> DIVBIT;
+    bitoff = bitnum & MODBITS;
+
+    bit_words_op(dst->bitarr, src->bitarr, num, op);
+
+    if (bitoff > 0) {
+        mask = (uint64)~0 >> (UNITBIT - bitoff);
+        w = src->bitarr[num];
+
+        if (op == BIT_AND) dst->bitarr[num] &= w | ~mask;
+        else if (op == BIT_OR) dst->bitarr[num] |= w & mask;
+        else dst->bitarr[num] ^= w & mask;
     }
 
     return 0;
 }
 
+int bitarr_and (bitarr_t * dst, bitarr_t * src)
+{
+    return bitarr_op(dst, src, BIT_AND);
+}
+
 int bitarr_or (bitarr_t * dst, bitarr_t * src)
 {
-    int  unitnum = 0;
-    int  bitoff = 0;
+    return bitarr_op(dst, src, BIT_OR);
+}
+
+int bitarr_xor (bitarr_t * dst, bitarr_t * src)
+{
+    return bitarr_op(dst, src, BIT_XOR);
+}
+
+
+static int bit_low (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
     int  i = 0;
+    while (!(w & 1)) { w >>= 1; i++; }
+    return i;
+#endif
+}
 
-    if (!dst || !src) return -1;
+static int bit_high (uint64 w)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(w);
+#else
+    int  i = 63;
+    while (!(w & ((uint64)1 << 63))) { w <<= 1; i--; }
+    return i;
+#endif
+}
 
-    if (dst->bitnum <= src->bitnum) {
+int bitarr_next (bitarr_t * bar, int from, int val)
+{
+    int     arrind = 0;
+    int     ind = 0;
+    uint64  w;
 
-        unitnum = (dst->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = dst->bitnum & MODBITS;
+    if (!bar) return -1;
 
-        for (i = 0; i < unitnum; i++) {
-            dst->bitarr[i] |= src->bitarr[i];
-        }
+    if (from < 0) from = 0;
+    if (from >= bar->bitnum) return -1;
 
-        if (bitoff > 0)
-            dst->bitarr[unitnum - 1] &= (uint64)~0 >> (UNITBIT - bitoff);
+    arrind = from >> DIVBIT;
 
-    } else {
+    w = val ? bar->bitarr[arrind] : ~bar->bitarr[arrind];
+    w &= (uint64)~0 << (from & MODBITS);
 
-        unitnum = (src->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = src->bitnum & MODBITS;
- 
-        for (i = 0; i < unitnum - 1; i++) {
-            dst->bitarr[i] |= src->bitarr[i];
-        }
- 
-        dst->bitarr[unitnum - 1] |= ((uint64)~0 >> (UNITBIT - bitoff)) & src->bitarr[unitnum - 1];
+    while (w == 0) {
+        if (++arrind >= bar->unitnum) return -1;
+        w = val ? bar->bitarr[arrind] : ~bar->bitarr[arrind];
     }
 
-    return 0;
+    ind = (arrind << DIVBIT) + bit_low(w);
+    if (ind >= bar->bitnum) return -1;
+
+    return ind;
 }
 
-int bitarr_xor (bitarr_t * dst, bitarr_t * src)
+int bitarr_prev (bitarr_t * bar, int from, int val)
 {
-    int  unitnum = 0;
-    int  bitoff = 0;
-    int  i = 0;
+    int     arrind = 0;
+    uint64  w;
 
-    if (!dst || !src) return -1;
-
-    if (dst->bitnum <= src->bitnum) {
-
-        unitnum = (dst->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = dst->bitnum & MODBITS;
+    if (!bar || from < 0 || bar->bitnum <= 0) return -1;
 
-        for (i = 0; i < unitnum; i++) {
-            dst->bitarr[i] ^= src->bitarr[i];
-        }
+    if (from >= bar->bitnum) from = bar->bitnum - 1;
 
-        if (bitoff > 0)
-            dst->bitarr[unitnum - 1] &= (uint64)~0 >> (UNITBIT - bitoff);
+    arrind = from >> DIVBIT;
 
-    } else {
+    w = val ? bar->bitarr[arrind] : ~bar->bitarr[arrind];
+    w &= (uint64)~0 >> (MODBITS - (from & MODBITS));
 
-        unitnum = (src->bitnum + UNITBIT - 1) / UNITBIT;
-        bitoff = src->bitnum & MODBITS;
- 
-        for (i = 0; i < unitnum - 1; i++) {
-            dst->bitarr[i] ^= src->bitarr[i];
-        }
- 
-        dst->bitarr[unitnum - 1] ^= ((uint64)~0 >> (UNITBIT - bitoff)) & src->bitarr[unitnum - 1];
+    while (w == 0) {
+        if (--arrind < 0) return -1;
+        w = val ? bar->bitarr[arrind] : ~bar->bitarr[arrind];
     }
 
-    return 0;
+    return (arrind << DIVBIT) + bit_high(w);
 }
 
-
 int bitarr_filled (bitarr_t * bar)
 {
-    int    i = 0, arrind = 0;
-    int    restbit = 0;
+    int     i = 0, num = 0;
+    int     bitoff = 0;
  
     if (!bar) return -1;
  
-    for (i = 0; i < bar->bitnum; i += UNITBIT) {
-        restbit = bar->bitnum - i;
- 
-        if (restbit < UNITBIT)
-            restbit = UNITBIT - restbit;
-        else
-            restbit = 0;
- 
-        arrind = i / UNITBIT;
- 
-        if (((bar->bitarr[arrind] ^ (uint64)-1) & ((uint64)-1 >> restbit)) != 0)
-            return 0;
+    num = bar->bitnum >> DIVBIT;
+    bitoff = bar->bitnum & MODBITS;
+
+    for (i = 0; i < num; i++) {
+        if (bar->bitarr[i] != (uint64)~0) return 0;
     }
+
+    if (bitoff > 0 && bar->bitarr[num] != (uint64)~0 >> (UNITBIT - bitoff))
+        return 0;
  
     return 1;
 }
@@ -388,6 +450,314 @@ int bitarr_zero  (bitarr_t * bar)
     return 0;
 }
 
+
+/* population count of the words, by the popcnt instruction or the AVX2
+ * nibble lookup where the CPU has them */
+
+static int bit_count (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static int64 bit_words_count_c (uint64 * w, int num)
+{
+    int64  cnt = 0;
+    int    i;
+
+    for (i = 0; i < num; i++) cnt += bit_count(w[i]);
+
+    return cnt;
+}
+
+#ifdef BITARR_X86_DISPATCH
+
+__attribute__((target("popcnt")))
+static int64 bit_words_count_popcnt (uint64 * w, int num)
+{
+    int64  c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    int    i = 0;
+
+    for ( ; i + 4 <= num; i += 4) {
+        c0 += __builtin_popcountll(w[i]);
+        c1 += __builtin_popcountll(w[i + 1]);
+        c2 += __builtin_popcountll(w[i + 2]);
+        c3 += __builtin_popcountll(w[i + 3]);
+    }
+    for ( ; i < num; i++) c0 += __builtin_popcountll(w[i]);
+
+    return c0 + c1 + c2 + c3;
+}
+
+/* the counts of the nibbles are looked up by pshufb and summed by psadbw */
+__attribute__((target("avx2")))
+static int64 bit_words_count_avx2 (uint64 * w, int num)
+{
+    const __m256i  lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i  low = _mm256_set1_epi8(0x0F);
+    __m256i        acc = _mm256_setzero_si256();
+    __m256i        v, cnt;
+    int64          total = 0;
+    int            i = 0;
+
+    for ( ; i + 4 <= num; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *)(w + i));
+
+        cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                              _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+
+    total = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+            _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+
+    for ( ; i < num; i++) total += __builtin_popcountll(w[i]);
+
+    return total;
+}
+
+static int bitarr_simd_level ()
+{
+    static int level = -1;
+    int        lvl = __atomic_load_n(&level, __ATOMIC_RELAXED);
+
+    if (lvl < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) lvl = 2;
+        else if (__builtin_cpu_supports("popcnt")) lvl = 1;
+        else lvl = 0;
+        __atomic_store_n(&level, lvl, __ATOMIC_RELAXED);
+    }
+
+    return lvl;
+}
+
+#endif
+
+static int64 bit_words_count (uint64 * w, int num)
+{
+#ifdef BITARR_X86_DISPATCH
+    int  lvl = bitarr_simd_level();
+
+    if (lvl == 2 && num >= 16) return bit_words_count_avx2(w, num);
+    if (lvl >= 1) return bit_words_count_popcnt(w, num);
+#endif
+
+    return bit_words_count_c(w, num);
+}
+
+int bitarr_count (bitarr_t * bar)
+{
+    if (!bar) return -1;
+
+    /* the bits beyond bitnum are always kept 0 */
+    return (int)bit_words_count(bar->bitarr, (bar->bitnum + UNITBIT - 1) / UNITBIT);
+}
+
+int bitarr_count_range (bitarr_t * bar, int from, int num)
+{
+    int     end = 0;
+    int     fu, eu;
+    int64   cnt = 0;
+    uint64  w;
+
+    if (!bar) return -1;
+
+    if (from < 0) { num += from; from = 0; }
+    end = from + num;
+    if (end > (int)bar->bitnum) end = bar->bitnum;
+    if (num <= 0 || from >= end) return 0;
+
+    fu = from >> DIVBIT;
+    eu = (end - 1) >> DIVBIT;
+
+    w = bar->bitarr[fu] & ((uint64)~0 << (from & MODBITS));
+
+    if (fu == eu) {
+        if (end & MODBITS) w &= (uint64)~0 >> (UNITBIT - (end & MODBITS));
+        return bit_count(w);
+    }
+
+    cnt = bit_count(w);
+    cnt += bit_words_count(bar->bitarr + fu + 1, eu - fu - 1);
+
+    w = bar->bitarr[eu];
+    if (end & MODBITS) w &= (uint64)~0 >> (UNITBIT - (end & MODBITS));
+    cnt += bit_count(w);
+
+    return (int)cnt;
+}
+
+int bitarr_set_range (bitarr_t * bar, int from, int num, int val)
+{
+    int     end = 0;
+    int     fu, eu;
+    uint64  fmask, emask;
+
+    if (!bar) return -1;
+    if (from < 0 || num < 0) return -2;
+    if (num == 0) return 0;
+
+    end = from + num;
+    if (end > (int)bar->bitnum) {
+        if (!bitarr_resize(bar, end)) return -100;
+    }
+
+    fu = from >> DIVBIT;
+    eu = (end - 1) >> DIVBIT;
+
+    fmask = (uint64)~0 << (from & MODBITS);
+    emask = (end & MODBITS) ? (uint64)~0 >> (UNITBIT - (end & MODBITS)) : (uint64)~0;
+
+    if (fu == eu) fmask &= emask;
+
+    if (val) bar->bitarr[fu] |= fmask;
+    else bar->bitarr[fu] &= ~fmask;
+
+    if (fu == eu) return 0;
+
+    if (eu - fu > 1)
+        memset(bar->bitarr + fu + 1, val ? 0xFF : 0, (eu - fu - 1) * UNITBYTE);
+
+    if (val) bar->bitarr[eu] |= emask;
+    else bar->bitarr[eu] &= ~emask;
+
+    return 0;
+}
+
+
+/* rank/select directory: the ones before every 512-bit block, so rank is
+ * a lookup and a count of at most 8 words and select is a binary search
+ * of the blocks and a scan of at most 8 words */
+
+#define RANK_BLKWORDS  8
+
+typedef struct bit_rank_s {
+    bitarr_t   * bar;
+    int          blknum;
+    uint32     * rank;      //blknum + 1 entries, the last is the total
+} BitRank;
+
+void * bitarr_rank_build (bitarr_t * bar)
+{
+    BitRank * br = NULL;
+    int       words, i, n;
+    uint32    acc = 0;
+
+    if (!bar) return NULL;
+
+    br = kzalloc(sizeof(*br));
+    if (!br) return NULL;
+
+    words = (bar->bitnum + UNITBIT - 1) / UNITBIT;
+
+    br->bar = bar;
+    br->blknum = (words + RANK_BLKWORDS - 1) / RANK_BLKWORDS;
+    br->rank = kzalloc((br->blknum + 1) * sizeof(uint32));
+    if (!br->rank) {
+        kfree(br);
+        return NULL;
+    }
+
+    for (i = 0; i < br->blknum; i++) {
+        br->rank[i] = acc;
+
+        n = words - i * RANK_BLKWORDS;
+        if (n > RANK_BLKWORDS) n = RANK_BLKWORDS;
+        acc += (uint32)bit_words_count(bar->bitarr + i * RANK_BLKWORDS, n);
+    }
+    br->rank[br->blknum] = acc;
+
+    return br;
+}
+
+void bitarr_rank_free (void * vrank)
+{
+    BitRank * br = (BitRank *)vrank;
+
+    if (!br) return;
+
+    if (br->rank) kfree(br->rank);
+    kfree(br);
+}
+
+int bitarr_rank (void * vrank, int ind)
+{
+    BitRank  * br = (BitRank *)vrank;
+    bitarr_t * bar = NULL;
+    int        blk, wi, cnt;
+
+    if (!br) return -1;
+
+    bar = br->bar;
+
+    if (ind <= 0) return 0;
+    if (ind >= (int)bar->bitnum) return br->rank[br->blknum];
+
+    wi = ind >> DIVBIT;
+    blk = wi / RANK_BLKWORDS;
+
+    cnt = br->rank[blk] + (int)bit_words_count(bar->bitarr + blk * RANK_BLKWORDS,
+                                               wi - blk * RANK_BLKWORDS);
+
+    if (ind & MODBITS)
+        cnt += bit_count(bar->bitarr[wi] & ((uint64)~0 >> (UNITBIT - (ind & MODBITS))));
+
+    return cnt;
+}
+
+int bitarr_select (void * vrank, int k)
+{
+    BitRank  * br = (BitRank *)vrank;
+    uint64   * w = NULL;
+    uint64     v;
+    int        lo, hi, mid, wi, c;
+
+    if (!br || k < 0) return -1;
+    if ((uint32)k >= br->rank[br->blknum]) return -1;
+
+    /* the last block whose rank is not beyond k */
+    lo = 0; hi = br->blknum - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (br->rank[mid] <= (uint32)k) lo = mid;
+        else hi = mid - 1;
+    }
+
+    k -= br->rank[lo];
+    w = br->bar->bitarr;
+
+    for (wi = lo * RANK_BLKWORDS; ; wi++) {
+        c = bit_count(w[wi]);
+        if (k < c) break;
+        k -= c;
+    }
+
+    /* the k-th one within the word, a byte at a time */
+    v = w[wi];
+    for (c = 0; ; c += 8) {
+        if (k < bit_count((v >> c) & 0xFF)) break;
+        k -= bit_count((v >> c) & 0xFF);
+    }
+
+    v >>= c;
+    for ( ; ; c++, v >>= 1) {
+        if (v & 1) {
+            if (k == 0) break;
+            k--;
+        }
+    }
+
+    return (wi << DIVBIT) + c;
+}
+
 void bitarr_print (bitarr_t * bar)
 {
     int  i = 0, n = 0;
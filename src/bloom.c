@@ -12,6 +12,61 @@
 #include "hashtab.h"
 #include "bloom.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BLOOM_SEED1    0x7af9cb4d9747b28cULL
+#define BLOOM_BLKBITS  512
+#define BLOOM_BLKWORDS 8
+#define BLOOM_BATCH    16
+
+#define BLOOM_CNTMAX   15   //4-bit counter saturates and sticks at 15
+
+/* sub-filter i of scalable bloom holds entries * 2^i keys at error * 0.9^i,
+ * the first error is error * (1 - 0.9), the sum is bounded by error */
+#define SBLOOM_GROWTH  2
+#define SBLOOM_RATIO   0.9
+
+#define BLOOM_MAGIC    0x4D4F4C42  //BLOM
+#define BLOOM_VERSION  1
+
+/* serialized header, the bit array follows at offset 64 */
+typedef struct bloom_hdr_s {
+    uint32      magic;
+    uint32      version;
+    uint32      blocked;
+    uint32      hashes;
+    int64       entries;
+    double      error;
+    int64       bits;
+    int64       bytes;
+    uint32      counting;
+    uint32      hashkind;
+    uint64      seed;
+} bloom_hdr_t;
+
+/* the two 64-bit hashes of the double hashing */
+static inline void bloom_hash2 (bloom_p bf, void * key, int len, uint64 * pa, uint64 * pb)
+{
+    if (bf->hashkind == BLOOM_HASH_WY) {
+        *pa = wy_hash(key, len, bf->seed);
+        *pb = wy_hash(key, len, *pa ^ bf->seed);
+        return;
+    }
+
+    *pa = murmur_hash2_64(key, len, BLOOM_SEED1);
+    *pb = murmur_hash2_64(key, len, *pa);
+}
+
 inline static int test_bit_set_bit (uint8 * buf, uint64 x, int set_bit)
 {
     uint64   byte = x >> 3;
@@ -33,15 +88,14 @@ inline static int test_bit_set_bit (uint8 * buf, uint64 x, int set_bit)
 static int bloom_check_add (bloom_p bf, void * key, int len, int add)
 {
     int      hits = 0;
-    register uint64 a;
-    register uint64 b;
+    uint64   a;
+    uint64   b;
     register uint64 x;
     register uint64 i;
  
     if (!bf) return -1;
 
-    a = murmur_hash2_64(key, len, 0x7af9cb4d9747b28c);
-    b = murmur_hash2_64(key, len, a);
+    bloom_hash2(bf, key, len, &a, &b);
 
     for (i = 0; i < (uint64)bf->hashes; i++) {
         x = (a + i*b) % bf->bits;
@@ -61,6 +115,134 @@ static int bloom_check_add (bloom_p bf, void * key, int len, int add)
     return 0;
 }
 
+/* counters are 4 bits and packed 2 per byte. the key is added even if
+ * all counters are non-zero so that deleting a colliding key is safe */
+static int bloom_count_check_add (bloom_p bf, void * key, int len, int op)
+{
+    uint64   pos[64];
+    uint64   a, b, i;
+    uint8  * pc = NULL;
+    uint8    cnt;
+    int      hashes;
+    int      hits = 0;
+
+    if (!bf) return -1;
+
+    bloom_hash2(bf, key, len, &a, &b);
+
+    hashes = bf->hashes < 64 ? bf->hashes : 64;
+
+    for (i = 0; i < (uint64)hashes; i++) {
+        pos[i] = (a + i*b) % bf->bits;
+
+        pc = bf->bitarr + (pos[i] >> 1);
+        cnt = (pos[i] & 1) ? (*pc >> 4) : (*pc & 0x0F);
+
+        if (cnt) hits++;
+        else if (op <= 0) return 0;
+    }
+
+    for (i = 0; op != 0 && i < (uint64)hashes; i++) {
+        pc = bf->bitarr + (pos[i] >> 1);
+        cnt = (pos[i] & 1) ? (*pc >> 4) : (*pc & 0x0F);
+
+        if (cnt == BLOOM_CNTMAX) continue;
+
+        if (op > 0) cnt++;
+        else cnt--;
+
+        if (pos[i] & 1) *pc = (*pc & 0x0F) | (cnt << 4);
+        else *pc = (*pc & 0xF0) | cnt;
+    }
+
+    return hits == hashes ? 1 : 0;
+}
+
+/* bit positions of blocked filter are derived from the second 64-bit hash,
+ * all of them fall in the 512-bit block selected by the first hash */
+static uint64 * bloom_block_mask (bloom_p bf, void * key, int len, uint64 * mask)
+{
+    uint64   a, b;
+    uint32   h1, h2;
+    uint32   x;
+    int      i;
+
+    bloom_hash2(bf, key, len, &a, &b);
+
+    h1 = (uint32)b;
+    h2 = (uint32)(b >> 32) | 1;
+
+    memset(mask, 0, sizeof(uint64) * BLOOM_BLKWORDS);
+    for (i = 0; i < bf->hashes; i++) {
+        x = (h1 + i * h2) & (BLOOM_BLKBITS - 1);
+        mask[x >> 6] |= 1ULL << (x & 63);
+    }
+
+    return (uint64 *)bf->bitarr + (a % bf->blocks) * BLOOM_BLKWORDS;
+}
+
+/* return 1 if all bits of mask are set in block */
+static inline int bloom_block_test (uint64 * block, uint64 * mask)
+{
+#if defined(__AVX2__)
+    __m256i  m0 = _mm256_loadu_si256((const __m256i *)mask);
+    __m256i  m1 = _mm256_loadu_si256((const __m256i *)(mask + 4));
+
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i *)block), m0) &&
+           _mm256_testc_si256(_mm256_load_si256((const __m256i *)(block + 4)), m1);
+
+#elif defined(__SSE2__)
+    __m128i  v, m, acc = _mm_setzero_si128();
+    int      i;
+
+    for (i = 0; i < BLOOM_BLKWORDS; i += 2) {
+        m = _mm_loadu_si128((const __m128i *)(mask + i));
+        v = _mm_load_si128((const __m128i *)(block + i));
+        acc = _mm_or_si128(acc, _mm_andnot_si128(v, m));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xFFFF;
+
+#else
+    uint64   miss = 0;
+    int      i;
+
+    for (i = 0; i < BLOOM_BLKWORDS; i++)
+        miss |= mask[i] & ~block[i];
+    return miss == 0;
+#endif
+}
+
+static int bloom_block_check_add (bloom_p bf, void * key, int len, int add)
+{
+    uint64   mask[BLOOM_BLKWORDS];
+    uint64 * block = NULL;
+    int      i;
+
+    block = bloom_block_mask(bf, key, len, mask);
+
+    if (bloom_block_test(block, mask))
+        return 1;
+
+    if (add) {
+        for (i = 0; i < BLOOM_BLKWORDS; i++)
+            block[i] |= mask[i];
+    }
+
+    return 0;
+}
+
+static int bloom_alloc_bits (bloom_p bf)
+{
+    /* blocks are aligned to cache line */
+    bf->bitmem = kzalloc_huge(bf->bytes + 64);
+    if (bf->bitmem == NULL)
+        return -1;
+
+    bf->bitarr = (uint8 *)(((ulong)bf->bitmem + 63) & ~(ulong)63);
+
+    return 0;
+}
+
 bloom_p bloom_new (uint64 entries, double error)
 {
     bloom_t * bf = NULL;
@@ -92,8 +274,55 @@ bloom_p bloom_new (uint64 entries, double error)
    
     bf->hashes = (int)ceil(0.693147180559945 * bf->bpe);  // ln(2)
    
-    bf->bitarr = (uint8 *)kalloc(bf->bytes * sizeof(uint8));
-    if (bf->bitarr == NULL) {
+    if (bloom_alloc_bits(bf) < 0) {
+        kfree(bf);
+        return NULL;
+    }
+
+    return bf;
+}
+
+bloom_p bloom_new_counting (uint64 entries, double error)
+{
+    bloom_t * bf = NULL;
+
+    bf = bloom_new(entries, error);
+    if (!bf) return NULL;
+
+    kfree_huge(bf->bitmem);
+    bf->bitmem = NULL;
+    bf->bitarr = NULL;
+
+    /* 4 bits for each position */
+    bf->counting = 1;
+    bf->bytes = (bf->bits + 1) / 2;
+
+    if (bloom_alloc_bits(bf) < 0) {
+        kfree(bf);
+        return NULL;
+    }
+
+    return bf;
+}
+
+bloom_p bloom_new_blocked (uint64 entries, double error)
+{
+    bloom_t * bf = NULL;
+
+    bf = bloom_new(entries, error);
+    if (!bf) return NULL;
+
+    kfree_huge(bf->bitmem);
+    bf->bitmem = NULL;
+    bf->bitarr = NULL;
+
+    /* one block of 512 bits for every key */
+    bf->blocked = 1;
+    bf->blocks = (bf->bits + BLOOM_BLKBITS - 1) / BLOOM_BLKBITS;
+    bf->bits = bf->blocks * BLOOM_BLKBITS;
+    bf->bytes = bf->bits / 8;
+
+    if (bloom_alloc_bits(bf) < 0) {
         kfree(bf);
         return NULL;
     }
@@ -105,25 +334,112 @@ void bloom_free (bloom_t * bf)
 {
     if (!bf) return;
 
-    if (bf->bitarr) {
-        kfree(bf->bitarr);
+#ifdef UNIX
+    if (bf->mapbase) {
+        munmap(bf->mapbase, bf->maplen);
+        bf->mapbase = NULL;
+        bf->bitarr = NULL;
+    }
+#endif
+
+    if (bf->bitmem) {
+        kfree_huge(bf->bitmem);
+        bf->bitmem = NULL;
         bf->bitarr = NULL;
     }
 
     kfree(bf);
 }
+
+int bloom_set_hash (bloom_t * bf, int hashkind, uint64 seed)
+{
+    if (!bf) return -1;
+
+    if (hashkind == BLOOM_HASH_WY) {
+        if (seed == 0) seed = hash_random_seed() ^ (uint64)(ulong)bf;
+        bf->hashkind = BLOOM_HASH_WY;
+        bf->seed = seed;
+        return 0;
+    }
+
+    bf->hashkind = BLOOM_HASH_MURMUR;
+    bf->seed = BLOOM_SEED1;
+    return 0;
+}
  
 int bloom_add (bloom_t * bf, void * key, int keylen)
 {
+    if (bf && bf->blocked)
+        return bloom_block_check_add(bf, key, keylen, 1);
+
+    if (bf && bf->counting)
+        return bloom_count_check_add(bf, key, keylen, 1);
+
     return bloom_check_add(bf, key, keylen, 1);
 }
 
 int bloom_check (bloom_t * bf, void * key, int keylen)
 {
+    if (bf && bf->blocked)
+        return bloom_block_check_add(bf, key, keylen, 0);
+
+    if (bf && bf->counting)
+        return bloom_count_check_add(bf, key, keylen, 0);
+
     return bloom_check_add(bf, key, keylen, 0);
 }
+
+/* only counting filter supports deletion. return 1 if the key was in and
+ * its counters are decreased, 0 if not in */
+int bloom_del (bloom_t * bf, void * key, int keylen)
+{
+    if (!bf) return -1;
+    if (!bf->counting) return -2;
+
+    return bloom_count_check_add(bf, key, keylen, -1);
+}
+
+/* the hashes of a group of keys are computed and their blocks prefetched
+ * first, then tested, so that the cache misses of keys overlap.
+ * result[i] is set to 1 if keys[i] may be in. return the number of hits */
+int bloom_check_batch (bloom_t * bf, void ** keys, int * keylens, int num, uint8 * result)
+{
+    uint64    mask[BLOOM_BATCH][BLOOM_BLKWORDS];
+    uint64  * block[BLOOM_BATCH];
+    int       i, j, n, ret;
+    int       hits = 0;
+
+    if (!bf || !keys || !keylens || !result) return -1;
+
+    if (!bf->blocked) {
+        for (i = 0; i < num; i++) {
+            result[i] = bloom_check(bf, keys[i], keylens[i]) == 1 ? 1 : 0;
+            hits += result[i];
+        }
+        return hits;
+    }
+
+    for (i = 0; i < num; i += BLOOM_BATCH) {
+        n = num - i < BLOOM_BATCH ? num - i : BLOOM_BATCH;
+
+        for (j = 0; j < n; j++) {
+            block[j] = bloom_block_mask(bf, keys[i + j], keylens[i + j], mask[j]);
+#if defined(__GNUC__)
+            __builtin_prefetch(block[j], 0, 0);
+#endif
+        }
+
+        for (j = 0; j < n; j++) {
+            ret = bloom_block_test(block[j], mask[j]);
+            result[i + j] = ret;
+            hits += ret;
+        }
+    }
+
+    return hits;
+}
  
-int blomm_reset (bloom_t * bf)
+int bloom_reset (bloom_t * bf)
 {
     if (!bf) return -1;
 
@@ -132,6 +448,12 @@ int blomm_reset (bloom_t * bf)
     return 0;
 }
 
+/* kept for the callers of the old misspelled name */
+int blomm_reset (bloom_t * bf)
+{
+    return bloom_reset(bf);
+}
+
 void bloom_print (bloom_t * bloom)
 {
     printf("bloom at %p\n", (void *)bloom);
@@ -141,5 +463,262 @@ void bloom_print (bloom_t * bloom)
     printf(" ->bits per elem = %f\n", bloom->bpe);
     printf(" ->bytes = %llu\n", bloom->bytes);
     printf(" ->hash functions = %d\n", bloom->hashes);
+    if (bloom->blocked)
+        printf(" ->blocks = %llu\n", bloom->blocks);
+    if (bloom->counting)
+        printf(" ->4-bit counters\n");
+    if (bloom->mapbase)
+        printf(" ->mapped = %llu bytes\n", bloom->maplen);
+    if (bloom->hashkind == BLOOM_HASH_WY)
+        printf(" ->wyhash seed = %016llx\n", bloom->seed);
+}
+
+
+/* the header of 64 bytes followed by bit array is written into file */
+int bloom_save (bloom_t * bf, char * file)
+{
+    bloom_hdr_t   hdr;
+    FILE        * fp = NULL;
+
+    if (!bf || !file) return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BLOOM_MAGIC;
+    hdr.version = BLOOM_VERSION;
+    hdr.blocked = bf->blocked;
+    hdr.hashes = bf->hashes;
+    hdr.entries = bf->entries;
+    hdr.error = bf->error;
+    hdr.bits = bf->bits;
+    hdr.bytes = bf->bytes;
+    hdr.counting = bf->counting;
+    hdr.hashkind = bf->hashkind;
+    hdr.seed = bf->seed;
+
+    fp = fopen(file, "wb");
+    if (!fp) return -2;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(bf->bitarr, 1, bf->bytes, fp) != (size_t)bf->bytes)
+    {
+        fclose(fp);
+        return -3;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static bloom_p bloom_from_hdr (bloom_hdr_t * hdr, int64 fsize)
+{
+    bloom_t * bf = NULL;
+
+    if (hdr->magic != BLOOM_MAGIC || hdr->version != BLOOM_VERSION)
+        return NULL;
+
+    if (hdr->bytes <= 0 || hdr->bits > hdr->bytes * 8 || hdr->hashes <= 0 ||
+        (int64)sizeof(*hdr) + hdr->bytes > fsize)
+        return NULL;
+
+    if (hdr->blocked && hdr->bits % BLOOM_BLKBITS != 0)
+        return NULL;
+
+    if (hdr->counting && (hdr->blocked || hdr->bits > hdr->bytes * 2))
+        return NULL;
+
+    if (hdr->hashkind != BLOOM_HASH_MURMUR && hdr->hashkind != BLOOM_HASH_WY)
+        return NULL;
+
+    bf = kzalloc(sizeof(*bf));
+    if (!bf) return NULL;
+
+    bf->entries = hdr->entries;
+    bf->error = hdr->error;
+    bf->bits = hdr->bits;
+    bf->bytes = hdr->bytes;
+    bf->hashes = hdr->hashes;
+    bf->bpe = (double)hdr->bits / (double)hdr->entries;
+    bf->blocked = hdr->blocked ? 1 : 0;
+    bf->counting = hdr->counting ? 1 : 0;
+    if (bf->blocked) bf->blocks = bf->bits / BLOOM_BLKBITS;
+    bf->hashkind = hdr->hashkind;
+    bf->seed = hdr->seed;
+
+    return bf;
+}
+
+/* load the filter saved by bloom_save. if mapshare is set, the file is
+ * mapped with MAP_SHARED so that processes share one copy of the bits
+ * and bloom_add on it updates the file */
+bloom_p bloom_load (char * file, int mapshare)
+{
+    bloom_t     * bf = NULL;
+    bloom_hdr_t   hdr;
+    FILE        * fp = NULL;
+    int64         fsize = 0;
+#ifdef UNIX
+    struct stat   st;
+    void        * pmap = NULL;
+    int           fd = -1;
+#endif
+
+    if (!file) return NULL;
+
+#ifdef UNIX
+    if (mapshare) {
+        fd = open(file, O_RDWR);
+        if (fd < 0) return NULL;
+
+        if (fstat(fd, &st) < 0 || st.st_size < (int64)sizeof(hdr) ||
+            read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        {
+            close(fd);
+            return NULL;
+        }
+
+        bf = bloom_from_hdr(&hdr, st.st_size);
+        if (!bf) {
+            close(fd);
+            return NULL;
+        }
+
+        pmap = mmap(NULL, sizeof(hdr) + bf->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (pmap == MAP_FAILED) {
+            kfree(bf);
+            return NULL;
+        }
+
+        bf->mapbase = pmap;
+        bf->maplen = sizeof(hdr) + bf->bytes;
+        bf->bitarr = (uint8 *)pmap + sizeof(hdr);
+
+        return bf;
+    }
+#endif
+
+    fp = fopen(file, "rb");
+    if (!fp) return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || (bf = bloom_from_hdr(&hdr, fsize)) == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+
+    if (bloom_alloc_bits(bf) < 0 ||
+        fread(bf->bitarr, 1, bf->bytes, fp) != (size_t)bf->bytes)
+    {
+        fclose(fp);
+        bloom_free(bf);
+        return NULL;
+    }
+
+    fclose(fp);
+    return bf;
+}
+
+
+sbloom_p sbloom_new (uint64 entries, double error)
+{
+    sbloom_t * sbf = NULL;
+
+    sbf = kzalloc(sizeof(*sbf));
+    if (!sbf) return NULL;
+
+    if (entries < 1000) entries = 1000;
+    if (error == 0) error = 0.0001;
+
+    sbf->entries = entries;
+    sbf->error = error;
+
+    sbf->filter[0] = bloom_new(entries, error * (1 - SBLOOM_RATIO));
+    if (!sbf->filter[0]) {
+        kfree(sbf);
+        return NULL;
+    }
+    sbf->num = 1;
+
+    return sbf;
+}
+
+void sbloom_free (sbloom_t * sbf)
+{
+    int  i;
+
+    if (!sbf) return;
+
+    for (i = 0; i < sbf->num; i++)
+        bloom_free(sbf->filter[i]);
+
+    kfree(sbf);
+}
+
+/* the key is checked in all sub-filters, the newest one first. when the
+ * newest is full, a larger and tighter one is appended to the chain */
+int sbloom_add (sbloom_t * sbf, void * key, int keylen)
+{
+    bloom_t  * bf = NULL;
+    int        ret;
+
+    if (!sbf) return -1;
+
+    if (sbloom_check(sbf, key, keylen) == 1)
+        return 1;
+
+    bf = sbf->filter[sbf->num - 1];
+
+    if (sbf->count >= bf->entries && sbf->num < SBLOOM_MAXNUM) {
+        bf = bloom_new(bf->entries * SBLOOM_GROWTH, bf->error * SBLOOM_RATIO);
+        if (!bf) return -2;
+        bloom_set_hash(bf, sbf->filter[0]->hashkind, sbf->filter[0]->seed);
+
+        sbf->filter[sbf->num++] = bf;
+        sbf->count = 0;
+    }
+
+    ret = bloom_add(bf, key, keylen);
+    if (ret == 0) {
+        sbf->count++;
+        sbf->total++;
+    }
+
+    return ret;
+}
+
+int sbloom_check (sbloom_t * sbf, void * key, int keylen)
+{
+    int  i;
+
+    if (!sbf) return -1;
+
+    for (i = sbf->num - 1; i >= 0; i--) {
+        if (bloom_check(sbf->filter[i], key, keylen) == 1)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* drop all sub-filters except the first one and clear it */
+int sbloom_reset (sbloom_t * sbf)
+{
+    int  i;
+
+    if (!sbf) return -1;
+
+    for (i = 1; i < sbf->num; i++) {
+        bloom_free(sbf->filter[i]);
+        sbf->filter[i] = NULL;
+    }
+    sbf->num = 1;
+    sbf->count = 0;
+    sbf->total = 0;
+
+    return bloom_reset(sbf->filter[0]);
 }
 
@@ -7,9 +7,11 @@
 #include "memory.h"
 #include "arfifo.h"
 #include "hashtab.h"
+#include "tlcache.h"
 
 #ifdef UNIX
 #include "mthread.h"
+#include "metrics.h"
 #endif
 
 
@@ -34,6 +36,9 @@ typedef struct buffer_pool {
        exceeds this threshold. release the units that get exceeded */
     int      unit_freesize;
 
+    /* alignment of the units allocated, 0 for the default of kzalloc */
+    int      align;
+
     PoolUnitInit * unitinit;
     PoolUnitFree * unitfree;
     PoolUnitSize * getunitsize;
@@ -53,8 +58,59 @@ typedef struct buffer_pool {
     hashtab_t        * rmdup_tab;
     int                hashlen;
 
+    /* per-thread magazines in front of the locked fifo */
+    tlcache_t        * tlcache;
+
+    /* NUMA-aware pool hands out the units of the sub-pool of the node that
+       the calling thread runs on. node is the node of a sub-pool, -1 for
+       the others */
+    int                node;
+    int                nodenum;
+    struct buffer_pool ** nodes;
+
 } bpool_t;
 
+static void * bpool_unit_alloc (bpool_t * pool)
+{
+    void * punit = NULL;
+
+    /* the units of sub-pool are zeroed by the thread of its node, their
+       pages are placed by first-touch */
+    if (pool->align <= 0)
+        return kzalloc_huge(pool->unitsize);
+
+#ifdef UNIX
+    if (posix_memalign(&punit, pool->align, pool->unitsize) != 0)
+        return NULL;
+#endif
+#ifdef _WIN32
+    punit = _aligned_malloc(pool->unitsize, pool->align);
+    if (!punit) return NULL;
+#endif
+
+    /* the page-aligned buffers are bound before being touched */
+    if (pool->node >= 0)
+        mem_numa_bind(punit, pool->unitsize, pool->node);
+
+    memset(punit, 0, pool->unitsize);
+    return punit;
+}
+
+static void bpool_unit_free (bpool_t * pool, void * punit)
+{
+    if (pool->align <= 0) {
+        kfree_huge(punit);
+        return;
+    }
+
+#ifdef UNIX
+    free(punit);
+#endif
+#ifdef _WIN32
+    _aligned_free(punit);
+#endif
+}
+
 int bpool_hash_cmp(void * a, void * b)
 {
     ulong  ua = (ulong)a;
@@ -88,6 +144,8 @@ bpool_t * bpool_init (bpool_t * pool)
 
     pmem->freegate = 0;
 
+    pmem->node = -1;
+
     InitializeCriticalSection(&pmem->ulCS);
     pmem->fifo = ar_fifo_new(128);
     pmem->refifo = ar_fifo_new(128);
@@ -107,6 +165,17 @@ int bpool_clean (bpool_t * pool)
 
     if (!pool) return -1;
 
+    if (pool->nodes) {
+        for (i = 0; i < pool->nodenum; i++)
+            bpool_clean(pool->nodes[i]);
+        kfree(pool->nodes);
+        pool->nodes = NULL;
+    }
+
+    /* units cached by threads go back to refifo before releasing */
+    tlcache_free(pool->tlcache);
+    pool->tlcache = NULL;
+
     EnterCriticalSection(&pool->ulCS);
 
     num = ar_fifo_num(pool->refifo);
@@ -115,7 +184,7 @@ int bpool_clean (bpool_t * pool)
         if (pool->unitfree)
             (*pool->unitfree)(punit);
         else
-            kfree(punit);
+            bpool_unit_free(pool, punit);
     }
     ar_fifo_free(pool->refifo);
     pool->refifo = NULL;
@@ -123,7 +192,7 @@ int bpool_clean (bpool_t * pool)
     num = ar_fifo_num(pool->fifo);
     for (i=0; i<num; i++) {
         punit = ar_fifo_value(pool->fifo, i);
-        kfree(punit);
+        bpool_unit_free(pool, punit);
     }
     ar_fifo_free(pool->fifo);
     pool->fifo = NULL;
@@ -141,8 +210,16 @@ int bpool_clean (bpool_t * pool)
 
 int bpool_fetched_num (bpool_t * pool)
 {
+    int  i, num = 0;
+
     if (!pool) return 0;
 
+    if (pool->nodes) {
+        for (i = 0; i < pool->nodenum; i++)
+            num += pool->nodes[i]->exhausted;
+        return num;
+    }
+
     return pool->exhausted;
 }
 
@@ -177,6 +254,13 @@ int bpool_set_unitsize (bpool_t * pool, int size)
 }
 
 
+int bpool_unitsize (bpool_t * pool)
+{
+    if (!pool) return 0;
+
+    return pool->unitsize;
+}
+
 int bpool_set_allocnum (bpool_t * pool, int escl)
 {
     if (!pool) return -1;
@@ -194,42 +278,102 @@ int bpool_set_freesize (bpool_t * pool, int size)
 }
 
 
+int bpool_set_align (bpool_t * pool, int align)
+{
+    if (!pool) return -1;
+
+    if (align <= 0) align = 0;
+    else if (align < (int)sizeof(void *) || (align & (align - 1)) != 0)
+        return -2;
+
+    pool->align = align;
+    return align;
+}
+
+
+static void bpool_sub_state (bpool_t * pool, int * allocated, int * remaining,
+                             int * exhausted, int * fifonum, int * refifonum)
+{
+    EnterCriticalSection(&pool->ulCS);
+
+    if (allocated) *allocated += pool->allocated;
+    if (remaining) *remaining += pool->remaining;
+    if (exhausted) *exhausted += pool->exhausted;
+    if (fifonum) *fifonum += ar_fifo_num(pool->fifo);
+    if (refifonum) *refifonum += ar_fifo_num(pool->refifo);
+
+    LeaveCriticalSection(&pool->ulCS);
+}
+
+int bpool_get_node_state (bpool_t * pool, int node, int * allocated, int * remaining,
+                          int * exhausted, int * fifonum, int * refifonum)
+{
+    if (!pool) return -1;
+
+    if (pool->nodes) {
+        if (node < 0 || node >= pool->nodenum) return -2;
+        pool = pool->nodes[node];
+    } else if (node != 0) {
+        return -2;
+    }
+
+    if (allocated) *allocated = 0;
+    if (remaining) *remaining = 0;
+    if (exhausted) *exhausted = 0;
+    if (fifonum) *fifonum = 0;
+    if (refifonum) *refifonum = 0;
+
+    bpool_sub_state(pool, allocated, remaining, exhausted, fifonum, refifonum);
+
+    return 0;
+}
+
 int bpool_get_state (bpool_t * pool, int * allocated, int * remaining,
                      int * exhausted, int * fifonum, int * refifonum)
 {
+    int  i;
+
     if (!pool) return -1;
 
-    if (allocated) *allocated = pool->allocated;
-    if (remaining) *remaining = pool->remaining;
-    if (exhausted) *exhausted = pool->exhausted;
-    if (fifonum) *fifonum = ar_fifo_num(pool->fifo);
-    if (refifonum) *refifonum =  ar_fifo_num(pool->refifo);
+    if (!pool->nodes)
+        return bpool_get_node_state(pool, 0, allocated, remaining,
+                                    exhausted, fifonum, refifonum);
+
+    if (allocated) *allocated = 0;
+    if (remaining) *remaining = 0;
+    if (exhausted) *exhausted = 0;
+    if (fifonum) *fifonum = 0;
+    if (refifonum) *refifonum = 0;
+
+    for (i = 0; i < pool->nodenum; i++)
+        bpool_sub_state(pool->nodes[i], allocated, remaining,
+                        exhausted, fifonum, refifonum);
 
     return 0;
 }
 
 
-void * bpool_fetch (bpool_t * pool)
+static void * bpool_fetch_locked (bpool_t * pool)
 {
     void * punit = NULL;
     int    i = 0;
 
-    if (!pool) return NULL;
-
-    EnterCriticalSection(&pool->ulCS);
-
     /* pool->fifo stores objects pre-allocated but not handed out.
        pool->refifo stores the recycled objects. */
     if (ar_fifo_num(pool->fifo) <= 0 && ar_fifo_num(pool->refifo) <= 0) {
         for (i = 0; i < pool->allocnum; i++) {
-            punit = kzalloc(pool->unitsize);
+            punit = bpool_unit_alloc(pool);
             if (!punit)  continue;
 
             ar_fifo_push(pool->fifo, punit);
             pool->allocated++;
             pool->remaining++;
         }
-    }
+
+        metric_inc(MC_BPOOL_MISS);
+        metric_add(MC_BPOOL_GROW_BYTES, (uint64)pool->allocnum * pool->unitsize);
+    } else
+        metric_inc(MC_BPOOL_HIT);
 
     punit = NULL;
     if (ar_fifo_num(pool->fifo) > 0)
@@ -250,33 +394,30 @@ void * bpool_fetch (bpool_t * pool)
         ht_set(pool->rmdup_tab, punit, punit);
     }
 
-    LeaveCriticalSection(&pool->ulCS);
-
-    if (punit && pool->unitinit)
-        (*pool->unitinit)(punit);
-
     return punit;
 }
 
-int bpool_recycle (bpool_t * pool, void * punit)
+static int bpool_oversize (bpool_t * pool, void * punit)
 {
-    if (!pool || !punit) return -1;
+    if (pool->unitfree && pool->unit_freesize > 0 && pool->getunitsize != NULL) {
+        if ((*pool->getunitsize)(punit) >= pool->unit_freesize)
+            return 1;
+    }
 
-    EnterCriticalSection(&pool->ulCS);
+    return 0;
+}
 
+static int bpool_recycle_locked (bpool_t * pool, void * punit)
+{
     if (ht_delete(pool->rmdup_tab, punit) != punit) {
-        LeaveCriticalSection(&pool->ulCS);
         return -10;
     }
 
-    if (pool->unitfree && pool->unit_freesize > 0 && pool->getunitsize != NULL) {
-        if ((*pool->getunitsize)(punit) >= pool->unit_freesize) {
-            (*pool->unitfree)(punit);
-            pool->allocated--;
-            pool->exhausted--;
-            LeaveCriticalSection(&pool->ulCS);
-            return 0;
-        }
+    if (bpool_oversize(pool, punit)) {
+        (*pool->unitfree)(punit);
+        pool->allocated--;
+        pool->exhausted--;
+        return 0;
     }
 
     ar_fifo_push(pool->refifo, punit);
@@ -296,14 +437,14 @@ int bpool_recycle (bpool_t * pool, void * punit)
             punit = ar_fifo_out(pool->refifo);
             if (punit) {
                 if (pool->unitfree) (*pool->unitfree)(punit);
-                else kfree(punit);
+                else bpool_unit_free(pool, punit);
 
                 pool->remaining--;
                 pool->allocated--;
             } else {
                 punit = ar_fifo_out(pool->fifo);
                 if (punit) {
-                    kfree(punit);
+                    bpool_unit_free(pool, punit);
                     pool->remaining--;
                     pool->allocated--;
                 }
@@ -312,7 +453,210 @@ int bpool_recycle (bpool_t * pool, void * punit)
         pool->freegate = 0;
     }
 
+    return 0;
+}
+
+/* units held in thread magazines are counted as exhausted */
+static int bpool_refill_batch (void * vpool, void ** units, int num)
+{
+    bpool_t * pool = (bpool_t *)vpool;
+    int       i = 0;
+
+    EnterCriticalSection(&pool->ulCS);
+
+    for (i = 0; i < num; i++) {
+        units[i] = bpool_fetch_locked(pool);
+        if (!units[i]) break;
+    }
+
+    LeaveCriticalSection(&pool->ulCS);
+
+    return i;
+}
+
+static int bpool_flush_batch (void * vpool, void ** units, int num)
+{
+    bpool_t * pool = (bpool_t *)vpool;
+    int       i = 0;
+
+    EnterCriticalSection(&pool->ulCS);
+
+    for (i = 0; i < num; i++) {
+        bpool_recycle_locked(pool, units[i]);
+    }
+
     LeaveCriticalSection(&pool->ulCS);
+
     return 0;
 }
 
+void * bpool_fetch (bpool_t * pool)
+{
+    void * punit = NULL;
+
+    if (!pool) return NULL;
+
+    if (pool->nodes)
+        return bpool_fetch(pool->nodes[mem_numa_node() % pool->nodenum]);
+
+    if (pool->tlcache) {
+        punit = tlcache_fetch(pool->tlcache);
+
+    } else {
+        EnterCriticalSection(&pool->ulCS);
+        punit = bpool_fetch_locked(pool);
+        LeaveCriticalSection(&pool->ulCS);
+    }
+
+    if (punit && pool->unitinit)
+        (*pool->unitinit)(punit);
+
+    return punit;
+}
+
+/* the unit goes back to the sub-pool it was fetched from, even if recycled
+   by a thread of another node. the sub-pool of current node is checked
+   first, as the units are mostly recycled where they are used */
+static bpool_t * bpool_node_owner (bpool_t * pool, void * punit)
+{
+    bpool_t * sub = NULL;
+    void    * found = NULL;
+    int       i, node;
+
+    node = mem_numa_node() % pool->nodenum;
+
+    for (i = 0; i < pool->nodenum; i++) {
+        sub = pool->nodes[(node + i) % pool->nodenum];
+
+        EnterCriticalSection(&sub->ulCS);
+        found = ht_get(sub->rmdup_tab, punit);
+        LeaveCriticalSection(&sub->ulCS);
+
+        if (found == punit) return sub;
+    }
+
+    return NULL;
+}
+
+int bpool_recycle (bpool_t * pool, void * punit)
+{
+    int  ret = 0;
+
+    if (!pool || !punit) return -1;
+
+    if (pool->nodes) {
+        pool = bpool_node_owner(pool, punit);
+        if (!pool) return -10;
+    }
+
+    /* the oversized unit is released via the locked path immediately */
+    if (pool->tlcache && !bpool_oversize(pool, punit)) {
+        if (tlcache_recycle(pool->tlcache, punit) < 0)
+            return -10;
+        return 0;
+    }
+
+    EnterCriticalSection(&pool->ulCS);
+    ret = bpool_recycle_locked(pool, punit);
+    LeaveCriticalSection(&pool->ulCS);
+
+    return ret;
+}
+
+int bpool_set_tlcache (bpool_t * pool, int depth)
+{
+    int  i, ret = 0;
+
+    if (!pool) return -1;
+
+    if (pool->nodes) {
+        for (i = 0; i < pool->nodenum && ret == 0; i++)
+            ret = bpool_set_tlcache(pool->nodes[i], depth);
+        return ret;
+    }
+
+    if (pool->tlcache) {
+        if (tlcache_depth(pool->tlcache) == depth)
+            return 0;
+
+        tlcache_free(pool->tlcache);
+        pool->tlcache = NULL;
+    }
+
+    if (depth <= 0) return 0;
+
+    pool->tlcache = tlcache_new(pool, depth, bpool_refill_batch, bpool_flush_batch);
+    if (!pool->tlcache) return -2;
+
+    return 0;
+}
+
+int bpool_tlcache_stat (bpool_t * pool, ulong * hit, ulong * miss,
+                        ulong * recycle, ulong * flush)
+{
+    if (!pool) return -1;
+
+    if (pool->nodes)
+        pool = pool->nodes[mem_numa_node() % pool->nodenum];
+
+    return tlcache_stat(pool->tlcache, hit, miss, recycle, flush);
+}
+
+int bpool_set_numa (bpool_t * pool, int on)
+{
+    bpool_t * sub = NULL;
+    int       i, num;
+
+    if (!pool) return -1;
+
+    if (!on) {
+        if (pool->nodes) {
+            for (i = 0; i < pool->nodenum; i++)
+                bpool_clean(pool->nodes[i]);
+            kfree(pool->nodes);
+            pool->nodes = NULL;
+            pool->nodenum = 0;
+        }
+        return 1;
+    }
+
+    if (pool->nodes) return pool->nodenum;
+
+    num = mem_numa_nodes();
+    if (num <= 1) return 1;
+
+    pool->nodes = kzalloc(sizeof(bpool_t *) * num);
+    if (!pool->nodes) return -100;
+
+    for (i = 0; i < num; i++) {
+        sub = bpool_init(NULL);
+        if (!sub) break;
+
+        sub->unitsize = pool->unitsize;
+        sub->allocnum = pool->allocnum;
+        sub->unit_freesize = pool->unit_freesize;
+        sub->align = pool->align;
+        sub->unitinit = pool->unitinit;
+        sub->unitfree = pool->unitfree;
+        sub->getunitsize = pool->getunitsize;
+        sub->node = i;
+
+        if (pool->tlcache)
+            bpool_set_tlcache(sub, tlcache_depth(pool->tlcache));
+
+        pool->nodes[i] = sub;
+        pool->nodenum++;
+    }
+
+    if (pool->nodenum < num) {
+        bpool_set_numa(pool, 0);
+        return -101;
+    }
+
+    /* the magazines of the sub-pools take the place of pool's own */
+    tlcache_free(pool->tlcache);
+    pool->tlcache = NULL;
+
+    return pool->nodenum;
+}
+
@@ -0,0 +1,901 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "bptree.h"
+
+#if defined(__AVX2__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define BPT_LEAF_MIN   (BPT_ORDER / 2)
+#define BPT_INNER_MIN  (BPT_ORDER / 2 - 1)
+
+/* the descending path from root, node[d] and the child index taken */
+typedef struct bptpath_ {
+    bptnode_t  * node[BPT_MAXDEPTH];
+    int          index[BPT_MAXDEPTH];
+    int          depth;
+} BPTPath;
+
+
+static bptnode_t * bptnode_alloc (bptree_t * bpt, int leaf)
+{
+    bptnode_t * node = NULL;
+
+    node = kzalloc(sizeof(*node));
+    if (!node) return NULL;
+
+    node->leaf = leaf ? 1 : 0;
+    bpt->nodes++;
+
+    return node;
+}
+
+static void bptnode_free (bptree_t * bpt, bptnode_t * node)
+{
+    if (!node) return;
+
+    bpt->nodes--;
+    kfree(node);
+}
+
+static void bptnode_recursive_free (bptree_t * bpt, bptnode_t * node, rbtfree_t * freefunc)
+{
+    int   i;
+
+    if (!node) return;
+
+    if (node->leaf) {
+        if (freefunc) {
+            for (i = 0; i < node->num; i++)
+                (*freefunc)(node->ptr[i]);
+        }
+    } else {
+        for (i = 0; i <= node->num; i++)
+            bptnode_recursive_free(bpt, node->ptr[i], freefunc);
+    }
+
+    bptnode_free(bpt, node);
+}
+
+/* the separator value of entry i of leaf: key if integer, obj if cmp */
+#define bpt_sepval(bpt, leaf, i) ((bpt)->cmp ? (leaf)->ptr[i] : (leaf)->key[i])
+
+/* the number of keys less than key in an integer node, the keys are sorted */
+static int bpt_int_less (void ** keys, int num, long key)
+{
+    int   i = 0;
+
+#if defined(__AVX2__) && defined(__x86_64__)
+    __m256i   kv = _mm256_set1_epi64x((long long)key);
+    __m256i   v;
+    int       m;
+
+    for ( ; i + 4 <= num; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, v)));
+        if (m != 0xF) return i + __builtin_popcount(m);
+    }
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    int64x2_t   kv = vdupq_n_s64((int64_t)key);
+    uint64x2_t  m;
+
+    for ( ; i + 2 <= num; i += 2) {
+        m = vcgtq_s64(kv, vld1q_s64((const int64_t *)(keys + i)));
+        if (!vgetq_lane_u64(m, 1))
+            return i + (vgetq_lane_u64(m, 0) ? 1 : 0);
+    }
+#endif
+
+    for ( ; i < num; i++) {
+        if ((long)keys[i] >= key) break;
+    }
+
+    return i;
+}
+
+/* the number of entries of leaf or separators of inner node less than key */
+static int bpt_less (bptree_t * bpt, bptnode_t * node, void * key)
+{
+    void  ** vals = NULL;
+    int      lo = 0, hi, mid;
+
+    if (!bpt->cmp)
+        return bpt_int_less(node->key, node->num, (long)key);
+
+    vals = node->leaf ? node->ptr : node->key;
+
+    for (hi = node->num; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if ((*bpt->cmp)(vals[mid], key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int bpt_entry_cmp (bptree_t * bpt, bptnode_t * leaf, int i, void * key)
+{
+    if (bpt->cmp)
+        return (*bpt->cmp)(leaf->ptr[i], key);
+
+    if ((long)leaf->key[i] < (long)key) return -1;
+    return (long)leaf->key[i] > (long)key;
+}
+
+/* descend to the leaf that the first entry not less than key may be in */
+static bptnode_t * bpt_descend (bptree_t * bpt, void * key, BPTPath * path)
+{
+    bptnode_t * node = bpt->root;
+    int         i;
+
+    path->depth = 0;
+
+    while (node && !node->leaf) {
+        i = bpt_less(bpt, node, key);
+
+        path->node[path->depth] = node;
+        path->index[path->depth] = i;
+        path->depth++;
+
+        node = node->ptr[i];
+    }
+
+    return node;
+}
+
+/* move the path to the leaf next to the current one */
+static bptnode_t * bpt_path_next (BPTPath * path)
+{
+    bptnode_t * node = NULL;
+    int         d;
+
+    for (d = path->depth - 1; d >= 0; d--) {
+        if (path->index[d] < path->node[d]->num) break;
+    }
+    if (d < 0) return NULL;
+
+    path->index[d]++;
+    node = path->node[d]->ptr[path->index[d]];
+
+    for (d = d + 1; d < path->depth; d++) {
+        path->node[d] = node;
+        path->index[d] = 0;
+        node = node->ptr[0];
+    }
+
+    return node;
+}
+
+/* find the first entry equal to key, return its leaf and set the index */
+static bptnode_t * bpt_find (bptree_t * bpt, void * key, BPTPath * path, int * pidx)
+{
+    bptnode_t * leaf = NULL;
+    int         i;
+
+    leaf = bpt_descend(bpt, key, path);
+    if (!leaf) return NULL;
+
+    i = bpt_less(bpt, leaf, key);
+
+    if (i >= leaf->num) {
+        leaf = bpt_path_next(path);
+        if (!leaf) return NULL;
+        i = 0;
+    }
+
+    if (bpt_entry_cmp(bpt, leaf, i, key) != 0)
+        return NULL;
+
+    *pidx = i;
+    return leaf;
+}
+
+
+void * bptree_new (rbtcmp_t * cmp)
+{
+    bptree_t * bpt = NULL;
+
+    bpt = kzalloc(sizeof(*bpt));
+    if (!bpt) return NULL;
+
+    bpt->cmp = cmp;
+
+    return bpt;
+}
+
+void bptree_free (void * vbpt)
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt) return;
+
+    bptnode_recursive_free(bpt, bpt->root, NULL);
+
+    kfree(bpt);
+}
+
+void bptree_free_all (void * vbpt, int (*freefunc)())
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt) return;
+
+    bptnode_recursive_free(bpt, bpt->root, (rbtfree_t *)freefunc);
+
+    kfree(bpt);
+}
+
+void bptree_zero (void * vbpt)
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt) return;
+
+    bptnode_recursive_free(bpt, bpt->root, NULL);
+
+    bpt->root = bpt->head = bpt->tail = NULL;
+    bpt->num = 0;
+    bpt->depth = 0;
+}
+
+int bptree_num (void * vbpt)
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt) return 0;
+
+    return bpt->num;
+}
+
+void * bptree_get (void * vbpt, void * key)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    BPTPath     path;
+    int         i = 0;
+
+    if (!bpt) return NULL;
+    if (bpt->cmp && !key) return NULL;
+
+    leaf = bpt_find(bpt, key, &path, &i);
+    if (!leaf) return NULL;
+
+    return leaf->ptr[i];
+}
+
+int bptree_mget (void * vbpt, void * key, void ** plist, int listsize)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    BPTPath     path;
+    int         i = 0;
+    int         num = 0;
+
+    if (!bpt) return -1;
+    if (bpt->cmp && !key) return -1;
+
+    leaf = bpt_find(bpt, key, &path, &i);
+
+    for ( ; leaf; leaf = leaf->next, i = 0) {
+        for ( ; i < leaf->num; i++) {
+            if (bpt_entry_cmp(bpt, leaf, i, key) != 0)
+                return num;
+
+            if (plist && num < listsize)
+                plist[num] = leaf->ptr[i];
+            num++;
+        }
+    }
+
+    return num;
+}
+
+void * bptree_min (void * vbpt)
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt || !bpt->head || bpt->head->num <= 0)
+        return NULL;
+
+    return bpt->head->ptr[0];
+}
+
+void * bptree_max (void * vbpt)
+{
+    bptree_t * bpt = (bptree_t *)vbpt;
+
+    if (!bpt || !bpt->tail || bpt->tail->num <= 0)
+        return NULL;
+
+    return bpt->tail->ptr[bpt->tail->num - 1];
+}
+
+
+/* insert separator sep and its right child into the nodes of path from
+ * depth d upward, splitting the full ones */
+static int bpt_insert_parent (bptree_t * bpt, BPTPath * path, int d, void * sep, bptnode_t * right)
+{
+    bptnode_t * node = NULL;
+    bptnode_t * sibling = NULL;
+    bptnode_t * root = NULL;
+    void      * keys[BPT_ORDER];
+    void      * ptrs[BPT_ORDER + 1];
+    int         i, pos, half;
+
+    for ( ; d >= 0; d--) {
+        node = path->node[d];
+        pos = path->index[d];
+
+        if (node->num < BPT_ORDER - 1) {
+            memmove(node->key + pos + 1, node->key + pos, (node->num - pos) * sizeof(void *));
+            memmove(node->ptr + pos + 2, node->ptr + pos + 1, (node->num - pos) * sizeof(void *));
+            node->key[pos] = sep;
+            node->ptr[pos + 1] = right;
+            node->num++;
+            return 0;
+        }
+
+        /* the full node has BPT_ORDER separators then, split at half */
+        for (i = 0; i < pos; i++) keys[i] = node->key[i];
+        keys[pos] = sep;
+        for (i = pos; i < node->num; i++) keys[i + 1] = node->key[i];
+
+        for (i = 0; i <= pos; i++) ptrs[i] = node->ptr[i];
+        ptrs[pos + 1] = right;
+        for (i = pos + 1; i <= node->num; i++) ptrs[i + 1] = node->ptr[i];
+
+        sibling = bptnode_alloc(bpt, 0);
+        if (!sibling) return -100;
+
+        half = BPT_ORDER / 2;
+
+        memcpy(node->key, keys, half * sizeof(void *));
+        memcpy(node->ptr, ptrs, (half + 1) * sizeof(void *));
+        node->num = half;
+
+        memcpy(sibling->key, keys + half + 1, (BPT_ORDER - half - 1) * sizeof(void *));
+        memcpy(sibling->ptr, ptrs + half + 1, (BPT_ORDER - half) * sizeof(void *));
+        sibling->num = BPT_ORDER - half - 1;
+
+        sep = keys[half];
+        right = sibling;
+    }
+
+    /* the root is split, grow one level */
+    root = bptnode_alloc(bpt, 0);
+    if (!root) return -100;
+
+    root->key[0] = sep;
+    root->ptr[0] = bpt->root;
+    root->ptr[1] = right;
+    root->num = 1;
+
+    bpt->root = root;
+    bpt->depth++;
+
+    return 0;
+}
+
+int bptree_insert (void * vbpt, void * key, void * obj)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    bptnode_t * iter = NULL;
+    bptnode_t * right = NULL;
+    BPTPath     path, tmp;
+    void      * keys[BPT_ORDER + 1];
+    void      * objs[BPT_ORDER + 1];
+    int         i, pos, half;
+
+    if (!bpt || !obj) return -1;
+    if (bpt->cmp && !key) return -1;
+
+    if (!bpt->root) {
+        bpt->root = bpt->head = bpt->tail = bptnode_alloc(bpt, 1);
+        if (!bpt->root) return -100;
+        bpt->depth = 1;
+    }
+
+    leaf = bpt_descend(bpt, key, &path);
+    pos = bpt_less(bpt, leaf, key);
+
+    /* the same obj with equal key is not inserted again */
+    memcpy(&tmp, &path, sizeof(tmp));
+    for (iter = leaf, i = pos; iter; ) {
+        if (i >= iter->num) {
+            iter = bpt_path_next(&tmp);
+            i = 0;
+            continue;
+        }
+        if (bpt_entry_cmp(bpt, iter, i, key) != 0) break;
+        if (iter->ptr[i] == obj) return 0;
+        i++;
+    }
+
+    if (leaf->num < BPT_ORDER) {
+        memmove(leaf->key + pos + 1, leaf->key + pos, (leaf->num - pos) * sizeof(void *));
+        memmove(leaf->ptr + pos + 1, leaf->ptr + pos, (leaf->num - pos) * sizeof(void *));
+        leaf->key[pos] = key;
+        leaf->ptr[pos] = obj;
+        leaf->num++;
+        bpt->num++;
+        return 1;
+    }
+
+    right = bptnode_alloc(bpt, 1);
+    if (!right) return -100;
+
+    for (i = 0; i < pos; i++) {
+        keys[i] = leaf->key[i];
+        objs[i] = leaf->ptr[i];
+    }
+    keys[pos] = key;
+    objs[pos] = obj;
+    for (i = pos; i < leaf->num; i++) {
+        keys[i + 1] = leaf->key[i];
+        objs[i + 1] = leaf->ptr[i];
+    }
+
+    half = (BPT_ORDER + 1) / 2;
+
+    memcpy(leaf->key, keys, half * sizeof(void *));
+    memcpy(leaf->ptr, objs, half * sizeof(void *));
+    leaf->num = half;
+
+    memcpy(right->key, keys + half, (BPT_ORDER + 1 - half) * sizeof(void *));
+    memcpy(right->ptr, objs + half, (BPT_ORDER + 1 - half) * sizeof(void *));
+    right->num = BPT_ORDER + 1 - half;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) leaf->next->prev = right;
+    else bpt->tail = right;
+    leaf->next = right;
+
+    bpt->num++;
+
+    if (bpt_insert_parent(bpt, &path, path.depth - 1, bpt_sepval(bpt, right, 0), right) < 0)
+        return -100;
+
+    return 1;
+}
+
+
+static void bpt_unlink_leaf (bptree_t * bpt, bptnode_t * leaf)
+{
+    if (leaf->prev) leaf->prev->next = leaf->next;
+    else bpt->head = leaf->next;
+
+    if (leaf->next) leaf->next->prev = leaf->prev;
+    else bpt->tail = leaf->prev;
+}
+
+/* remove separator i and child i+1 of inner node */
+static void bpt_remove_sep (bptnode_t * node, int i)
+{
+    memmove(node->key + i, node->key + i + 1, (node->num - i - 1) * sizeof(void *));
+    memmove(node->ptr + i + 1, node->ptr + i + 2, (node->num - i - 1) * sizeof(void *));
+    node->num--;
+}
+
+static void bpt_rebalance_inner (bptree_t * bpt, BPTPath * path, int d)
+{
+    bptnode_t * node = NULL;
+    bptnode_t * parent = NULL;
+    bptnode_t * left = NULL;
+    bptnode_t * right = NULL;
+    int         j;
+
+    for ( ; d >= 0; d--) {
+        node = path->node[d];
+
+        if (d == 0) {
+            /* the root with one child is removed */
+            if (node->num == 0) {
+                bpt->root = node->ptr[0];
+                bpt->depth--;
+                bptnode_free(bpt, node);
+            }
+            return;
+        }
+
+        if (node->num >= BPT_INNER_MIN) return;
+
+        parent = path->node[d - 1];
+        j = path->index[d - 1];
+
+        left = j > 0 ? parent->ptr[j - 1] : NULL;
+        right = j < parent->num ? parent->ptr[j + 1] : NULL;
+
+        if (left && left->num > BPT_INNER_MIN) {
+            memmove(node->key + 1, node->key, node->num * sizeof(void *));
+            memmove(node->ptr + 1, node->ptr, (node->num + 1) * sizeof(void *));
+            node->key[0] = parent->key[j - 1];
+            node->ptr[0] = left->ptr[left->num];
+            node->num++;
+
+            parent->key[j - 1] = left->key[left->num - 1];
+            left->num--;
+            return;
+        }
+
+        if (right && right->num > BPT_INNER_MIN) {
+            node->key[node->num] = parent->key[j];
+            node->ptr[node->num + 1] = right->ptr[0];
+            node->num++;
+
+            parent->key[j] = right->key[0];
+            memmove(right->key, right->key + 1, (right->num - 1) * sizeof(void *));
+            memmove(right->ptr, right->ptr + 1, right->num * sizeof(void *));
+            right->num--;
+            return;
+        }
+
+        if (left) {
+            left->key[left->num] = parent->key[j - 1];
+            memcpy(left->key + left->num + 1, node->key, node->num * sizeof(void *));
+            memcpy(left->ptr + left->num + 1, node->ptr, (node->num + 1) * sizeof(void *));
+            left->num += node->num + 1;
+
+            bpt_remove_sep(parent, j - 1);
+            bptnode_free(bpt, node);
+
+        } else if (right) {
+            node->key[node->num] = parent->key[j];
+            memcpy(node->key + node->num + 1, right->key, right->num * sizeof(void *));
+            memcpy(node->ptr + node->num + 1, right->ptr, (right->num + 1) * sizeof(void *));
+            node->num += right->num + 1;
+
+            bpt_remove_sep(parent, j);
+            bptnode_free(bpt, right);
+        }
+    }
+}
+
+/* remove entry i of the leaf at the end of path */
+static void * bpt_remove (bptree_t * bpt, BPTPath * path, bptnode_t * leaf, int i)
+{
+    bptnode_t * parent = NULL;
+    bptnode_t * left = NULL;
+    bptnode_t * right = NULL;
+    void      * obj = NULL;
+    int         d, j;
+
+    obj = leaf->ptr[i];
+
+    memmove(leaf->key + i, leaf->key + i + 1, (leaf->num - i - 1) * sizeof(void *));
+    memmove(leaf->ptr + i, leaf->ptr + i + 1, (leaf->num - i - 1) * sizeof(void *));
+    leaf->num--;
+    bpt->num--;
+
+    /* the separator of the subtree that leaf is leftmost in refers to the
+     * first entry, replace it so that no separator refers to removed obj */
+    if (i == 0) {
+        for (d = path->depth - 1; d >= 0 && path->index[d] == 0; d--);
+
+        if (d >= 0) {
+            if (leaf->num > 0)
+                path->node[d]->key[path->index[d] - 1] = bpt_sepval(bpt, leaf, 0);
+            else if (leaf->next)
+                path->node[d]->key[path->index[d] - 1] = bpt_sepval(bpt, leaf->next, 0);
+        }
+    }
+
+    if (path->depth == 0) {
+        if (leaf->num == 0) {
+            bptnode_free(bpt, leaf);
+            bpt->root = bpt->head = bpt->tail = NULL;
+            bpt->depth = 0;
+        }
+        return obj;
+    }
+
+    if (leaf->num >= BPT_LEAF_MIN) return obj;
+
+    parent = path->node[path->depth - 1];
+    j = path->index[path->depth - 1];
+
+    left = j > 0 ? parent->ptr[j - 1] : NULL;
+    right = j < parent->num ? parent->ptr[j + 1] : NULL;
+
+    if (left && left->num > BPT_LEAF_MIN) {
+        memmove(leaf->key + 1, leaf->key, leaf->num * sizeof(void *));
+        memmove(leaf->ptr + 1, leaf->ptr, leaf->num * sizeof(void *));
+        leaf->key[0] = left->key[left->num - 1];
+        leaf->ptr[0] = left->ptr[left->num - 1];
+        leaf->num++;
+        left->num--;
+
+        parent->key[j - 1] = bpt_sepval(bpt, leaf, 0);
+        return obj;
+    }
+
+    if (right && right->num > BPT_LEAF_MIN) {
+        leaf->key[leaf->num] = right->key[0];
+        leaf->ptr[leaf->num] = right->ptr[0];
+        leaf->num++;
+
+        memmove(right->key, right->key + 1, (right->num - 1) * sizeof(void *));
+        memmove(right->ptr, right->ptr + 1, (right->num - 1) * sizeof(void *));
+        right->num--;
+
+        parent->key[j] = bpt_sepval(bpt, right, 0);
+        return obj;
+    }
+
+    if (left) {
+        memcpy(left->key + left->num, leaf->key, leaf->num * sizeof(void *));
+        memcpy(left->ptr + left->num, leaf->ptr, leaf->num * sizeof(void *));
+        left->num += leaf->num;
+
+        bpt_unlink_leaf(bpt, leaf);
+        bpt_remove_sep(parent, j - 1);
+        bptnode_free(bpt, leaf);
+
+    } else if (right) {
+        memcpy(leaf->key + leaf->num, right->key, right->num * sizeof(void *));
+        memcpy(leaf->ptr + leaf->num, right->ptr, right->num * sizeof(void *));
+        leaf->num += right->num;
+
+        bpt_unlink_leaf(bpt, right);
+        bpt_remove_sep(parent, j);
+        bptnode_free(bpt, right);
+    }
+
+    bpt_rebalance_inner(bpt, path, path->depth - 1);
+
+    return obj;
+}
+
+void * bptree_delete (void * vbpt, void * key)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    BPTPath     path;
+    int         i = 0;
+
+    if (!bpt) return NULL;
+    if (bpt->cmp && !key) return NULL;
+
+    leaf = bpt_find(bpt, key, &path, &i);
+    if (!leaf) return NULL;
+
+    return bpt_remove(bpt, &path, leaf, i);
+}
+
+int bptree_mdelete (void * vbpt, void * key, void ** plist, int listnum)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    BPTPath     path;
+    void      * obj = NULL;
+    int         i = 0;
+    int         num = 0;
+
+    if (!bpt) return -1;
+    if (bpt->cmp && !key) return -1;
+
+    while ((leaf = bpt_find(bpt, key, &path, &i)) != NULL) {
+        obj = bpt_remove(bpt, &path, leaf, i);
+
+        if (plist && num < listnum)
+            plist[num] = obj;
+        num++;
+    }
+
+    return num;
+}
+
+void * bptree_delete_min (void * vbpt)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * node = NULL;
+    BPTPath     path;
+
+    if (!bpt || !bpt->root || bpt->num <= 0) return NULL;
+
+    path.depth = 0;
+    for (node = bpt->root; !node->leaf; node = node->ptr[0]) {
+        path.node[path.depth] = node;
+        path.index[path.depth] = 0;
+        path.depth++;
+    }
+
+    return bpt_remove(bpt, &path, node, 0);
+}
+
+void * bptree_delete_max (void * vbpt)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * node = NULL;
+    BPTPath     path;
+
+    if (!bpt || !bpt->root || bpt->num <= 0) return NULL;
+
+    path.depth = 0;
+    for (node = bpt->root; !node->leaf; node = node->ptr[node->num]) {
+        path.node[path.depth] = node;
+        path.index[path.depth] = node->num;
+        path.depth++;
+    }
+
+    return bpt_remove(bpt, &path, node, node->num - 1);
+}
+
+
+int bptree_load (void * vbpt, void ** keys, void ** objs, int num)
+{
+    bptree_t   * bpt = (bptree_t *)vbpt;
+    bptnode_t ** level = NULL;
+    void      ** mins = NULL;
+    bptnode_t  * node = NULL;
+    bptnode_t  * prev = NULL;
+    int          count, i, j, k, n;
+
+    if (!bpt || !keys || !objs || num < 0) return -1;
+    if (bpt->root || bpt->num > 0) return -2;
+
+    for (i = 1; i < num; i++) {
+        if (bpt->cmp) {
+            if ((*bpt->cmp)(objs[i - 1], keys[i]) > 0) return -3;
+        } else if ((long)keys[i - 1] > (long)keys[i]) {
+            return -3;
+        }
+    }
+
+    if (num == 0) return 0;
+
+    /* children of the next level and the least separator value of them */
+    count = (num + BPT_ORDER - 1) / BPT_ORDER;
+    level = kzalloc(count * sizeof(bptnode_t *));
+    mins = kzalloc(count * sizeof(void *));
+    if (!level || !mins) {
+        if (level) kfree(level);
+        if (mins) kfree(mins);
+        return -100;
+    }
+
+    /* the last two nodes of a level share the rest if it is below minimum */
+    for (i = 0, k = 0; i < num; k++) {
+        n = num - i;
+        if (n > BPT_ORDER) {
+            n = BPT_ORDER;
+            if (num - i - n < BPT_LEAF_MIN) n = (num - i + 1) / 2;
+        }
+
+        node = bptnode_alloc(bpt, 1);
+        if (!node) goto nomem;
+
+        memcpy(node->key, keys + i, n * sizeof(void *));
+        memcpy(node->ptr, objs + i, n * sizeof(void *));
+        node->num = n;
+
+        node->prev = prev;
+        if (prev) prev->next = node;
+        else bpt->head = node;
+        prev = node;
+
+        level[k] = node;
+        mins[k] = bpt_sepval(bpt, node, 0);
+        i += n;
+    }
+
+    bpt->tail = prev;
+    bpt->num = num;
+    bpt->depth = 1;
+    count = k;
+
+    while (count > 1) {
+        for (i = 0, k = 0; i < count; k++) {
+            n = count - i;
+            if (n > BPT_ORDER) {
+                n = BPT_ORDER;
+                if (count - i - n < BPT_INNER_MIN + 1) n = (count - i + 1) / 2;
+            }
+
+            node = bptnode_alloc(bpt, 0);
+            if (!node) goto nomem;
+
+            for (j = 0; j < n; j++) {
+                node->ptr[j] = level[i + j];
+                if (j > 0) node->key[j - 1] = mins[i + j];
+            }
+            node->num = n - 1;
+
+            level[k] = node;
+            mins[k] = mins[i];
+            i += n;
+        }
+
+        count = k;
+        bpt->depth++;
+    }
+
+    bpt->root = level[0];
+
+    kfree(level);
+    kfree(mins);
+    return num;
+
+nomem:
+    if (bpt->depth == 0) {
+        /* leaves are all linked from head yet */
+        for (node = bpt->head; node; node = prev) {
+            prev = node->next;
+            bptnode_free(bpt, node);
+        }
+    } else {
+        /* the new parents and the children not yet moved into parents */
+        for (j = 0; j < k; j++)
+            bptnode_recursive_free(bpt, level[j], NULL);
+        for (j = i; j < count; j++)
+            bptnode_recursive_free(bpt, level[j], NULL);
+    }
+
+    bpt->root = bpt->head = bpt->tail = NULL;
+    bpt->num = 0;
+    bpt->depth = 0;
+
+    kfree(level);
+    kfree(mins);
+    return -100;
+}
+
+
+int bptree_inorder (void * vbpt, rbtcb_t * cb, void * cbpara)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    int         i, index = 0;
+
+    if (!bpt) return -1;
+
+    for (leaf = bpt->head; leaf; leaf = leaf->next) {
+        for (i = 0; i < leaf->num; i++, index++) {
+            if (cb) (*cb)(cbpara, leaf->key[i], leaf->ptr[i], index);
+        }
+    }
+
+    return index;
+}
+
+int bptree_range (void * vbpt, void * lokey, void * hikey, rbtcb_t * cb, void * cbpara)
+{
+    bptree_t  * bpt = (bptree_t *)vbpt;
+    bptnode_t * leaf = NULL;
+    BPTPath     path;
+    int         i = 0, index = 0;
+
+    if (!bpt) return -1;
+
+    if (!bpt->root) return 0;
+
+    if (bpt->cmp && !lokey) {
+        leaf = bpt->head;
+    } else {
+        leaf = bpt_descend(bpt, lokey, &path);
+        i = bpt_less(bpt, leaf, lokey);
+    }
+
+    for ( ; leaf; leaf = leaf->next, i = 0) {
+        for ( ; i < leaf->num; i++, index++) {
+            if ((!bpt->cmp || hikey) && bpt_entry_cmp(bpt, leaf, i, hikey) > 0)
+                return index;
+
+            if (cb) (*cb)(cbpara, leaf->key[i], leaf->ptr[i], index);
+        }
+    }
+
+    return index;
+}
+
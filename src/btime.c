@@ -5,6 +5,7 @@
 
 #include "btype.h"
 #include "btime.h"
+#include "strutil.h"
 
 #ifdef _WIN32
 int gettimeofday(struct timeval * tv, struct timezone * tz)
@@ -74,6 +75,159 @@ void btime_now_add (btime_t * tp, long ms)
 }
 
 
+#ifdef UNIX
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE  CLOCK_REALTIME
+#endif
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+static long btime_clock (clockid_t id, btime_t * tp)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    if (tp) {
+        tp->s = ts.tv_sec;
+        tp->ms = ts.tv_nsec / 1000000;
+    }
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long btime_coarse (btime_t * tp)
+{
+    return btime_clock(CLOCK_REALTIME_COARSE, tp);
+}
+
+long btime_mono (btime_t * tp)
+{
+    return btime_clock(CLOCK_MONOTONIC, tp);
+}
+
+long btime_mono_coarse (btime_t * tp)
+{
+    return btime_clock(CLOCK_MONOTONIC_COARSE, tp);
+}
+
+static int64 btime_mono_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#else
+
+long btime_coarse (btime_t * tp)
+{
+    return btime(tp);
+}
+
+static int64 btime_mono_ns ()
+{
+    LARGE_INTEGER  cnt, freq;
+
+    QueryPerformanceCounter(&cnt);
+    QueryPerformanceFrequency(&freq);
+
+    return (int64)(cnt.QuadPart / freq.QuadPart * 1000000000LL +
+                   cnt.QuadPart % freq.QuadPart * 1000000000LL / freq.QuadPart);
+}
+
+long btime_mono (btime_t * tp)
+{
+    int64  ns = btime_mono_ns();
+
+    if (tp) {
+        tp->s = (long)(ns / 1000000000LL);
+        tp->ms = (long)(ns / 1000000 % 1000);
+    }
+    return (long)(ns / 1000);
+}
+
+long btime_mono_coarse (btime_t * tp)
+{
+    ULONGLONG  ms = GetTickCount64();
+
+    if (tp) {
+        tp->s = (long)(ms / 1000);
+        tp->ms = (long)(ms % 1000);
+    }
+    return (long)(ms * 1000);
+}
+
+#endif
+
+void btime_mono_add (btime_t * tp, long ms)
+{
+    btime_mono(tp);
+    btime_add_ms(tp, ms);
+}
+
+
+uint64 btime_cycles ()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+    uint32  lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64)hi << 32 | lo;
+#elif defined(__GNUC__) && defined(__aarch64__)
+    uint64  val;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+#else
+    return (uint64)btime_mono_ns();
+#endif
+}
+
+static uint64 bt_cycles_hz = 0;
+
+uint64 btime_cycles_hz ()
+{
+    uint64  hz = __atomic_load_n(&bt_cycles_hz, __ATOMIC_ACQUIRE);
+    uint64  c0, c1;
+    int64   t0, t1;
+
+    if (hz) return hz;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+    /* the TSC rate is counted over 10 ms of the monotonic clock */
+    t0 = btime_mono_ns();
+    c0 = btime_cycles();
+    do {
+        t1 = btime_mono_ns();
+    } while (t1 - t0 < 10000000);
+    c1 = btime_cycles();
+
+    hz = (uint64)((double)(c1 - c0) * 1000000000.0 / (double)(t1 - t0));
+#elif defined(__GNUC__) && defined(__aarch64__)
+    __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r"(hz));
+    (void)c0; (void)c1; (void)t0; (void)t1;
+#else
+    hz = 1000000000ULL;
+    (void)c0; (void)c1; (void)t0; (void)t1;
+#endif
+
+    if (hz == 0) hz = 1;
+
+    __atomic_store_n(&bt_cycles_hz, hz, __ATOMIC_RELEASE);
+    return hz;
+}
+
+int64 btime_cycles_ns (uint64 cycles)
+{
+    uint64  hz = btime_cycles_hz();
+
+    return (int64)(cycles / hz * 1000000000ULL +
+                   (double)(cycles % hz) * 1000000000.0 / (double)hz);
+}
+
+
 btime_t btime_diff (btime_t * tp0, btime_t * tp1)
 {
     btime_t ret = {0};
@@ -102,3 +256,84 @@ long btime_diff_ms (btime_t * tp0, btime_t * tp1)
     return ms;
 }
 
+
+typedef struct btime_str_s {
+    long    sec;
+    int     gmtlen;
+    int     loclen;
+    char    gmt[40];
+    char    loc[24];
+} btime_str_t;
+
+/* the new second is formatted into the next slot and then published, the
+ * readers of the old slots are never overwritten under them */
+static btime_str_t   bt_slots[BTIME_SLOTS];
+static btime_str_t * bt_cur = NULL;
+static int           bt_next = 0;
+static int           bt_lock = 0;
+
+static btime_str_t * btime_str_get ()
+{
+    btime_str_t * cur = NULL;
+    btime_str_t * slot = NULL;
+    btime_t       now;
+    time_t        tick;
+    struct tm     st;
+
+    /* the tick of coarse clock is far finer than the second */
+    btime_coarse(&now);
+
+    cur = __atomic_load_n(&bt_cur, __ATOMIC_ACQUIRE);
+    if (cur && cur->sec == now.s) return cur;
+
+    /* only one caller formats, the others go on with the last second */
+    if (__atomic_exchange_n(&bt_lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (!cur) cur = __atomic_load_n(&bt_cur, __ATOMIC_ACQUIRE);
+        return cur;
+    }
+
+    cur = __atomic_load_n(&bt_cur, __ATOMIC_ACQUIRE);
+    if (!cur || cur->sec != now.s) {
+        slot = &bt_slots[bt_next];
+        bt_next = (bt_next + 1) % BTIME_SLOTS;
+
+        tick = now.s;
+        slot->sec = now.s;
+
+        str_time2gmt(&tick, slot->gmt, sizeof(slot->gmt), 0);
+        slot->gmtlen = strlen(slot->gmt);
+
+#ifdef UNIX
+        localtime_r(&tick, &st);
+#else
+        st = *localtime(&tick);
+#endif
+        slot->loclen = snprintf(slot->loc, sizeof(slot->loc), "%04d-%02d-%02d %02d:%02d:%02d",
+                                st.tm_year+1900, st.tm_mon+1, st.tm_mday,
+                                st.tm_hour, st.tm_min, st.tm_sec);
+
+        __atomic_store_n(&bt_cur, slot, __ATOMIC_RELEASE);
+        cur = slot;
+    }
+
+    __atomic_store_n(&bt_lock, 0, __ATOMIC_RELEASE);
+
+    return cur;
+}
+
+char * btime_gmtstr (int * plen)
+{
+    btime_str_t * cur = btime_str_get();
+
+    if (plen) *plen = cur->gmtlen;
+    return cur->gmt;
+}
+
+char * btime_localstr (int * plen)
+{
+    btime_str_t * cur = btime_str_get();
+
+    if (plen) *plen = cur->loclen;
+    return cur->loc;
+}
+
@@ -52,115 +52,79 @@ int iter_set_buffer (ByteIter * iter, uint8 * text, int len)
 
 int iter_get_uint64BE (ByteIter * iter, uint64 * pval)
 {
-    int      i = 0;
     uint64   val = 0;
-    uint8  * pbyte = NULL;
- 
+
     if (!iter) return -1;
     if (iter_rest(iter) < 8) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (val=0, i=0; i<8; i++) {
-        val <<= 8; val |= pbyte[i];
-    }
+
+    val = iter_fetch_uint64BE(iter);
     if (pval) *pval = val;
-     
-    iter_forward(iter, 8);
+
     return 0;
 }
 
 int iter_get_uint64LE (ByteIter * iter, uint64 * pval)
 {
-    int      i = 0;
     uint64   val = 0;
-    uint8  * pbyte = NULL;
 
     if (!iter) return -1;
     if (iter_rest(iter) < 8) return -100;
 
-    pbyte = iter_cur(iter);
-    for (val=0, i=7; i>=0; i--) {
-        val <<= 8; val |= pbyte[i];
-    }
+    val = iter_fetch_uint64LE(iter);
     if (pval) *pval = val;
 
-    iter_forward(iter, 8);
     return 0;
 }
 
 int iter_get_uint32BE (ByteIter * iter, uint32 * pval)
-{ 
-    int      i = 0;
+{
     uint32   val = 0;
-    uint8  * pbyte = NULL;
-     
+
     if (!iter) return -1;
     if (iter_rest(iter) < 4) return -100;
-     
-    pbyte = iter_cur(iter);
-    for (val=0, i=0; i<4; i++) {
-        val <<= 8; val |= pbyte[i];
-    }    
+
+    val = iter_fetch_uint32BE(iter);
     if (pval) *pval = val;
-      
-    iter_forward(iter, 4);
-    return 0;  
-}    
- 
+
+    return 0;
+}
+
 int iter_get_uint32LE (ByteIter * iter, uint32 * pval)
 {
-    int      i = 0;
     uint32   val = 0;
-    uint8  * pbyte = NULL;
- 
+
     if (!iter) return -1;
     if (iter_rest(iter) < 4) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (val=0, i=3; i>=0; i--) {
-        val <<= 8; val |= pbyte[i];
-    }
+
+    val = iter_fetch_uint32LE(iter);
     if (pval) *pval = val;
- 
-    iter_forward(iter, 4);
+
     return 0;
 }
- 
+
 int iter_get_uint16BE (ByteIter * iter, uint16 * pval)
 {
-    int      i = 0;
     uint16   val = 0;
-    uint8  * pbyte = NULL;
- 
+
     if (!iter) return -1;
     if (iter_rest(iter) < 2) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (val=0, i=0; i<2; i++) {
-        val <<= 8; val |= pbyte[i];
-    }
+
+    val = iter_fetch_uint16BE(iter);
     if (pval) *pval = val;
- 
-    iter_forward(iter, 2);
+
     return 0;
 }
- 
+
 int iter_get_uint16LE (ByteIter * iter, uint16 * pval)
 {
-    int      i = 0;
     uint16   val = 0;
-    uint8  * pbyte = NULL;
- 
+
     if (!iter) return -1;
     if (iter_rest(iter) < 2) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (val=0, i=1; i>=0; i--) {
-        val <<= 8; val |= pbyte[i];
-    }
+
+    val = iter_fetch_uint16LE(iter);
     if (pval) *pval = val;
- 
-    iter_forward(iter, 2);
+
     return 0;
 }
 
@@ -215,27 +179,47 @@ int iter_set_bytes (ByteIter * iter, uint8 * pbuf, int buflen)
     return len;
 }
 
+/* format into the rest bytes in place. the string is cut off to the rest,
+ * and the terminating 0 is written after it only if there is room for it */
 int iter_fmtstr (ByteIter * iter, const char * fmt, ...)
 {
     uint8  * pbyte = NULL;
+    char   * tmp = NULL;
     int      len = 0;
-    va_list  args;
-    char     tmp[4096];
+    int      ret = 0;
+    va_list  args, cargs;
 
     if (!iter) return -1;
 
     pbyte = iter_cur(iter);
     len = iter_rest(iter);
-     
-    memset(tmp, 0, sizeof(tmp));
+    if (len <= 0) return 0;
+
     va_start(args, fmt);
-    vsprintf(tmp, fmt, args);
+    va_copy(cargs, args);
+    ret = vsnprintf((char *)pbyte, len, fmt, args);
     va_end(args);
 
-    if (len > (int)strlen(tmp)) len = strlen(tmp);
+    if (ret < 0) {
+        va_end(cargs);
+        return -1;
+    }
 
-    memcpy(pbyte, tmp, len);
-    return len;
+    /* vsnprintf keeps the last byte for the 0, the cut off string is
+     * formatted again to fill the last byte up */
+    if (ret >= len) {
+        tmp = kalloc(ret + 1);
+        if (tmp) {
+            vsnprintf(tmp, ret + 1, fmt, cargs);
+            memcpy(pbyte, tmp, len);
+            kfree(tmp);
+        } else
+            len--;
+        ret = len;
+    }
+
+    va_end(cargs);
+    return ret;
 }
 
 
@@ -252,118 +236,294 @@ int iter_set_uint8 (ByteIter * iter, uint8 byte)
 
 int iter_set_uint16BE (ByteIter * iter, uint16 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;  
-         
     if (!iter) return -1;
     if (iter_rest(iter) < 2) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (i=0; i<2; i++) {
-        byte = (uint8)((val >> ((1-i)*8)) & 0xFF);
-        pbyte[i] = byte;
-    }
- 
-    iter_forward(iter, 2);
+
+    iter_put_uint16BE(iter, val);
     return 0;
 }
 
 int iter_set_uint16LE (ByteIter * iter, uint16 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;
- 
     if (!iter) return -1;
     if (iter_rest(iter) < 2) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (i=0; i<2; i++) { 
-        byte = (uint8)((val >> (i*8)) & 0xFF);
-        pbyte[i] = byte;
-    }
- 
-    iter_forward(iter, 2);
+
+    iter_put_uint16LE(iter, val);
     return 0;
 }
 
 int iter_set_uint32BE (ByteIter * iter, uint32 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;
- 
     if (!iter) return -1;
     if (iter_rest(iter) < 4) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (i=0; i<4; i++) { 
-        byte = (uint8)((val >> ((3-i)*8)) & 0xFF);
-        pbyte[i] = byte;
-    }
- 
-    iter_forward(iter, 4);
+
+    iter_put_uint32BE(iter, val);
     return 0;
 }
 
 int iter_set_uint32LE (ByteIter * iter, uint32 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;
- 
     if (!iter) return -1;
     if (iter_rest(iter) < 4) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (i=0; i<4; i++) {
-        byte = (uint8)((val >> i*8) & 0xFF);
-        pbyte[i] = byte;
-    }
- 
-    iter_forward(iter, 4);
+
+    iter_put_uint32LE(iter, val);
     return 0;
 }
 
 int iter_set_uint64BE (ByteIter * iter, uint64 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;
- 
     if (!iter) return -1;
     if (iter_rest(iter) < 8) return -100;
- 
-    pbyte = iter_cur(iter);
-    for (i=0; i<8; i++) {
-        byte = (uint8)((val >> ((7-i)*8)) & 0xFF);
-        pbyte[i] = byte;
-    }
- 
-    iter_forward(iter, 8);
+
+    iter_put_uint64BE(iter, val);
     return 0;
 }
 
 int iter_set_uint64LE (ByteIter * iter, uint64 val)
 {
-    int      i = 0;
-    uint8    byte = 0;
-    uint8  * pbyte = NULL;
-  
     if (!iter) return -1;
     if (iter_rest(iter) < 8) return -100;
-     
-    pbyte = iter_cur(iter);
-    for (i=0; i<8; i++) {
-        byte = (uint8)((val >> i*8) & 0xFF);
-        pbyte[i] = byte;
+
+    iter_put_uint64LE(iter, val);
+    return 0;
+}
+
+
+int iter_varint_size (uint64 val)
+{
+    int  n = 1;
+
+    while (val >= 0x80) {
+        val >>= 7;
+        n++;
     }
- 
-    iter_forward(iter, 8);
+
+    return n;
+}
+
+int iter_get_varint (ByteIter * iter, uint64 * pval)
+{
+    uint8  * p = NULL;
+    uint64   val = 0;
+    int      i, rest;
+
+    if (!iter) return -1;
+
+    p = iter_cur(iter);
+    rest = iter_rest(iter);
+
+    /* 1 byte of the values under 128 is the most */
+    if (rest > 0 && p[0] < 0x80) {
+        if (pval) *pval = p[0];
+        iter->cur++;
+        return 0;
+    }
+
+    if (rest > VARINT_MAX) rest = VARINT_MAX;
+
+    for (i = 0; i < rest; i++) {
+        val |= (uint64)(p[i] & 0x7F) << (7 * i);
+
+        if (p[i] < 0x80) {
+            if (pval) *pval = val;
+            iter->cur += i + 1;
+            return 0;
+        }
+    }
+
+    return rest < VARINT_MAX ? -100 : -101;
+}
+
+int iter_set_varint (ByteIter * iter, uint64 val)
+{
+    uint8  * p = NULL;
+    int      n = 0;
+
+    if (!iter) return -1;
+
+    if (iter_rest(iter) < VARINT_MAX && iter_rest(iter) < iter_varint_size(val))
+        return -100;
+
+    p = iter_cur(iter);
+
+    while (val >= 0x80) {
+        p[n++] = (uint8)val | 0x80;
+        val >>= 7;
+    }
+    p[n++] = (uint8)val;
+
+    iter->cur += n;
+    return 0;
+}
+
+int iter_get_svarint (ByteIter * iter, int64 * pval)
+{
+    uint64  val = 0;
+    int     ret = 0;
+
+    ret = iter_get_varint(iter, &val);
+    if (ret < 0) return ret;
+
+    if (pval) *pval = zigzag_decode(val);
+    return 0;
+}
+
+int iter_set_svarint (ByteIter * iter, int64 val)
+{
+    return iter_set_varint(iter, zigzag_encode(val));
+}
+
+
+/* copy num integers of size bytes from src to dst, with the bytes of each
+ * reversed if swap is set. the byte swap is done by pshufb, 16 or 32 bytes
+ * at a time, where the CPU has SSSE3 or AVX2 */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ITER_X86_DISPATCH 1
+#include <immintrin.h>
+
+static const uint8 iter_bswap_mask[3][16] = {
+    { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+    { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+    { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 }
+};
+
+/* return the bytes done, a multiple of 16 */
+__attribute__((target("ssse3")))
+static int iter_bswap_ssse3 (uint8 * dst, uint8 * src, int len, int mind)
+{
+    __m128i  mask = _mm_loadu_si128((const __m128i *)iter_bswap_mask[mind]);
+    int      i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), mask));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int iter_bswap_avx2 (uint8 * dst, uint8 * src, int len, int mind)
+{
+    __m128i  m = _mm_loadu_si128((const __m128i *)iter_bswap_mask[mind]);
+    __m256i  mask = _mm256_broadcastsi128_si256(m);
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                   _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + i)), mask));
+    }
+
+    for ( ; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), m));
+    }
+
+    return i;
+}
+
+static int iter_simd_level ()
+{
+    static int level = -1;
+    int        lvl = __atomic_load_n(&level, __ATOMIC_RELAXED);
+
+    if (lvl < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) lvl = 2;
+        else if (__builtin_cpu_supports("ssse3")) lvl = 1;
+        else lvl = 0;
+        __atomic_store_n(&level, lvl, __ATOMIC_RELAXED);
+    }
+
+    return lvl;
+}
+#endif
+
+static void iter_copy_ints (uint8 * dst, uint8 * src, int num, int size, int swap)
+{
+    int  len = num * size;
+    int  i = 0, k;
+
+    if (!swap) {
+        memcpy(dst, src, len);
+        return;
+    }
+
+#ifdef ITER_X86_DISPATCH
+    k = iter_simd_level();
+    if (k >= 2) i = iter_bswap_avx2(dst, src, len, size >> 2);
+    else if (k >= 1) i = iter_bswap_ssse3(dst, src, len, size >> 2);
+#endif
+
+    for ( ; i < len; i += size) {
+        for (k = 0; k < size; k++) dst[i + k] = src[i + size - 1 - k];
+    }
+}
+
+/* the bytes of host order are to be reversed for the byte order asked */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ITER_SWAP(bigendian)  (!(bigendian))
+#else
+#define ITER_SWAP(bigendian)  (bigendian)
+#endif
+
+static int iter_get_ints (ByteIter * iter, void * vals, int num, int size, int bigendian)
+{
+    if (!iter || num < 0) return -1;
+    if (num > iter_rest(iter) / size) return -100;
+    if (num == 0) return 0;
+    if (!vals) return -2;
+
+    iter_copy_ints((uint8 *)vals, iter_cur(iter), num, size, ITER_SWAP(bigendian));
+    iter->cur += num * size;
+
+    return 0;
+}
+
+static int iter_set_ints (ByteIter * iter, void * vals, int num, int size, int bigendian)
+{
+    if (!iter || num < 0) return -1;
+    if (num > iter_rest(iter) / size) return -100;
+    if (num == 0) return 0;
+    if (!vals) return -2;
+
+    iter_copy_ints(iter_cur(iter), (uint8 *)vals, num, size, ITER_SWAP(bigendian));
+    iter->cur += num * size;
+
     return 0;
 }
 
+int iter_get_uint16_array (ByteIter * iter, uint16 * vals, int num, int bigendian)
+{
+    return iter_get_ints(iter, vals, num, 2, bigendian);
+}
+
+int iter_get_uint32_array (ByteIter * iter, uint32 * vals, int num, int bigendian)
+{
+    return iter_get_ints(iter, vals, num, 4, bigendian);
+}
+
+int iter_get_uint64_array (ByteIter * iter, uint64 * vals, int num, int bigendian)
+{
+    return iter_get_ints(iter, vals, num, 8, bigendian);
+}
+
+int iter_set_uint16_array (ByteIter * iter, uint16 * vals, int num, int bigendian)
+{
+    return iter_set_ints(iter, vals, num, 2, bigendian);
+}
+
+int iter_set_uint32_array (ByteIter * iter, uint32 * vals, int num, int bigendian)
+{
+    return iter_set_ints(iter, vals, num, 4, bigendian);
+}
+
+int iter_set_uint64_array (ByteIter * iter, uint64 * vals, int num, int bigendian)
+{
+    return iter_set_ints(iter, vals, num, 8, bigendian);
+}
+
 
 /* skip to next, once any char of the given char array is encountered, stop skipping*/
 int iter_skipTo (ByteIter * iter, uint8 * chs, int charnum) 
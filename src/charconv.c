@@ -0,0 +1,799 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "strutil.h"
+#include "frame.h"
+#include "charset.h"
+#include "charconv.h"
+
+#ifdef UNIX
+
+#include <iconv.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define CC_OTHER     0
+#define CC_UTF8      1
+#define CC_GBK       2
+#define CC_GB2312    3
+#define CC_GB18030   4
+#define CC_BIG5      5
+
+#define CC_COPY      0
+#define CC_DECODE    1    //table charset to UTF-8
+#define CC_ENCODE    2    //UTF-8 to table charset
+#define CC_ICONV     3
+
+/* the longest incomplete char kept between calls */
+#define CC_PEND_MAX  8
+
+/* 2-byte codes of lead 0x81-0xFE and trail 0x40-0xFE */
+#define CC_DEC_NUM   (126 * 191)
+
+/* 4-byte GB18030 codes of linear index below are mapped to BMP by table,
+ * those from CC_GB4_SUPP on are U+10000 onward in order */
+#define CC_GB4_BMP   39420
+#define CC_GB4_SUPP  189000
+
+#define CC_BIG_MAX   16
+
+typedef struct cc_table_s {
+    uint16     dec1[128];         //single byte 0x80-0xFF to code point, such as 0x80 of GBK
+    uint16     dec[CC_DEC_NUM];   //2-byte code to BMP code point, 0 if unmapped
+    uint16     enc[65536];        //BMP code point to 2-byte code, or single byte if < 0x100
+
+    uint16   * dec4;              //GB18030 4-byte linear index to BMP code point
+    uint16   * enc4;              //BMP code point to linear index + 1
+
+    int        bignum;            //2-byte codes beyond BMP, marked 0xFFFF in dec
+    uint16     bigcode[CC_BIG_MAX];
+    uint32     bigcp[CC_BIG_MAX];
+} CCTable;
+
+/* tables of GBK, GB2312, GB18030 and BIG5, built once and kept by process */
+static CCTable * cc_tables[4];
+
+typedef struct char_conv_s {
+    char       src[32];
+    char       dst[32];
+
+    int        mode;
+    CCTable  * tab;
+    iconv_t    hconv;
+
+    int        pendlen;
+    uint8      pend[CC_PEND_MAX];
+} CharConv;
+
+
+static int cc_chset_id (char * name)
+{
+    if (!str_casecmp(name, "UTF-8") || !str_casecmp(name, "UTF8")) return CC_UTF8;
+    if (!str_casecmp(name, "GBK") || !str_casecmp(name, "CP936")) return CC_GBK;
+    if (!str_casecmp(name, "GB2312") || !str_casecmp(name, "EUC-CN")) return CC_GB2312;
+    if (!str_casecmp(name, "GB18030")) return CC_GB18030;
+    if (!str_casecmp(name, "BIG5") || !str_casecmp(name, "BIG-5")) return CC_BIG5;
+
+    return CC_OTHER;
+}
+
+/* the single code point of the char converted by iconv, 0 if unmapped */
+static uint32 cc_iconv_cp (iconv_t hconv, uint8 * in, int len)
+{
+    char   * pin = (char *)in;
+    size_t   inlen = len;
+    uint8    out[8];
+    char   * pout = (char *)out;
+    size_t   outlen = sizeof(out);
+
+    iconv(hconv, NULL, NULL, NULL, NULL);
+
+    if (iconv(hconv, &pin, &inlen, &pout, &outlen) == (size_t)-1) return 0;
+    if (inlen != 0 || outlen != sizeof(out) - 4) return 0;
+
+    return out[0] | (out[1] << 8) | (out[2] << 16) | ((uint32)out[3] << 24);
+}
+
+/* the code of cp converted by iconv into code, return its bytes or 0 */
+static int cc_iconv_code (iconv_t hconv, uint32 cp, uint8 * code)
+{
+    uint8    in[4];
+    char   * pin = (char *)in;
+    size_t   inlen = 4;
+    char   * pout = (char *)code;
+    size_t   outlen = 4;
+
+    in[0] = cp; in[1] = cp >> 8; in[2] = cp >> 16; in[3] = cp >> 24;
+
+    iconv(hconv, NULL, NULL, NULL, NULL);
+
+    if (iconv(hconv, &pin, &inlen, &pout, &outlen) == (size_t)-1) return 0;
+    if (inlen != 0) return 0;
+
+    return 4 - outlen;
+}
+
+static void cc_table_free (CCTable * tab)
+{
+    if (!tab) return;
+
+    if (tab->dec4) kfree(tab->dec4);
+    if (tab->enc4) kfree(tab->enc4);
+
+    kfree(tab);
+}
+
+/* decode every code by iconv, then encode every BMP code point back, so
+ * that the code point of many codes is encoded the same as iconv does */
+static CCTable * cc_table_build (char * name, int gb18030)
+{
+    CCTable  * tab = NULL;
+    iconv_t    hdec, henc;
+    uint8      code[4];
+    uint32     cp, lin;
+    int        i, n;
+
+    hdec = iconv_open("UTF-32LE", name);
+    if (hdec == (iconv_t)-1) return NULL;
+
+    henc = iconv_open(name, "UTF-32LE");
+    if (henc == (iconv_t)-1) {
+        iconv_close(hdec);
+        return NULL;
+    }
+
+    tab = kzalloc(sizeof(*tab));
+    if (tab && gb18030) {
+        tab->dec4 = kzalloc(sizeof(uint16) * CC_GB4_BMP);
+        tab->enc4 = kzalloc(sizeof(uint16) * 65536);
+    }
+    if (!tab || (gb18030 && (!tab->dec4 || !tab->enc4))) {
+        cc_table_free(tab);
+        iconv_close(hdec);
+        iconv_close(henc);
+        return NULL;
+    }
+
+    for (i = 0; i < 128; i++) {
+        code[0] = 0x80 + i;
+
+        cp = cc_iconv_cp(hdec, code, 1);
+        if (cp > 0 && cp <= 0xFFFF) tab->dec1[i] = cp;
+    }
+
+    for (i = 0; i < CC_DEC_NUM; i++) {
+        code[0] = 0x81 + i / 191;
+        code[1] = 0x40 + i % 191;
+
+        cp = cc_iconv_cp(hdec, code, 2);
+        if (cp == 0) continue;
+
+        if (cp <= 0xFFFF) {
+            tab->dec[i] = cp;
+
+        } else if (tab->bignum < CC_BIG_MAX) {
+            /* a few 2-byte codes of GB18030 are beyond BMP */
+            tab->dec[i] = 0xFFFF;
+            tab->bigcode[tab->bignum] = (code[0] << 8) | code[1];
+            tab->bigcp[tab->bignum++] = cp;
+        }
+    }
+
+    for (lin = 0; gb18030 && lin < CC_GB4_BMP; lin++) {
+        code[0] = 0x81 + lin / 12600;
+        code[1] = 0x30 + lin / 1260 % 10;
+        code[2] = 0x81 + lin / 10 % 126;
+        code[3] = 0x30 + lin % 10;
+
+        cp = cc_iconv_cp(hdec, code, 4);
+        if (cp > 0 && cp <= 0xFFFF) tab->dec4[lin] = cp;
+    }
+
+    for (cp = 0x80; cp < 0x10000; cp++) {
+        if (cp >= 0xD800 && cp < 0xE000) continue;
+
+        n = cc_iconv_code(henc, cp, code);
+
+        if (n == 1 && code[0] >= 0x80) {
+            tab->enc[cp] = code[0];
+
+        } else if (n == 2 && code[0] >= 0x81) {
+            tab->enc[cp] = (code[0] << 8) | code[1];
+
+        } else if (n == 4 && gb18030) {
+            lin = (((code[0] - 0x81) * 10 + code[1] - 0x30) * 126 + code[2] - 0x81) * 10 + code[3] - 0x30;
+            if (lin < CC_GB4_BMP) tab->enc4[cp] = lin + 1;
+        }
+    }
+
+    iconv_close(hdec);
+    iconv_close(henc);
+
+    return tab;
+}
+
+static CCTable * cc_table_get (int chset)
+{
+    CCTable  * tab = NULL;
+    CCTable  * old = NULL;
+    static char * names[4] = { "GBK", "GB2312", "GB18030", "BIG5" };
+    int        ind = 0;
+
+    switch (chset) {
+    case CC_GBK:     ind = 0; break;
+    case CC_GB2312:  ind = 1; break;
+    case CC_GB18030: ind = 2; break;
+    case CC_BIG5:    ind = 3; break;
+    default:         return NULL;
+    }
+
+    tab = __atomic_load_n(&cc_tables[ind], __ATOMIC_ACQUIRE);
+    if (tab) return tab;
+
+    /* threads racing on the first use build their own, one of them wins */
+    tab = cc_table_build(names[ind], chset == CC_GB18030);
+    if (!tab) return NULL;
+
+    if (!__atomic_compare_exchange_n(&cc_tables[ind], &old, tab, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        cc_table_free(tab);
+        tab = old;
+    }
+
+    return tab;
+}
+
+
+static int cc_utf8_put (uint8 * out, uint32 cp)
+{
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/* the strict UTF-8 char at p, return its bytes, 0 if incomplete, or -1
+ * if invalid */
+static int cc_utf8_get (uint8 * p, int len, uint32 * pcp)
+{
+    uint8   c = p[0];
+    uint8   lo = 0x80, hi = 0xBF;
+    uint32  cp = 0;
+    int     n, i;
+
+    if (c < 0x80) {
+        *pcp = c;
+        return 1;
+    }
+
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2; cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3; cp = c & 0x0F;
+        if (c == 0xE0) lo = 0xA0;
+        else if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4; cp = c & 0x07;
+        if (c == 0xF0) lo = 0x90;
+        else if (c == 0xF4) hi = 0x8F;
+    } else return -1;
+
+    for (i = 1; i < n && i < len; i++) {
+        if (p[i] < lo || p[i] > hi) return -1;
+        lo = 0x80; hi = 0xBF;
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+
+    if (i < n) return 0;
+
+    *pcp = cp;
+    return n;
+}
+
+/* one char of GBK, GB18030 or BIG5 to UTF-8. return the bytes taken and
+ * the output in out, or 0 if incomplete. the invalid or unmapped byte is
+ * taken as itself */
+static int cc_decode_step (CharConv * cc, uint8 * p, int len, uint8 * out, int * outlen)
+{
+    CCTable * tab = cc->tab;
+    uint32    cp = 0, lin = 0;
+    uint8     c = p[0];
+    int       i;
+
+    out[0] = c;
+    *outlen = 1;
+
+    if (c >= 0x80 && tab->dec1[c - 0x80]) {
+        *outlen = cc_utf8_put(out, tab->dec1[c - 0x80]);
+        return 1;
+    }
+
+    if (c < 0x81 || c == 0xFF) return 1;
+    if (len < 2) return 0;
+
+    if (p[1] >= 0x40 && p[1] <= 0xFE) {
+        cp = tab->dec[(c - 0x81) * 191 + p[1] - 0x40];
+        if (cp == 0) return 1;
+
+        if (cp == 0xFFFF) {
+            for (i = 0; i < tab->bignum; i++) {
+                if (tab->bigcode[i] == ((c << 8) | p[1])) break;
+            }
+            if (i >= tab->bignum) return 1;
+            cp = tab->bigcp[i];
+        }
+
+        *outlen = cc_utf8_put(out, cp);
+        return 2;
+    }
+
+    if (!tab->dec4 || p[1] < 0x30 || p[1] > 0x39) return 1;
+
+    if (len < 3) return 0;
+    if (p[2] < 0x81 || p[2] == 0xFF) return 1;
+    if (len < 4) return 0;
+    if (p[3] < 0x30 || p[3] > 0x39) return 1;
+
+    lin = (((c - 0x81) * 10 + p[1] - 0x30) * 126 + p[2] - 0x81) * 10 + p[3] - 0x30;
+
+    if (lin < CC_GB4_BMP) cp = tab->dec4[lin];
+    else if (lin >= CC_GB4_SUPP && lin < CC_GB4_SUPP + 0x100000)
+        cp = lin - CC_GB4_SUPP + 0x10000;
+    if (cp == 0) return 1;
+
+    *outlen = cc_utf8_put(out, cp);
+    return 4;
+}
+
+/* one UTF-8 char to GBK, GB18030 or BIG5. the unmapped char is copied
+ * through as its UTF-8 bytes */
+static int cc_encode_step (CharConv * cc, uint8 * p, int len, uint8 * out, int * outlen)
+{
+    CCTable * tab = cc->tab;
+    uint32    cp = 0, lin = 0;
+    int       n, i;
+
+    n = cc_utf8_get(p, len, &cp);
+    if (n == 0) return 0;
+
+    if (n < 0) {
+        out[0] = p[0];
+        *outlen = 1;
+        return 1;
+    }
+
+    if (cp < 0x10000 && tab->enc[cp] && tab->enc[cp] < 0x100) {
+        out[0] = tab->enc[cp];
+        *outlen = 1;
+        return n;
+    }
+
+    if (cp < 0x10000 && tab->enc[cp]) {
+        out[0] = tab->enc[cp] >> 8;
+        out[1] = tab->enc[cp] & 0xFF;
+        *outlen = 2;
+        return n;
+    }
+
+    for (i = 0; cp >= 0x10000 && i < tab->bignum; i++) {
+        if (tab->bigcp[i] == cp) {
+            out[0] = tab->bigcode[i] >> 8;
+            out[1] = tab->bigcode[i] & 0xFF;
+            *outlen = 2;
+            return n;
+        }
+    }
+
+    if (tab->enc4 && (cp >= 0x10000 || tab->enc4[cp])) {
+        lin = cp >= 0x10000 ? cp - 0x10000 + CC_GB4_SUPP : tab->enc4[cp] - 1u;
+
+        out[3] = 0x30 + lin % 10;  lin /= 10;
+        out[2] = 0x81 + lin % 126; lin /= 126;
+        out[1] = 0x30 + lin % 10;  lin /= 10;
+        out[0] = 0x81 + lin;
+        *outlen = 4;
+        return n;
+    }
+
+    memcpy(out, p, n);
+    *outlen = n;
+    return n;
+}
+
+static int cc_table_loop (CharConv * cc, uint8 * in, int inlen, uint8 * out, int room,
+                          int * outlen, int last, int * full)
+{
+    uint16 * dec = cc->tab->dec;
+    uint8    ch[8];
+    uint8  * pout = NULL;
+    uint32   cp;
+    int      i = 0, w = 0;
+    int      n, olen;
+
+    *full = 0;
+
+    while (i < inlen) {
+        /* the ASCII runs are the same in all the table charsets */
+        if (in[i] < 0x80) {
+            if (i + 1 < inlen && in[i + 1] < 0x80)
+                n = coding_ascii_span(in + i, inlen - i);
+            else
+                n = 1;
+
+            if (n > room - w) {
+                n = room - w;
+                *full = 1;
+            }
+
+            memcpy(out + w, in + i, n);
+            w += n; i += n;
+
+            if (*full) break;
+            continue;
+        }
+
+        /* the char is converted in place while there is room for the longest */
+        pout = room - w >= 4 ? out + w : ch;
+
+        if (cc->mode == CC_DECODE) {
+            /* the common 2-byte code is looked up here */
+            if (in[i] >= 0x81 && in[i] < 0xFF && i + 1 < inlen &&
+                in[i + 1] >= 0x40 && in[i + 1] < 0xFF &&
+                (cp = dec[(in[i] - 0x81) * 191 + in[i + 1] - 0x40]) != 0 && cp != 0xFFFF)
+            {
+                n = 2;
+                olen = cc_utf8_put(pout, cp);
+            } else
+                n = cc_decode_step(cc, in + i, inlen - i, pout, &olen);
+        } else
+            n = cc_encode_step(cc, in + i, inlen - i, pout, &olen);
+
+        if (n == 0) {
+            /* the incomplete tail is left to the caller */
+            if (!last) break;
+
+            pout[0] = in[i];
+            n = olen = 1;
+        }
+
+        if (pout == ch) {
+            if (w + olen > room) {
+                *full = 1;
+                break;
+            }
+            memcpy(out + w, ch, olen);
+        }
+
+        w += olen; i += n;
+    }
+
+    *outlen = w;
+    return i;
+}
+
+static int cc_iconv_loop (CharConv * cc, uint8 * in, int inlen, uint8 * out, int room,
+                          int * outlen, int last, int * full)
+{
+    char   * pin = (char *)in;
+    size_t   inleft = inlen;
+    char   * pout = (char *)out;
+    size_t   outleft = room;
+
+    *full = 0;
+
+    while (inleft > 0) {
+        if (iconv(cc->hconv, &pin, &inleft, &pout, &outleft) != (size_t)-1)
+            break;
+
+        if (errno == E2BIG) {
+            *full = 1;
+            break;
+        }
+
+        /* the incomplete tail is left to the caller */
+        if (errno == EINVAL && !last && inleft <= CC_PEND_MAX) break;
+
+        /* the invalid byte is copied through */
+        if (outleft == 0) {
+            *full = 1;
+            break;
+        }
+        *pout++ = *pin++;
+        inleft--; outleft--;
+    }
+
+    /* the shift sequence back to the initial state */
+    if (last && !*full && inleft == 0) {
+        if (iconv(cc->hconv, NULL, NULL, &pout, &outleft) == (size_t)-1 && errno == E2BIG)
+            *full = 1;
+    }
+
+    *outlen = room - outleft;
+    return inlen - inleft;
+}
+
+static int cc_loop (CharConv * cc, uint8 * in, int inlen, uint8 * out, int room,
+                    int * outlen, int last, int * full)
+{
+    int  n;
+
+    switch (cc->mode) {
+    case CC_DECODE:
+    case CC_ENCODE:
+        return cc_table_loop(cc, in, inlen, out, room, outlen, last, full);
+
+    case CC_ICONV:
+        return cc_iconv_loop(cc, in, inlen, out, room, outlen, last, full);
+
+    default:
+        n = inlen < room ? inlen : room;
+        memcpy(out, in, n);
+        *outlen = n;
+        *full = n < inlen;
+        return n;
+    }
+}
+
+
+void * charconv_open (char * srcchset, char * dstchset)
+{
+    CharConv * cc = NULL;
+    int        src, dst;
+
+    if (!srcchset || !dstchset) return NULL;
+    if (str_len(srcchset) >= sizeof(cc->src) || str_len(dstchset) >= sizeof(cc->dst))
+        return NULL;
+
+    cc = kzalloc(sizeof(*cc));
+    if (!cc) return NULL;
+
+    str_cpy(cc->src, srcchset);
+    str_cpy(cc->dst, dstchset);
+    cc->hconv = (iconv_t)-1;
+
+    src = cc_chset_id(srcchset);
+    dst = cc_chset_id(dstchset);
+
+    if (src != CC_OTHER && src == dst) {
+        cc->mode = CC_COPY;
+        return cc;
+    }
+
+    if (dst == CC_UTF8 && src != CC_OTHER && src != CC_UTF8) {
+        cc->tab = cc_table_get(src);
+        cc->mode = CC_DECODE;
+
+    } else if (src == CC_UTF8 && dst != CC_OTHER) {
+        cc->tab = cc_table_get(dst);
+        cc->mode = CC_ENCODE;
+    }
+
+    if (cc->tab) return cc;
+
+    cc->mode = CC_ICONV;
+    cc->hconv = iconv_open(dstchset, srcchset);
+    if (cc->hconv == (iconv_t)-1) {
+        kfree(cc);
+        return NULL;
+    }
+
+    return cc;
+}
+
+void charconv_close (void * vconv)
+{
+    CharConv * cc = (CharConv *)vconv;
+
+    if (!cc) return;
+
+    if (cc->hconv != (iconv_t)-1) iconv_close(cc->hconv);
+
+    kfree(cc);
+}
+
+void charconv_reset (void * vconv)
+{
+    CharConv * cc = (CharConv *)vconv;
+
+    if (!cc) return;
+
+    cc->pendlen = 0;
+
+    if (cc->hconv != (iconv_t)-1)
+        iconv(cc->hconv, NULL, NULL, NULL, NULL);
+}
+
+
+typedef struct cc_cache_s {
+    CharConv * conv[CHARCONV_CACHE];
+    int        next;
+} CCCache;
+
+static pthread_once_t  cc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   cc_key;
+static int             cc_keyok = 0;
+
+static void cc_cache_free (void * vcache)
+{
+    CCCache * cache = (CCCache *)vcache;
+    int       i;
+
+    if (!cache) return;
+
+    for (i = 0; i < CHARCONV_CACHE; i++)
+        charconv_close(cache->conv[i]);
+
+    kfree(cache);
+}
+
+static void cc_key_init ()
+{
+    if (pthread_key_create(&cc_key, cc_cache_free) == 0)
+        cc_keyok = 1;
+}
+
+void * charconv_get (char * srcchset, char * dstchset)
+{
+    CCCache  * cache = NULL;
+    CharConv * cc = NULL;
+    int        i;
+
+    if (!srcchset || !dstchset) return NULL;
+
+    pthread_once(&cc_once, cc_key_init);
+    if (!cc_keyok) return NULL;
+
+    cache = pthread_getspecific(cc_key);
+    if (!cache) {
+        cache = kzalloc(sizeof(*cache));
+        if (!cache) return NULL;
+
+        if (pthread_setspecific(cc_key, cache) != 0) {
+            kfree(cache);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < CHARCONV_CACHE; i++) {
+        cc = cache->conv[i];
+
+        if (cc && str_casecmp(cc->src, srcchset) == 0 &&
+                  str_casecmp(cc->dst, dstchset) == 0) {
+            charconv_reset(cc);
+            return cc;
+        }
+    }
+
+    cc = charconv_open(srcchset, dstchset);
+    if (!cc) return NULL;
+
+    /* the slots are replaced round robin */
+    charconv_close(cache->conv[cache->next]);
+    cache->conv[cache->next] = cc;
+    cache->next = (cache->next + 1) % CHARCONV_CACHE;
+
+    return cc;
+}
+
+
+int charconv_run (void * vconv, void * psrc, int srclen, void * pdst, int * dstlen, int last)
+{
+    CharConv * cc = (CharConv *)vconv;
+    uint8    * src = (uint8 *)psrc;
+    uint8    * dst = (uint8 *)pdst;
+    uint8      tmp[CC_PEND_MAX * 2];
+    int        i = 0, w = 0, room = 0;
+    int        n, k, tl, olen, full = 0;
+
+    if (!cc || !dstlen) return -1;
+    if (srclen < 0 || (srclen > 0 && !src)) return -2;
+
+    room = *dstlen;
+    if (!dst || room < 0) room = 0;
+
+    /* the kept bytes are completed with the head of input */
+    if (cc->pendlen > 0) {
+        k = srclen < CC_PEND_MAX ? srclen : CC_PEND_MAX;
+
+        memcpy(tmp, cc->pend, cc->pendlen);
+        if (k > 0) memcpy(tmp + cc->pendlen, src, k);
+        tl = cc->pendlen + k;
+
+        n = cc_loop(cc, tmp, tl, dst, room, &w, k == srclen ? last : 0, &full);
+
+        if (n < cc->pendlen) {
+            if (full) {
+                cc->pendlen -= n;
+                memmove(cc->pend, cc->pend + n, cc->pendlen);
+                *dstlen = w;
+                return 0;
+            }
+
+            /* the input ends within the kept char */
+            cc->pendlen = tl - n;
+            memmove(cc->pend, tmp + n, cc->pendlen);
+            *dstlen = w;
+            return srclen;
+        }
+
+        i = n - cc->pendlen;
+        cc->pendlen = 0;
+
+        if (full) {
+            *dstlen = w;
+            return i;
+        }
+    }
+
+    if (i < srclen) {
+        n = cc_loop(cc, src + i, srclen - i, dst + w, room - w, &olen, last, &full);
+        w += olen;
+        i += n;
+
+        if (i < srclen && !full) {
+            /* keep the incomplete char at the end */
+            cc->pendlen = srclen - i;
+            memcpy(cc->pend, src + i, cc->pendlen);
+            i = srclen;
+        }
+    }
+
+    *dstlen = w;
+    return i;
+}
+
+int charconv_frame (void * vconv, void * psrc, int srclen, frame_p dst, int last)
+{
+    CharConv * cc = (CharConv *)vconv;
+    uint8    * src = (uint8 *)psrc;
+    int        need, room, n;
+    int        total = 0;
+
+    if (!cc || !dst) return -1;
+    if (srclen < 0 || (srclen > 0 && !src)) return -2;
+
+    if (frame_unshare(dst) < 0) return -100;
+
+    do {
+        /* the room is grown again if the output runs over the guess */
+        need = srclen / 2 * 3 + CC_PEND_MAX * 4 + 16;
+        if (frame_rest(dst) < need)
+            frame_grow(dst, need - frame_rest(dst));
+        if (frame_rest(dst) < need) return total > 0 ? total : -100;
+
+        room = frame_rest(dst);
+        n = charconv_run(cc, src, srclen, frame_end(dst), &room, last);
+        if (n < 0) return total > 0 ? total : n;
+
+        frame_len_add(dst, room);
+        total += room;
+        src += n; srclen -= n;
+
+    } while (srclen > 0 || (last && cc->pendlen > 0));
+
+    return total;
+}
+
+#endif
+
@@ -9,6 +9,14 @@
 #include "frame.h"
 #include "charset.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define CHARSET_X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define CHARSET_NEON 1
+#include <arm_neon.h>
+#endif
+
 static uint8 big5_first[100];
 static uint8 big5_range[8][10] = {
     { 0x40, 0x7E, 0xA1, 0xFE, 0 },
@@ -28,6 +36,30 @@ static uint8 big5_second_init = 0;
 static uint8 gb2312_second[9][100];
 static uint8 gb2312_second_init = 0;
 
+/* the class of bytes in GBK and GB18030 */
+#define GB_LEAD   0x01   //0x81-0xFE
+#define GB_TRAIL  0x02   //0x40-0x7E, 0x80-0xFE
+#define GB_DIGIT  0x04   //0x30-0x39, 2nd and 4th byte of 4-byte GB18030
+
+static const uint8 gb_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 00-0F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 10-1F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 20-2F */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0,  /* 30-3F */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 40-4F */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 50-5F */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 60-6F */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0,  /* 70-7F */
+    2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* 80-8F */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* 90-9F */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* A0-AF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* B0-BF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* C0-CF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* D0-DF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* E0-EF */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0,  /* F0-FF */
+};
+
 
 typedef int CharCheck (void * p, int len);
 
@@ -200,9 +232,8 @@ int coding_gbk_check (void * p, int len)
 
     if (!pbyte || len < 2) return 0;
 
-    if (pbyte[0] < 0x81 || pbyte[0] == 0xFF) return 0;
-    if (pbyte[1] < 0x40 || pbyte[1] == 0xFF) return 0;
-    if (pbyte[1] == 0x7F) return 0;
+    if (!(gb_class[pbyte[0]] & GB_LEAD) || !(gb_class[pbyte[1]] & GB_TRAIL))
+        return 0;
 
     return 2;
 }
@@ -213,10 +244,8 @@ int coding_gb18030_check (void * p, int len)
 
     if (!pbyte || len < 4) return 0;
 
-    if (pbyte[0] < 0x81 || pbyte[0] == 0xFF) return 0;
-    if (pbyte[1] < 0x30 || pbyte[1] > 0x39) return 0;
-    if (pbyte[2] < 0x81 || pbyte[2] == 0xFF) return 0;
-    if (pbyte[3] < 0x30 || pbyte[3] > 0x39) return 0;
+    if (!(gb_class[pbyte[0]] & GB_LEAD) || !(gb_class[pbyte[1]] & GB_DIGIT)) return 0;
+    if (!(gb_class[pbyte[2]] & GB_LEAD) || !(gb_class[pbyte[3]] & GB_DIGIT)) return 0;
 
     return 4;
 }
@@ -234,10 +263,10 @@ int coding_utf8_check (void * p, int len)
     if (pbyte[0] < 0xC0 || pbyte[0] > 0xFD)
         return 0;
 
-    if (pbyte[0] > 0xFC) count = 5;
-    else if (pbyte[0] > 0xF8) count = 4;
-    else if (pbyte[0] > 0xF0) count = 3;
-    else if (pbyte[0] > 0xE0) count = 2;
+    if (pbyte[0] >= 0xFC) count = 5;
+    else if (pbyte[0] >= 0xF8) count = 4;
+    else if (pbyte[0] >= 0xF0) count = 3;
+    else if (pbyte[0] >= 0xE0) count = 2;
     else count = 1;
 
     if (count + 1 > len) return 0;
@@ -250,6 +279,388 @@ int coding_utf8_check (void * p, int len)
     return count + 1;
 }
 
+/* the validators below return the length of the longest valid prefix, the
+ * whole len if all valid, so the callers find where the bad bytes are.
+ * the runs of ASCII are skipped a block at a time */
+
+int coding_ascii_span (void * pbyte, int len)
+{
+    uint8  * p = (uint8 *)pbyte;
+    int      i = 0;
+
+    if (!p || len <= 0) return 0;
+
+#if defined(__AVX2__)
+    for ( ; i + 32 <= len; i += 32) {
+        int m = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(p + i)));
+        if (m) return i + __builtin_ctz(m);
+    }
+#elif defined(__SSE2__)
+    for ( ; i + 16 <= len; i += 16) {
+        int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (m) return i + __builtin_ctz(m);
+    }
+#elif defined(CHARSET_NEON)
+    for ( ; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(p + i)) >= 0x80) break;
+    }
+#endif
+
+    for ( ; i < len && p[i] < 0x80; i++);
+
+    return i;
+}
+
+/* strict UTF-8 of RFC 3629: no overlong forms, no surrogates, no value
+ * beyond U+10FFFF */
+static int utf8_valid_scalar (uint8 * p, int len)
+{
+    int    i = 0, n = 0, k;
+    uint8  lo = 0x80, hi = 0xBF;
+
+    while (i < len) {
+        if (p[i] < 0x80) {
+            i += coding_ascii_span(p + i, len - i);
+            continue;
+        }
+
+        lo = 0x80; hi = 0xBF;
+
+        if (p[i] >= 0xC2 && p[i] <= 0xDF) n = 1;
+        else if (p[i] >= 0xE0 && p[i] <= 0xEF) {
+            n = 2;
+            if (p[i] == 0xE0) lo = 0xA0;
+            else if (p[i] == 0xED) hi = 0x9F;
+        } else if (p[i] >= 0xF0 && p[i] <= 0xF4) {
+            n = 3;
+            if (p[i] == 0xF0) lo = 0x90;
+            else if (p[i] == 0xF4) hi = 0x8F;
+        } else return i;
+
+        if (i + n >= len) return i;
+
+        if (p[i+1] < lo || p[i+1] > hi) return i;
+        for (k = 2; k <= n; k++) {
+            if (p[i+k] < 0x80 || p[i+k] > 0xBF) return i;
+        }
+
+        i += n + 1;
+    }
+
+    return len;
+}
+
+/* the vector kernels follow the lookup scheme of Keiser and Lemire. the
+ * high and low nibbles of each byte and the high nibble of its next byte
+ * pick 3 sets of error flags out of the tables, the byte pair is bad if a
+ * flag is in all 3 sets. the continuations due after 3- and 4-byte leads
+ * are told from those of the flags. the kernels return where the whole
+ * blocks end or at the block where an error or the incomplete char shows
+ * up, and the exact position is located by the scalar loop */
+
+#define U8_TOO_SHORT      (1 << 0)  /* lead followed by no continuation */
+#define U8_TOO_LONG       (1 << 1)  /* ASCII followed by continuation */
+#define U8_OVERLONG_3     (1 << 2)
+#define U8_TOO_LARGE      (1 << 3)
+#define U8_SURROGATE      (1 << 4)
+#define U8_OVERLONG_2     (1 << 5)
+#define U8_TOO_LARGE_1000 (1 << 6)
+#define U8_OVERLONG_4     (1 << 6)
+#define U8_TWO_CONTS      (1 << 7)
+#define U8_CARRY          (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#if defined(CHARSET_X86_DISPATCH) || defined(CHARSET_NEON)
+
+static const uint8 u8_byte1_high[16] = {
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+    U8_TOO_SHORT | U8_OVERLONG_2,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+};
+
+static const uint8 u8_byte1_low[16] = {
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+    U8_CARRY | U8_OVERLONG_2,
+    U8_CARRY,
+    U8_CARRY,
+    U8_CARRY | U8_TOO_LARGE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+};
+
+static const uint8 u8_byte2_high[16] = {
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+};
+
+/* the block ending with these is incomplete if any byte is greater */
+static const uint8 u8_incomplete[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+#endif
+
+#ifdef CHARSET_X86_DISPATCH
+
+#define CHARSET_SCALAR  0
+#define CHARSET_SSSE3   1
+#define CHARSET_AVX2    2
+
+static int charset_level = -1;
+
+static int charset_simd_level ()
+{
+    int  level = __atomic_load_n(&charset_level, __ATOMIC_RELAXED);
+
+    if (level >= 0) return level;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) level = CHARSET_AVX2;
+    else if (__builtin_cpu_supports("ssse3")) level = CHARSET_SSSE3;
+    else level = CHARSET_SCALAR;
+
+    __atomic_store_n(&charset_level, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+__attribute__((target("ssse3")))
+static int utf8_valid_ssse3 (uint8 * p, int len)
+{
+    __m128i  b1high = _mm_loadu_si128((const __m128i *)u8_byte1_high);
+    __m128i  b1low = _mm_loadu_si128((const __m128i *)u8_byte1_low);
+    __m128i  b2high = _mm_loadu_si128((const __m128i *)u8_byte2_high);
+    __m128i  incmax = _mm_loadu_si128((const __m128i *)(u8_incomplete + 16));
+    __m128i  nib = _mm_set1_epi8(0x0F);
+    __m128i  zero = _mm_setzero_si128();
+    __m128i  prev = zero, previnc = zero;
+    __m128i  v, prev1, sc, must23;
+    int      i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+
+        if (_mm_movemask_epi8(v) == 0) {
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(previnc, zero)) != 0xFFFF) return i;
+            prev = v;
+            previnc = zero;
+            continue;
+        }
+
+        prev1 = _mm_alignr_epi8(v, prev, 15);
+
+        sc = _mm_and_si128(_mm_shuffle_epi8(b1high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+                           _mm_shuffle_epi8(b1low, _mm_and_si128(prev1, nib)));
+        sc = _mm_and_si128(sc, _mm_shuffle_epi8(b2high, _mm_and_si128(_mm_srli_epi16(v, 4), nib)));
+
+        must23 = _mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(v, prev, 14), _mm_set1_epi8((char)(0xE0 - 0x80))),
+                              _mm_subs_epu8(_mm_alignr_epi8(v, prev, 13), _mm_set1_epi8((char)(0xF0 - 0x80))));
+        must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_xor_si128(must23, sc), zero)) != 0xFFFF)
+            return i;
+
+        previnc = _mm_subs_epu8(v, incmax);
+        prev = v;
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int utf8_valid_avx2 (uint8 * p, int len)
+{
+    __m256i  b1high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte1_high));
+    __m256i  b1low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte1_low));
+    __m256i  b2high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte2_high));
+    __m256i  incmax = _mm256_loadu_si256((const __m256i *)u8_incomplete);
+    __m256i  nib = _mm256_set1_epi8(0x0F);
+    __m256i  zero = _mm256_setzero_si256();
+    __m256i  prev = zero, previnc = zero;
+    __m256i  v, cross, prev1, sc, must23;
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+
+        if (_mm256_movemask_epi8(v) == 0) {
+            if (!_mm256_testz_si256(previnc, previnc)) return i;
+            prev = v;
+            previnc = zero;
+            continue;
+        }
+
+        /* the bytes before each lane: the high lane of prev, the low lane of v */
+        cross = _mm256_permute2x128_si256(prev, v, 0x21);
+        prev1 = _mm256_alignr_epi8(v, cross, 15);
+
+        sc = _mm256_and_si256(_mm256_shuffle_epi8(b1high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+                              _mm256_shuffle_epi8(b1low, _mm256_and_si256(prev1, nib)));
+        sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(b2high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+
+        must23 = _mm256_or_si256(_mm256_subs_epu8(_mm256_alignr_epi8(v, cross, 14), _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                 _mm256_subs_epu8(_mm256_alignr_epi8(v, cross, 13), _mm256_set1_epi8((char)(0xF0 - 0x80))));
+        must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+
+        sc = _mm256_xor_si256(must23, sc);
+        if (!_mm256_testz_si256(sc, sc)) return i;
+
+        previnc = _mm256_subs_epu8(v, incmax);
+        prev = v;
+    }
+
+    return i;
+}
+
+static int utf8_valid_vector (uint8 * p, int len)
+{
+    int  level = charset_simd_level();
+
+    if (level >= CHARSET_AVX2) return utf8_valid_avx2(p, len);
+    if (level >= CHARSET_SSSE3) return utf8_valid_ssse3(p, len);
+
+    return 0;
+}
+
+#elif defined(CHARSET_NEON)
+
+static int utf8_valid_vector (uint8 * p, int len)
+{
+    uint8x16_t  b1high = vld1q_u8(u8_byte1_high);
+    uint8x16_t  b1low = vld1q_u8(u8_byte1_low);
+    uint8x16_t  b2high = vld1q_u8(u8_byte2_high);
+    uint8x16_t  incmax = vld1q_u8(u8_incomplete + 16);
+    uint8x16_t  nib = vdupq_n_u8(0x0F);
+    uint8x16_t  prev = vdupq_n_u8(0), previnc = vdupq_n_u8(0);
+    uint8x16_t  v, prev1, sc, must23;
+    int         i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = vld1q_u8(p + i);
+
+        if (vmaxvq_u8(v) < 0x80) {
+            if (vmaxvq_u8(previnc)) return i;
+            prev = v;
+            previnc = vdupq_n_u8(0);
+            continue;
+        }
+
+        prev1 = vextq_u8(prev, v, 15);
+
+        sc = vandq_u8(vqtbl1q_u8(b1high, vshrq_n_u8(prev1, 4)), vqtbl1q_u8(b1low, vandq_u8(prev1, nib)));
+        sc = vandq_u8(sc, vqtbl1q_u8(b2high, vshrq_n_u8(v, 4)));
+
+        must23 = vorrq_u8(vqsubq_u8(vextq_u8(prev, v, 14), vdupq_n_u8(0xE0 - 0x80)),
+                          vqsubq_u8(vextq_u8(prev, v, 13), vdupq_n_u8(0xF0 - 0x80)));
+        must23 = vandq_u8(must23, vdupq_n_u8(0x80));
+
+        if (vmaxvq_u8(veorq_u8(must23, sc))) return i;
+
+        previnc = vqsubq_u8(v, incmax);
+        prev = v;
+    }
+
+    return i;
+}
+
+#else
+#define utf8_valid_vector(p, len)  0
+#endif
+
+int coding_utf8_valid (void * p, int len)
+{
+    uint8 * pbyte = (uint8 *)p;
+    int     i, k;
+
+    if (!pbyte || len <= 0) return 0;
+
+    i = utf8_valid_vector(pbyte, len);
+
+    /* back to the lead of the last char before the block bound, which may
+     * be incomplete. the bytes before the lead are valid */
+    for (k = 0; k < 3 && i > 0 && (pbyte[i-1] & 0xC0) == 0x80; k++) i--;
+    if (i > 0 && pbyte[i-1] >= 0xC0) i--;
+
+    return i + utf8_valid_scalar(pbyte + i, len - i);
+}
+
+
+
+int coding_gbk_valid (void * p, int len)
+{
+    uint8 * pbyte = (uint8 *)p;
+    int     i = 0;
+
+    if (!pbyte || len <= 0) return 0;
+
+    while (i < len) {
+        if (pbyte[i] < 0x80) {
+            i += coding_ascii_span(pbyte + i, len - i);
+            continue;
+        }
+
+        if (i + 1 >= len) return i;
+        if (!(gb_class[pbyte[i]] & GB_LEAD) || !(gb_class[pbyte[i+1]] & GB_TRAIL))
+            return i;
+
+        i += 2;
+    }
+
+    return len;
+}
+
+int coding_gb18030_valid (void * p, int len)
+{
+    uint8 * pbyte = (uint8 *)p;
+    int     i = 0;
+
+    if (!pbyte || len <= 0) return 0;
+
+    while (i < len) {
+        if (pbyte[i] < 0x80) {
+            i += coding_ascii_span(pbyte + i, len - i);
+            continue;
+        }
+
+        if (i + 1 >= len || !(gb_class[pbyte[i]] & GB_LEAD)) return i;
+
+        if (gb_class[pbyte[i+1]] & GB_TRAIL) {
+            i += 2;
+            continue;
+        }
+
+        if (i + 3 >= len) return i;
+        if (!(gb_class[pbyte[i+1]] & GB_DIGIT) || !(gb_class[pbyte[i+2]] & GB_LEAD) ||
+            !(gb_class[pbyte[i+3]] & GB_DIGIT))
+            return i;
+
+        i += 4;
+    }
+
+    return len;
+}
+
 int coding_unknown_check (void * p, int len)
 {
     if (!p || len <= 0) return 0;
@@ -326,6 +737,33 @@ int coding_string_trunc (void * srcstr, int srclen, void * dststr, int dstlen, i
     return num;
 }
 
+/* the valid UTF-8 run at p is taken by the checks of coding_charset_scan
+ * char by char as the validator does, as long as it has no NUL and is not
+ * followed by NUL, which makes the ASCII before it UCS-2. the run is
+ * counted at once, in windows of 4K to bound the NUL search */
+static int coding_utf8_run (uint8 * p, int len, int * hibytes)
+{
+    uint8 * nul = NULL;
+    int     i, n, hi = 0;
+
+    *hibytes = 0;
+
+    n = len < 4096 ? len : 4096;
+
+    nul = memchr(p, 0, n);
+    if (nul) n = nul - p;
+
+    if (n < len && p[n] == 0 && n > 0) n--;
+    if (n <= 0) return 0;
+
+    n = coding_utf8_valid(p, n);
+
+    for (i = 0; i < n; i++) hi += p[i] >> 7;
+
+    *hibytes = hi;
+    return n;
+}
+
 int coding_charset_scan (void * p, int len, int * ascii, int * unicode, int * utf8, 
                   int * gbk, int * gb2312, int * gb18030, int * big5, int * unknown)
 {
@@ -333,6 +771,8 @@ int coding_charset_scan (void * p, int len, int * ascii, int * unicode, int * ut
     int  i = 0;
     int  count = 0;
     int  nullbytes = 0;
+    int  hibytes = 0;
+    int  fastpos = 0;
 
     int  asciibytes = 0;
     int  unicodebytes = 0;
@@ -356,6 +796,22 @@ int coding_charset_scan (void * p, int len, int * ascii, int * unicode, int * ut
     if (!pbyte) return -1;
 
     for (i=0; i<len; ) {
+        /* the valid UTF-8 and ASCII runs skip the checks. after a short
+         * run the texts of other charsets are checked char by char for a
+         * while before trying again */
+        if (i >= fastpos) {
+            count = coding_utf8_run(pbyte + i, len - i, &hibytes);
+            fastpos = i + (count >= 64 ? count : 64);
+
+            if (count > 0) {
+                nullbytes = 0;
+                asciibytes += count - hibytes;
+                utf8bytes += hibytes;
+                i += count;
+                continue;
+            }
+        }
+
         if (pbyte[i] == 0) {
             nullbytes++;
             if (nullbytes > 5) break; //possibly binary stream
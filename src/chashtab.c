@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "epoch.h"
+#include "chashtab.h"
+
+#ifdef UNIX
+#include <sched.h>
+#define cht_yield()   sched_yield()
+#else
+#define cht_yield()   Sleep(0)
+#endif
+
+typedef void ChtFree (void * a);
+
+typedef struct cht_node_s {
+    struct cht_node_s * next;
+    ulong               hash;
+    void              * value;
+} ChtNode;
+
+/* the bucket of old table that has been moved into the new table */
+#define CHT_MOVED  ((ChtNode *)1)
+
+typedef struct cht_table_s {
+    ulong      size;
+    ulong      mask;
+    long       migidx;    //next bucket to move
+    long       moved;     //buckets moved
+    ChtNode  * buckets[1];
+} ChtTable;
+
+typedef struct cht_lock_s {
+    int        lock;
+    uint8      pad[64 - sizeof(int)];
+} ChtLock;
+
+typedef struct chashtab_s {
+    ChtTable   * cur;
+    ChtTable   * next;    //the table being moved into during resize
+
+    long         num;
+    int          load_limit;
+
+    HashFunc   * hashFunc;
+    HashTabCmp * cmp;
+
+    void       * epoch;
+
+    void       * lockmem;
+    ChtLock    * locks;
+} CHashTab;
+
+
+static ulong cht_hash_string (void * key)
+{
+    return string_hash(key, -1, 0);
+}
+
+static void cht_lock (CHashTab * cht, ulong hash)
+{
+    ChtLock * lk = &cht->locks[hash & (CHT_STRIPES - 1)];
+    int       spins = 0;
+
+    while (__atomic_exchange_n(&lk->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lk->lock, __ATOMIC_RELAXED)) {
+            if (++spins > 100) {
+                cht_yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+static void cht_unlock (CHashTab * cht, ulong hash)
+{
+    __atomic_store_n(&cht->locks[hash & (CHT_STRIPES - 1)].lock, 0, __ATOMIC_RELEASE);
+}
+
+static ChtTable * cht_table_alloc (ulong size)
+{
+    ChtTable * tab = NULL;
+
+    tab = kzalloc(sizeof(*tab) + sizeof(ChtNode *) * (size - 1));
+    if (!tab) return NULL;
+
+    tab->size = size;
+    tab->mask = size - 1;
+
+    return tab;
+}
+
+static void cht_kfree (void * p)
+{
+    kfree(p);
+}
+
+static void cht_chain_free (void * vnode)
+{
+    ChtNode * node = (ChtNode *)vnode;
+    ChtNode * next = NULL;
+
+    for ( ; node && node != CHT_MOVED; node = next) {
+        next = node->next;
+        kfree(node);
+    }
+}
+
+void * cht_new (int num, HashTabCmp * cmp)
+{
+    CHashTab * cht = NULL;
+    ulong      size = CHT_STRIPES;
+
+    cht = kzalloc(sizeof(*cht));
+    if (!cht) return NULL;
+
+    while (size < (ulong)num) size <<= 1;
+
+    cht->cur = cht_table_alloc(size);
+    cht->epoch = epoch_new();
+    cht->lockmem = kzalloc(sizeof(ChtLock) * (CHT_STRIPES + 1));
+
+    if (!cht->cur || !cht->epoch || !cht->lockmem) {
+        cht_free(cht);
+        return NULL;
+    }
+
+    cht->locks = (ChtLock *)(((ulong)cht->lockmem + 63) & ~(ulong)63);
+
+    cht->load_limit = CHT_LOAD_LIMIT;
+    cht->hashFunc = cht_hash_string;
+    cht->cmp = cmp;
+
+    return cht;
+}
+
+static void cht_table_free (ChtTable * tab, ChtFree * func)
+{
+    ChtNode * node = NULL;
+    ulong     i;
+
+    if (!tab) return;
+
+    for (i = 0; i < tab->size; i++) {
+        node = tab->buckets[i];
+        if (node == CHT_MOVED) continue;
+
+        if (func) {
+            for ( ; node; node = node->next)
+                (*func)(node->value);
+        }
+        cht_chain_free(tab->buckets[i]);
+    }
+
+    kfree(tab);
+}
+
+void cht_free_all (void * vcht, void * vfunc)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+
+    if (!cht) return;
+
+    cht_table_free(cht->cur, (ChtFree *)vfunc);
+    cht_table_free(cht->next, (ChtFree *)vfunc);
+
+    if (cht->epoch) epoch_free(cht->epoch);
+    if (cht->lockmem) kfree(cht->lockmem);
+
+    kfree(cht);
+}
+
+void cht_free (void * vcht)
+{
+    cht_free_all(vcht, NULL);
+}
+
+void cht_set_hash_func (void * vcht, HashFunc * hashfunc)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+
+    if (!cht) return;
+
+    cht->hashFunc = hashfunc ? hashfunc : cht_hash_string;
+}
+
+void cht_set_load_limit (void * vcht, int percent)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+
+    if (!cht) return;
+
+    if (percent < 0) percent = 0;
+    cht->load_limit = percent;
+}
+
+int cht_num (void * vcht)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+
+    if (!cht) return 0;
+
+    return (int)__atomic_load_n(&cht->num, __ATOMIC_RELAXED);
+}
+
+int cht_len (void * vcht)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    ChtTable * tab = NULL;
+
+    if (!cht) return 0;
+
+    epoch_enter(cht->epoch);
+    tab = __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE);
+    if (!tab) tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+    epoch_leave(cht->epoch);
+
+    return (int)tab->size;
+}
+
+
+/* get the chain head for reading, following the moved bucket into the
+ * new table. must be called in epoch section */
+static ChtNode * cht_read_head (CHashTab * cht, ulong hash)
+{
+    ChtTable * tab = NULL;
+    ChtTable * ntab = NULL;
+    ChtNode  * head = NULL;
+
+    for ( ; ; ) {
+        tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&tab->buckets[hash & tab->mask], __ATOMIC_ACQUIRE);
+        if (head != CHT_MOVED) return head;
+
+        ntab = __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE);
+        if (!ntab || __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE) != tab)
+            continue;
+
+        head = __atomic_load_n(&ntab->buckets[hash & ntab->mask], __ATOMIC_ACQUIRE);
+        if (head != CHT_MOVED) return head;
+    }
+}
+
+/* get the bucket slot for writing, the stripe lock of hash must be held.
+ * the moved buckets of the same stripe can not change while locked */
+static ChtNode ** cht_write_slot (CHashTab * cht, ulong hash)
+{
+    ChtTable * tab = NULL;
+    ChtTable * ntab = NULL;
+    ChtNode ** slot = NULL;
+
+    for ( ; ; ) {
+        tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+        slot = &tab->buckets[hash & tab->mask];
+        if (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != CHT_MOVED)
+            return slot;
+
+        ntab = __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE);
+        if (!ntab || __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE) != tab)
+            continue;
+
+        slot = &ntab->buckets[hash & ntab->mask];
+        if (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != CHT_MOVED)
+            return slot;
+    }
+}
+
+/* copy the chain of bucket idx into the new table, the old nodes are kept
+ * for the readers walking them and freed after the grace period */
+static int cht_migrate_bucket (CHashTab * cht, ChtTable * tab, ChtTable * ntab, ulong idx)
+{
+    ChtNode  * head = NULL;
+    ChtNode  * node = NULL;
+    ChtNode  * copy = NULL;
+    ChtNode  * list = NULL;
+    ChtNode ** slot = NULL;
+
+    head = tab->buckets[idx];
+    if (head == CHT_MOVED) return 0;
+
+    for (node = head; node; node = node->next) {
+        copy = kalloc(sizeof(*copy));
+        if (!copy) {
+            cht_chain_free(list);
+            return -1;
+        }
+        copy->hash = node->hash;
+        copy->value = __atomic_load_n(&node->value, __ATOMIC_RELAXED);
+        copy->next = list;
+        list = copy;
+    }
+
+    /* the new buckets are visible only after the old one is marked */
+    while ((copy = list) != NULL) {
+        list = copy->next;
+        slot = &ntab->buckets[copy->hash & ntab->mask];
+        copy->next = *slot;
+        *slot = copy;
+    }
+
+    __atomic_store_n(&tab->buckets[idx], CHT_MOVED, __ATOMIC_RELEASE);
+
+    if (head) epoch_retire(cht->epoch, head, cht_chain_free);
+
+    return 0;
+}
+
+static void cht_migrate (CHashTab * cht, int steps)
+{
+    ChtTable * tab = NULL;
+    ChtTable * ntab = NULL;
+    long       idx;
+
+    ntab = __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE);
+    if (!ntab) return;
+
+    tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+    if (tab == ntab || __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE) != ntab)
+        return;
+
+    for ( ; steps > 0; steps--) {
+        idx = __atomic_fetch_add(&tab->migidx, 1, __ATOMIC_ACQ_REL);
+        if (idx >= (long)tab->size) return;
+
+        /* bucket idx of both tables belongs to the stripe idx, since the
+         * table size is always a multiple of CHT_STRIPES */
+        cht_lock(cht, idx);
+        while (cht_migrate_bucket(cht, tab, ntab, idx) < 0)
+            cht_yield();
+        cht_unlock(cht, idx);
+
+        if (__atomic_add_fetch(&tab->moved, 1, __ATOMIC_ACQ_REL) == (long)tab->size) {
+            __atomic_store_n(&cht->cur, ntab, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&cht->next, NULL, __ATOMIC_SEQ_CST);
+            epoch_retire(cht->epoch, tab, cht_kfree);
+            return;
+        }
+    }
+}
+
+static void cht_grow (CHashTab * cht)
+{
+    ChtTable * tab = NULL;
+    ChtTable * ntab = NULL;
+    ChtTable * expect = NULL;
+
+    if (cht->load_limit <= 0) return;
+    if (__atomic_load_n(&cht->next, __ATOMIC_ACQUIRE)) return;
+
+    tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&cht->num, __ATOMIC_RELAXED) * 100 <= (long)tab->size * cht->load_limit)
+        return;
+
+    ntab = cht_table_alloc(tab->size * 2);
+    if (!ntab) return;
+
+    if (__atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE) != tab ||
+        !__atomic_compare_exchange_n(&cht->next, &expect, ntab, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        kfree(ntab);
+    }
+}
+
+static ChtNode * cht_chain_find (CHashTab * cht, ChtNode * node, ulong hash, void * key)
+{
+    for ( ; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) {
+        if (node->hash == hash &&
+            (*cht->cmp)(__atomic_load_n(&node->value, __ATOMIC_ACQUIRE), key) == 0)
+            return node;
+    }
+
+    return NULL;
+}
+
+void * cht_get (void * vcht, void * key)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    ChtNode  * node = NULL;
+    void     * value = NULL;
+    ulong      hash;
+
+    if (!cht || !key) return NULL;
+
+    hash = (*cht->hashFunc)(key);
+
+    epoch_enter(cht->epoch);
+    node = cht_chain_find(cht, cht_read_head(cht, hash), hash, key);
+    if (node) value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+    epoch_leave(cht->epoch);
+
+    return value;
+}
+
+/* mode 0: add if absent, 1: replace. return the node found, or NULL
+ * when added */
+static ChtNode * cht_store (CHashTab * cht, void * key, void * value, int mode, void ** pold)
+{
+    ChtNode  * node = NULL;
+    ChtNode ** slot = NULL;
+    ulong      hash;
+    int        added = 0;
+
+    hash = (*cht->hashFunc)(key);
+
+    epoch_enter(cht->epoch);
+    cht_lock(cht, hash);
+
+    slot = cht_write_slot(cht, hash);
+    node = cht_chain_find(cht, *slot, hash, key);
+
+    if (node) {
+        if (pold) *pold = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+        if (mode == 1) __atomic_store_n(&node->value, value, __ATOMIC_RELEASE);
+
+    } else if ((node = kalloc(sizeof(*node))) != NULL) {
+        node->hash = hash;
+        node->value = value;
+        node->next = *slot;
+        __atomic_store_n(slot, node, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&cht->num, 1, __ATOMIC_RELAXED);
+        node = NULL;
+        added = 1;
+    } else {
+        /* out of memory, reported as existing */
+        if (pold) *pold = NULL;
+        node = CHT_MOVED;
+    }
+
+    cht_unlock(cht, hash);
+
+    if (added) cht_grow(cht);
+    cht_migrate(cht, CHT_REHASH_STEP);
+
+    epoch_leave(cht->epoch);
+
+    return node;
+}
+
+int cht_set (void * vcht, void * key, void * value)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+
+    if (!cht || !key) return -1;
+
+    return cht_store(cht, key, value, 0, NULL) ? 1 : 0;
+}
+
+void * cht_get_or_set (void * vcht, void * key, void * value)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    void     * old = NULL;
+
+    if (!cht || !key) return NULL;
+
+    if (cht_store(cht, key, value, 0, &old) == NULL)
+        return value;
+
+    return old;
+}
+
+void * cht_replace (void * vcht, void * key, void * value)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    void     * old = NULL;
+
+    if (!cht || !key) return NULL;
+
+    if (cht_store(cht, key, value, 1, &old) == NULL)
+        return NULL;
+
+    return old;
+}
+
+void * cht_delete (void * vcht, void * key)
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    ChtNode  * node = NULL;
+    ChtNode ** pprev = NULL;
+    void     * value = NULL;
+    ulong      hash;
+
+    if (!cht || !key) return NULL;
+
+    hash = (*cht->hashFunc)(key);
+
+    epoch_enter(cht->epoch);
+    cht_lock(cht, hash);
+
+    pprev = cht_write_slot(cht, hash);
+    for ( ; (node = *pprev) != NULL; pprev = &node->next) {
+        if (node->hash == hash && (*cht->cmp)(node->value, key) == 0) {
+            value = node->value;
+            __atomic_store_n(pprev, node->next, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&cht->num, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    cht_unlock(cht, hash);
+
+    /* the readers may be standing on the node, free it later */
+    if (node) epoch_retire(cht->epoch, node, cht_kfree);
+
+    cht_migrate(cht, CHT_REHASH_STEP);
+
+    epoch_leave(cht->epoch);
+
+    return value;
+}
+
+void cht_traverse (void * vcht, void * usrInfo, void (*check)(void *, void *))
+{
+    CHashTab * cht = (CHashTab *)vcht;
+    ChtTable * tab = NULL;
+    ChtTable * ntab = NULL;
+    ChtNode  * node = NULL;
+    ulong      i;
+
+    if (!cht || !check) return;
+
+    epoch_enter(cht->epoch);
+
+    /* the buckets not yet moved in current table, then the new table */
+    do {
+        tab = __atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE);
+        ntab = __atomic_load_n(&cht->next, __ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&cht->cur, __ATOMIC_ACQUIRE) != tab);
+
+    for (i = 0; i < tab->size; i++) {
+        node = __atomic_load_n(&tab->buckets[i], __ATOMIC_ACQUIRE);
+        if (node == CHT_MOVED) continue;
+
+        for ( ; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))
+            (*check)(usrInfo, __atomic_load_n(&node->value, __ATOMIC_ACQUIRE));
+    }
+
+    if (ntab) {
+        for (i = 0; i < ntab->size; i++) {
+            node = __atomic_load_n(&ntab->buckets[i], __ATOMIC_ACQUIRE);
+            if (node == CHT_MOVED) continue;
+
+            for ( ; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))
+                (*check)(usrInfo, __atomic_load_n(&node->value, __ATOMIC_ACQUIRE));
+        }
+    }
+
+    epoch_leave(cht->epoch);
+}
+
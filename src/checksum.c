@@ -1,9 +1,11 @@
 /*
   calcrc32() -- compute the CRC-32 of a data stream
+  calcrc32c() -- compute the CRC-32C (Castagnoli) of a data stream
   caladler32() -- compute the Adler-32 checksum of a data stream
  */
 
 #include "btype.h"
+#include "checksum.h"
 
 #define BASE 65521L /* largest prime smaller than 65536 */
 #define NMAX 5552
@@ -134,38 +136,414 @@ const uint32 * get_crc_table_ake()
     return (const uint32 *)crc_table;
 }
 
-/* ========================================================================= */
-#define CRCDO1(buf) crc = crc_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
-#define CRCDO2(buf)  CRCDO1(buf); CRCDO1(buf);
-#define CRCDO4(buf)  CRCDO2(buf); CRCDO2(buf);
-#define CRCDO8(buf)  CRCDO4(buf); CRCDO4(buf);
+/* =========================================================================
+ * slicing-by-8 tables for CRC-32 (0xEDB88320) and CRC-32C (0x82F63B78),
+ * hardware paths selected by sys_cpuid: SSE4.2 crc32 instruction for
+ * CRC-32C, PCLMULQDQ folding for CRC-32. ARMv8 CRC instructions are used
+ * for both when compiled with the crc extension.
+ */
+
+#define CRC32_POLY   0xEDB88320UL
+#define CRC32C_POLY  0x82F63B78UL
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define CRC_X86_DISPATCH 1
+#include <immintrin.h>
+#include "service.h"
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+static uint32  crc_slice_tab[2][8][256];
+static uint32  crc_x2n_tab[2][32];
+static volatile int crc_slice_init = 0;
+
+static int     crc_hw_sse42 = 0;
+static int     crc_hw_pclmul = 0;
+
+static uint32 crc_multmodp (uint32 a, uint32 b, uint32 poly)
+{
+    uint32  m = 1UL << 31;
+    uint32  p = 0;
+
+    for ( ; ; ) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ poly : b >> 1;
+    }
+    return p;
+}
+
+static void crc_tables_init (void)
+{
+    static const uint32 poly[2] = { CRC32_POLY, CRC32C_POLY };
+    uint32   c, p;
+    int      t, n, k;
+#ifdef CRC_X86_DISPATCH
+    uint32   cpuinfo[4];
+#endif
+
+    if (crc_slice_init) return;
+
+    for (t = 0; t < 2; t++) {
+        for (n = 0; n < 256; n++) {
+            c = (uint32)n;
+            for (k = 0; k < 8; k++)
+                c = (c & 1) ? poly[t] ^ (c >> 1) : c >> 1;
+            crc_slice_tab[t][0][n] = c;
+        }
+
+        for (n = 0; n < 256; n++) {
+            c = crc_slice_tab[t][0][n];
+            for (k = 1; k < 8; k++) {
+                c = crc_slice_tab[t][0][c & 0xff] ^ (c >> 8);
+                crc_slice_tab[t][k][n] = c;
+            }
+        }
+
+        /* x^(2^n) mod p, for combining */
+        p = 1UL << 30;
+        crc_x2n_tab[t][0] = p;
+        for (n = 1; n < 32; n++)
+            crc_x2n_tab[t][n] = p = crc_multmodp(p, p, poly[t]);
+    }
+
+#ifdef CRC_X86_DISPATCH
+    sys_cpuid(0, cpuinfo);
+    if (cpuinfo[0] >= 1) {
+        sys_cpuid(1, cpuinfo);
+        crc_hw_sse42 = (cpuinfo[3] >> 20) & 1;
+        crc_hw_pclmul = ((cpuinfo[3] >> 1) & 1) && ((cpuinfo[3] >> 19) & 1);
+    }
+#endif
+
+#if defined(__GNUC__)
+    __sync_synchronize();
+#endif
+    crc_slice_init = 1;
+}
+
+/* crc is the register value, not complemented */
+static uint32 crc_slice8 (uint32 tab[8][256], uint32 crc, uint8 * buf, uint32 len)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32  lo, hi;
+
+    while (len >= 8) {
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+        lo ^= crc;
+
+        crc = tab[7][lo & 0xff] ^ tab[6][(lo >> 8) & 0xff] ^
+              tab[5][(lo >> 16) & 0xff] ^ tab[4][lo >> 24] ^
+              tab[3][hi & 0xff] ^ tab[2][(hi >> 8) & 0xff] ^
+              tab[1][(hi >> 16) & 0xff] ^ tab[0][hi >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len-- > 0)
+        crc = tab[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#ifdef CRC_X86_DISPATCH
+
+__attribute__((target("sse4.2")))
+static uint32 crc32c_sse42 (uint32 crc, uint8 * buf, uint32 len)
+{
+#if defined(__x86_64__) || defined(__amd64__)
+    uint64  c = crc;
+    uint64  v;
+
+    while (len >= 8) {
+        memcpy(&v, buf, 8);
+        c = _mm_crc32_u64(c, v);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32)c;
+#endif
+
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *buf++);
+
+    return crc;
+}
+
+/* fold 4 x 128 bits in parallel with carry-less multiply, then Barrett
+ * reduce to 32 bits. len must be a multiple of 16 and not less than 64 */
+__attribute__((target("sse4.1,pclmul")))
+static uint32 crc32_pclmul (uint32 crc, uint8 * buf, uint32 len)
+{
+    static const uint64 k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const uint64 k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const uint64 k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const uint64 poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+    __m128i  x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((__m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((__m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((__m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((__m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((__m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i *)(buf + 0x30)));
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold into 128 bits */
+    x0 = _mm_load_si128((__m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((__m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((__m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((__m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+
+static uint32 crc_armv8 (uint32 crc, uint8 * buf, uint32 len, int castagnoli)
+{
+    uint64  v;
+
+    while (len >= 8) {
+        memcpy(&v, buf, 8);
+        crc = castagnoli ? __crc32cd(crc, v) : __crc32d(crc, v);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0) {
+        crc = castagnoli ? __crc32cb(crc, *buf) : __crc32b(crc, *buf);
+        buf++;
+    }
+
+    return crc;
+}
+
+#endif
+
 
 /* ========================================================================= */
 uint32 calcrc32 (uint32 crc, uint8 * buf, uint32 len)
 {
+#ifdef CRC_X86_DISPATCH
+    uint32  n = 0;
+#endif
+
     if (buf == NULL) 
         return 0L;
 
-#ifdef DYNAMIC_CRC_TABLE
-    if (crc_table_empty)
-        make_crc_table();
-#endif
+    crc_tables_init();
 
     crc = crc ^ 0xffffffffL;
-    while (len >= 8) {
-        CRCDO8(buf);
-        len -= 8;
-    }
-    if (len) { 
-        do {
-            CRCDO1(buf);
-        } while (--len);
+
+#if defined(__ARM_FEATURE_CRC32)
+    crc = crc_armv8(crc, buf, len, 0);
+#else
+#ifdef CRC_X86_DISPATCH
+    if (crc_hw_pclmul && len >= 64) {
+        n = len & ~15U;
+        crc = crc32_pclmul(crc, buf, n);
+        buf += n;
+        len -= n;
     }
+#endif
+    crc = crc_slice8(crc_slice_tab[0], crc, buf, len);
+#endif
+
+    return crc ^ 0xffffffffL;
+}
+
+uint32 calcrc32c (uint32 crc, uint8 * buf, uint32 len)
+{
+    if (buf == NULL)
+        return 0L;
+
+    crc_tables_init();
+
+    crc = crc ^ 0xffffffffL;
+
+#if defined(__ARM_FEATURE_CRC32)
+    crc = crc_armv8(crc, buf, len, 1);
+#else
+#ifdef CRC_X86_DISPATCH
+    if (crc_hw_sse42)
+        return crc32c_sse42(crc, buf, len) ^ 0xffffffffL;
+#endif
+    crc = crc_slice8(crc_slice_tab[1], crc, buf, len);
+#endif
 
     return crc ^ 0xffffffffL;
 }
 
+/* x^(n*2^k) mod p */
+static uint32 crc_x2nmodp (int t, int64 n, int k, uint32 poly)
+{
+    uint32  p = 1UL << 31;
+
+    while (n) {
+        if (n & 1)
+            p = crc_multmodp(crc_x2n_tab[t][k & 31], p, poly);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+uint32 crc32_combine (uint32 crc1, uint32 crc2, int64 len2)
+{
+    crc_tables_init();
+
+    return crc_multmodp(crc_x2nmodp(0, len2, 3, CRC32_POLY), crc1, CRC32_POLY) ^ crc2;
+}
+
+uint32 crc32c_combine (uint32 crc1, uint32 crc2, int64 len2)
+{
+    crc_tables_init();
+
+    return crc_multmodp(crc_x2nmodp(1, len2, 3, CRC32C_POLY), crc1, CRC32C_POLY) ^ crc2;
+}
+
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline uint32 adler_hsum (__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return (uint32)_mm_cvtsi128_si32(v);
+}
+
+/* 32 bytes a block, s1 is summed by psadbw, s2 by pmaddwd with the
+ * weights 32..1. no more than NMAX bytes are summed before modulo */
+static void adler32_sse2 (unsigned long * ps1, unsigned long * ps2, uint8 * buf, uint32 blocks)
+{
+    const __m128i  zero = _mm_setzero_si128();
+    const __m128i  w1 = _mm_setr_epi16(32, 31, 30, 29, 28, 27, 26, 25);
+    const __m128i  w2 = _mm_setr_epi16(24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i  w3 = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i  w4 = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    unsigned long  s1 = *ps1;
+    unsigned long  s2 = *ps2;
+    __m128i        v_s1, v_s2, v_ps, b1, b2;
+    uint32         n;
+
+    while (blocks > 0) {
+        n = NMAX / 32;
+        if (n > blocks) n = blocks;
+        blocks -= n;
+
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = zero;
+
+        do {
+            b1 = _mm_loadu_si128((const __m128i *)buf);
+            b2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b1, zero));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b2, zero));
+
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(b1, zero), w1));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(b1, zero), w2));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(b2, zero), w3));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(b2, zero), w4));
+
+            buf += 32;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
 
+        s1 += adler_hsum(v_s1);
+        s2 = adler_hsum(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    *ps1 = s1;
+    *ps2 = s2;
+}
+#endif
 
 #define ADLDO1(buf,i)  {s1 += buf[i]; s2 += s1;}
 #define ADLDO2(buf,i)  ADLDO1(buf,i); ADLDO1(buf,i+1);
@@ -182,6 +560,15 @@ uint32 caladler32 (uint32 adler, uint8 * buf, uint32 len)
 
     if (buf == NULL) return 1L;
 
+#if defined(__SSE2__)
+    if (len >= 64) {
+        k = len / 32;
+        adler32_sse2(&s1, &s2, buf, k);
+        buf += k * 32;
+        len -= k * 32;
+    }
+#endif
+
     while (len > 0) {
         k = len < NMAX ? len : NMAX;
         len -= k;
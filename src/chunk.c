@@ -9,9 +9,17 @@
 #include "fileop.h"
 #include "frame.h"
 #include "nativefile.h"
+#include "pagecache.h"
 #include "strutil.h"
 #include "chunk.h"
 #include "patmat.h"
+#include "btime.h"
+
+#ifdef UNIX
+#include <fcntl.h>
+#endif
+
+#include <zlib.h>
 
 static char * chunk_end_flag = "0\r\n\r\n";
 
@@ -32,6 +40,28 @@ int size_hex_len (int64 size)
     return n;
 }
 
+/* the size line of HTTP chunk in lower-case hex, as "%llx\r\n" */
+static void chunk_ent_lenstr (ckent_t * ent)
+{
+    static char hexch[] = "0123456789abcdef";
+    char    digit[16];
+    uint64  val = (uint64)ent->length;
+    int     i, n = 0;
+
+    do {
+        digit[n++] = hexch[val & 15];
+        val >>= 4;
+    } while (val && n < 16);
+
+    for (i = 0; i < n; i++)
+        ent->lenstr[i] = digit[n - 1 - i];
+
+    ent->lenstr[n] = '\r';
+    ent->lenstr[n + 1] = '\n';
+    ent->lenstr[n + 2] = '\0';
+    ent->lenstrlen = n + 2;
+}
+
 void chunk_entity_free (void * pent)
 {
     ckent_t  * ent = (ckent_t *)pent;
@@ -87,6 +117,518 @@ void chunk_entity_free (void * pent)
     kfree(ent);
 }
 
+static int chunk_index_extend (chunk_t * ck)
+{
+    ckent_t  * ent = NULL;
+    int64    * p = NULL;
+    int64      end, ckend;
+    int        i, num, size;
+
+    num = arr_num(ck->entity_list);
+    if (ck->idxnum >= num) return 0;
+
+    if (ck->idxhead + num > ck->idxsize) {
+        /* move out the slots of entities removed from head */
+        if (ck->idxhead > 0 && ck->idxnum > 0) {
+            memmove(ck->entend, ck->entend + ck->idxhead, ck->idxnum * sizeof(int64));
+            memmove(ck->ckend, ck->ckend + ck->idxhead, ck->idxnum * sizeof(int64));
+        }
+        ck->idxhead = 0;
+
+        if (num > ck->idxsize) {
+            for (size = ck->idxsize > 0 ? ck->idxsize : 64; size < num; size *= 2);
+
+            p = krealloc(ck->entend, size * sizeof(int64));
+            if (!p) return -100;
+            ck->entend = p;
+
+            p = krealloc(ck->ckend, size * sizeof(int64));
+            if (!p) return -100;
+            ck->ckend = p;
+
+            ck->idxsize = size;
+        }
+    }
+
+    if (ck->idxnum > 0) {
+        end = ck->entend[ck->idxhead + ck->idxnum - 1];
+        ckend = ck->ckend[ck->idxhead + ck->idxnum - 1];
+    } else {
+        end = ck->rmentlen;
+        ckend = ck->rmchunklen;
+    }
+
+    for (i = ck->idxnum; i < num; i++) {
+        ent = arr_value(ck->entity_list, i);
+        if (ent) {
+            end += ent->length;
+            ckend += ent->lenstrlen + ent->length + ent->trailerlen;
+        }
+        ck->entend[ck->idxhead + i] = end;
+        ck->ckend[ck->idxhead + i] = ckend;
+    }
+    ck->idxnum = num;
+
+    return 0;
+}
+
+/* read the file entity at pos through the shared page cache. return < 0
+   if the cache is not set up or fails, the caller reads the file itself */
+static int chunk_pcache_read (ckent_t * ent, int64 pos, void * pbuf, int len)
+{
+    if (!pcache_enabled()) return -1;
+
+    if (ent->cktype == CKT_FILE_NAME)
+        return pcache_read(native_file_fd(ent->u.filename.hfile),
+                           ent->u.filename.inode, ent->u.filename.mtime,
+                           ent->u.filename.offset + pos, pbuf, len);
+
+    if (ent->cktype == CKT_FILE_DESC)
+        return pcache_read(ent->u.filefd.fd,
+                           ent->u.filefd.inode, ent->u.filefd.mtime,
+                           ent->u.filefd.offset + pos, pbuf, len);
+
+    return -1;
+}
+
+/* map the window holding the file offset fpos, return the pointer to fpos.
+   the window is aligned to the window size, so the positions of adjacent
+   reads or backward scanning fall in the window mapped already */
+static void * chunk_file_map (chunk_t * ck, int fd, int64 fpos,
+                              void ** ppmap, size_t * pmaplen, off_t * pmapoff)
+{
+    int64   win, winoff;
+    int     backward = 0;
+
+    if (*ppmap && fpos >= *pmapoff && fpos < *pmapoff + (int64)*pmaplen)
+        return (uint8 *)*ppmap + fpos - *pmapoff;
+
+    win = ck->mapwin > 0 ? ck->mapwin : CHUNK_MAPWIN;
+    winoff = fpos - fpos % win;
+
+    if (*ppmap) {
+        backward = winoff < *pmapoff;
+
+        file_munmap(*ppmap, *pmaplen);
+        *ppmap = NULL;
+        *pmaplen = 0;
+        *pmapoff = 0;
+    }
+
+    if (file_mmap(NULL, fd, winoff, win, PROT_READ, MAP_SHARED, ppmap, pmaplen, pmapoff) == NULL)
+        return NULL;
+
+    if (ck->mapadvise) {
+#if defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+        madvise(*ppmap, *pmaplen, backward ? MADV_WILLNEED : MADV_SEQUENTIAL);
+#endif
+#if defined(POSIX_FADV_WILLNEED)
+        /* the pages of next window are read in while this one is scanned */
+        if (!backward)
+            posix_fadvise(fd, winoff + win, win, POSIX_FADV_WILLNEED);
+        else if (winoff > 0)
+            posix_fadvise(fd, winoff - win, win, POSIX_FADV_WILLNEED);
+#endif
+    }
+
+    return (uint8 *)*ppmap + fpos - *pmapoff;
+}
+
+/* the entities from index on are changed, they are indexed again */
+static void chunk_index_trunc (chunk_t * ck, int index)
+{
+    if (index < 0) index = 0;
+
+    if (ck->idxnum > index)
+        ck->idxnum = index;
+
+    if (ck->idxnum == 0)
+        ck->idxhead = 0;
+}
+
+/* the first entity is removed from entity_list */
+static void chunk_index_shift (chunk_t * ck)
+{
+    if (ck->idxnum > 0) {
+        ck->idxhead++;
+        ck->idxnum--;
+    }
+
+    if (ck->idxnum == 0)
+        ck->idxhead = 0;
+}
+
+/* return the index of entity that pos is located in, and the offset of it
+   by paccentlen. the walking from entity 0 is replaced with binary search */
+static int chunk_ent_locate (chunk_t * ck, int64 pos, int httpchunk, int64 * paccentlen)
+{
+    int64  * ends = NULL;
+    int      lo, hi, mid;
+
+    if (chunk_index_extend(ck) < 0) {
+        *paccentlen = httpchunk ? ck->rmchunklen : ck->rmentlen;
+        return 0;
+    }
+
+    ends = (httpchunk ? ck->ckend : ck->entend) + ck->idxhead;
+
+    for (lo = 0, hi = ck->idxnum; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if (ends[mid] <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo > 0)
+        *paccentlen = ends[lo - 1];
+    else
+        *paccentlen = httpchunk ? ck->rmchunklen : ck->rmentlen;
+
+    return lo;
+}
+
+
+/* the deflating stage of chunk_set_zip. the source chunk holds the entities
+ * to compress, they are read by chunk_read_ptr and removed after deflated.
+ * the output is appended to the chunk as buffer entities of CHUNK_ZIP_BLOCK
+ * bytes at most */
+
+#define CHUNK_ZIP_BLOCK  (32*1024)
+#define CHUNK_ZIP_READ   (64*1024)
+
+typedef struct chunk_zip_s {
+    z_stream    zs;
+    chunk_t   * src;
+    int64       srcpos;
+
+    uint8       srcend;
+    uint8       done;
+
+    /* the compressed copy of the whole-file source being written */
+    FILE      * cachefp;
+    char      * cachefile;
+    char      * cachetmp;
+} ChunkZip;
+
+static void chunk_zip_cache_end (ChunkZip * zip, int ok)
+{
+    if (zip->cachefp) {
+        if (fclose(zip->cachefp) != 0) ok = 0;
+        zip->cachefp = NULL;
+
+        if (ok) rename(zip->cachetmp, zip->cachefile);
+        else unlink(zip->cachetmp);
+    }
+
+    if (zip->cachefile) kfree(zip->cachefile);
+    if (zip->cachetmp) kfree(zip->cachetmp);
+    zip->cachefile = zip->cachetmp = NULL;
+}
+
+static void chunk_zip_free (ChunkZip * zip)
+{
+    if (!zip) return;
+
+    chunk_zip_cache_end(zip, 0);
+
+    if (!zip->done) deflateEnd(&zip->zs);
+    if (zip->src) chunk_free(zip->src);
+
+    kfree(zip);
+}
+
+/* append the buffer allocated by kalloc as an entity owning it */
+static int chunk_add_kbuf (chunk_t * ck, void * pbuf, int64 len)
+{
+    ckent_t  * ent = NULL;
+
+    ent = kzalloc(sizeof(*ent));
+    if (!ent) return -100;
+
+    ent->cktype = CKT_BUFFER;
+    ent->length = len;
+    ent->u.buf.pbyte = pbuf;
+
+    arr_push(ck->entity_list, ent);
+
+    ck->size += len;
+    ck->bufnum++;
+
+    chunk_ent_lenstr(ent);
+    strcpy(ent->trailer, "\r\n");
+    ent->trailerlen = 2;
+    ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+
+    return 0;
+}
+
+/* the pending bytes of coalesced buffers become one buffer entity */
+static int chunk_coalesce_flush (chunk_t * ck)
+{
+    int  len = ck->pendlen;
+
+    if (len <= 0) return 0;
+
+    ck->pend[len] = '\0';
+    if (chunk_add_kbuf(ck, ck->pend, len) < 0)
+        return -100;
+
+    ck->pend = NULL;
+    ck->pendlen = 0;
+
+    return len;
+}
+
+static int chunk_coalesce_add (chunk_t * ck, void * pbuf, int len)
+{
+    if (ck->pendlen + len > ck->pendmax)
+        chunk_coalesce_flush(ck);
+
+    if (!ck->pend) {
+        ck->pend = kalloc(ck->pendmax + 1);
+        if (!ck->pend) return -100;
+
+        ck->pendlen = 0;
+        ck->pendtime = btime_mono_coarse(NULL);
+    }
+
+    memcpy(ck->pend + ck->pendlen, pbuf, len);
+    ck->pendlen += len;
+
+    if (ck->pendlen >= ck->pendmax)
+        chunk_coalesce_flush(ck);
+
+    return 0;
+}
+
+/* deflate one block, return the bytes produced, 0 if the source has no
+ * data available now, or < 0 on failure */
+static int chunk_zip_block (chunk_t * ck, ChunkZip * zip)
+{
+    uint8  * out = NULL;
+    void   * pbyte = NULL;
+    int64    bytelen = 0;
+    int      ret, outlen;
+
+    out = kalloc(CHUNK_ZIP_BLOCK + 1);
+    if (!out) return -100;
+
+    zip->zs.next_out = out;
+    zip->zs.avail_out = CHUNK_ZIP_BLOCK;
+
+    while (zip->zs.avail_out > 0) {
+        if (zip->zs.avail_in == 0 && !zip->srcend) {
+            /* the entities consumed are released, files are unmapped */
+            chunk_remove(zip->src, zip->srcpos, 0);
+
+            if (zip->srcpos >= chunk_size(zip->src, 0)) {
+                zip->srcend = 1;
+
+            } else {
+                bytelen = 0;
+                if (chunk_read_ptr(zip->src, zip->srcpos, CHUNK_ZIP_READ, &pbyte, &bytelen, 0) <= 0 ||
+                    bytelen <= 0)
+                    break;   //callback entity has no data yet
+
+                zip->zs.next_in = pbyte;
+                zip->zs.avail_in = (uInt)bytelen;
+                zip->srcpos += bytelen;
+            }
+        }
+
+        ret = deflate(&zip->zs, zip->srcend ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            zip->done = 1;
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            kfree(out);
+            return -101;
+        }
+    }
+
+    outlen = CHUNK_ZIP_BLOCK - zip->zs.avail_out;
+    if (outlen <= 0) {
+        kfree(out);
+        return 0;
+    }
+    out[outlen] = '\0';
+
+    if (zip->cachefp && fwrite(out, 1, outlen, zip->cachefp) != (size_t)outlen)
+        chunk_zip_cache_end(zip, 0);
+
+    if (chunk_add_kbuf(ck, out, outlen) < 0) {
+        kfree(out);
+        return -100;
+    }
+
+    return outlen;
+}
+
+/* compress ahead of the read position till CHUNK_ZIP_WINDOW bytes are
+ * ready, the source is drained or it has to wait for callback data */
+static int chunk_zip_fill (chunk_t * ck, int64 offset, int httpchunk)
+{
+    ChunkZip * zip = (ChunkZip *)ck->zip;
+    int64      rest = 0;
+    int        ret = 0;
+
+    if (!zip || zip->done) return 0;
+
+    rest = httpchunk ? ck->chunksize - offset : ck->size - offset;
+
+    while (!zip->done && rest < CHUNK_ZIP_WINDOW) {
+        ret = chunk_zip_block(ck, zip);
+        if (ret < 0) break;
+        if (ret == 0 && !zip->done) break;
+
+        rest += ret;
+    }
+
+    if (zip->done || ret < 0) {
+        deflateEnd(&zip->zs);
+        zip->done = 1;
+
+        chunk_zip_cache_end(zip, ret >= 0);
+        chunk_free(zip->src);
+        zip->src = NULL;
+
+        chunk_set_end(ck);
+    }
+
+    return ret;
+}
+
+static void chunk_pull (chunk_t * ck, int64 offset, int httpchunk)
+{
+    if (ck->pendlen > 0 && (ck->pendwait <= 0 ||
+        btime_mono_coarse(NULL) - ck->pendtime >= (long)ck->pendwait * 1000))
+        chunk_coalesce_flush(ck);
+
+    if (ck->zip) chunk_zip_fill(ck, offset, httpchunk);
+}
+
+int chunk_set_zip (void * vck, int ziptype, int level, char * cachedir)
+{
+    chunk_t  * ck = (chunk_t *)vck;
+    chunk_t  * src = NULL;
+    ChunkZip * zip = NULL;
+    ckent_t  * ent = NULL;
+    arr_t    * hdrlist = NULL;
+    char       path[1024];
+    char     * ext = NULL;
+    int64      fsize = 0;
+    time_t     mtime = 0;
+    long       inode = 0;
+    int        i, num, wbits;
+
+    if (!ck) return -1;
+    if (ck->zip || ck->rmentlen > 0) return -2;
+
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+
+    switch (ziptype) {
+    case CHUNK_ZIP_GZIP:    wbits = 15 + 16; ext = "gz"; break;
+    case CHUNK_ZIP_DEFLATE: wbits = 15; ext = "zz"; break;
+    case CHUNK_ZIP_RAW:     wbits = -15; ext = "df"; break;
+    default: return -3;
+    }
+
+    /* the file entities are read into the load buffer of src */
+    src = chunk_new(CHUNK_ZIP_READ);
+    if (!src) return -100;
+
+    src->mapwin = ck->mapwin;
+    src->mapadvise = ck->mapadvise;
+
+    /* the header entities stay in chunk uncompressed */
+    hdrlist = arr_new(4);
+    num = arr_num(ck->entity_list);
+
+    for (i = 0; i < num; i++) {
+        ent = arr_value(ck->entity_list, i);
+        if (!ent) continue;
+
+        if (ent->header) {
+            arr_push(hdrlist, ent);
+            continue;
+        }
+
+        arr_push(src->entity_list, ent);
+        src->size += ent->length;
+        src->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+
+        if (ent->cktype == CKT_FILE_NAME || ent->cktype == CKT_FILE_PTR ||
+            ent->cktype == CKT_FILE_DESC)
+            src->filenum++;
+        else
+            src->bufnum++;
+    }
+
+    arr_free(ck->entity_list);
+    ck->entity_list = hdrlist;
+    chunk_index_trunc(ck, 0);
+
+    ck->size = ck->rmentlen;
+    ck->chunksize = ck->rmchunklen + 5;
+    ck->filenum = ck->bufnum = 0;
+    ck->endsize = ck->chunkendsize = -1;
+
+    for (i = 0; i < arr_num(ck->entity_list); i++) {
+        ent = arr_value(ck->entity_list, i);
+        ck->size += ent->length;
+        ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+        if (ent->cktype == CKT_FILE_NAME || ent->cktype == CKT_FILE_PTR ||
+            ent->cktype == CKT_FILE_DESC)
+            ck->filenum++;
+        else
+            ck->bufnum++;
+    }
+
+    if (cachedir && chunk_is_file(src, &fsize, &mtime, &inode, NULL)) {
+        snprintf(path, sizeof(path), "%s/%lx-%llx-%llx.%s", cachedir, inode,
+                 (unsigned long long)mtime, (unsigned long long)fsize, ext);
+
+        if (file_is_regular(path) && chunk_add_file(ck, path, 0, -1, 0) >= 0) {
+            chunk_free(src);
+            chunk_set_end(ck);
+            return 1;
+        }
+    } else {
+        cachedir = NULL;
+    }
+
+    zip = kzalloc(sizeof(*zip));
+    if (!zip) {
+        chunk_free(src);
+        return -100;
+    }
+
+    if (level < 0 || level > 9) level = Z_DEFAULT_COMPRESSION;
+
+    if (deflateInit2(&zip->zs, level, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        kfree(zip);
+        chunk_free(src);
+        return -101;
+    }
+
+    zip->src = src;
+
+    if (cachedir) {
+        zip->cachefile = str_dup(path, -1);
+        zip->cachetmp = kalloc(strlen(path) + 32);
+
+        if (zip->cachefile && zip->cachetmp) {
+            sprintf(zip->cachetmp, "%s.%lx.tmp", path, (ulong)getpid() ^ (ulong)zip);
+            zip->cachefp = fopen(zip->cachetmp, "wb");
+        }
+
+        if (!zip->cachefp) chunk_zip_cache_end(zip, 0);
+    }
+
+    ck->zip = zip;
+    return 0;
+}
+
 
 void * chunk_new (int buflen)
 {
@@ -111,6 +653,9 @@ void * chunk_new (int buflen)
 
     ck->seekpos = 0;
 
+    ck->mapwin = CHUNK_MAPWIN;
+    ck->mapadvise = 1;
+
     ck->lblen = 0;
     ck->lbsize = buflen;
     if (ck->lbsize > 0) {
@@ -128,6 +673,17 @@ void chunk_free (void * vck)
 
     if (!ck) return;
 
+    if (ck->zip) {
+        chunk_zip_free(ck->zip);
+        ck->zip = NULL;
+    }
+
+    if (ck->pend) {
+        kfree(ck->pend);
+        ck->pend = NULL;
+        ck->pendlen = 0;
+    }
+
     if (ck->loadbuf) {
         kfree(ck->loadbuf);
         ck->loadbuf = NULL;
@@ -142,6 +698,9 @@ void chunk_free (void * vck)
     }
     arr_free(ck->entity_list);
 
+    if (ck->entend) kfree(ck->entend);
+    if (ck->ckend) kfree(ck->ckend);
+
     kfree(ck);
 }
 
@@ -154,6 +713,17 @@ void chunk_zero (void * vck)
 
     if (!ck) return;
 
+    if (ck->zip) {
+        chunk_zip_free(ck->zip);
+        ck->zip = NULL;
+    }
+
+    if (ck->pend) {
+        kfree(ck->pend);
+        ck->pend = NULL;
+        ck->pendlen = 0;
+    }
+
     num = arr_num(ck->entity_list);
 
     for (i = 0; i < num; i++) {
@@ -164,6 +734,7 @@ void chunk_zero (void * vck)
     }
 
     arr_zero(ck->entity_list);
+    chunk_index_trunc(ck, 0);
 
     ck->httpchunk = 0;
     ck->rmchunklen = 0;
@@ -341,6 +912,8 @@ int chunk_set_end (void * vck)
 
     if (!ck) return 0;
 
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+
     ck->endsize = ck->size;
     ck->chunkendsize = ck->chunksize;
 
@@ -393,6 +966,10 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
 
     if (!ck) return -1;
 
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
+
     if (httpchunk) {
         if (offset < ck->rmchunklen)
             offset = ck->rmchunklen;
@@ -427,7 +1004,7 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
     ck->seekpos = offset;
 
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, httpchunk, &accentlen); i < num; i++) {
 
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -439,7 +1016,7 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
                 if (curlen > length - readlen)
                     curlen = length - readlen;
  
-                memcpy(pbuf, ent->lenstr + curpos, curlen);
+                memcpy((uint8 *)pbuf + readlen, ent->lenstr + curpos, curlen);
  
                 readlen += curlen;
                 readpos += curlen;
@@ -458,13 +1035,13 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
                 curlen = length - readlen;
 
             if (ent->cktype == CKT_CHAR_ARRAY) {
-                memcpy(pbuf, ent->u.charr.pbyte + curpos, curlen);
+                memcpy((uint8 *)pbuf + readlen, ent->u.charr.pbyte + curpos, curlen);
 
             } else if (ent->cktype == CKT_BUFFER) {
-                memcpy(pbuf, ent->u.buf.pbyte + curpos, curlen);
+                memcpy((uint8 *)pbuf + readlen, ent->u.buf.pbyte + curpos, curlen);
 
             } else if (ent->cktype == CKT_BUFFER_PTR) {
-                memcpy(pbuf, ent->u.bufptr.pbyte + curpos, curlen);
+                memcpy((uint8 *)pbuf + readlen, ent->u.bufptr.pbyte + curpos, curlen);
 
             } else if (ent->cktype == CKT_FILE_NAME) {
                 if (ent->u.filename.hfile == NULL) {
@@ -477,19 +1054,24 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
                                   &ent->u.filename.mtime, NULL);
                 }
 
-                native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
-
-                ret = native_file_read(ent->u.filename.hfile, pbuf, curlen);
+                ret = chunk_pcache_read(ent, curpos, (uint8 *)pbuf + readlen, curlen);
+                if (ret < 0) {
+                    native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
+                    ret = native_file_read(ent->u.filename.hfile, (uint8 *)pbuf + readlen, curlen);
+                }
                 if (ret >= 0) curlen = ret;
 
             } else if (ent->cktype == CKT_FILE_PTR) {
                 file_seek(ent->u.fileptr.fp, ent->u.fileptr.offset + curpos, SEEK_SET);
-                ret = file_read(ent->u.fileptr.fp, pbuf, curlen);
+                ret = file_read(ent->u.fileptr.fp, (uint8 *)pbuf + readlen, curlen);
                 if (ret >= 0) curlen = ret;
 
             } else if (ent->cktype == CKT_FILE_DESC) {
-                lseek(ent->u.filefd.fd, ent->u.filefd.offset + curpos, SEEK_SET);
-                ret = filefd_read(ent->u.filefd.fd, pbuf, curlen);
+                ret = chunk_pcache_read(ent, curpos, (uint8 *)pbuf + readlen, curlen);
+                if (ret < 0) {
+                    lseek(ent->u.filefd.fd, ent->u.filefd.offset + curpos, SEEK_SET);
+                    ret = filefd_read(ent->u.filefd.fd, (uint8 *)pbuf + readlen, curlen);
+                }
                 if (ret >= 0) curlen = ret;
 
             } else if (ent->cktype == CKT_CALLBACK) {
@@ -503,7 +1085,7 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
                                                        curlen - onelen,
                                                        &pbyte, &bytelen);
                     if (ret >= 0) {
-                        memcpy(pbuf+onelen, pbyte, bytelen);
+                        memcpy((uint8 *)pbuf + readlen + onelen, pbyte, bytelen);
                         onelen += bytelen;
                         continue;
                     }
@@ -528,7 +1110,7 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
                 if (curlen > length - readlen)
                     curlen = length - readlen;
  
-                memcpy(pbuf, ent->trailer + curpos, curlen);
+                memcpy((uint8 *)pbuf + readlen, ent->trailer + curpos, curlen);
  
                 readlen += curlen;
                 readpos += curlen;
@@ -548,7 +1130,7 @@ int64 chunk_read (void * vck, void * pbuf, int64 offset, int64 length, int httpc
             if (curlen > length - readlen)
                 curlen = length - readlen;
  
-            memcpy(pbuf, chunk_end_flag + curpos, curlen);
+            memcpy((uint8 *)pbuf + readlen, chunk_end_flag + curpos, curlen);
  
             readlen += curlen;
             readpos += curlen;
@@ -578,6 +1160,10 @@ int64 chunk_read_ptr (void * vck, int64 offset, int64 length, void ** ppbyte, in
     int64      curlen = 0;
  
     if (!ck) return -1;
+
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
  
     if (httpchunk) {
         if (offset < ck->rmchunklen)
@@ -613,7 +1199,7 @@ int64 chunk_read_ptr (void * vck, int64 offset, int64 length, void ** ppbyte, in
     ck->seekpos = offset;
 
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, httpchunk, &accentlen); i < num; i++) {
 
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -668,11 +1254,14 @@ int64 chunk_read_ptr (void * vck, int64 offset, int64 length, void ** ppbyte, in
                                   &ent->u.filename.mtime, NULL);
                 }
 
-                native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
                 if (curlen > ck->lbsize) curlen = ck->lbsize;
 
                 if (!ck->loadbuf) ck->loadbuf = kalloc(ck->lbsize);
-                ret = native_file_read(ent->u.filename.hfile, ck->loadbuf, curlen);
+                ret = chunk_pcache_read(ent, curpos, ck->loadbuf, curlen);
+                if (ret < 0) {
+                    native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
+                    ret = native_file_read(ent->u.filename.hfile, ck->loadbuf, curlen);
+                }
                 if (ret >= 0) curlen = ret;
 
                 if (ppbyte) *ppbyte = ck->loadbuf;
@@ -694,11 +1283,14 @@ int64 chunk_read_ptr (void * vck, int64 offset, int64 length, void ** ppbyte, in
                 return curlen;
 
             } else if (ent->cktype == CKT_FILE_DESC) {
-                lseek(ent->u.filefd.fd, ent->u.filefd.offset + curpos, SEEK_SET);
                 if (curlen > ck->lbsize) curlen = ck->lbsize;
 
                 if (!ck->loadbuf) ck->loadbuf = kalloc(ck->lbsize);
-                ret = filefd_read(ent->u.filefd.fd, ck->loadbuf, curlen);
+                ret = chunk_pcache_read(ent, curpos, ck->loadbuf, curlen);
+                if (ret < 0) {
+                    lseek(ent->u.filefd.fd, ent->u.filefd.offset + curpos, SEEK_SET);
+                    ret = filefd_read(ent->u.filefd.fd, ck->loadbuf, curlen);
+                }
                 if (ret >= 0) curlen = ret;
 
                 if (ppbyte) *ppbyte = ck->loadbuf;
@@ -770,6 +1362,10 @@ int64 chunk_readto_frame (void * vck, frame_p frm, int64 offset, int64 length, i
 
     if (!ck) return -1;
 
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
+
     if (httpchunk) {
         if (offset < ck->rmchunklen)
             offset = ck->rmchunklen;
@@ -802,7 +1398,7 @@ int64 chunk_readto_frame (void * vck, frame_p frm, int64 offset, int64 length, i
     ck->seekpos = offset;
 
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, httpchunk, &accentlen); i < num; i++) {
 
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -852,12 +1448,14 @@ int64 chunk_readto_frame (void * vck, frame_p frm, int64 offset, int64 length, i
                                   &ent->u.filename.mtime, NULL);
                 }
 
-                native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
-
                 if (frame_rest(frm) < curlen) 
                     frame_grow(frm, curlen); 
 
-                ret = native_file_read(ent->u.filename.hfile, frame_end(frm), curlen);
+                ret = chunk_pcache_read(ent, curpos, frame_end(frm), curlen);
+                if (ret < 0) {
+                    native_file_seek(ent->u.filename.hfile, ent->u.filename.offset + curpos);
+                    ret = native_file_read(ent->u.filename.hfile, frame_end(frm), curlen);
+                }
                 if (ret >= 0) frame_len_add(frm, ret);
 
             } else if (ent->cktype == CKT_FILE_PTR) {
@@ -865,7 +1463,17 @@ int64 chunk_readto_frame (void * vck, frame_p frm, int64 offset, int64 length, i
                 if (ret >= 0) curlen = ret;
 
             } else if (ent->cktype == CKT_FILE_DESC) {
-                ret = frame_filefd_read(frm, ent->u.filefd.fd, ent->u.filefd.offset + curpos, curlen);
+                ret = -1;
+                if (pcache_enabled()) {
+                    if (frame_rest(frm) < curlen)
+                        frame_grow(frm, curlen);
+
+                    if (frame_rest(frm) >= curlen)
+                        ret = chunk_pcache_read(ent, curpos, frame_end(frm), curlen);
+                    if (ret >= 0) frame_len_add(frm, ret);
+                }
+                if (ret < 0)
+                    ret = frame_filefd_read(frm, ent->u.filefd.fd, ent->u.filefd.offset + curpos, curlen);
                 if (ret >= 0) curlen = ret;
 
             } else if (ent->cktype == CKT_CALLBACK) {
@@ -954,6 +1562,10 @@ int64 chunk_readto_file (void * vck, int fd, int64 offset, int64 length, int htt
     int64      curlen = 0;
 
     if (!ck) return -1;
+
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
     if (fd < 0) return -2;
 
     if (httpchunk) {
@@ -988,7 +1600,7 @@ int64 chunk_readto_file (void * vck, int fd, int64 offset, int64 length, int htt
     ck->seekpos = offset;
 
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, httpchunk, &accentlen); i < num; i++) {
 
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -1149,7 +1761,7 @@ int chunk_go_ahead (void * vck, void * msg, int64 offset, int64 step)
  
     num = arr_num(ck->entity_list);
 
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, 0, &accentlen); i < num; i++) {
 
         ent = arr_value(ck->entity_list, i);
         if (!ent || ent->length <= 0) continue;
@@ -1186,6 +1798,13 @@ int chunk_add_buffer (void * vck, void * pbuf, int64 len)
 
     if (len < 0) return 0;
 
+    if (ck->pendmax > 0) {
+        if (len < ck->pendmax)
+            return chunk_coalesce_add(ck, pbuf, (int)len);
+
+        chunk_coalesce_flush(ck);
+    }
+
     ent = kzalloc(sizeof(*ent));
     if (!ent) return -100;
 
@@ -1215,8 +1834,7 @@ int chunk_add_buffer (void * vck, void * pbuf, int64 len)
     ck->size += len;
     ck->bufnum++;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n"); 
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1230,6 +1848,9 @@ int chunk_add_strip_buffer (void * vck, void * pbuf, int64 len, char * escch, in
     ckent_t  * ent = NULL;
  
     if (!ck) return -1;
+
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
  
     if (len <= 0) return 0;
  
@@ -1251,8 +1872,7 @@ int chunk_add_strip_buffer (void * vck, void * pbuf, int64 len, char * escch, in
 
     ck->size += ent->length;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n"); 
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1260,16 +1880,82 @@ int chunk_add_strip_buffer (void * vck, void * pbuf, int64 len, char * escch, in
     return 0;
 }
 
-int chunk_remove_bufptr (void * vck, void * pbuf)
+int chunk_add_base64 (void * vck, void * vst, void * pbuf, int64 len, int last)
 {
-    chunk_t  * ck = (chunk_t *)vck;
-    ckent_t  * ent = NULL;
-    int        i, num;
-    int        rmnum = 0;
-
+    chunk_t        * ck = (chunk_t *)vck;
+    ckent_t        * ent = NULL;
+    base64_state_t   onest;
+    base64_state_t * st = (base64_state_t *)vst;
+    uint8          * pbyte = NULL;
+    int64            size, pos = 0;
+    int              step, n;
+ 
     if (!ck) return -1;
 
-    num = arr_num(ck->entity_list);
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+    if (len < 0 || (len > 0 && !pbuf)) return -2;
+ 
+    if (!st) {
+        base64_state_init(&onest);
+        st = &onest;
+        last = 1;
+    }
+
+    size = (st->carrynum + len) / 3 * 4;
+    if (last && (st->carrynum + len) % 3) size += 4;
+
+    if (size <= 0) {
+        /* too few octets for a triplet, kept in st for the next call */
+        for ( ; pos < len; pos++)
+            st->carry[st->carrynum++] = ((uint8 *)pbuf)[pos];
+        return 0;
+    }
+
+    ent = kzalloc(sizeof(*ent));
+    if (!ent) return -100;
+ 
+    ent->u.buf.pbyte = pbyte = kalloc(size + 1);
+    if (ent->u.buf.pbyte == NULL) {
+        kfree(ent);
+        return -200;
+    }
+
+    /* a multiple of 3 per step keeps the triplets aligned */
+    for (ent->length = 0; pos < len; pos += step) {
+        step = (len - pos > (3 << 28)) ? (3 << 28) : (int)(len - pos);
+
+        n = bin_to_base64_update(st, (uint8 *)pbuf + pos, step, pbyte + ent->length);
+        if (n > 0) ent->length += n;
+    }
+    if (last) ent->length += bin_to_base64_final(st, pbyte + ent->length);
+
+    ent->cktype = CKT_BUFFER;
+    pbyte[ent->length] = '\0';
+ 
+    arr_push(ck->entity_list, ent);
+    ck->bufnum++;
+
+    ck->size += ent->length;
+
+    chunk_ent_lenstr(ent);
+    strcpy(ent->trailer, "\r\n"); 
+    ent->trailerlen = 2;
+    ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+
+    return 0;
+}
+
+int chunk_remove_bufptr (void * vck, void * pbuf)
+{
+    chunk_t  * ck = (chunk_t *)vck;
+    ckent_t  * ent = NULL;
+    int        i, num;
+    int        rmnum = 0;
+
+    if (!ck) return -1;
+
+    num = arr_num(ck->entity_list);
 
     for (i = 0; i < num; i++) {
  
@@ -1281,6 +1967,7 @@ int chunk_remove_bufptr (void * vck, void * pbuf)
 
         if (pbuf == ent->u.bufptr.pbyte) {
             arr_delete(ck->entity_list, i);
+            chunk_index_trunc(ck, i);
             i--;
 
             ck->size -= ent->length;
@@ -1314,6 +2001,7 @@ int chunk_prepend_bufptr (void * vck, void * pbuf, int64 len, uint8 isheader)
     ent->u.bufptr.pbyte = pbuf;
  
     arr_insert(ck->entity_list, ent, 0);
+    chunk_index_trunc(ck, 0);
     ck->bufnum++;
 
     ck->size += len;
@@ -1323,8 +2011,7 @@ int chunk_prepend_bufptr (void * vck, void * pbuf, int64 len, uint8 isheader)
         ent->trailerlen = 0;
         ck->chunksize += ent->length;
     } else {
-        sprintf(ent->lenstr, "%llx\r\n", ent->length);
-        ent->lenstrlen = strlen(ent->lenstr);
+        chunk_ent_lenstr(ent);
         strcpy(ent->trailer, "\r\n");
         ent->trailerlen = 2;
         ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1340,6 +2027,9 @@ int chunk_add_bufptr (void * vck, void * pbuf, int64 len, void * porig)
 
     if (!ck) return -1;
 
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+
     if (len <= 0) return 0;
  
     ent = kzalloc(sizeof(*ent));
@@ -1355,8 +2045,7 @@ int chunk_add_bufptr (void * vck, void * pbuf, int64 len, void * porig)
 
     ck->size += len;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n");
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1398,6 +2087,9 @@ int chunk_add_file (void * vck, char * fname, int64 offset, int64 length, int me
 
     if (!ck) return -1;
 
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+
     if (offset < 0) offset = 0;
  
     if (file_attr(fname, &inode, &fsize, NULL, &mtime, NULL) < 0)
@@ -1421,6 +2113,7 @@ int chunk_add_file (void * vck, char * fname, int64 offset, int64 length, int me
         if (length <= 0) return 0;
 
         ent->length += length;
+        chunk_index_trunc(ck, arr_num(ck->entity_list) - 1);
 
     } else {
         ent = kzalloc(sizeof(*ent));
@@ -1447,8 +2140,7 @@ int chunk_add_file (void * vck, char * fname, int64 offset, int64 length, int me
 
     ck->size += length;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
 
     strcpy(ent->trailer, "\r\n"); 
     ent->trailerlen = 2;
@@ -1468,6 +2160,9 @@ int chunk_add_filefp (void * vck, FILE * fp, int64 offset, int64 length)
 #endif
 
     if (!ck) return -1;
+
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
     if (!fp) return -2;
 
     if (offset < 0) offset = 0;
@@ -1505,8 +2200,7 @@ int chunk_add_filefp (void * vck, FILE * fp, int64 offset, int64 length)
     ck->size += ent->length;
     ck->filenum++;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n");
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1524,6 +2218,9 @@ int chunk_add_filefd (void * vck, int fd, int64 offset, int64 length)
 #endif
  
     if (!ck) return -1;
+
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
     if (fd < 0) return -2;
  
     if (offset < 0) offset = 0;
@@ -1562,8 +2259,7 @@ int chunk_add_filefd (void * vck, int fd, int64 offset, int64 length)
     ck->size += ent->length;
     ck->filenum++;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n");
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1578,6 +2274,9 @@ int chunk_add_cbdata (void * vck, void * fetchfunc, void * fetchobj, int64 offse
     ckent_t  * ent = NULL;
 
     if (!ck) return -1;
+
+    /* the coalesced bytes go before the entity added */
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
     if (!fetchfunc) return -2;
 
     if (offset < 0) offset = 0;
@@ -1602,8 +2301,7 @@ int chunk_add_cbdata (void * vck, void * fetchfunc, void * fetchobj, int64 offse
 
     ck->size += length;
 
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-    ent->lenstrlen = strlen(ent->lenstr);
+    chunk_ent_lenstr(ent);
     strcpy(ent->trailer, "\r\n");
     ent->trailerlen = 2;
     ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
@@ -1624,6 +2322,65 @@ int chunk_add_process_notify (void * vck, void * notifyfunc, void * notifypara)
     return 0;
 }
 
+int chunk_set_coalesce (void * vck, int maxsize, int latency)
+{
+    chunk_t * ck = (chunk_t *)vck;
+
+    if (!ck) return -1;
+
+    if (ck->pendlen > 0) chunk_coalesce_flush(ck);
+    if (ck->pend) {
+        kfree(ck->pend);
+        ck->pend = NULL;
+    }
+
+    ck->pendmax = maxsize > 0 ? maxsize : 0;
+    ck->pendwait = latency > 0 ? latency : 0;
+
+    return 0;
+}
+
+int chunk_flush (void * vck)
+{
+    chunk_t * ck = (chunk_t *)vck;
+
+    if (!ck) return -1;
+
+    return chunk_coalesce_flush(ck);
+}
+
+int chunk_flush_timeout (void * vck)
+{
+    chunk_t * ck = (chunk_t *)vck;
+    long      waited = 0;
+
+    if (!ck || ck->pendlen <= 0) return -1;
+
+    waited = (btime_mono_coarse(NULL) - ck->pendtime) / 1000;
+    if (waited >= ck->pendwait) return 0;
+
+    return (int)(ck->pendwait - waited);
+}
+
+int chunk_set_mapwin (void * vck, int64 winsize, int advise)
+{
+    chunk_t * ck = (chunk_t *)vck;
+    long      pagesize = sysconf(_SC_PAGE_SIZE);
+
+    if (!ck) return -1;
+
+    if (winsize <= 0) winsize = CHUNK_MAPWIN;
+
+    /* the window starts at page boundary */
+    if (pagesize > 0)
+        winsize = (winsize + pagesize - 1) / pagesize * pagesize;
+
+    ck->mapwin = winsize;
+    ck->mapadvise = advise ? 1 : 0;
+
+    return 0;
+}
+
 int chunk_remove (void * vck, int64 pos, int httpchunk)
 {
     chunk_t * ck = (chunk_t *)vck;
@@ -1651,6 +2408,7 @@ int chunk_remove (void * vck, int64 pos, int httpchunk)
         ent = arr_value(ck->entity_list, 0);
         if (!ent) {
             arr_delete(ck->entity_list, 0);
+            chunk_index_shift(ck);
             continue;
         }
 
@@ -1685,6 +2443,7 @@ int chunk_remove (void * vck, int64 pos, int httpchunk)
         }
 
         arr_delete(ck->entity_list, 0);
+        chunk_index_shift(ck);
         chunk_entity_free(ent);
         rmnum++;
     }
@@ -1720,6 +2479,10 @@ int chunk_vec_get (void * vck, int64 offset, chunk_vec_t * pvec, int httpchunk)
     int64      bytelen = 0;
 
     if (!ck) return -1;
+
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
  
     if (!pvec) return -2;
     
@@ -1756,7 +2519,7 @@ int chunk_vec_get (void * vck, int64 offset, chunk_vec_t * pvec, int httpchunk)
     readpos = offset;
     num = arr_num(ck->entity_list);
  
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, httpchunk, &accentlen); i < num; i++) {
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
 
@@ -1952,6 +2715,10 @@ int chunk_writev (void * vck, int fd, int64 offset, int64 * actnum, int httpchun
     if (actnum) *actnum = 0;
 
     if (!ck) return -1;
+
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
  
     if (httpchunk) {
         if (offset < ck->rmchunklen)
@@ -2008,6 +2775,350 @@ int chunk_writev (void * vck, int fd, int64 offset, int64 * actnum, int httpchun
 }
 
 
+/* MSG_ZEROCOPY send of the buffers added by chunk_add_bufptr. the kernel
+ * refers to the pages of buffer until the completion is read from the
+ * error queue of socket, then porig is handed back through the release
+ * callback. the other memory of chunk is sent by copy as usual */
+
+#if defined(_LINUX_) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+
+#define CHUNK_ZC_MINSIZE  16384
+
+typedef struct zc_ref_s {
+    void      * porig;
+    uint8     * pbyte;
+    uint8     * pend;      //end of the buffer, all bytes are sent when reached
+    int64       lastseq;   //the last zerocopy send referring to it, -1 if none
+    uint8       closed;
+} ZcRef;
+
+typedef struct zc_send_s {
+    SOCKET            fd;
+    uint8             enabled;
+
+    ZeroCopyRelease * relfunc;
+    void            * relpara;
+
+    /* sequence of next zerocopy send and the completed ones below done */
+    int64             seq;
+    int64             done;
+    int64             copied;
+
+    arr_t           * reflist;
+} ZcSend;
+
+void * chunk_zc_new (SOCKET fd, ZeroCopyRelease * relfunc, void * relpara)
+{
+    ZcSend  * zc = NULL;
+#ifdef HAVE_MSG_ZEROCOPY
+    int       val = 1;
+#endif
+
+    if (fd == INVALID_SOCKET) return NULL;
+
+    zc = kzalloc(sizeof(*zc));
+    if (!zc) return NULL;
+
+    zc->fd = fd;
+    zc->relfunc = relfunc;
+    zc->relpara = relpara;
+    zc->reflist = arr_new(8);
+
+#ifdef HAVE_MSG_ZEROCOPY
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0)
+        zc->enabled = 1;
+#endif
+
+    return zc;
+}
+
+/* the references not yet released are handed back, the socket should
+ * have been closed so that kernel does not touch them anymore */
+void chunk_zc_free (void * vzc)
+{
+    ZcSend  * zc = (ZcSend *)vzc;
+    ZcRef   * ref = NULL;
+
+    if (!zc) return;
+
+    while ((ref = arr_pop(zc->reflist)) != NULL) {
+        if (zc->relfunc && ref->porig)
+            (*zc->relfunc)(zc->relpara, ref->porig);
+        kfree(ref);
+    }
+    arr_free(zc->reflist);
+
+    kfree(zc);
+}
+
+int chunk_zc_enabled (void * vzc)
+{
+    ZcSend  * zc = (ZcSend *)vzc;
+
+    return zc ? zc->enabled : 0;
+}
+
+int chunk_zc_pending (void * vzc)
+{
+    ZcSend  * zc = (ZcSend *)vzc;
+
+    return zc ? arr_num(zc->reflist) : 0;
+}
+
+static int chunk_zc_release (ZcSend * zc)
+{
+    ZcRef   * ref = NULL;
+    int       i, num = 0;
+
+    for (i = 0; i < arr_num(zc->reflist); ) {
+        ref = arr_value(zc->reflist, i);
+
+        if (ref->closed && ref->lastseq < zc->done) {
+            arr_delete(zc->reflist, i);
+
+            if (zc->relfunc && ref->porig)
+                (*zc->relfunc)(zc->relpara, ref->porig);
+            kfree(ref);
+            num++;
+            continue;
+        }
+        i++;
+    }
+
+    return num;
+}
+
+/* read zerocopy completions from the error queue. TCP reports them in order,
+ * each one covers the range of send sequence [ee_info, ee_data].
+ * return the number of buffers released */
+int chunk_zc_reap (void * vzc)
+{
+    ZcSend  * zc = (ZcSend *)vzc;
+#ifdef HAVE_MSG_ZEROCOPY
+    struct sock_extended_err * serr = NULL;
+    struct cmsghdr  * cm = NULL;
+    struct msghdr     msg;
+    uint8             control[128];
+    int               ret;
+#endif
+
+    if (!zc) return -1;
+
+#ifdef HAVE_MSG_ZEROCOPY
+    while (zc->enabled && zc->done < zc->seq) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ret = recvmsg(zc->fd, &msg, MSG_ERRQUEUE);
+        if (ret < 0) break;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            if ((int64)serr->ee_data + 1 > zc->done)
+                zc->done = (int64)serr->ee_data + 1;
+
+            /* kernel fell back to copy, zerocopy is not worth it on this path */
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->copied += (int64)serr->ee_data - serr->ee_info + 1;
+        }
+    }
+#endif
+
+    return chunk_zc_release(zc);
+}
+
+static ZcRef * chunk_zc_ref (ZcSend * zc, chunk_t * ck, void * p)
+{
+    ckent_t  * ent = NULL;
+    ZcRef    * ref = NULL;
+    uint8    * pbyte;
+    int        i, num;
+
+    for (i = arr_num(zc->reflist) - 1; i >= 0; i--) {
+        ref = arr_value(zc->reflist, i);
+        if (!ref->closed && (uint8 *)p >= ref->pbyte && (uint8 *)p < ref->pend)
+            return ref;
+    }
+
+    num = arr_num(ck->entity_list);
+    for (i = 0; i < num; i++) {
+        ent = arr_value(ck->entity_list, i);
+        if (!ent || ent->cktype != CKT_BUFFER_PTR) continue;
+
+        pbyte = (uint8 *)ent->u.bufptr.pbyte;
+        if ((uint8 *)p < pbyte || (uint8 *)p >= pbyte + ent->length)
+            continue;
+
+        ref = kzalloc(sizeof(*ref));
+        if (!ref) return NULL;
+
+        ref->porig = ent->u.bufptr.porig;
+        ref->pbyte = pbyte;
+        ref->pend = pbyte + ent->length;
+        ref->lastseq = -1;
+        arr_push(zc->reflist, ref);
+
+        return ref;
+    }
+
+    return NULL;
+}
+
+/* send iovs[0..n) by one sendmsg. return bytes sent, 0 on EAGAIN */
+static int chunk_zc_sendmsg (ZcSend * zc, struct iovec * iovs, int n, int zerocopy, int * perr)
+{
+    struct msghdr  msg;
+    int            flags = MSG_NOSIGNAL;
+    int            ret;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = n;
+
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy) flags |= MSG_ZEROCOPY;
+#endif
+
+    for ( ; ; ) {
+        ret = sendmsg(zc->fd, &msg, flags);
+        if (ret >= 0) return ret;
+
+        if (errno == EINTR) continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            return 0;
+
+        if (perr) *perr = errno;
+        return -30;
+    }
+}
+
+int chunk_writev_zc (void * vck, void * vzc, int64 offset, int64 * actnum, int httpchunk)
+{
+    chunk_t     * ck = (chunk_t *)vck;
+    ZcSend      * zc = (ZcSend *)vzc;
+    chunk_vec_t   iovec;
+    ZcRef       * refs[128];
+    ZcRef       * ref = NULL;
+    int64         pos = 0;
+    int64         num = 0;
+    int64         runlen;
+    int           ret = 0, err = 0;
+    int           i, j, k, sent, zero;
+
+    if (actnum) *actnum = 0;
+
+    if (!ck || !zc) return -1;
+
+    chunk_zc_reap(zc);
+
+    /* the pending writes are flushed and the compressed output is
+       produced as the chunk is read */
+    if (ck->pendlen > 0 || ck->zip) chunk_pull(ck, offset, httpchunk);
+
+    if (httpchunk) {
+        if (offset < ck->rmchunklen)
+            return -3;
+
+        if (offset >= ck->chunksize) {
+            if (ck->chunkendsize > 0) return -4;
+            else return 0;
+        }
+
+    } else {
+        if (offset < ck->rmentlen)
+            offset = ck->rmentlen;
+
+        if (offset >= ck->size) {
+            if (ck->endsize > 0) return -4;
+            else return 0;
+        }
+    }
+
+    pos = offset;
+
+    for ( ; chunk_get_end(ck, pos, httpchunk) == 0; ) {
+        memset(&iovec, 0, sizeof(iovec));
+        ret = chunk_vec_get(ck, pos, &iovec, httpchunk);
+
+        if (ret < 0 || (iovec.vectype != 1 && iovec.vectype != 2 && iovec.size > 0)) {
+            return ret;
+        }
+
+        if (iovec.size == 0) {
+            /* no available data to send, waiting for more data... */
+            return 0;
+        }
+
+        if (iovec.vectype == 2) { //sendfile
+            ret = tcp_sendfile(zc->fd, iovec.filefd, iovec.fpos, iovec.size, &sent, &err);
+            if (ret < 0) return -100;
+
+            pos += sent;
+            if (actnum) *actnum += sent;
+
+            if (sent < iovec.size) return 0;
+            continue;
+        }
+
+        for (i = 0; i < iovec.iovcnt; i++)
+            refs[i] = chunk_zc_ref(zc, ck, iovec.iovs[i].iov_base);
+
+        /* the run of iovs of the same kind goes in one sendmsg, the buffers
+         * of bufptr in a large run are sent with MSG_ZEROCOPY */
+        for (i = 0; i < iovec.iovcnt; i = j) {
+            runlen = iovec.iovs[i].iov_len;
+            for (j = i + 1; j < iovec.iovcnt && (refs[j] != NULL) == (refs[i] != NULL); j++)
+                runlen += iovec.iovs[j].iov_len;
+
+            zero = zc->enabled && refs[i] && runlen >= CHUNK_ZC_MINSIZE;
+
+            sent = chunk_zc_sendmsg(zc, iovec.iovs + i, j - i, zero, &err);
+            if (sent < 0) return -101;
+
+            if (sent > 0 && zero) zc->seq++;
+
+            pos += sent;
+            num = sent;
+            if (actnum) *actnum += sent;
+
+            for (k = i; k < j && num > 0; k++) {
+                ref = refs[k];
+
+                if (ref && zero) ref->lastseq = zc->seq - 1;
+
+                if ((int64)iovec.iovs[k].iov_len > num) break;
+
+                num -= iovec.iovs[k].iov_len;
+
+                if (ref && (uint8 *)iovec.iovs[k].iov_base + iovec.iovs[k].iov_len >= ref->pend)
+                    ref->closed = 1;
+            }
+
+            if (sent < runlen) {
+                chunk_zc_release(zc);
+                return 0;
+            }
+        }
+
+        chunk_zc_release(zc);
+    }
+
+    return 0;
+}
+
+
 int chunk_at (void * vck, int64 pos, int * ind)
 {
     chunk_t  * ck = (chunk_t *)vck;
@@ -2033,7 +3144,7 @@ int chunk_at (void * vck, int64 pos, int * ind)
     ck->seekpos = pos;
  
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, 0, &accentlen); i < num; i++) {
  
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -2066,70 +3177,31 @@ int chunk_at (void * vck, int64 pos, int * ind)
                 }
  
                 curpos += ent->u.filename.offset;
-                if (curpos < ent->u.filename.mapoff || 
-                    curpos >= ent->u.filename.mapoff + ent->u.filename.maplen)
-                {
-                    if (ent->u.filename.pmap != NULL) {
-                        file_munmap(ent->u.filename.pmap, ent->u.filename.maplen);
-                        ent->u.filename.pmap = NULL;
-                        ent->u.filename.pbyte = NULL;
-                    }
-                    ent->u.filename.pbyte = file_mmap(NULL, native_file_fd(ent->u.filename.hfile), 
-                                                  ent->u.filename.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.filename.pmap,
-                                                  &ent->u.filename.maplen,
-                                                  &ent->u.filename.mapoff);
-                    if (ent->u.filename.pbyte == NULL)
-                        return -100;
-                }
+                ent->u.filename.pbyte = chunk_file_map(ck, native_file_fd(ent->u.filename.hfile), curpos,
+                                                       &ent->u.filename.pmap, &ent->u.filename.maplen,
+                                                       &ent->u.filename.mapoff);
+                if (ent->u.filename.pbyte == NULL)
+                    return -100;
                 if (ind) *ind = i;
                 return ((uint8 *)ent->u.filename.pmap)[curpos - ent->u.filename.mapoff];
 
             } else if (ent->cktype == CKT_FILE_PTR) {
                 curpos += ent->u.fileptr.offset;
-                if (curpos < ent->u.fileptr.mapoff ||
-                    curpos >= ent->u.fileptr.mapoff + ent->u.fileptr.maplen)
-                {
-                    if (ent->u.fileptr.pmap != NULL) {
-                        file_munmap(ent->u.fileptr.pmap, ent->u.fileptr.maplen);
-                        ent->u.fileptr.pmap = NULL;
-                        ent->u.fileptr.pbyte = NULL;
-                    }
-                    ent->u.fileptr.pbyte = file_mmap(NULL, fileno(ent->u.fileptr.fp),
-                                                  ent->u.fileptr.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.fileptr.pmap,
-                                                  &ent->u.fileptr.maplen,
-                                                  &ent->u.fileptr.mapoff);
-                    if (ent->u.fileptr.pbyte == NULL)
-                        return -100;
-                }
+                ent->u.fileptr.pbyte = chunk_file_map(ck, fileno(ent->u.fileptr.fp), curpos,
+                                                      &ent->u.fileptr.pmap, &ent->u.fileptr.maplen,
+                                                      &ent->u.fileptr.mapoff);
+                if (ent->u.fileptr.pbyte == NULL)
+                    return -100;
                 if (ind) *ind = i;
                 return ((uint8 *)ent->u.fileptr.pmap)[curpos - ent->u.fileptr.mapoff];
 
             } else if (ent->cktype == CKT_FILE_DESC) {
                 curpos += ent->u.filefd.offset;
-                if (curpos < ent->u.filefd.mapoff ||
-                    curpos >= ent->u.filefd.mapoff + ent->u.filefd.maplen)
-                {
-                    if (ent->u.filefd.pmap != NULL) {
-                        file_munmap(ent->u.filefd.pmap, ent->u.filefd.maplen);
-                        ent->u.filefd.pmap = NULL;
-                        ent->u.filefd.pbyte = NULL;
-                    }
-                    ent->u.filefd.pbyte = file_mmap(NULL, ent->u.filefd.fd,
-                                                  ent->u.filefd.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.filefd.pmap,
-                                                  &ent->u.filefd.maplen,
-                                                  &ent->u.filefd.mapoff);
-                    if (ent->u.filefd.pbyte == NULL)
-                        return -100;
-                }
+                ent->u.filefd.pbyte = chunk_file_map(ck, ent->u.filefd.fd, curpos,
+                                                     &ent->u.filefd.pmap, &ent->u.filefd.maplen,
+                                                     &ent->u.filefd.mapoff);
+                if (ent->u.filefd.pbyte == NULL)
+                    return -100;
                 if (ind) *ind = i;
                 return ((uint8 *)ent->u.filefd.pmap)[curpos - ent->u.filefd.mapoff];
  
@@ -2180,7 +3252,7 @@ void * chunk_ptr (void * vck, int64 pos, int * ind, void ** ppbuf, int64 * plen)
     ck->seekpos = pos;
  
     num = arr_num(ck->entity_list);
-    for (i = 0; i < num; i++) {
+    for (i = chunk_ent_locate(ck, readpos, 0, &accentlen); i < num; i++) {
  
         ent = arr_value(ck->entity_list, i);
         if (!ent) continue;
@@ -2219,24 +3291,11 @@ void * chunk_ptr (void * vck, int64 pos, int * ind, void ** ppbuf, int64 * plen)
                 }
  
                 curpos += ent->u.filename.offset;
-                if (curpos < ent->u.filename.mapoff ||
-                    curpos >= ent->u.filename.mapoff + ent->u.filename.maplen)
-                {
-                    if (ent->u.filename.pmap != NULL) {
-                        file_munmap(ent->u.filename.pmap, ent->u.filename.maplen);
-                        ent->u.filename.pmap = NULL;
-                        ent->u.filename.pbyte = NULL;
-                    }
-                    ent->u.filename.pbyte = file_mmap(NULL, native_file_fd(ent->u.filename.hfile),
-                                                  ent->u.filename.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.filename.pmap,
-                                                  &ent->u.filename.maplen,
-                                                  &ent->u.filename.mapoff);
-                    if (ent->u.filename.pbyte == NULL)
-                        return NULL;
-                }
+                ent->u.filename.pbyte = chunk_file_map(ck, native_file_fd(ent->u.filename.hfile), curpos,
+                                                       &ent->u.filename.pmap, &ent->u.filename.maplen,
+                                                       &ent->u.filename.mapoff);
+                if (ent->u.filename.pbyte == NULL)
+                    return NULL;
 
                 if (curlen > ent->u.filename.maplen - (curpos - ent->u.filename.mapoff))
                     curlen = ent->u.filename.maplen - (curpos - ent->u.filename.mapoff);
@@ -2248,24 +3307,11 @@ void * chunk_ptr (void * vck, int64 pos, int * ind, void ** ppbuf, int64 * plen)
  
             } else if (ent->cktype == CKT_FILE_PTR) {
                 curpos += ent->u.fileptr.offset;
-                if (curpos < ent->u.fileptr.mapoff ||
-                    curpos >= ent->u.fileptr.mapoff + ent->u.fileptr.maplen)
-                {
-                    if (ent->u.fileptr.pmap != NULL) {
-                        file_munmap(ent->u.fileptr.pmap, ent->u.fileptr.maplen);
-                        ent->u.fileptr.pmap = NULL;
-                        ent->u.fileptr.pbyte = NULL;
-                    }
-                    ent->u.fileptr.pbyte = file_mmap(NULL, fileno(ent->u.fileptr.fp),
-                                                  ent->u.fileptr.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.fileptr.pmap,
-                                                  &ent->u.fileptr.maplen,
-                                                  &ent->u.fileptr.mapoff);
-                    if (ent->u.fileptr.pbyte == NULL)
-                        return NULL;
-                }
+                ent->u.fileptr.pbyte = chunk_file_map(ck, fileno(ent->u.fileptr.fp), curpos,
+                                                      &ent->u.fileptr.pmap, &ent->u.fileptr.maplen,
+                                                      &ent->u.fileptr.mapoff);
+                if (ent->u.fileptr.pbyte == NULL)
+                    return NULL;
 
                 if (curlen > ent->u.fileptr.maplen - (curpos - ent->u.fileptr.mapoff))
                     curlen = ent->u.fileptr.maplen - (curpos - ent->u.fileptr.mapoff);
@@ -2277,24 +3323,11 @@ void * chunk_ptr (void * vck, int64 pos, int * ind, void ** ppbuf, int64 * plen)
  
             } else if (ent->cktype == CKT_FILE_DESC) {
                 curpos += ent->u.filefd.offset;
-                if (curpos < ent->u.filefd.mapoff ||
-                    curpos >= ent->u.filefd.mapoff + ent->u.filefd.maplen)
-                {
-                    if (ent->u.filefd.pmap != NULL) {
-                        file_munmap(ent->u.filefd.pmap, ent->u.filefd.maplen);
-                        ent->u.filefd.pmap = NULL;
-                        ent->u.filefd.pbyte = NULL;
-                    }
-                    ent->u.filefd.pbyte = file_mmap(NULL, ent->u.filefd.fd,
-                                                  ent->u.filefd.offset + curpos,
-                                                  2048*1024,
-                                                  PROT_READ, MAP_SHARED,
-                                                  &ent->u.filefd.pmap,
-                                                  &ent->u.filefd.maplen,
-                                                  &ent->u.filefd.mapoff);
-                    if (ent->u.filefd.pbyte == NULL)
-                        return NULL;
-                }
+                ent->u.filefd.pbyte = chunk_file_map(ck, ent->u.filefd.fd, curpos,
+                                                     &ent->u.filefd.pmap, &ent->u.filefd.maplen,
+                                                     &ent->u.filefd.mapoff);
+                if (ent->u.filefd.pbyte == NULL)
+                    return NULL;
 
                 if (curlen > ent->u.filefd.maplen - (curpos - ent->u.filefd.mapoff))
                     curlen = ent->u.filefd.maplen - (curpos - ent->u.filefd.mapoff);
@@ -2351,44 +3384,66 @@ int chunk_char (void * vck, int64 pos, ckpos_vec_t * pvec, int * pind)
 }
  
 
+/* scan the memory pieces of chunk forward by the set scanners. mode 0 skips
+ * to the set, 1 skips over the set, 2 skips to the set with escaping */
+static int64 chunk_scan (chunk_t * ck, int64 pos, int64 fsize, chset_t * set, int mode)
+{
+    uint8    * pbuf = NULL;
+    int64      plen = 0;
+    int64      i = 0;
+    int        n, r;
+
+    while (i < fsize) {
+        if (chunk_ptr(ck, pos + i, NULL, (void **)&pbuf, &plen) == NULL || plen <= 0)
+            break;
+
+        if (plen > fsize - i) plen = fsize - i;
+        n = plen > 0x7FFFFFFF ? 0x7FFFFFFF : (int)plen;
+
+        if (mode == 1)
+            r = (uint8 *)skip_over_set(pbuf, n, set) - pbuf;
+        else if (mode == 2)
+            r = (uint8 *)skip_esc_to_set(pbuf, n, set) - pbuf;
+        else
+            r = (uint8 *)skip_to_set(pbuf, n, set) - pbuf;
+
+        i += r;
+        if (r < n) break;
+    }
+
+    return pos + i;
+}
+
 int64 chunk_skip_to (void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
-    int64      i = 0, fsize;
-
-    ckpos_vec_t posvec = {0};
+    chset_t    set;
+    int64      fsize;
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
     if (pos >= ck->size) return ck->size;
  
     fsize = ck->size - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    chset_init(&set, vpat, patlen);
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
-    }
- 
-    return pos + i;
+    return chunk_scan(ck, pos, fsize, &set, 0);
 }
 
 int64  chunk_rskip_to(void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
+    chset_t    set;
+    int        fch = 0;
     int64      i = 0;
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     if (pos < ck->rmentlen) return ck->rmentlen;
     if (pos >= ck->size) pos = ck->size - 1;
@@ -2400,9 +3455,7 @@ int64  chunk_rskip_to(void * vck, int64 pos, int64 skiplimit, void * vpat, int p
         fch = chunk_at(ck, pos - i, NULL);
         if (fch < 0) break;
  
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos - i;
-        }
+        if (chset_has(&set, fch)) return pos - i;
     }
  
     return pos - i;
@@ -2411,43 +3464,33 @@ int64  chunk_rskip_to(void * vck, int64 pos, int64 skiplimit, void * vpat, int p
 int64 chunk_skip_over (void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
-    int64      i = 0, fsize;
- 
-    ckpos_vec_t posvec = {0};
+    chset_t    set;
+    int64      fsize;
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
     if (pos >= ck->size) return ck->size;
  
     fsize = ck->size - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    chset_init(&set, vpat, patlen);
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
-
-        if (j >= patlen) return pos + i;
-    }
- 
-    return pos + i;
+    return chunk_scan(ck, pos, fsize, &set, 1);
 }
 
 int64 chunk_rskip_over(void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
+    chset_t    set;
+    int        fch = 0;
     int64      i = 0;
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     if (pos <= ck->rmentlen) return ck->rmentlen;
     if (pos >= ck->size) pos = ck->size - 1;
@@ -2459,11 +3502,7 @@ int64 chunk_rskip_over(void * vck, int64 pos, int64 skiplimit, void * vpat, int
         fch = chunk_at(ck, pos - i, NULL);
         if (fch < 0) break;
  
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
-
-        if (j >= patlen) return pos - i;
+        if (!chset_has(&set, fch)) return pos - i;
     }
  
     return pos - i;
@@ -2500,14 +3539,16 @@ static int64 chunk_qstrlen (void * vck, int64 pos, int64 skiplimit)
 int64 chunk_skip_quote_to(void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    int        j, fch = 0;
-    uint8    * pat = (uint8 *)vpat;
+    chset_t    set;
+    int        fch = 0;
     int64      fsize = 0, i, qlen;
 
     ckpos_vec_t posvec = {0};
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     fsize = ck->size - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
@@ -2522,9 +3563,7 @@ int64 chunk_skip_quote_to(void * vck, int64 pos, int64 skiplimit, void * vpat, i
             continue;
         }
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
+        if (chset_has(&set, fch)) return pos + i;
  
         if (fch == '"' || fch == '\'') {
             qlen = chunk_qstrlen(ck, pos + i, fsize - i);
@@ -2540,46 +3579,71 @@ int64 chunk_skip_quote_to(void * vck, int64 pos, int64 skiplimit, void * vpat, i
 int64 chunk_skip_esc_to  (void * vck, int64 pos, int64 skiplimit, void * vpat, int patlen)
 {
     chunk_t  * ck = (chunk_t *)vck;
-    uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
-    int64      i = 0, fsize;
- 
-    ckpos_vec_t posvec = {0};
+    chset_t    set;
+    int64      fsize;
  
     if (!ck) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
     if (pos >= ck->size) return ck->size;
  
     fsize = ck->size - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    chset_init(&set, vpat, patlen);
 
-        if (fch == '\\') {
-            i++;
-            continue;
+    return chunk_scan(ck, pos, fsize, &set, 2);
+}
+
+/* search pattern in the contiguous memory pieces of chunk by pat_find.
+ * the matches crossing the end of a piece are checked byte by byte over
+ * the last patlen - 1 positions of it */
+static int64 chunk_pat_find (chunk_t * ck, int64 pos, uint8 * pat, int patlen, int * pind)
+{
+    ckpos_vec_t    posvec = {0};
+    uint8        * pbuf = NULL;
+    uint8        * p = NULL;
+    int64          buflen = 0;
+    int64          edge = 0;
+    int            ind = 0;
+    int            i;
+
+    while (pos <= ck->size - patlen) {
+        if (chunk_ptr(ck, pos, &ind, (void **)&pbuf, &buflen) == NULL || buflen <= 0)
+            return -100;
+
+        if (buflen > ck->size - pos) buflen = ck->size - pos;
+        if (buflen > 0x7FFFFFFF) buflen = 0x7FFFFFFF;
+
+        if (buflen >= patlen) {
+            p = pat_find(pbuf, (int)buflen, pat, patlen);
+            if (p) {
+                if (pind) *pind = ind;
+                return pos + (p - pbuf);
+            }
+            edge = pos + buflen - patlen + 1;
+        } else {
+            edge = pos;
         }
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
+        /* chunk_ptr may have remapped the file piece cached in posvec */
+        memset(&posvec, 0, sizeof(posvec));
+
+        for (pos += buflen; edge < pos && edge <= ck->size - patlen; edge++) {
+            for (i = 0; i < patlen && pat[i] == chunk_char(ck, edge + i, &posvec, pind); i++);
+            if (i >= patlen) return edge;
         }
     }
- 
-    return pos + i;
+
+    return -100;
 }
 
+/* pvec is kept for the compatibility of callers, the search is done by
+ * pat_find on each memory piece of the chunk */
 int64 sun_find_chunk (void * vck, int64 pos, void * pattern, int patlen, void * pvec, int * pind)
 {
     chunk_t      * ck = (chunk_t *)vck;
     uint8        * pat = (uint8 *)pattern;
-    pat_sunvec_t * patvec = (pat_sunvec_t *)pvec;
-    uint8          alloc = 0;
-    int            i = 0;
-    uint8          matchfound = 0;
-    ckpos_vec_t    posvec = {0};
  
     if (!ck) return -1;
 
@@ -2594,43 +3658,13 @@ int64 sun_find_chunk (void * vck, int64 pos, void * pattern, int patlen, void *
     if (patlen > chunk_rest_size(ck, 0))
         return -4;
  
-    if (!patvec) {
-        patvec = pat_sunvec_alloc(pat, patlen, 0);
-        alloc = 1;
-    }
- 
-    if (!patvec) return -10;
- 
-    for ( ; pos <= ck->size - patlen; ) {
- 
-        for (i = 0; i < patlen && pat[i] == chunk_char(ck, i + pos, &posvec, pind); i++);
- 
-        if (i >= patlen) {
-            matchfound = 1;
-            break;
- 
-        } else {
-            pos += patlen - patvec->chloc[ chunk_char(ck, pos + patlen, &posvec, pind) ];
-        }
-    }
- 
-    if (alloc) pat_sunvec_free(patvec);
- 
-    if (matchfound)
-        return pos;
- 
-    return -100;
+    return chunk_pat_find(ck, pos, pat, patlen, pind);
 }
 
 int64 bm_find_chunk (void * vck, int64 pos, void * pattern, int patlen, void * pvec, int * pind)
 {
     chunk_t     * ck = (chunk_t *)vck;
     uint8       * pat = (uint8 *)pattern;
-    pat_bmvec_t * patvec = (pat_bmvec_t *)pvec;
-    uint8         alloc = 0;
-    int           i = 0;
-    uint8         matchfound = 0;
-    ckpos_vec_t   posvec = {0};
  
     if (!ck) return -1;
  
@@ -2645,33 +3679,7 @@ int64 bm_find_chunk (void * vck, int64 pos, void * pattern, int patlen, void * p
     if (patlen > chunk_rest_size(ck, 0))
         return -4;
  
-    if (!patvec) {
-        patvec = pat_bmvec_alloc(pat, patlen, 0);
-        alloc = 1;
-    }
- 
-    if (!patvec) return -10;
- 
-    for ( ; pos < ck->size - patlen; ) {
-        for (i = patlen - 1;
-             i >= 0 && pat[i] == chunk_char(ck, pos + i, &posvec, pind);
-             i--);
- 
-        if (i < 0) {
-            matchfound = 1;
-            break;
-        } else {
-            pos += max( patvec->goodsuff[i],
-                        patvec->badch[ chunk_char(ck, pos + i, &posvec, pind) ] - patlen + 1 + i );
-        }
-    }
- 
-    if (alloc) pat_bmvec_free(patvec);
- 
-    if (matchfound)
-        return pos;
- 
-    return -100;
+    return chunk_pat_find(ck, pos, pat, patlen, pind);
 }
 
 int64 kmp_find_chunk (void * vck, int64 pos, void * pattern, int patlen, void * pvec, int * pind)
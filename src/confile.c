@@ -9,6 +9,7 @@
 #include "dynarr.h"
 #include "fileop.h"
 #include "strutil.h"
+#include "epoch.h"
 
 #ifdef UNIX
 #include <sys/stat.h>
@@ -119,8 +120,13 @@ typedef struct _ConfMgmt {
     CFGLine     default_sect;
 
     hashtab_t * sect_table;
+
+    /* table of typed values built by conf_compile */
+    void      * ctab;
 } ConfMgmt;
 
+static void conf_tab_free (void * vtab);
+
 
 void  * conf_mgmt_init (char * file)
 {
@@ -165,6 +171,8 @@ int conf_mgmt_cleanup (void * vconf)
 
     ht_free(conf->sect_table);
 
+    conf_tab_free(conf->ctab);
+
     kfree(conf);
     return 0;
 }
@@ -653,3 +661,372 @@ int conf_set_bool(void * vconf, char * sect, char * key, uint8 value)
     return 0;
 }
 
+
+/* compiled table of the (sect, key) visible to conf_get_xxx, each value is
+ * parsed into all the types once. the handle is the index of the value */
+
+#define CONF_TAB_SEED  0x243F6A8885A308D3ULL
+
+typedef struct conf_value_ {
+    char      * sect;
+    char      * key;
+    uint64      hash;
+
+    uint8       exist;
+    uint8       bval;
+    char      * str;
+    int         ival;
+    uint32      ulval;
+    long        hexval;
+    double      dval;
+} ConfValue;
+
+typedef struct conf_tab_ {
+    ConfValue * val;
+    int         num;
+
+    /* open addressing index, slot holds value index + 1 */
+    uint32    * slot;
+    uint32      mask;
+} ConfTab;
+
+static uint64 conf_tab_hash (char * sect, char * key)
+{
+    uint64  seed = CONF_TAB_SEED;
+
+    if (sect) seed = wy_hash_nocase(sect, strlen(sect), seed);
+
+    return wy_hash_nocase(key, strlen(key), seed);
+}
+
+/* return the slot of (sect, key) or the empty slot where it goes */
+static uint32 conf_tab_slot (ConfTab * tab, char * sect, char * key, uint64 hash)
+{
+    ConfValue * v = NULL;
+    uint32      i;
+
+    for (i = (uint32)hash & tab->mask; tab->slot[i]; i = (i + 1) & tab->mask) {
+        v = &tab->val[tab->slot[i] - 1];
+        if (v->hash != hash || strcasecmp(v->key, key) != 0) continue;
+
+        if (!v->sect && !sect) break;
+        if (v->sect && sect && strcasecmp(v->sect, sect) == 0) break;
+    }
+
+    return i;
+}
+
+static void conf_tab_free (void * vtab)
+{
+    ConfTab  * tab = (ConfTab *)vtab;
+    int        i;
+
+    if (!tab) return;
+
+    for (i = 0; i < tab->num; i++) {
+        if (tab->val[i].sect) kfree(tab->val[i].sect);
+        if (tab->val[i].key) kfree(tab->val[i].key);
+        if (tab->val[i].str) kfree(tab->val[i].str);
+    }
+
+    if (tab->val) kfree(tab->val);
+    if (tab->slot) kfree(tab->slot);
+
+    kfree(tab);
+}
+
+static ConfValue * conf_tab_add (ConfTab * tab, char * sect, char * key, uint64 hash, uint32 islot)
+{
+    ConfValue * v = &tab->val[tab->num];
+
+    v->sect = sect ? str_dup(sect, strlen(sect)) : NULL;
+    v->key = str_dup(key, strlen(key));
+    if ((sect && !v->sect) || !v->key) return NULL;
+
+    v->hash = hash;
+    tab->slot[islot] = ++tab->num;
+
+    return v;
+}
+
+static int conf_value_parse (ConfValue * v, char * value)
+{
+    v->str = str_dup(value, strlen(value));
+    if (!v->str) return -1;
+
+    if (strlen(value) >= 2 && strncasecmp(value, "0x", 2) == 0) {
+        v->ival = strtol(value + 2, NULL, 16);
+        v->ulval = strtol(value + 2, NULL, 16);
+    } else {
+        v->ival = atoi(value);
+        v->ulval = strtoul(value, (char **)NULL, 10);
+    }
+
+    v->hexval = strtol(value, (char **)NULL, 16);
+    v->dval = strtod(value, (char **)NULL);
+
+    v->bval = (strcasecmp(value, "yes") == 0 ||
+               strcasecmp(value, "true") == 0 ||
+               strcasecmp(value, "1") == 0) ? 1 : 0;
+
+    v->exist = 1;
+    return 0;
+}
+
+/* the keys of prev keep their indices, the ones no longer in conf are kept
+ * as missing, so the handles got from prev stay valid on the new table */
+static ConfTab * conf_tab_build (ConfMgmt * conf, ConfTab * prev)
+{
+    ConfTab   * tab = NULL;
+    ConfValue * v = NULL;
+    CFGLine   * line = NULL;
+    CFGLine   * sect = NULL;
+    uint64      hash;
+    uint32      size = 16, j;
+    int         i, num, cap;
+
+    num = arr_num(conf->line_list);
+    cap = num + (prev ? prev->num : 0);
+
+    tab = kzalloc(sizeof(*tab));
+    if (!tab) return NULL;
+
+    while (size < (uint32)cap * 2) size <<= 1;
+    tab->mask = size - 1;
+
+    tab->val = kzalloc(sizeof(ConfValue) * (cap + 1));
+    tab->slot = kzalloc(sizeof(uint32) * size);
+    if (!tab->val || !tab->slot) goto nomem;
+
+    for (i = 0; prev && i < prev->num; i++) {
+        v = &prev->val[i];
+        j = conf_tab_slot(tab, v->sect, v->key, v->hash);
+        if (!conf_tab_add(tab, v->sect, v->key, v->hash, j)) goto nomem;
+    }
+
+    for (i = 0; i < num; i++) {
+        line = (CFGLine *)arr_value(conf->line_list, i);
+        if (!line) continue;
+
+        if (line->cfgtype == CFGTYPE_SECTION || line->cfgtype == CFGTYPE_SECTION_CMT) {
+            sect = line;
+            continue;
+        }
+
+        if (line->cfgtype != CFGTYPE_ITEM && line->cfgtype != CFGTYPE_ITEM_CMT)
+            continue;
+
+        /* only the lines found by conf_get_xxx, the first of the duplicated
+         * sections or keys */
+        if (!sect || !line->key || !line->value) continue;
+        if (ht_get(conf->sect_table, sect->key) != sect) continue;
+        if (ht_get(sect->htsect, line->key) != line) continue;
+
+        hash = conf_tab_hash(sect->key, line->key);
+        j = conf_tab_slot(tab, sect->key, line->key, hash);
+
+        if (tab->slot[j]) {
+            v = &tab->val[tab->slot[j] - 1];
+            if (v->exist) continue;
+        } else {
+            v = conf_tab_add(tab, sect->key, line->key, hash, j);
+            if (!v) goto nomem;
+        }
+
+        if (conf_value_parse(v, line->value) < 0) goto nomem;
+    }
+
+    return tab;
+
+nomem:
+    if (tab->val) tab->num = cap;
+    conf_tab_free(tab);
+    return NULL;
+}
+
+int conf_compile (void * vconf)
+{
+    ConfMgmt * conf = (ConfMgmt *)vconf;
+    ConfTab  * tab = NULL;
+
+    if (!conf) return -1;
+
+    tab = conf_tab_build(conf, conf->ctab);
+    if (!tab) return -100;
+
+    conf_tab_free(conf->ctab);
+    conf->ctab = tab;
+
+    return tab->num;
+}
+
+conf_handle_t conf_lookup (void * vconf, char * sect, char * key)
+{
+    ConfMgmt * conf = (ConfMgmt *)vconf;
+    ConfTab  * tab = NULL;
+    uint32     j;
+
+    if (!conf || !key) return -1;
+
+    tab = conf->ctab;
+    if (!tab) return -2;
+
+    j = conf_tab_slot(tab, sect, key, conf_tab_hash(sect, key));
+    if (!tab->slot[j]) return -3;
+
+    return tab->slot[j] - 1;
+}
+
+static ConfValue * conf_value_get (void * vconf, conf_handle_t h)
+{
+    ConfMgmt * conf = (ConfMgmt *)vconf;
+    ConfTab  * tab = NULL;
+
+    if (!conf || h < 0) return NULL;
+
+    tab = conf->ctab;
+    if (!tab || h >= tab->num || !tab->val[h].exist) return NULL;
+
+    return &tab->val[h];
+}
+
+char * conf_hget_string (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->str : NULL;
+}
+
+int conf_hget_int (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->ival : -1;
+}
+
+uint32 conf_hget_ulong (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->ulval : 0;
+}
+
+long conf_hget_hexlong (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->hexval : -1;
+}
+
+double conf_hget_double (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->dval : 0.;
+}
+
+uint8 conf_hget_bool (void * vconf, conf_handle_t h)
+{
+    ConfValue * v = conf_value_get(vconf, h);
+
+    return v ? v->bval : 0;
+}
+
+
+typedef struct conf_snap_ {
+    void      * epoch;
+    void      * conf;
+} ConfSnap;
+
+void * conf_snap_new (char * file)
+{
+    ConfSnap * snap = NULL;
+
+    snap = kzalloc(sizeof(*snap));
+    if (!snap) return NULL;
+
+    snap->epoch = epoch_new();
+    snap->conf = conf_mgmt_init(file);
+
+    if (!snap->epoch || !snap->conf || conf_compile(snap->conf) < 0) {
+        conf_snap_free(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+int conf_snap_free (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return -1;
+
+    if (snap->epoch) epoch_free(snap->epoch);
+    if (snap->conf) conf_mgmt_cleanup(snap->conf);
+
+    kfree(snap);
+    return 0;
+}
+
+int conf_snap_reload (void * vsnap, char * file)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+    ConfMgmt * conf = NULL;
+    ConfMgmt * cur = NULL;
+    char       fname[128];
+    int        ret;
+
+    if (!snap) return -1;
+
+    if (!file) {
+        epoch_enter(snap->epoch);
+        cur = epoch_deref(&snap->conf);
+        strncpy(fname, cur->confile, sizeof(fname)-1);
+        fname[sizeof(fname)-1] = '\0';
+        epoch_leave(snap->epoch);
+        file = fname;
+    }
+
+    conf = conf_mgmt_init(NULL);
+    if (!conf) return -100;
+
+    ret = conf_mgmt_read(conf, file);
+    if (ret < 0) {
+        conf_mgmt_cleanup(conf);
+        return ret;
+    }
+
+    /* the handles got from the current conf stay valid on the new one */
+    epoch_enter(snap->epoch);
+    cur = epoch_deref(&snap->conf);
+    conf->ctab = conf_tab_build(conf, cur->ctab);
+    epoch_leave(snap->epoch);
+
+    if (!conf->ctab) {
+        conf_mgmt_cleanup(conf);
+        return -100;
+    }
+
+    return epoch_publish(snap->epoch, &snap->conf, conf, conf_mgmt_cleanup);
+}
+
+void * conf_snap_enter (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return NULL;
+
+    epoch_enter(snap->epoch);
+
+    return epoch_deref(&snap->conf);
+}
+
+void conf_snap_leave (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return;
+
+    epoch_leave(snap->epoch);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "dabuild.h"
+
+
+static void dab_unlink (dabuild_t * bd, int pos)
+{
+    int32  prev = bd->prevfree[pos];
+    int32  next = bd->nextfree[pos];
+
+    if (prev >= 0) bd->nextfree[prev] = next;
+    else bd->freehead = next;
+
+    if (next >= 0) bd->prevfree[next] = prev;
+    else bd->freetail = prev;
+
+    bd->nextfree[pos] = bd->prevfree[pos] = -1;
+}
+
+static void dab_use (dabuild_t * bd, int pos)
+{
+    bd->used[pos] = 1;
+
+    if (bd->nextfree[pos] >= 0 || bd->prevfree[pos] >= 0 || bd->freehead == pos)
+        dab_unlink(bd, pos);
+}
+
+int dab_init (dabuild_t * bd, int extnum, int32 * extinit)
+{
+    int   i;
+
+    if (!bd) return -1;
+    if (extnum < 0 || extnum > DAB_MAXEXT) return -2;
+
+    memset(bd, 0, sizeof(*bd));
+
+    bd->extnum = extnum;
+    for (i = 0; i < extnum; i++)
+        bd->extinit[i] = extinit ? extinit[i] : 0;
+
+    bd->freehead = bd->freetail = -1;
+
+    if (dab_grow(bd, 1024) < 0) {
+        dab_free(bd);
+        return -3;
+    }
+
+    dab_use(bd, 0);
+
+    return 0;
+}
+
+void dab_free (dabuild_t * bd)
+{
+    int   i;
+
+    if (!bd) return;
+
+    if (bd->unit) kfree(bd->unit);
+    for (i = 0; i < bd->extnum; i++) {
+        if (bd->ext[i]) kfree(bd->ext[i]);
+    }
+
+    if (bd->used) kfree(bd->used);
+    if (bd->tried) kfree(bd->tried);
+    if (bd->nextfree) kfree(bd->nextfree);
+    if (bd->prevfree) kfree(bd->prevfree);
+
+    memset(bd, 0, sizeof(*bd));
+}
+
+int dab_grow (dabuild_t * bd, int64 need)
+{
+    int64    size = 0;
+    int      i, k;
+    void   * p = NULL;
+
+    if (need < bd->size) return 0;
+
+    for (size = bd->size > 0 ? bd->size : 1024; size <= need; size *= 2);
+
+    if (size > (1 << 30)) return -1;
+
+    if ((p = krealloc(bd->unit, size * sizeof(daunit_t))) == NULL) return -2;
+    bd->unit = p;
+
+    for (k = 0; k < bd->extnum; k++) {
+        if ((p = krealloc(bd->ext[k], size * sizeof(int32))) == NULL) return -2;
+        bd->ext[k] = p;
+    }
+
+    if ((p = krealloc(bd->used, size)) == NULL) return -2;
+    bd->used = p;
+    if ((p = krealloc(bd->tried, size)) == NULL) return -2;
+    bd->tried = p;
+    if ((p = krealloc(bd->nextfree, size * sizeof(int32))) == NULL) return -2;
+    bd->nextfree = p;
+    if ((p = krealloc(bd->prevfree, size * sizeof(int32))) == NULL) return -2;
+    bd->prevfree = p;
+
+    for (i = bd->size; i < size; i++) {
+        bd->unit[i].base = 0;
+        bd->unit[i].check = -1;
+
+        for (k = 0; k < bd->extnum; k++)
+            bd->ext[k][i] = bd->extinit[k];
+
+        bd->used[i] = 0;
+        bd->tried[i] = 0;
+
+        /* append to the tail of free list */
+        bd->nextfree[i] = -1;
+        bd->prevfree[i] = bd->freetail;
+        if (bd->freetail >= 0) bd->nextfree[bd->freetail] = i;
+        else bd->freehead = i;
+        bd->freetail = i;
+    }
+
+    bd->size = size;
+    return 0;
+}
+
+int dab_place (dabuild_t * bd, int parent, int * codes, int num)
+{
+    int    pos, next, base, i;
+    int    oldsize;
+
+    if (!bd || !codes) return -1;
+
+    if (num <= 0) {
+        bd->unit[parent].base = 0;
+        return 0;
+    }
+
+    for (pos = bd->freehead; ; pos = next) {
+        if (pos < 0) {
+            /* no free slot fits, the new slots appended are all free */
+            oldsize = bd->size;
+            if (dab_grow(bd, bd->size) < 0) return -2;
+            pos = oldsize;
+        }
+
+        if (pos <= codes[0]) {
+            next = bd->nextfree[pos];
+            continue;
+        }
+
+        base = pos - codes[0];
+        if (dab_grow(bd, (int64)base + codes[num - 1]) < 0) return -2;
+
+        next = bd->nextfree[pos];
+
+        for (i = 1; i < num; i++) {
+            if (bd->used[base + codes[i]]) break;
+        }
+        if (i >= num) break;
+
+        if (++bd->tried[pos] >= DAB_MAXTRY)
+            dab_unlink(bd, pos);
+    }
+
+    for (i = 0; i < num; i++) {
+        dab_use(bd, base + codes[i]);
+        bd->unit[base + codes[i]].check = parent;
+    }
+
+    bd->unit[parent].base = base;
+
+    if (base + codes[num - 1] > bd->maxslot) bd->maxslot = base + codes[num - 1];
+    if (base > bd->maxbase) bd->maxbase = base;
+
+    return base;
+}
+
+int dab_size (dabuild_t * bd, int maxcode)
+{
+    int   size;
+
+    if (!bd) return 0;
+
+    size = bd->maxslot + 1;
+    if (size < bd->maxbase + maxcode + 1) size = bd->maxbase + maxcode + 1;
+    if (size < maxcode + 1) size = maxcode + 1;
+
+    return size;
+}
+
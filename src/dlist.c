@@ -31,8 +31,13 @@ static dnode_t * getNode (dlist_t * lt, int loc)
 
     if (loc < 0 || loc > lt->num - 1) return NULL;
 
-    for (i = 0, node = lt->first; i < loc; i++) {
-        node = node->next;
+    /* walk from the nearer end of the list */
+    if (loc <= lt->num / 2) {
+        for (i = 0, node = lt->first; i < loc; i++)
+            node = node->next;
+    } else {
+        for (i = lt->num - 1, node = lt->last; i > loc; i--)
+            node = node->prev;
     }
 
     return node;
@@ -702,8 +707,7 @@ void * lt_get (dlist_t * lt, int loc)
     if (!lt || lt->num == 0 || loc < 0 || loc >= lt->num)
     return NULL;
 
-    ret = lt->first;
-    while (loc--) ret = ret->next;
+    ret = getNode(lt, loc);
 
     return ret;
 }
@@ -716,8 +720,7 @@ void * lt_value (dlist_t * lt, int loc)
     if (!lt || lt->num == 0 || loc < 0 || loc >= lt->num)
         return NULL;
 
-    ret = lt->first;
-    while (loc--) ret = ret->next;
+    ret = getNode(lt, loc);
 
     return ret;
 }
@@ -0,0 +1,1114 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "dynarr.h"
+#include "hashtab.h"
+#include "btime.h"
+#include "tsock.h"
+#include "trace.h"
+#include "dnsres.h"
+
+#ifdef UNIX
+
+#include <fcntl.h>
+#include <poll.h>
+
+#define DNS_SHARDS      16
+#define DNS_SHARD_MAX   4096      /* names cached in one shard */
+#define DNS_ADDR_MAX    16        /* addresses kept of one family */
+#define DNS_NAME_MAX    253
+#define DNS_PKT_MAX     4096
+
+#define DNS_T_A         1
+#define DNS_T_AAAA      28
+#define DNS_C_IN        1
+
+#define DNS_RCODE_SERVFAIL  2
+#define DNS_RCODE_NXDOMAIN  3
+#define DNS_RCODE_REFUSED   5
+
+/* the addresses of one name, as cached or being collected by a query */
+typedef struct dns_entry_s {
+    char     name[DNS_NAME_MAX + 3];
+    int64    expire;              /* monotonic microseconds, 0 never */
+    int      err;
+    int      num4;
+    int      num6;
+    uint8    addr4[DNS_ADDR_MAX][4];
+    uint8    addr6[DNS_ADDR_MAX][16];
+} DnsEntry;
+
+typedef struct dns_shard_s {
+    CRITICAL_SECTION   lock;
+    hashtab_t        * cache;
+} DnsShard;
+
+typedef struct dns_waiter_s {
+    DnsResolveCB     * cb;
+    void             * para;
+    int                port;
+    int                socktype;
+} DnsWaiter;
+
+/* the A and AAAA queries of one name in flight, the lookups of the name
+ * wait on it meanwhile */
+typedef struct dns_query_s {
+    DnsEntry           ent;       /* the first member, as cmp of pending */
+    uint16             id[2];
+    uint8              done[2];
+    int                err[2];
+    uint32             minttl;
+    int                tries;
+    int                nsidx;
+    int64              deadline;
+    arr_t            * waiters;
+} DnsQuery;
+
+typedef struct dns_res_s {
+    DnsShard           shard[DNS_SHARDS];
+    uint64             seed;
+    uint64             rnd;
+
+    ep_sockaddr_t      ns[DNS_NS_MAX];
+    int                nsnum;
+    int                nsuser;    /* given by dns_nameserver_add */
+
+    int                timeout;   /* milli-seconds of one try */
+    int                retries;
+    int                negttl;
+    int                maxttl;
+
+    SOCKET             fd4;
+    SOCKET             fd6;
+    int                wakefd[2];
+
+    CRITICAL_SECTION   qlock;
+    hashtab_t        * pending;   /* queries by name */
+    DnsQuery        ** idtab;     /* queries by id of 16 bits */
+    arr_t            * qlist;
+
+    pthread_t          thread;
+    int                running;
+    int                quit;
+} DnsRes;
+
+
+static int dns_entry_cmp (void * a, void * b)
+{
+    return strcasecmp(((DnsEntry *)a)->name, (char *)b);
+}
+
+static void dns_entry_free (void * ent)
+{
+    kfree(ent);
+}
+
+/* copy host into name in lower-case, without the trailing dot */
+static int dns_name_norm (char * host, char * name)
+{
+    int   i, len, label = 0;
+
+    len = strlen(host);
+    if (len > 0 && host[len - 1] == '.') len--;
+    if (len <= 0 || len > DNS_NAME_MAX) return -1;
+
+    for (i = 0; i < len; i++) {
+        if (host[i] == '.') {
+            if (label == 0) return -2;
+            label = 0;
+        } else if (++label > 63) {
+            return -3;
+        }
+        name[i] = adf_tolower(host[i]);
+    }
+    if (label == 0) return -2;
+
+    name[len] = '\0';
+    return len;
+}
+
+static DnsShard * dns_shard_of (DnsRes * res, char * name)
+{
+    return &res->shard[wy_hash_nocase(name, -1, res->seed) % DNS_SHARDS];
+}
+
+/* drop the expired names of the shard, its lock is held */
+static void dns_shard_expire (DnsShard * shard, int64 now)
+{
+    DnsEntry  * ent = NULL;
+    arr_t     * list = NULL;
+    int         i, num;
+
+    num = ht_num(shard->cache);
+    for (i = 0; i < num; i++) {
+        ent = ht_value(shard->cache, i);
+        if (ent && ent->expire && ent->expire <= now) {
+            if (!list) list = arr_new(16);
+            arr_push(list, ent);
+        }
+    }
+
+    num = arr_num(list);
+    for (i = 0; i < num; i++) {
+        ent = arr_value(list, i);
+        ht_delete(shard->cache, ent->name);
+        kfree(ent);
+    }
+    arr_free(list);
+}
+
+static int dns_cache_get (DnsRes * res, char * name, DnsEntry * out)
+{
+    DnsShard  * shard = dns_shard_of(res, name);
+    DnsEntry  * ent = NULL;
+
+    EnterCriticalSection(&shard->lock);
+
+    ent = ht_get(shard->cache, name);
+    if (ent && ent->expire && ent->expire <= btime_mono_coarse(NULL)) {
+        ht_delete(shard->cache, name);
+        kfree(ent);
+        ent = NULL;
+    }
+    if (ent) memcpy(out, ent, sizeof(*out));
+
+    LeaveCriticalSection(&shard->lock);
+
+    return ent ? 1 : 0;
+}
+
+static void dns_cache_put (DnsRes * res, DnsEntry * src)
+{
+    DnsShard  * shard = dns_shard_of(res, src->name);
+    DnsEntry  * ent = NULL;
+
+    EnterCriticalSection(&shard->lock);
+
+    ent = ht_get(shard->cache, src->name);
+    if (ent) {
+        memcpy(ent, src, sizeof(*ent));
+
+    } else {
+        if (ht_num(shard->cache) >= DNS_SHARD_MAX)
+            dns_shard_expire(shard, btime_mono_coarse(NULL));
+
+        /* the answer is still given to the waiters when it's not cached */
+        if (ht_num(shard->cache) < DNS_SHARD_MAX && (ent = kalloc(sizeof(*ent)))) {
+            memcpy(ent, src, sizeof(*ent));
+            ht_set(shard->cache, ent->name, ent);
+        }
+    }
+
+    LeaveCriticalSection(&shard->lock);
+}
+
+static void dns_addr_fill (ep_sockaddr_t * addr, int family, uint8 * ip, int port, int socktype)
+{
+    memset(addr, 0, sizeof(*addr));
+
+    if (family == AF_INET) {
+        addr->u.addr4.sin_family = AF_INET;
+        addr->u.addr4.sin_port = htons((uint16)port);
+        memcpy(&addr->u.addr4.sin_addr, ip, 4);
+        addr->socklen = sizeof(struct sockaddr_in);
+    } else {
+        addr->u.addr6.sin6_family = AF_INET6;
+        addr->u.addr6.sin6_port = htons((uint16)port);
+        memcpy(&addr->u.addr6.sin6_addr, ip, 16);
+        addr->socklen = sizeof(struct sockaddr_in6);
+    }
+
+    addr->family = family;
+    addr->socktype = socktype;
+}
+
+/* build the list into head as sock_addr_acquire does, return its number */
+static int dns_entry_addrs (DnsEntry * ent, ep_sockaddr_t * head, int port, int socktype)
+{
+    ep_sockaddr_t  * tail = NULL;
+    ep_sockaddr_t  * newa = NULL;
+    int              i, num = 0;
+
+    for (i = 0; i < ent->num4 + ent->num6; i++) {
+        newa = num == 0 ? head : kzalloc(sizeof(*newa));
+        if (!newa) break;
+
+        if (i < ent->num4)
+            dns_addr_fill(newa, AF_INET, ent->addr4[i], port, socktype);
+        else
+            dns_addr_fill(newa, AF_INET6, ent->addr6[i - ent->num4], port, socktype);
+
+        if (tail) tail->next = newa;
+        tail = newa;
+        num++;
+    }
+
+    return num;
+}
+
+static void dns_callback (DnsWaiter * w, DnsEntry * ent, char * host)
+{
+    ep_sockaddr_t  addr;
+    int            num = 0;
+    int            err = ent->err;
+
+    memset(&addr, 0, sizeof(addr));
+
+    if (err == DNS_OK) {
+        num = dns_entry_addrs(ent, &addr, w->port, w->socktype);
+        if (num <= 0) err = DNS_ENOTFOUND;
+    }
+
+    (*w->cb)(w->para, host, num > 0 ? &addr : NULL, num, err);
+
+    sock_addr_freenext(&addr);
+}
+
+
+static uint16 dns_random_id (DnsRes * res)
+{
+    /* xorshift64* from the random seed of the process */
+    res->rnd ^= res->rnd >> 12;
+    res->rnd ^= res->rnd << 25;
+    res->rnd ^= res->rnd >> 27;
+
+    return (uint16)((res->rnd * 0x2545F4914F6CDD1DULL) >> 48);
+}
+
+static int dns_query_build (uint8 * pkt, uint16 id, char * name, int qtype)
+{
+    uint8  * p = pkt;
+    char   * label = name;
+    char   * dot = NULL;
+    int      len;
+
+    memset(p, 0, 12);
+    p[0] = id >> 8; p[1] = id & 0xFF;
+    p[2] = 0x01;                       /* RD, recursion desired */
+    p[5] = 1;                          /* QDCOUNT */
+    p += 12;
+
+    for ( ; *label; label = dot + 1) {
+        dot = strchr(label, '.');
+        len = dot ? dot - label : (int)strlen(label);
+
+        *p++ = (uint8)len;
+        memcpy(p, label, len);
+        p += len;
+
+        if (!dot) break;
+    }
+    *p++ = 0;
+
+    *p++ = qtype >> 8; *p++ = qtype & 0xFF;
+    *p++ = 0; *p++ = DNS_C_IN;
+
+    return p - pkt;
+}
+
+/* send the queries not answered yet to the next nameserver, the qlock is held */
+static void dns_query_send (DnsRes * res, DnsQuery * q)
+{
+    ep_sockaddr_t  * ns = NULL;
+    SOCKET           fd;
+    uint8            pkt[DNS_NAME_MAX + 32];
+    int              i, len;
+
+    q->deadline = btime_mono_coarse(NULL) + (int64)res->timeout * 1000;
+
+    if (res->nsnum <= 0) return;
+
+    ns = &res->ns[q->nsidx % res->nsnum];
+    fd = ns->family == AF_INET6 ? res->fd6 : res->fd4;
+    if (fd == INVALID_SOCKET) return;
+
+    for (i = 0; i < 2; i++) {
+        if (q->done[i]) continue;
+
+        len = dns_query_build(pkt, q->id[i], q->ent.name, i == 0 ? DNS_T_A : DNS_T_AAAA);
+        sendto(fd, pkt, len, MSG_DONTWAIT, &ns->u.addr, ns->socklen);
+    }
+}
+
+/* take the finished query out of the tables, the qlock is held */
+static void dns_query_unlink (DnsRes * res, DnsQuery * q)
+{
+    int   i, num;
+
+    ht_delete(res->pending, q->ent.name);
+
+    if (res->idtab[q->id[0]] == q) res->idtab[q->id[0]] = NULL;
+    if (res->idtab[q->id[1]] == q) res->idtab[q->id[1]] = NULL;
+
+    num = arr_num(res->qlist);
+    for (i = 0; i < num; i++) {
+        if (arr_value(res->qlist, i) == q) {
+            arr_delete(res->qlist, i);
+            break;
+        }
+    }
+}
+
+/* cache the answers and call back the waiters, the qlock is not held */
+static void dns_query_finish (DnsRes * res, DnsQuery * q)
+{
+    DnsEntry   * ent = &q->ent;
+    DnsWaiter  * w = NULL;
+    uint32       ttl = 0;
+    int          i, num;
+
+    if (ent->num4 + ent->num6 > 0) {
+        ent->err = DNS_OK;
+        ttl = q->minttl;
+    } else if (q->err[0] == DNS_ENOTFOUND || q->err[1] == DNS_ENOTFOUND ||
+               (q->err[0] == DNS_OK && q->err[1] == DNS_OK)) {
+        ent->err = DNS_ENOTFOUND;
+        ttl = res->negttl;
+    } else {
+        ent->err = q->err[0] != DNS_OK ? q->err[0] : q->err[1];
+    }
+
+    /* the failures of nameservers are not cached */
+    if (ent->err == DNS_OK || ent->err == DNS_ENOTFOUND) {
+        if (ttl < 1) ttl = 1;
+        if (ttl > (uint32)res->maxttl) ttl = res->maxttl;
+        ent->expire = btime_mono_coarse(NULL) + (int64)ttl * 1000000;
+        dns_cache_put(res, ent);
+    }
+
+    num = arr_num(q->waiters);
+    for (i = 0; i < num; i++) {
+        w = arr_value(q->waiters, i);
+        dns_callback(w, ent, ent->name);
+        kfree(w);
+    }
+
+    arr_free(q->waiters);
+    kfree(q);
+}
+
+static int dns_skip_name (uint8 * pkt, int len, int pos)
+{
+    while (pos < len) {
+        if (pkt[pos] == 0) return pos + 1;
+
+        /* a compression pointer ends the name */
+        if ((pkt[pos] & 0xC0) == 0xC0) return pos + 2 <= len ? pos + 2 : -1;
+
+        pos += pkt[pos] + 1;
+    }
+    return -1;
+}
+
+/* the question name must be the one queried, which stops the answers
+ * forged without seeing the query */
+static int dns_name_match (uint8 * pkt, int len, int pos, char * name)
+{
+    int   n, nlen = strlen(name), off = 0;
+
+    while (pos < len && pkt[pos] != 0) {
+        n = pkt[pos++];
+        if (n > 63 || pos + n > len) return 0;
+
+        if (off > 0) {
+            if (off >= nlen || name[off] != '.') return 0;
+            off++;
+        }
+        if (off + n > nlen || strncasecmp((char *)pkt + pos, name + off, n) != 0) return 0;
+
+        off += n;
+        pos += n;
+    }
+
+    return pos < len && off == nlen;
+}
+
+static int dns_from_ns (DnsRes * res, struct sockaddr_storage * from)
+{
+    ep_sockaddr_t  * ns = NULL;
+    int              i;
+
+    for (i = 0; i < res->nsnum; i++) {
+        ns = &res->ns[i];
+        if (ns->family != from->ss_family) continue;
+
+        if (ns->family == AF_INET &&
+            memcmp(&ns->u.addr4.sin_addr, &((struct sockaddr_in *)from)->sin_addr, 4) == 0 &&
+            ns->u.addr4.sin_port == ((struct sockaddr_in *)from)->sin_port)
+            return 1;
+
+        if (ns->family == AF_INET6 &&
+            memcmp(&ns->u.addr6.sin6_addr, &((struct sockaddr_in6 *)from)->sin6_addr, 16) == 0 &&
+            ns->u.addr6.sin6_port == ((struct sockaddr_in6 *)from)->sin6_port)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void dns_answer (DnsRes * res, uint8 * pkt, int len, struct sockaddr_storage * from)
+{
+    DnsQuery  * q = NULL;
+    uint16      id, type, cls, rdlen;
+    uint32      ttl;
+    int         which, rcode, ancount, i, pos;
+
+    if (len < 12 || !(pkt[2] & 0x80)) return;        /* not a response */
+    if (((pkt[4] << 8) | pkt[5]) != 1) return;
+
+    if (!dns_from_ns(res, from)) return;
+
+    id = (pkt[0] << 8) | pkt[1];
+    rcode = pkt[3] & 0x0F;
+    ancount = (pkt[6] << 8) | pkt[7];
+
+    EnterCriticalSection(&res->qlock);
+
+    q = res->idtab[id];
+    if (!q) goto done;
+
+    which = q->id[0] == id ? 0 : 1;
+    if (q->done[which]) goto done;
+
+    if (!dns_name_match(pkt, len, 12, q->ent.name)) goto done;
+
+    pos = dns_skip_name(pkt, len, 12);
+    if (pos < 0 || pos + 4 > len) goto done;
+    if (((pkt[pos] << 8) | pkt[pos + 1]) != (which == 0 ? DNS_T_A : DNS_T_AAAA)) goto done;
+    pos += 4;
+
+    if (rcode == DNS_RCODE_SERVFAIL || rcode == DNS_RCODE_REFUSED) {
+        /* try the next nameserver at once */
+        if (q->tries < res->retries) {
+            q->deadline = 0;
+        } else {
+            q->done[which] = 1;
+            q->err[which] = DNS_ESERVER;
+        }
+        goto check;
+    }
+
+    if (rcode == DNS_RCODE_NXDOMAIN) {
+        q->done[which] = 1;
+        q->err[which] = DNS_ENOTFOUND;
+        goto check;
+    }
+
+    if (rcode != 0) {
+        q->done[which] = 1;
+        q->err[which] = DNS_ESERVER;
+        goto check;
+    }
+
+    for (i = 0; i < ancount; i++) {
+        pos = dns_skip_name(pkt, len, pos);
+        if (pos < 0 || pos + 10 > len) break;
+
+        type = (pkt[pos] << 8) | pkt[pos + 1];
+        cls = (pkt[pos + 2] << 8) | pkt[pos + 3];
+        ttl = ((uint32)pkt[pos + 4] << 24) | (pkt[pos + 5] << 16) | (pkt[pos + 6] << 8) | pkt[pos + 7];
+        rdlen = (pkt[pos + 8] << 8) | pkt[pos + 9];
+        pos += 10;
+        if (pos + rdlen > len) break;
+
+        /* CNAME records are followed by the addresses of the target */
+        if (cls == DNS_C_IN && type == (which == 0 ? DNS_T_A : DNS_T_AAAA) && rdlen == (which == 0 ? 4 : 16)) {
+            if (which == 0 && q->ent.num4 < DNS_ADDR_MAX)
+                memcpy(q->ent.addr4[q->ent.num4++], pkt + pos, 4);
+            else if (which == 1 && q->ent.num6 < DNS_ADDR_MAX)
+                memcpy(q->ent.addr6[q->ent.num6++], pkt + pos, 16);
+
+            if (ttl < q->minttl) q->minttl = ttl;
+        }
+        pos += rdlen;
+    }
+
+    q->done[which] = 1;
+    q->err[which] = DNS_OK;
+
+check:
+    if (q->done[0] && q->done[1]) {
+        dns_query_unlink(res, q);
+        LeaveCriticalSection(&res->qlock);
+
+        dns_query_finish(res, q);
+        return;
+    }
+
+done:
+    LeaveCriticalSection(&res->qlock);
+}
+
+/* retry the queries timed out, and finish the ones out of tries. return
+ * the milli-seconds till the next deadline */
+static int dns_check_timeout (DnsRes * res)
+{
+    DnsQuery  * q = NULL;
+    arr_t     * fin = NULL;
+    int64       now = btime_mono_coarse(NULL);
+    int64       next = now + 1000000;
+    int         i, num;
+
+    EnterCriticalSection(&res->qlock);
+
+    for (i = 0; i < arr_num(res->qlist); ) {
+        q = arr_value(res->qlist, i);
+
+        if (q->deadline > now) {
+            if (q->deadline < next) next = q->deadline;
+            i++;
+            continue;
+        }
+
+        if (q->tries < res->retries) {
+            q->tries++;
+            q->nsidx++;
+            dns_query_send(res, q);
+            if (q->deadline < next) next = q->deadline;
+            i++;
+            continue;
+        }
+
+        if (!q->done[0]) { q->done[0] = 1; q->err[0] = DNS_ETIMEOUT; }
+        if (!q->done[1]) { q->done[1] = 1; q->err[1] = DNS_ETIMEOUT; }
+
+        dns_query_unlink(res, q);
+        if (!fin) fin = arr_new(4);
+        arr_push(fin, q);
+    }
+
+    LeaveCriticalSection(&res->qlock);
+
+    num = arr_num(fin);
+    for (i = 0; i < num; i++)
+        dns_query_finish(res, arr_value(fin, i));
+    arr_free(fin);
+
+    return (int)((next - now + 999) / 1000);
+}
+
+static void * dns_thread (void * arg)
+{
+    DnsRes                  * res = (DnsRes *)arg;
+    struct pollfd             pfd[3];
+    struct sockaddr_storage   from;
+    socklen_t                 fromlen;
+    uint8                     pkt[DNS_PKT_MAX];
+    int                       i, n, len, ms = 1000;
+
+    while (!res->quit) {
+        n = 0;
+        pfd[n].fd = res->wakefd[0]; pfd[n].events = POLLIN; n++;
+        if (res->fd4 != INVALID_SOCKET) { pfd[n].fd = res->fd4; pfd[n].events = POLLIN; n++; }
+        if (res->fd6 != INVALID_SOCKET) { pfd[n].fd = res->fd6; pfd[n].events = POLLIN; n++; }
+
+        if (poll(pfd, n, ms) < 0 && errno != EINTR) break;
+
+        while (read(res->wakefd[0], pkt, sizeof(pkt)) > 0);
+
+        for (i = 1; i < n; i++) {
+            for ( ; ; ) {
+                fromlen = sizeof(from);
+                len = recvfrom(pfd[i].fd, pkt, sizeof(pkt), MSG_DONTWAIT,
+                               (struct sockaddr *)&from, &fromlen);
+                if (len < 0) break;
+
+                dns_answer(res, pkt, len, &from);
+            }
+        }
+
+        ms = dns_check_timeout(res);
+    }
+
+    return NULL;
+}
+
+static void dns_wakeup (DnsRes * res)
+{
+    uint8  byte = 1;
+
+    if (write(res->wakefd[1], &byte, 1) < 0) return;
+}
+
+
+static SOCKET dns_udp_socket (int family)
+{
+    SOCKET  fd;
+
+    fd = socket(family, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET) return INVALID_SOCKET;
+
+    sock_nonblock_set(fd, 1);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+static int dns_ns_parse (ep_sockaddr_t * ns, char * ip, int port)
+{
+    memset(ns, 0, sizeof(*ns));
+
+    if (sock_addr_parse(ip, -1, ns) < 0) return -1;
+
+    if (ns->family == AF_INET)
+        ns->u.addr4.sin_port = htons((uint16)port);
+    else
+        ns->u.addr6.sin6_port = htons((uint16)port);
+
+    ns->socktype = SOCK_DGRAM;
+    return 0;
+}
+
+static void dns_resolvconf_load (DnsRes * res, char * file)
+{
+    FILE  * fp = NULL;
+    char    line[512];
+    char    ip[128];
+
+    fp = fopen(file ? file : "/etc/resolv.conf", "r");
+    if (!fp) return;
+
+    while (fgets(line, sizeof(line), fp) && res->nsnum < DNS_NS_MAX) {
+        if (sscanf(line, " nameserver %127s", ip) != 1) continue;
+
+        if (dns_ns_parse(&res->ns[res->nsnum], ip, 53) == 0)
+            res->nsnum++;
+    }
+
+    fclose(fp);
+}
+
+static void dns_hosts_load (DnsRes * res, char * file)
+{
+    FILE           * fp = NULL;
+    DnsEntry         ent;
+    ep_sockaddr_t    addr;
+    char             line[1024];
+    char           * p = NULL;
+    char           * tok = NULL;
+    char           * save = NULL;
+
+    fp = fopen(file, "r");
+    if (!fp) return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if ((p = strchr(line, '#'))) *p = '\0';
+
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok) continue;
+
+        memset(&addr, 0, sizeof(addr));
+        if (sock_addr_parse(tok, -1, &addr) < 0) continue;
+
+        while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+            memset(&ent, 0, sizeof(ent));
+            if (dns_name_norm(tok, ent.name) < 0) continue;
+
+            /* the addresses of a name over lines are merged */
+            dns_cache_get(res, ent.name, &ent);
+
+            if (addr.family == AF_INET && ent.num4 < DNS_ADDR_MAX)
+                memcpy(ent.addr4[ent.num4++], &addr.u.addr4.sin_addr, 4);
+            else if (addr.family == AF_INET6 && ent.num6 < DNS_ADDR_MAX)
+                memcpy(ent.addr6[ent.num6++], &addr.u.addr6.sin6_addr, 16);
+
+            ent.expire = 0;
+            ent.err = DNS_OK;
+            dns_cache_put(res, &ent);
+        }
+    }
+
+    fclose(fp);
+}
+
+void * dns_resolver_new (char * resolvconf, int timeout, int retries)
+{
+    DnsRes  * res = NULL;
+    int       i;
+
+    res = kzalloc(sizeof(*res));
+    if (!res) return NULL;
+
+    res->seed = hash_random_seed();
+    res->rnd = res->seed ^ (uint64)btime_mono(NULL) ^ 0x9E3779B97F4A7C15ULL;
+    if (res->rnd == 0) res->rnd = 1;
+
+    res->timeout = timeout > 0 ? timeout : 2000;
+    res->retries = retries > 0 ? retries : 2;
+    res->negttl = 10;
+    res->maxttl = 3600;
+
+    res->fd4 = res->fd6 = INVALID_SOCKET;
+    res->wakefd[0] = res->wakefd[1] = -1;
+
+    for (i = 0; i < DNS_SHARDS; i++) {
+        InitializeCriticalSection(&res->shard[i].lock);
+        res->shard[i].cache = ht_new(256, dns_entry_cmp);
+        ht_set_seed_hash(res->shard[i].cache, HT_HASH_WY_NOCASE, res->seed);
+    }
+
+    InitializeCriticalSection(&res->qlock);
+    res->pending = ht_new(64, dns_entry_cmp);
+    ht_set_seed_hash(res->pending, HT_HASH_WY_NOCASE, res->seed);
+    res->qlist = arr_new(16);
+    res->idtab = kzalloc(65536 * sizeof(DnsQuery *));
+
+    if (!res->pending || !res->qlist || !res->idtab)
+        goto failed;
+
+    dns_resolvconf_load(res, resolvconf);
+    if (res->nsnum == 0) {
+        dns_ns_parse(&res->ns[0], "127.0.0.1", 53);
+        res->nsnum = 1;
+    }
+
+    dns_hosts_load(res, "/etc/hosts");
+
+    res->fd4 = dns_udp_socket(AF_INET);
+    res->fd6 = dns_udp_socket(AF_INET6);
+
+    if (pipe(res->wakefd) < 0) goto failed;
+    sock_nonblock_set(res->wakefd[0], 1);
+    sock_nonblock_set(res->wakefd[1], 1);
+
+    if (pthread_create(&res->thread, NULL, dns_thread, res) != 0)
+        goto failed;
+    res->running = 1;
+
+    return res;
+
+failed:
+    tolog(1, "dns_resolver_new failed\n");
+    dns_resolver_free(res);
+    return NULL;
+}
+
+void dns_resolver_free (void * vres)
+{
+    DnsRes    * res = (DnsRes *)vres;
+    DnsQuery  * q = NULL;
+    int         i;
+
+    if (!res) return;
+
+    if (res->running) {
+        res->quit = 1;
+        dns_wakeup(res);
+        pthread_join(res->thread, NULL);
+    }
+
+    /* the waiters are called back as timed out */
+    while ((q = arr_value(res->qlist, 0))) {
+        q->err[0] = q->err[1] = DNS_ETIMEOUT;
+        dns_query_unlink(res, q);
+        dns_query_finish(res, q);
+    }
+
+    if (res->fd4 != INVALID_SOCKET) closesocket(res->fd4);
+    if (res->fd6 != INVALID_SOCKET) closesocket(res->fd6);
+    if (res->wakefd[0] >= 0) close(res->wakefd[0]);
+    if (res->wakefd[1] >= 0) close(res->wakefd[1]);
+
+    for (i = 0; i < DNS_SHARDS; i++) {
+        ht_free_all(res->shard[i].cache, dns_entry_free);
+        DeleteCriticalSection(&res->shard[i].lock);
+    }
+
+    ht_free(res->pending);
+    arr_free(res->qlist);
+    kfree(res->idtab);
+    DeleteCriticalSection(&res->qlock);
+
+    kfree(res);
+}
+
+int dns_nameserver_add (void * vres, char * ip, int port)
+{
+    DnsRes        * res = (DnsRes *)vres;
+    ep_sockaddr_t   ns;
+
+    if (!res || !ip) return -1;
+
+    if (dns_ns_parse(&ns, ip, port > 0 ? port : 53) < 0)
+        return -2;
+
+    EnterCriticalSection(&res->qlock);
+
+    if (!res->nsuser) {
+        res->nsuser = 1;
+        res->nsnum = 0;
+    }
+
+    if (res->nsnum >= DNS_NS_MAX) {
+        LeaveCriticalSection(&res->qlock);
+        return -3;
+    }
+
+    memcpy(&res->ns[res->nsnum++], &ns, sizeof(ns));
+
+    LeaveCriticalSection(&res->qlock);
+    return 0;
+}
+
+void dns_ttl_set (void * vres, int negttl, int maxttl)
+{
+    DnsRes  * res = (DnsRes *)vres;
+
+    if (!res) return;
+
+    if (negttl >= 0) res->negttl = negttl;
+    if (maxttl > 0) res->maxttl = maxttl;
+}
+
+int dns_resolve (void * vres, char * host, int port, int socktype,
+                 DnsResolveCB * cb, void * para)
+{
+    DnsRes         * res = (DnsRes *)vres;
+    DnsQuery       * q = NULL;
+    DnsWaiter        wt;
+    DnsWaiter      * w = NULL;
+    DnsEntry         ent;
+    ep_sockaddr_t    addr;
+    char             name[DNS_NAME_MAX + 3];
+    int              i, k;
+
+    if (!res || !host || !cb) return -1;
+
+    wt.cb = cb;
+    wt.para = para;
+    wt.port = port;
+    wt.socktype = socktype;
+
+    memset(&addr, 0, sizeof(addr));
+    if (sock_addr_parse(host, -1, &addr) == 0) {
+        if (addr.family == AF_INET)
+            addr.u.addr4.sin_port = htons((uint16)port);
+        else
+            addr.u.addr6.sin6_port = htons((uint16)port);
+        addr.socktype = socktype;
+
+        (*cb)(para, host, &addr, 1, DNS_OK);
+        return 1;
+    }
+
+    if (dns_name_norm(host, name) < 0) return -2;
+
+    if (dns_cache_get(res, name, &ent)) {
+        dns_callback(&wt, &ent, host);
+        return 1;
+    }
+
+    w = kalloc(sizeof(*w));
+    if (!w) return DNS_ENOMEM;
+    memcpy(w, &wt, sizeof(*w));
+
+    EnterCriticalSection(&res->qlock);
+
+    /* wait for the query of the same name in flight */
+    q = ht_get(res->pending, name);
+    if (q) {
+        arr_push(q->waiters, w);
+        LeaveCriticalSection(&res->qlock);
+        return 0;
+    }
+
+    q = kzalloc(sizeof(*q));
+    if (!q || !(q->waiters = arr_new(4))) {
+        LeaveCriticalSection(&res->qlock);
+        if (q) kfree(q);
+        kfree(w);
+        return DNS_ENOMEM;
+    }
+
+    strcpy(q->ent.name, name);
+    q->minttl = (uint32)res->maxttl;
+    arr_push(q->waiters, w);
+
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < 1024; i++) {
+            q->id[k] = dns_random_id(res);
+            if (!res->idtab[q->id[k]] && (k == 0 || q->id[1] != q->id[0])) break;
+        }
+        if (i >= 1024) {
+            LeaveCriticalSection(&res->qlock);
+            arr_free(q->waiters);
+            kfree(q); kfree(w);
+            return -3;
+        }
+    }
+    res->idtab[q->id[0]] = q;
+    res->idtab[q->id[1]] = q;
+
+    ht_set(res->pending, q->ent.name, q);
+    arr_push(res->qlist, q);
+
+    dns_query_send(res, q);
+
+    LeaveCriticalSection(&res->qlock);
+
+    dns_wakeup(res);
+    return 0;
+}
+
+
+/* the result handed from the callback to dns_resolve_wait, released by
+ * the one of the two leaving it later */
+typedef struct dns_wait_s {
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+    int               refs;
+    int               done;
+    int               num;
+    int               err;
+    ep_sockaddr_t     addr;
+} DnsWait;
+
+static void dns_wait_unref (DnsWait * w)
+{
+    int   refs;
+
+    pthread_mutex_lock(&w->mutex);
+    refs = --w->refs;
+    pthread_mutex_unlock(&w->mutex);
+
+    if (refs > 0) return;
+
+    sock_addr_freenext(&w->addr);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->mutex);
+    kfree(w);
+}
+
+static void dns_wait_cb (void * para, char * host, ep_sockaddr_t * addr, int num, int err)
+{
+    DnsWait * w = (DnsWait *)para;
+
+    pthread_mutex_lock(&w->mutex);
+
+    if (addr && num > 0) {
+        memcpy(&w->addr, addr, sizeof(*addr));
+        addr->next = NULL;
+    }
+    w->num = num;
+    w->err = err;
+    w->done = 1;
+
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+
+    dns_wait_unref(w);
+}
+
+int dns_resolve_wait (void * vres, ep_sockaddr_t * addr, char * host, int port,
+                      int socktype, int ms)
+{
+    DnsWait          * w = NULL;
+    struct timespec    ts;
+    int                ret;
+
+    if (!vres || !addr || !host) return -1;
+
+    w = kzalloc(sizeof(*w));
+    if (!w) return DNS_ENOMEM;
+
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->refs = 2;
+
+    ret = dns_resolve(vres, host, port, socktype, dns_wait_cb, w);
+    if (ret < 0) {
+        w->refs = 1;
+        dns_wait_unref(w);
+        return ret;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+
+    pthread_mutex_lock(&w->mutex);
+
+    while (!w->done) {
+        if (pthread_cond_timedwait(&w->cond, &w->mutex, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (!w->done) {
+        ret = DNS_ETIMEOUT;
+    } else if (w->num > 0) {
+        memcpy(addr, &w->addr, sizeof(*addr));
+        w->addr.next = NULL;
+        ret = w->num;
+    } else {
+        ret = w->err < 0 ? w->err : DNS_ENOTFOUND;
+    }
+
+    pthread_mutex_unlock(&w->mutex);
+
+    dns_wait_unref(w);
+    return ret;
+}
+
+void dns_cache_flush (void * vres, char * host)
+{
+    DnsRes     * res = (DnsRes *)vres;
+    DnsShard   * shard = NULL;
+    DnsEntry   * ent = NULL;
+    arr_t      * list = NULL;
+    char         name[DNS_NAME_MAX + 3];
+    int          i, j, num;
+
+    if (!res) return;
+
+    if (host) {
+        if (dns_name_norm(host, name) < 0) return;
+
+        shard = dns_shard_of(res, name);
+        EnterCriticalSection(&shard->lock);
+
+        ent = ht_get(shard->cache, name);
+        if (ent && ent->expire) {
+            ht_delete(shard->cache, name);
+            kfree(ent);
+        }
+
+        LeaveCriticalSection(&shard->lock);
+        return;
+    }
+
+    /* the names of /etc/hosts are kept */
+    for (i = 0; i < DNS_SHARDS; i++) {
+        shard = &res->shard[i];
+        EnterCriticalSection(&shard->lock);
+
+        num = ht_num(shard->cache);
+        for (j = 0; j < num; j++) {
+            ent = ht_value(shard->cache, j);
+            if (ent && ent->expire) {
+                if (!list) list = arr_new(16);
+                arr_push(list, ent);
+            }
+        }
+
+        num = arr_num(list);
+        for (j = 0; j < num; j++) {
+            ent = arr_value(list, j);
+            ht_delete(shard->cache, ent->name);
+            kfree(ent);
+        }
+        if (list) arr_zero(list);
+
+        LeaveCriticalSection(&shard->lock);
+    }
+
+    arr_free(list);
+}
+
+#endif
+
@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "memory.h"
+#include "thpool.h"
 #include "dynarr.h"
 
 #define MIN_NODES    4
@@ -252,6 +253,252 @@ void arr_sort_by (arr_t * ar, ArrCmp * cmp)
     qsort(ar->data, ar->num, sizeof(void *), FP_ICC cmp);
 }
 
+
+/* parallel merge sort. the runs sorted by qsort in parallel are merged
+ * level by level, each merge of two runs is split into equal parts of
+ * output by binary searching the split point, so that all the workers
+ * are busy even in the last level */
+
+#define PSORT_MINRUN   8192
+
+typedef int PSortCmp (void * a, void * b);
+
+typedef struct psort_s {
+    char      * src;
+    char      * dst;
+    int         size;
+    long        num;
+    long        run;
+    long        width;
+    int         parts;
+    PSortCmp  * cmp;
+} PSort;
+
+static void psort_run_func (void * arg, long from, long to)
+{
+    PSort * ps = (PSort *)arg;
+    long    i, lo, hi;
+
+    for (i = from; i < to; i++) {
+        lo = i * ps->run;
+        hi = lo + ps->run;
+        if (hi > ps->num) hi = ps->num;
+
+        if (hi > lo)
+            qsort(ps->src + lo * ps->size, hi - lo, ps->size, FP_ICC ps->cmp);
+    }
+}
+
+/* the count of units of a in the first d units of merging a and b */
+static long psort_corank (PSort * ps, char * a, long na, char * b, long nb, long d)
+{
+    long   lo, hi, i;
+    int    size = ps->size;
+
+    lo = d > nb ? d - nb : 0;
+    hi = d < na ? d : na;
+
+    while (lo < hi) {
+        i = (lo + hi) / 2;
+
+        /* a[i] equal to b[d-i-1] goes first for stability */
+        if ((*ps->cmp)(a + i * size, b + (d - i - 1) * size) <= 0)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+
+    return lo;
+}
+
+static void psort_merge (PSort * ps, char * a, long na, char * b, long nb, char * out)
+{
+    int    size = ps->size;
+    char * aend = a + na * size;
+    char * bend = b + nb * size;
+
+    if (size == sizeof(void *)) {
+        while (a < aend && b < bend) {
+            if ((*ps->cmp)(a, b) <= 0) {
+                *(void **)out = *(void **)a; a += size;
+            } else {
+                *(void **)out = *(void **)b; b += size;
+            }
+            out += size;
+        }
+    } else {
+        while (a < aend && b < bend) {
+            if ((*ps->cmp)(a, b) <= 0) {
+                memcpy(out, a, size); a += size;
+            } else {
+                memcpy(out, b, size); b += size;
+            }
+            out += size;
+        }
+    }
+
+    if (a < aend) memcpy(out, a, aend - a);
+    else if (b < bend) memcpy(out, b, bend - b);
+}
+
+static void psort_merge_func (void * arg, long from, long to)
+{
+    PSort * ps = (PSort *)arg;
+    char  * a, * b;
+    long    t, lo, mid, hi, na, nb, d0, d1, i0, i1;
+
+    for (t = from; t < to; t++) {
+        lo = (t / ps->parts) * 2 * ps->width;
+        mid = lo + ps->width;
+        if (mid > ps->num) mid = ps->num;
+        hi = mid + ps->width;
+        if (hi > ps->num) hi = ps->num;
+
+        a = ps->src + lo * ps->size;
+        b = ps->src + mid * ps->size;
+        na = mid - lo;
+        nb = hi - mid;
+
+        d0 = (na + nb) * (t % ps->parts) / ps->parts;
+        d1 = (na + nb) * (t % ps->parts + 1) / ps->parts;
+
+        i0 = psort_corank(ps, a, na, b, nb, d0);
+        i1 = psort_corank(ps, a, na, b, nb, d1);
+
+        psort_merge(ps, a + i0 * ps->size, i1 - i0,
+                    b + (d0 - i0) * ps->size, (d1 - i1) - (d0 - i0),
+                    ps->dst + (lo + d0) * ps->size);
+    }
+}
+
+int qsort_parallel (void * base, long num, int size, int (*cmp)(void *, void *), void * pool)
+{
+    PSort   ps;
+    char  * buf = NULL;
+    char  * tmp = NULL;
+    long    runs, pairs;
+    int     workers;
+
+    if (!base || !cmp || size <= 0) return -1;
+    if (num < 2) return 0;
+
+    /* the calling thread takes part in the ranges too */
+    workers = thpool_num(pool) + 1;
+
+    for (runs = 1; runs < workers * 2 && num / (runs * 2) >= PSORT_MINRUN; runs *= 2);
+
+    if (workers <= 1 || runs <= 1 || (buf = kalloc(num * size)) == NULL) {
+        qsort(base, num, size, FP_ICC cmp);
+        return 0;
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    ps.src = base;
+    ps.dst = buf;
+    ps.size = size;
+    ps.num = num;
+    ps.run = (num + runs - 1) / runs;
+    ps.cmp = cmp;
+
+    thpool_parallel_for(pool, 0, runs, 1, psort_run_func, &ps);
+
+    for (ps.width = ps.run; ps.width < num; ps.width *= 2) {
+        pairs = (num + 2 * ps.width - 1) / (2 * ps.width);
+
+        ps.parts = (workers * 2 + pairs - 1) / pairs;
+        if (ps.parts < 1) ps.parts = 1;
+
+        thpool_parallel_for(pool, 0, pairs * ps.parts, 1, psort_merge_func, &ps);
+
+        tmp = ps.src; ps.src = ps.dst; ps.dst = tmp;
+    }
+
+    if (ps.src != base)
+        memcpy(base, ps.src, num * size);
+
+    kfree(buf);
+    return 0;
+}
+
+void arr_psort_by (arr_t * ar, ArrCmp * cmp, void * pool)
+{
+    if (!ar) return;
+
+    qsort_parallel(ar->data, ar->num, sizeof(void *), cmp, pool);
+}
+
+/* k-way merge by a heap of the list indices ordered by their current
+ * member, the lower index goes first when members are equal */
+static int arr_merge_less (arr_t ** lists, int * pos, ArrCmp * cmp, int a, int b)
+{
+    int  ret;
+
+    ret = (*cmp)(&lists[a]->data[pos[a]], &lists[b]->data[pos[b]]);
+
+    return ret < 0 || (ret == 0 && a < b);
+}
+
+static void arr_merge_down (arr_t ** lists, int * pos, ArrCmp * cmp, int * hp, int num, int i)
+{
+    int  child, tmp;
+
+    while ((child = 2 * i + 1) < num) {
+        if (child + 1 < num && arr_merge_less(lists, pos, cmp, hp[child + 1], hp[child]))
+            child++;
+
+        if (!arr_merge_less(lists, pos, cmp, hp[child], hp[i]))
+            break;
+
+        tmp = hp[i]; hp[i] = hp[child]; hp[child] = tmp;
+        i = child;
+    }
+}
+
+arr_t * arr_merge (arr_t ** lists, int num, ArrCmp * cmp)
+{
+    arr_t  * ar = NULL;
+    int    * pos = NULL;
+    int    * hp = NULL;
+    int      i, total = 0, hnum = 0;
+    int      top;
+
+    if (!lists || num <= 0 || !cmp) return NULL;
+
+    for (i = 0; i < num; i++) {
+        if (lists[i]) total += lists[i]->num;
+    }
+
+    ar = arr_new(total);
+    pos = kzalloc(num * 2 * sizeof(int));
+    if (!ar || !pos) {
+        arr_free(ar);
+        if (pos) kfree(pos);
+        return NULL;
+    }
+    hp = pos + num;
+
+    for (i = 0; i < num; i++) {
+        if (lists[i] && lists[i]->num > 0)
+            hp[hnum++] = i;
+    }
+
+    for (i = hnum / 2 - 1; i >= 0; i--)
+        arr_merge_down(lists, pos, cmp, hp, hnum, i);
+
+    while (hnum > 0) {
+        top = hp[0];
+        ar->data[ar->num++] = lists[top]->data[pos[top]++];
+
+        if (pos[top] >= lists[top]->num)
+            hp[0] = hp[--hnum];
+
+        arr_merge_down(lists, pos, cmp, hp, hnum, 0);
+    }
+
+    kfree(pos);
+    return ar;
+}
+
 int arr_insert_by (arr_t * ar, void * item, ArrCmp * cmp)
 {
     int lo, mid, hi;
@@ -292,6 +539,110 @@ int arr_insert_by (arr_t * ar, void * item, ArrCmp * cmp)
     return arr_insert(ar, item, lo);
 }
 
+/* stable merge sort of the members, cmp gets the members like arr_insert_by */
+static void arr_msort (void ** data, void ** tmp, int num, ArrCmp * cmp)
+{
+    int  half, i, j, k;
+
+    if (num < 2) return;
+
+    half = num / 2;
+    arr_msort(data, tmp, half, cmp);
+    arr_msort(data + half, tmp, num - half, cmp);
+
+    if ((*cmp)(data[half - 1], data[half]) <= 0) return;
+
+    memcpy(tmp, data, half * sizeof(void *));
+
+    for (i = 0, j = half, k = 0; i < half && j < num; ) {
+        if ((*cmp)(tmp[i], data[j]) <= 0)
+            data[k++] = tmp[i++];
+        else
+            data[k++] = data[j++];
+    }
+
+    while (i < half) data[k++] = tmp[i++];
+}
+
+/* the position after the last one not greater than item in data[0, hi),
+ * galloping down from hi */
+static int arr_gallop_upper (void ** data, int hi, void * item, ArrCmp * cmp)
+{
+    int  gt, probe, step = 1, mid;
+
+    if (hi <= 0 || (*cmp)(data[hi - 1], item) <= 0)
+        return hi;
+
+    gt = hi - 1;
+    while ((probe = gt - step) >= 0 && (*cmp)(data[probe], item) > 0) {
+        gt = probe;
+        step <<= 1;
+    }
+    if (probe < 0) probe = -1;
+
+    /* data[probe] is not greater, data[gt] is greater */
+    while (probe + 1 < gt) {
+        mid = probe + (gt - probe) / 2;
+        if ((*cmp)(data[mid], item) > 0) gt = mid;
+        else probe = mid;
+    }
+
+    return gt;
+}
+
+int arr_insert_batch_by (arr_t * ar, void ** items, int num, ArrCmp * cmp)
+{
+    void ** batch = NULL;
+    void ** s = NULL;
+    int     i, j, k, pos, cnt;
+
+    if (!ar || !items || num < 0 || !cmp)
+        return -1;
+
+    if (num == 0) return ar->num;
+
+    batch = kalloc(num * 2 * sizeof(void *));
+    if (!batch) return -100;
+
+    memcpy(batch, items, num * sizeof(void *));
+    arr_msort(batch, batch + num, num, cmp);
+
+    if (ar->num_alloc < ar->num + num) {
+        for (k = ar->num_alloc > 0 ? ar->num_alloc : MIN_NODES; k < ar->num + num; k *= 2);
+
+        s = (void **)krealloc((void *)ar->data, sizeof(void *) * k);
+        if (s == NULL) {
+            kfree(batch);
+            return -100;
+        }
+        ar->data = s;
+        ar->num_alloc = k;
+    }
+
+    /* merge from the end, each member is moved once. the new one is placed
+     * after the equal members like arr_insert_by */
+    i = ar->num;
+    k = ar->num + num;
+
+    for (j = num - 1; j >= 0; j--) {
+        pos = arr_gallop_upper(ar->data, i, batch[j], cmp);
+        cnt = i - pos;
+
+        if (cnt > 0) {
+            k -= cnt;
+            memmove(ar->data + k, ar->data + pos, cnt * sizeof(void *));
+            i = pos;
+        }
+
+        ar->data[--k] = batch[j];
+    }
+
+    ar->num += num;
+
+    kfree(batch);
+    return ar->num;
+}
+
 int arr_findloc_by (arr_t * ar, void * pattern, ArrCmp * cmp, int * found)
 {
     int lo, hi, mid = 0;
@@ -438,9 +789,51 @@ void * arr_delete_by (arr_t * ar, void * pattern, ArrCmp * cmp)
 }   
 
 
+/* the first member in [lo, mid] equal to pattern, data[mid] is equal and
+ * the ones before lo are less. gallop from mid then binary search */
+static int arr_gallop_first (void ** data, int lo, int mid, void * pattern, ArrCmp * cmp)
+{
+    int  eq = mid, probe = mid, step = 1;
+
+    while ((probe = eq - step) >= lo && (*cmp)(data[probe], pattern) == 0) {
+        eq = probe;
+        step <<= 1;
+    }
+    if (probe < lo) probe = lo - 1;
+
+    /* data[probe] is less, data[eq] is equal */
+    while (probe + 1 < eq) {
+        mid = probe + (eq - probe) / 2;
+        if ((*cmp)(data[mid], pattern) == 0) eq = mid;
+        else probe = mid;
+    }
+
+    return eq;
+}
+
+/* the last member in [mid, hi] equal to pattern */
+static int arr_gallop_last (void ** data, int mid, int hi, void * pattern, ArrCmp * cmp)
+{
+    int  eq = mid, probe = mid, step = 1;
+
+    while ((probe = eq + step) <= hi && (*cmp)(data[probe], pattern) == 0) {
+        eq = probe;
+        step <<= 1;
+    }
+    if (probe > hi) probe = hi + 1;
+
+    while (eq + 1 < probe) {
+        mid = eq + (probe - eq) / 2;
+        if ((*cmp)(data[mid], pattern) == 0) eq = mid;
+        else probe = mid;
+    }
+
+    return eq;
+}
+
 arr_t * arr_delete_all_by (arr_t * ar, void * pattern, ArrCmp * cmp)
 {
-    int     lo, hi, mid=0, cur=0, bgn=0, end=0;
+    int     lo, hi, mid=0, bgn=0, end=0;
     int     result;
     arr_t * ret = NULL;
 
@@ -453,31 +846,20 @@ arr_t * arr_delete_all_by (arr_t * ar, void * pattern, ArrCmp * cmp)
     while (lo <= hi) {
         mid = (lo + hi) / 2;
 
-        if (!(result = (*cmp)(arr_value(ar, mid), pattern))) {
-            ret = arr_new(4);
-            if (!ret) return NULL;
-
-            for (cur = mid+1; cur <= hi; cur++) {
-                if ((*cmp)(arr_value(ar, cur), pattern) != 0) {
-                    end = cur-1;
-                    break;
-                }
-            }
-
-            if (cur > hi) end = hi;
+        if (!(result = (*cmp)(ar->data[mid], pattern))) {
+            bgn = arr_gallop_first(ar->data, lo, mid, pattern, cmp);
+            end = arr_gallop_last(ar->data, mid, hi, pattern, cmp);
 
-            for (cur = mid-1; cur >= lo; cur--) {
-                if ((*cmp)(arr_value(ar, cur), pattern) != 0) {
-                    bgn = cur+1;
-                    break;
-                }
-            }
+            ret = arr_new(end - bgn + 1);
+            if (!ret) return NULL;
 
-            if (cur < lo) bgn = lo;
+            /* take the matched ones out and close the gap at once */
+            memcpy(ret->data, ar->data + bgn, (end - bgn + 1) * sizeof(void *));
+            ret->num = end - bgn + 1;
 
-            for (cur = bgn; cur <= end; cur++) {
-                arr_push(ret, arr_delete(ar, bgn));
-            }
+            memmove(ar->data + bgn, ar->data + end + 1, (ar->num - end - 1) * sizeof(void *));
+            ar->num -= end - bgn + 1;
+            memset(ar->data + ar->num, 0, (end - bgn + 1) * sizeof(void *));
 
             return ret;
 
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "epoch.h"
+
+#ifdef UNIX
+#include <sched.h>
+#define ep_yield()   sched_yield()
+#else
+#define ep_yield()   Sleep(0)
+#endif
+
+typedef void EpochFree (void * obj);
+
+/* per-thread record, epoch is 0 when the thread is out of read section */
+typedef struct ep_record_s {
+    struct ep_record_s * next;
+    ulong                epoch;
+    int                  depth;
+    int                  inuse;
+    uint8                pad[64 - sizeof(void *) - sizeof(ulong) - sizeof(int) * 2];
+} EpRecord;
+
+typedef struct ep_retire_s {
+    struct ep_retire_s * next;
+    void               * obj;
+    EpochFree          * func;
+    ulong                epoch;
+} EpRetire;
+
+typedef struct epoch_s {
+    ulong              global;
+    uint8              pad[64 - sizeof(ulong)];
+
+#ifdef UNIX
+    pthread_key_t      key;
+#else
+    DWORD              key;
+#endif
+
+    CRITICAL_SECTION   recCS;
+    EpRecord         * recs;
+
+    CRITICAL_SECTION   retCS;
+    EpRetire         * retired;
+    int                retnum;
+} Epoch;
+
+
+#ifdef UNIX
+static void epoch_thread_exit (void * vrec)
+{
+    EpRecord * rec = (EpRecord *)vrec;
+
+    if (!rec) return;
+
+    rec->depth = 0;
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->inuse, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+void * epoch_new ()
+{
+    Epoch * ep = NULL;
+
+    ep = kzalloc(sizeof(*ep));
+    if (!ep) return NULL;
+
+#ifdef UNIX
+    if (pthread_key_create(&ep->key, epoch_thread_exit) != 0) {
+        kfree(ep);
+        return NULL;
+    }
+#else
+    ep->key = TlsAlloc();
+    if (ep->key == TLS_OUT_OF_INDEXES) {
+        kfree(ep);
+        return NULL;
+    }
+#endif
+
+    ep->global = 1;
+
+    InitializeCriticalSection(&ep->recCS);
+    InitializeCriticalSection(&ep->retCS);
+
+    return ep;
+}
+
+void epoch_free (void * vep)
+{
+    Epoch    * ep = (Epoch *)vep;
+    EpRecord * rec = NULL;
+    EpRetire * ret = NULL;
+
+    if (!ep) return;
+
+#ifdef UNIX
+    pthread_key_delete(ep->key);
+#else
+    TlsFree(ep->key);
+#endif
+
+    while ((ret = ep->retired) != NULL) {
+        ep->retired = ret->next;
+        if (ret->func) (*ret->func)(ret->obj);
+        kfree(ret);
+    }
+
+    while ((rec = ep->recs) != NULL) {
+        ep->recs = rec->next;
+        kfree(rec);
+    }
+
+    DeleteCriticalSection(&ep->recCS);
+    DeleteCriticalSection(&ep->retCS);
+
+    kfree(ep);
+}
+
+static EpRecord * epoch_record (Epoch * ep)
+{
+    EpRecord * rec = NULL;
+    int        zero = 0;
+
+#ifdef UNIX
+    rec = pthread_getspecific(ep->key);
+#else
+    rec = TlsGetValue(ep->key);
+#endif
+    if (rec) return rec;
+
+    /* reuse the record left by an exited thread */
+    for (rec = __atomic_load_n(&ep->recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        zero = 0;
+        if (__atomic_load_n(&rec->inuse, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&rec->inuse, &zero, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!rec) {
+        rec = kzalloc(sizeof(*rec));
+        if (!rec) return NULL;
+        rec->inuse = 1;
+
+        EnterCriticalSection(&ep->recCS);
+        rec->next = ep->recs;
+        __atomic_store_n(&ep->recs, rec, __ATOMIC_RELEASE);
+        LeaveCriticalSection(&ep->recCS);
+    }
+
+#ifdef UNIX
+    pthread_setspecific(ep->key, rec);
+#else
+    TlsSetValue(ep->key, rec);
+#endif
+
+    return rec;
+}
+
+void epoch_enter (void * vep)
+{
+    Epoch    * ep = (Epoch *)vep;
+    EpRecord * rec = NULL;
+
+    if (!ep) return;
+
+    rec = epoch_record(ep);
+    if (!rec) return;
+
+    if (rec->depth++ > 0) return;
+
+    /* the epoch must be visible before the shared pointer is loaded */
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&ep->global, __ATOMIC_ACQUIRE),
+                     __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_leave (void * vep)
+{
+    Epoch    * ep = (Epoch *)vep;
+    EpRecord * rec = NULL;
+
+    if (!ep) return;
+
+    rec = epoch_record(ep);
+    if (!rec || rec->depth <= 0) return;
+
+    if (--rec->depth > 0) return;
+
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* the smallest epoch of the readers in section, ~0 if there's no reader */
+static ulong epoch_min_active (Epoch * ep)
+{
+    EpRecord * rec = NULL;
+    ulong      minep = ~(ulong)0;
+    ulong      val;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (rec = __atomic_load_n(&ep->recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        val = __atomic_load_n(&rec->epoch, __ATOMIC_ACQUIRE);
+        if (val != 0 && val < minep) minep = val;
+    }
+
+    return minep;
+}
+
+int epoch_retire (void * vep, void * obj, void * freefunc)
+{
+    Epoch    * ep = (Epoch *)vep;
+    EpRetire * ret = NULL;
+
+    if (!ep || !obj) return -1;
+
+    ret = kzalloc(sizeof(*ret));
+    if (!ret) return -2;
+
+    ret->obj = obj;
+    ret->func = (EpochFree *)freefunc;
+
+    EnterCriticalSection(&ep->retCS);
+    /* readers entering after the increment can not see obj */
+    ret->epoch = __atomic_fetch_add(&ep->global, 1, __ATOMIC_SEQ_CST);
+    ret->next = ep->retired;
+    ep->retired = ret;
+    ep->retnum++;
+    LeaveCriticalSection(&ep->retCS);
+
+    epoch_reclaim(ep);
+
+    return 0;
+}
+
+int epoch_reclaim (void * vep)
+{
+    Epoch     * ep = (Epoch *)vep;
+    EpRetire  * ret = NULL;
+    EpRetire  * list = NULL;
+    EpRetire ** pprev = NULL;
+    ulong       minep;
+    int         num = 0;
+
+    if (!ep) return 0;
+
+    EnterCriticalSection(&ep->retCS);
+
+    minep = epoch_min_active(ep);
+
+    for (pprev = &ep->retired; (ret = *pprev) != NULL; ) {
+        if (ret->epoch < minep) {
+            *pprev = ret->next;
+            ret->next = list;
+            list = ret;
+            ep->retnum--;
+            continue;
+        }
+        pprev = &ret->next;
+    }
+
+    LeaveCriticalSection(&ep->retCS);
+
+    /* free outside the lock, freefunc may retire again */
+    while ((ret = list) != NULL) {
+        list = ret->next;
+        if (ret->func) (*ret->func)(ret->obj);
+        kfree(ret);
+        num++;
+    }
+
+    return num;
+}
+
+void epoch_synchronize (void * vep)
+{
+    Epoch    * ep = (Epoch *)vep;
+    ulong      target;
+
+    if (!ep) return;
+
+    target = __atomic_fetch_add(&ep->global, 1, __ATOMIC_SEQ_CST) + 1;
+
+    while (epoch_min_active(ep) < target)
+        ep_yield();
+
+    epoch_reclaim(ep);
+}
+
+int epoch_publish (void * vep, void ** slot, void * obj, void * freefunc)
+{
+    void  * old = NULL;
+
+    if (!vep || !slot) return -1;
+
+    old = __atomic_exchange_n(slot, obj, __ATOMIC_SEQ_CST);
+
+    if (old && old != obj)
+        return epoch_retire(vep, old, freefunc);
+
+    return 0;
+}
+
+int epoch_retired (void * vep)
+{
+    Epoch    * ep = (Epoch *)vep;
+
+    if (!ep) return 0;
+
+    return ep->retnum;
+}
+
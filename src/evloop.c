@@ -0,0 +1,808 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "btype.h"
+#include "memory.h"
+#include "btime.h"
+#include "heap.h"
+#include "dynarr.h"
+#include "mthread.h"
+#include "tsock.h"
+#include "frame.h"
+#include "evloop.h"
+
+#if defined(_LINUX_)
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#include <sched.h>
+#elif defined(_FREEBSD_) || defined(OSX)
+#define HAVE_KQUEUE 1
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
+
+#ifdef UNIX
+#include <fcntl.h>
+#include <pthread.h>
+#endif
+
+#define EVCONN_TCP     1
+#define EVCONN_LISTEN  2
+#define EVCONN_WAKEUP  3
+
+/* connections accepted by one accept4 batch of a readiness event */
+#define EV_ACCEPT_BATCH  64
+
+typedef struct ev_conn_s {
+    SOCKET         fd;
+    int            type;
+    uint8          closed;
+
+    void         * loop;
+
+    frame_p        rcvfrm;
+    frame_p        sndfrm;
+
+    EvConnCB     * cb;
+    EvAcceptCB   * acceptcb;
+    void         * para;
+} EvConn;
+
+typedef struct ev_timer_s {
+    btime_t        expire;
+    uint64         seq;
+    uint8          cancelled;
+
+    EvTimerCB    * cb;
+    void         * para;
+} EvTimer;
+
+typedef struct ev_loop_s {
+#if defined(HAVE_EPOLL)
+    int                  epfd;
+    struct epoll_event * evs;
+#elif defined(HAVE_KQUEUE)
+    int                  kqfd;
+    struct kevent      * evs;
+#endif
+    int                  evnum;
+
+    /* a pipe is watched to wake up the waiting from other threads */
+    int                  wakefd[2];
+    EvConn             * wakeconn;
+
+    CRITICAL_SECTION     timerCS;
+    heap_t             * timerheap;
+    uint64               timerseq;
+
+    /* conns closed in current iteration are freed after dispatching */
+    arr_t              * closelist;
+
+    int                  conns;
+    int                  quit;
+} EvLoop;
+
+typedef struct ev_loop_pool_s {
+    int                  num;
+    EvLoop            ** loops;
+#ifdef UNIX
+    pthread_t          * tids;
+#endif
+    uint32               next;
+} EvLoopPool;
+
+
+static int evtimer_cmp (void * a, void * b)
+{
+    EvTimer * ta = (EvTimer *)a;
+    EvTimer * tb = (EvTimer *)b;
+
+    if (btime_cmp(&ta->expire, <, &tb->expire)) return -1;
+    if (btime_cmp(&ta->expire, >, &tb->expire)) return 1;
+
+    return ta->seq < tb->seq ? -1 : (ta->seq > tb->seq ? 1 : 0);
+}
+
+static int evloop_register (EvLoop * loop, EvConn * conn)
+{
+#if defined(HAVE_EPOLL)
+    struct epoll_event  ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = conn;
+
+    /* edge-triggered, both directions are watched once for the lifetime */
+    if (conn->type == EVCONN_TCP)
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    else
+        ev.events = EPOLLIN | EPOLLET;
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+
+#elif defined(HAVE_KQUEUE)
+    struct kevent  kev[2];
+    int            n = 0;
+
+    EV_SET(&kev[n++], conn->fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, conn);
+    if (conn->type == EVCONN_TCP)
+        EV_SET(&kev[n++], conn->fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, conn);
+
+    return kevent(loop->kqfd, kev, n, NULL, 0, NULL);
+
+#else
+    return -1;
+#endif
+}
+
+static void evloop_unregister (EvLoop * loop, EvConn * conn)
+{
+#if defined(HAVE_EPOLL)
+    struct epoll_event  ev;
+
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, &ev);
+
+#elif defined(HAVE_KQUEUE)
+    struct kevent  kev[2];
+    int            n = 0;
+
+    EV_SET(&kev[n++], conn->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    if (conn->type == EVCONN_TCP)
+        EV_SET(&kev[n++], conn->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+
+    kevent(loop->kqfd, kev, n, NULL, 0, NULL);
+#endif
+}
+
+
+void * evloop_new (int maxevents)
+{
+#if defined(HAVE_EPOLL) || defined(HAVE_KQUEUE)
+    EvLoop * loop = NULL;
+
+    if (maxevents <= 0) maxevents = EVLOOP_MAXEVENTS;
+
+    loop = kzalloc(sizeof(*loop));
+    if (!loop) return NULL;
+
+    loop->wakefd[0] = loop->wakefd[1] = -1;
+    loop->evnum = maxevents;
+
+#if defined(HAVE_EPOLL)
+    loop->epfd = epoll_create(maxevents);
+    loop->evs = kzalloc(sizeof(struct epoll_event) * maxevents);
+    if (loop->epfd < 0 || !loop->evs) goto failed;
+#else
+    loop->kqfd = kqueue();
+    loop->evs = kzalloc(sizeof(struct kevent) * maxevents);
+    if (loop->kqfd < 0 || !loop->evs) goto failed;
+#endif
+
+    InitializeCriticalSection(&loop->timerCS);
+    loop->timerheap = heap_new(evtimer_cmp, 64);
+    loop->closelist = arr_new(16);
+
+    if (pipe(loop->wakefd) < 0) goto failed;
+    sock_nonblock_set(loop->wakefd[0], 1);
+    sock_nonblock_set(loop->wakefd[1], 1);
+
+    loop->wakeconn = kzalloc(sizeof(EvConn));
+    if (!loop->wakeconn) goto failed;
+
+    loop->wakeconn->fd = loop->wakefd[0];
+    loop->wakeconn->type = EVCONN_WAKEUP;
+    loop->wakeconn->loop = loop;
+
+    if (evloop_register(loop, loop->wakeconn) < 0)
+        goto failed;
+
+    return loop;
+
+failed:
+    evloop_free(loop);
+    return NULL;
+#else
+    return NULL;
+#endif
+}
+
+static void evconn_free (EvConn * conn)
+{
+    if (!conn) return;
+
+    if (conn->rcvfrm) frame_free(conn->rcvfrm);
+    if (conn->sndfrm) frame_free(conn->sndfrm);
+
+    kfree(conn);
+}
+
+void evloop_free (void * vloop)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+
+    if (!loop) return;
+
+#if defined(HAVE_EPOLL)
+    if (loop->epfd >= 0) close(loop->epfd);
+#elif defined(HAVE_KQUEUE)
+    if (loop->kqfd >= 0) close(loop->kqfd);
+#endif
+
+    if (loop->wakefd[0] >= 0) close(loop->wakefd[0]);
+    if (loop->wakefd[1] >= 0) close(loop->wakefd[1]);
+
+    if (loop->wakeconn) kfree(loop->wakeconn);
+
+    if (loop->closelist) {
+        arr_pop_free(loop->closelist, evconn_free);
+        loop->closelist = NULL;
+    }
+
+    if (loop->timerheap) {
+        DeleteCriticalSection(&loop->timerCS);
+        heap_pop_kfree(loop->timerheap);
+        loop->timerheap = NULL;
+    }
+
+    if (loop->evs) kfree(loop->evs);
+
+    kfree(loop);
+}
+
+
+static void evconn_readable (EvLoop * loop, EvConn * conn, int hangup)
+{
+    SOCKET   fds[EV_ACCEPT_BATCH];
+    int      i, num = 0;
+    int      ret, err = 0;
+    uint8    buf[256];
+
+    if (conn->type == EVCONN_WAKEUP) {
+#ifdef UNIX
+        while (read(conn->fd, buf, sizeof(buf)) > 0);
+#endif
+        return;
+    }
+
+    if (conn->type == EVCONN_LISTEN) {
+        /* edge-triggered, accept all pending connections */
+        for (num = EV_ACCEPT_BATCH; !conn->closed && num == EV_ACCEPT_BATCH; ) {
+            num = tcp_accept_batch(conn->fd, fds, NULL, EV_ACCEPT_BATCH, 1, &err);
+            if (num < 0) break;
+
+            for (i = 0; i < num; i++) {
+                if (conn->closed || !conn->acceptcb ||
+                    (*conn->acceptcb)(conn->para, conn, fds[i]) < 0)
+                    closesocket(fds[i]);
+            }
+        }
+        return;
+    }
+
+    /* drain the socket till EAGAIN, as required by edge-triggered mode */
+    ret = frame_tcp_nbzc_recv(conn->rcvfrm, conn->fd, &num, &err);
+
+    if (num > 0 && conn->cb) {
+        if ((*conn->cb)(conn->para, conn, EV_READ) < 0) {
+            evconn_close(conn);
+            return;
+        }
+    }
+
+    if (ret < 0 || (hangup && num == 0)) {
+        if (conn->closed) return;
+
+        if (conn->cb) (*conn->cb)(conn->para, conn, EV_CLOSE);
+        evconn_close(conn);
+    }
+}
+
+static void evconn_writable (EvLoop * loop, EvConn * conn)
+{
+    int   num = 0;
+    int   ret;
+
+    if (conn->type != EVCONN_TCP || conn->closed)
+        return;
+
+    if (frame_len(conn->sndfrm) > 0) {
+        ret = frame_tcp_nb_send(conn->sndfrm, conn->fd, &num);
+        if (num > 0) frame_del_first(conn->sndfrm, num);
+
+        if (ret < 0) {
+            if (conn->cb) (*conn->cb)(conn->para, conn, EV_CLOSE);
+            evconn_close(conn);
+            return;
+        }
+
+        if (frame_len(conn->sndfrm) > 0)
+            return;
+
+        if (conn->cb && (*conn->cb)(conn->para, conn, EV_WRITE) < 0)
+            evconn_close(conn);
+    }
+}
+
+static int evloop_timer_wait (EvLoop * loop, int waitms)
+{
+    EvTimer  * timer = NULL;
+    btime_t    now;
+    long       ms;
+
+    EnterCriticalSection(&loop->timerCS);
+    timer = heap_value(loop->timerheap, 0);
+    if (timer) {
+        btime_mono(&now);
+        ms = btime_diff_ms(&now, &timer->expire);
+        if (ms < 0) ms = 0;
+        if (waitms < 0 || ms < waitms) waitms = ms;
+    }
+    LeaveCriticalSection(&loop->timerCS);
+
+    return waitms;
+}
+
+static int evloop_timer_fire (EvLoop * loop)
+{
+    EvTimer  * timer = NULL;
+    btime_t    now;
+    int        num = 0;
+
+    btime_mono(&now);
+
+    for ( ; ; ) {
+        EnterCriticalSection(&loop->timerCS);
+        timer = heap_value(loop->timerheap, 0);
+        if (!timer || btime_cmp(&timer->expire, >, &now)) {
+            LeaveCriticalSection(&loop->timerCS);
+            break;
+        }
+        heap_pop(loop->timerheap);
+        LeaveCriticalSection(&loop->timerCS);
+
+        if (!timer->cancelled && timer->cb) {
+            (*timer->cb)(timer->para, timer);
+            num++;
+        }
+
+        kfree(timer);
+    }
+
+    return num;
+}
+
+int evloop_once (void * vloop, int waitms)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    EvConn   * conn = NULL;
+    int        i, num;
+    int        hangup;
+
+    if (!loop) return -1;
+
+    waitms = evloop_timer_wait(loop, waitms);
+
+#if defined(HAVE_EPOLL)
+    num = epoll_wait(loop->epfd, loop->evs, loop->evnum, waitms);
+    if (num < 0 && errno != EINTR) return -100;
+
+    for (i = 0; i < num; i++) {
+        conn = loop->evs[i].data.ptr;
+        if (!conn || conn->closed) continue;
+
+        hangup = (loop->evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) ? 1 : 0;
+
+        if (loop->evs[i].events & EPOLLOUT)
+            evconn_writable(loop, conn);
+
+        if (!conn->closed && (loop->evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)))
+            evconn_readable(loop, conn, hangup);
+    }
+
+#elif defined(HAVE_KQUEUE)
+    struct timespec  ts, * pts = NULL;
+
+    if (waitms >= 0) {
+        ts.tv_sec = waitms / 1000;
+        ts.tv_nsec = (waitms % 1000) * 1000000;
+        pts = &ts;
+    }
+
+    num = kevent(loop->kqfd, NULL, 0, loop->evs, loop->evnum, pts);
+    if (num < 0 && errno != EINTR) return -100;
+
+    for (i = 0; i < num; i++) {
+        conn = (EvConn *)loop->evs[i].udata;
+        if (!conn || conn->closed) continue;
+
+        hangup = (loop->evs[i].flags & (EV_EOF | EV_ERROR)) ? 1 : 0;
+
+        if (loop->evs[i].filter == EVFILT_WRITE)
+            evconn_writable(loop, conn);
+        else if (loop->evs[i].filter == EVFILT_READ)
+            evconn_readable(loop, conn, hangup);
+    }
+#else
+    num = 0;
+#endif
+
+    if (num < 0) num = 0;
+
+    num += evloop_timer_fire(loop);
+
+    while ((conn = arr_pop(loop->closelist)) != NULL)
+        evconn_free(conn);
+
+    return num;
+}
+
+int evloop_run (void * vloop)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    int        ret;
+
+    if (!loop) return -1;
+
+    loop->quit = 0;
+
+    while (!loop->quit) {
+        ret = evloop_once(loop, 1000);
+        if (ret < 0) return ret;
+    }
+
+    return 0;
+}
+
+void evloop_stop (void * vloop)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    uint8      c = 0;
+
+    if (!loop) return;
+
+    loop->quit = 1;
+
+#ifdef UNIX
+    if (write(loop->wakefd[1], &c, 1) < 0) {
+        /* pipe is full, the loop is being waked up anyway */
+    }
+#endif
+}
+
+int evloop_conns (void * vloop)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+
+    if (!loop) return 0;
+
+    return loop->conns;
+}
+
+
+static EvConn * evconn_alloc (EvLoop * loop, SOCKET fd, int type)
+{
+    EvConn   * conn = NULL;
+
+    if (!loop || fd == INVALID_SOCKET) return NULL;
+
+    conn = kzalloc(sizeof(*conn));
+    if (!conn) return NULL;
+
+    conn->fd = fd;
+    conn->type = type;
+    conn->loop = loop;
+
+    sock_nonblock_set(fd, 1);
+
+    return conn;
+}
+
+void * evconn_add (void * vloop, SOCKET fd, EvConnCB * cb, void * para)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    EvConn   * conn = NULL;
+
+    conn = evconn_alloc(loop, fd, EVCONN_TCP);
+    if (!conn) return NULL;
+
+    conn->cb = cb;
+    conn->para = para;
+    conn->rcvfrm = frame_new(4096);
+
+    __sync_fetch_and_add(&loop->conns, 1);
+
+    if (evloop_register(loop, conn) < 0) {
+        __sync_fetch_and_sub(&loop->conns, 1);
+        evconn_free(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+void * evlisten_add (void * vloop, SOCKET fd, EvAcceptCB * cb, void * para)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    EvConn   * conn = NULL;
+
+    conn = evconn_alloc(loop, fd, EVCONN_LISTEN);
+    if (!conn) return NULL;
+
+    conn->acceptcb = cb;
+    conn->para = para;
+
+    if (evloop_register(loop, conn) < 0) {
+        evconn_free(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+int evconn_close (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+    EvLoop   * loop = NULL;
+
+    if (!conn) return -1;
+    if (conn->closed) return 0;
+
+    loop = (EvLoop *)conn->loop;
+
+    conn->closed = 1;
+
+    evloop_unregister(loop, conn);
+    closesocket(conn->fd);
+    conn->fd = INVALID_SOCKET;
+
+    if (conn->type == EVCONN_TCP)
+        __sync_fetch_and_sub(&loop->conns, 1);
+
+    arr_push(loop->closelist, conn);
+
+    return 0;
+}
+
+int evconn_send (void * vconn, void * pbyte, int len)
+{
+    EvConn   * conn = (EvConn *)vconn;
+    int        num = 0;
+    int        ret;
+
+    if (!conn || conn->closed) return -1;
+    if (!pbyte || len <= 0) return 0;
+
+    /* keep the order of bytes, append after the pending */
+    if (frame_len(conn->sndfrm) > 0) {
+        frame_put_nlast(conn->sndfrm, pbyte, len);
+        return 0;
+    }
+
+    ret = tcp_nb_send(conn->fd, pbyte, len, &num);
+    if (ret < 0) return ret;
+
+    if (num < len) {
+        if (!conn->sndfrm) conn->sndfrm = frame_new(len - num);
+        frame_put_nlast(conn->sndfrm, (uint8 *)pbyte + num, len - num);
+    }
+
+    return num;
+}
+
+int evconn_sendfrm (void * vconn, frame_p frm)
+{
+    return evconn_send(vconn, frame_bgn(frm), frame_len(frm));
+}
+
+int evconn_pending (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+
+    if (!conn) return 0;
+
+    return frame_len(conn->sndfrm);
+}
+
+SOCKET evconn_fd (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+
+    if (!conn) return INVALID_SOCKET;
+
+    return conn->fd;
+}
+
+frame_p evconn_rcvfrm (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+
+    if (!conn) return NULL;
+
+    return conn->rcvfrm;
+}
+
+void * evconn_para (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+
+    if (!conn) return NULL;
+
+    return conn->para;
+}
+
+void * evconn_loop (void * vconn)
+{
+    EvConn   * conn = (EvConn *)vconn;
+
+    if (!conn) return NULL;
+
+    return conn->loop;
+}
+
+
+void * evtimer_add (void * vloop, long ms, EvTimerCB * cb, void * para)
+{
+    EvLoop   * loop = (EvLoop *)vloop;
+    EvTimer  * timer = NULL;
+    int        first = 0;
+    uint8      c = 0;
+
+    if (!loop || !cb) return NULL;
+
+    timer = kzalloc(sizeof(*timer));
+    if (!timer) return NULL;
+
+    btime_mono_add(&timer->expire, ms);
+    timer->cb = cb;
+    timer->para = para;
+
+    EnterCriticalSection(&loop->timerCS);
+    timer->seq = loop->timerseq++;
+    heap_push(loop->timerheap, timer);
+    first = (heap_value(loop->timerheap, 0) == timer);
+    LeaveCriticalSection(&loop->timerCS);
+
+    /* the loop may be waiting longer than the new timer */
+#ifdef UNIX
+    if (first && write(loop->wakefd[1], &c, 1) < 0) {
+    }
+#endif
+
+    return timer;
+}
+
+int evtimer_del (void * vtimer)
+{
+    EvTimer  * timer = (EvTimer *)vtimer;
+
+    if (!timer) return -1;
+
+    /* freed lazily when it comes to the top of heap */
+    timer->cancelled = 1;
+
+    return 0;
+}
+
+
+#ifdef UNIX
+static void * evloop_pool_thread (void * arg)
+{
+    evloop_run(arg);
+    return NULL;
+}
+#endif
+
+void * evloop_pool_new (int num, int maxevents)
+{
+#ifdef UNIX
+    EvLoopPool * pool = NULL;
+    int          ncpu, i;
+#if defined(HAVE_EPOLL)
+    cpu_set_t    cpuset;
+#endif
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 1;
+
+    if (num <= 0) num = ncpu;
+
+    pool = kzalloc(sizeof(*pool));
+    if (!pool) return NULL;
+
+    pool->loops = kzalloc(sizeof(EvLoop *) * num);
+    pool->tids = kzalloc(sizeof(pthread_t) * num);
+    if (!pool->loops || !pool->tids) goto failed;
+
+    for (i = 0; i < num; i++) {
+        pool->loops[i] = evloop_new(maxevents);
+        if (!pool->loops[i]) goto failed;
+        pool->num++;
+
+        if (pthread_create(&pool->tids[i], NULL, evloop_pool_thread, pool->loops[i]) != 0) {
+            evloop_free(pool->loops[i]);
+            pool->loops[i] = NULL;
+            pool->num--;
+            goto failed;
+        }
+
+#if defined(HAVE_EPOLL)
+        CPU_ZERO(&cpuset);
+        CPU_SET(i % ncpu, &cpuset);
+        pthread_setaffinity_np(pool->tids[i], sizeof(cpuset), &cpuset);
+#endif
+    }
+
+    return pool;
+
+failed:
+    evloop_pool_free(pool);
+    return NULL;
+#else
+    return NULL;
+#endif
+}
+
+void evloop_pool_free (void * vpool)
+{
+    EvLoopPool * pool = (EvLoopPool *)vpool;
+    int          i;
+
+    if (!pool) return;
+
+#ifdef UNIX
+    for (i = 0; i < pool->num; i++)
+        evloop_stop(pool->loops[i]);
+
+    for (i = 0; i < pool->num; i++)
+        pthread_join(pool->tids[i], NULL);
+#endif
+
+    for (i = 0; i < pool->num; i++)
+        evloop_free(pool->loops[i]);
+
+    if (pool->loops) kfree(pool->loops);
+#ifdef UNIX
+    if (pool->tids) kfree(pool->tids);
+#endif
+
+    kfree(pool);
+}
+
+int evloop_pool_num (void * vpool)
+{
+    EvLoopPool * pool = (EvLoopPool *)vpool;
+
+    if (!pool) return 0;
+
+    return pool->num;
+}
+
+void * evloop_pool_get (void * vpool, int index)
+{
+    EvLoopPool * pool = (EvLoopPool *)vpool;
+
+    if (!pool || index < 0 || index >= pool->num)
+        return NULL;
+
+    return pool->loops[index];
+}
+
+/* round-robin, the new connection goes to the next loop */
+void * evloop_pool_next (void * vpool)
+{
+    EvLoopPool * pool = (EvLoopPool *)vpool;
+    uint32       index;
+
+    if (!pool || pool->num <= 0) return NULL;
+
+    index = __sync_fetch_and_add(&pool->next, 1);
+
+    return pool->loops[index % pool->num];
+}
+
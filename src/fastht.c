@@ -6,8 +6,15 @@
 #include "btype.h"
 #include <math.h>
 #include "memory.h"
+#include "hashtab.h"
 #include "fastht.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 typedef int (FAST_HASH_FREE) (void * val, int valen);
 
 uint32 hash_crypt_table[1280] = { 0 };
@@ -68,6 +75,13 @@ uint32 fast_hash_func (void * pkey, int keylen, int hashtype)
     if (keylen < 0) keylen = strlen((char *)key);
     if (keylen <= 0) return 0;
 
+    if (hashtype == HASH_WY_OFFSET)
+        return (uint32)wy_hash_nocase(key, keylen, hash_random_seed() ^ 0x9E3779B97F4A7C15ULL);
+    if (hashtype == HASH_WY_A)
+        return (uint32)wy_hash_nocase(key, keylen, hash_random_seed());
+    if (hashtype == HASH_WY_B)
+        return (uint32)(wy_hash_nocase(key, keylen, hash_random_seed()) >> 32);
+
     if (!crypt_table_init)
         fast_ht_crypt_table_init();
 
@@ -80,6 +94,184 @@ uint32 fast_hash_func (void * pkey, int keylen, int hashtype)
 
     return seed1;
 }
+
+static void fast_ht_hash (FastHashTab * ht, void * key, int keylen,
+                          uint32 * hash, uint32 * hashA, uint32 * hashB)
+{
+    uint64  h = 0;
+
+    if (!ht->wyhash) {
+        *hash = fast_hash_func(key, keylen, HASH_OFFSET);
+        *hashA = fast_hash_func(key, keylen, HASH_A);
+        *hashB = fast_hash_func(key, keylen, HASH_B);
+        return;
+    }
+
+    if (!key || keylen == 0) {
+        *hash = *hashA = *hashB = 0;
+        return;
+    }
+    if (keylen < 0) keylen = strlen((char *)key);
+
+    /* one 64-bit hash checks the identity, another one locates the slot */
+    h = wy_hash_nocase(key, keylen, ht->seed);
+    *hashA = (uint32)h;
+    *hashB = (uint32)(h >> 32);
+    *hash = (uint32)wy_hash_nocase(key, keylen, ht->seed ^ 0x9E3779B97F4A7C15ULL);
+}
+
+
+/* the image of fast_ht_save. the header of 64 bytes is followed by the slot
+ * array and the data. the value bytes of a slot start at off from the data,
+ * aligned to 8 bytes, followed by the key bytes */
+
+#define FAST_IMAGE_MAGIC    0x49544846   /* FHTI */
+#define FAST_IMAGE_VERSION  1
+
+typedef struct fast_image_hdr {
+    uint32    magic;
+    uint16    version;
+    uint8     wyhash;
+    uint8     resv;
+    uint32    slotsize;
+    uint32    resv2;
+    uint64    seed;
+    uint64    size;
+    uint64    num;
+    uint64    dataoff;
+    uint64    datalen;
+    uint64    resv3;
+} FastImageHdr;
+
+typedef struct fast_image_slot {
+    uint32    hashA;
+    uint32    hashB;
+    uint8     exist;
+    uint8     rawval;   //the value is off itself, not located in data
+    uint16    resv;
+    uint32    keylen;   //0 if the key is not kept
+    int32     vallen;
+    uint32    resv2;
+    uint64    off;
+} FastImageSlot;
+
+static int fast_image_check (FastImageHdr * hdr, uint64 len)
+{
+    if (len < sizeof(*hdr)) return -1;
+
+    if (hdr->magic != FAST_IMAGE_MAGIC || hdr->version != FAST_IMAGE_VERSION ||
+        hdr->slotsize != sizeof(FastImageSlot))
+        return -2;
+
+    if (hdr->size == 0 || hdr->size > (len - sizeof(*hdr)) / sizeof(FastImageSlot))
+        return -3;
+
+    if (hdr->dataoff != sizeof(*hdr) + hdr->size * sizeof(FastImageSlot) ||
+        hdr->datalen > len - hdr->dataoff)
+        return -4;
+
+    return 0;
+}
+
+static void fast_image_release (FastHashTab * ht)
+{
+#ifdef UNIX
+    if (ht->mapped) {
+        munmap(ht->image, ht->imagelen);
+        ht->image = NULL;
+        return;
+    }
+#endif
+    kfree_huge(ht->image);
+    ht->image = NULL;
+}
+
+static int fast_image_keycmp (uint8 * a, uint8 * b, int len)
+{
+    int  i;
+
+    for (i = 0; i < len; i++) {
+        if (adf_toupper(a[i]) != adf_toupper(b[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* probe the image from the hashes of the key computed by fast_ht_hash */
+static void * fast_image_find (FastHashTab * ht, void * key, int keylen, uint32 hash,
+                               uint32 hashA, uint32 hashB, void ** pval, int * vallen)
+{
+    FastImageHdr  * hdr = (FastImageHdr *)ht->image;
+    FastImageSlot * tab = (FastImageSlot *)(hdr + 1);
+    FastImageSlot * slot = NULL;
+    uint8         * data = (uint8 *)ht->image + hdr->dataoff;
+    void          * val = NULL;
+    uint32          hashbgn = 0;
+
+    if (key && keylen < 0) keylen = strlen((char *)key);
+
+    hash %= ht->size;
+    hashbgn = hash;
+
+    while (tab[hash].exist) {
+        slot = &tab[hash];
+
+        if (slot->hashA == hashA && slot->hashB == hashB) {
+            if (slot->rawval) {
+                val = (void *)(ulong)slot->off;
+                break;
+            }
+
+            /* the offsets of a damaged image never reach outside */
+            if (slot->vallen < 0 || slot->off > hdr->datalen ||
+                (uint64)slot->keylen + slot->vallen > hdr->datalen - slot->off)
+                break;
+
+            if (slot->keylen == 0 ||
+                (slot->keylen == (uint32)keylen && key &&
+                 fast_image_keycmp(data + slot->off + slot->vallen, key, keylen) == 0))
+            {
+                val = data + slot->off;
+                break;
+            }
+        }
+
+        hash = (hash + 1) % ht->size;
+        if (hash == hashbgn) break;
+    }
+
+    if (!val) slot = NULL;
+
+    if (pval) *pval = val;
+    if (vallen) *vallen = slot ? slot->vallen : 0;
+    return val;
+}
+
+static void * fast_ht_find (FastHashTab * ht, uint32 hash, uint32 hashA, uint32 hashB,
+                            void ** pval, int * vallen)
+{
+    uint32  hashbgn = 0;
+
+    hash %= ht->size;
+    hashbgn = hash;
+
+    while (ht->ptab[hash].exist) {
+        if (ht->ptab[hash].hashA == hashA && ht->ptab[hash].hashB == hashB) {
+            if (pval) *pval = ht->ptab[hash].value;
+            if (vallen) *vallen = ht->ptab[hash].valuelen;
+            return ht->ptab[hash].value;
+        }
+
+        hash = (hash + 1) % ht->size;
+
+        if (hash == hashbgn) break;
+    }
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+    return NULL;
+}
  
 
 void * fast_ht_new (ulong num)
@@ -93,7 +285,7 @@ void * fast_ht_new (ulong num)
     ht->size = find_a_prime (num);
     ht->num = 0;
  
-    ht->ptab = kzalloc(ht->size * sizeof(FastHashNode));
+    ht->ptab = kzalloc_huge(ht->size * sizeof(FastHashNode));
     if (ht->ptab == NULL) {
         kfree(ht);
         return NULL;
@@ -103,13 +295,27 @@ void * fast_ht_new (ulong num)
 }
 
 
+int fast_ht_set_wyhash (void * vht, uint64 seed)
+{
+    FastHashTab * ht = (FastHashTab *)vht;
+
+    if (!ht || ht->image) return -1;
+
+    if (seed == 0) seed = hash_random_seed() ^ (uint64)(ulong)ht;
+
+    ht->wyhash = 1;
+    ht->seed = seed;
+    return 0;
+}
+
 void fast_ht_free (void * vht)
 {
     FastHashTab * ht = (FastHashTab *)vht;
 
     if (!ht) return;
  
-    kfree(ht->ptab);
+    if (ht->image) fast_image_release(ht);
+    kfree_huge(ht->ptab);
     kfree(ht);
 }
  
@@ -122,7 +328,7 @@ void fast_ht_free_all (void * vht, void * vfunc)
  
     if (!ht) return;
  
-    if (func == NULL) {
+    if (func == NULL || ht->image) {
         fast_ht_free(ht);
         return;
     }
@@ -133,7 +339,7 @@ void fast_ht_free_all (void * vht, void * vfunc)
         }
     }
  
-    kfree(ht->ptab);
+    kfree_huge(ht->ptab);
     kfree(ht);
 }
  
@@ -143,7 +349,7 @@ void fast_ht_free_member (void * vht, void * vfunc)
     ulong         i = 0;
     FAST_HASH_FREE * func = (FAST_HASH_FREE *)vfunc;
  
-    if (!ht) return;
+    if (!ht || ht->image) return;
  
     if (func == NULL) return fast_ht_zero(ht);
  
@@ -164,7 +370,7 @@ void fast_ht_zero (void * vht)
     FastHashTab * ht = (FastHashTab *)vht;
     ulong         i = 0;
  
-    if (!ht) return;
+    if (!ht || ht->image) return;
  
     for (i = 0; i < ht->size; i++) {
         if (ht->ptab[i].exist) {
@@ -189,32 +395,71 @@ void * fast_ht_get (void * vht, void * key, int keylen, void ** pval, int * vall
     uint32  hash = 0;
     uint32  hashA = 0;
     uint32  hashB = 0;
-    uint32  hashbgn = 0;
 
     if (!ht) return NULL;
 
-    hash = fast_hash_func(key, keylen, HASH_OFFSET);
-    hashA = fast_hash_func(key, keylen, HASH_A);
-    hashB = fast_hash_func(key, keylen, HASH_B);
+    fast_ht_hash(ht, key, keylen, &hash, &hashA, &hashB);
 
-    hash %= ht->size;
-    hashbgn = hash;
+    if (ht->image)
+        return fast_image_find(ht, key, keylen, hash, hashA, hashB, pval, vallen);
 
-    while (ht->ptab[hash].exist) {
-        if (ht->ptab[hash].hashA == hashA && ht->ptab[hash].hashB == hashB) {
-            if (pval) *pval = ht->ptab[hash].value;
-            if (vallen) *vallen = ht->ptab[hash].valuelen;
-            return ht->ptab[hash].value;
+    return fast_ht_find(ht, hash, hashA, hashB, pval, vallen);
+}
+
+/* look up num keys at once, keylens NULL means the keys are strings. the
+ * keys are hashed a group at a time and the home slots of the group are
+ * prefetched before any is probed, so the cache misses of the group are
+ * waited for together instead of one after another. vallens may be NULL.
+ * return the number of keys found */
+
+#define FAST_BATCH_GROUP  16
+
+int fast_ht_get_batch (void * vht, void ** keys, int * keylens, int num,
+                       void ** vals, int * vallens)
+{
+    FastHashTab   * ht = (FastHashTab *)vht;
+    FastImageHdr  * hdr = NULL;
+    FastImageSlot * itab = NULL;
+    uint32          hash[FAST_BATCH_GROUP];
+    uint32          hashA[FAST_BATCH_GROUP];
+    uint32          hashB[FAST_BATCH_GROUP];
+    int             i, j, n, keylen;
+    int             found = 0;
+
+    if (!ht || !keys || !vals || num <= 0) return 0;
+
+    if (ht->image) {
+        hdr = (FastImageHdr *)ht->image;
+        itab = (FastImageSlot *)(hdr + 1);
+    }
+
+    for (i = 0; i < num; i += n) {
+        n = num - i;
+        if (n > FAST_BATCH_GROUP) n = FAST_BATCH_GROUP;
+
+        for (j = 0; j < n; j++) {
+            keylen = keylens ? keylens[i + j] : -1;
+            fast_ht_hash(ht, keys[i + j], keylen, &hash[j], &hashA[j], &hashB[j]);
+
+            if (itab) __builtin_prefetch(&itab[hash[j] % ht->size], 0, 1);
+            else __builtin_prefetch(&ht->ptab[hash[j] % ht->size], 0, 1);
         }
 
-        hash = (hash + 1) % ht->size;
-     
-        if (hash == hashbgn) break;
+        for (j = 0; j < n; j++) {
+            keylen = keylens ? keylens[i + j] : -1;
+
+            if (itab)
+                vals[i + j] = fast_image_find(ht, keys[i + j], keylen, hash[j], hashA[j], hashB[j],
+                                              NULL, vallens ? &vallens[i + j] : NULL);
+            else
+                vals[i + j] = fast_ht_find(ht, hash[j], hashA[j], hashB[j],
+                                           NULL, vallens ? &vallens[i + j] : NULL);
+
+            if (vals[i + j]) found++;
+        }
     }
 
-    if (pval) *pval = NULL;
-    if (vallen) *vallen = 0;
-    return NULL;
+    return found;
 }
 
 int fast_ht_set (void * vht, void * key, int keylen, void * value, int valuelen)
@@ -225,11 +470,9 @@ int fast_ht_set (void * vht, void * key, int keylen, void * value, int valuelen)
     uint32  hashB = 0;
     uint32  hashbgn = 0;
 
-    if (!ht) return -1;
+    if (!ht || ht->image) return -1;
 
-    hash = fast_hash_func(key, keylen, HASH_OFFSET);
-    hashA = fast_hash_func(key, keylen, HASH_A);
-    hashB = fast_hash_func(key, keylen, HASH_B);
+    fast_ht_hash(ht, key, keylen, &hash, &hashA, &hashB);
 
     hash %= ht->size;
     hashbgn = hash;
@@ -262,11 +505,9 @@ void * fast_ht_del (void * vht, void * key, int keylen, void ** pval, int * vall
     uint32   hashbgn = 0;
     void   * old = NULL;
 
-    if (!ht) return NULL;
+    if (!ht || ht->image) return NULL;
 
-    hash = fast_hash_func(key, keylen, HASH_OFFSET);
-    hashA = fast_hash_func(key, keylen, HASH_A);
-    hashB = fast_hash_func(key, keylen, HASH_B);
+    fast_ht_hash(ht, key, keylen, &hash, &hashA, &hashB);
 
     hash %= ht->size;
     hashbgn = hash;
@@ -292,3 +533,324 @@ void * fast_ht_del (void * vht, void * key, int keylen, void ** pval, int * vall
     return NULL;
 }
 
+
+static int fast_image_pad (FILE * fp, uint64 len)
+{
+    static uint8 zero[8] = {0};
+
+    if ((len & 7) == 0) return 0;
+
+    return fwrite(zero, 1, 8 - (len & 7), fp) == 8 - (len & 7) ? 0 : -1;
+}
+
+#define FAST_IMAGE_ALIGN(len)  (((len) + 7) & ~(uint64)7)
+
+int fast_ht_save (void * vht, char * file)
+{
+    FastHashTab   * ht = (FastHashTab *)vht;
+    FastHashNode  * node = NULL;
+    FastImageHdr    hdr;
+    FastImageSlot   slot;
+    FILE          * fp = NULL;
+    uint64          off = 0;
+    ulong           i;
+
+    if (!ht || !file) return -1;
+
+    fp = fopen(file, "wb");
+    if (!fp) return -2;
+
+    /* a loaded image is saved as it is */
+    if (ht->image) {
+        if (fwrite(ht->image, 1, ht->imagelen, fp) != ht->imagelen)
+            goto failed;
+        fclose(fp);
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FAST_IMAGE_MAGIC;
+    hdr.version = FAST_IMAGE_VERSION;
+    hdr.wyhash = ht->wyhash;
+    hdr.slotsize = sizeof(FastImageSlot);
+    hdr.seed = ht->seed;
+    hdr.size = ht->size;
+    hdr.dataoff = sizeof(hdr) + (uint64)ht->size * sizeof(FastImageSlot);
+
+    for (i = 0; i < ht->size; i++) {
+        node = &ht->ptab[i];
+        if (!node->exist) continue;
+
+        hdr.num++;
+        if (node->value && node->valuelen > 0)
+            hdr.datalen += FAST_IMAGE_ALIGN(node->valuelen);
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        goto failed;
+
+    for (i = 0; i < ht->size; i++) {
+        node = &ht->ptab[i];
+        memset(&slot, 0, sizeof(slot));
+
+        if (node->exist) {
+            slot.exist = 1;
+            slot.hashA = node->hashA;
+            slot.hashB = node->hashB;
+            slot.vallen = node->valuelen;
+
+            if (node->value && node->valuelen > 0) {
+                slot.off = off;
+                off += FAST_IMAGE_ALIGN(node->valuelen);
+            } else {
+                slot.rawval = 1;
+                slot.off = (uint64)(ulong)node->value;
+            }
+        }
+
+        if (fwrite(&slot, sizeof(slot), 1, fp) != 1)
+            goto failed;
+    }
+
+    for (i = 0; i < ht->size; i++) {
+        node = &ht->ptab[i];
+        if (!node->exist || !node->value || node->valuelen <= 0) continue;
+
+        if (fwrite(node->value, 1, node->valuelen, fp) != (size_t)node->valuelen ||
+            fast_image_pad(fp, node->valuelen) < 0)
+            goto failed;
+    }
+
+    if (fclose(fp) != 0) return -3;
+    return 0;
+
+failed:
+    fclose(fp);
+    return -3;
+}
+
+void * fast_ht_mmap_load (char * file, int populate)
+{
+    FastHashTab  * ht = NULL;
+    FastImageHdr * hdr = NULL;
+    uint8        * pimg = NULL;
+    uint64         len = 0;
+    uint8          mapped = 0;
+#ifdef UNIX
+    struct stat    st;
+    int            fd = -1;
+    int            flags = MAP_SHARED;
+#else
+    FILE         * fp = NULL;
+#endif
+
+    if (!file) return NULL;
+
+#ifdef UNIX
+    fd = open(file, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(FastImageHdr)) {
+        close(fd);
+        return NULL;
+    }
+    len = st.st_size;
+
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+
+    pimg = mmap(NULL, len, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (pimg == MAP_FAILED) return NULL;
+
+    /* the lookups touch the slots at random, read-ahead only wastes */
+    if (!populate) madvise(pimg, len, MADV_RANDOM);
+    mapped = 1;
+#else
+    fp = fopen(file, "rb");
+    if (!fp) return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    pimg = len >= sizeof(FastImageHdr) ? kalloc_huge(len) : NULL;
+    if (!pimg || fread(pimg, 1, len, fp) != len) {
+        fclose(fp);
+        kfree_huge(pimg);
+        return NULL;
+    }
+    fclose(fp);
+#endif
+
+    hdr = (FastImageHdr *)pimg;
+    if (fast_image_check(hdr, len) < 0)
+        goto failed;
+
+    ht = kzalloc(sizeof(*ht));
+    if (!ht) goto failed;
+
+    ht->reqsize = hdr->size;
+    ht->size = hdr->size;
+    ht->num = (int)hdr->num;
+    ht->wyhash = hdr->wyhash;
+    ht->seed = hdr->seed;
+
+    ht->image = pimg;
+    ht->imagelen = len;
+    ht->mapped = mapped;
+
+    return ht;
+
+failed:
+#ifdef UNIX
+    munmap(pimg, len);
+#else
+    kfree_huge(pimg);
+#endif
+    return NULL;
+}
+
+
+typedef struct fast_dump_ent {
+    void    * key;
+    void    * val;
+    int       keylen;
+    int       vallen;
+} FastDumpEnt;
+
+typedef struct fast_dump_ctx {
+    FastHtDump  * func;
+    FastDumpEnt * ents;
+    int           num;
+    int           max;
+    int           failed;
+} FastDumpCtx;
+
+static void fast_dump_collect (void * vctx, void * value)
+{
+    FastDumpCtx * ctx = (FastDumpCtx *)vctx;
+    FastDumpEnt * ent = NULL;
+
+    if (ctx->num >= ctx->max) {
+        ctx->failed = 1;
+        return;
+    }
+
+    ent = &ctx->ents[ctx->num];
+    memset(ent, 0, sizeof(*ent));
+
+    if ((*ctx->func)(value, &ent->key, &ent->keylen, &ent->val, &ent->vallen) < 0)
+        return;
+
+    if (!ent->key) return;
+    if (ent->keylen < 0) ent->keylen = strlen((char *)ent->key);
+    if (ent->keylen <= 0) return;
+
+    if (!ent->val || ent->vallen < 0) ent->vallen = 0;
+
+    ctx->num++;
+}
+
+int fast_ht_save_hashtab (void * vht, FastHtDump * func, uint64 seed, char * file)
+{
+    hashtab_t     * hht = (hashtab_t *)vht;
+    FastHashTab     ht;
+    FastDumpCtx     ctx;
+    FastDumpEnt   * ent = NULL;
+    FastImageHdr    hdr;
+    FastImageSlot * tab = NULL;
+    FILE          * fp = NULL;
+    uint32          hash = 0;
+    uint32          hashA = 0;
+    uint32          hashB = 0;
+    uint64          off = 0;
+    int             i, ret = -3;
+
+    if (!hht || !func || !file) return -1;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.func = func;
+    ctx.max = ht_num(hht);
+    ctx.ents = kalloc(sizeof(FastDumpEnt) * (ctx.max + 1));
+    if (!ctx.ents) return -2;
+
+    ht_traverse(hht, &ctx, fast_dump_collect);
+    if (ctx.failed) {
+        kfree(ctx.ents);
+        return -1;
+    }
+
+    /* the slots are at most half occupied, the probes stay short */
+    memset(&ht, 0, sizeof(ht));
+    ht.size = find_a_prime((ulong)ctx.num * 2 + 1);
+    ht.wyhash = 1;
+    ht.seed = seed ? seed : hash_random_seed() ^ (uint64)(ulong)hht;
+
+    tab = kzalloc_huge(ht.size * sizeof(FastImageSlot));
+    if (!tab) {
+        kfree(ctx.ents);
+        return -2;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FAST_IMAGE_MAGIC;
+    hdr.version = FAST_IMAGE_VERSION;
+    hdr.wyhash = 1;
+    hdr.slotsize = sizeof(FastImageSlot);
+    hdr.seed = ht.seed;
+    hdr.size = ht.size;
+    hdr.dataoff = sizeof(hdr) + (uint64)ht.size * sizeof(FastImageSlot);
+
+    for (i = 0; i < ctx.num; i++) {
+        ent = &ctx.ents[i];
+
+        fast_ht_hash(&ht, ent->key, ent->keylen, &hash, &hashA, &hashB);
+        hash %= ht.size;
+
+        /* the keys of equal hashes are told apart by the key bytes */
+        while (tab[hash].exist)
+            hash = (hash + 1) % ht.size;
+
+        tab[hash].exist = 1;
+        tab[hash].hashA = hashA;
+        tab[hash].hashB = hashB;
+        tab[hash].keylen = ent->keylen;
+        tab[hash].vallen = ent->vallen;
+        tab[hash].off = off;
+
+        off += FAST_IMAGE_ALIGN((uint64)ent->keylen + ent->vallen);
+    }
+
+    hdr.num = ctx.num;
+    hdr.datalen = off;
+
+    fp = fopen(file, "wb");
+    if (!fp) {
+        ret = -2;
+        goto done;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(tab, sizeof(FastImageSlot), ht.size, fp) != ht.size)
+        goto done;
+
+    for (i = 0; i < ctx.num; i++) {
+        ent = &ctx.ents[i];
+
+        if ((ent->vallen > 0 && fwrite(ent->val, 1, ent->vallen, fp) != (size_t)ent->vallen) ||
+            fwrite(ent->key, 1, ent->keylen, fp) != (size_t)ent->keylen ||
+            fast_image_pad(fp, (uint64)ent->keylen + ent->vallen) < 0)
+            goto done;
+    }
+
+    ret = 0;
+
+done:
+    if (fp && fclose(fp) != 0 && ret == 0) ret = -3;
+    kfree_huge(tab);
+    kfree(ctx.ents);
+
+    return ret;
+}
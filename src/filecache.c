@@ -8,9 +8,12 @@
 #include "dynarr.h"
 #include "mthread.h"
 #include "bpool.h"
+#include "strutil.h"
 #include "nativefile.h"
+#include "pagecache.h"
 
 #include "filecache.h"
+#include "metrics.h"
 
 typedef int FCCDNRead (void * pmedia, uint8 * pbuf, uint32 * readsize, int64 offset);
 
@@ -23,6 +26,8 @@ typedef struct file_cache {
     uint8              mediatype;    //0-memory 1-local file 2-cdn media
     char               filename[64];
     void             * hfile; 
+    time_t             mtime;
+    long               inode;
 
     void             * pmedia; 
     FCCDNRead        * cdnread;
@@ -60,6 +65,14 @@ typedef struct file_cache {
  
     void             * avail_event;
  
+    /* read-ahead loader thread, loading the next prefetch packs */
+    int                prefetch;
+    void             * load_event;
+#ifdef UNIX
+    int                ldquit;
+    pthread_t          loader;
+#endif
+ 
 } FileCache;
  
 
@@ -97,6 +110,9 @@ typedef struct file_pack {
     int                packind;
     uint8              state;    //current operation state
     int                rcvlen;   //actual loaded length
+
+    /* bumped each time the pack is reset, a load claimed before it is dropped */
+    uint32             gen;
 } FilePack;
  
  
@@ -115,6 +131,7 @@ int file_pack_recv (void * vpack, SOCKET fd);
 int file_pack_exit_load(void * vpack);
  
 int file_pack_state_to (void * vpack, int state);
+static int file_pack_state_cas (void * vpack, int from, int to);
 int file_pack_ready_notify (void * vpack);
  
 int file_pack_bind_unit  (void * vpack, void * vunit);
@@ -128,6 +145,8 @@ int file_pack_reload (void * vpack, int reason, void * curt);
 static void * file_cache_get_idle_pack (void * vcache);
 static int file_cache_seek_to (void * vcache, int64 offset);
 static int file_cache_load_pack (void * vcache, void * vpack);
+static int file_cache_pack_ready (void * vcache, void * vpack, int wait);
+static int file_cache_prefetch_stop (void * vcache);
 
 
 void * file_cache_init (int packnum, int packsize)
@@ -188,6 +207,8 @@ int file_cache_clean (void * vcache)
 
     if (!cache) return -1;
 
+    file_cache_prefetch_stop(cache);
+
     if (cache->avail_event) {
         event_destroy(cache->avail_event);
         cache->avail_event = NULL;
@@ -244,6 +265,8 @@ int file_cache_setbuf (void * vcache, void * pbuf, int buflen, int packsize)
     if (packsize <= 0) packsize = 8192;
     if (buflen < packsize) return -4;
 
+    /* the loader reads into the packs holding fpCS */
+    EnterCriticalSection(&cache->fpCS);
     EnterCriticalSection(&cache->cacheCS);
     /* clear the old pack list */
     for (i=0; i<cache->packnum; i++) {
@@ -277,10 +300,12 @@ int file_cache_setbuf (void * vcache, void * pbuf, int buflen, int packsize)
         pack->packind = -1;
         pack->state = PACK_NULL;
         pack->rcvlen = 0;
+        pack->gen++;
         arr_push(cache->pack_list, pack);
     }
 
     LeaveCriticalSection(&cache->cacheCS);
+    LeaveCriticalSection(&cache->fpCS);
 
     return 0;
 }
@@ -293,11 +318,13 @@ int file_cache_packlist_prepare (void * vcache)
 
     if (!cache) return -1;
 
+    EnterCriticalSection(&cache->fpCS);
     EnterCriticalSection(&cache->cacheCS);
 
     if (cache->packsize > 0) {
         cache->packtotal = (int)((cache->length + cache->packsize - 1)/cache->packsize);
-        cache->residual = (int)(cache->length % cache->packsize);
+        /* the size of the last pack, a whole pack if length is a multiple */
+        cache->residual = (int)(cache->length - (int64)(cache->packtotal - 1) * cache->packsize);
     } else {
         cache->packtotal = 0;
         cache->residual = 0;
@@ -315,9 +342,11 @@ int file_cache_packlist_prepare (void * vcache)
         pack->packind = i + cache->bgn_pack;
         pack->state = PACK_NULL;
         pack->rcvlen = 0;
+        pack->gen++;
     }
 
     LeaveCriticalSection(&cache->cacheCS);
+    LeaveCriticalSection(&cache->fpCS);
 
     return 0;
 }
@@ -334,11 +363,13 @@ int file_cache_setfile (void * vcache, char * file, int64 offset)
 
     if (file) strncpy(cache->filename, file, sizeof(cache->filename)-1);
  
+    EnterCriticalSection(&cache->fpCS);
     if (cache->hfile) native_file_close(cache->hfile);
     cache->hfile = native_file_open(cache->filename, NF_READ);
+    LeaveCriticalSection(&cache->fpCS);
     if (cache->hfile == NULL) return -100;
  
-    native_file_attr(cache->hfile, &cache->length, NULL, NULL, NULL);
+    native_file_attr(cache->hfile, &cache->length, &cache->mtime, &cache->inode, NULL);
     cache->offset = offset;
  
     return file_cache_packlist_prepare(cache);
@@ -352,10 +383,12 @@ int file_cache_setcdn (void * vcache, void * pmedia, int64 offset, uint64 msize,
     if (!pmedia) return -2;
     if (!cdnread) return -3;
  
+    EnterCriticalSection(&cache->fpCS);
     cache->mediatype = 2;
  
     cache->pmedia = pmedia;
     cache->cdnread = (FCCDNRead *)cdnread;
+    LeaveCriticalSection(&cache->fpCS);
  
     cache->offset = offset;
     cache->length = msize;
@@ -493,13 +526,14 @@ int file_cache_seek (void * vcache, int64 offset)
 long file_cache_skip_over (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 {
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0;
     long        i, fsize = 0;
-    int         j = 0;
 
     if (!cache) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
 
     fsize = cache->length - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
@@ -508,11 +542,7 @@ long file_cache_skip_over (void * vcache, long pos, int skiplimit, void * vpat,
     for (i = 0; i < fsize; i++) {
         fch = file_cache_at(cache, pos + i);
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
-
-        if (j >= patlen) return pos+i;
+        if (fch < 0 || !chset_has(&set, fch)) return pos+i;
     }
 
     return pos + i;
@@ -521,13 +551,14 @@ long file_cache_skip_over (void * vcache, long pos, int skiplimit, void * vpat,
 long file_cache_rskip_over (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 {    
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0; 
     long        i; 
-    int         j = 0;  
          
     if (!cache) return -1; 
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     if (pos <= 0) return pos;
 
@@ -539,11 +570,7 @@ long file_cache_rskip_over (void * vcache, long pos, int skiplimit, void * vpat,
 
         fch = file_cache_at(cache, pos-i);
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
-
-        if (j >= patlen) return pos - i;
+        if (fch < 0 || !chset_has(&set, fch)) return pos - i;
     }
 
     return pos - i;
@@ -577,14 +604,15 @@ static long file_cache_quotedstrlen (void * vcache, long pos, int skiplimit)
 long file_cache_skip_quote_to (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 {
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0;
     long        fsize = 0;
     long        i = 0, qlen = 0;
-    int         j = 0;
  
     if (!cache) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     fsize = cache->length - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
@@ -598,9 +626,7 @@ long file_cache_skip_quote_to (void * vcache, long pos, int skiplimit, void * vp
             continue;
         }
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
+        if (fch >= 0 && chset_has(&set, fch)) return pos + i;
 
         if (fch == '"' || fch == '\'') {
             qlen = file_cache_quotedstrlen(cache, pos + i, fsize - i);
@@ -617,13 +643,15 @@ long file_cache_skip_quote_to (void * vcache, long pos, int skiplimit, void * vp
 long file_cache_skip_to (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 { 
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0; 
     long        fsize = 0;
-    long        i = 0, j = 0;
+    long        i = 0;
      
     if (!cache) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
      
     fsize = cache->length;
     for (i = 0; i < fsize - pos; i++) {
@@ -631,9 +659,7 @@ long file_cache_skip_to (void * vcache, long pos, int skiplimit, void * vpat, in
             break;
 
         fch = file_cache_at(cache, pos + i); 
-        for (j = 0; j < patlen; j++) {  
-            if (pat[j] == fch) return pos + i;
-        }    
+        if (fch >= 0 && chset_has(&set, fch)) return pos + i;
     }    
     return pos + i;
 }    
@@ -641,13 +667,15 @@ long file_cache_skip_to (void * vcache, long pos, int skiplimit, void * vpat, in
 long file_cache_rskip_to (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 {
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0;
     long        fsize = 0;
-    long        i = 0, j = 0;
+    long        i = 0;
      
     if (!cache) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
  
     fsize = cache->length;
     if (pos < 0) return 0;
@@ -658,9 +686,7 @@ long file_cache_rskip_to (void * vcache, long pos, int skiplimit, void * vpat, i
             break;
 
         fch = file_cache_at(cache, pos-i);
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos - i;
-        }     
+        if (fch >= 0 && chset_has(&set, fch)) return pos - i;
     }     
 
     return pos - i; 
@@ -669,13 +695,15 @@ long file_cache_rskip_to (void * vcache, long pos, int skiplimit, void * vpat, i
 long file_cache_skip_esc_to (void * vcache, long pos, int skiplimit, void * vpat, int patlen)
 {  
     FileCache * cache = (FileCache *)vcache;
-    uint8     * pat = (uint8 *)vpat;
+    chset_t     set;
     int         fch = 0;  
     long        fsize = 0;
-    long        i = 0, j = 0;
+    long        i = 0;
       
     if (!cache) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
+
+    chset_init(&set, vpat, patlen);
       
     fsize = cache->length;
     for (i = 0; i < fsize - pos; i++) {
@@ -685,9 +713,7 @@ long file_cache_skip_esc_to (void * vcache, long pos, int skiplimit, void * vpat
         fch = file_cache_at(cache, pos+i);  
         if (fch == '\\') { i++; continue; }
 
-        for (j = 0; j < patlen; j++) {   
-            if (pat[j] == fch) return pos + i;
-        }
+        if (fch >= 0 && chset_has(&set, fch)) return pos + i;
     }
 
     return pos + i;
@@ -720,8 +746,7 @@ int file_cache_at (void * vcache, int64 offset)
     pack = arr_value(cache->pack_list, seekpack % cache->packnum);
     if (!pack) return -201;
 
-    if (pack->state == PACK_NULL)
-        file_cache_load_pack(cache, pack);
+    file_cache_pack_ready(cache, pack, 1);
 
     packpos = (int)(seekpos % cache->packsize);
 
@@ -772,8 +797,8 @@ int file_cache_read (void * vcache, void * pbuf, int length, int nbmode)
         pack = arr_value(cache->pack_list, seekpack % cache->packnum);
         if (!pack) return -201;
 
-        if (pack->state == PACK_NULL) 
-            file_cache_load_pack(cache, pack);
+        if (file_cache_pack_ready(cache, pack, !nbmode) < 0)
+            break;
 
         packpos = (int)(seekpos % cache->packsize);
         cplen = length - iter;
@@ -845,8 +870,8 @@ int file_cache_recv (void * vcache, void * pbuf, int length, int waitms)
         pack = arr_value(cache->pack_list, seekpack % cache->packnum);
         if (!pack) return -201;
  
-        if (pack->state == PACK_NULL)
-            file_cache_load_pack(cache, pack);
+        if (file_cache_pack_ready(cache, pack, waitms > 0) < 0)
+            break;
  
         packpos = (int)(seekpos % cache->packsize);
         cplen = length - iter;
@@ -896,41 +921,137 @@ int file_cache_recv (void * vcache, void * pbuf, int length, int waitms)
 }
  
 
-static int file_cache_load_pack (void * vcache, void * vpack)
+/* read the media at offset, the caller holds fpCS. local files are read
+ * through the shared page cache if it is set up */
+static int file_cache_media_read (FileCache * cache, uint8 * pbuf, uint32 length, int64 offset)
+{
+    int  rcvlen = 0;
+
+    if (cache->mediatype == 1) {
+        if (pcache_enabled())
+            return pcache_read(native_file_fd(cache->hfile), cache->inode, cache->mtime,
+                               offset, pbuf, length);
+
+        native_file_seek(cache->hfile, offset);
+        rcvlen = native_file_read(cache->hfile, pbuf, length);
+
+    } else if (cache->mediatype == 2 && cache->cdnread) {
+        uint32  readsize = length;
+        (*cache->cdnread)(cache->pmedia, pbuf, &readsize, offset);
+        rcvlen = readsize;
+    }
+
+    return rcvlen;
+}
+
+/* switch an idle pack to the given loading state. return 1 and the
+ * generation of the pack if it is claimed */
+static int file_cache_pack_claim (void * vcache, void * vpack, int state, uint32 * gen)
 {
     FileCache * cache = (FileCache *)vcache;
     FilePack  * pack = (FilePack *)vpack;
-    int64       offset = 0;
-    
-    if (!cache) return -1;
-    
+
+    if (__atomic_load_n(&pack->state, __ATOMIC_ACQUIRE) != PACK_NULL)
+        return 0;
+
     EnterCriticalSection(&pack->packCS);
-    pack->state = PACK_INIT;
+    if (!file_pack_state_cas(pack, PACK_NULL, state)) {
+        LeaveCriticalSection(&pack->packCS);
+        return 0;
+    }
     pack->rcvlen = 0;
 
     if (pack->packind >= cache->packtotal-1)
         pack->length = cache->residual;
     else
         pack->length = cache->packsize;
+
+    *gen = pack->gen;
     LeaveCriticalSection(&pack->packCS);
-    
+
+    return 1;
+}
+
+/* read in the pack claimed at generation gen. the caller holds fpCS, so the
+ * packs are not released under it. a seek may reset the pack while it is
+ * being read, then the stale data are dropped */
+static int file_cache_pack_fill (void * vcache, void * vpack, uint32 gen)
+{
+    FileCache * cache = (FileCache *)vcache;
+    FilePack  * pack = (FilePack *)vpack;
+    int64       offset = 0;
+    uint32      length = 0;
+    int         rcvlen = 0;
+    int         ret = 0;
+
+    EnterCriticalSection(&pack->packCS);
+    if (pack->gen != gen) {
+        LeaveCriticalSection(&pack->packCS);
+        return 0;
+    }
     offset = cache->offset + (int64)pack->packind * (int64)cache->packsize;
+    length = pack->length;
+    LeaveCriticalSection(&pack->packCS);
+
+    rcvlen = file_cache_media_read(cache, pack->pbyte, length, offset);
+
+    EnterCriticalSection(&pack->packCS);
+    if (pack->gen == gen) {
+        pack->rcvlen = rcvlen;
+        file_pack_state_to(pack, PACK_SUCC);
+        ret = 1;
+    }
+    LeaveCriticalSection(&pack->packCS);
+
+    return ret;
+}
 
+static int file_cache_load_pack (void * vcache, void * vpack)
+{
+    FileCache * cache = (FileCache *)vcache;
+    FilePack  * pack = (FilePack *)vpack;
+    uint32      gen = 0;
+    int         ret = 0;
+    
+    if (!cache || !pack) return -1;
+    
     EnterCriticalSection(&cache->fpCS);
+    if (file_cache_pack_claim(cache, pack, PACK_INIT, &gen))
+        ret = file_cache_pack_fill(cache, pack, gen);
+    LeaveCriticalSection(&cache->fpCS);
 
-    if (cache->mediatype == 1) {
-        native_file_seek(cache->hfile, offset);
-        pack->rcvlen = native_file_read(cache->hfile, pack->pbyte, pack->length);
+    return ret;
+}
 
-    } else if (cache->mediatype == 2 && cache->cdnread) {
-        uint32  readsize = pack->length;
-        (*cache->cdnread)(cache->pmedia, pack->pbyte, &readsize, offset);
-        pack->rcvlen = readsize;
+/* an idle pack is loaded in place. the pack being loaded by the loader
+ * thread is waited for if wait is set. a loaded pack is then read by the
+ * consumer without taking any lock */
+static int file_cache_pack_ready (void * vcache, void * vpack, int wait)
+{
+    FileCache * cache = (FileCache *)vcache;
+    FilePack  * pack = (FilePack *)vpack;
+    int         state = 0;
+
+    state = __atomic_load_n(&pack->state, __ATOMIC_ACQUIRE);
+    if (state == PACK_SUCC) {
+        metric_inc(MC_FILECACHE_HIT);
+        return 0;
     }
+    metric_inc(MC_FILECACHE_MISS);
 
-    LeaveCriticalSection(&cache->fpCS);
+    for ( ; ; ) {
+        state = __atomic_load_n(&pack->state, __ATOMIC_ACQUIRE);
+        if (state == PACK_SUCC) return 0;
+
+        if (state == PACK_NULL) {
+            file_cache_load_pack(cache, pack);
+            continue;
+        }
 
-    pack->state = PACK_SUCC;
+        if (!wait) return -1;
+
+        event_wait(cache->avail_event, 10);
+    }
 
     return 0;
 }
@@ -945,6 +1066,12 @@ int file_cache_load_all (void * vcache)
 
     if (!cache) return -1;
 
+    if (cache->load_event) {
+        /* the loader thread keeps the packs after seek_pack filled */
+        event_set(cache->load_event, 1);
+        return 0;
+    }
+
     if (nodenum < 8) nodenum = 8;
 
     for (i = 0; i < nodenum && i < cache->packnum && i < cache->packtotal; i++) {
@@ -958,6 +1085,107 @@ int file_cache_load_all (void * vcache)
     return i;
 }
 
+#ifdef UNIX
+static void * file_cache_loader (void * arg)
+{
+    FileCache * cache = (FileCache *)arg;
+    FilePack  * pack = NULL;
+    uint32      gen = 0;
+    int         i, end, loaded;
+
+    while (!__atomic_load_n(&cache->ldquit, __ATOMIC_ACQUIRE)) {
+        loaded = 0;
+
+        EnterCriticalSection(&cache->fpCS);
+
+        /* claim the first idle pack among the prefetch ones after seek_pack.
+         * it is done in cacheCS, a seek being in the middle of moving the pack
+         * to a new packind is not seen */
+        pack = NULL;
+        EnterCriticalSection(&cache->cacheCS);
+        end = cache->seek_pack + __atomic_load_n(&cache->prefetch, __ATOMIC_RELAXED);
+        if (end > cache->bgn_pack + cache->packnum)
+            end = cache->bgn_pack + cache->packnum;
+        if (end > cache->packtotal)
+            end = cache->packtotal;
+
+        for (i = cache->seek_pack; i < end && cache->packnum > 0; i++) {
+            pack = arr_value(cache->pack_list, i % cache->packnum);
+            if (file_cache_pack_claim(cache, pack, PACK_RCVING, &gen))
+                break;
+            pack = NULL;
+        }
+        LeaveCriticalSection(&cache->cacheCS);
+
+        if (pack) loaded = file_cache_pack_fill(cache, pack, gen);
+
+        LeaveCriticalSection(&cache->fpCS);
+
+        if (loaded > 0)
+            file_pack_ready_notify(pack);
+        else if (!pack)
+            event_wait(cache->load_event, 20);
+    }
+
+    return NULL;
+}
+#endif
+
+int file_cache_set_prefetch (void * vcache, int packs)
+{
+    FileCache * cache = (FileCache *)vcache;
+
+    if (!cache) return -1;
+
+    if (packs <= 0) return file_cache_prefetch_stop(cache);
+
+#ifdef UNIX
+    __atomic_store_n(&cache->prefetch, packs, __ATOMIC_RELAXED);
+
+    if (cache->load_event) {
+        event_set(cache->load_event, 1);
+        return 0;
+    }
+
+    cache->load_event = event_create();
+    if (!cache->load_event) return -100;
+
+    cache->ldquit = 0;
+    if (pthread_create(&cache->loader, NULL, file_cache_loader, cache) != 0) {
+        event_destroy(cache->load_event);
+        cache->load_event = NULL;
+        cache->prefetch = 0;
+        return -101;
+    }
+
+    return 0;
+#else
+    return -100;
+#endif
+}
+
+static int file_cache_prefetch_stop (void * vcache)
+{
+    FileCache * cache = (FileCache *)vcache;
+
+    if (!cache) return -1;
+
+    if (!cache->load_event) return 0;
+
+#ifdef UNIX
+    __atomic_store_n(&cache->ldquit, 1, __ATOMIC_RELEASE);
+    event_set(cache->load_event, 1);
+
+    pthread_join(cache->loader, NULL);
+#endif
+
+    event_destroy(cache->load_event);
+    cache->load_event = NULL;
+    cache->prefetch = 0;
+
+    return 0;
+}
+
 int file_cache_load_one (void * vcache)
 {
     FileCache * cache = (FileCache *)vcache;
@@ -1252,8 +1480,9 @@ int file_pack_exit_load(void * vpack)
     memset(pack->unitarr, 0, sizeof(pack->unitarr));
     pack->unitnum = 0;
 
-    pack->state = PACK_NULL;
     pack->rcvlen = 0;
+    pack->gen++;
+    file_pack_state_to(pack, PACK_NULL);
     LeaveCriticalSection(&pack->packCS);
 
     return 0;
@@ -1265,10 +1494,22 @@ int file_pack_state_to (void * vpack, int state)
  
     if (!pack) return -1;
 
-    pack->state = state;
+    /* release the loaded data along with PACK_SUCC to the lock-free reader */
+    __atomic_store_n(&pack->state, (uint8)state, __ATOMIC_RELEASE);
     return 0;
 }
 
+static int file_pack_state_cas (void * vpack, int from, int to)
+{
+    FilePack  * pack = (FilePack *)vpack;
+    uint8       expect = (uint8)from;
+
+    if (!pack) return 0;
+
+    return __atomic_compare_exchange_n(&pack->state, &expect, (uint8)to, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
 int file_pack_ready_notify (void * vpack)
 {
     FilePack  * pack = (FilePack *)vpack;
@@ -1351,20 +1592,12 @@ int file_pack_reload (void * vpack, int reason, void * pcurt)
 
     EnterCriticalSection(&cache->fpCS);
 
-    if (cache->mediatype == 1) {
-        native_file_seek(cache->hfile, offset);
-        pack->rcvlen = native_file_read(cache->hfile, pack->pbyte, pack->length);
+    pack->rcvlen = file_cache_media_read(cache, pack->pbyte, pack->length, offset);
 
-    } else if (cache->mediatype == 2 && cache->cdnread) {
-        uint32 readsize = pack->length;
-        (*cache->cdnread)(cache->pmedia, pack->pbyte, &readsize, offset);
-        pack->rcvlen = readsize;
-    }
+    file_pack_state_to(pack, PACK_SUCC);
 
     LeaveCriticalSection(&cache->fpCS);
 
-    pack->state = PACK_SUCC;
-
     return 0;
 }
 
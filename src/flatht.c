@@ -0,0 +1,371 @@
+/*  
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution. 
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "hashtab.h"
+#include "flatht.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+typedef int (FLAT_HASH_FREE) (void * val, int valen);
+
+#define FLAT_HASH_SEED   0x9E3779B97F4A7C15ULL
+#define FLAT_CHECK_SEED  0x5BD1E995
+
+#define flat_h1(hash)  ((hash) >> 7)
+#define flat_h2(hash)  ((uint8)((hash) & 0x7F))
+
+
+/* return a bit mask that bit i is set if ctrl[i] equals to c, i < 16 */
+static inline uint32 flat_group_match (uint8 * ctrl, uint8 c)
+{
+#if defined(__SSE2__)
+    __m128i grp = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8((char)c)));
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    static const uint8 bitval[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t  eq = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(c));
+    uint8x16_t  bits = vandq_u8(eq, vld1q_u8(bitval));
+
+    return (uint32)vaddv_u8(vget_low_u8(bits)) |
+           ((uint32)vaddv_u8(vget_high_u8(bits)) << 8);
+
+#else
+    uint32 mask = 0;
+    int    i;
+
+    for (i = 0; i < FLAT_HT_GROUP; i++) {
+        if (ctrl[i] == c) mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline int flat_ctz (uint32 mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int n = 0;
+    while ((mask & 1) == 0) { mask >>= 1; n++; }
+    return n;
+#endif
+}
+
+static inline void flat_set_ctrl (FlatHashTab * ht, ulong pos, uint8 c)
+{
+    ht->ctrl[pos] = c;
+
+    /* keep the mirrored bytes so that a group can be loaded from any pos */
+    if (pos < FLAT_HT_GROUP)
+        ht->ctrl[ht->size + pos] = c;
+}
+
+static void flat_hash_key (void * key, int keylen, uint64 * hash, uint32 * check)
+{
+    if (keylen < 0) keylen = key ? strlen((char *)key) : 0;
+
+    *hash = murmur_hash2_64(key, keylen, FLAT_HASH_SEED);
+    *check = murmur_hash2(key, keylen, FLAT_CHECK_SEED);
+}
+
+static ulong flat_capacity (ulong num)
+{
+    ulong size = FLAT_HT_GROUP;
+
+    /* keep the load factor not greater than 7/8 */
+    while (size - size / 8 < num) size <<= 1;
+
+    return size;
+}
+
+static int flat_table_alloc (FlatHashTab * ht, ulong size)
+{
+    uint8        * ctrl = NULL;
+    FlatHashSlot * slots = NULL;
+
+    ctrl = kalloc_huge(size + FLAT_HT_GROUP);
+    if (!ctrl) return -1;
+
+    slots = kalloc_huge(size * sizeof(FlatHashSlot));
+    if (!slots) {
+        kfree_huge(ctrl);
+        return -2;
+    }
+
+    memset(ctrl, FLAT_HT_EMPTY, size + FLAT_HT_GROUP);
+
+    ht->ctrl = ctrl;
+    ht->slots = slots;
+    ht->size = size;
+    ht->mask = size - 1;
+    ht->growth_left = size - size / 8 - ht->num;
+
+    return 0;
+}
+
+/* find the slot storing the hash, or the first empty slot where it
+ * should be inserted. return 1 if found, 0 if not found */
+static int flat_find_slot (FlatHashTab * ht, uint64 hash, uint32 check, ulong * ppos)
+{
+    ulong    pos = flat_h1(hash) & ht->mask;
+    ulong    probed = 0;
+    ulong    slot;
+    uint32   match;
+    uint32   empty;
+
+    for ( ; probed < ht->size; probed += FLAT_HT_GROUP) {
+        match = flat_group_match(ht->ctrl + pos, flat_h2(hash));
+        while (match) {
+            slot = (pos + flat_ctz(match)) & ht->mask;
+            if (ht->slots[slot].hash == hash && ht->slots[slot].check == check) {
+                *ppos = slot;
+                return 1;
+            }
+            match &= match - 1;
+        }
+
+        /* all slots between home position and the stored one are occupied,
+         * an empty control byte terminates the probing */
+        empty = flat_group_match(ht->ctrl + pos, FLAT_HT_EMPTY);
+        if (empty) {
+            *ppos = (pos + flat_ctz(empty)) & ht->mask;
+            return 0;
+        }
+
+        pos = (pos + FLAT_HT_GROUP) & ht->mask;
+    }
+
+    *ppos = ht->size;
+    return 0;
+}
+
+static int flat_resize (FlatHashTab * ht, ulong newsize)
+{
+    uint8        * ctrl = ht->ctrl;
+    FlatHashSlot * slots = ht->slots;
+    ulong          size = ht->size;
+    ulong          i, pos;
+
+    if (flat_table_alloc(ht, newsize) < 0)
+        return -1;
+
+    for (i = 0; i < size; i++) {
+        if (ctrl[i] == FLAT_HT_EMPTY) continue;
+
+        flat_find_slot(ht, slots[i].hash, slots[i].check, &pos);
+        ht->slots[pos] = slots[i];
+        flat_set_ctrl(ht, pos, ctrl[i]);
+    }
+
+    kfree_huge(ctrl);
+    kfree_huge(slots);
+
+    return 0;
+}
+
+
+void * flat_ht_new (ulong num)
+{
+    FlatHashTab * ht = NULL;
+ 
+    ht = kzalloc(sizeof(*ht));
+    if (ht == NULL) return NULL;
+ 
+    ht->reqsize = num;
+    ht->num = 0;
+
+    if (flat_table_alloc(ht, flat_capacity(num)) < 0) {
+        kfree(ht);
+        return NULL;
+    }
+
+    return ht;
+}
+
+
+void flat_ht_free (void * vht)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+
+    if (!ht) return;
+ 
+    kfree_huge(ht->ctrl);
+    kfree_huge(ht->slots);
+    kfree(ht);
+}
+ 
+ 
+void flat_ht_free_all (void * vht, void * vfunc)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    FLAT_HASH_FREE * func = (FLAT_HASH_FREE *)vfunc;
+ 
+    if (!ht) return;
+ 
+    flat_ht_free_member(ht, func);
+    flat_ht_free(ht);
+}
+ 
+void flat_ht_free_member (void * vht, void * vfunc)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    FLAT_HASH_FREE * func = (FLAT_HASH_FREE *)vfunc;
+    ulong         i = 0;
+ 
+    if (!ht) return;
+ 
+    if (func) {
+        for (i = 0; i < ht->size; i++) {
+            if (ht->ctrl[i] != FLAT_HT_EMPTY)
+                func(ht->slots[i].value, ht->slots[i].valuelen);
+        }
+    }
+ 
+    flat_ht_zero(ht);
+}
+ 
+void flat_ht_zero (void * vht)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+ 
+    if (!ht) return;
+ 
+    memset(ht->ctrl, FLAT_HT_EMPTY, ht->size + FLAT_HT_GROUP);
+    ht->num = 0;
+    ht->growth_left = ht->size - ht->size / 8;
+}
+ 
+int flat_ht_num (void * vht)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+
+    if (!ht) return 0;
+ 
+    return (int)ht->num;
+}
+
+int flat_ht_reserve (void * vht, ulong num)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    ulong         size = 0;
+
+    if (!ht) return -1;
+
+    size = flat_capacity(num);
+    if (size <= ht->size) return 0;
+
+    return flat_resize(ht, size);
+}
+ 
+void * flat_ht_get (void * vht, void * key, int keylen, void ** pval, int * vallen)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    uint64  hash = 0;
+    uint32  check = 0;
+    ulong   pos = 0;
+
+    if (!ht) return NULL;
+
+    flat_hash_key(key, keylen, &hash, &check);
+
+    if (flat_find_slot(ht, hash, check, &pos)) {
+        if (pval) *pval = ht->slots[pos].value;
+        if (vallen) *vallen = ht->slots[pos].valuelen;
+        return ht->slots[pos].value;
+    }
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+    return NULL;
+}
+
+int flat_ht_set (void * vht, void * key, int keylen, void * value, int valuelen)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    uint64  hash = 0;
+    uint32  check = 0;
+    ulong   pos = 0;
+
+    if (!ht) return -1;
+
+    flat_hash_key(key, keylen, &hash, &check);
+
+    if (flat_find_slot(ht, hash, check, &pos)) {
+        ht->slots[pos].value = value;
+        ht->slots[pos].valuelen = valuelen;
+        return 0;
+    }
+
+    if (ht->growth_left == 0) {
+        if (flat_resize(ht, ht->size << 1) < 0)
+            return -100;
+
+        flat_find_slot(ht, hash, check, &pos);
+    }
+
+    ht->slots[pos].hash = hash;
+    ht->slots[pos].check = check;
+    ht->slots[pos].value = value;
+    ht->slots[pos].valuelen = valuelen;
+    flat_set_ctrl(ht, pos, flat_h2(hash));
+
+    ht->num++;
+    ht->growth_left--;
+    return 1;
+}
+
+void * flat_ht_del (void * vht, void * key, int keylen, void ** pval, int * vallen)
+{
+    FlatHashTab * ht = (FlatHashTab *)vht;
+    uint64   hash = 0;
+    uint32   check = 0;
+    ulong    pos = 0;
+    ulong    next = 0;
+    ulong    home = 0;
+    void   * old = NULL;
+
+    if (!ht) return NULL;
+
+    flat_hash_key(key, keylen, &hash, &check);
+
+    if (!flat_find_slot(ht, hash, check, &pos)) {
+        if (pval) *pval = NULL;
+        if (vallen) *vallen = 0;
+        return NULL;
+    }
+
+    if (pval) *pval = ht->slots[pos].value;
+    if (vallen) *vallen = ht->slots[pos].valuelen;
+    old = ht->slots[pos].value;
+
+    /* backward shift the following slots into the hole if the hole lies
+     * between their home position and current position */
+    for (next = (pos + 1) & ht->mask; ht->ctrl[next] != FLAT_HT_EMPTY;
+         next = (next + 1) & ht->mask)
+    {
+        home = flat_h1(ht->slots[next].hash) & ht->mask;
+        if (((next - home) & ht->mask) >= ((next - pos) & ht->mask)) {
+            ht->slots[pos] = ht->slots[next];
+            flat_set_ctrl(ht, pos, ht->ctrl[next]);
+            pos = next;
+        }
+    }
+
+    flat_set_ctrl(ht, pos, FLAT_HT_EMPTY);
+    ht->num--;
+    ht->growth_left++;
+
+    return old;
+}
+
@@ -3,13 +3,24 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#include <stddef.h>
+
 #include "btype.h"
 #include "memory.h"
-#include "vstar.h"
+#include "rbtree.h"
+#include "mpool.h"
+#include "bitarr.h"
 #include "fileop.h"
 #include "mthread.h"
 #include "fragpack.h"
 
+typedef struct frag_node_s {
+    FragItem    item;      //kept first, the tree compares it as FragItem
+    rbtnode_t   node;
+} FragNode;
+
+#define FRAG_NODE(frag, n)  ((FragNode *)rbtree_obj((frag)->tree, n))
+
 int fragitem_cmp_offset (void * a, void * b)
 {
     FragItem * pl = (FragItem *)a;
@@ -35,11 +46,409 @@ int fragitem_cmp_by_offset (void * a, void * b)
     return 0;
 }
 
+
+/* the node of the last range starting at or before pos */
+static FragNode * frag_node_floor (FragPack * frag, int64 pos)
+{
+    rbtnode_t * node = frag->tree->root;
+    rbtnode_t * floor = NULL;
+
+    while (node) {
+        if (FRAG_NODE(frag, node)->item.offset <= pos) {
+            floor = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+
+    return floor ? FRAG_NODE(frag, floor) : NULL;
+}
+
+static FragNode * frag_node_next (FragPack * frag, FragNode * fn)
+{
+    rbtnode_t * node = NULL;
+
+    if (fn) node = rbtnode_next(&fn->node);
+    else node = rbtree_min_node(frag->tree);
+
+    return node ? FRAG_NODE(frag, node) : NULL;
+}
+
+static void frag_node_del (FragPack * frag, FragNode * fn)
+{
+    rbtree_delete_node(frag->tree, &fn->node);
+    mpool_recycle(frag->pool, fn);
+    frag->fragnum--;
+}
+
+static int frag_node_add (FragPack * frag, int64 pos, int64 len)
+{
+    FragNode * fn = NULL;
+
+    fn = mpool_fetch(frag->pool);
+    if (!fn) return -100;
+
+    fn->item.offset = pos;
+    fn->item.length = len;
+
+    rbtree_insert(frag->tree, &fn->item.offset, fn, NULL);
+    frag->fragnum++;
+
+    return 0;
+}
+
+static void frag_tree_zero (FragPack * frag)
+{
+    FragNode * fn = NULL;
+
+    while ((fn = rbtree_delete_min(frag->tree)) != NULL)
+        mpool_recycle(frag->pool, fn);
+
+    frag->fragnum = 0;
+}
+
+/* merge pos:len with the ranges it overlaps or touches.
+   return the bytes newly received */
+static int64 frag_tree_add (FragPack * frag, int64 pos, int64 len)
+{
+    FragNode * fn = NULL;
+    FragNode * cur = NULL;
+    FragNode * next = NULL;
+    int64      end = pos + len;
+    int64      covered = 0;
+    int64      added = 0;
+
+    fn = frag_node_floor(frag, pos);
+    if (fn && fn->item.offset + fn->item.length >= pos) {
+        /* -... |-----!-----|---!---   ...
+               fn    pos   pos+len       */
+        if (fn->item.offset + fn->item.length >= end)
+            return 0;
+
+        cur = fn;
+        covered = fn->item.length;
+    }
+
+    /* the ranges swallowed by pos:len are removed, each at most once */
+    next = frag_node_next(frag, fn);
+    while (next && next->item.offset <= end) {
+        if (next->item.offset + next->item.length > end)
+            end = next->item.offset + next->item.length;
+        covered += next->item.length;
+
+        fn = frag_node_next(frag, next);
+        frag_node_del(frag, next);
+        next = fn;
+    }
+
+    if (cur) {
+        added = end - cur->item.offset - covered;
+        cur->item.length = end - cur->item.offset;
+
+    } else {
+        added = end - pos - covered;
+        if (frag_node_add(frag, pos, end - pos) < 0)
+            return 0;
+    }
+
+    frag->rcvlen += added;
+
+    return added;
+}
+
+static void frag_tree_del (FragPack * frag, int64 pos, int64 len)
+{
+    FragNode * fn = NULL;
+    FragNode * next = NULL;
+    int64      end = pos + len;
+    int64      fend = 0;
+
+    fn = frag_node_floor(frag, pos);
+    if (fn && fn->item.offset < pos && fn->item.offset + fn->item.length > pos) {
+        fend = fn->item.offset + fn->item.length;
+        fn->item.length = pos - fn->item.offset;
+
+        if (fend > end) {
+            /*       pos   pos+len
+               -... |--!-----!--|       |--------|  ...
+                    fn                  next            */
+            frag->rcvlen -= len;
+            frag_node_add(frag, end, fend - end);
+            return;
+        }
+
+        frag->rcvlen -= fend - pos;
+        next = frag_node_next(frag, fn);
+
+    } else if (fn && fn->item.offset == pos) {
+        next = fn;
+    } else {
+        next = frag_node_next(frag, fn);
+    }
+
+    while (next && next->item.offset < end) {
+        fend = next->item.offset + next->item.length;
+
+        if (fend <= end) {
+            frag->rcvlen -= next->item.length;
+
+            fn = frag_node_next(frag, next);
+            frag_node_del(frag, next);
+            next = fn;
+
+        } else {
+            /* the order is kept when the head of next is cut off */
+            frag->rcvlen -= end - next->item.offset;
+            next->item.offset = end;
+            next->item.length = fend - end;
+            break;
+        }
+    }
+}
+
+
+static int64 frag_blk_len (FragPack * frag, int blk)
+{
+    int64  len = frag->blksize;
+
+    if ((blk + 1) * frag->blksize > frag->length)
+        len = frag->length - blk * frag->blksize;
+
+    return len;
+}
+
+static void frag_blk_set (FragPack * frag, int blk, int val)
+{
+    bitarr_t * bm = frag->blkmap;
+    int        nbr = 0;
+
+    if (bitarr_get(bm, blk) == val) return;
+
+    /* a block joins or splits its neighbor ranges */
+    if (blk > 0) nbr += bitarr_get(bm, blk - 1);
+    if (blk + 1 < bm->bitnum) nbr += bitarr_get(bm, blk + 1);
+
+    if (val) {
+        bitarr_set(bm, blk);
+        frag->fragnum += 1 - nbr;
+        frag->blkset++;
+        frag->rcvlen += frag_blk_len(frag, blk);
+
+    } else {
+        bitarr_unset(bm, blk);
+        frag->fragnum += nbr - 1;
+        frag->blkset--;
+        frag->rcvlen -= frag_blk_len(frag, blk);
+    }
+}
+
+/* only the blocks that pos:len covers wholly are set */
+static int64 frag_blk_add (FragPack * frag, int64 pos, int64 len)
+{
+    int64  rcvlen = frag->rcvlen;
+    int    blk, last;
+
+    blk = (int)((pos + frag->blksize - 1) / frag->blksize);
+
+    if (pos + len >= frag->length)
+        last = frag->blkmap->bitnum;
+    else
+        last = (int)((pos + len) / frag->blksize);
+
+    for ( ; blk < last; blk++)
+        frag_blk_set(frag, blk, 1);
+
+    return frag->rcvlen - rcvlen;
+}
+
+/* the blocks that pos:len touches are unset */
+static void frag_blk_del (FragPack * frag, int64 pos, int64 len)
+{
+    int    blk, last;
+
+    blk = (int)(pos / frag->blksize);
+    last = (int)((pos + len + frag->blksize - 1) / frag->blksize);
+    if (last > frag->blkmap->bitnum) last = frag->blkmap->bitnum;
+
+    for ( ; blk < last; blk++)
+        frag_blk_set(frag, blk, 0);
+}
+
+/* the byte range of the run of set blocks that starts at blk */
+static void frag_blk_run (FragPack * frag, int blk, FragItem * item)
+{
+    int   end = 0;
+
+    end = bitarr_next(frag->blkmap, blk, 0);
+    if (end < 0) end = frag->blkmap->bitnum;
+
+    item->offset = blk * frag->blksize;
+    item->length = end * frag->blksize - item->offset;
+
+    if (item->offset + item->length > frag->length)
+        item->length = frag->length - item->offset;
+}
+
+
+/* locate pos among the ranges. return 1 if some range contains pos, the
+   range is given in cur and the following one in next. return 0 if not,
+   cur is the range before pos and next the one after. a zero-length item
+   means no such range */
+static int frag_span (FragPack * frag, int64 pos, FragItem * cur, FragItem * next)
+{
+    FragNode * fn = NULL;
+    FragNode * nfn = NULL;
+    int        found = 0;
+    int        blk, ind;
+
+    memset(cur, 0, sizeof(*cur));
+    memset(next, 0, sizeof(*next));
+
+    if (frag->blksize <= 0) {
+        fn = frag_node_floor(frag, pos);
+        if (fn && fn->item.offset + fn->item.length > pos)
+            found = 1;
+
+        if (fn) *cur = fn->item;
+
+        nfn = frag_node_next(frag, fn);
+        if (nfn) *next = nfn->item;
+
+        return found;
+    }
+
+    blk = (int)(pos / frag->blksize);
+    if (blk < frag->blkmap->bitnum && bitarr_get(frag->blkmap, blk) == 1)
+        found = 1;
+
+    ind = bitarr_prev(frag->blkmap, blk, 1);
+    if (ind >= 0) {
+        ind = bitarr_prev(frag->blkmap, ind, 0) + 1;
+        frag_blk_run(frag, ind, cur);
+    }
+
+    if (found) ind = bitarr_next(frag->blkmap, blk, 0);
+    else ind = blk;
+
+    if (ind >= 0) ind = bitarr_next(frag->blkmap, ind, 1);
+    if (ind >= 0) frag_blk_run(frag, ind, next);
+
+    return found;
+}
+
+/* copy the ranges in order into items, at most num. return the number */
+static int frag_items (FragPack * frag, FragItem * items, int num)
+{
+    FragNode * fn = NULL;
+    int        i = 0, blk = 0;
+
+    if (frag->blksize <= 0) {
+        for (fn = frag_node_next(frag, NULL); fn && i < num; fn = frag_node_next(frag, fn))
+            items[i++] = fn->item;
+        return i;
+    }
+
+    while (i < num && (blk = bitarr_next(frag->blkmap, blk, 1)) >= 0) {
+        frag_blk_run(frag, blk, &items[i]);
+        blk = (int)((items[i].offset + items[i].length + frag->blksize - 1) / frag->blksize);
+        i++;
+    }
+
+    return i;
+}
+
+static void frag_check_complete (FragPack * frag)
+{
+    FragNode * fn = NULL;
+
+    frag->complete = 0;
+
+    if (frag->length <= 0) return;
+
+    if (frag->blksize > 0) {
+        if (frag->blkset == frag->blkmap->bitnum)
+            frag->complete = 1;
+        return;
+    }
+
+    if (frag->fragnum == 1) {
+        fn = frag_node_next(frag, NULL);
+        if (fn && fn->item.offset == 0 && fn->item.length == frag->length)
+            frag->complete = 1;
+    }
+}
+
+static int64 frag_pack_clip (FragPack * frag, int64 * pos, int64 len)
+{
+    if (frag->length > 0) {
+        if (*pos > frag->length) *pos = frag->length;
+        if (*pos + len > frag->length)
+            len = frag->length - *pos;
+    }
+
+    return len;
+}
+
+/* rebuild the ranges with the new length, as a bitmap if blksize > 0 or
+   as a tree. the ranges are taken out before the length is changed */
+static int frag_rebuild (FragPack * frag, int64 blksize, int64 length)
+{
+    FragItem * items = NULL;
+    int64      pos, len;
+    int        i, num = 0;
+
+    if (blksize > 0 && length <= 0) return -10;
+
+    if (frag->fragnum > 0) {
+        items = kalloc(sizeof(FragItem) * frag->fragnum);
+        if (!items) return -100;
+
+        num = frag_items(frag, items, frag->fragnum);
+    }
+
+    if (frag->blkmap) {
+        bitarr_free(frag->blkmap);
+        frag->blkmap = NULL;
+    }
+    frag->blksize = 0;
+    frag->blkset = 0;
+
+    frag_tree_zero(frag);
+    frag->rcvlen = 0;
+    frag->length = length;
+
+    if (blksize > 0) {
+        frag->blkmap = bitarr_alloc((int)((frag->length + blksize - 1) / blksize));
+        if (!frag->blkmap) {
+            if (items) kfree(items);
+            return -101;
+        }
+        frag->blksize = blksize;
+    }
+
+    for (i = 0; i < num; i++) {
+        pos = items[i].offset;
+        len = frag_pack_clip(frag, &pos, items[i].length);
+        if (len <= 0) continue;
+
+        if (frag->blksize > 0) frag_blk_add(frag, pos, len);
+        else frag_tree_add(frag, pos, len);
+    }
+
+    if (items) kfree(items);
+
+    frag_check_complete(frag);
+
+    return 0;
+}
+
+
 void * frag_pack_alloc ()
 {
     FragPack * frag = NULL;
 
-    frag = kalloc(sizeof(*frag));
+    frag = kzalloc(sizeof(*frag));
     if (!frag) return NULL;
 
     frag->complete = 0;
@@ -48,7 +457,11 @@ void * frag_pack_alloc ()
 
     InitializeCriticalSection(&frag->packCS);
 
-    frag->pack_var = vstar_new(sizeof(FragItem), 4, NULL);
+    frag->tree = rbtree_new_embed(fragitem_cmp_offset, offsetof(FragNode, node));
+
+    frag->pool = mpool_alloc();
+    mpool_set_unitsize(frag->pool, sizeof(FragNode));
+    mpool_set_allocnum(frag->pool, 128);
 
     return frag;
 }
@@ -61,7 +474,11 @@ void frag_pack_free (void * vfrag)
 
     DeleteCriticalSection(&frag->packCS);
 
-    vstar_free(frag->pack_var);
+    /* the nodes are released with the pool */
+    rbtree_free(frag->tree);
+    mpool_free(frag->pool);
+
+    if (frag->blkmap) bitarr_free(frag->blkmap);
 
     kfree(frag);
 }
@@ -78,7 +495,14 @@ int frag_pack_zero (void * vfrag)
     frag->length = 0;
     frag->rcvlen = 0;
 
-    vstar_zero(frag->pack_var);
+    frag_tree_zero(frag);
+
+    if (frag->blkmap) {
+        bitarr_free(frag->blkmap);
+        frag->blkmap = NULL;
+    }
+    frag->blksize = 0;
+    frag->blkset = 0;
 
     LeaveCriticalSection(&frag->packCS);
 
@@ -88,7 +512,6 @@ int frag_pack_zero (void * vfrag)
 void frag_pack_set_length (void * vfrag, int64 length)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
 
     if (!frag) return;
 
@@ -96,38 +519,46 @@ void frag_pack_set_length (void * vfrag, int64 length)
 
     EnterCriticalSection(&frag->packCS);
 
-    frag->length = length;
+    /* the bitmap is sized by length */
+    if (frag->blksize > 0)
+        frag_rebuild(frag, length > 0 ? frag->blksize : 0, length);
+    else
+        frag->length = length;
 
-    frag->complete = 0;
-    if (length > 0 && vstar_num(frag->pack_var) == 1) {
-        item = vstar_get(frag->pack_var, 0);
-        if (item && item->offset == 0) {
-            if (frag->length > 0 && item->length == frag->length)
-                frag->complete = 1;
-        }
-    }
+    frag_check_complete(frag);
 
     LeaveCriticalSection(&frag->packCS);
 }
 
-int frag_pack_complete (void * vfrag)
+int frag_pack_set_block (void * vfrag, int64 blksize)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
+    int        ret = 0;
 
-    if (!frag) return 0;
+    if (!frag) return -1;
+
+    if (blksize < 0) blksize = 0;
 
     EnterCriticalSection(&frag->packCS);
 
-    frag->complete = 0;
-    if (vstar_num(frag->pack_var) == 1) {
-        item = vstar_get(frag->pack_var, 0);
-        if (item && item->offset == 0) {
-            if (frag->length > 0 && item->length == frag->length)
-                frag->complete = 1;
-        }
-    }
+    if (blksize > 0 && (frag->length + blksize - 1) / blksize > 0x7FFFFFFF)
+        ret = -2;
+    else if (blksize != frag->blksize)
+        ret = frag_rebuild(frag, blksize, frag->length);
+
+    LeaveCriticalSection(&frag->packCS);
+
+    return ret;
+}
+
+int frag_pack_complete (void * vfrag)
+{
+    FragPack * frag = (FragPack *)vfrag;
+
+    if (!frag) return 0;
 
+    EnterCriticalSection(&frag->packCS);
+    frag_check_complete(frag);
     LeaveCriticalSection(&frag->packCS);
 
     return frag->complete;
@@ -149,7 +580,7 @@ int64 frag_pack_rcvlen (void * vfrag, int * fragnum)
     if (!frag) return 0;
  
     if (fragnum)
-        *fragnum = vstar_num(frag->pack_var);
+        *fragnum = frag->fragnum;
 
     return frag->rcvlen;
 }
@@ -157,25 +588,35 @@ int64 frag_pack_rcvlen (void * vfrag, int * fragnum)
 int64 frag_pack_curlen (void * vfrag)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
+    FragNode * fn = NULL;
+    int64      curlen = 0;
+    int        blk = 0;
 
     if (!frag) return 0;
 
     EnterCriticalSection(&frag->packCS);
-    item = vstar_last(frag->pack_var);
-    LeaveCriticalSection(&frag->packCS);
 
-    if (item) {
-        return item->offset + item->length;
+    if (frag->blksize > 0) {
+        blk = bitarr_prev(frag->blkmap, frag->blkmap->bitnum - 1, 1);
+        if (blk >= 0)
+            curlen = blk * frag->blksize + frag_blk_len(frag, blk);
+
+    } else {
+        fn = FRAG_NODE(frag, rbtree_max_node(frag->tree));
+        if (fn) curlen = fn->item.offset + fn->item.length;
     }
 
-    return 0;
+    LeaveCriticalSection(&frag->packCS);
+
+    return curlen;
 }
 
 int frag_pack_read (void * vfrag, int fd, int64 pos)
 {
     FragPack * frag = (FragPack *)vfrag;
     FragItem * item = NULL;
+    int64      blksize = 0;
+    int64      length = 0;
     int        i, num = 0;
     int        len = 0;
     void     * p = NULL;
@@ -185,9 +626,9 @@ int frag_pack_read (void * vfrag, int fd, int64 pos)
 
     EnterCriticalSection(&frag->packCS);
 
-    lseek(fd, SEEK_SET, pos);
+    lseek(fd, pos, SEEK_SET);
 
-    filefd_read(fd, &frag->length, 8);
+    filefd_read(fd, &length, 8);
 
     filefd_read(fd, &len, 4);
     if ((len % sizeof(FragItem)) != 0) {
@@ -203,21 +644,26 @@ int frag_pack_read (void * vfrag, int fd, int64 pos)
     p = kalloc(len);
     filefd_read(fd, p, len);
 
-    vstar_zero(frag->pack_var);
+    /* the ranges are loaded into the tree, then into the bitmap of new length */
+    blksize = frag->blksize;
+    if (blksize > 0) frag_rebuild(frag, 0, length);
+
+    frag_tree_zero(frag);
     frag->rcvlen = 0;
+    frag->length = length;
 
     num = len/sizeof(FragItem);
     for (i = 0; i < num; i++) {
         item = (FragItem *)(p + i * sizeof(FragItem));
-        frag->rcvlen += item->length;
-
-        vstar_push(frag->pack_var, item);
+        frag_tree_add(frag, item->offset, item->length);
     }
     kfree(p);
 
-    LeaveCriticalSection(&frag->packCS);
+    if (blksize > 0) frag_rebuild(frag, blksize, length);
 
-    frag_pack_complete(frag);
+    frag_check_complete(frag);
+
+    LeaveCriticalSection(&frag->packCS);
 
     return 0;
 }
@@ -225,6 +671,7 @@ int frag_pack_read (void * vfrag, int fd, int64 pos)
 int frag_pack_write (void * vfrag, int fd, int64 pos)
 {
     FragPack * frag = (FragPack *)vfrag;
+    FragItem * items = NULL;
     int        len = 0;
  
     if (!frag) return -1;
@@ -232,241 +679,110 @@ int frag_pack_write (void * vfrag, int fd, int64 pos)
  
     EnterCriticalSection(&frag->packCS);
 
-    len = vstar_len(frag->pack_var);
+    if (frag->fragnum > 0) {
+        items = kalloc(sizeof(FragItem) * frag->fragnum);
+        if (!items) {
+            LeaveCriticalSection(&frag->packCS);
+            return -100;
+        }
+        len = frag_items(frag, items, frag->fragnum) * sizeof(FragItem);
+    }
 
-    lseek(fd, SEEK_SET, pos);
+    lseek(fd, pos, SEEK_SET);
     filefd_write(fd, &frag->length, 8);
     filefd_write(fd, &len, 4);
-    filefd_write(fd, vstar_ptr(frag->pack_var), len);
+    if (len > 0) filefd_write(fd, items, len);
 
     LeaveCriticalSection(&frag->packCS);
 
+    if (items) kfree(items);
+
     return len + 12;
 }
  
 int frag_pack_add (void * vfrag, int64 pos, int64 len)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem   sitem = {0};
-    FragItem * item = NULL;
-    FragItem * next = NULL;
-    int        found = 0;
-    int        loc = 0;
-    int64      rcvlen = 0;
+    int64      added = 0;
 
     if (!frag) return -1;
 
     if (frag->complete) return 0;
 
-    if (frag->length > 0) {
-        if (pos > frag->length) pos = frag->length;
-        if (pos + len > frag->length)
-            len = frag->length - pos;
-    }
-
-    sitem.offset = pos;
-    sitem.length = len;
+    len = frag_pack_clip(frag, &pos, len);
+    if (pos < 0 || len <= 0) return 0;
 
     EnterCriticalSection(&frag->packCS);
 
-    loc = vstar_findloc_by(frag->pack_var, &pos, fragitem_cmp_offset, &found);
-    if (!found) {
-        item = NULL;
-        if (loc > 0) 
-            item = vstar_get(frag->pack_var, loc-1);
-        if (item && item->offset + item->length == pos) {
-            sitem.offset = item->offset;
-            sitem.length = item->length;
-
-            item->length = pos + len - item->offset;
-            goto loopcheck;
-        }
-
-        next = vstar_get(frag->pack_var, loc);
-        if (!next || pos + len < next->offset) {
-            /* -...  !     !      |----------| ... 
-                    pos pos+len  next     length    */
-            vstar_insert(frag->pack_var, &sitem, loc);
+    if (frag->blksize > 0)
+        added = frag_blk_add(frag, pos, len);
+    else
+        added = frag_tree_add(frag, pos, len);
 
-            rcvlen = len;
-            frag->rcvlen += rcvlen;
+    frag_check_complete(frag);
 
-            goto end_add;
-        }
+    LeaveCriticalSection(&frag->packCS);
 
-        if (pos + len <= next->offset + next->length) {
-            /* -...  !    |-------!------| ...
-                    pos  next  pos+len  length    */
-            rcvlen = next->offset - pos;
-            frag->rcvlen += rcvlen;
+    return added > 0 ? 1 : 0;
+}
 
-            next->length += next->offset - pos;
-            next->offset = pos;
+int frag_pack_add_n (void * vfrag, FragItem * items, int num)
+{
+    FragPack * frag = (FragPack *)vfrag;
+    int64      added = 0;
+    int64      pos, len, end;
+    int        i;
 
-            goto end_add;
-        } 
+    if (!frag) return -1;
+    if (!items || num <= 0) return 0;
 
-        /* -...  !    |-------|    |--------!-------| ...
-                pos  next       next+1   pos+len    */
-        rcvlen = next->offset - pos;
-        frag->rcvlen += rcvlen;
+    if (frag->complete) return 0;
 
-        sitem.offset = next->offset;
-        sitem.length = next->length;
+    EnterCriticalSection(&frag->packCS);
 
-        item = next;
-        item->offset = pos;
-        item->length = len;
-        loc++;
+    for (i = 0; i < num; ) {
+        pos = items[i].offset;
+        end = pos + items[i].length;
 
-    } else { //found one item
-        /* -... |-----!----------!-----|        |-----------| ... 
-               item  pos                       next     */
-        item = vstar_get(frag->pack_var, loc);
-        if (pos + len <= item->offset + item->length) {
-            LeaveCriticalSection(&frag->packCS);
-            return 0;
+        /* the ranges received in order go into the pack as one */
+        for (i++; i < num && items[i].offset >= pos && items[i].offset <= end; i++) {
+            if (items[i].offset + items[i].length > end)
+                end = items[i].offset + items[i].length;
         }
 
-        /* -... |-----!------|        |--------!-----| ... 
-               item  pos             next   pos+len         */
-        sitem.offset = item->offset;
-        sitem.length = item->length;
+        len = frag_pack_clip(frag, &pos, end - pos);
+        if (pos < 0 || len <= 0) continue;
 
-        item->length = pos + len - item->offset;
-        loc++;
+        if (frag->blksize > 0)
+            added += frag_blk_add(frag, pos, len);
+        else
+            added += frag_tree_add(frag, pos, len);
     }
 
-loopcheck:
-    while (loc <= vstar_num(frag->pack_var)) {
-        next = vstar_get(frag->pack_var, loc);
-        if (next && item->offset + item->length >= next->offset) {
-            /* -... |-----!----|     |----!--------| ... 
-                   item  pos       next pos+len    */
-            rcvlen = next->offset - (sitem.offset + sitem.length);
-            frag->rcvlen += rcvlen;
-
-            if (item->offset + item->length <= next->offset + next->length) {
-                item->length = next->offset - item->offset + next->length;
-                vstar_delete(frag->pack_var, loc);
-                break;
- 
-            } else {
-                /* -... |-----!----|     |--------|    |-------!---|  ... 
-                       item  pos       next           next  pos+len    */
-                sitem.offset = next->offset;
-                sitem.length = next->length;
-
-                vstar_delete(frag->pack_var, loc);
-            }
- 
-        } else {
-            rcvlen = (item->offset + item->length) - (sitem.offset + sitem.length);
-            frag->rcvlen += rcvlen;
-            break;
-        }
-    }
-
-end_add:
-    if (vstar_num(frag->pack_var) == 1) {
-        item = vstar_get(frag->pack_var, 0);
-        if (item && item->offset == 0) {
-            if (frag->length > 0 && item->length == frag->length)
-                frag->complete = 1;
-        }
-    }
+    frag_check_complete(frag);
 
     LeaveCriticalSection(&frag->packCS);
-    return 1;
+
+    return added > 0 ? 1 : 0;
 }
 
 int frag_pack_del (void * vfrag, int64 pos, int64 len)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem   sitem = {0};
-    FragItem * item = NULL;
-    int        found = 0;
-    int        loc = 0;
  
     if (!frag) return -1;
  
-    if (frag->length > 0) {
-        if (pos > frag->length) pos = frag->length;
-        if (pos + len > frag->length)
-            len = frag->length - pos;
-    }
+    len = frag_pack_clip(frag, &pos, len);
+    if (pos < 0 || len <= 0) return 1;
 
     EnterCriticalSection(&frag->packCS);
  
-    loc = vstar_findloc_by(frag->pack_var, &pos, fragitem_cmp_offset, &found);
-    if (found) {
-        item = vstar_get(frag->pack_var, loc);
-        if (item) {
-            if (pos == item->offset) {
-                if (pos + len >= item->offset + item->length) {
-                    /*     pos          pos+len                                 
-                       -... |----------|  !    |--------|    |-----------|  ... 
-                           item               next           next             */
-                    frag->rcvlen -= item->length;
-                    vstar_delete(frag->pack_var, loc);
-                } else {
-                    /*     pos   pos+len                                 
-                       -... |------!---|       |--------|    |-----------|  ... 
-                           item               next           next             */
-                    item->length -= len;
-                    item->offset = pos + len;
-
-                    frag->rcvlen -= len;
-                    LeaveCriticalSection(&frag->packCS);
-                    return 1;
-                }
-            } else {
-                if (pos + len >= item->offset + item->length) {
-                    /*       pos         pos+len                                 
-                       -... |--!--------|   !    |--------|    |-----------|  ... 
-                           item                 next           next             */
-                    frag->rcvlen -= item->length - (pos - item->offset);
-                    item->length = pos - item->offset;
-                    loc++;
-                } else {
-                    /*       pos   pos+len                                 
-                       -... |--!-----!--|       |--------|    |-----------|  ... 
-                           item                 next           next             */
-                    frag->rcvlen -= len;
-
-                    sitem.offset = pos + len;
-                    sitem.length = (item->offset + item->length) - (pos + len);
-                    vstar_insert(frag->pack_var, &sitem, loc + 1);
-
-                    item->length = pos - item->offset;
-                    LeaveCriticalSection(&frag->packCS);
-                    return 1;
-                }
-            }
-        }
-    }
-
-    while (loc <= vstar_num(frag->pack_var)) {
-        item = vstar_get(frag->pack_var, loc);
-        if (!item || pos + len <= item->offset) break;
+    if (frag->blksize > 0)
+        frag_blk_del(frag, pos, len);
+    else
+        frag_tree_del(frag, pos, len);
 
-        if (pos + len >= item->offset + item->length) {
-            /*       pos                      pos+len                                 
-              -... |--!--------|     |--------|  !   |-----------|  ... 
-                                    item            next             */
-            frag->rcvlen -= item->length;
-            vstar_delete(frag->pack_var, loc);
-
-        } else {
-            /*       pos                pos+len                                 
-              -... |--!--------|     |-----!---|      |-----------|  ... 
-                                    item            next             */
-            frag->rcvlen -= (pos + len) - item->offset;
-            item->length = (item->offset + item->length) - (pos + len);
-            item->offset = pos + len;
-            break;
-        }
-    }
+    frag->complete = 0;
 
     LeaveCriticalSection(&frag->packCS);
 
@@ -476,9 +792,8 @@ int frag_pack_del (void * vfrag, int64 pos, int64 len)
 int frag_pack_get (void * vfrag, int64 pos, int64 * actpos, int64 * actlen)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
+    FragItem   cur, next;
     int        found = 0;
-    int        loc = 0;
  
     if (actpos) *actpos = 0;
     if (actlen) *actlen = 0;
@@ -486,45 +801,31 @@ int frag_pack_get (void * vfrag, int64 pos, int64 * actpos, int64 * actlen)
     if (!frag) return -1;
  
     EnterCriticalSection(&frag->packCS);
+    found = frag_span(frag, pos, &cur, &next);
+    LeaveCriticalSection(&frag->packCS);
  
-    loc = vstar_findloc_by(frag->pack_var, &pos, fragitem_cmp_offset, &found);
     if (!found) {
-        item = vstar_get(frag->pack_var, loc);
-        if (item) {
-            if (actpos) *actpos = item->offset;
-            if (actlen) *actlen = item->length;
-
-            LeaveCriticalSection(&frag->packCS);
+        if (next.length > 0) {
+            if (actpos) *actpos = next.offset;
+            if (actlen) *actlen = next.length;
             return 0;
         }
 
-        LeaveCriticalSection(&frag->packCS);
         return -100;
     }
 
-    item = vstar_get(frag->pack_var, loc);
-    if (item) {
-        if (actpos) *actpos = item->offset;
-        if (actlen) *actlen = item->length;
-
-        LeaveCriticalSection(&frag->packCS);
-        return 1;
-    }
-
-    LeaveCriticalSection(&frag->packCS);
+    if (actpos) *actpos = cur.offset;
+    if (actlen) *actlen = cur.length;
 
-    return 0;
+    return 1;
 }
  
 int frag_pack_gap (void * vfrag, int64 pos, int64 * gappos, int64 * gaplen)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * prev = NULL;
-    FragItem * next = NULL;
+    FragItem   prev, next;
     int64      offset = 0;
     int64      length = 0;
-    int        found = 0;
-    int        loc = 0;
  
     if (gappos) *gappos = 0;
     if (gaplen) *gaplen = 0;
@@ -533,25 +834,16 @@ int frag_pack_gap (void * vfrag, int64 pos, int64 * gappos, int64 * gaplen)
  
     EnterCriticalSection(&frag->packCS);
  
-    loc = vstar_findloc_by(frag->pack_var, &pos, fragitem_cmp_offset, &found);
-    if (!found) {
-        next = vstar_get(frag->pack_var, loc);
-        if (loc > 0)
-            prev = vstar_get(frag->pack_var, loc - 1);
-
-    } else {
-        prev = vstar_get(frag->pack_var, loc);
-        next = vstar_get(frag->pack_var, loc + 1);
-    }
+    frag_span(frag, pos, &prev, &next);
 
-    if (prev) {
-        offset = prev->offset + prev->length;
+    if (prev.length > 0) {
+        offset = prev.offset + prev.length;
     } else {
         offset = 0;
     }
 
-    if (next) {
-        length = next->offset - offset;
+    if (next.length > 0) {
+        length = next.offset - offset;
     } else {
         if (frag->length > 0)
             length = frag->length - offset;
@@ -578,10 +870,8 @@ int frag_pack_contain (void * vfrag, int64 pos, int length, int64 * datapos,
                        int64 * datalen, int64 * gappos, int64 * gaplen)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
-    FragItem * next = NULL;
-    int        found = 0;
-    int        loc = 0;
+    FragItem   item, next;
+    int64      len = length;
  
     if (datapos) *datapos = pos;
     if (datalen) *datalen = 0;
@@ -598,98 +888,92 @@ int frag_pack_contain (void * vfrag, int64 pos, int length, int64 * datapos,
     }
 
     if (pos >= 0) {
-        if (length < 0 && frag->length > 0)  //[200, -1]
-            length = frag->length - pos;
-        else if (length < 0 && frag->length <= 0)  //[200, -1]
-            length = 0x7FFFFFFFFFFFFFFF - pos;
+        if (len < 0 && frag->length > 0)  //[200, -1]
+            len = frag->length - pos;
+        else if (len < 0 && frag->length <= 0)  //[200, -1]
+            len = 0x7FFFFFFFFFFFFFFF - pos;
     } else {
-        if (length > 0 && frag->length > 0)  //[-1, 1000]
-            pos = frag->length - length;
+        if (len > 0 && frag->length > 0)  //[-1, 1000]
+            pos = frag->length - len;
     }
 
-    if (pos < 0 || length < 0) return -10;
+    if (pos < 0 || len < 0) return -10;
 
     EnterCriticalSection(&frag->packCS);
 
-    loc = vstar_findloc_by(frag->pack_var, &pos, fragitem_cmp_offset, &found);
-    if (!found) {
-        item = vstar_get(frag->pack_var, loc);
-        if (item) {
-            if (gaplen) *gaplen = item->offset - pos;
+    if (!frag_span(frag, pos, &item, &next)) {
+        if (next.length > 0) {
+            if (gaplen) *gaplen = next.offset - pos;
         } else {
             if (gaplen) *gaplen = frag->length - pos;
         }
 
-        if (item && pos + length >= item->offset) {
+        LeaveCriticalSection(&frag->packCS);
+
+        if (next.length > 0 && pos + len >= next.offset) {
             /* !    |--!-------| */
-            if (datapos) *datapos = item->offset;
-            if (datalen) *datalen = pos + length - item->offset;
+            if (datapos) *datapos = next.offset;
+            if (datalen) *datalen = pos + len - next.offset;
 
-            LeaveCriticalSection(&frag->packCS);
             return 1;  //right-side partial contained
         }
 
-        LeaveCriticalSection(&frag->packCS);
         return 0;
- 
-    } else {
-        item = vstar_get(frag->pack_var, loc);
-        if (item) {
-            if (gappos) *gappos = item->offset + item->length;
-
-            next = vstar_get(frag->pack_var, loc+1);
-            if (next) {
-                if (gaplen) *gaplen = next->offset - item->offset - item->length;
-            } else {
-                if (gaplen) *gaplen = frag->length - item->offset - item->length;
-            }
-
-            if (pos + length > item->offset + item->length) {
-                /* |------!---|    ! */
-                if (datapos) *datapos = pos;
-                if (datalen) *datalen = item->offset + item->length - pos;
-
-                LeaveCriticalSection(&frag->packCS);
-                return 2;  //left-side partial contained
-
-            } else {
-                if (datapos) *datapos = pos;
-                if (datalen) *datalen = length;
-
-                LeaveCriticalSection(&frag->packCS);
-                return 3;  //completely contained
-            }
-        }
     }
 
     LeaveCriticalSection(&frag->packCS);
 
-    return 0;
+    if (gappos) *gappos = item.offset + item.length;
+
+    if (next.length > 0) {
+        if (gaplen) *gaplen = next.offset - item.offset - item.length;
+    } else {
+        if (gaplen) *gaplen = frag->length - item.offset - item.length;
+    }
+
+    if (pos + len > item.offset + item.length) {
+        /* |------!---|    ! */
+        if (datapos) *datapos = pos;
+        if (datalen) *datalen = item.offset + item.length - pos;
+
+        return 2;  //left-side partial contained
+    }
+
+    if (datapos) *datapos = pos;
+    if (datalen) *datalen = len;
+
+    return 3;  //completely contained
 }
 
 void frag_pack_print (void * vfrag, FILE * fp)
 {
     FragPack * frag = (FragPack *)vfrag;
-    FragItem * item = NULL;
-    int        i, num;
+    FragItem * items = NULL;
+    int        i, num = 0;
 
     if (!frag) return;
 
     if (!fp) fp = stdout;
 
-    num = vstar_num(frag->pack_var);
+    EnterCriticalSection(&frag->packCS);
+
+    if (frag->fragnum > 0) {
+        items = kalloc(sizeof(FragItem) * frag->fragnum);
+        if (items) num = frag_items(frag, items, frag->fragnum);
+    }
 
     fprintf(fp, "FragLength: %lld  RcvLen: %lld  Complete: %d  FragNum: %d\n",
-            frag->length, frag->rcvlen, frag->complete, num);
+            frag->length, frag->rcvlen, frag->complete, frag->fragnum);
 
     for (i = 1; i <= num; i++) {
-        item = vstar_get(frag->pack_var, i-1);
-        if (!item) continue;
-
         if (i % 6 == 0) fprintf(fp, "\n");
 
-        fprintf(fp, "  [%-2d %lld-%lld]", i, item->offset, item->length);
+        fprintf(fp, "  [%-2d %lld-%lld]", i, items[i-1].offset, items[i-1].length);
     }
     fprintf(fp, "\n");
+
+    LeaveCriticalSection(&frag->packCS);
+
+    if (items) kfree(items);
 }
 
@@ -5,11 +5,13 @@
 
 #include "btype.h"
 #include "memory.h"
+#include "bpool.h"
 #include "frame.h"
 #include "strutil.h"
 #include "patmat.h"
 #include "fileop.h"
 #include "tsock.h"
+#include "metrics.h"
 
 #include <stdarg.h>
 #include <assert.h>
@@ -23,23 +25,192 @@
 extern void *memrchr (__const void *__s, int __c, size_t __n);
 #define  DEFAULT_SIZE  128
 
+/* the data of frames not beyond the largest size class are fetched from the
+   pools of size classes, and frame_t from the pool of the last slot. all pools
+   keep per-thread magazines, so building and releasing frames in one thread
+   mostly takes no lock. larger data are allocated by kalloc */
+#define  FRAME_CLASSES  4
+#define  FRAME_TLCACHE  32
+
+static const int frame_class_size[FRAME_CLASSES] = { 256, 1024, 4096, 16384 };
+static bpool_t * frame_pool[FRAME_CLASSES + 1];
+
+typedef struct FrameShare_ {
+    int      ref;
+    uint8  * data;
+    int      size;
+    int      pool;
+} FrameShare;
+
+static bpool_t * frame_pool_get (int cls)
+{
+    bpool_t * pool = NULL;
+    bpool_t * old = NULL;
+
+    pool = __atomic_load_n(&frame_pool[cls], __ATOMIC_ACQUIRE);
+    if (pool) return pool;
+
+    pool = bpool_init(NULL);
+    if (!pool) return NULL;
+
+    if (cls < FRAME_CLASSES) {
+        bpool_set_unitsize(pool, frame_class_size[cls]);
+        bpool_set_allocnum(pool, 16);
+    } else {
+        bpool_set_unitsize(pool, sizeof(frame_t));
+        bpool_set_allocnum(pool, 64);
+    }
+    bpool_set_tlcache(pool, FRAME_TLCACHE);
+
+    /* another thread has set up the pool first */
+    if (!__atomic_compare_exchange_n(&frame_pool[cls], &old, pool, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        bpool_clean(pool);
+        return old;
+    }
+
+    return pool;
+}
+
+/* allocate the data of at least size bytes, plus one byte for the
+   terminating zero of frame_string */
+static uint8 * frame_data_alloc (int size, int * psize, int * pcls)
+{
+    bpool_t * pool = NULL;
+    uint8   * p = NULL;
+    int       i;
+
+    if (size < 0) size = 0;
+
+    for (i = 0; i < FRAME_CLASSES; i++) {
+        if (size + 1 > frame_class_size[i])
+            continue;
+
+        pool = frame_pool_get(i);
+        if (pool && (p = bpool_fetch(pool)) != NULL) {
+            *psize = frame_class_size[i] - 1;
+            *pcls = i + 1;
+            p[0] = '\0';
+            return p;
+        }
+        break;
+    }
+
+    p = kzalloc(size + 1);
+    if (!p) return NULL;
+
+    *psize = size;
+    *pcls = 0;
+
+    return p;
+}
+
+static void frame_data_free (uint8 * data, int cls)
+{
+    if (!data) return;
+
+    if (cls > 0 && frame_pool[cls - 1])
+        bpool_recycle(frame_pool[cls - 1], data);
+    else
+        kfree(data);
+}
+
+/* enlarge the data to hold at least size bytes. the bytes before
+   start + len are kept in place */
+static int frame_data_resize (frame_p frm, int size)
+{
+    uint8  * p = NULL;
+    int      newsize = 0, cls = 0;
+
+    if (frm->data && size <= frm->size) return 0;
+
+    if (frm->data && metrics_on) {
+        metrics_counter_add(MC_FRAME_REALLOC, 1);
+        metrics_counter_add(MC_FRAME_REALLOC_BYTES, frm->start + frm->len);
+        metrics_hist_record(MH_FRAME_REALLOC_SIZE, size);
+    }
+
+    if (frm->data && frm->pool == 0 && size + 1 > frame_class_size[FRAME_CLASSES - 1]) {
+        p = krealloc(frm->data, size + 1);
+        if (!p) return -100;
+
+        frm->data = p;
+        frm->size = size;
+        return 0;
+    }
+
+    p = frame_data_alloc(size, &newsize, &cls);
+    if (!p) return -100;
+
+    if (frm->data) {
+        if (frm->start + frm->len > 0)
+            memcpy(p, frm->data, frm->start + frm->len);
+        frame_data_free(frm->data, frm->pool);
+    } else {
+        frm->start = 0;
+        frm->len = 0;
+    }
+
+    frm->data = p;
+    frm->size = newsize;
+    frm->pool = cls;
+
+    return 0;
+}
+
+static frame_p frame_alloc ()
+{
+    bpool_t * pool = NULL;
+    frame_p   frm = NULL;
+
+    pool = frame_pool_get(FRAME_CLASSES);
+    if (pool) frm = bpool_fetch(pool);
+
+    if (!frm) frm = kalloc(sizeof(*frm));
+    if (!frm) return NULL;
+
+    memset(frm, 0, sizeof(*frm));
+
+    return frm;
+}
+
+static void frame_release (frame_p frm)
+{
+    if (frame_pool[FRAME_CLASSES] && bpool_recycle(frame_pool[FRAME_CLASSES], frm) == 0)
+        return;
+
+    kfree_sz(frm, sizeof(*frm));
+}
+
+static void frame_share_release (FrameShare * sh)
+{
+    if (!sh) return;
+
+    if (__atomic_sub_fetch(&sh->ref, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    frame_data_free(sh->data, sh->pool);
+    kfree_sz(sh, sizeof(*sh));
+}
+
 frame_p frame_new (int size)
 {
     frame_p frm = NULL;
  
-    frm = kzalloc(sizeof(*frm));
+    frm = frame_alloc();
+    if (!frm) return NULL;
+
     frm->next = NULL;
-    if (size <= 0) {
-        frm->len = 0;
-        frm->size = 0;
-        frm->start = 0;
-        frm->data = kzalloc(4 + 2);
-    } else {
-        frm->start = 0;
-        frm->len = 0;
-        frm->size = size;
-        frm->data = kzalloc(frm->size + 1);
+    frm->start = 0;
+    frm->len = 0;
+
+    frm->data = frame_data_alloc(size, &frm->size, &frm->pool);
+    if (!frm->data) {
+        frame_release(frm);
+        return NULL;
     }
+
     return frm;
 }
 
@@ -52,9 +223,11 @@ void frame_free (frame_p frm)
     do {
         iter = frm->next;
 
-        if (frm->data)
-            kfree(frm->data);
-        kfree(frm);
+        if (frm->share)
+            frame_share_release(frm->share);
+        else if (frm->data)
+            frame_data_free(frm->data, frm->pool);
+        frame_release(frm);
 
         frm = iter;
     } while (frm != NULL);
@@ -76,10 +249,108 @@ int frame_size (frame_p frm)
     return frm->size;
 }
 
+frame_p frame_slice (frame_p frm, int pos, int len)
+{
+    FrameShare * sh = NULL;
+    frame_p      slc = NULL;
+
+    if (!frm || pos < 0 || pos > frm->len) return NULL;
+
+    if (len < 0 || len > frm->len - pos)
+        len = frm->len - pos;
+
+    if (!frm->data) return frame_new(0);
+
+    slc = frame_alloc();
+    if (!slc) return NULL;
+
+    sh = frm->share;
+    if (!sh) {
+        /* the data of frm is handed over to the shared buffer */
+        sh = kzalloc(sizeof(*sh));
+        if (!sh) {
+            frame_release(slc);
+            return NULL;
+        }
+        sh->ref = 1;
+        sh->data = frm->data;
+        sh->size = frm->size;
+        sh->pool = frm->pool;
+        frm->share = sh;
+    }
+
+    __atomic_add_fetch(&sh->ref, 1, __ATOMIC_ACQ_REL);
+
+    slc->data = frm->data + frm->start + pos;
+    slc->start = 0;
+    slc->size = len;
+    slc->len = len;
+    slc->next = NULL;
+    slc->share = sh;
+
+    return slc;
+}
+
+frame_p frame_share (frame_p frm)
+{
+    if (!frm) return NULL;
+
+    return frame_slice(frm, 0, frm->len);
+}
+
+int frame_unshare (frame_p frm)
+{
+    FrameShare * sh = NULL;
+    uint8      * p = NULL;
+    int          size = 0, cls = 0;
+
+    if (!frm || !(sh = frm->share)) return 0;
+
+    if (__atomic_load_n(&sh->ref, __ATOMIC_ACQUIRE) == 1) {
+        /* no other frame refers it, the whole buffer is taken back */
+        frm->start += frm->data - sh->data;
+        frm->data = sh->data;
+        frm->size = sh->size;
+        frm->pool = sh->pool;
+        frm->share = NULL;
+
+        kfree_sz(sh, sizeof(*sh));
+        return 0;
+    }
+
+    p = frame_data_alloc(frm->len, &size, &cls);
+    if (!p) return -100;
+
+    if (frm->len > 0)
+        memcpy(p, frm->data + frm->start, frm->len);
+    p[frm->len] = '\0';
+
+    frm->data = p;
+    frm->start = 0;
+    frm->size = size;
+    frm->pool = cls;
+    frm->share = NULL;
+
+    frame_share_release(sh);
+
+    return 0;
+}
+
+int frame_shared (frame_p frm)
+{
+    if (!frm || !frm->share) return 0;
+
+    return __atomic_load_n(&((FrameShare *)frm->share)->ref, __ATOMIC_ACQUIRE) > 1;
+}
+
 char * frame_string (frame_p frm)
 {
     if (!frm || !frm->data) return NULL;
 
+    /* the terminating zero may overwrite the byte viewed by other slice */
+    if (frm->share && frame_unshare(frm) < 0)
+        return NULL;
+
     if (frm->start + frm->len > frm->size)
         return NULL;
  
@@ -145,6 +416,9 @@ frame_p frame_dup (frame_p frm)
 void frame_grow (frame_p frm, int size)
 {
     int       dif = 0;
+    int       newsize = 0;
+
+    if (frame_unshare(frm) < 0) return;
 
     if (!frm || size <= 0) return;
 
@@ -160,27 +434,24 @@ void frame_grow (frame_p frm, int size)
         return;
     }
 
-    dif = (frm->size + size) % DEFAULT_SIZE;
-    dif = DEFAULT_SIZE - dif;
-    size += dif;
+    /* grow by half of current size at least, appending piece by piece
+       costs amortized O(1) reallocations */
+    newsize = frm->size + size;
+    if (newsize < frm->size + frm->size / 2)
+        newsize = frm->size + frm->size / 2;
 
-    if (frm->data == NULL) {
-        frm->data = kzalloc(frm->size + size + 1);
-        frm->start = 0;
-        frm->len = 0;
-    } else {
-        frm->data = krealloc(frm->data, frm->size + size + 1);
-        if (!frm->data)
-            frm->data = kzalloc(frm->size + size + 1);
-    }
+    dif = newsize % DEFAULT_SIZE;
+    if (dif) newsize += DEFAULT_SIZE - dif;
 
-    frm->size += size;
+    frame_data_resize(frm, newsize);
 }
 
 void frame_grow_to (frame_p frm, int size)
 {
     if (!frm || size <= 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (size <= frm->size) return;
 
     frame_grow(frm, size - frm->size);
@@ -189,6 +460,9 @@ void frame_grow_to (frame_p frm, int size)
 void frame_grow_head (frame_p frm, int size)
 {
     int  dif = 0, rest = 0;
+    int  oldsize = 0, newsize = 0;
+
+    if (frame_unshare(frm) < 0) return;
 
     if (!frm || size <= 0) return;
 
@@ -208,21 +482,21 @@ void frame_grow_head (frame_p frm, int size)
         return;
     }
 
-    dif = (frm->size + size) % DEFAULT_SIZE;
-    dif = DEFAULT_SIZE - dif;
-    size += dif;
- 
-    if (frm->data == NULL) {
-        frm->data = kzalloc(frm->size + size + 1);
-        frm->len = 0;
-    } else {
-        frm->data = krealloc(frm->data, frm->size + size + 1);
-        if (!frm->data)
-            frm->data = kzalloc(frm->size + size + 1);
- 
-        memmove (frm->data + size, frm->data, frm->size);
-    }
-    frm->size += size;
+    newsize = frm->size + size;
+    if (newsize < frm->size + frm->size / 2)
+        newsize = frm->size + frm->size / 2;
+
+    dif = newsize % DEFAULT_SIZE;
+    if (dif) newsize += DEFAULT_SIZE - dif;
+
+    oldsize = frm->data ? frm->size : 0;
+    if (frame_data_resize(frm, newsize) < 0)
+        return;
+
+    /* all the space added goes before the data */
+    size = frm->size - oldsize;
+    if (frm->len > 0)
+        memmove(frm->data + frm->start + size, frm->data + frm->start, frm->len);
     frm->start += size;
 }
 
@@ -302,6 +576,8 @@ int frame_get (frame_p frm, int pos)
     if (pos == frm->len - 1) 
         return frame_get_last(frm);
 
+    if (frame_unshare(frm) < 0) return -100;
+
     c = frm->data[frm->start + pos];
 
     memmove(frm->data + frm->start + pos,
@@ -333,6 +609,8 @@ int frame_getn (frame_p frm, int pos, void * bytes, int n)
     if (pos + n >= frm->len)
         return frame_get_nlast(frm, bytes, n);
     
+    if (frame_unshare(frm) < 0) return -100;
+
     memcpy(bytes, &frm->data[frm->start + pos], n);
 
     memmove (frm->data + frm->start + pos,
@@ -450,9 +728,12 @@ void frame_put_first (frame_p frm, int byte)
 {
     if (!frm) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (frm->data == NULL) {
         frm->size = DEFAULT_SIZE;
-        frm->data = kzalloc(frm->size + 1);
+        frm->data = frame_data_alloc(frm->size, &frm->size, &frm->pool);
+        if (!frm->data) return;
         frm->start = frm->size/2;
         frm->len = 0;
     }
@@ -470,9 +751,12 @@ void frame_put_nfirst (frame_p frm, void * bytes, int n)
 {
     if (!frm || !bytes || n <= 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (frm->data == NULL) {
         frm->size = n + DEFAULT_SIZE - (n % DEFAULT_SIZE);
-        frm->data = kzalloc(frm->size + 1);
+        frm->data = frame_data_alloc(frm->size, &frm->size, &frm->pool);
+        if (!frm->data) return;
         frm->start = n;
         frm->len = 0;
     }
@@ -490,9 +774,12 @@ void frame_put_last (frame_p frm, int byte)
 {
     if (!frm) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (frm->data == NULL) {
         frm->size = DEFAULT_SIZE;
-        frm->data = kzalloc(frm->size + 1);
+        frm->data = frame_data_alloc(frm->size, &frm->size, &frm->pool);
+        if (!frm->data) return;
         frm->start = frm->size/2;
         frm->len = 0;
     }
@@ -509,9 +796,12 @@ void frame_put_nlast (frame_p frm, void * bytes, int n)
 {
     if (!frm || !bytes || n <= 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (frm->data == NULL) {
         frm->size = n + DEFAULT_SIZE - (n % DEFAULT_SIZE);
-        frm->data = kzalloc(frm->size + 1);
+        frm->data = frame_data_alloc(frm->size, &frm->size, &frm->pool);
+        if (!frm->data) return;
         frm->start = 0;
         frm->len = 0;
     }
@@ -528,6 +818,8 @@ void frame_put (frame_p frm, int pos, int byte)
 {
     if (!frm || pos < 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (pos == 0) {
         frame_put_first(frm, byte);
         return;
@@ -554,6 +846,8 @@ void frame_putn (frame_p frm, int pos, void * bytes, int n)
 {
     if (!frm || !bytes || pos < 0 || n <= 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (pos == 0) {
         frame_put_nfirst(frm, bytes, n);
         return;
@@ -581,6 +875,8 @@ void frame_set (frame_p frm, int pos, int byte)
     if (!frm || frm->len <= 0 || pos < 0 || pos >= frm->len)
         return;
 
+    if (frame_unshare(frm) < 0) return;
+
     frm->data[frm->start + pos] = byte;
 }
 
@@ -589,6 +885,8 @@ void frame_setn (frame_p frm, int pos, void * bytes, int n)
     if (!frm || frm->len <= 0 || pos < 0 || pos >= frm->len)
         return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (!bytes || n <= 0)
         return;
 
@@ -625,6 +923,8 @@ void frame_appendf (frame_p frm, char * fmt, ...)
     int     avail = 0;
     int     written = 0;
 
+    if (frame_unshare(frm) < 0) return;
+
     for (;;) {
         avail = frame_rest(frm);
         va_start(args, fmt);
@@ -741,6 +1041,8 @@ void frame_del (frame_p frm, int pos, int n)
         return;
     }
 
+    if (frame_unshare(frm) < 0) return;
+
     memmove(frm->data + frm->start + pos,
              frm->data + frm->start + pos + n,
              frm->len - pos - n);
@@ -772,10 +1074,14 @@ int frame_attach (frame_p frm, void * pbuf, int len)
     if (!frm || !pbuf || len <= 0)
         return -1;
 
-    if (frm->data)
-        kfree(frm->data);
+    if (frm->share) {
+        frame_share_release(frm->share);
+        frm->share = NULL;
+    } else if (frm->data)
+        frame_data_free(frm->data, frm->pool);
 
     frm->data = pbuf;
+    frm->pool = 0;
     frm->start = 0;
     frm->size = len;
     frm->len = len;
@@ -789,6 +1095,8 @@ int frame_replace (frame_p frm, int pos, int len, void * pbyte, int bytelen)
     if (!frm || frm->len <= 0)
         return -1;
  
+    if (frame_unshare(frm) < 0) return -100;
+
     if (len == 0 && bytelen == 0)
         return 0;
  
@@ -864,7 +1172,7 @@ int frame_search (frame_p frm, int pos, int len, void * pattern, int patlen, int
         if (patlen == 1)
             p = memchr(frm->data + frm->start + pos, pat[0], len);
         else
-            p = kmp_find_bytes(frm->data + frm->start + pos, len, pat, patlen, NULL);
+            p = pat_find(frm->data + frm->start + pos, len, pat, patlen);
     }
 
     if (!p) return -100;
@@ -1006,6 +1314,8 @@ int frame_file_load (frame_p frm, char * fname)
     long        len = 0;
     FILE      * fp = NULL;
 
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm || !fname) return -1;
 
     if (file_stat(fname, &fs) < 0) 
@@ -1052,6 +1362,8 @@ int frame_file_read (frame_p frm, FILE * fp, long fpos, long flen)
     int    readlen = 0;
     long   len = 0;
  
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm || !fp) return -1;
  
     if (flen > 64*1024*1024)
@@ -1095,6 +1407,8 @@ int frame_filefd_read (frame_p frm, int fd, long fpos, long flen)
     int    readlen = 0;
     long   len = 0;
          
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm || fd < 0) return -1; 
                  
     if (flen > 64*1024*1024)
@@ -1157,6 +1471,8 @@ int frame_tcp_recv (frame_p frm, SOCKET fd, int waitms, int * actnum)
 
     if (!frm) return 0;
  
+    if (frame_unshare(frm) < 0) return -100;
+
     if (waitms > 0) {
         gettimeofday(&tick0, NULL);
         restms = waitms;
@@ -1341,6 +1657,8 @@ int frame_tcp_nbzc_recv (frame_p frm, SOCKET fd, int * actnum, int * perr)
  
     if (!frm) return -2;
 
+    if (frame_unshare(frm) < 0) return -100;
+
     for (readLen = 0; ; ) {
         unread = sock_unread_data(fd);
 #ifdef UNIX
@@ -1572,8 +1890,106 @@ error:
     return ret;
 }
 
+/* each frame gets room for the largest datagram or GRO message, the data
+ * received is appended to the end of frame. msgs holds the addresses */
+int frame_udp_recv_batch (frame_p * frms, int num, SOCKET fd, struct udp_msg_s * msgs, int * perr)
+{
+    int   i, ret;
+
+    if (!frms || !msgs || num <= 0) return -1;
+
+    if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+    for (i = 0; i < num; i++) {
+        if (!frms[i]) return -2;
+
+        if (frame_unshare(frms[i]) < 0) return -100;
+
+        if (frame_rest(frms[i]) < 65536)
+            frame_grow(frms[i], 65536 - frame_rest(frms[i]));
+
+        msgs[i].pbuf = frame_end(frms[i]);
+        msgs[i].size = frame_rest(frms[i]);
+    }
+
+    ret = udp_recv_batch(fd, msgs, num, perr);
+
+    for (i = 0; i < ret; i++)
+        frame_len_add(frms[i], msgs[i].len);
+
+    return ret;
+}
+
+/* the content of frms[i] is sent to the address in msgs[i] */
+int frame_udp_send_batch (frame_p * frms, int num, SOCKET fd, struct udp_msg_s * msgs, int * perr)
+{
+    int   i;
+
+    if (!frms || !msgs || num <= 0) return -1;
+
+    for (i = 0; i < num; i++) {
+        msgs[i].pbuf = frame_bgn(frms[i]);
+        msgs[i].len = frame_len(frms[i]);
+    }
+
+    return udp_send_batch(fd, msgs, num, perr);
+}
+
+
+/* make n bytes writable behind the data of frm */
+static int frame_codec_room (frame_p frm, int n)
+{
+    if (frame_unshare(frm) < 0) return -1;
+
+    if (frame_rest(frm) < n)
+        frame_grow(frm, n - frame_rest(frm));
+
+    if (!frm->data || frame_rest(frm) < n) return -100;
+
+    return 0;
+}
 
 //#define BASE64CRLF 1
+#ifndef BASE64CRLF
+int frame_bin_to_base64 (frame_p frm, frame_p dst)
+{
+    int      triplets, need, len, off = 0;
+    int      asclen = 0;
+    uint8  * pbin = NULL;
+ 
+    if (!frm) return -1;
+    if (!dst) dst = frm;
+ 
+    if (frm->len == 0) return 0;
+ 
+    len = frm->len;
+    triplets = (len + 2) / 3;
+    need = triplets * 4 + (triplets + 18) / 19 * 2 + 1;
+
+    if (dst == frm) {
+        /* move the source behind the room of output, so that encoding
+           forward never overwrites the octets not read yet */
+        off = need - len + 32;
+        if (frame_codec_room(frm, off) < 0) return -100;
+
+        pbin = frameP(frm) + off;
+        memmove(pbin, frameP(frm), len);
+    } else {
+        dst->len = 0;
+        if (frame_codec_room(dst, need) < 0) return -100;
+
+        pbin = frameP(frm);
+    }
+
+    asclen = need;
+    if (bin_to_base64(pbin, len, frameP(dst), &asclen) < 0)
+        return -101;
+
+    dst->len = asclen;
+
+    return 0;
+}
+#else
 int frame_bin_to_base64 (frame_p frm, frame_p dst)
 {
     static const uint8 base64[65] =
@@ -1608,6 +2024,8 @@ int frame_bin_to_base64 (frame_p frm, frame_p dst)
     frame_grow_to(dst, triplets * 4 + 1);
 #endif
  
+    if (frame_unshare(dst) < 0) return -100;
+
     orig_len = frm->len;
     pbin = frameP(frm);
     pdst = frameP(dst);
@@ -1718,14 +2136,12 @@ int frame_bin_to_base64 (frame_p frm, frame_p dst)
  
     return 0;
 }
+#endif
  
  
 int frame_base64_to_bin (frame_p frm, frame_p dst)
 {
-    int      triplet, pos, len, to;
-    int      quadpos = 0;
-    uint8  * data = NULL;
-    uint8  * pdst = NULL;
+    int      len, need, binlen;
  
     if (!frm) return -1;
  
@@ -1734,96 +2150,96 @@ int frame_base64_to_bin (frame_p frm, frame_p dst)
  
     if (!dst) dst = frm;
     
-    len = (frm->len + 3)/4 * 3;
-    if (dst->len < len) {
-        frame_grow(dst, len - dst->len);
-    }
+    len = frm->len;
+    need = (len + 3)/4 * 3 + 1;
 
-    data = frameP(frm);
-    pdst = frameP(dst);
- 
-    to = 0;
-    triplet = 0;
-    quadpos = 0;
-    for (pos = 0; pos < frm->len; pos++) {
-        int c = data[pos];
-        int sixbits;
- 
-        if (c >= 'A' && c <= 'Z') {
-            sixbits = c - 'A';
-        } else if (c >= 'a' && c <= 'z') {
-            sixbits = 26 + c - 'a';
-        } else if (c >= '0' && c <= '9') {
-            sixbits = 52 + c - '0';
-        } else if (c == '+') {
-            sixbits = 62;
-        } else if (c == '/') {
-            sixbits = 63;
-        } else if (c == '=') {
-            /* These can only occur at the end of encoded text.  RFC 2045
-             * says we can assume it really is the end. */
-            break;
-        } else if (isspace(c)) {
-            /* skip whitespace */
-            continue;
-        } else {
-            continue;
-        }
- 
-        triplet = (triplet << 6) | sixbits;
-        quadpos++;
- 
-        if (quadpos == 4) {
-            pdst[to++] = (triplet >> 16) & 0xff;
-            pdst[to++] = (triplet >> 8) & 0xff;
-            pdst[to++] = triplet & 0xff;
-            quadpos = 0;
-        }
-    }
- 
-    /* Deal with leftover octets */
-    switch (quadpos) {
-    case 0:
-        break;
-    case 3:  /* triplet has 18 bits, we want the first 16 */
-        pdst[to++] = (triplet >> 10) & 0xff;
-        pdst[to++] = (triplet >> 2) & 0xff;
-        break;
-    case 2:  /* triplet has 12 bits, we want the first 8 */
-        pdst[to++] = (triplet >> 4) & 0xff;
-        break;
-    case 1:
-        break;
+    /* decoding in place is safe, the output never passes the input */
+    if (dst == frm) {
+        if (need > len && frame_codec_room(frm, need - len) < 0) return -100;
+    } else {
+        dst->len = 0;
+        if (frame_codec_room(dst, need) < 0) return -100;
     }
- 
-    dst->len = to;
-    pdst[to] = '\0';
+
+    binlen = need;
+    if (base64_to_bin(frameP(frm), len, frameP(dst), &binlen) < 0)
+        binlen = 0;
+
+    dst->len = binlen;
  
     return 0;
 }
 
+int frame_base64_encode_put (frame_p frm, void * st, void * pbin, int len)
+{
+    int  n = 0;
+
+    if (!frm || !st) return -1;
+    if (!pbin || len <= 0) return 0;
+
+    if (frame_codec_room(frm, (len + 2) / 3 * 4 + 1) < 0) return -100;
+
+    n = bin_to_base64_update((base64_state_t *)st, pbin, len, frameP(frm) + frm->len);
+    if (n > 0) frm->len += n;
+
+    return n;
+}
+
+int frame_base64_encode_end (frame_p frm, void * st)
+{
+    int  n = 0;
+
+    if (!frm || !st) return -1;
+
+    if (frame_codec_room(frm, 5) < 0) return -100;
+
+    n = bin_to_base64_final((base64_state_t *)st, frameP(frm) + frm->len);
+    if (n > 0) frm->len += n;
+
+    return n;
+}
+
+int frame_base64_decode_put (frame_p frm, void * st, void * pasc, int len)
+{
+    int  n = 0;
+
+    if (!frm || !st) return -1;
+    if (!pasc || len <= 0) return 0;
+
+    if (frame_codec_room(frm, (len + 3) / 4 * 3 + 1) < 0) return -100;
+
+    n = base64_to_bin_update((base64_state_t *)st, pasc, len, frameP(frm) + frm->len);
+    if (n > 0) frm->len += n;
+
+    return n;
+}
+
+int frame_base64_decode_end (frame_p frm, void * st)
+{
+    int  n = 0;
+
+    if (!frm || !st) return -1;
+
+    if (frame_codec_room(frm, 3) < 0) return -100;
+
+    n = base64_to_bin_final((base64_state_t *)st, frameP(frm) + frm->len);
+    if (n > 0) frm->len += n;
+
+    return n;
+}
+
 int frame_bin_to_ascii (frame_p binfrm, frame_p ascfrm)
 {
-    int     i = 0;
-    uint8   byte = 0;
-    uint8 * pbin = NULL;
+    int     len = 0;
  
     if (!binfrm || binfrm->len < 1) return -1;
     if (!ascfrm) return -2;
  
-    pbin = binfrm->data + binfrm->start;
+    len = binfrm->len;
+    if (frame_codec_room(ascfrm, len * 2 + 1) < 0) return -100;
 
-    for (i = 0; i < binfrm->len; i++) {
-        byte = ((pbin[i] >> 4) & 0x0F);
-        if (byte < 10) frame_put_last(ascfrm, (byte + '0'));
-        else if (byte < 16) frame_put_last(ascfrm, (byte -10 + 'A'));
-        else frame_put_last(ascfrm, '.');
- 
-        byte = (pbin[i] & 0x0F);
-        if (byte < 10) frame_put_last(ascfrm, (byte + '0'));
-        else if (byte < 16) frame_put_last(ascfrm, (byte -10 + 'A'));
-        else frame_put_last(ascfrm, '.');
-    }
+    bin_to_ascii(frameP(binfrm), len, frameP(ascfrm) + ascfrm->len, NULL, 1);
+    ascfrm->len += len * 2;
  
     return 0;
 }
@@ -1831,43 +2247,62 @@ int frame_bin_to_ascii (frame_p binfrm, frame_p ascfrm)
  
 int frame_ascii_to_bin (frame_p ascfrm, frame_p binfrm)
 {
-    int     i;
-    uint8   byte = 0;
-    uint8 * pascii = NULL;
+    int     len = 0, binlen = 0;
  
     if (!ascfrm || ascfrm->len < 1) return -1;
     if (!binfrm) return -2;
  
-    pascii = ascfrm->data + ascfrm->start;
+    len = ascfrm->len;
+    if (frame_codec_room(binfrm, len / 2 + 1) < 0) return -100;
+
+    if (ascii_to_bin(frameP(ascfrm), len, frameP(binfrm) + binfrm->len, &binlen) < 0)
+        return -100;
+
+    binfrm->len += binlen;
+ 
+    return 0;
+}
 
-    for (i = 0; i < ascfrm->len; i++) {
-        byte <<= 4;
-        if (pascii[i] >= 'a' && pascii[i] <= 'f')
-            byte |= pascii[i] - 'a' + 10;
-        else if (pascii[i] >= 'A' && pascii[i] <= 'F')
-            byte |= pascii[i] - 'A' + 10;
-        else if (pascii[i] >= '0' && pascii[i] <= '9')
-            byte |= pascii[i] - '0';
-        else
-            return -100;
 
-        if ((i + 1) % 2 == 0) {
-            frame_put_last(binfrm, byte);
-            byte = 0;
+/* put the value of \uXXXX, \xXX or \NNN in host byte order, the values
+ * over 0xFFFF are dropped. return the bytes taken */
+static int frame_uval_put (uint8 * dst, uint32 uval)
+{
+    if (uval <= 0xFF) {
+        if (dst) dst[0] = uval & 0xFF;
+        return 1;
+    }
+
+    if (uval <= 0xFFFF) {
+        if (dst && isBigEndian()) {
+            dst[0] = (uval >> 8) & 0xFF;
+            dst[1] = (uval & 0xFF);
+        } else if (dst) {
+            dst[0] = (uval & 0xFF);
+            dst[1] = (uval >> 8) & 0xFF;
         }
+        return 2;
     }
- 
+
     return 0;
 }
 
+/* length of the run before next backslash */
+static int frame_bslash_span (uint8 * p, int len)
+{
+    uint8 * pend = memchr(p, '\\', len);
+
+    return pend ? pend - p : len;
+}
 
 int frame_slash_add (void * psrc, int len, void * pesc, int chlen, frame_p dstfrm)
 {
-    uint8 * p = (uint8 *)psrc;
-    uint8 * escch = (uint8 *)pesc;
-    int     i = 0, num = 0, totalnum = 0;
-    uint8   dstbuf[4096];
-    uint8   ch = 0;
+    uint8   * p = (uint8 *)psrc;
+    uint8   * escch = (uint8 *)pesc;
+    uint8   * dst = NULL;
+    int       i = 0, num = 0, run = 0;
+    uint8     ch = 0;
+    chset_t   set;
  
     if (!p) return 0;
     if (len < 0) len = str_len(p);
@@ -1882,67 +2317,81 @@ int frame_slash_add (void * psrc, int len, void * pesc, int chlen, frame_p dstfr
         frame_put_nlast(dstfrm, p, len);
         return len;
     }
+
+    /* the control chars not listed are escaped as \u00XX */
+    chset_init(&set, escch, chlen);
+    for (ch = 0; ch <= 0x1F; ch++)
+        chset_add(&set, ch);
+
+    /* the escaped size is counted first, the runs of plain chars are
+     * skipped by the vector scan both in counting and in copying */
+    for (i = 0, num = 0; i < len; ) {
+        run = (uint8 *)skip_to_set(p + i, len - i, &set) - (p + i);
+        num += run; i += run;
+        if (i >= len) break;
+
+        ch = p[i++];
+        num += memchr(escch, ch, chlen) != NULL ? 2 : 6;
+    }
+
+    if (frame_codec_room(dstfrm, num) < 0) return -100;
+    dst = frame_end(dstfrm);
  
-    for (i = 0, num = 0; i < len; i++) {
-        ch = p[i];
+    for (i = 0, num = 0; i < len; ) {
+        run = (uint8 *)skip_to_set(p + i, len - i, &set) - (p + i);
+        if (run > 0) {
+            memcpy(dst + num, p + i, run);
+            num += run; i += run;
+            continue;
+        }
+
+        ch = p[i++];
         if (memchr(escch, ch, chlen) != NULL) {
-            dstbuf[num++] = '\\';
+            dst[num++] = '\\';
  
             switch (ch) {
             case '\r':
-                dstbuf[num++] = 'r';
+                dst[num++] = 'r';
                 break;
             case '\n':
-                dstbuf[num++] = 'n';
+                dst[num++] = 'n';
                 break;
             case '\t':
-                dstbuf[num++] = 't';
+                dst[num++] = 't';
                 break;
             case '\b':
-                dstbuf[num++] = 'b';
+                dst[num++] = 'b';
                 break;
             case '\f':
-                dstbuf[num++] = 'f';
+                dst[num++] = 'f';
                 break;
             default:
-                dstbuf[num++] = ch;
+                dst[num++] = ch;
                 break;
             }
         } else {
-            if (ch <= 0x1F) {
-                dstbuf[num++] = '\\'; dstbuf[num++] = 'u';
-                dstbuf[num++] = '0'; dstbuf[num++] = '0';
-                dstbuf[num++] = '0' + ((ch >> 4) & 0xF);
-                ch &= 0xF;
-                dstbuf[num++] = (ch < 10) ? ('0' + ch) : ('A' + ch - 10);
-            } else {
-                dstbuf[num++] = ch;
-            }
-        }
-
-        if (num >= sizeof(dstbuf) - 8) {
-            frame_put_nlast(dstfrm, dstbuf, num);
-            totalnum += num;
-            num = 0;
+            dst[num++] = '\\'; dst[num++] = 'u';
+            dst[num++] = '0'; dst[num++] = '0';
+            dst[num++] = '0' + ((ch >> 4) & 0xF);
+            ch &= 0xF;
+            dst[num++] = (ch < 10) ? ('0' + ch) : ('A' + ch - 10);
         }
     }
- 
-    if (num > 0)
-        frame_put_nlast(dstfrm, dstbuf, num);
 
-    totalnum += num;
-    return totalnum;
+    frame_len_add(dstfrm, num);
+
+    return num;
 }
  
 int frame_slash_strip (void * psrc, int len, void * pesc, int chlen, frame_p dstfrm)
 {
-    uint8 * p = (uint8 *)psrc;
-    uint8 * escch = (uint8 *)pesc;
-    int     i = 0, num = 0, totalnum = 0;
-    uint8   ch = 0;
-    uint8   dstbuf[4096];
-    uint32  uval = 0;
-    int     ret = 0;
+    uint8   * p = (uint8 *)psrc;
+    uint8   * escch = (uint8 *)pesc;
+    uint8   * dst = NULL;
+    int       i = 0, num = 0, run = 0;
+    uint8     ch = 0;
+    uint32    uval = 0;
+    int       ret = 0;
 
  
     if (!p) return 0;
@@ -1958,381 +2407,203 @@ int frame_slash_strip (void * psrc, int len, void * pesc, int chlen, frame_p dst
         frame_put_nlast(dstfrm, p, len);
         return len;
     }
+
+    /* stripping never grows, the room of len is reserved at once */
+    if (frame_codec_room(dstfrm, len) < 0) return -100;
+    dst = frame_end(dstfrm);
  
     for (i = 0, num = 0; i < len; ) {
-        if (p[i] == '\\' && i+1<len) {
-            switch (p[i+1]) {
-            case '\\':
-                ch = '\\';
-                break;
-            case '"':
-                ch = '"';
-                break;
-            case '/':
-                ch = '/';
-                break;
-            case '\'':
-                ch = '\'';
-                break;
-            case 'r':
-                ch = '\r';
-                break;
-            case 'n':
-                ch = '\n';
-                break;
-            case 't':
-                ch = '\t';
-                break;
-            case 'b':
-                ch = '\b';
-                break;
-            case 'f':
-                ch = '\f';
-                break;
+        if (p[i] != '\\' || i + 1 >= len) {
+            run = frame_bslash_span(p + i, len - i);
+            if (run == 0) run = 1;
+
+            memcpy(dst + num, p + i, run);
+            num += run; i += run;
+            continue;
+        }
 
-            case 'u':
-            case 'x':
-                if (len - i >= 3) {
-                    ret = str_hextou(p + i + 2, 4, &uval);
-                    if (ret <= 0) break;
- 
-                    if (uval <= 0xFF) dstbuf[num++] = uval & 0xFF;
-                    else if (uval <= 0xFFFF) {
-                        if (isBigEndian()) {
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                            dstbuf[num++] = (uval & 0xFF);
-                        } else {
-                            dstbuf[num++] = (uval & 0xFF);
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                        }
-                    }
+        switch (p[i+1]) {
+        case '\\':
+            ch = '\\';
+            break;
+        case '"':
+            ch = '"';
+            break;
+        case '/':
+            ch = '/';
+            break;
+        case '\'':
+            ch = '\'';
+            break;
+        case 'r':
+            ch = '\r';
+            break;
+        case 'n':
+            ch = '\n';
+            break;
+        case 't':
+            ch = '\t';
+            break;
+        case 'b':
+            ch = '\b';
+            break;
+        case 'f':
+            ch = '\f';
+            break;
+
+        case 'u':
+        case 'x':
+            if (len - i >= 3) {
+                ret = str_hextou(p + i + 2, len - i - 2 < 4 ? len - i - 2 : 4, &uval);
+                if (ret > 0) {
+                    num += frame_uval_put(dst + num, uval);
                     i += 2 + ret;
                     continue;
                 }
-                break;
-
-            default:
-                ch = p[i+1];
-                break;
             }
- 
-            if (chlen > 0 && memchr(escch, ch, chlen) != NULL) {
-                dstbuf[num++] = ch; i+=2;
-            } else {
-                dstbuf[num++] = p[i++];
-                dstbuf[num++] = p[i++];
-            }
-        } else {
-            dstbuf[num++] = p[i++];
+            ch = p[i+1];
+            break;
+
+        default:
+            ch = p[i+1];
+            break;
         }
  
-        if (num >= sizeof(dstbuf)-4) {
-            frame_put_nlast(dstfrm, dstbuf, num);
-            totalnum += num;
-            num = 0;
+        if (memchr(escch, ch, chlen) != NULL) {
+            dst[num++] = ch; i+=2;
+        } else {
+            dst[num++] = p[i++];
+            dst[num++] = p[i++];
         }
     }
  
-    if (num > 0)
-        frame_put_nlast(dstfrm, dstbuf, num);
-
-    totalnum += num;
+    frame_len_add(dstfrm, num);
 
-    return totalnum;
+    return num;
 }
 
 int frame_json_escape (void * psrc, int len, frame_p dstfrm)
 {
-    uint8   * src = (uint8 *)psrc;
-    uint8     ch;
-    int       i = 0, num = 0, totalnum = 0;
-    uint8     dstbuf[4096];
- 
-    if (!src || len <= 0) return 0;
-
-    if (dstfrm == NULL) {
-        while (len > 0) {
-            ch = *src++;
- 
-            if (ch == '\\' || ch == '"') {
-                num++;
-            } else if (ch <= 0x1f) {
-                switch (ch) {
-                case '\n':
-                case '\r':
-                case '\t':
-                case '\b':
-                case '\f':
-                    num++;
-                    break;
-                default:
-                    num += sizeof("\\u001F") - 2;
-                }
-            }
-            num++;
-            len--;
-        }
- 
-        return num;
-    }
+    int      num = 0;
 
-    for (i = 0, num = 0; i < len; i++) {
-        ch = src[i];
+    if (frame_unshare(dstfrm) < 0) return -100;
 
-        if (ch > 0x1f) {
-            if (ch == '\\' || ch == '"') {
-                dstbuf[num++] = '\\';
-            }
-            dstbuf[num++] = ch;
-        } else {
-            dstbuf[num++] = '\\';
- 
-            switch (ch) {
-            case '\n':
-                dstbuf[num++] = 'n';
-                break;
-            case '\r':
-                dstbuf[num++] = 'r';
-                break;
-            case '\t':
-                dstbuf[num++] = 't';
-                break;
-            case '\b':
-                dstbuf[num++] = 'b';
-                break;
-            case '\f':
-                dstbuf[num++] = 'f';
-                break;
-            default:
-                dstbuf[num++] = 'u'; dstbuf[num++] = '0'; dstbuf[num++] = '0';
-                dstbuf[num++] = '0' + (ch >> 4);
-                ch &= 0xf;
-                dstbuf[num++] = (ch < 10) ? ('0' + ch) : ('A' + ch - 10);
-                break;
-            }
-        }
+    if (!psrc || len <= 0) return 0;
 
-        if (num >= sizeof(dstbuf) - 8) {
-            frame_put_nlast(dstfrm, dstbuf, num);
-            totalnum += num;
-            num = 0;
-        }
-    }
- 
-    if (num > 0)
-        frame_put_nlast(dstfrm, dstbuf, num);
- 
-    totalnum += num;
-    return totalnum;
+    /* the escaped size is counted first, then escaped into frame at once */
+    num = json_escape(psrc, len, NULL, 0);
+    if (dstfrm == NULL) return num;
+
+    if (frame_rest(dstfrm) < num)
+        frame_grow(dstfrm, num - frame_rest(dstfrm));
+
+    num = json_escape(psrc, len, frame_end(dstfrm), num);
+    frame_len_add(dstfrm, num);
+
+    return num;
 }
 
 int frame_json_unescape (void * psrc, size_t size, frame_p dstfrm)
 {
     uint8   * src = (uint8 *)psrc;
+    uint8   * dst = NULL;
     uint8     ch;
     uint32    uval = 0;
     size_t    i = 0;
-    int       ret, num = 0, totalnum = 0;
-    uint8     dstbuf[4096];
+    int       ret, run, num = 0;
 
     if (!src || size <= 0) return 0;
+
+    /* unescaping never grows, the room of size is reserved at once and
+     * the size is only counted without dstfrm */
+    if (dstfrm) {
+        if (frame_codec_room(dstfrm, size) < 0) return -100;
+        dst = frame_end(dstfrm);
+    }
  
-    if (dstfrm == NULL) {
-        for (i = 0; i < size; ) {
-            ch = src[i++];
- 
-            if (ch == '\\' && size - i >= 1) {
-                ch = src[i++];
-                switch (ch) {
-                case 'n':
-                case 'r':
-                case 't':
-                case 'b':
-                case 'f':
-                case '\\':
-                case '"':
-                    num++;
-                    break;
-                case 'u':
-                    if (size - i >= 1) {
-                        ret = str_hextou(src + i, 4, &uval);
-                        if (ret <= 0) break;
- 
-                        i += ret;
-                        if (uval <= 0xFF) num += 1;
-                        else if (uval <= 0xFFFF) num += 2;
-                    }
-                    break;
-                case 'x':   // \x0B  --> \v
-                    ret = str_hextou(src + i, size - i, &uval);
-                    if (ret <= 0) break;
- 
-                    i += ret;
-                    if (uval <= 0xFF) num += 1;
-                    else if (uval <= 0xFFFF) num += 2;
-                    break;
-                default:
-                    if (ch >= '0' && ch <= '9') {  // \13 --> \v
-                        i--;
-                        ret = str_atou(src + i, size - i, &uval);
-                        if (ret <= 0) break;
- 
-                        i += ret;
-                        if (uval <= 0xFF) num += 1;
-                        else if (uval <= 0xFFFF) num += 2;
-                    }
-                    break;
-                }
-            } else {
-                num++;
-            }
+    for (i = 0, num = 0; i < size; ) {
+        if (src[i] != '\\' || size - i < 2) {
+            run = frame_bslash_span(src + i, size - i);
+            if (run == 0) run = 1;
+
+            if (dst) memcpy(dst + num, src + i, run);
+            num += run; i += run;
+            continue;
         }
- 
-        return num;
-    }
 
-    for (i = 0, num = 0; i < size; ) {
+        i++;
         ch = src[i++];
+
+        switch (ch) {
+        case 'n':
+            ch = '\n';
+            break;
+        case 'r':
+            ch = '\r';
+            break;
+        case 't':
+            ch = '\t';
+            break;
+        case 'b':
+            ch = '\b';
+            break;
+        case 'f':
+            ch = '\f';
+            break;
+        case '\\':
+        case '"':
+            break;
+        case 'u':    // \u001F
+            if (size - i >= 1) {
+                ret = str_hextou(src + i, size - i < 4 ? size - i : 4, &uval);
+                if (ret <= 0) continue;
  
-        if (ch == '\\' && size - i >= 1) {
-            ch = src[i++];
-            switch (ch) {
-            case 'n':
-                dstbuf[num++] = '\n';
-                break;
-            case 'r':
-                dstbuf[num++] = '\r';
-                break;
-            case 't':
-                dstbuf[num++] = '\t';
-                break;
-            case 'b':
-                dstbuf[num++] = '\b';
-                break;
-            case 'f':
-                dstbuf[num++] = '\f';
-                break;
-            case '\\':
-                dstbuf[num++] = '\\';
-                break;
-            case '"':
-                dstbuf[num++] = '"';
-                break;
-            case 'u':    // \u001F
-                if (size - i >= 1) {
-                    ret = str_hextou(src + i, 4, &uval);
-                    if (ret <= 0) break;
- 
-                    i += ret;
-                    if (uval <= 0xFF) dstbuf[num++] = uval & 0xFF;
-                    else if (uval <= 0xFFFF) {
-                        if (isBigEndian()) {
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                            dstbuf[num++] = (uval & 0xFF);
-                        } else {
-                            dstbuf[num++] = (uval & 0xFF);
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                        }
-                    }
-                }
-                break;
-            case 'x':   // \x0B  --> \v
-                ret = str_hextou(src + i, size - i, &uval);
-                if (ret <= 0) break;
+                i += ret;
+                num += frame_uval_put(dst ? dst + num : NULL, uval);
+            }
+            continue;
+        case 'x':   // \x0B  --> \v
+            ret = str_hextou(src + i, size - i, &uval);
+            if (ret <= 0) continue;
+ 
+            i += ret;
+            num += frame_uval_put(dst ? dst + num : NULL, uval);
+            continue;
+        default:
+            if (ch >= '0' && ch <= '9') {  // \13 --> \v
+                i--;
+                ret = str_atou(src + i, size - i, &uval);
+                if (ret <= 0) continue;
  
                 i += ret;
-                if (uval <= 0xFF) dstbuf[num++] = uval & 0xFF;
-                else if (uval <= 0xFFFF) {
-                    if (isBigEndian()) {
-                        dstbuf[num++] = (uval >> 8) & 0xFF;
-                        dstbuf[num++] = (uval & 0xFF);
-                    } else {
-                        dstbuf[num++] = (uval & 0xFF);
-                        dstbuf[num++] = (uval >> 8) & 0xFF;
-                    }
-                }
-                break;
-            default:
-                if (ch >= '0' && ch <= '9') {  // \13 --> \v
-                    i--;
-                    ret = str_atou(src + i, size - i, &uval);
-                    if (ret <= 0) break;
- 
-                    i += ret;
- 
-                    if (uval <= 0xFF) dstbuf[num++] = uval & 0xFF;
-                    else if (uval <= 0xFFFF) {
-                        if (isBigEndian()) {
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                            dstbuf[num++] = (uval & 0xFF);
-                        } else {
-                            dstbuf[num++] = (uval & 0xFF);
-                            dstbuf[num++] = (uval >> 8) & 0xFF;
-                        }
-                    }
-                }
-                break;
+                num += frame_uval_put(dst ? dst + num : NULL, uval);
             }
-        } else {
-            dstbuf[num++] = ch;
+            continue;
         }
 
-        if (num >= sizeof(dstbuf)-4) {
-            frame_put_nlast(dstfrm, dstbuf, num);
-            totalnum += num;
-            num = 0;
-        }
+        if (dst) dst[num] = ch;
+        num++;
     }
  
-    if (num > 0)
-        frame_put_nlast(dstfrm, dstbuf, num);
- 
-    totalnum += num;
+    if (dst) frame_len_add(dstfrm, num);
  
-    return totalnum;
+    return num;
 }
 
 int frame_uri_encode (frame_p frm, void * psrc, int size, uint32 * escvec)
 {
-    uint8   * src = (uint8 *)psrc;
-    uint8     ch = 0;
-    int       n = 0;
-    static uint8 hex[] = "0123456789ABCDEF";
+    int   n = 0;
 
-    static uint32   uri[] = {
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
-        0x80000029, /* 1000 0000 0000 0000  0000 0000 0010 1001 */
-                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
-        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
-                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
-        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-    };
+    if (!psrc || size <= 0) return 0;
 
-    if (!escvec) escvec = uri;
+    /* the encoded size is counted first, then encoded into frame at once */
+    n = uri_encode_vec(psrc, size, NULL, 0, escvec);
+    if (!frm) return n;
 
-    while (size) {
- 
-        ch = *src++;
- 
-        if (escvec[ch >> 5] & (1U << (ch & 0x1f))) {
-            n += 3;
+    if (frame_codec_room(frm, n) < 0) return -100;
 
-            frame_put_last(frm, '%');
-            frame_put_last(frm, hex[ch >> 4]);
-            frame_put_last(frm, hex[ch & 0xf]);
- 
-        } else {
-            n++;
-            frame_put_last(frm, ch);
-        }
- 
-        size--;
-    }
+    n = uri_encode_vec(psrc, size, frame_end(frm), n, escvec);
+    frame_len_add(frm, n);
  
     return n;
 }
@@ -2341,12 +2612,6 @@ int frame_uri_decode (frame_p frm, void * psrc, int size)
 {
     uint8  * s = (uint8 *)psrc;
     int      len = 0;
-    uint8    ch, c, decoded;
-    enum {
-        sw_usual = 0,
-        sw_quoted,
-        sw_quoted_second
-    } state;
 
     if (!frm) return -1;
 
@@ -2354,70 +2619,11 @@ int frame_uri_decode (frame_p frm, void * psrc, int size)
     if (size < 0) size = str_len(s);
     if (size <= 0) return 0;
 
-    state = 0;
-    decoded = 0;
- 
-    while (size--) {
- 
-        ch = *s++;
- 
-        switch (state) {
-        case sw_usual:
-            if (ch == '%') {
-                state = sw_quoted;
-                break;
-            }
+    /* decoding never grows, the room of size is reserved at once */
+    if (frame_codec_room(frm, size) < 0) return -100;
 
-            len++;
-            if (ch == '+') ch = ' ';
-            frame_put_last(frm, ch);
-            break;
- 
-        case sw_quoted:
-            if (ch >= '0' && ch <= '9') {
-                decoded = (uint8) (ch - '0');
-                state = sw_quoted_second;
-                break;
-            }
- 
-            c = (uint8) (ch | 0x20);
-            if (c >= 'a' && c <= 'f') {
-                decoded = (uint8) (c - 'a' + 10);
-                state = sw_quoted_second;
-                break;
-            }
- 
-            /* the invalid quoted character */
-            state = sw_usual;
- 
-            len++;
-            frame_put_last(frm, ch);
-            break;
- 
-        case sw_quoted_second:
-            state = sw_usual;
- 
-            if (ch >= '0' && ch <= '9') {
-                ch = (uint8) ((decoded << 4) + (ch - '0'));
- 
-                len++;
-                frame_put_last(frm, ch);
-                break;
-            }
- 
-            c = (uint8) (ch | 0x20);
-            if (c >= 'a' && c <= 'f') {
-                ch = (uint8) ((decoded << 4) + (c - 'a') + 10);
- 
-                len++;
-                frame_put_last(frm, ch);
-                break;
-            }
- 
-            /* the invalid quoted character */
-            break;
-        }
-    }
+    len = uri_decode(s, size, frame_end(frm), size);
+    frame_len_add(frm, len);
  
     return len;
 }
@@ -2426,6 +2632,8 @@ int frame_bit_set (frame_p frm, int bitpos, int value)
 {
     int len, loc;
 
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm) return -1;
     if (bitpos < 0) return -1;
 
@@ -2468,6 +2676,8 @@ int frame_bit_shift_left (frame_p frm, int offset)
     uint8 * pbuf = NULL;
     int     i = 0;
 
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm || frm->len == 0)
          return -1;
 
@@ -2500,6 +2710,8 @@ int frame_bit_shift_right (frame_p frm, int offset)
     uint8 * pbuf = NULL;
     int     i = 0;
 
+    if (frame_unshare(frm) < 0) return -100;
+
     if (!frm || frm->len == 0) return -1;
     if (offset < 0) return -2;
 
@@ -2528,6 +2740,8 @@ void frame_append_nbytes (frame_p frm, uint8 byte, int n)
 {
     if (!frm || n <= 0) return;
 
+    if (frame_unshare(frm) < 0) return;
+
     if (frame_rest(frm) < n) {
         frame_grow(frm, n - frame_rest(frm));
     }
@@ -2540,14 +2754,23 @@ void frame_append_nbytes (frame_p frm, uint8 byte, int n)
 frame_p frame_realloc (frame_p frm, int size)
 {
     uint8  * pbyte = NULL;
+    int      newsize = 0, cls = 0;
 
     if (!frm) return frame_new(size);
 
     if (frm->size <= size) return frm;
 
+    if (frame_unshare(frm) < 0) return frm;
+
     pbyte = frm->data;
+    cls = frm->pool;
 
-    frm->data = kalloc(size + 1);
+    frm->data = frame_data_alloc(size, &newsize, &frm->pool);
+    if (!frm->data) {
+        frm->data = pbyte;
+        frm->pool = cls;
+        return frm;
+    }
 
     if (frm->len > size)
         frm->len = size;
@@ -2556,9 +2779,9 @@ frame_p frame_realloc (frame_p frm, int size)
         memcpy(frm->data, pbyte + frm->start, frm->len);
 
     frm->start = 0;
-    frm->size = size;
+    frm->size = newsize;
 
-    kfree(pbyte);
+    frame_data_free(pbyte, cls);
 
     return frm;
 }
@@ -7,7 +7,13 @@
 #include "memory.h"
 #include "strutil.h"
 #include "hashtab.h"
+#include "metrics.h"
 #include <math.h>
+#include <time.h>
+
+#ifdef UNIX
+#include <fcntl.h>
+#endif
 
 #define HASH_SHIFT  6
 #define HASH_VALUE_BITS  32 
@@ -190,6 +196,182 @@ uint64 murmur_hash2_64 (void * key, int len, uint64 seed )
 }
 
 
+/* wyhash of Wang Yi. 48 bytes are consumed per iteration by 3 independent
+ * 64x64->128 multiply lanes, keys up to 16 bytes are read in 2 loads.
+ * the nocase version folds ASCII letters to lower case 8 bytes a time */
+
+static const uint64 s_wysecret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline void wy_mum (uint64 * pa, uint64 * pb)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *pa;
+
+    r *= *pb;
+    *pa = (uint64)r;
+    *pb = (uint64)(r >> 64);
+#else
+    uint64 ha = *pa >> 32, hb = *pb >> 32, la = (uint32)*pa, lb = (uint32)*pb;
+    uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64 t = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *pa = lo;
+    *pb = hi;
+#endif
+}
+
+static inline uint64 wy_mix (uint64 a, uint64 b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+/* set bit 5 of the bytes in 'A'..'Z' */
+static inline uint64 wy_fold8 (uint64 w)
+{
+    uint64 b = w & 0x7F7F7F7F7F7F7F7FULL;
+    uint64 ge = b + 0x3F3F3F3F3F3F3F3FULL;   //bit 7 set if >= 'A'
+    uint64 gt = b + 0x2525252525252525ULL;   //bit 7 set if > 'Z'
+
+    return w | (((ge & ~gt & ~w) & 0x8080808080808080ULL) >> 2);
+}
+
+static inline uint64 wy_read8 (uint8 * p, int fold)
+{
+    uint64 v;
+
+    memcpy(&v, p, 8);
+    return fold ? wy_fold8(v) : v;
+}
+
+static inline uint64 wy_read4 (uint8 * p, int fold)
+{
+    uint32 v;
+
+    memcpy(&v, p, 4);
+    return fold ? (uint32)wy_fold8(v) : v;
+}
+
+static inline uint64 wy_read3 (uint8 * p, ulong k, int fold)
+{
+    if (fold)
+        return ((uint64)adf_tolower(p[0]) << 16) | ((uint64)adf_tolower(p[k >> 1]) << 8) |
+               (uint64)adf_tolower(p[k - 1]);
+
+    return ((uint64)p[0] << 16) | ((uint64)p[k >> 1] << 8) | p[k - 1];
+}
+
+static inline uint64 wy_hash_fold (uint8 * p, ulong len, uint64 seed, int fold)
+{
+    const uint64 * s = s_wysecret;
+    uint64  a, b, see1, see2;
+    ulong   i;
+
+    seed ^= wy_mix(seed ^ s[0], s[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_read4(p, fold) << 32) | wy_read4(p + ((len >> 3) << 2), fold);
+            b = (wy_read4(p + len - 4, fold) << 32) | wy_read4(p + len - 4 - ((len >> 3) << 2), fold);
+        } else if (len > 0) {
+            a = wy_read3(p, len, fold);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        i = len;
+        if (i > 48) {
+            see1 = see2 = seed;
+            do {
+                seed = wy_mix(wy_read8(p, fold) ^ s[1], wy_read8(p + 8, fold) ^ seed);
+                see1 = wy_mix(wy_read8(p + 16, fold) ^ s[2], wy_read8(p + 24, fold) ^ see1);
+                see2 = wy_mix(wy_read8(p + 32, fold) ^ s[3], wy_read8(p + 40, fold) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_read8(p, fold) ^ s[1], wy_read8(p + 8, fold) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_read8(p + i - 16, fold);
+        b = wy_read8(p + i - 8, fold);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+
+    return wy_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+uint64 wy_hash (void * key, int keylen, uint64 seed)
+{
+    if (!key) return seed;
+    if (keylen < 0) keylen = str_len(key);
+
+    return wy_hash_fold((uint8 *)key, keylen, seed, 0);
+}
+
+uint64 wy_hash_nocase (void * key, int keylen, uint64 seed)
+{
+    if (!key) return seed;
+    if (keylen < 0) keylen = str_len(key);
+
+    return wy_hash_fold((uint8 *)key, keylen, seed, 1);
+}
+
+/* random seed generated once per process */
+uint64 hash_random_seed ()
+{
+    static uint64 s_seed = 0;
+    uint64        seed = 0;
+#ifdef UNIX
+    int           fd;
+#endif
+
+    seed = __atomic_load_n(&s_seed, __ATOMIC_ACQUIRE);
+    if (seed) return seed;
+
+#ifdef UNIX
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) seed = 0;
+        close(fd);
+    }
+#endif
+
+    if (!seed) {
+        seed = (uint64)time(NULL) ^ ((uint64)getpid() << 32) ^ (uint64)(ulong)&seed;
+        seed = wy_mix(seed, s_wysecret[2]);
+    }
+    if (!seed) seed = s_wysecret[0];
+
+    __atomic_store_n(&s_seed, seed, __ATOMIC_RELEASE);
+
+    return seed;
+}
+
+ulong wy_key_hash (void * key)
+{
+    return (ulong)wy_hash(key, -1, hash_random_seed());
+}
+
+ulong wy_string_hash (void * key)
+{
+    return (ulong)wy_hash_nocase(key, -1, hash_random_seed());
+}
+
+
 static ulong hash_key (void * str)
 {
     return generic_hash(str, -1, 0);
@@ -200,10 +382,227 @@ static ulong hash_string (void * str)
     return string_hash(str, -1, 0);
 }
 
+
+/* the collide_tab records how many buckets are storing the given number of
+ * values, slot 0 counts the buckets storing HT_COLLIDE_MAX values or more */
+static void ht_collide_update (hashtab_t * ht, int oldcnt, int newcnt)
+{
+    if (oldcnt > 0)
+        ht->collide_tab[oldcnt < HT_COLLIDE_MAX ? oldcnt : 0] -= 1;
+    if (newcnt > 0)
+        ht->collide_tab[newcnt < HT_COLLIDE_MAX ? newcnt : 0] += 1;
+}
+
+static void ht_bucket_add (hashtab_t * ht, hashnode_t * node, ulong hash, void * value)
+{
+    arr_t * valueList = NULL;
+    arr_t * hashList = NULL;
+
+    switch (node->count) {
+    case 0:
+        node->dptr = value;
+        node->hash = hash;
+        break;
+
+    case 1:
+        valueList = arr_new(4);
+        hashList = arr_new(4);
+        arr_push(valueList, node->dptr);
+        arr_push(hashList, (void *)node->hash);
+        arr_push(valueList, value);
+        arr_push(hashList, (void *)hash);
+        node->dptr = valueList;
+        node->hlist = hashList;
+        break;
+
+    default:
+        arr_push(node->dptr, value);
+        arr_push(node->hlist, (void *)hash);
+        break;
+    }
+
+    node->count++;
+    ht_collide_update(ht, node->count - 1, node->count);
+}
+
+static void * ht_bucket_find (hashtab_t * ht, hashnode_t * node, void * key, int * pidx)
+{
+    void * value = NULL;
+    int    i, num;
+
+    switch (node->count) {
+    case 0:
+        return NULL;
+
+    case 1:
+        if ((*ht->cmp)(node->dptr, key) == 0) {
+            if (pidx) *pidx = 0;
+            return node->dptr;
+        }
+        return NULL;
+
+    default:
+        num = arr_num(node->dptr);
+        for (i = 0; i < num; i++) {
+            value = arr_value(node->dptr, i);
+            if ((*ht->cmp)(value, key) == 0) {
+                if (pidx) *pidx = i;
+                return value;
+            }
+        }
+        return NULL;
+    }
+}
+
+static void * ht_bucket_remove (hashtab_t * ht, hashnode_t * node, int idx)
+{
+    void * value = NULL;
+    void * tmp = NULL;
+
+    if (node->count <= 0) return NULL;
+
+    if (node->count == 1) {
+        value = node->dptr;
+        node->dptr = NULL;
+        node->hash = 0;
+        node->count = 0;
+        ht_collide_update(ht, 1, 0);
+        return value;
+    }
+
+    value = arr_delete(node->dptr, idx);
+    arr_delete(node->hlist, idx);
+    node->count--;
+
+    if (node->count == 1) {
+        tmp = arr_value(node->dptr, 0);
+        node->hash = (ulong)arr_value(node->hlist, 0);
+        arr_free(node->dptr);
+        arr_free(node->hlist);
+        node->dptr = tmp;
+        node->hlist = NULL;
+    }
+
+    ht_collide_update(ht, node->count + 1, node->count);
+    return value;
+}
+
+/* release the overflow lists of all buckets in the given table. values are
+ * freed via func if it's not NULL. the buckets are reset to empty state */
+static void ht_table_clear (hashnode_t * tab, int len, HashTabFree * func)
+{
+    int i;
+
+    if (!tab) return;
+
+    for (i = 0; i < len; i++) {
+        if (tab[i].count == 1) {
+            if (func) (*func)(tab[i].dptr);
+        } else if (tab[i].count > 1) {
+            if (func) arr_pop_free((arr_t *)tab[i].dptr, func);
+            else arr_free((arr_t *)tab[i].dptr);
+            arr_free(tab[i].hlist);
+        }
+    }
+
+    memset(tab, 0, len * sizeof(hashnode_t));
+}
+
+static hashnode_t * ht_bucket_of (hashtab_t * ht, ulong hash)
+{
+    ulong idx = 0;
+
+    /* buckets of old table before rehash_idx have been moved to new table */
+    if (ht->ptab_old) {
+        idx = hash % ht->len_old;
+        if (idx >= (ulong)ht->rehash_idx)
+            return &ht->ptab_old[idx];
+    }
+
+    return &ht->ptab[hash % ht->len];
+}
+
+static void ht_rehash_end (hashtab_t * ht)
+{
+    kfree_huge(ht->ptab_old);
+    ht->ptab_old = NULL;
+    ht->len_old = 0;
+    ht->rehash_idx = 0;
+}
+
+/* move at most steps non-empty buckets from old table to new table. the
+ * number of empty buckets visited is limited too, so that each call executes
+ * a bounded amount of work. steps < 0 means moving all the remaining buckets */
+static void ht_rehash_step (hashtab_t * ht, int steps)
+{
+    hashnode_t * node = NULL;
+    int          empty = steps * 10;
+    int          i, num;
+
+    while (ht->ptab_old && steps != 0) {
+        node = &ht->ptab_old[ht->rehash_idx];
+
+        if (node->count == 0) {
+            if (++ht->rehash_idx >= ht->len_old) {
+                ht_rehash_end(ht);
+                break;
+            }
+            if (--empty == 0) break;
+            continue;
+        }
+
+        if (node->count == 1) {
+            ht_bucket_add(ht, &ht->ptab[node->hash % ht->len], node->hash, node->dptr);
+
+        } else {
+            num = arr_num(node->dptr);
+            for (i = 0; i < num; i++) {
+                ht_bucket_add(ht, &ht->ptab[(ulong)arr_value(node->hlist, i) % ht->len],
+                              (ulong)arr_value(node->hlist, i),
+                              arr_value(node->dptr, i));
+            }
+            arr_free(node->dptr);
+            arr_free(node->hlist);
+        }
+
+        ht_collide_update(ht, node->count, 0);
+        memset(node, 0, sizeof(*node));
+
+        if (steps > 0) steps--;
+
+        if (++ht->rehash_idx >= ht->len_old) {
+            ht_rehash_end(ht);
+            break;
+        }
+    }
+}
+
+/* allocate a new bucket table and start moving the stored values into it
+ * incrementally. the value lookup checks both tables during rehashing. */
+static int ht_rehash_start (hashtab_t * ht, int newlen)
+{
+    hashnode_t * newtab = NULL;
+
+    if (ht->ptab_old) ht_rehash_step(ht, -1);
+
+    newtab = kzalloc_huge(newlen * sizeof(hashnode_t));
+    if (newtab == NULL) return -1;
+
+    ht->ptab_old = ht->ptab;
+    ht->len_old = ht->len;
+    ht->rehash_idx = 0;
+
+    ht->ptab = newtab;
+    ht->len = newlen;
+
+    if (ht->num == 0) ht_rehash_end(ht);
+
+    return 0;
+}
+
 hashtab_t * ht_only_new (int num, HashTabCmp * cmp)
 {
     hashtab_t * ret = NULL;
-    int  i = 0;
 
     ret = kzalloc(sizeof(*ret));
     if (ret == NULL)
@@ -218,16 +617,16 @@ hashtab_t * ht_only_new (int num, HashTabCmp * cmp)
     ret->linear = 0;
     ret->nodelist = NULL;
 
-    ret->ptab = kzalloc(ret->len * sizeof(hashnode_t));
+    ret->ptab_old = NULL;
+    ret->len_old = 0;
+    ret->rehash_idx = 0;
+    ret->load_limit = HT_LOAD_LIMIT;
+
+    ret->ptab = kzalloc_huge(ret->len * sizeof(hashnode_t));
     if (ret->ptab == NULL) {
         kfree(ret);
         return NULL;
     }
-    for (i = 0; i < ret->len; i++) {
-        ret->ptab[i].dptr = NULL;
-        ret->ptab[i].count = 0;
-        memset(&ret->ptab[i], 0, sizeof(ret->ptab[i]));
-    }
 
     return ret;
 }
@@ -257,23 +656,66 @@ void ht_set_hash_func (hashtab_t * ht, HashFunc * hashfunc)
     if (!ht || !hashfunc) return;
 
     ht->hashFunc = hashfunc;
+    ht->hashkind = HT_HASH_FUNC;
 }
 
+void ht_set_seed_hash (hashtab_t * ht, int hashkind, uint64 seed)
+{
+    if (!ht) return;
 
-void ht_free (hashtab_t * ht)
+    if (hashkind != HT_HASH_WY && hashkind != HT_HASH_WY_NOCASE)
+        hashkind = HT_HASH_FUNC;
+
+    if (seed == 0) seed = hash_random_seed() ^ (uint64)(ulong)ht;
+
+    ht->hashkind = hashkind;
+    ht->seed = seed;
+}
+
+static inline ulong ht_hash_key (hashtab_t * ht, void * key)
 {
-    int i;
+    if (ht->hashkind == HT_HASH_WY_NOCASE)
+        return (ulong)wy_hash_nocase(key, -1, ht->seed);
+
+    if (ht->hashkind == HT_HASH_WY)
+        return (ulong)wy_hash(key, -1, ht->seed);
+
+    return (*ht->hashFunc)(key);
+}
 
+void ht_set_load_limit (hashtab_t * ht, int percent)
+{
     if (!ht) return;
 
-    for (i = 0; i < ht->len; i++) {
-        if (ht->ptab[i].count > 1) {
-            arr_free((arr_t *)ht->ptab[i].dptr);
-        }
-    }
+    if (percent < 0) percent = 0;
+    ht->load_limit = percent;
+}
+
+int ht_reserve (hashtab_t * ht, int num)
+{
+    long  need = 0;
+    int   limit = 0;
+
+    if (!ht) return -1;
+
+    limit = ht->load_limit > 0 ? ht->load_limit : HT_LOAD_LIMIT;
+    need = (long)num * 100 / limit;
+    if (need <= ht->len) return 0;
+
+    return ht_rehash_start(ht, find_a_prime(need));
+}
+
+
+void ht_free (hashtab_t * ht)
+{
+    if (!ht) return;
+
+    ht_table_clear(ht->ptab, ht->len, NULL);
+    ht_table_clear(ht->ptab_old, ht->len_old, NULL);
 
     arr_free(ht->nodelist);
-    kfree(ht->ptab);
+    kfree_huge(ht->ptab_old);
+    kfree_huge(ht->ptab);
     kfree(ht);
 }
 
@@ -281,7 +723,6 @@ void ht_free (hashtab_t * ht)
 void ht_free_all (hashtab_t * ht, void * vfunc)
 {
     HashTabFree * func = (HashTabFree *)vfunc;
-    int i = 0;
 
     if (!ht) return;
 
@@ -290,23 +731,18 @@ void ht_free_all (hashtab_t * ht, void * vfunc)
         return;
     }
 
-    for (i = 0; i < ht->len; i++) {
-        if (ht->ptab[i].count == 1) {
-            (*func)(ht->ptab[i].dptr);
-        } else if (ht->ptab[i].count > 1) {
-            arr_pop_free ((arr_t *)ht->ptab[i].dptr, func);
-        }
-    }
+    ht_table_clear(ht->ptab, ht->len, func);
+    ht_table_clear(ht->ptab_old, ht->len_old, func);
 
     arr_free(ht->nodelist);
-    kfree(ht->ptab);
+    kfree_huge(ht->ptab_old);
+    kfree_huge(ht->ptab);
     kfree(ht);
 }
 
 void ht_free_member (hashtab_t * ht, void * vfunc)
 { 
     HashTabFree * func = (HashTabFree *)vfunc;
-    int i = 0;
      
     if (!ht) return;
      
@@ -315,45 +751,29 @@ void ht_free_member (hashtab_t * ht, void * vfunc)
         return; 
     }
      
-    for (i = 0; i < ht->len; i++) {
-        if (ht->ptab[i].count == 1) {
-            (*func)(ht->ptab[i].dptr);  
-        } else if (ht->ptab[i].count > 1) {
-            arr_pop_free((arr_t *)ht->ptab[i].dptr, func);
-        }    
-
-        ht->ptab[i].dptr = NULL;
-        ht->ptab[i].count = 0;
-    }    
+    ht_table_clear(ht->ptab, ht->len, func);
+    ht_table_clear(ht->ptab_old, ht->len_old, func);
+    if (ht->ptab_old) ht_rehash_end(ht);
      
     if (ht->linear) arr_zero(ht->nodelist);
     ht->num = 0;
 
-#ifdef _DEBUG
     memset(&ht->collide_tab, 0, sizeof(ht->collide_tab));
-#endif
 }
  
 void ht_zero (hashtab_t * ht)
 {
-    int i = 0;
-
     if (!ht) return;
 
-    for (i = 0; i < ht->len; i++) {
-        if (ht->ptab[i].count > 1) {
-            arr_free((arr_t *)ht->ptab[i].dptr);
-        }
-        ht->ptab[i].dptr = NULL;
-        ht->ptab[i].count = 0;
-    }
+    ht_table_clear(ht->ptab, ht->len, NULL);
+    ht_table_clear(ht->ptab_old, ht->len_old, NULL);
+    if (ht->ptab_old) ht_rehash_end(ht);
+
     ht->num = 0;
 
     if (ht->linear) arr_zero(ht->nodelist);
 
-#ifdef _DEBUG
     memset(&ht->collide_tab, 0, sizeof(ht->collide_tab));
-#endif
 }
 
 
@@ -364,31 +784,96 @@ int ht_num (hashtab_t * ht)
     return ht->num;
 }
 
+double ht_load_factor (hashtab_t * ht)
+{
+    if (!ht || ht->len <= 0) return 0;
+
+    return (double)ht->num / ht->len;
+}
+
+int ht_collide_stat (hashtab_t * ht, int * hist, int num)
+{
+    if (!ht || !hist || num <= 0) return 0;
+
+    if (num > HT_COLLIDE_MAX) num = HT_COLLIDE_MAX;
+    memcpy(hist, ht->collide_tab, num * sizeof(int));
+
+    return num;
+}
+
 
 void * ht_get (hashtab_t * ht, void * key)
 {
-    ulong hash = 0;
+    hashnode_t * node = NULL;
+    void       * value = NULL;
+    ulong        hash = 0;
+    int          idx = 0;
 
     if (!ht || !key) return NULL;
 
-    hash = (*ht->hashFunc)(key);
-    hash %= ht->len;
+    if (ht->ptab_old) ht_rehash_step(ht, HT_REHASH_STEP);
 
-    switch (ht->ptab[hash].count) {
-    case 0:
-        return NULL;
+    hash = ht_hash_key(ht, key);
+    node = ht_bucket_of(ht, hash);
 
-    case 1:
-        if ((*ht->cmp)(ht->ptab[hash].dptr, key) == 0) {
-            return ht->ptab[hash].dptr;
-        } else
-            return NULL;
+    if (!metrics_on)
+        return ht_bucket_find(ht, node, key, NULL);
 
-    default:
-        return arr_search(ht->ptab[hash].dptr, key, ht->cmp);
+    /* the keys compared are all of the bucket on miss */
+    value = ht_bucket_find(ht, node, key, &idx);
+
+    metrics_counter_add(MC_HT_GET, 1);
+    metrics_hist_record(MH_HT_PROBE, value ? idx + 1 : node->count);
+
+    return value;
+}
+
+#define HT_BATCH_GROUP  16
+
+int ht_mget_batch (hashtab_t * ht, void ** keys, int num, void ** vals)
+{
+    hashnode_t * node[HT_BATCH_GROUP];
+    int          i, j, n, idx;
+    int          found = 0;
+
+    if (!ht || !keys || !vals || num <= 0) return 0;
+
+    if (ht->ptab_old) ht_rehash_step(ht, HT_REHASH_STEP);
+
+    for (i = 0; i < num; i += n) {
+        n = num - i;
+        if (n > HT_BATCH_GROUP) n = HT_BATCH_GROUP;
+
+        /* hash the group and prefetch the buckets */
+        for (j = 0; j < n; j++) {
+            if (!keys[i + j]) { node[j] = NULL; continue; }
+
+            node[j] = ht_bucket_of(ht, ht_hash_key(ht, keys[i + j]));
+            __builtin_prefetch(node[j], 0, 1);
+        }
+
+        /* the buckets are arriving, prefetch what they point to: the
+           value compared, or the overflow list */
+        for (j = 0; j < n; j++) {
+            if (node[j] && node[j]->count > 0)
+                __builtin_prefetch(node[j]->dptr, 0, 1);
+        }
+
+        for (j = 0; j < n; j++) {
+            if (!node[j]) { vals[i + j] = NULL; continue; }
+
+            idx = 0;
+            vals[i + j] = ht_bucket_find(ht, node[j], keys[i + j], &idx);
+            if (vals[i + j]) found++;
+
+            if (metrics_on) {
+                metrics_counter_add(MC_HT_GET, 1);
+                metrics_hist_record(MH_HT_PROBE, vals[i + j] ? idx + 1 : node[j]->count);
+            }
+        }
     }
 
-    return NULL;
+    return found;
 }
 
 
@@ -405,7 +890,9 @@ int ht_sort (hashtab_t * ht, HashTabCmp * cmp)
 
 void * ht_value (hashtab_t * ht, int index)
 {
-    int  i = 0;
+    hashnode_t * tab = NULL;
+    int  len = 0;
+    int  i = 0, t = 0;
     int  num = 0;
 
     if (!ht) return NULL;
@@ -415,21 +902,26 @@ void * ht_value (hashtab_t * ht, int index)
     if (ht->linear)
         return arr_value(ht->nodelist, index);
 
-    for (num = 0, i = 0; i < ht->len; i++) {
-        switch(ht->ptab[i].count) {
-        case 0: 
-            continue;
-        case 1:
-            if (index == num) return ht->ptab[i].dptr;
-            if (index < num) return NULL;
-            num += 1;
-            break;
-        default:
-            if (index >= num + ht->ptab[i].count) {
-                num += ht->ptab[i].count;
+    for (num = 0, t = 0; t < 2; t++) {
+        tab = t == 0 ? ht->ptab_old : ht->ptab;
+        len = t == 0 ? ht->len_old : ht->len;
+        if (!tab) continue;
+
+        for (i = 0; i < len; i++) {
+            switch(tab[i].count) {
+            case 0: 
                 continue;
-            } else {
-                return arr_value(ht->ptab[i].dptr, index - num);
+            case 1:
+                if (index == num) return tab[i].dptr;
+                num += 1;
+                break;
+            default:
+                if (index >= num + tab[i].count) {
+                    num += tab[i].count;
+                    continue;
+                } else {
+                    return arr_value(tab[i].dptr, index - num);
+                }
             }
         }
     }
@@ -440,22 +932,30 @@ void * ht_value (hashtab_t * ht, int index)
 
 void ht_traverse (hashtab_t * ht, void * usrInfo, void (*check)(void *, void *))
 {
-    int i = 0, j = 0;
+    hashnode_t * tab = NULL;
+    int  len = 0;
+    int  i = 0, j = 0, t = 0;
 
     if (!ht || !check) return;
 
-    for (i = 0; i < ht->len; i++) {
-        switch (ht->ptab[i].count) {
-        case 0: 
-            break;
-        case 1:
-            (*check)(usrInfo, ht->ptab[i].dptr);
-            break;
-        default:
-            for (j = 0; j < arr_num(ht->ptab[i].dptr); j++) {
-                check(usrInfo, arr_value(ht->ptab[i].dptr, j));
+    for (t = 0; t < 2; t++) {
+        tab = t == 0 ? ht->ptab_old : ht->ptab;
+        len = t == 0 ? ht->len_old : ht->len;
+        if (!tab) continue;
+
+        for (i = 0; i < len; i++) {
+            switch (tab[i].count) {
+            case 0: 
+                break;
+            case 1:
+                (*check)(usrInfo, tab[i].dptr);
+                break;
+            default:
+                for (j = 0; j < arr_num(tab[i].dptr); j++) {
+                    check(usrInfo, arr_value(tab[i].dptr, j));
+                }
+                break;
             }
-            break;
         }
     }
 }
@@ -464,165 +964,88 @@ void ht_traverse (hashtab_t * ht, void * usrInfo, void (*check)(void *, void *))
 
 int ht_set (hashtab_t * ht, void * key, void * value)
 {
-    ulong   hash = 0;
-    arr_t * valueList = NULL;
+    hashnode_t * node = NULL;
+    ulong        hash = 0;
 
     if (!ht || !key) return -1;
 
-    hash = (*ht->hashFunc)(key);
-
-    hash %= ht->len;
-
-    switch (ht->ptab[hash].count) {
-    case 0:
-        ht->ptab[hash].dptr = value;
-        ht->ptab[hash].count++;
-        ht->num++;
-
-        if (ht->linear) arr_push(ht->nodelist, value);
-
-#ifdef _DEBUG
-        ht->collide_tab[ht->ptab[hash].count] += 1;
-#endif
-        return ht->ptab[hash].count;
- 
-    case 1:
-        if ((*ht->cmp)(ht->ptab[hash].dptr, key) == 0) {
-            return ht->ptab[hash].count;
-        }
-
-        ht->ptab[hash].count++;
-        valueList = arr_new(4);
-        arr_push(valueList, ht->ptab[hash].dptr);
-        arr_push(valueList, value);
-        ht->ptab[hash].dptr = valueList;
-        ht->num++;
-
-        if (ht->linear) arr_push(ht->nodelist, value);
+    if (ht->ptab_old) ht_rehash_step(ht, HT_REHASH_STEP);
 
-#ifdef _DEBUG
-        ht->collide_tab[ht->ptab[hash].count-1] -= 1;
-        ht->collide_tab[ht->ptab[hash].count] += 1;
-#endif
-        return ht->ptab[hash].count;
+    hash = ht_hash_key(ht, key);
+    node = ht_bucket_of(ht, hash);
 
-    default:
-        if (arr_search(ht->ptab[hash].dptr, key, ht->cmp) != NULL)
-            return 0;
+    if (ht_bucket_find(ht, node, key, NULL) != NULL)
+        return node->count > 1 ? 0 : node->count;
 
-        ht->ptab[hash].count++;
-        arr_push(ht->ptab[hash].dptr, value);
-        ht->num++;
+    ht_bucket_add(ht, node, hash, value);
+    ht->num++;
 
-        if (ht->linear) arr_push(ht->nodelist, value);
+    if (ht->linear) arr_push(ht->nodelist, value);
 
-#ifdef _DEBUG
-        if (ht->ptab[hash].count <= sizeof(ht->collide_tab)/sizeof(int) - 1) {
-            ht->collide_tab[ht->ptab[hash].count-1] -= 1;
-            ht->collide_tab[ht->ptab[hash].count] += 1;
-        } else {
-            if (ht->ptab[hash].count-1 <= sizeof(ht->collide_tab)/sizeof(int) - 1)
-                ht->collide_tab[ht->ptab[hash].count-1] -= 1;
-            ht->collide_tab[0] += 1;
-        }
-#endif
-        return ht->ptab[hash].count;
+    /* the bucket table grows when load factor exceeds the limit. the stored
+     * values are moved to the new table a few buckets at a time */
+    if (!ht->ptab_old && ht->load_limit > 0 &&
+        (long)ht->num * 100 > (long)ht->len * ht->load_limit)
+    {
+        ht_rehash_start(ht, find_a_prime((ulong)ht->len * 2));
     }
 
-    return 0;
+    return node->count;
 }
 
 
 void * ht_delete (hashtab_t * ht, void * key)
 {
+    hashnode_t * node = NULL;
     ulong  hash = 0;
     void * value = NULL;
+    int    idx = 0;
 
     if (!ht || !key) return NULL;
 
-    hash = (*ht->hashFunc)(key);
-    if (hash < 0) return NULL;
+    if (ht->ptab_old) ht_rehash_step(ht, HT_REHASH_STEP);
 
-    hash %= ht->len;
+    hash = ht_hash_key(ht, key);
+    node = ht_bucket_of(ht, hash);
 
-    switch (ht->ptab[hash].count) {
-    case 0:
-        return NULL;
+    value = ht_bucket_find(ht, node, key, &idx);
+    if (value == NULL) return NULL;
 
-    case 1:
-        if ((*ht->cmp)(ht->ptab[hash].dptr, key) == 0) {
-            ht->ptab[hash].count--;
-            ht->num--;
-            if (ht->linear) arr_delete_ptr(ht->nodelist, ht->ptab[hash].dptr);
-#ifdef _DEBUG
-            ht->collide_tab[ht->ptab[hash].count+1] -= 1;
-#endif
-            return ht->ptab[hash].dptr;
-        } else
-            return NULL;
+    ht_bucket_remove(ht, node, idx);
+    ht->num--;
 
-    default:
-        value = arr_search(ht->ptab[hash].dptr, key, ht->cmp);
-        if (value == NULL) return NULL;
+    if (ht->linear) arr_delete_ptr(ht->nodelist, value);
 
-        if (ht->linear) arr_delete_ptr(ht->nodelist, value);
-
-        arr_delete_ptr(ht->ptab[hash].dptr, value);
-        ht->ptab[hash].count--;
-        ht->num--;
-
-        if (arr_num((arr_t *)ht->ptab[hash].dptr) == 1) {
-            void * tmp = arr_value(ht->ptab[hash].dptr, 0);
-            arr_free(ht->ptab[hash].dptr);
-            ht->ptab[hash].dptr = tmp;
-            ht->ptab[hash].count = 1;
-        }
-#ifdef _DEBUG
-        if (ht->ptab[hash].count < sizeof(ht->collide_tab)/sizeof(int) - 1) {
-            ht->collide_tab[ht->ptab[hash].count] += 1;
-            ht->collide_tab[ht->ptab[hash].count+1] -= 1;
-        } else {
-            if (ht->ptab[hash].count <= sizeof(ht->collide_tab)/sizeof(int) - 1)
-                ht->collide_tab[ht->ptab[hash].count] += 1;
-            ht->collide_tab[0] -= 1;
-        }
-#endif
-        return value;
-    }
-
-    return NULL;
+    return value;
 }
 
 
 
 void ht_delete_pattern (hashtab_t * ht, void * usrInfo, HashTabCmp * cmp, HashTabFree * freeFunc)
 {
-    int i = 0, j = 0;
+    hashnode_t * tab = NULL;
+    void       * value = NULL;
+    int  len = 0;
+    int  i = 0, j = 0, t = 0;
 
     if (!ht || !cmp || !freeFunc) return;
 
-    for (i = 0; i < ht->len; i++) {
-        switch (ht->ptab[i].count) {
-        case 0:
-            break;
-        case 1:
-            if ((*cmp)(ht->ptab[i].dptr, usrInfo) == 0) {
-                ht->ptab[i].count--;
-                ht->num--;
-                if (ht->linear) arr_delete_ptr(ht->nodelist, ht->ptab[i].dptr);
-                (*freeFunc)(ht->ptab[i].dptr);
-            }
-            break;
-        default:
-            for (j = 0; j < arr_num(ht->ptab[i].dptr); j++) {
-                if ((*cmp)(arr_value(ht->ptab[i].dptr, j), usrInfo) == 0) {
-                    ht->ptab[i].count--;
+    for (t = 0; t < 2; t++) {
+        tab = t == 0 ? ht->ptab_old : ht->ptab;
+        len = t == 0 ? ht->len_old : ht->len;
+        if (!tab) continue;
+
+        for (i = 0; i < len; i++) {
+            for (j = tab[i].count - 1; j >= 0; j--) {
+                value = tab[i].count == 1 ? tab[i].dptr : arr_value(tab[i].dptr, j);
+
+                if ((*cmp)(value, usrInfo) == 0) {
+                    ht_bucket_remove(ht, &tab[i], j);
                     ht->num--;
-                    if (ht->linear) arr_delete_ptr(ht->nodelist, arr_value(ht->ptab[i].dptr, j));
-                    (*freeFunc)(arr_delete(ht->ptab[i].dptr, j));
+                    if (ht->linear) arr_delete_ptr(ht->nodelist, value);
+                    (*freeFunc)(value);
                 }
             }
-            break;
         }
     }
 
@@ -631,7 +1054,6 @@ void ht_delete_pattern (hashtab_t * ht, void * usrInfo, HashTabCmp * cmp, HashTa
 
 void print_hashtab (void * vht, FILE * fp)
 {
-#ifdef _DEBUG
     hashtab_t * ht = (hashtab_t *)vht;
     int i=0;
     int total = 0;
@@ -644,6 +1066,9 @@ void print_hashtab (void * vht, FILE * fp)
     fprintf(fp, "Total Bucket Number: %d\n", ht->len);
     fprintf(fp, "Req Bucket Number  : %d\n", ht->num_requested);
     fprintf(fp, "Stored Data Number : %d\n", ht->num);
+    fprintf(fp, "Load Factor        : %.2f\n", ht_load_factor(ht));
+    if (ht->ptab_old)
+        fprintf(fp, "Rehashing          : %d/%d\n", ht->rehash_idx, ht->len_old);
     for (i=1; i<num; i++) {
         total += ht->collide_tab[i];
         if (ht->collide_tab[i] > 0)
@@ -654,6 +1079,5 @@ void print_hashtab (void * vht, FILE * fp)
         fprintf(fp, "    Buckets Storing >= %d Data: %d\n", num, ht->collide_tab[0]);
     fprintf(fp, "Buckets Storing at least 1 data: %d\n", total);
     fprintf(fp, "-------------------------------------------------------\n");
-#endif
     return;
 }
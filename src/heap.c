@@ -14,6 +14,12 @@
 
 typedef void heapfree (void * );
 
+#define heap_setpos(hp, i)                                        \
+    do {                                                          \
+        if ((hp)->posoff >= 0)                                    \
+            *(int *)((char *)(hp)->data[i] + (hp)->posoff) = (i); \
+    } while (0)
+
 
 heap_t * heap_dup (heap_t * hp)
 {
@@ -26,6 +32,10 @@ heap_t * heap_dup (heap_t * hp)
     ret->num_alloc = hp->num_alloc;
     ret->num = hp->num;
     ret->cmp = hp->cmp;
+    ret->arity = hp->arity;
+
+    /* the elements keep their index in the original heap */
+    ret->posoff = -1;
 
     return ret;
 }
@@ -49,9 +59,35 @@ heap_t * heap_new (heapcmp_t * cmp, int len)
     ret->num = 0;
     ret->cmp = cmp;
 
+    ret->arity = 2;
+    ret->posoff = -1;
+
     return ret;
 }
 
+heap_t * heap_new_dary (heapcmp_t * cmp, int len, int arity)
+{
+    heap_t * ret = NULL;
+
+    if (arity < 2) arity = 2;
+
+    ret = heap_new(cmp, len);
+    if (!ret) return NULL;
+
+    ret->arity = arity;
+
+    return ret;
+}
+
+int heap_set_index (heap_t * hp, int offset)
+{
+    if (!hp) return -1;
+
+    hp->posoff = offset < 0 ? -1 : offset;
+
+    return 0;
+}
+
 void heap_pop_free (heap_t * hp, void * vfunc)
 {
     heapfree * func = (heapfree *)vfunc;
@@ -147,24 +183,23 @@ int heap_enlarge (heap_t * hp, int scale)
 void heap_up (heap_t * hp, int child)
 {
     int    parent = -1;
-    void * tmp = NULL;
+    void * obj = NULL;
 
-    if (!hp || child >= hp->num) return;
+    if (!hp || child < 0 || child >= hp->num) return;
+
+    obj = hp->data[ child ];
 
     while (child > 0) {
 
-        parent = (child - 1) / 2;
+        parent = (child - 1) / hp->arity;
 
-        //if (hp->data[ parent ] > hp->data[ child ]) {
+        if ((*hp->cmp)(hp->data[ parent ], obj) > 0) {
 
-        if ((*hp->cmp)(hp->data[ parent ], hp->data[ child ]) > 0) {
+            /* if the parent is greater than obj, the parent moves down
+               into the hole and obj goes on rising */
 
-            /* if the parent is greater than child, the current child
-               becomes parent by swaping them. */
-
-            tmp = hp->data[ parent ];
-            hp->data[ parent ] = hp->data[ child ];
-            hp->data[ child ] = tmp;
+            hp->data[ child ] = hp->data[ parent ];
+            heap_setpos(hp, child);
 
             child = parent;
 
@@ -172,42 +207,50 @@ void heap_up (heap_t * hp, int child)
             break;
         }
     }
+
+    hp->data[ child ] = obj;
+    heap_setpos(hp, child);
 }
 
 void heap_down (heap_t * hp, int index, int num)
 {
     int    parent = index;
-    int    child = 2 * parent + 1;
-    void * tmp = NULL;
+    int    child, last, i;
+    void * obj = NULL;
 
-    if (!hp || index >= hp->num) return;
+    if (!hp || index < 0 || index >= hp->num) return;
 
-    while (child < num) {
+    obj = hp->data[ parent ];
 
-        /* find the smaller child. 
-           if left child is greater than right child,
-           choose the right child */
+    while ((child = hp->arity * parent + 1) < num) {
 
-        if (child + 1 < num && 
-            (*hp->cmp)(hp->data[ child ], hp->data[ child + 1 ]) > 0)
-            child++;
+        /* find the smallest of the children */
 
-        if ((*hp->cmp)(hp->data[ parent ], hp->data[ child ]) > 0) {
+        last = child + hp->arity;
+        if (last > num) last = num;
 
-            /* if the parent is greater than child, the smaller becomes 
-               parent by swaping them. go on shifting the child down */
+        for (i = child + 1; i < last; i++) {
+            if ((*hp->cmp)(hp->data[ child ], hp->data[ i ]) > 0)
+                child = i;
+        }
+
+        if ((*hp->cmp)(obj, hp->data[ child ]) > 0) {
+
+            /* if obj is greater than the smallest child, the child moves
+               up into the hole. go on shifting obj down */
 
-            tmp = hp->data[ parent ];
             hp->data[ parent ] = hp->data[ child ];
-            hp->data[ child ] = tmp;
+            heap_setpos(hp, parent);
 
             parent = child;
-            child = 2 * parent + 1;
 
         } else {
             break;
         }
     }
+
+    hp->data[ parent ] = obj;
+    heap_setpos(hp, parent);
 }
 
 int heap_push (heap_t * hp, void * data)
@@ -226,7 +269,41 @@ int heap_push (heap_t * hp, void * data)
     }
 
     hp->data[hp->num++] = data;
-    heap_up(hp, hp->num);
+    heap_up(hp, hp->num - 1);
+
+    return hp->num;
+}
+
+int heap_push_n (heap_t * hp, void ** ar, int num)
+{
+    void ** s;
+    int     i, size;
+
+    if (!hp || !ar || num < 0) return -1;
+
+    if (hp->num_alloc < hp->num + num) {
+        for (size = hp->num_alloc; size < hp->num + num; size *= 2);
+
+        s = (void **)krealloc((void *)hp->data, sizeof(void *) * size);
+        if (s == NULL) return -100;
+
+        hp->data = s;
+        hp->num_alloc = size;
+    }
+
+    /* sifting each up costs num * log(n), heapifying costs n in total */
+    if (num <= hp->num) {
+        for (i = 0; i < num; i++) {
+            hp->data[hp->num++] = ar[i];
+            heap_up(hp, hp->num - 1);
+        }
+        return hp->num;
+    }
+
+    memcpy(hp->data + hp->num, ar, num * sizeof(void *));
+    hp->num += num;
+
+    heap_heapify(hp);
 
     return hp->num;
 }
@@ -244,6 +321,42 @@ void * heap_pop (heap_t * hp)
 
     heap_down(hp, 0, hp->num);
 
+    if (hp->posoff >= 0)
+        *(int *)((char *)obj + hp->posoff) = -1;
+
+    return obj;
+}
+
+int heap_update (heap_t * hp, int index)
+{
+    if (!hp || index < 0 || index >= hp->num) return -1;
+
+    if (index > 0 && (*hp->cmp)(hp->data[ (index - 1) / hp->arity ], hp->data[index]) > 0)
+        heap_up(hp, index);
+    else
+        heap_down(hp, index, hp->num);
+
+    return 0;
+}
+
+void * heap_remove_at (heap_t * hp, int index)
+{
+    void  * obj = NULL;
+
+    if (!hp || index < 0 || index >= hp->num) return NULL;
+
+    obj = hp->data[index];
+
+    hp->num--;
+
+    if (index < hp->num) {
+        hp->data[index] = hp->data[ hp->num ];
+        heap_update(hp, index);
+    }
+
+    if (hp->posoff >= 0)
+        *(int *)((char *)obj + hp->posoff) = -1;
+
     return obj;
 }
 
@@ -275,7 +388,13 @@ int heap_heapify (heap_t * hp)
 
     if (!hp) return -1;
 
-    for (i = (hp->num - 2) / 2; i >= 0; i--) {
+    /* the leaves are never moved, their positions are set here */
+    if (hp->posoff >= 0) {
+        for (i = 0; i < hp->num; i++)
+            heap_setpos(hp, i);
+    }
+
+    for (i = (hp->num - 2) / hp->arity; i >= 0; i--) {
         heap_down(hp, i, hp->num);
     }
 
@@ -0,0 +1,891 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "btype.h"
+#include "memory.h"
+#include "bpool.h"
+#include "dynarr.h"
+#include "frame.h"
+#include "chunk.h"
+#include "fileop.h"
+#include "tsock.h"
+#include "iouring.h"
+
+#if defined(_LINUX_) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define IOURING_CKBATCH    8
+#define IOURING_PIPESIZE   (1024*1024)
+
+typedef struct io_ring_s {
+    int                    fd;
+    uint32                 flags;
+    uint32                 features;
+
+    /* submission queue */
+    uint32               * sqhead;
+    uint32               * sqtail;
+    uint32               * sqmask;
+    uint32               * sqflags;
+    uint32               * sqarray;
+    uint32                 sqentries;
+    struct io_uring_sqe  * sqes;
+
+    /* tail of local prepared entries, published to kernel on submit */
+    uint32                 sqlocal;
+    int                    pending;
+
+    /* completion queue */
+    uint32               * cqhead;
+    uint32               * cqtail;
+    uint32               * cqmask;
+    struct io_uring_cqe  * cqes;
+
+    void                 * sqmap;
+    size_t                 sqmaplen;
+    void                 * cqmap;
+    size_t                 cqmaplen;
+    size_t                 sqeslen;
+
+    struct iovec         * regbuf;
+    int                    regnum;
+
+    /* pipe for splicing file to socket */
+    int                    pipefd[2];
+    int                    pipesize;
+
+    /* bytes spliced from file pipesrc at pipepos, not yet sent to pipeout */
+    int                    pipelen;
+    int                    pipeout;
+    int                    pipesrc;
+    int64                  pipepos;
+
+    chunk_vec_t          * ckvec;
+} IoRing;
+
+
+static int sys_io_uring_setup (uint32 entries, struct io_uring_params * p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter (int fd, uint32 tosubmit, uint32 mincomplete, uint32 flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register (int fd, uint32 opcode, void * arg, uint32 nargs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+#endif
+
+
+int iouring_supported ()
+{
+#ifdef HAVE_IO_URING
+    static int supported = -1;
+    void     * ring = NULL;
+
+    if (supported < 0) {
+        ring = iouring_new(4, 0);
+        supported = ring ? 1 : 0;
+        iouring_free(ring);
+    }
+    return supported;
+#else
+    return 0;
+#endif
+}
+
+void * iouring_new (int entries, int flags)
+{
+#ifdef HAVE_IO_URING
+    IoRing                 * ring = NULL;
+    struct io_uring_params   p;
+    uint8                  * sq = NULL;
+    uint8                  * cq = NULL;
+
+    if (entries <= 0) entries = 256;
+
+    ring = kzalloc(sizeof(*ring));
+    if (!ring) return NULL;
+
+    ring->fd = -1;
+    ring->pipefd[0] = ring->pipefd[1] = -1;
+    ring->pipeout = -1;
+    ring->sqmap = ring->cqmap = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    if (flags & IOURING_SQPOLL) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000;
+    }
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) goto failed;
+
+    ring->flags = p.flags;
+    ring->features = p.features;
+
+    ring->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(uint32);
+    ring->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqmaplen > ring->sqmaplen) ring->sqmaplen = ring->cqmaplen;
+        ring->cqmaplen = 0;
+    }
+
+    ring->sqmap = mmap(NULL, ring->sqmaplen, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqmap == MAP_FAILED) goto failed;
+
+    if (ring->cqmaplen > 0) {
+        ring->cqmap = mmap(NULL, ring->cqmaplen, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqmap == MAP_FAILED) goto failed;
+        cq = ring->cqmap;
+    } else {
+        cq = ring->sqmap;
+    }
+    sq = ring->sqmap;
+
+    ring->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqeslen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto failed;
+
+    ring->sqhead = (uint32 *)(sq + p.sq_off.head);
+    ring->sqtail = (uint32 *)(sq + p.sq_off.tail);
+    ring->sqmask = (uint32 *)(sq + p.sq_off.ring_mask);
+    ring->sqflags = (uint32 *)(sq + p.sq_off.flags);
+    ring->sqarray = (uint32 *)(sq + p.sq_off.array);
+    ring->sqentries = p.sq_entries;
+    ring->sqlocal = *ring->sqtail;
+
+    ring->cqhead = (uint32 *)(cq + p.cq_off.head);
+    ring->cqtail = (uint32 *)(cq + p.cq_off.tail);
+    ring->cqmask = (uint32 *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return ring;
+
+failed:
+    iouring_free(ring);
+    return NULL;
+#else
+    return NULL;
+#endif
+}
+
+void iouring_free (void * vring)
+{
+#ifdef HAVE_IO_URING
+    IoRing * ring = (IoRing *)vring;
+
+    if (!ring) return;
+
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqeslen);
+    if (ring->cqmap != MAP_FAILED) munmap(ring->cqmap, ring->cqmaplen);
+    if (ring->sqmap != MAP_FAILED) munmap(ring->sqmap, ring->sqmaplen);
+
+    if (ring->fd >= 0) close(ring->fd);
+
+    if (ring->pipefd[0] >= 0) close(ring->pipefd[0]);
+    if (ring->pipefd[1] >= 0) close(ring->pipefd[1]);
+
+    if (ring->regbuf) kfree(ring->regbuf);
+    if (ring->ckvec) kfree(ring->ckvec);
+
+    kfree(ring);
+#endif
+}
+
+int iouring_pending (void * vring)
+{
+#ifdef HAVE_IO_URING
+    IoRing * ring = (IoRing *)vring;
+
+    if (!ring) return 0;
+
+    return ring->pending;
+#else
+    return 0;
+#endif
+}
+
+
+int iouring_register_buffers (void * vring, void ** bufs, int * lens, int num)
+{
+#ifdef HAVE_IO_URING
+    IoRing  * ring = (IoRing *)vring;
+    int       i;
+
+    if (!ring || !bufs || !lens || num <= 0) return -1;
+
+    if (ring->regbuf) iouring_unregister_buffers(ring);
+
+    ring->regbuf = kzalloc(sizeof(struct iovec) * num);
+    if (!ring->regbuf) return -2;
+
+    for (i = 0; i < num; i++) {
+        ring->regbuf[i].iov_base = bufs[i];
+        ring->regbuf[i].iov_len = lens[i];
+    }
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, ring->regbuf, num) < 0) {
+        kfree(ring->regbuf);
+        ring->regbuf = NULL;
+        return -100;
+    }
+
+    ring->regnum = num;
+    return num;
+#else
+    return -1;
+#endif
+}
+
+int iouring_unregister_buffers (void * vring)
+{
+#ifdef HAVE_IO_URING
+    IoRing  * ring = (IoRing *)vring;
+
+    if (!ring) return -1;
+    if (!ring->regbuf) return 0;
+
+    sys_io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    kfree(ring->regbuf);
+    ring->regbuf = NULL;
+    ring->regnum = 0;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_register_bpool (void * vring, bpool_t * pool, int num, void ** units)
+{
+#ifdef HAVE_IO_URING
+    int     * lens = NULL;
+    int       unitsize;
+    int       i, ret;
+
+    if (!vring || !pool || num <= 0 || !units) return -1;
+
+    unitsize = bpool_unitsize(pool);
+    if (unitsize <= 0) return -2;
+
+    lens = kzalloc(sizeof(int) * num);
+    if (!lens) return -3;
+
+    for (i = 0; i < num; i++) {
+        units[i] = bpool_fetch(pool);
+        lens[i] = unitsize;
+        if (!units[i]) break;
+    }
+
+    if (i < num) {
+        while (i-- > 0) bpool_recycle(pool, units[i]);
+        kfree(lens);
+        return -4;
+    }
+
+    ret = iouring_register_buffers(vring, units, lens, num);
+    kfree(lens);
+
+    if (ret < 0) {
+        for (i = 0; i < num; i++) bpool_recycle(pool, units[i]);
+    }
+
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+
+#ifdef HAVE_IO_URING
+static struct io_uring_sqe * iouring_sqe_get (IoRing * ring, int opcode, int fd, int sflag, void * tag)
+{
+    struct io_uring_sqe  * sqe = NULL;
+    uint32                 head, index;
+
+    head = __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+    if (ring->sqlocal - head >= ring->sqentries)
+        return NULL;
+
+    index = ring->sqlocal & *ring->sqmask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64)(ulong)tag;
+    if (sflag & IOURING_LINK) sqe->flags |= IOSQE_IO_LINK;
+
+    ring->sqarray[index] = index;
+    ring->sqlocal++;
+    ring->pending++;
+
+    return sqe;
+}
+
+/* index of the registered buffer that holds [p, p+len) */
+static int iouring_regbuf_index (IoRing * ring, void * p, int len)
+{
+    uint8  * base;
+    int      i;
+
+    for (i = 0; i < ring->regnum; i++) {
+        base = (uint8 *)ring->regbuf[i].iov_base;
+        if ((uint8 *)p >= base && (uint8 *)p + len <= base + ring->regbuf[i].iov_len)
+            return i;
+    }
+
+    return -1;
+}
+#endif
+
+int iouring_prep_recv (void * vring, SOCKET fd, void * pbuf, int size, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe  * sqe = NULL;
+
+    if (!vring || !pbuf || size <= 0) return -2;
+
+    sqe = iouring_sqe_get(vring, IORING_OP_RECV, fd, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->addr = (uint64)(ulong)pbuf;
+    sqe->len = size;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_prep_send (void * vring, SOCKET fd, void * pbuf, int len, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe  * sqe = NULL;
+
+    if (!vring || !pbuf || len <= 0) return -2;
+
+    sqe = iouring_sqe_get(vring, IORING_OP_SEND, fd, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->addr = (uint64)(ulong)pbuf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_prep_read (void * vring, int fd, void * pbuf, int size, int64 offset, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    IoRing               * ring = (IoRing *)vring;
+    struct io_uring_sqe  * sqe = NULL;
+    int                    bufind;
+
+    if (!ring || !pbuf || size <= 0) return -2;
+
+    bufind = iouring_regbuf_index(ring, pbuf, size);
+
+    sqe = iouring_sqe_get(ring, bufind >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->addr = (uint64)(ulong)pbuf;
+    sqe->len = size;
+    sqe->off = (uint64)offset;
+    if (bufind >= 0) sqe->buf_index = bufind;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_prep_write (void * vring, int fd, void * pbuf, int len, int64 offset, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    IoRing               * ring = (IoRing *)vring;
+    struct io_uring_sqe  * sqe = NULL;
+    int                    bufind;
+
+    if (!ring || !pbuf || len <= 0) return -2;
+
+    bufind = iouring_regbuf_index(ring, pbuf, len);
+
+    sqe = iouring_sqe_get(ring, bufind >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->addr = (uint64)(ulong)pbuf;
+    sqe->len = len;
+    sqe->off = (uint64)offset;
+    if (bufind >= 0) sqe->buf_index = bufind;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_prep_writev (void * vring, int fd, void * iov, int iovcnt, int64 offset, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe  * sqe = NULL;
+
+    if (!vring || !iov || iovcnt <= 0) return -2;
+
+    sqe = iouring_sqe_get(vring, IORING_OP_WRITEV, fd, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->addr = (uint64)(ulong)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64)offset;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int iouring_prep_splice (void * vring, int fdin, int64 offin, int fdout, int64 offout,
+                         int len, int sflag, void * tag)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe  * sqe = NULL;
+
+    if (!vring || len <= 0) return -2;
+
+    sqe = iouring_sqe_get(vring, IORING_OP_SPLICE, fdout, sflag, tag);
+    if (!sqe) return -1;
+
+    sqe->splice_fd_in = fdin;
+    sqe->splice_off_in = (uint64)offin;
+    sqe->off = (uint64)offout;
+    sqe->len = len;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+int iouring_submit (void * vring, int waitnr)
+{
+#ifdef HAVE_IO_URING
+    IoRing   * ring = (IoRing *)vring;
+    uint32     flags = 0;
+    int        num, ret;
+
+    if (!ring) return -1;
+
+    num = ring->pending;
+
+    /* publish the prepared entries before kernel reads the tail */
+    __atomic_store_n(ring->sqtail, ring->sqlocal, __ATOMIC_RELEASE);
+
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+        ring->pending = 0;
+
+        if (__atomic_load_n(ring->sqflags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+
+        if (waitnr > 0) flags |= IORING_ENTER_GETEVENTS;
+
+        if (flags == 0) return num;
+
+        ret = sys_io_uring_enter(ring->fd, num, waitnr, flags);
+        if (ret < 0 && errno != EINTR) return -100;
+        return num;
+    }
+
+    if (num == 0 && waitnr <= 0) return 0;
+
+    if (waitnr > 0) flags |= IORING_ENTER_GETEVENTS;
+
+    for ( ; ; ) {
+        ret = sys_io_uring_enter(ring->fd, num, waitnr, flags);
+        if (ret < 0 && errno == EINTR) continue;
+        break;
+    }
+
+    if (ret < 0) return -100;
+
+    ring->pending -= ret;
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+int iouring_reap (void * vring, iouring_cqe_t * cqes, int max, int waitnr)
+{
+#ifdef HAVE_IO_URING
+    IoRing               * ring = (IoRing *)vring;
+    struct io_uring_cqe  * cqe = NULL;
+    uint32                 head, tail;
+    int                    num = 0;
+
+    if (!ring || !cqes || max <= 0) return -1;
+
+    if (waitnr > max) waitnr = max;
+
+    if (ring->pending > 0 && iouring_submit(ring, 0) < 0)
+        return -100;
+
+    for ( ; ; ) {
+        head = *ring->cqhead;
+        tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+
+        for ( ; head != tail && num < max; head++, num++) {
+            cqe = &ring->cqes[head & *ring->cqmask];
+            cqes[num].tag = (void *)(ulong)cqe->user_data;
+            cqes[num].res = cqe->res;
+            cqes[num].flags = cqe->flags;
+        }
+
+        __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+
+        if (num >= waitnr) break;
+
+        if (sys_io_uring_enter(ring->fd, 0, waitnr - num, IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR)
+            return num > 0 ? num : -100;
+    }
+
+    return num;
+#else
+    return -1;
+#endif
+}
+
+
+#ifdef HAVE_IO_URING
+static int iouring_pipe_open (IoRing * ring)
+{
+    if (ring->pipefd[0] >= 0) return 0;
+
+    if (pipe(ring->pipefd) < 0) return -1;
+
+    fcntl(ring->pipefd[1], F_SETPIPE_SZ, IOURING_PIPESIZE);
+
+    ring->pipesize = fcntl(ring->pipefd[1], F_GETPIPE_SZ);
+    if (ring->pipesize <= 0) ring->pipesize = 65536;
+
+    return 0;
+}
+
+/* submit and wait for the num requests prepared, results are stored by the
+ * tag that is the index of request */
+static int iouring_run (IoRing * ring, int num, int * res)
+{
+    iouring_cqe_t   cqes[IOURING_CKBATCH * 2];
+    int             i, got, ret;
+
+    for (i = 0; i < num; i++) res[i] = -ECANCELED;
+
+    for (got = 0; got < num; ) {
+        ret = iouring_reap(ring, cqes, num - got, num - got);
+        if (ret < 0) return ret;
+
+        for (i = 0; i < ret; i++) {
+            if ((ulong)cqes[i].tag < (ulong)num)
+                res[(ulong)cqes[i].tag] = cqes[i].res;
+        }
+        got += ret;
+    }
+
+    return 0;
+}
+
+/* the bytes left in pipe are dropped when they can not be sent to the
+ * owner, the caller sends them again from file */
+static void iouring_pipe_drop (IoRing * ring)
+{
+    uint8   buf[4096];
+    int     ret;
+
+    while (ring->pipelen > 0) {
+        ret = read(ring->pipefd[0], buf, min(ring->pipelen, (int)sizeof(buf)));
+        if (ret <= 0) break;
+        ring->pipelen -= ret;
+    }
+
+    ring->pipelen = 0;
+    ring->pipeout = -1;
+}
+
+/* send the bytes in pipe to fdout. return 0 if pipe is drained, 1 if fdout
+ * is not writable and the rest is kept in pipe, or negative on error */
+static int iouring_pipe_flush (IoRing * ring, int fdout, int64 * wlen, int * perr)
+{
+    int    res[1];
+
+    while (ring->pipelen > 0) {
+        if (iouring_prep_splice(ring, ring->pipefd[0], -1, fdout, -1,
+                                ring->pipelen, 0, (void *)0) < 0 ||
+            iouring_run(ring, 1, res) < 0)
+        {
+            iouring_pipe_drop(ring);
+            return -100;
+        }
+
+        if (res[0] > 0) {
+            ring->pipelen -= res[0];
+            ring->pipepos += res[0];
+            *wlen += res[0];
+            continue;
+        }
+
+        if (res[0] == -EINTR || res[0] == -ECANCELED) continue;
+
+        if (res[0] == -EAGAIN) return 1;
+
+        if (perr) *perr = -res[0];
+        iouring_pipe_drop(ring);
+        return -30;
+    }
+
+    return 0;
+}
+
+/* file is spliced into pipe and linked with pipe to fdout in one enter.
+ * if fdout is not writable, the bytes already in pipe are kept with the
+ * file position, and are sent first when the caller continues sending
+ * the same file from that position to the same fd */
+static int iouring_splice_out (IoRing * ring, int fdout, int srcfd, int64 offset, int64 size,
+                               int64 * actnum, int * perr)
+{
+    int64    wlen = 0;
+    int      onelen;
+    int      res[2];
+    int      ret = 0;
+
+    if (actnum) *actnum = 0;
+    if (perr) *perr = 0;
+
+    if (iouring_pipe_open(ring) < 0) return -1;
+
+    if (ring->pipelen > 0) {
+        if (ring->pipeout == fdout && ring->pipesrc == srcfd && ring->pipepos == offset &&
+            ring->pipelen <= size)
+        {
+            ret = iouring_pipe_flush(ring, fdout, &wlen, perr);
+        } else {
+            iouring_pipe_drop(ring);
+        }
+    }
+
+    while (ret == 0 && wlen < size) {
+        onelen = (int)min(size - wlen, (int64)ring->pipesize);
+
+        if (iouring_prep_splice(ring, srcfd, offset + wlen, ring->pipefd[1], -1,
+                                onelen, IOURING_LINK, (void *)0) < 0 ||
+            iouring_prep_splice(ring, ring->pipefd[0], -1, fdout, -1,
+                                onelen, 0, (void *)1) < 0)
+            return -2;
+
+        if (iouring_run(ring, 2, res) < 0)
+            return -100;
+
+        if (res[0] <= 0) {
+            if (perr) *perr = -res[0];
+            ret = res[0] == 0 ? -40 : -30;
+            break;
+        }
+
+        ring->pipelen = res[0];
+        ring->pipeout = fdout;
+        ring->pipesrc = srcfd;
+        ring->pipepos = offset + wlen;
+
+        if (res[1] > 0) {
+            ring->pipelen -= res[1];
+            ring->pipepos += res[1];
+            wlen += res[1];
+        } else if (res[1] == -EAGAIN) {
+            ret = 1;
+            break;
+        }
+
+        ret = iouring_pipe_flush(ring, fdout, &wlen, perr);
+    }
+
+    if (actnum) *actnum = wlen;
+
+    return ret < 0 ? ret : 0;
+}
+#endif
+
+int iouring_tcp_sendfile (void * vring, SOCKET fd, int srcfd, int64 offset, int64 size,
+                          int * actnum, int * perr)
+{
+#ifdef HAVE_IO_URING
+    IoRing      * ring = (IoRing *)vring;
+    struct stat   st;
+    int64         num = 0;
+    int           ret;
+
+    if (actnum) *actnum = 0;
+    if (perr) *perr = 0;
+
+    if (!ring) return -1;
+    if (fd == INVALID_SOCKET) return -1;
+    if (srcfd < 0) return -2;
+
+    if (fstat(srcfd, &st) < 0)
+        return -3;
+
+    if (offset >= st.st_size) return 0;
+    if (size > st.st_size - offset) size = st.st_size - offset;
+    if (size > SENDFILE_MAXSIZE) size = SENDFILE_MAXSIZE;
+
+    ret = iouring_splice_out(ring, fd, srcfd, offset, size, &num, perr);
+
+    if (actnum) *actnum = (int)num;
+    if (ret < 0) return ret;
+
+    return (int)num;
+#else
+    return -1;
+#endif
+}
+
+int iouring_chunk_writev (void * vring, void * vck, int fd, int64 offset, int64 * actnum, int httpchunk)
+{
+#ifdef HAVE_IO_URING
+    IoRing       * ring = (IoRing *)vring;
+    chunk_t      * ck = (chunk_t *)vck;
+    chunk_vec_t  * vec = NULL;
+    int            res[IOURING_CKBATCH];
+    int64          expect[IOURING_CKBATCH];
+    int64          pos = 0, vpos = 0;
+    int64          num = 0;
+    int            i, n, ret;
+    int            blocked = 0;
+
+    if (actnum) *actnum = 0;
+
+    if (!ring || !ck) return -1;
+
+    if (!ring->ckvec) {
+        ring->ckvec = kzalloc(sizeof(chunk_vec_t) * IOURING_CKBATCH);
+        if (!ring->ckvec) return -2;
+    }
+
+    /* the same range check as chunk_writev */
+    if (httpchunk) {
+        if (offset < ck->rmchunklen)
+            return -3;
+
+        if (offset >= ck->chunksize) {
+            if (ck->chunkendsize > 0) return -4;
+            else return 0;
+        }
+
+    } else {
+        if (offset < ck->rmentlen)
+            offset = ck->rmentlen;
+
+        if (offset >= ck->size) {
+            if (ck->endsize > 0) return -4;
+            else return 0;
+        }
+    }
+
+    for (pos = offset; !blocked && chunk_get_end(ck, pos, httpchunk) == 0; ) {
+        /* link the memory segments of next batch as writev requests */
+        for (n = 0, vpos = pos; n < IOURING_CKBATCH && chunk_get_end(ck, vpos, httpchunk) == 0; ) {
+            vec = &ring->ckvec[n];
+            memset(vec, 0, sizeof(*vec));
+
+            ret = chunk_vec_get(ck, vpos, vec, httpchunk);
+            if (ret < 0 || (vec->vectype != 1 && vec->vectype != 2 && vec->size > 0))
+                return ret;
+
+            if (vec->size == 0 || vec->vectype != 1) break;
+
+            expect[n] = vec->size;
+            if (iouring_prep_writev(ring, fd, vec->iovs, vec->iovcnt, -1, IOURING_LINK, (void *)(ulong)n) < 0)
+                break;
+
+            vpos += vec->size;
+            n++;
+        }
+
+        if (n > 0) {
+            /* the last one should not be linked with later requests */
+            ring->sqes[(ring->sqlocal - 1) & *ring->sqmask].flags &= ~IOSQE_IO_LINK;
+
+            if (iouring_run(ring, n, res) < 0)
+                return -100;
+
+            for (i = 0; i < n; i++) {
+                if (res[i] > 0) {
+                    pos += res[i];
+                    if (actnum) *actnum += res[i];
+                }
+
+                if (res[i] == expect[i]) continue;
+
+                /* short write or EAGAIN, the rest are cancelled */
+                if (res[i] >= 0 || res[i] == -EAGAIN || res[i] == -ECANCELED) {
+                    blocked = 1;
+                    break;
+                }
+
+                return -101;
+            }
+            continue;
+        }
+
+        if (vec->size == 0) {
+            /* no available data to send, waiting for more data... */
+            return 0;
+        }
+
+        /* segment of file */
+        ret = iouring_splice_out(ring, fd, vec->filefd, vec->fpos, vec->size, &num, NULL);
+        if (ret < 0) return -100;
+
+        pos += num;
+        if (actnum) *actnum += num;
+
+        if (num < vec->size) blocked = 1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
@@ -11,6 +11,11 @@
 #include "filecache.h"
 #include "patmat.h"
 #include "fileop.h"
+#include "dynarr.h"
+#include "frame.h"
+#include "chunk.h"
+#include "tsock.h"
+#include "jsonidx.h"
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -233,18 +238,146 @@ int json_item_free (void * vitem)
 }
 
 
-void * json_init (int sptype, int cmtflag)
+/* the objects initialized by json_init_arena allocate all the nodes and
+ * strings from the arena. they are released at once with the arena */
+static void * json_alloc (JsonObj * obj, int size)
 {
-    JsonObj * obj = NULL;
+    if (obj && obj->arena) return arena_zalloc(obj->arena, size);
 
-    obj = kzalloc(sizeof(*obj));
-    if (!obj) return NULL;
+    return kzalloc(size);
+}
 
-    InitializeCriticalSection(&obj->objCS);
+static void * json_dup (JsonObj * obj, void * p, int len)
+{
+    if (obj && obj->arena) return arena_strdup(obj->arena, p, len);
 
-    obj->objtab = ht_new(200, json_item_cmp_key);
-    ht_set_hash_func(obj->objtab, commstrkey_hash_func);
+    return str_dup(p, len);
+}
+
+static void * json_strip_copy (JsonObj * obj, void * p, int len)
+{
+    uint8 * pdst = NULL;
+    int     dlen = 0;
+
+    if (!obj || !obj->arena) return json_strip_dup(p, len);
+
+    if (!p) return NULL;
+
+    pdst = arena_alloc(obj->arena, len + 1);
+    if (!pdst) return NULL;
+
+    dlen = json_strip(p, len, pdst, len);
+    pdst[dlen] = '\0';
+
+    return pdst;
+}
+
+/* the zero-copy value may contain escaped chars, they are stripped into
+ * the arena when the value is accessed for the first time */
+static void json_value_unescape (JsonObj * obj, JsonValue * jval)
+{
+    uint8 * p = NULL;
+    int     len = 0;
+
+    if (!obj || !jval || !jval->escaped) return;
+
+    p = arena_alloc(obj->arena, jval->valuelen + 1);
+    if (!p) return;
+
+    len = json_strip(jval->value, jval->valuelen, p, jval->valuelen);
+    p[len] = '\0';
+
+    jval->value = p;
+    jval->valuelen = len;
+    jval->escaped = 0;
+}
+
+static void json_obj_value_free (JsonObj * obj, void * vjval)
+{
+    JsonValue * jval = (JsonValue *)vjval;
+
+    if (!jval) return;
+
+    if (!obj->arena) {
+        json_value_free(jval);
+        return;
+    }
+
+    if (jval->jsonobj) {
+        json_clean(jval->jsonobj);
+        jval->jsonobj = NULL;
+    }
+}
+
+/* release all the values bound to the item, and reset it as empty */
+static void json_item_values_free (JsonObj * obj, JsonItem * item)
+{
+    arr_t * vallist = NULL;
+    int     i, num;
+
+    if (item->valnum == 1) {
+        json_obj_value_free(obj, item->valobj);
+
+    } else if (item->valnum > 1) {
+        if (!obj->arena) {
+            arr_pop_free((arr_t *)item->valobj, json_value_free);
+
+        } else {
+            vallist = (arr_t *)item->valobj;
+            num = arr_num(vallist);
+            for (i = 0; i < num; i++)
+                json_obj_value_free(obj, arr_value(vallist, i));
+            arr_free(vallist);
+        }
+    }
+
+    item->valobj = NULL;
+    item->valnum = 0;
+}
+
+static void * json_obj_value_alloc (JsonObj * obj)
+{
+    if (!obj->arena) return json_value_alloc();
+
+    return arena_zalloc(obj->arena, sizeof(JsonValue));
+}
+
+static void * json_obj_item_alloc (JsonObj * obj)
+{
+    if (!obj->arena) return json_item_alloc();
+
+    return arena_zalloc(obj->arena, sizeof(JsonItem));
+}
+
+static void json_value_grow (JsonObj * obj, JsonValue * jval, int addlen)
+{
+    uint8 * p = NULL;
 
+    if (!obj->arena) {
+        jval->value = krealloc(jval->value, jval->valuelen + addlen + 1);
+        return;
+    }
+
+    json_value_unescape(obj, jval);
+
+    p = arena_alloc(obj->arena, jval->valuelen + addlen + 1);
+    if (p && jval->value && jval->valuelen > 0)
+        memcpy(p, jval->value, jval->valuelen);
+
+    jval->value = p;
+}
+
+static void * json_obj_new_sub (JsonObj * obj)
+{
+    if (obj->arena)
+        return json_init_arena(obj->sptype, obj->cmtflag, obj->arena);
+
+    return json_init(obj->sptype, obj->cmtflag);
+}
+
+
+static void json_obj_init (JsonObj * obj, int sptype, int cmtflag)
+{
     obj->bytenum = 0;
 
     obj->sptype = (sptype == 0 ? 0 : 1);
@@ -288,16 +421,80 @@ void * json_init (int sptype, int cmtflag)
         str_cpy(obj->kvend, ";}");
         obj->kvendlen = 2;
     }
+}
+
+void * json_init (int sptype, int cmtflag)
+{
+    JsonObj * obj = NULL;
+
+    obj = kzalloc(sizeof(*obj));
+    if (!obj) return NULL;
+
+    InitializeCriticalSection(&obj->objCS);
+
+    obj->objtab = ht_new(200, json_item_cmp_key);
+    ht_set_hash_func(obj->objtab, commstrkey_hash_func);
+
+    obj->arena = NULL;
+    obj->ownarena = 0;
+
+    json_obj_init(obj, sptype, cmtflag);
+
+    return obj;
+}
+
+void * json_init_arena (int sptype, int cmtflag, void * arena)
+{
+    JsonObj * obj = NULL;
+    uint8     ownarena = 0;
+
+    if (!arena) {
+        arena = arena_init(64*1024, NULL, 1);
+        if (!arena) return NULL;
+        ownarena = 1;
+    }
+
+    obj = arena_zalloc(arena, sizeof(*obj));
+    if (!obj) {
+        if (ownarena) arena_clean(arena);
+        return NULL;
+    }
+
+    /* no lock for the object, the hashtab grows from a small table */
+    obj->objtab = ht_new(7, json_item_cmp_key);
+    ht_set_hash_func(obj->objtab, commstrkey_hash_func);
+
+    obj->arena = arena;
+    obj->ownarena = ownarena;
+
+    json_obj_init(obj, sptype, cmtflag);
 
     return obj;
 }
 
 int json_clean (void * vobj)
 {
-    JsonObj * obj = (JsonObj *)vobj;
+    JsonObj  * obj = (JsonObj *)vobj;
+    JsonItem * item = NULL;
+    int        i, num;
 
     if (!obj) return -1;
 
+    if (obj->arena) {
+        /* nodes live in arena, only the hashtabs and value lists are freed */
+        num = ht_num(obj->objtab);
+        for (i = 0; i < num; i++) {
+            item = ht_value(obj->objtab, i);
+            if (item) json_item_values_free(obj, item);
+        }
+
+        ht_free(obj->objtab);
+        obj->objtab = NULL;
+
+        if (obj->ownarena) arena_clean(obj->arena);
+        return 0;
+    }
+
     DeleteCriticalSection(&obj->objCS);
 
     ht_free_all(obj->objtab, json_item_free);
@@ -367,6 +564,8 @@ void * json_item_get (void * vobj, void * name, int namelen)
     key.name = name;
     key.namelen = namelen;
 
+    if (obj->arena) return ht_get(obj->objtab, &key);
+
     EnterCriticalSection(&obj->objCS);
     item = ht_get(obj->objtab, &key);
     LeaveCriticalSection(&obj->objCS);
@@ -388,6 +587,11 @@ int json_item_add (void * vobj, void * name, int namelen, void * vitem)
     key.name = name;
     key.namelen = namelen;
  
+    if (obj->arena) {
+        ht_set(obj->objtab, &key, item);
+        return 0;
+    }
+
     EnterCriticalSection(&obj->objCS);
     ht_set(obj->objtab, &key, item);
     LeaveCriticalSection(&obj->objCS);
@@ -453,6 +657,8 @@ int json_iter (void * vobj, int ind, void ** pkey, int * keylen, void ** pval, i
         jval = arr_value((arr_t *)item->valobj, 0);
     }
 
+    json_value_unescape(obj, jval);
+
     if (jval->valtype == 0) { //generic string
         if (pval) *pval = jval->value;
         if (vallen) *vallen = jval->valuelen;
@@ -534,6 +740,8 @@ int json_mget_value (void * vobj, void * key, int keylen, void ** pval, int * va
         }
     }
 
+    json_value_unescape(subobj, jval);
+
     if (jval->valtype == 0) { //generic string
         if (pval) *pval = jval->value;
         if (vallen) *vallen = jval->valuelen;
@@ -643,6 +851,8 @@ int json_get_value (void * vobj, void * key, int keylen, int index, void ** pval
 
     if (!jval) return -300;
  
+    json_value_unescape(obj, jval);
+
     if (jval->valtype == 0) { //generic string
         if (pval) *pval = jval->value;
         if (vallen) *vallen = jval->valuelen;
@@ -774,7 +984,10 @@ int json_get_double (void * vobj, void * key, int keylen, double * val)
 }
 
  
-int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8 isarr, uint8 strip)
+/* zerocopy: the key and value are referenced directly instead of being
+ * duplicated, only used by decoding the arena object */
+static int json_add_value (void * vobj, void * key, int keylen, void * val, int vallen,
+                           uint8 isarr, uint8 strip, uint8 zerocopy)
 {
     JsonObj   * obj = (JsonObj *)vobj;
     JsonItem  * item = NULL;
@@ -792,8 +1005,8 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
 
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
-        item->name = str_dup(key, keylen);
+        item = json_obj_item_alloc(obj);
+        item->name = zerocopy ? key : json_dup(obj, key, keylen);
         item->namelen = keylen;
         json_item_add(obj, key, keylen, item);
 
@@ -801,10 +1014,17 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
     }
     item->arrflag = isarr;
 
-    jval = json_value_alloc();
+    jval = json_obj_value_alloc(obj);
 
-    jval->value = strip ? json_strip_dup(val, vallen) : str_dup(val, vallen);
-    jval->valuelen = jval->value ? str_len(jval->value) : 0;
+    if (zerocopy) {
+        jval->value = val;
+        jval->valuelen = val ? vallen : 0;
+        jval->escaped = (strip && val && memchr(val, '\\', vallen)) ? 1 : 0;
+
+    } else {
+        jval->value = strip ? json_strip_copy(obj, val, vallen) : json_dup(obj, val, vallen);
+        jval->valuelen = jval->value ? str_len(jval->value) : 0;
+    }
 
     obj->bytenum += vallen + 3;
 
@@ -825,12 +1045,7 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
         item->valnum++;
 
     } else {
-        if (item->valnum == 1) {
-            json_value_free(item->valobj); 
-
-        } else if (item->valnum > 1) { 
-            arr_pop_free((arr_t *)item->valobj, json_value_free); 
-        }
+        json_item_values_free(obj, item);
 
         item->valobj = jval; 
         item->valnum = 1;
@@ -839,6 +1054,11 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
     return item->valnum;
 }
 
+int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8 isarr, uint8 strip)
+{
+    return json_add_value(vobj, key, keylen, val, vallen, isarr, strip, 0);
+}
+
 
 int json_append (void * vobj, void * key, int keylen, void * val, int vallen, uint8 strip)
 {
@@ -860,8 +1080,8 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
  
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
-        item->name = str_dup(key, keylen);
+        item = json_obj_item_alloc(obj);
+        item->name = json_dup(obj, key, keylen);
         item->namelen = keylen;
 
         json_item_add(obj, key, keylen, item);
@@ -870,9 +1090,9 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
     }
  
     if (item->valnum < 1) {
-        jval = json_value_alloc();
+        jval = json_obj_value_alloc(obj);
 
-        jval->value = strip ? json_strip_dup(val, vallen) : str_dup(val, vallen);
+        jval->value = strip ? json_strip_copy(obj, val, vallen) : json_dup(obj, val, vallen);
         jval->valuelen = jval->value ? str_len(jval->value) : 0;
 
         obj->bytenum += vallen + 3;
@@ -882,10 +1102,10 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
 
     } else if (item->valnum == 1) {
         jval = item->valobj;
-        if (!jval) jval = item->valobj = json_value_alloc();
+        if (!jval) jval = item->valobj = json_obj_value_alloc(obj);
 
         obj->bytenum += vallen + 3;
-        jval->value = krealloc(jval->value, jval->valuelen + vallen + 1);
+        json_value_grow(obj, jval, vallen);
 
         if (jval->value) {
             if (strip) {
@@ -907,7 +1127,7 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
             if (!jval) continue;
 
             obj->bytenum += vallen + 3;
-            jval->value = krealloc(jval->value, jval->valuelen + vallen + 1);
+            json_value_grow(obj, jval, vallen);
 
             if (jval->value) {
                 if (strip) {
@@ -955,8 +1175,8 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
 
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
-        item->name = str_dup(key, keylen);
+        item = json_obj_item_alloc(obj);
+        item->name = json_dup(obj, key, keylen);
         item->namelen = keylen;
         json_item_add(obj, key, keylen, item);
  
@@ -964,9 +1184,9 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
     }
  
     if (item->valnum < 1) {
-        jval = json_value_alloc();
+        jval = json_obj_value_alloc(obj);
 
-        jval->value = kalloc(length+1);
+        jval->value = json_alloc(obj, length+1);
 
         file_read(fp, jval->value, length);
 
@@ -981,10 +1201,10 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
 
     } else if (item->valnum == 1) {
         jval = item->valobj;
-        if (!jval) jval = item->valobj = json_value_alloc();
+        if (!jval) jval = item->valobj = json_obj_value_alloc(obj);
  
         obj->bytenum += length+3;
-        jval->value = krealloc(jval->value, jval->valuelen + length + 1);
+        json_value_grow(obj, jval, length);
  
         if (jval->value) {
             file_read(fp, jval->value + jval->valuelen, length);
@@ -1006,7 +1226,7 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
             if (!jval) continue;
  
             obj->bytenum += length+3;
-            jval->value = krealloc(jval->value, jval->valuelen + length + 1);
+            json_value_grow(obj, jval, length);
  
             if (jval->value) {
                 file_read(fp, jval->value + jval->valuelen, length);
@@ -1040,29 +1260,29 @@ int json_add_by_fca (void * vobj, void * fca, long keypos, int keylen, long valp
     if (keylen <= 0) return -3;
     if (vallen <= 0) return -100;
  
-    key = kzalloc(keylen + 1);
+    key = json_alloc(obj, keylen + 1);
 
     file_cache_seek(fca, keypos);
     file_cache_read(fca, key, keylen, 0);
 
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
+        item = json_obj_item_alloc(obj);
 
         item->name = key;
         item->namelen = keylen;
 
         json_item_add(obj, key, keylen, item);
 
-    } else {
+    } else if (!obj->arena) {
         kfree(key);
     }
 
     item->arrflag = isarr;
  
-    jval = json_value_alloc();
+    jval = json_obj_value_alloc(obj);
 
-    jval->value = kzalloc(vallen+1);
+    jval->value = json_alloc(obj, vallen+1);
     jval->valuelen = vallen;
  
     file_cache_seek(fca, valpos);
@@ -1086,11 +1306,7 @@ int json_add_by_fca (void * vobj, void * fca, long keypos, int keylen, long valp
         item->valnum++;
 
     } else {
-        if (item->valnum == 1) {
-            json_value_free(item->valobj);
-        } else if (item->valnum > 1) {
-            arr_pop_free((arr_t *)item->valobj, json_value_free);
-        }
+        json_item_values_free(obj, item);
 
         item->valobj = jval;
         item->valnum = 1;
@@ -1115,8 +1331,8 @@ void * json_add_obj (void * vobj, void * key, int keylen, uint8 isarr)
 
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
-        item->name = str_dup(key, keylen);
+        item = json_obj_item_alloc(obj);
+        item->name = json_dup(obj, key, keylen);
         item->namelen = keylen;
 
         item->valtype = 1;
@@ -1124,9 +1340,9 @@ void * json_add_obj (void * vobj, void * key, int keylen, uint8 isarr)
     }
     item->arrflag = isarr;
 
-    jval = json_value_alloc();
+    jval = json_obj_value_alloc(obj);
     jval->valtype = 1;
-    jval->jsonobj = json_init(obj->sptype, obj->cmtflag);
+    jval->jsonobj = json_obj_new_sub(obj);
 
     if (item->arrflag) {
         if (item->valnum == 0) {
@@ -1142,11 +1358,7 @@ void * json_add_obj (void * vobj, void * key, int keylen, uint8 isarr)
 
         item->valnum++;
     } else {
-        if (item->valnum == 1) {
-            json_value_free(item->valobj); 
-        } else if (item->valnum > 1) { 
-            arr_pop_free((arr_t *)item->valobj, json_value_free); 
-        }
+        json_item_values_free(obj, item);
         item->valobj = jval; 
         item->valnum = 1;
     }
@@ -1167,26 +1379,26 @@ void * json_add_obj_by_fca (void * vobj, void * fca, long keypos, int keylen, ui
          
     if (keylen <= 0) return NULL;
      
-    key = kzalloc(keylen + 1);
+    key = json_alloc(obj, keylen + 1);
     file_cache_seek(fca, keypos);
     file_cache_read(fca, key, keylen, 0);
 
     item = json_item_get(obj, key, keylen);
     if (!item) {
-        item = json_item_alloc();
+        item = json_obj_item_alloc(obj);
         item->name = key;
         item->namelen = keylen;
      
         item->valtype = 1;
         json_item_add(obj, key, keylen, item);
-    } else {
+    } else if (!obj->arena) {
         kfree(key);
     }
     item->arrflag = isarr;
  
-    jval = json_value_alloc();
+    jval = json_obj_value_alloc(obj);
     jval->valtype = 1;
-    jval->jsonobj = json_init(obj->sptype, obj->cmtflag);
+    jval->jsonobj = json_obj_new_sub(obj);
  
     if (item->arrflag) {
         if (item->valnum == 0) item->valobj = jval;
@@ -1200,10 +1412,7 @@ void * json_add_obj_by_fca (void * vobj, void * fca, long keypos, int keylen, ui
         }
         item->valnum++;
     } else {
-        if (item->valnum == 1) json_value_free(item->valobj);
-        else if (item->valnum > 1) {
-            arr_pop_free((arr_t *)item->valobj, json_value_free);
-        }
+        json_item_values_free(obj, item);
         item->valobj = jval;
         item->valnum = 1;
     }
@@ -1438,6 +1647,267 @@ uint8 * find_closed_script (uint8 * pbgn, uint8 * pend)
     return pkvend + 9;
 }
 
+/* strict JSON text is decoded via the structural index built by SIMD
+ * compares, instead of byte-by-byte skipping. the text that contains
+ * comments, scripts, single quotes or variables is left to json_decode */
+
+#define JSON_IDX_MINLEN  128
+
+typedef struct json_idx_ctx {
+    uint8    * pjson;
+    int        length;
+    uint32   * pos;
+    int        num;
+    int        iter;
+    int        strip;
+} JsonIdxCtx;
+
+#define jidx_ch(ctx, i)  ((ctx)->pjson[(ctx)->pos[i]])
+
+static int json_idx_raw (JsonIdxCtx * ctx, int from, int to, uint8 ** pval)
+{
+    uint8  * p = ctx->pjson;
+
+    while (from < to && ISSPACE(p[from])) from++;
+    while (to > from && ISSPACE(p[to-1])) to--;
+
+    *pval = p + from;
+    return to - from;
+}
+
+static int json_idx_decode_obj (JsonObj * obj, JsonIdxCtx * ctx, int start);
+
+static int json_idx_decode_arr (JsonObj * obj, JsonIdxCtx * ctx, uint8 * name, int namelen)
+{
+    JsonObj  * subobj = NULL;
+    uint8    * value = NULL;
+    int        valuelen = 0;
+    int        prev = 0;
+    uint8      zcopy = obj->arena ? 1 : 0;
+    uint8      c;
+
+    prev = ctx->pos[ctx->iter++] + 1;
+
+    while (ctx->iter < ctx->num) {
+        c = jidx_ch(ctx, ctx->iter);
+
+        switch (c) {
+        case '"':
+            if (ctx->iter + 1 >= ctx->num) return ctx->length;
+
+            value = ctx->pjson + ctx->pos[ctx->iter] + 1;
+            valuelen = ctx->pos[ctx->iter + 1] - ctx->pos[ctx->iter] - 1;
+            json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+
+            prev = ctx->pos[ctx->iter + 1] + 1;
+            ctx->iter += 2;
+            break;
+
+        case '{':
+            subobj = json_add_obj(obj, name, namelen, 1);
+            ctx->iter++;
+            prev = json_idx_decode_obj(subobj, ctx, ctx->pos[ctx->iter - 1] + 1);
+            break;
+
+        case '[':
+            prev = json_idx_decode_arr(obj, ctx, name, namelen);
+            break;
+
+        case ',':
+        case ']':
+        case '}':
+            valuelen = json_idx_raw(ctx, prev, ctx->pos[ctx->iter], &value);
+            if (valuelen > 0)
+                json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+
+            /* the closing brace of the parent object is left to its caller */
+            if (c == '}') return ctx->pos[ctx->iter];
+
+            prev = ctx->pos[ctx->iter++] + 1;
+            if (c == ']') return prev;
+            break;
+
+        default:
+            ctx->iter++;
+            break;
+        }
+    }
+
+    return ctx->length;
+}
+
+static int json_idx_decode_obj (JsonObj * obj, JsonIdxCtx * ctx, int start)
+{
+    JsonObj  * subobj = NULL;
+    uint8    * name = NULL;
+    int        namelen = 0;
+    uint8    * value = NULL;
+    int        valuelen = 0;
+    int        prev = start;
+    int        i, depth;
+    uint8      zcopy = obj->arena ? 1 : 0;
+    uint8      c;
+
+    while (ctx->iter < ctx->num) {
+        c = jidx_ch(ctx, ctx->iter);
+        if (c == '}') return ctx->pos[ctx->iter++] + 1;
+
+        /* key string or bare word ended by : , or } */
+        if (c == '"') {
+            if (ctx->iter + 1 >= ctx->num) return ctx->length;
+
+            name = ctx->pjson + ctx->pos[ctx->iter] + 1;
+            namelen = ctx->pos[ctx->iter + 1] - ctx->pos[ctx->iter] - 1;
+
+            ctx->iter += 2;
+            if (ctx->iter >= ctx->num) return ctx->length;
+            c = jidx_ch(ctx, ctx->iter);
+
+        } else {
+            namelen = json_idx_raw(ctx, prev, ctx->pos[ctx->iter], &name);
+        }
+
+        if (c == ',' || c == '}') {
+            /* key has no corresponding value followed */
+            if (namelen > 7 && str_ncasecmp(name, "include", 7) == 0 && ISSPACE(name[7])) {
+                valuelen = json_idx_raw(ctx, name + 7 - ctx->pjson, name + namelen - ctx->pjson, &value);
+                if (valuelen > 0)
+                    json_decode_file(obj, value, valuelen, 0, ctx->strip);
+
+            } else if (namelen > 0) {
+                json_add_value(obj, name, namelen, NULL, 0, 1, ctx->strip, zcopy);
+            }
+
+            if (c == ',') prev = ctx->pos[ctx->iter++] + 1;
+            continue;
+        }
+
+        if (c != ':' || namelen <= 0) {
+            prev = ctx->pos[ctx->iter++] + 1;
+            continue;
+        }
+
+        prev = ctx->pos[ctx->iter++] + 1;
+        if (ctx->iter >= ctx->num) {
+            valuelen = json_idx_raw(ctx, prev, ctx->length, &value);
+            json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+            return ctx->length;
+        }
+
+        c = jidx_ch(ctx, ctx->iter);
+
+        if (c == '"') {
+            if (ctx->iter + 1 >= ctx->num) return ctx->length;
+
+            value = ctx->pjson + ctx->pos[ctx->iter] + 1;
+            valuelen = ctx->pos[ctx->iter + 1] - ctx->pos[ctx->iter] - 1;
+            json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+
+            ctx->iter += 2;
+
+        } else if (c == '{' && namelen == 6 && str_ncasecmp(name, "script", 6) == 0) {
+            /* script = { ... }, the codes between braces are kept as value */
+            for (depth = 0, i = ctx->iter; i < ctx->num; i++) {
+                if (jidx_ch(ctx, i) == '{') depth++;
+                else if (jidx_ch(ctx, i) == '}' && --depth == 0) break;
+            }
+
+            valuelen = json_idx_raw(ctx, ctx->pos[ctx->iter] + 1,
+                                    i < ctx->num ? ctx->pos[i] : ctx->length, &value);
+            if (valuelen > 0)
+                json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+
+            ctx->iter = i < ctx->num ? i + 1 : i;
+
+        } else if (c == '{') {
+            subobj = json_add_obj(obj, name, namelen, 1);
+            ctx->iter++;
+            json_idx_decode_obj(subobj, ctx, ctx->pos[ctx->iter - 1] + 1);
+
+        } else if (c == '[') {
+            json_idx_decode_arr(obj, ctx, name, namelen);
+
+        } else {
+            /* bare value such as number, true, false, null, ended by , or } */
+            for (i = ctx->iter; i < ctx->num; i++) {
+                c = jidx_ch(ctx, i);
+                if (c == ',' || c == '}') break;
+            }
+
+            valuelen = json_idx_raw(ctx, prev, i < ctx->num ? ctx->pos[i] : ctx->length, &value);
+            json_add_value(obj, name, namelen, value, valuelen, 1, ctx->strip, zcopy);
+
+            ctx->iter = i;
+        }
+
+        /* skip anything left until the item separator */
+        while (ctx->iter < ctx->num) {
+            c = jidx_ch(ctx, ctx->iter);
+            if (c == '}') break;
+
+            prev = ctx->pos[ctx->iter++] + 1;
+            if (c == ',') break;
+        }
+    }
+
+    return ctx->length;
+}
+
+/* return -1 if the text is not strict JSON, caller falls back to byte scan */
+static int json_decode_index (JsonObj * obj, uint8 * pjson, int length, int findobjbgn, int strip)
+{
+    JsonIdxCtx   ctx;
+    uint32     * pos = NULL;
+    int          size = 0;
+    int          num = 0;
+    int          flag = 0;
+    int          start = 0;
+    int          ret = 0;
+
+    size = length / 4 + 64;
+    pos = kalloc(size * sizeof(uint32));
+    if (!pos) return -1;
+
+    num = json_index_build(pjson, length, pos, size, &flag);
+    if (num < 0) {
+        /* dense text, the number of offsets never exceeds length */
+        kfree(pos);
+        size = length + 1;
+        pos = kalloc(size * sizeof(uint32));
+        if (!pos) return -1;
+
+        num = json_index_build(pjson, length, pos, size, &flag);
+    }
+
+    if (num < 0 || flag != 0) {
+        kfree(pos);
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.pjson = pjson;
+    ctx.length = length;
+    ctx.pos = pos;
+    ctx.num = num;
+    ctx.strip = strip;
+
+    if (findobjbgn) {
+        while (ctx.iter < num && jidx_ch(&ctx, ctx.iter) != '{')
+            ctx.iter++;
+
+        if (ctx.iter >= num) {
+            kfree(pos);
+            return length;
+        }
+        start = pos[ctx.iter++] + 1;
+    }
+
+    ret = json_idx_decode_obj(obj, &ctx, start);
+
+    kfree(pos);
+    return ret;
+}
+
 int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int strip)
 {
     JsonObj  * obj = (JsonObj *)vobj;
@@ -1454,12 +1924,22 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
     int        namelen = 0;
     uint8    * value = NULL;
     int        valuelen = 0;
+    uint8      zcopy = 0;
+    int        ret = 0;
 
     if (!obj) return 0;
     if (!pjson) return 0;
     if (length < 0) length = str_len(pjson);
     if (length <= 0) return 0;
 
+    /* arena objects reference names and values in the input buffer */
+    zcopy = obj->arena ? 1 : 0;
+
+    if (obj->sptype == 0 && !obj->cmtflag && length >= JSON_IDX_MINLEN) {
+        ret = json_decode_index(obj, pjson, length, findobjbgn, strip);
+        if (ret >= 0) return ret;
+    }
+
     pbgn = pjson; pend = pbgn + length;
 
     if (findobjbgn) {
@@ -1480,7 +1960,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                 //find the \r\n
                 poct = skipTo(pbgn, pend-pbgn, "\r\n", 2);
                 if (obj->cmtflag > 1)
-                    json_add(obj, "cmt#", 4, pbgn, poct - pbgn, 1, 0);
+                    json_add_value(obj, "cmt#", 4, pbgn, poct - pbgn, 1, 0, zcopy);
     
                 pbgn = poct;
                 continue;
@@ -1500,12 +1980,12 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
     
                 if (poct >= pend - 1) {
                     if (obj->cmtflag > 1)
-                        json_add(obj, "cmt*", 4, pbgn, poct - pbgn, 1, 0);
+                        json_add_value(obj, "cmt*", 4, pbgn, poct - pbgn, 1, 0, zcopy);
                     pbgn = poct;
     
                 } else if (poct[0] == '*' && poct[1] == '/') {
                     if (obj->cmtflag > 1)
-                        json_add(obj, "cmt*", 4, pbgn, poct - pbgn, 1, 0);
+                        json_add_value(obj, "cmt*", 4, pbgn, poct - pbgn, 1, 0, zcopy);
                     pbgn = poct + 2;
                 }
                 continue;
@@ -1525,7 +2005,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
             valuelen = poct + 1 - value;
 
             if (valuelen > 0)
-                json_add(obj, name, namelen, value, valuelen, 1, strip);
+                json_add_value(obj, name, namelen, value, valuelen, 1, strip, zcopy);
 
             pbgn = pkvend;
             continue; 
@@ -1566,7 +2046,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                     valuelen = poct + 1 - value;
 
                     if (valuelen > 0)
-                        json_add(obj, name, namelen, value, valuelen, 1, strip);
+                        json_add_value(obj, name, namelen, value, valuelen, 1, strip, zcopy);
 
                     if (pbgn < pend && *pbgn == '}') {
                         pbgn++;
@@ -1605,7 +2085,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                         }
 
                         valuelen = poct - value + 1;
-                        json_add(obj, name, namelen, value, valuelen, 1, strip);
+                        json_add_value(obj, name, namelen, value, valuelen, 1, strip, zcopy);
 
                         poct = pkvend;
                     }
@@ -1616,7 +2096,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
 
                 value = poct;
                 valuelen = pkvend - value;
-                json_add(obj, name, namelen, value, valuelen, 1, strip);
+                json_add_value(obj, name, namelen, value, valuelen, 1, strip, zcopy);
 
                 pbgn = pkvend;
 
@@ -1642,7 +2122,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                 }
 
                 valuelen = poct - value + 1;
-                json_add(obj, name, namelen, value, valuelen, 1, strip);
+                json_add_value(obj, name, namelen, value, valuelen, 1, strip, zcopy);
 
                 pbgn = pkvend;
             }
@@ -1670,7 +2150,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                 json_decode_file(obj, pbgn,  poct + 1 - pbgn, 0, strip);
 
             } else {
-                json_add(obj, name, namelen, NULL, 0, 1, strip);
+                json_add_value(obj, name, namelen, NULL, 0, 1, strip, zcopy);
             }
             
             pbgn = pkvsep + 1;
@@ -1688,6 +2168,7 @@ int json_decode_file (void * vobj, void * fn, int fnlen, int findobjbgn, int str
     struct stat   st;
     int           fd;
     void        * pbyte = NULL;
+    void        * pjson = NULL;
     int           ret = 0;
 
     if (!obj) return -1;
@@ -1708,7 +2189,14 @@ int json_decode_file (void * vobj, void * fn, int fnlen, int findobjbgn, int str
         return -300;
     }
  
-    ret = json_decode(obj, pbyte, st.st_size, findobjbgn, strip);
+    if (obj->arena) {
+        /* zero-copy values reference the input, keep it alive in arena */
+        pjson = arena_alloc(obj->arena, st.st_size);
+        if (pjson) memcpy(pjson, pbyte, st.st_size);
+        ret = pjson ? json_decode(obj, pjson, st.st_size, findobjbgn, strip) : -400;
+    } else {
+        ret = json_decode(obj, pbyte, st.st_size, findobjbgn, strip);
+    }
  
     munmap(pbyte, st.st_size);
     close(fd);
@@ -1833,6 +2321,70 @@ long json_fca_decode (void * vobj, void * fca, long startpos, long length)
  
 
 
+/* exact size of json_encode output. the string value not shorter than refmin
+ * and needing no escape is referenced instead of copied, only its quotes are
+ * counted, refnum gets the number of such values */
+static int json_encoded_size (JsonObj * obj, int refmin, int * refnum)
+{
+    JsonItem  * item = NULL;
+    JsonValue * jval = NULL;
+    int         size = 0;
+    int         esclen = 0;
+    int         i, j, num;
+    uint8       needcomma = 0;
+
+    if (!obj) return 0;
+
+    size = 2;  //{ and }
+
+    num = ht_num(obj->objtab);
+    for (i = 0; i < num; i++) {
+        item = (JsonItem *)ht_value(obj->objtab, i);
+        if (!item || !item->name || item->namelen <= 0) continue;
+        if (item->valnum <= 0) continue;
+
+        if (needcomma) size += 2;
+        needcomma = 1;
+
+        size += item->namelen + 3;
+        if (item->arrflag && item->valnum > 1) size += 2;
+        if (item->valnum > 1) size += (item->valnum - 1) * 2;
+
+        for (j = 0; j < item->valnum; j++) {
+            if (item->valnum == 1)
+                jval = (JsonValue *)item->valobj;
+            else
+                jval = arr_value((arr_t *)item->valobj, j);
+            if (!jval) continue;
+
+            json_value_unescape(obj, jval);
+
+            if (jval->valtype != 0) {
+                size += json_encoded_size(jval->jsonobj, refmin, refnum);
+                continue;
+            }
+
+            size += 2;
+            if (!jval->value || jval->valuelen <= 0) continue;
+
+            esclen = json_escape(jval->value, jval->valuelen, NULL, 0);
+            if (refmin > 0 && jval->valuelen >= refmin && esclen == jval->valuelen) {
+                if (refnum) (*refnum)++;
+                continue;
+            }
+            size += esclen;
+        }
+    }
+
+    return size;
+}
+
+int json_encode_size (void * vobj)
+{
+    return json_encoded_size((JsonObj *)vobj, 0, NULL);
+}
+
+
 int json_value_encode (void * vjval, void * vjson, int len)
 {
     JsonValue * jval = (JsonValue *)vjval;
@@ -1912,7 +2464,10 @@ int json_encode (void * vobj, void * vjson, int len)
 
         if (item->valnum == 1) {
             jval = (JsonValue *)item->valobj;
-            if (jval) iter += json_value_encode(jval, pjson+iter, len-iter);
+            if (jval) {
+                json_value_unescape(obj, jval);
+                iter += json_value_encode(jval, pjson+iter, len-iter);
+            }
 
         } else {
             for (j = 0; j<item->valnum; j++) {
@@ -1922,7 +2477,10 @@ int json_encode (void * vobj, void * vjson, int len)
                 }
 
                 jval = arr_value((arr_t *)item->valobj, j);
-                if (jval) iter += json_value_encode(jval, pjson+iter, len-iter);
+                if (jval) {
+                    json_value_unescape(obj, jval);
+                    iter += json_value_encode(jval, pjson+iter, len-iter);
+                }
             }
         }
 
@@ -1968,64 +2526,210 @@ int json_value_encode2 (void * vjval, frame_p objfrm)
 }
 
 int json_encode2 (void * vobj, frame_p objfrm)
-{        
+{
     JsonObj   * obj = (JsonObj *)vobj;
-    JsonItem  * item = NULL; 
-    JsonValue * jval = NULL; 
+    int         size = 0;
     int         iter = 0;
-    int         i, num; 
-    int         j;
+
+    if (!obj || !objfrm) return 0;
+
+    /* size is computed exactly, frame grows once and is filled in one pass */
+    size = json_encode_size(obj);
+
+    if (frame_rest(objfrm) < size)
+        frame_grow(objfrm, size - frame_rest(objfrm));
+
+    iter = json_encode(obj, frame_end(objfrm), size);
+    frame_len_add(objfrm, iter);
+
+    return iter;
+}
+
+/* long string values are referenced by chunk entities or iovecs instead of
+ * being copied, which must be kept until the output is sent */
+#define JSON_ENC_REFMIN  512
+
+typedef struct json_enc_vec {
+    frame_p          frm;     //escaped text not referenced
+    int              mark;    //start of text which is not output yet
+
+    void           * chunk;
+    struct iovec   * iov;
+    int              iovmax;
+    int              iovcnt;
+} JsonEncVec;
+
+static int json_vec_flush (JsonEncVec * vec)
+{
+    int   len = frameL(vec->frm) - vec->mark;
+
+    if (len <= 0) return 0;
+
+    if (vec->chunk) {
+        if (chunk_add_buffer(vec->chunk, frameP(vec->frm), len) < 0)
+            return -1;
+
+        frame_empty(vec->frm);
+        vec->mark = 0;
+        return 0;
+    }
+
+    if (vec->iovcnt >= vec->iovmax) return -1;
+
+    vec->iov[vec->iovcnt].iov_base = (uint8 *)frameP(vec->frm) + vec->mark;
+    vec->iov[vec->iovcnt].iov_len = len;
+    vec->iovcnt++;
+
+    vec->mark = frameL(vec->frm);
+    return 0;
+}
+
+static int json_vec_ref (JsonEncVec * vec, void * pbyte, int len)
+{
+    if (json_vec_flush(vec) < 0) return -1;
+
+    if (vec->chunk)
+        return chunk_add_bufptr(vec->chunk, pbyte, len, NULL);
+
+    if (vec->iovcnt >= vec->iovmax) return -1;
+
+    vec->iov[vec->iovcnt].iov_base = pbyte;
+    vec->iov[vec->iovcnt].iov_len = len;
+    vec->iovcnt++;
+
+    return 0;
+}
+
+static int json_vec_encode (JsonObj * obj, JsonEncVec * vec)
+{
+    JsonItem  * item = NULL;
+    JsonValue * jval = NULL;
+    frame_p     frm = vec->frm;
+    int         esclen = 0;
+    int         i, j, num;
     uint8       needcomma = 0;
- 
-    if (!obj) return 0;
- 
-    frame_put_last(objfrm, '{'); iter++;
- 
-    num = ht_num(obj->objtab);
 
-    for (i = 0; i < num; i++) {
+    frame_put_last(frm, '{');
 
+    num = ht_num(obj->objtab);
+    for (i = 0; i < num; i++) {
         item = (JsonItem *)ht_value(obj->objtab, i);
         if (!item || !item->name || item->namelen <= 0) continue;
         if (item->valnum <= 0) continue;
- 
+
         if (needcomma) {
-            frame_put_last(objfrm, obj->itemsep);
-            frame_put_last(objfrm, ' ');
-            iter += 2;
+            frame_put_last(frm, obj->itemsep);
+            frame_put_last(frm, ' ');
         }
- 
-        frame_put_last(objfrm, '"'); iter++;
-        frame_put_nlast(objfrm, item->name, item->namelen); iter += item->namelen;
-        frame_put_last(objfrm, '"'); iter++;
-        frame_put_last(objfrm, obj->kvsep); iter++;
+        needcomma = 1;
 
-        if (item->arrflag && item->valnum > 1) {
-            frame_put_last(objfrm, '['); iter++;
-        }
+        frame_put_last(frm, '"');
+        frame_put_nlast(frm, item->name, item->namelen);
+        frame_put_last(frm, '"');
+        frame_put_last(frm, obj->kvsep);
 
-        if (item->valnum == 1) {
-            jval = (JsonValue *)item->valobj;
-            if (jval) iter += json_value_encode2(jval, objfrm);
+        if (item->arrflag && item->valnum > 1)
+            frame_put_last(frm, '[');
 
-        } else {
-            for (j = 0; j < item->valnum; j++) {
-                if (j > 0) { frame_append(objfrm, ", "); iter += 2; }
- 
+        for (j = 0; j < item->valnum; j++) {
+            if (j > 0) frame_append(frm, ", ");
+
+            if (item->valnum == 1)
+                jval = (JsonValue *)item->valobj;
+            else
                 jval = arr_value((arr_t *)item->valobj, j);
-                if (jval) iter += json_value_encode2(jval, objfrm);
+            if (!jval) continue;
+
+            json_value_unescape(obj, jval);
+
+            if (jval->valtype != 0) {
+                if (json_vec_encode(jval->jsonobj, vec) < 0) return -1;
+                continue;
             }
-        }
 
-        if (item->arrflag && item->valnum > 1) {
-            frame_put_last(objfrm, ']'); iter++;
+            frame_put_last(frm, '"');
+
+            if (jval->value && jval->valuelen > 0) {
+                esclen = json_escape(jval->value, jval->valuelen, NULL, 0);
+
+                if (jval->valuelen >= JSON_ENC_REFMIN && esclen == jval->valuelen) {
+                    if (json_vec_ref(vec, jval->value, jval->valuelen) < 0)
+                        return -1;
+                } else {
+                    frame_json_escape(jval->value, jval->valuelen, frm);
+                }
+            }
+
+            frame_put_last(frm, '"');
         }
- 
-        needcomma = 1;
+
+        if (item->arrflag && item->valnum > 1)
+            frame_put_last(frm, ']');
     }
- 
-    frame_put_last(objfrm, '}'); iter++;
 
-    return iter;
+    frame_put_last(frm, '}');
+
+    return 0;
 }
 
+/* append the encoded text to chunk, long values are added as buffer pointers
+ * referencing the object. return the number of bytes appended */
+long json_encode_chunk (void * vobj, void * chunk)
+{
+    JsonObj    * obj = (JsonObj *)vobj;
+    JsonEncVec   vec;
+    int64        size = 0;
+    int          ret = 0;
+
+    if (!obj) return -1;
+    if (!chunk) return -2;
+
+    memset(&vec, 0, sizeof(vec));
+    vec.chunk = chunk;
+    vec.frm = frame_new(4096);
+
+    size = chunk_size(chunk, 0);
+
+    ret = json_vec_encode(obj, &vec);
+    if (ret >= 0) ret = json_vec_flush(&vec);
+
+    frame_free(vec.frm);
+
+    if (ret < 0) return -100;
+
+    return chunk_size(chunk, 0) - size;
+}
+
+/* encode into frm and fill iov with the pieces of text in frm and the long
+ * values in object, for writev. frm is grown once to hold all the text.
+ * return the number of iovec used, or negative if iovmax is not enough */
+int json_encode_iovec (void * vobj, frame_p frm, void * iov, int iovmax)
+{
+    JsonObj    * obj = (JsonObj *)vobj;
+    JsonEncVec   vec;
+    int          size = 0;
+    int          refnum = 0;
+
+    if (!obj) return -1;
+    if (!frm || !iov || iovmax <= 0) return -2;
+
+    size = json_encoded_size(obj, JSON_ENC_REFMIN, &refnum);
+    if (iovmax < refnum * 2 + 1) return -100;
+
+    /* iov points into frm, which must not be reallocated while encoding */
+    if (frame_rest(frm) < size)
+        frame_grow(frm, size - frame_rest(frm));
+
+    memset(&vec, 0, sizeof(vec));
+    vec.frm = frm;
+    vec.mark = frameL(frm);
+    vec.iov = (struct iovec *)iov;
+    vec.iovmax = iovmax;
+
+    if (json_vec_encode(obj, &vec) < 0 || json_vec_flush(&vec) < 0)
+        return -101;
+
+    return vec.iovcnt;
+}
+
+
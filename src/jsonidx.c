@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "jsonidx.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+#define JIDX_OP      0x01
+#define JIDX_QUOTE   0x02
+#define JIDX_BSLASH  0x04
+#define JIDX_SPECIAL 0x08
+#define JIDX_OPEN    0x10
+#define JIDX_CLOSE   0x20
+
+typedef struct json_block_mask {
+    uint64   op;
+    uint64   open;     //{ [
+    uint64   close;    //} ]
+    uint64   quote;
+    uint64   bslash;
+    uint64   special;
+} JsonBlockMask;
+
+
+#if defined(__AVX2__)
+
+static inline uint32 jidx_eq32 (__m256i v, char c)
+{
+    return (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+static void jidx_block_mask (uint8 * p, JsonBlockMask * mask)
+{
+    __m256i   v;
+    uint64    m[6][2];
+    int       i;
+
+    for (i = 0; i < 2; i++) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+
+        m[4][i] = jidx_eq32(v, '{') | jidx_eq32(v, '[');
+        m[5][i] = jidx_eq32(v, '}') | jidx_eq32(v, ']');
+        m[0][i] = m[4][i] | m[5][i] | jidx_eq32(v, ':') | jidx_eq32(v, ',');
+        m[1][i] = jidx_eq32(v, '"');
+        m[2][i] = jidx_eq32(v, '\\');
+        m[3][i] = jidx_eq32(v, '\'') | jidx_eq32(v, '#') | jidx_eq32(v, '/') |
+                  jidx_eq32(v, '<') | jidx_eq32(v, '$');
+    }
+
+    mask->op = m[0][0] | (m[0][1] << 32);
+    mask->open = m[4][0] | (m[4][1] << 32);
+    mask->close = m[5][0] | (m[5][1] << 32);
+    mask->quote = m[1][0] | (m[1][1] << 32);
+    mask->bslash = m[2][0] | (m[2][1] << 32);
+    mask->special = m[3][0] | (m[3][1] << 32);
+}
+
+#elif defined(__SSE2__)
+
+static inline uint32 jidx_eq16 (__m128i v, char c)
+{
+    return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+static void jidx_block_mask (uint8 * p, JsonBlockMask * mask)
+{
+    __m128i   v;
+    uint64    op = 0, open = 0, close = 0, quote = 0, bslash = 0, special = 0;
+    uint32    ob, cb;
+    int       i;
+
+    for (i = 0; i < 4; i++) {
+        v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+
+        ob = jidx_eq16(v, '{') | jidx_eq16(v, '[');
+        cb = jidx_eq16(v, '}') | jidx_eq16(v, ']');
+        open |= (uint64)ob << (i * 16);
+        close |= (uint64)cb << (i * 16);
+        op |= (uint64)(ob | cb | jidx_eq16(v, ':') | jidx_eq16(v, ',')) << (i * 16);
+        quote |= (uint64)jidx_eq16(v, '"') << (i * 16);
+        bslash |= (uint64)jidx_eq16(v, '\\') << (i * 16);
+        special |= (uint64)(jidx_eq16(v, '\'') | jidx_eq16(v, '#') | jidx_eq16(v, '/') |
+                            jidx_eq16(v, '<') | jidx_eq16(v, '$')) << (i * 16);
+    }
+
+    mask->op = op;
+    mask->open = open;
+    mask->close = close;
+    mask->quote = quote;
+    mask->bslash = bslash;
+    mask->special = special;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+/* gather the high bits of 4 compare results into a 64-bit mask */
+static inline uint64 jidx_neon_mask (uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d)
+{
+    static const uint8 bitval[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t  bits = vld1q_u8(bitval);
+    uint8x16_t  s0, s1;
+
+    s0 = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    s1 = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+
+static void jidx_block_mask (uint8 * p, JsonBlockMask * mask)
+{
+    uint8x16_t  v[4];
+    uint8x16_t  r[6][4];
+    int         i;
+
+    for (i = 0; i < 4; i++) {
+        v[i] = vld1q_u8(p + i * 16);
+
+        r[4][i] = vorrq_u8(vceqq_u8(v[i], vdupq_n_u8('{')), vceqq_u8(v[i], vdupq_n_u8('[')));
+        r[5][i] = vorrq_u8(vceqq_u8(v[i], vdupq_n_u8('}')), vceqq_u8(v[i], vdupq_n_u8(']')));
+        r[0][i] = vorrq_u8(vorrq_u8(r[4][i], r[5][i]),
+                           vorrq_u8(vceqq_u8(v[i], vdupq_n_u8(':')), vceqq_u8(v[i], vdupq_n_u8(','))));
+        r[1][i] = vceqq_u8(v[i], vdupq_n_u8('"'));
+        r[2][i] = vceqq_u8(v[i], vdupq_n_u8('\\'));
+        r[3][i] = vorrq_u8(vorrq_u8(vceqq_u8(v[i], vdupq_n_u8('\'')), vceqq_u8(v[i], vdupq_n_u8('#'))),
+                  vorrq_u8(vorrq_u8(vceqq_u8(v[i], vdupq_n_u8('/')), vceqq_u8(v[i], vdupq_n_u8('<'))),
+                           vceqq_u8(v[i], vdupq_n_u8('$'))));
+    }
+
+    mask->op = jidx_neon_mask(r[0][0], r[0][1], r[0][2], r[0][3]);
+    mask->open = jidx_neon_mask(r[4][0], r[4][1], r[4][2], r[4][3]);
+    mask->close = jidx_neon_mask(r[5][0], r[5][1], r[5][2], r[5][3]);
+    mask->quote = jidx_neon_mask(r[1][0], r[1][1], r[1][2], r[1][3]);
+    mask->bslash = jidx_neon_mask(r[2][0], r[2][1], r[2][2], r[2][3]);
+    mask->special = jidx_neon_mask(r[3][0], r[3][1], r[3][2], r[3][3]);
+}
+
+#else
+
+static uint8 jidx_class[256];
+static int   jidx_class_init = 0;
+
+static void jidx_block_mask (uint8 * p, JsonBlockMask * mask)
+{
+    uint64   op = 0, open = 0, close = 0, quote = 0, bslash = 0, special = 0;
+    uint8    cls;
+    int      i;
+
+    if (!jidx_class_init) {
+        jidx_class['{'] = jidx_class['['] = JIDX_OP | JIDX_OPEN;
+        jidx_class['}'] = jidx_class[']'] = JIDX_OP | JIDX_CLOSE;
+        jidx_class[':'] = jidx_class[','] = JIDX_OP;
+        jidx_class['"'] = JIDX_QUOTE;
+        jidx_class['\\'] = JIDX_BSLASH;
+        jidx_class['\''] = jidx_class['#'] = jidx_class['/'] = JIDX_SPECIAL;
+        jidx_class['<'] = jidx_class['$'] = JIDX_SPECIAL;
+        jidx_class_init = 1;
+    }
+
+    for (i = 0; i < 64; i++) {
+        cls = jidx_class[p[i]];
+        if (!cls) continue;
+
+        if (cls & JIDX_OP) {
+            op |= 1ULL << i;
+            if (cls & JIDX_OPEN) open |= 1ULL << i;
+            else if (cls & JIDX_CLOSE) close |= 1ULL << i;
+        }
+        else if (cls & JIDX_QUOTE) quote |= 1ULL << i;
+        else if (cls & JIDX_BSLASH) bslash |= 1ULL << i;
+        else special |= 1ULL << i;
+    }
+
+    mask->op = op;
+    mask->open = open;
+    mask->close = close;
+    mask->quote = quote;
+    mask->bslash = bslash;
+    mask->special = special;
+}
+
+#endif
+
+
+/* bit i is set if the number of quotes in bits 0..i is odd */
+static inline uint64 jidx_prefix_xor (uint64 x)
+{
+#if defined(__PCLMUL__)
+    __m128i  v = _mm_set_epi64x(0, (long long)x);
+
+    v = _mm_clmulepi64_si128(v, _mm_set1_epi8((char)0xFF), 0);
+    return (uint64)_mm_cvtsi128_si64(v);
+#else
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+#endif
+}
+
+/* set the bits of chars preceded by an odd sequence of backslashes.
+ * the carry holds whether the first char of next block is escaped */
+static inline uint64 jidx_escaped (uint64 bslash, uint64 * carry)
+{
+    static const uint64 even = 0x5555555555555555ULL;
+    uint64  follows, oddstart, evenseq;
+    uint64  prev = *carry;
+
+    bslash &= ~prev;
+    follows = (bslash << 1) | prev;
+
+    oddstart = bslash & ~even & ~follows;
+    evenseq = oddstart + bslash;
+    *carry = (evenseq < bslash) ? 1 : 0;
+
+    return (even ^ (evenseq << 1)) & follows;
+}
+
+static inline int jidx_ctz (uint64 mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int n = 0;
+    while ((mask & 1) == 0) { mask >>= 1; n++; }
+    return n;
+#endif
+}
+
+static inline int jidx_popcnt (uint64 mask)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(mask);
+#else
+    int n = 0;
+    for ( ; mask; mask &= mask - 1) n++;
+    return n;
+#endif
+}
+
+
+int json_index_build (void * vjson, int length, uint32 * pos, int size, int * flag)
+{
+    uint8         * pjson = (uint8 *)vjson;
+    uint8           tail[64];
+    uint8         * p = NULL;
+    JsonBlockMask   mask;
+    uint64          esc_carry = 0;
+    uint64          instr_carry = 0;
+    uint64          quote, instr, bits;
+    int             iter, rest;
+    int             num = 0;
+    int             ret = 0;
+
+    if (flag) *flag = 0;
+
+    if (!pjson || length <= 0) return 0;
+    if (!pos || size <= 0) return -1;
+
+    for (iter = 0; iter < length; iter += 64) {
+        rest = length - iter;
+        if (rest >= 64) {
+            p = pjson + iter;
+        } else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, pjson + iter, rest);
+            p = tail;
+        }
+
+        jidx_block_mask(p, &mask);
+
+        quote = mask.quote & ~jidx_escaped(mask.bslash, &esc_carry);
+
+        /* opening quote and string content are set, closing quote is not */
+        instr = jidx_prefix_xor(quote) ^ instr_carry;
+        instr_carry = (uint64)((sint64)instr >> 63);
+
+        bits = (mask.op & ~instr) | quote;
+
+        if (mask.special & ~instr) ret |= JSON_IDX_SPECIAL;
+
+        if (num + 64 > size) {
+            /* slow path near the end of pos array */
+            while (bits) {
+                if (num >= size) return -1;
+                pos[num++] = iter + jidx_ctz(bits);
+                bits &= bits - 1;
+            }
+            continue;
+        }
+
+        while (bits) {
+            pos[num++] = iter + jidx_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+
+    if (instr_carry) ret |= JSON_IDX_UNCLOSED;
+    if (flag) *flag = ret;
+
+    return num;
+}
+
+
+int json_index_skip (void * vjson, int length, int pos, int depth)
+{
+    uint8         * pjson = (uint8 *)vjson;
+    uint8           tail[64];
+    uint8         * p = NULL;
+    JsonBlockMask   mask;
+    uint64          esc_carry = 0;
+    uint64          instr_carry = 0;
+    uint64          quote, instr, open, close, bits;
+    int             iter, rest, cnt;
+
+    if (!pjson || pos < 0 || depth <= 0) return -1;
+
+    for (iter = pos; iter < length; iter += 64) {
+        rest = length - iter;
+        if (rest >= 64) {
+            p = pjson + iter;
+        } else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, pjson + iter, rest);
+            p = tail;
+        }
+
+        jidx_block_mask(p, &mask);
+
+        quote = mask.quote & ~jidx_escaped(mask.bslash, &esc_carry);
+        instr = jidx_prefix_xor(quote) ^ instr_carry;
+        instr_carry = (uint64)((sint64)instr >> 63);
+
+        open = mask.open & ~instr;
+        close = mask.close & ~instr;
+
+        /* the depth can only drop to 0 in a block with enough closings,
+         * otherwise the block is passed by counting its bits */
+        cnt = jidx_popcnt(close);
+        if (cnt < depth) {
+            depth += jidx_popcnt(open) - cnt;
+            continue;
+        }
+
+        for (bits = open | close; bits; bits &= bits - 1) {
+            if (close & bits & (~bits + 1)) {
+                if (--depth == 0) return iter + jidx_ctz(bits) + 1;
+            } else {
+                depth++;
+            }
+        }
+    }
+
+    return -1;
+}
+
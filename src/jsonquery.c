@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "filecache.h"
+#include "jsonidx.h"
+#include "jsonquery.h"
+
+#define JQ_KEY       0
+#define JQ_INDEX     1
+
+#define JQ_READBUF   65536
+
+typedef struct json_query_step {
+    uint8     type;
+    uint8   * name;
+    int       namelen;
+    int       index;
+} JQStep;
+
+typedef struct json_query_path {
+    uint8   * text;
+    JQStep    step[JSON_QUERY_MAXSTEP];
+    int       num;
+
+    int       type;
+    int       offset;
+    int       length;
+} JQPath;
+
+typedef struct json_query {
+    JQPath  * path[JSON_QUERY_MAXPATH];
+    int       num;
+    uint64    all;
+    uint64    found;
+
+    /* the step of each path to be applied to the value being visited */
+    uint8     cur[JSON_QUERY_MAXPATH];
+
+    uint8   * pjson;
+    int       length;
+    int       partial;  //more text follows length
+    long      base;
+
+    uint8   * buf;
+    int       bufsize;
+} JsonQuery;
+
+
+static inline int jq_ctz (uint64 mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int n = 0;
+    while ((mask & 1) == 0) { mask >>= 1; n++; }
+    return n;
+#endif
+}
+
+static inline int jq_ws (uint8 * p, int len, int pos)
+{
+    while (pos < len && (p[pos] == ' ' || p[pos] == '\t' || p[pos] == '\r' || p[pos] == '\n'))
+        pos++;
+    return pos;
+}
+
+/* pos is at the opening quote, return the offset after the closing one */
+static int jq_string_end (uint8 * p, int len, int pos)
+{
+    uint8  * q = NULL;
+    int      i;
+
+    for (pos++; pos < len; pos = q - p + 1) {
+        q = memchr(p + pos, '"', len - pos);
+        if (!q) break;
+
+        for (i = 0; q - i > p + pos && q[-i - 1] == '\\'; i++);
+        if ((i & 1) == 0) return q - p + 1;
+    }
+
+    return -1;
+}
+
+static int jq_scalar_end (JsonQuery * q, int pos)
+{
+    uint8  * p = q->pjson;
+    int      start = pos;
+
+    for ( ; pos < q->length; pos++) {
+        if (p[pos] == ',' || p[pos] == '}' || p[pos] == ']' || p[pos] == ':' ||
+            p[pos] == ' ' || p[pos] == '\t' || p[pos] == '\r' || p[pos] == '\n')
+            break;
+    }
+
+    /* the number may go on in the text not read yet */
+    if (pos == q->length && q->partial) return -1;
+
+    return pos > start ? pos : -2;
+}
+
+static int jq_skip (JsonQuery * q, int pos)
+{
+    pos = jq_ws(q->pjson, q->length, pos);
+    if (pos >= q->length) return -1;
+
+    switch (q->pjson[pos]) {
+    case '{':
+    case '[':
+        return json_index_skip(q->pjson, q->length, pos + 1, 1);
+    case '"':
+        return jq_string_end(q->pjson, q->length, pos);
+    case '}':
+    case ']':
+    case ',':
+    case ':':
+        return -2;
+    }
+
+    return jq_scalar_end(q, pos);
+}
+
+static int jq_visit (JsonQuery * q, int pos, uint64 mask);
+
+static int jq_object (JsonQuery * q, int pos, uint64 mask)
+{
+    uint8   * p = q->pjson;
+    int       len = q->length;
+    JQStep  * st = NULL;
+    uint8   * key = NULL;
+    int       keylen = 0;
+    uint64    sub, m;
+    int       k;
+
+    pos = jq_ws(p, len, pos + 1);
+    if (pos >= len) return -1;
+    if (p[pos] == '}') return pos + 1;
+
+    for (;;) {
+        if (p[pos] != '"') return -2;
+
+        key = p + pos + 1;
+        pos = jq_string_end(p, len, pos);
+        if (pos < 0) return pos;
+        keylen = p + pos - 1 - key;
+
+        pos = jq_ws(p, len, pos);
+        if (pos >= len) return -1;
+        if (p[pos++] != ':') return -2;
+
+        for (sub = 0, m = mask & ~q->found; m; m &= m - 1) {
+            k = jq_ctz(m);
+            st = &q->path[k]->step[q->cur[k]];
+            if (st->namelen == keylen && memcmp(st->name, key, keylen) == 0)
+                sub |= 1ULL << k;
+        }
+
+        if (sub) {
+            for (m = sub; m; m &= m - 1) q->cur[jq_ctz(m)]++;
+            pos = jq_visit(q, pos, sub);
+            for (m = sub; m; m &= m - 1) q->cur[jq_ctz(m)]--;
+        } else {
+            pos = jq_skip(q, pos);
+        }
+        if (pos < 0) return pos;
+        if (q->found == q->all) return pos;
+
+        pos = jq_ws(p, len, pos);
+        if (pos >= len) return -1;
+
+        if (p[pos] == '}') return pos + 1;
+        if (p[pos++] != ',') return -2;
+
+        /* no path waits in the rest of object */
+        if ((mask & ~q->found) == 0)
+            return json_index_skip(p, len, pos, 1);
+
+        pos = jq_ws(p, len, pos);
+        if (pos >= len) return -1;
+    }
+}
+
+static int jq_array (JsonQuery * q, int pos, uint64 mask)
+{
+    uint8   * p = q->pjson;
+    int       len = q->length;
+    uint64    sub, rest, m;
+    int       i, k, index;
+
+    pos = jq_ws(p, len, pos + 1);
+    if (pos >= len) return -1;
+    if (p[pos] == ']') return pos + 1;
+
+    for (i = 0; ; i++) {
+        for (sub = rest = 0, m = mask & ~q->found; m; m &= m - 1) {
+            k = jq_ctz(m);
+            index = q->path[k]->step[q->cur[k]].index;
+            if (index == i) sub |= 1ULL << k;
+            else if (index > i) rest |= 1ULL << k;
+        }
+
+        if (sub) {
+            for (m = sub; m; m &= m - 1) q->cur[jq_ctz(m)]++;
+            pos = jq_visit(q, pos, sub);
+            for (m = sub; m; m &= m - 1) q->cur[jq_ctz(m)]--;
+        } else {
+            pos = jq_skip(q, pos);
+        }
+        if (pos < 0) return pos;
+        if (q->found == q->all) return pos;
+
+        pos = jq_ws(p, len, pos);
+        if (pos >= len) return -1;
+
+        if (p[pos] == ']') return pos + 1;
+        if (p[pos++] != ',') return -2;
+
+        /* no path waits for the elements after i */
+        if ((rest & ~q->found) == 0)
+            return json_index_skip(p, len, pos, 1);
+    }
+}
+
+/* mask holds the paths led to the value at pos, each one is to apply its
+ * step cur[k] to the value, or ends there if all steps are matched */
+static int jq_visit (JsonQuery * q, int pos, uint64 mask)
+{
+    uint8    save[JSON_QUERY_MAXPATH];
+    uint8  * p = q->pjson;
+    JQPath * path = NULL;
+    JQStep * st = NULL;
+    uint64   want = 0, live = 0, m;
+    uint8    c;
+    int      k, end, type;
+
+    pos = jq_ws(p, q->length, pos);
+    if (pos >= q->length) return -1;
+
+    c = p[pos];
+
+    for (m = mask; m; m &= m - 1) {
+        k = jq_ctz(m);
+        path = q->path[k];
+        save[k] = q->cur[k];
+
+        /* [0] on a value other than array is the value itself */
+        for ( ; q->cur[k] < path->num; q->cur[k]++) {
+            st = &path->step[q->cur[k]];
+            if (st->type != JQ_INDEX || st->index != 0 || c == '[') break;
+        }
+
+        if (q->cur[k] == path->num) {
+            want |= 1ULL << k;
+        } else if ((c == '{' && st->type == JQ_KEY) || (c == '[' && st->type == JQ_INDEX)) {
+            live |= 1ULL << k;
+        }
+    }
+
+    if (c == '{') {
+        type = JSON_QUERY_OBJECT;
+        end = live ? jq_object(q, pos, live) : json_index_skip(p, q->length, pos + 1, 1);
+    } else if (c == '[') {
+        type = JSON_QUERY_ARRAY;
+        end = live ? jq_array(q, pos, live) : json_index_skip(p, q->length, pos + 1, 1);
+    } else if (c == '"') {
+        type = JSON_QUERY_STRING;
+        end = jq_string_end(p, q->length, pos);
+    } else if (c == '}' || c == ']' || c == ',' || c == ':') {
+        type = JSON_QUERY_NONE;
+        end = -2;
+    } else {
+        type = JSON_QUERY_SCALAR;
+        end = jq_scalar_end(q, pos);
+    }
+
+    for (m = mask; m; m &= m - 1) {
+        k = jq_ctz(m);
+        q->cur[k] = save[k];
+    }
+
+    if (end < 0) return end;
+
+    for (m = want; m; m &= m - 1) {
+        path = q->path[jq_ctz(m)];
+        path->type = type;
+        path->offset = pos;
+        path->length = end - pos;
+        if (type == JSON_QUERY_STRING) {
+            path->offset++;
+            path->length -= 2;
+        }
+    }
+    q->found |= want;
+
+    return end;
+}
+
+static int jq_exec (JsonQuery * q, uint8 * pjson, int length)
+{
+    int  i, ret;
+
+    q->pjson = pjson;
+    q->length = length;
+    q->found = 0;
+
+    for (i = 0; i < q->num; i++) {
+        q->cur[i] = 0;
+        q->path[i]->type = JSON_QUERY_NONE;
+        q->path[i]->offset = -1;
+        q->path[i]->length = 0;
+    }
+
+    if (q->num <= 0 || !pjson || length <= 0) return 0;
+
+    ret = jq_visit(q, 0, q->all);
+    if (ret < 0 && q->found != q->all) return ret;
+
+    for (i = ret = 0; i < q->num; i++) {
+        if (q->found & (1ULL << i)) ret++;
+    }
+
+    return ret;
+}
+
+
+void * json_query_compile (char * paths, int len)
+{
+    JsonQuery * q = NULL;
+    int         i, start, quote = 0;
+
+    q = kzalloc(sizeof(*q));
+    if (!q) return NULL;
+
+    if (!paths) return q;
+    if (len < 0) len = strlen(paths);
+
+    for (i = start = 0; i <= len; i++) {
+        if (i < len && quote) {
+            if (paths[i] == quote) quote = 0;
+            continue;
+        }
+        if (i < len && (paths[i] == '"' || paths[i] == '\'')) {
+            quote = paths[i];
+            continue;
+        }
+        if (i < len && paths[i] != ',') continue;
+
+        while (start < i && (paths[start] == ' ' || paths[start] == '\t')) start++;
+
+        if (json_query_add(q, paths + start, i - start) < 0) {
+            json_query_free(q);
+            return NULL;
+        }
+        start = i + 1;
+    }
+
+    return q;
+}
+
+void json_query_free (void * vq)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+    int         i;
+
+    if (!q) return;
+
+    for (i = 0; i < q->num; i++) {
+        kfree(q->path[i]->text);
+        kfree(q->path[i]);
+    }
+
+    if (q->buf) kfree(q->buf);
+
+    kfree(q);
+}
+
+/* http.server.location[0].errpage.504 */
+int json_query_add (void * vq, char * vpath, int len)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+    JQPath    * path = NULL;
+    JQStep    * st = NULL;
+    uint8     * p = NULL;
+    uint8     * name = NULL;
+    int         i, namelen, nsteps, index;
+
+    if (!q) return -1;
+    if (!vpath) return -2;
+    if (len < 0) len = strlen(vpath);
+
+    while (len > 0 && (vpath[len - 1] == ' ' || vpath[len - 1] == '\t')) len--;
+    if (len <= 0) return -3;
+
+    if (q->num >= JSON_QUERY_MAXPATH) return -4;
+
+    path = kzalloc(sizeof(*path));
+    if (!path) return -5;
+
+    path->text = p = kalloc(len + 1);
+    if (!p) {
+        kfree(path);
+        return -5;
+    }
+    memcpy(p, vpath, len);
+    p[len] = '\0';
+
+    for (i = 0; i < len; ) {
+        nsteps = path->num;
+
+        if (p[i] == '"' || p[i] == '\'') {
+            name = p + i + 1;
+            for (i++; i < len && p[i] != name[-1]; i++);
+            if (i >= len) goto badpath;
+            namelen = p + i - name;
+            i++;
+        } else {
+            name = p + i;
+            for ( ; i < len && p[i] != '.' && p[i] != '['; i++);
+            namelen = p + i - name;
+        }
+
+        if (namelen > 0) {
+            if (path->num >= JSON_QUERY_MAXSTEP) goto badpath;
+            st = &path->step[path->num++];
+            st->type = JQ_KEY;
+            st->name = name;
+            st->namelen = namelen;
+        }
+
+        while (i < len && p[i] == '[') {
+            for (i++, index = 0; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+                index = index * 10 + p[i] - '0';
+                if (index > 0x7FFFFFF) goto badpath;
+            }
+            if (i >= len || p[i] != ']' || p[i - 1] == '[') goto badpath;
+            i++;
+
+            if (path->num >= JSON_QUERY_MAXSTEP) goto badpath;
+            st = &path->step[path->num++];
+            st->type = JQ_INDEX;
+            st->index = index;
+        }
+
+        if (path->num == nsteps) goto badpath;
+
+        if (i < len) {
+            if (p[i] != '.' || i + 1 >= len) goto badpath;
+            i++;
+        }
+    }
+
+    path->type = JSON_QUERY_NONE;
+    path->offset = -1;
+
+    q->path[q->num] = path;
+    q->all |= 1ULL << q->num;
+
+    return q->num++;
+
+badpath:
+    kfree(path->text);
+    kfree(path);
+    return -10;
+}
+
+int json_query_num (void * vq)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+
+    if (!q) return 0;
+
+    return q->num;
+}
+
+int json_query_exec (void * vq, void * pjson, int length)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+
+    if (!q) return -1;
+
+    q->partial = 0;
+    q->base = 0;
+
+    return jq_exec(q, (uint8 *)pjson, length);
+}
+
+long json_query_fca (void * vq, void * fca, long startpos, long length)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+    uint8     * p = NULL;
+    long        fsize = 0;
+    long        size = 0;
+    long        got = 0;
+    int         ret = 0;
+
+    if (!q) return -1;
+    if (!fca) return -2;
+
+    q->partial = 0;
+    q->base = startpos;
+
+    fsize = file_cache_filesize(fca);
+    if (startpos < 0 || startpos >= fsize) return jq_exec(q, NULL, 0);
+    if (length < 0 || startpos + length > fsize) length = fsize - startpos;
+    if (length > 0x7FFFFFFF) length = 0x7FFFFFFF;
+
+    file_cache_seek(fca, startpos);
+
+    /* read twice as much each round and rescan, the scan is done again
+     * only when the paths are not all found in the text read so far */
+    for (size = min(length, JQ_READBUF); ; size = min(length, size * 2)) {
+        if (size > q->bufsize) {
+            p = krealloc(q->buf, size);
+            if (!p) return -5;
+            q->buf = p;
+            q->bufsize = size;
+        }
+
+        while (got < size) {
+            ret = file_cache_read(fca, q->buf + got, size - got, 0);
+            if (ret <= 0) break;
+            got += ret;
+        }
+        if (got < size) length = size = got;
+
+        q->partial = got < length;
+
+        ret = jq_exec(q, q->buf, got);
+        if (ret != -1 || !q->partial) return ret;
+    }
+}
+
+int json_query_get (void * vq, int i, void ** pval, int * vallen)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+    JQPath    * path = NULL;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!q || i < 0 || i >= q->num) return JSON_QUERY_NONE;
+
+    path = q->path[i];
+    if (path->type == JSON_QUERY_NONE) return JSON_QUERY_NONE;
+
+    if (pval) *pval = q->pjson + path->offset;
+    if (vallen) *vallen = path->length;
+
+    return path->type;
+}
+
+long json_query_offset (void * vq, int i)
+{
+    JsonQuery * q = (JsonQuery *)vq;
+
+    if (!q || i < 0 || i >= q->num) return -1;
+
+    if (q->path[i]->type == JSON_QUERY_NONE) return -1;
+
+    return q->base + q->path[i]->offset;
+}
+
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "strutil.h"
+#include "dynarr.h"
+#include "frame.h"
+#include "filecache.h"
+#include "chunk.h"
+#include "jsonsax.h"
+
+#define SAX_TOP      0   //before a top-level value
+#define SAX_KEY      1   //in object, expecting key or }
+#define SAX_COLON    2   //after key, expecting :
+#define SAX_VALUE    3   //expecting a value
+#define SAX_AFTER    4   //after value, expecting , or closing bracket
+#define SAX_STRING   5
+#define SAX_BARE     6   //number, true, false, null
+
+#define SAX_READBUF  16384
+
+typedef struct json_sax {
+    JsonSaxCB  * cb;
+    void       * para;
+    uint8        strip;
+
+    uint8        state;
+    uint8        strkey;   //the string being scanned is a key
+    uint8        esc;      //last byte of previous piece is a backslash
+    uint8        hasesc;
+    uint8        intok;    //token content is accumulated in tokfrm
+
+    int          depth;
+    uint8        stack[JSON_SAX_MAXDEPTH];
+
+    frame_p      tokfrm;
+    frame_p      keyfrm;
+    frame_p      outfrm;
+
+    int64        offset;
+    int          error;
+} JsonSax;
+
+
+void * json_sax_new (JsonSaxCB * cb, void * para, int strip)
+{
+    JsonSax * sax = NULL;
+
+    if (!cb) return NULL;
+
+    sax = kzalloc(sizeof(*sax));
+    if (!sax) return NULL;
+
+    sax->cb = cb;
+    sax->para = para;
+    sax->strip = strip ? 1 : 0;
+
+    sax->tokfrm = frame_new(256);
+    sax->keyfrm = frame_new(128);
+    sax->outfrm = frame_new(256);
+
+    return sax;
+}
+
+void json_sax_free (void * vsax)
+{
+    JsonSax * sax = (JsonSax *)vsax;
+
+    if (!sax) return;
+
+    frame_free(sax->tokfrm);
+    frame_free(sax->keyfrm);
+    frame_free(sax->outfrm);
+
+    kfree(sax);
+}
+
+void json_sax_reset (void * vsax)
+{
+    JsonSax * sax = (JsonSax *)vsax;
+
+    if (!sax) return;
+
+    sax->state = SAX_TOP;
+    sax->strkey = 0;
+    sax->esc = 0;
+    sax->hasesc = 0;
+    sax->intok = 0;
+    sax->depth = 0;
+    sax->offset = 0;
+    sax->error = 0;
+
+    frame_empty(sax->tokfrm);
+    frame_empty(sax->keyfrm);
+    frame_empty(sax->outfrm);
+}
+
+int64 json_sax_offset (void * vsax)
+{
+    JsonSax * sax = (JsonSax *)vsax;
+
+    if (!sax) return 0;
+
+    return sax->offset;
+}
+
+
+static int sax_emit (JsonSax * sax, int event, uint8 * val, int vallen, int quoted)
+{
+    uint8  * key = NULL;
+    int      keylen = 0;
+    int      depth = sax->depth;
+
+    if (event == JSON_SAX_OBJ_END || event == JSON_SAX_ARR_END)
+        depth--;
+
+    /* key belongs to the token whose enclosing container is an object */
+    if (event != JSON_SAX_OBJ_END && event != JSON_SAX_ARR_END && event != JSON_SAX_DOC_END &&
+        depth > 0 && sax->stack[depth - 1] == '{')
+    {
+        key = frameP(sax->keyfrm);
+        keylen = frameL(sax->keyfrm);
+    }
+
+    return (*sax->cb)(sax->para, event, depth, key, keylen, val, vallen, quoted);
+}
+
+static int sax_value_end (JsonSax * sax)
+{
+    if (sax->depth > 0) {
+        sax->state = SAX_AFTER;
+        return 0;
+    }
+
+    sax->state = SAX_TOP;
+    return sax_emit(sax, JSON_SAX_DOC_END, NULL, 0, 0);
+}
+
+static int sax_push (JsonSax * sax, uint8 type)
+{
+    int ret = 0;
+
+    if (sax->depth >= JSON_SAX_MAXDEPTH) return -11;
+
+    ret = sax_emit(sax, type == '{' ? JSON_SAX_OBJ_BEGIN : JSON_SAX_ARR_BEGIN, NULL, 0, 0);
+    if (ret < 0) return ret;
+
+    sax->stack[sax->depth++] = type;
+    sax->state = (type == '{') ? SAX_KEY : SAX_VALUE;
+
+    return 0;
+}
+
+static int sax_pop (JsonSax * sax, uint8 type)
+{
+    int ret = 0;
+
+    if (sax->depth <= 0 || sax->stack[sax->depth - 1] != type)
+        return -10;
+
+    ret = sax_emit(sax, type == '{' ? JSON_SAX_OBJ_END : JSON_SAX_ARR_END, NULL, 0, 0);
+    if (ret < 0) return ret;
+
+    sax->depth--;
+
+    return sax_value_end(sax);
+}
+
+static int sax_token_add (JsonSax * sax, uint8 * p, int len)
+{
+    if (len <= 0) return 0;
+
+    if (frameL(sax->tokfrm) + len > JSON_SAX_MAXTOKEN)
+        return -12;
+
+    frame_put_nlast(sax->tokfrm, p, len);
+    sax->intok = 1;
+
+    return 0;
+}
+
+static int sax_string_end (JsonSax * sax, uint8 * p, int len)
+{
+    frame_p   frm = NULL;
+    int       ret = 0;
+
+    frm = sax->strkey ? sax->keyfrm : sax->outfrm;
+
+    if (sax->strkey || (sax->strip && sax->hasesc)) {
+        frame_empty(frm);
+
+        if (sax->strip && sax->hasesc) {
+            if (frame_rest(frm) < len + 1) frame_grow(frm, len + 1);
+            frame_len_add(frm, json_strip(p, len, frame_end(frm), len));
+        } else {
+            frame_put_nlast(frm, p, len);
+        }
+
+        p = frameP(frm);
+        len = frameL(frm);
+    }
+
+    if (sax->strkey) {
+        sax->state = SAX_COLON;
+        return 0;
+    }
+
+    ret = sax_emit(sax, JSON_SAX_VALUE, p, len, 1);
+    if (ret < 0) return ret;
+
+    return sax_value_end(sax);
+}
+
+static int sax_start (JsonSax * sax, uint8 c)
+{
+    switch (c) {
+    case '{':
+    case '[':
+        return sax_push(sax, c);
+
+    case ']':
+        /* empty array or trailing comma */
+        return sax_pop(sax, '[');
+
+    case '}':
+        return sax_pop(sax, '{');
+
+    case '"':
+        sax->strkey = 0;
+        sax->state = SAX_STRING;
+        return 0;
+
+    case ',':
+    case ':':
+        return -10;
+    }
+
+    sax->state = SAX_BARE;
+    return 0;
+}
+
+#define SAX_ISBAREEND(c) (ISSPACE(c) || (c) == ',' || (c) == '}' || (c) == ']' || (c) == ':')
+
+int json_sax_feed (void * vsax, void * pbyte, int len)
+{
+    JsonSax  * sax = (JsonSax *)vsax;
+    uint8    * p = (uint8 *)pbyte;
+    uint8    * tok = NULL;
+    int        toklen = 0;
+    int        tokstart = 0;
+    int        i = 0;
+    int        ret = 0;
+    uint8      c;
+
+    if (!sax) return -1;
+    if (sax->error < 0) return sax->error;
+    if (!p || len <= 0) return 0;
+
+    while (i < len) {
+        switch (sax->state) {
+        case SAX_STRING:
+            for (tokstart = i; i < len; i++) {
+                c = p[i];
+                if (sax->esc) { sax->esc = 0; continue; }
+                if (c == '\\') { sax->esc = 1; sax->hasesc = 1; continue; }
+                if (c == '"') break;
+            }
+
+            if (i >= len) {
+                ret = sax_token_add(sax, p + tokstart, len - tokstart);
+                break;
+            }
+
+            if (sax->intok) {
+                ret = sax_token_add(sax, p + tokstart, i - tokstart);
+                tok = frameP(sax->tokfrm);
+                toklen = frameL(sax->tokfrm);
+            } else {
+                tok = p + tokstart;
+                toklen = i - tokstart;
+            }
+            i++;
+
+            if (ret >= 0) ret = sax_string_end(sax, tok, toklen);
+
+            frame_empty(sax->tokfrm);
+            sax->intok = 0;
+            sax->hasesc = 0;
+            break;
+
+        case SAX_BARE:
+            for (tokstart = i; i < len && !SAX_ISBAREEND(p[i]); i++);
+
+            if (i >= len) {
+                ret = sax_token_add(sax, p + tokstart, len - tokstart);
+                break;
+            }
+
+            if (sax->intok) {
+                ret = sax_token_add(sax, p + tokstart, i - tokstart);
+                tok = frameP(sax->tokfrm);
+                toklen = frameL(sax->tokfrm);
+            } else {
+                tok = p + tokstart;
+                toklen = i - tokstart;
+            }
+
+            if (ret >= 0) ret = sax_emit(sax, JSON_SAX_VALUE, tok, toklen, 0);
+            if (ret >= 0) ret = sax_value_end(sax);
+
+            frame_empty(sax->tokfrm);
+            sax->intok = 0;
+            break;
+
+        default:
+            c = p[i++];
+            if (ISSPACE(c)) continue;
+
+            if (sax->state == SAX_TOP || sax->state == SAX_VALUE) {
+                ret = sax_start(sax, c);
+                if (sax->state == SAX_BARE) i--;
+
+            } else if (sax->state == SAX_KEY) {
+                if (c == '"') {
+                    sax->strkey = 1;
+                    sax->state = SAX_STRING;
+                } else if (c == '}') {
+                    ret = sax_pop(sax, '{');
+                } else {
+                    ret = -10;
+                }
+
+            } else if (sax->state == SAX_COLON) {
+                if (c == ':') sax->state = SAX_VALUE;
+                else ret = -10;
+
+            } else { //SAX_AFTER
+                if (c == ',') {
+                    sax->state = (sax->stack[sax->depth - 1] == '{') ? SAX_KEY : SAX_VALUE;
+                } else if (c == '}') {
+                    ret = sax_pop(sax, '{');
+                } else if (c == ']') {
+                    ret = sax_pop(sax, '[');
+                } else {
+                    ret = -10;
+                }
+            }
+            break;
+        }
+
+        if (ret < 0) {
+            sax->offset += i;
+            sax->error = ret;
+            return ret;
+        }
+    }
+
+    sax->offset += len;
+
+    return len;
+}
+
+/* report the bare value left at the end of text, return negative if the
+ * text is truncated in a string or a container */
+int json_sax_finish (void * vsax)
+{
+    JsonSax  * sax = (JsonSax *)vsax;
+    int        ret = 0;
+
+    if (!sax) return -1;
+    if (sax->error < 0) return sax->error;
+
+    if (sax->state == SAX_BARE) {
+        ret = sax_emit(sax, JSON_SAX_VALUE, frameP(sax->tokfrm), frameL(sax->tokfrm), 0);
+        if (ret >= 0) ret = sax_value_end(sax);
+
+        frame_empty(sax->tokfrm);
+        sax->intok = 0;
+        if (ret < 0) return sax->error = ret;
+    }
+
+    if (sax->state == SAX_STRING || sax->depth > 0)
+        return sax->error = -13;
+
+    return 0;
+}
+
+
+long json_sax_fca (void * vsax, void * fca, long startpos, long length)
+{
+    JsonSax  * sax = (JsonSax *)vsax;
+    uint8      buf[SAX_READBUF];
+    long       fsize = 0;
+    long       iter = 0;
+    int        ret = 0;
+
+    if (!sax) return -1;
+    if (!fca) return -2;
+
+    fsize = file_cache_filesize(fca);
+    if (startpos >= fsize) return 0;
+    if (length < 0 || startpos + length > fsize) length = fsize - startpos;
+
+    file_cache_seek(fca, startpos);
+
+    while (iter < length) {
+        ret = length - iter > SAX_READBUF ? SAX_READBUF : length - iter;
+        ret = file_cache_read(fca, buf, ret, 0);
+        if (ret <= 0) break;
+
+        ret = json_sax_feed(sax, buf, ret);
+        if (ret < 0) return ret;
+
+        iter += ret;
+    }
+
+    ret = json_sax_finish(sax);
+    if (ret < 0) return ret;
+
+    return iter;
+}
+
+int64 json_sax_chunk (void * vsax, void * vck, int64 pos, int64 length, int httpchunk)
+{
+    JsonSax  * sax = (JsonSax *)vsax;
+    void     * pbyte = NULL;
+    int64      bytelen = 0;
+    int64      iter = 0;
+    int64      size = 0;
+    int        ret = 0;
+
+    if (!sax) return -1;
+    if (!vck) return -2;
+
+    size = chunk_size(vck, httpchunk);
+    if (pos >= size) return 0;
+    if (length < 0 || pos + length > size) length = size - pos;
+
+    while (iter < length) {
+        /* each call returns the bytes within one chunk entity */
+        if (chunk_read_ptr(vck, pos + iter, length - iter, &pbyte, &bytelen, httpchunk) <= 0)
+            break;
+        if (!pbyte || bytelen <= 0) break;
+
+        while (bytelen > 0) {
+            ret = bytelen > 0x40000000 ? 0x40000000 : (int)bytelen;
+            ret = json_sax_feed(sax, pbyte, ret);
+            if (ret < 0) return ret;
+
+            pbyte = (uint8 *)pbyte + ret;
+            bytelen -= ret;
+            iter += ret;
+        }
+    }
+
+    ret = json_sax_finish(sax);
+    if (ret < 0) return ret;
+
+    return iter;
+}
+
@@ -0,0 +1,622 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "hashtab.h"
+#include "btime.h"
+#include "kvcache.h"
+
+typedef struct kvc_entry_s {
+    struct kvc_entry_s * next;     //next in the hash bucket, or in the list to free
+
+    uint64             hash;
+    long               expire;     //monotonic micro-seconds, 0 never
+    void             * value;
+    int                vallen;
+    int                keylen;
+    int                cost;
+    int                ref;        //pins by kvcache_get
+    int                slot;       //position in the clock ring, -1 if not cached
+    uint8              used;       //CLOCK referenced bit
+    uint8              copied;     //value is copied after the key
+
+    uint8              data[1];    //key, then the copied value
+} KVCEntry;
+
+typedef struct kvc_shard_s {
+    CRITICAL_SECTION   shCS;
+
+    KVCEntry        ** bucket;
+    int                bucketnum;  //power of 2
+
+    KVCEntry        ** ring;       //the clock ring of cached entries
+    int                ringnum;
+    int                ringsize;
+    int                hand;
+
+    int64              bytes;
+
+    uint64             hits;
+    uint64             misses;
+    uint64             inserts;
+    uint64             evicts;
+    uint64             expires;
+} KVCShard;
+
+typedef struct kvcache_s {
+    int64              budget;
+    int64              shardbudget;
+    long               ttl;        //default micro-seconds
+    uint64             seed;
+
+    KVCacheCost      * costfunc;
+    KVCacheFree      * freefunc;
+    void             * para;
+
+    KVCShard           shard[KVCACHE_SHARDS];
+} KVCache;
+
+
+void * kvcache_new (int64 budget, int ttl)
+{
+    KVCache  * kc = NULL;
+    KVCShard * sh = NULL;
+    int        i;
+
+    if (budget <= 0) return NULL;
+
+    kc = kzalloc(sizeof(*kc));
+    if (!kc) return NULL;
+
+    kc->budget = budget;
+    kc->shardbudget = budget / KVCACHE_SHARDS;
+    if (kc->shardbudget < 1) kc->shardbudget = 1;
+
+    kc->ttl = ttl > 0 ? (long)ttl * 1000 : 0;
+    kc->seed = hash_random_seed() ^ (uint64)(ulong)kc;
+
+    for (i = 0; i < KVCACHE_SHARDS; i++)
+        InitializeCriticalSection(&kc->shard[i].shCS);
+
+    for (i = 0; i < KVCACHE_SHARDS; i++) {
+        sh = &kc->shard[i];
+
+        sh->bucketnum = 16;
+        sh->bucket = kzalloc(sizeof(KVCEntry *) * sh->bucketnum);
+
+        sh->ringsize = 16;
+        sh->ring = kzalloc(sizeof(KVCEntry *) * sh->ringsize);
+
+        if (!sh->bucket || !sh->ring) {
+            kvcache_free(kc);
+            return NULL;
+        }
+    }
+
+    return kc;
+}
+
+void kvcache_free (void * vc)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    int        i;
+
+    if (!kc) return;
+
+    kvcache_clear(kc);
+
+    for (i = 0; i < KVCACHE_SHARDS; i++) {
+        sh = &kc->shard[i];
+
+        if (sh->ring) kfree(sh->ring);
+        if (sh->bucket) kfree(sh->bucket);
+
+        DeleteCriticalSection(&sh->shCS);
+    }
+
+    kfree(kc);
+}
+
+void kvcache_set_callback (void * vc, void * costfunc, void * freefunc, void * para)
+{
+    KVCache  * kc = (KVCache *)vc;
+
+    if (!kc) return;
+
+    kc->costfunc = (KVCacheCost *)costfunc;
+    kc->freefunc = (KVCacheFree *)freefunc;
+    kc->para = para;
+}
+
+
+static KVCShard * kvc_shard (KVCache * kc, uint64 h)
+{
+    return &kc->shard[(h >> 32) % KVCACHE_SHARDS];
+}
+
+static KVCEntry * kvc_find (KVCShard * sh, void * key, int keylen, uint64 h)
+{
+    KVCEntry * e = NULL;
+
+    for (e = sh->bucket[h & (sh->bucketnum - 1)]; e; e = e->next) {
+        if (e->hash == h && e->keylen == keylen && memcmp(e->data, key, keylen) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+static void kvc_bucket_unlink (KVCShard * sh, KVCEntry * e)
+{
+    KVCEntry ** pp = NULL;
+
+    for (pp = &sh->bucket[e->hash & (sh->bucketnum - 1)]; *pp; pp = &(*pp)->next) {
+        if (*pp == e) {
+            *pp = e->next;
+            return;
+        }
+    }
+}
+
+/* double the buckets when the entries outnumber them */
+static void kvc_bucket_grow (KVCShard * sh)
+{
+    KVCEntry ** bucket = NULL;
+    KVCEntry  * e = NULL;
+    int         num = sh->bucketnum * 2;
+    int         i;
+
+    bucket = kzalloc(sizeof(KVCEntry *) * num);
+    if (!bucket) return;
+
+    for (i = 0; i < sh->ringnum; i++) {
+        e = sh->ring[i];
+        e->next = bucket[e->hash & (num - 1)];
+        bucket[e->hash & (num - 1)] = e;
+    }
+
+    kfree(sh->bucket);
+    sh->bucket = bucket;
+    sh->bucketnum = num;
+}
+
+/* take e out of the shard. the last entry of the ring moves into its slot.
+ * e goes to the list to free out of the lock unless it is pinned */
+static void kvc_drop (KVCShard * sh, KVCEntry * e, KVCEntry ** freelist)
+{
+    kvc_bucket_unlink(sh, e);
+
+    sh->ringnum--;
+    if (e->slot < sh->ringnum) {
+        sh->ring[e->slot] = sh->ring[sh->ringnum];
+        sh->ring[e->slot]->slot = e->slot;
+    }
+    sh->ring[sh->ringnum] = NULL;
+    if (sh->hand >= sh->ringnum) sh->hand = 0;
+
+    sh->bytes -= e->cost;
+    e->slot = -1;
+
+    if (e->ref <= 0) {
+        e->next = *freelist;
+        *freelist = e;
+    }
+}
+
+static void kvc_release (KVCache * kc, KVCEntry * list)
+{
+    KVCEntry * e = NULL;
+
+    while ((e = list) != NULL) {
+        list = e->next;
+
+        if (!e->copied && kc->freefunc)
+            (*kc->freefunc)(kc->para, e->value, e->vallen);
+
+        kfree(e);
+    }
+}
+
+/* sweep the clock hand until need bytes fit the budget of shard. the
+ * expired entries are dropped, the pinned ones skipped and the referenced
+ * ones get a second chance. return -1 if all left are pinned */
+static int kvc_evict (KVCache * kc, KVCShard * sh, int need, long now, KVCEntry ** freelist)
+{
+    KVCEntry * e = NULL;
+    int        steps = 0;
+
+    while (sh->bytes + need > kc->shardbudget) {
+        if (sh->ringnum <= 0 || steps > 2 * sh->ringnum) return -1;
+        steps++;
+
+        e = sh->ring[sh->hand];
+
+        if (e->expire > 0 && e->expire <= now && e->ref <= 0) {
+            kvc_drop(sh, e, freelist);
+            sh->expires++;
+            continue;
+        }
+
+        if (e->ref > 0 || e->used) {
+            e->used = 0;
+            sh->hand = (sh->hand + 1) % sh->ringnum;
+            continue;
+        }
+
+        kvc_drop(sh, e, freelist);
+        sh->evicts++;
+    }
+
+    return 0;
+}
+
+static int kvc_set (KVCache * kc, void * key, int keylen, void * value, int vallen,
+                    int ttl, int copy)
+{
+    KVCShard  * sh = NULL;
+    KVCEntry  * e = NULL;
+    KVCEntry  * old = NULL;
+    KVCEntry  * freelist = NULL;
+    KVCEntry ** ring = NULL;
+    uint64      h;
+    long        now;
+    int         ret = 0;
+
+    if (!kc) return -1;
+    if (!key) return -2;
+
+    if (keylen < 0) keylen = strlen((char *)key);
+    if (keylen <= 0) return -2;
+
+    if (vallen < 0) vallen = value ? strlen((char *)value) : 0;
+    if (copy && vallen > 0 && !value) return -3;
+
+    e = kalloc(sizeof(*e) - 1 + keylen + (copy ? vallen : 0));
+    if (!e) return -100;
+
+    memset(e, 0, sizeof(*e));
+    memcpy(e->data, key, keylen);
+    e->keylen = keylen;
+    e->vallen = vallen;
+    e->copied = copy ? 1 : 0;
+
+    if (copy) {
+        e->value = e->data + keylen;
+        if (vallen > 0) memcpy(e->value, value, vallen);
+    } else {
+        e->value = value;
+    }
+
+    if (kc->costfunc)
+        e->cost = (*kc->costfunc)(kc->para, key, keylen, value, vallen);
+    else
+        e->cost = sizeof(*e) + keylen + vallen;
+
+    if (e->cost > kc->shardbudget) {
+        kfree(e);
+        return -101;
+    }
+
+    now = btime_mono_coarse(NULL);
+
+    if (ttl < 0) e->expire = kc->ttl > 0 ? now + kc->ttl : 0;
+    else e->expire = ttl > 0 ? now + (long)ttl * 1000 : 0;
+
+    e->hash = h = wy_hash(key, keylen, kc->seed);
+    e->used = 1;
+
+    sh = kvc_shard(kc, h);
+
+    EnterCriticalSection(&sh->shCS);
+
+    old = kvc_find(sh, key, keylen, h);
+    if (old) {
+        kvc_drop(sh, old, &freelist);
+        ret = 1;
+    }
+
+    if (kvc_evict(kc, sh, e->cost, now, &freelist) < 0) {
+        ret = -102;
+        goto done;
+    }
+
+    if (sh->ringnum >= sh->ringsize) {
+        ring = krealloc(sh->ring, sizeof(KVCEntry *) * sh->ringsize * 2);
+        if (!ring) {
+            ret = -103;
+            goto done;
+        }
+        sh->ring = ring;
+        sh->ringsize *= 2;
+    }
+
+    e->slot = sh->ringnum;
+    sh->ring[sh->ringnum++] = e;
+
+    e->next = sh->bucket[h & (sh->bucketnum - 1)];
+    sh->bucket[h & (sh->bucketnum - 1)] = e;
+
+    sh->bytes += e->cost;
+    sh->inserts++;
+
+    if (sh->ringnum > sh->bucketnum) kvc_bucket_grow(sh);
+
+    e = NULL;
+
+done:
+    LeaveCriticalSection(&sh->shCS);
+
+    /* the new entry not cached is not released by the free callback */
+    if (e) kfree(e);
+
+    kvc_release(kc, freelist);
+
+    return ret;
+}
+
+int kvcache_set (void * vc, void * key, int keylen, void * value, int vallen, int ttl)
+{
+    return kvc_set((KVCache *)vc, key, keylen, value, vallen, ttl, 0);
+}
+
+int kvcache_set_copy (void * vc, void * key, int keylen, void * value, int vallen, int ttl)
+{
+    return kvc_set((KVCache *)vc, key, keylen, value, vallen, ttl, 1);
+}
+
+
+/* find the entry live at now with the lock of shard held. the expired one
+ * is dropped into freelist */
+static KVCEntry * kvc_lookup (KVCShard * sh, void * key, int keylen, uint64 h,
+                              long now, KVCEntry ** freelist)
+{
+    KVCEntry * e = NULL;
+
+    e = kvc_find(sh, key, keylen, h);
+
+    if (e && e->expire > 0 && e->expire <= now) {
+        kvc_drop(sh, e, freelist);
+        sh->expires++;
+        e = NULL;
+    }
+
+    if (!e) {
+        sh->misses++;
+        return NULL;
+    }
+
+    /* no relinking, and no write to the entry when referenced already */
+    if (!e->used) e->used = 1;
+    sh->hits++;
+
+    return e;
+}
+
+void * kvcache_get (void * vc, void * key, int keylen, void ** pval, int * vallen)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    KVCEntry * e = NULL;
+    KVCEntry * freelist = NULL;
+    uint64     h;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!kc || !key) return NULL;
+
+    if (keylen < 0) keylen = strlen((char *)key);
+
+    h = wy_hash(key, keylen, kc->seed);
+    sh = kvc_shard(kc, h);
+
+    EnterCriticalSection(&sh->shCS);
+
+    e = kvc_lookup(sh, key, keylen, h, btime_mono_coarse(NULL), &freelist);
+    if (e) {
+        e->ref++;
+
+        if (pval) *pval = e->value;
+        if (vallen) *vallen = e->vallen;
+    }
+
+    LeaveCriticalSection(&sh->shCS);
+
+    kvc_release(kc, freelist);
+
+    return e;
+}
+
+void kvcache_put (void * vc, void * handle)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCEntry * e = (KVCEntry *)handle;
+    KVCShard * sh = NULL;
+    KVCEntry * freelist = NULL;
+
+    if (!kc || !e) return;
+
+    sh = kvc_shard(kc, e->hash);
+
+    EnterCriticalSection(&sh->shCS);
+
+    /* the entry replaced or deleted while pinned is freed by the last one */
+    if (--e->ref <= 0 && e->slot < 0) {
+        e->next = NULL;
+        freelist = e;
+    }
+
+    LeaveCriticalSection(&sh->shCS);
+
+    kvc_release(kc, freelist);
+}
+
+int kvcache_copy (void * vc, void * key, int keylen, void * pbuf, int buflen)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    KVCEntry * e = NULL;
+    KVCEntry * freelist = NULL;
+    uint64     h;
+    int        len = -1;
+
+    if (!kc || !key) return -1;
+
+    if (keylen < 0) keylen = strlen((char *)key);
+
+    h = wy_hash(key, keylen, kc->seed);
+    sh = kvc_shard(kc, h);
+
+    EnterCriticalSection(&sh->shCS);
+
+    e = kvc_lookup(sh, key, keylen, h, btime_mono_coarse(NULL), &freelist);
+    if (e) {
+        len = e->vallen;
+
+        if (pbuf && buflen > 0 && e->value)
+            memcpy(pbuf, e->value, min(buflen, len));
+    }
+
+    LeaveCriticalSection(&sh->shCS);
+
+    kvc_release(kc, freelist);
+
+    return len;
+}
+
+int kvcache_del (void * vc, void * key, int keylen)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    KVCEntry * e = NULL;
+    KVCEntry * freelist = NULL;
+    uint64     h;
+
+    if (!kc || !key) return -1;
+
+    if (keylen < 0) keylen = strlen((char *)key);
+
+    h = wy_hash(key, keylen, kc->seed);
+    sh = kvc_shard(kc, h);
+
+    EnterCriticalSection(&sh->shCS);
+    e = kvc_find(sh, key, keylen, h);
+    if (e) kvc_drop(sh, e, &freelist);
+    LeaveCriticalSection(&sh->shCS);
+
+    kvc_release(kc, freelist);
+
+    return e ? 0 : -1;
+}
+
+int kvcache_expire (void * vc)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    KVCEntry * e = NULL;
+    KVCEntry * freelist = NULL;
+    long       now;
+    int        i, j, num = 0;
+
+    if (!kc) return 0;
+
+    now = btime_mono_coarse(NULL);
+
+    for (i = 0; i < KVCACHE_SHARDS; i++) {
+        sh = &kc->shard[i];
+
+        EnterCriticalSection(&sh->shCS);
+
+        /* the last entry moves into the slot dropped, which is checked again */
+        for (j = 0; j < sh->ringnum; ) {
+            e = sh->ring[j];
+
+            if (e->expire > 0 && e->expire <= now) {
+                kvc_drop(sh, e, &freelist);
+                sh->expires++;
+                num++;
+            } else {
+                j++;
+            }
+        }
+
+        LeaveCriticalSection(&sh->shCS);
+
+        kvc_release(kc, freelist);
+        freelist = NULL;
+    }
+
+    return num;
+}
+
+void kvcache_clear (void * vc)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    KVCEntry * freelist = NULL;
+    int        i;
+
+    if (!kc) return;
+
+    for (i = 0; i < KVCACHE_SHARDS; i++) {
+        sh = &kc->shard[i];
+
+        EnterCriticalSection(&sh->shCS);
+        while (sh->ringnum > 0)
+            kvc_drop(sh, sh->ring[sh->ringnum - 1], &freelist);
+        LeaveCriticalSection(&sh->shCS);
+
+        kvc_release(kc, freelist);
+        freelist = NULL;
+    }
+}
+
+int kvcache_num (void * vc)
+{
+    KVCache  * kc = (KVCache *)vc;
+    int        i, num = 0;
+
+    if (!kc) return 0;
+
+    for (i = 0; i < KVCACHE_SHARDS; i++)
+        num += __atomic_load_n(&kc->shard[i].ringnum, __ATOMIC_RELAXED);
+
+    return num;
+}
+
+int kvcache_stat (void * vc, kvcache_stat_t * st)
+{
+    KVCache  * kc = (KVCache *)vc;
+    KVCShard * sh = NULL;
+    int        i;
+
+    if (!st) return -1;
+
+    memset(st, 0, sizeof(*st));
+
+    if (!kc) return -2;
+
+    st->budget = kc->budget;
+
+    for (i = 0; i < KVCACHE_SHARDS; i++) {
+        sh = &kc->shard[i];
+
+        EnterCriticalSection(&sh->shCS);
+        st->num += sh->ringnum;
+        st->bytes += sh->bytes;
+        st->hits += sh->hits;
+        st->misses += sh->misses;
+        st->inserts += sh->inserts;
+        st->evicts += sh->evicts;
+        st->expires += sh->expires;
+        LeaveCriticalSection(&sh->shCS);
+    }
+
+    return 0;
+}
+
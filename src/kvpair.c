@@ -213,6 +213,168 @@ int kvpair_item_free (void * vitem)
 }
 
 
+static int kvpair_slice_add (KVPairObj * obj, uint8 * name, int namelen, uint8 * value, int valuelen)
+{
+    KVPairSlice * slice = NULL;
+    int           size;
+
+    if (obj->slicenum >= obj->slicesize) {
+        size = obj->slicesize > 0 ? obj->slicesize * 2 : 16;
+
+        slice = krealloc(obj->slice, sizeof(*slice) * size);
+        if (!slice) return -100;
+
+        obj->slice = slice;
+        obj->slicesize = size;
+    }
+
+    slice = &obj->slice[obj->slicenum++];
+    slice->name = name;
+    slice->namelen = namelen;
+    slice->value = value;
+    slice->valuelen = valuelen;
+    slice->decval = NULL;
+    slice->declen = 0;
+
+    return obj->slicenum;
+}
+
+/* add the slices not indexed yet, doubling the index when half full */
+static int kvpair_slice_index (KVPairObj * obj)
+{
+    KVPairSlice * slice = NULL;
+    int         * idx = NULL;
+    int           size, i, j;
+
+    if (obj->slicenum * 2 > obj->idxsize) {
+        for (size = 64; size < obj->slicenum * 2; size <<= 1);
+
+        idx = krealloc(obj->sliceidx, sizeof(int) * size);
+        if (!idx) return -100;
+
+        obj->sliceidx = idx;
+        obj->idxsize = size;
+        obj->idxnum = 0;
+        memset(idx, 0xFF, sizeof(int) * size);
+    }
+
+    for (i = obj->idxnum; i < obj->slicenum; i++) {
+        slice = &obj->slice[i];
+
+        j = generic_hash(slice->name, slice->namelen, 0) & (obj->idxsize - 1);
+        while (obj->sliceidx[j] >= 0)
+            j = (j + 1) & (obj->idxsize - 1);
+
+        obj->sliceidx[j] = i;
+    }
+    obj->idxnum = obj->slicenum;
+
+    return 0;
+}
+
+static int kvpair_slice_match (KVPairSlice * slice, uint8 * key, int keylen)
+{
+    return slice->namelen == keylen && str_ncasecmp(slice->name, key, keylen) == 0;
+}
+
+/* find the index-th value of key, the last one if index < 0. the values of
+   the same key are in the decoding order in both the array and the index.
+   return the number of values of key, and the slice found in pfound */
+static int kvpair_slice_find (KVPairObj * obj, uint8 * key, int keylen, int index,
+                              KVPairSlice ** pfound)
+{
+    KVPairSlice * slice = NULL;
+    int           i, j, num = 0;
+
+    *pfound = NULL;
+
+    if (obj->slicenum <= KVPAIR_LINEAR_MAX || kvpair_slice_index(obj) < 0) {
+        for (i = 0; i < obj->slicenum; i++) {
+            slice = &obj->slice[i];
+            if (!kvpair_slice_match(slice, key, keylen)) continue;
+
+            if (index < 0 || num == index) *pfound = slice;
+            num++;
+        }
+        return num;
+    }
+
+    j = generic_hash(key, keylen, 0) & (obj->idxsize - 1);
+
+    for ( ; (i = obj->sliceidx[j]) >= 0; j = (j + 1) & (obj->idxsize - 1)) {
+        slice = &obj->slice[i];
+        if (!kvpair_slice_match(slice, key, keylen)) continue;
+
+        if (index < 0 || num == index) *pfound = slice;
+        num++;
+    }
+
+    return num;
+}
+
+static void kvpair_slice_value (KVPairObj * obj, KVPairSlice * slice, void ** pval, int * vallen)
+{
+    uint8  * p = slice->value;
+    int      len = slice->valuelen;
+
+    if (obj->urldec && len > 0 && !slice->decval &&
+        (memchr(p, '%', len) || memchr(p, '+', len)))
+    {
+        slice->decval = kalloc(len + 1);
+        if (slice->decval) {
+            slice->declen = uri_decode(p, len, slice->decval, len);
+            slice->decval[slice->declen] = '\0';
+        }
+    }
+
+    if (slice->decval) {
+        p = slice->decval;
+        len = slice->declen;
+    }
+
+    if (pval) *pval = p;
+    if (vallen) *vallen = len;
+}
+
+static void kvpair_slice_zero (KVPairObj * obj)
+{
+    int  i;
+
+    for (i = 0; i < obj->slicenum; i++) {
+        if (obj->slice[i].decval) kfree(obj->slice[i].decval);
+    }
+
+    obj->slicenum = 0;
+    obj->idxnum = 0;
+    if (obj->sliceidx)
+        memset(obj->sliceidx, 0xFF, sizeof(int) * obj->idxsize);
+}
+
+/* copy the slices into hash table for the operations without lazy support */
+static void kvpair_slice_flush (KVPairObj * obj)
+{
+    KVPairSlice * slice = NULL;
+    void        * val = NULL;
+    int           i, num, len = 0;
+
+    if (obj->slicenum <= 0) return;
+
+    /* kvpair_add flushes the slices too, hide them from it */
+    num = obj->slicenum;
+    obj->slicenum = 0;
+
+    for (i = 0; i < num; i++) {
+        slice = &obj->slice[i];
+
+        kvpair_slice_value(obj, slice, &val, &len);
+        kvpair_add(obj, slice->name, slice->namelen, val, len);
+    }
+
+    obj->slicenum = num;
+    kvpair_slice_zero(obj);
+}
+
+
 void * kvpair_init (int htsize, char * sepa, char * kvsep)
 {
     KVPairObj * obj = NULL;
@@ -244,6 +406,10 @@ int kvpair_clean (void * vobj)
 
     ht_free_all(obj->objtab, kvpair_item_free);
 
+    kvpair_slice_zero(obj);
+    if (obj->slice) kfree(obj->slice);
+    if (obj->sliceidx) kfree(obj->sliceidx);
+
     kfree(obj);
     return 0;
 }
@@ -255,10 +421,26 @@ int kvpair_zero (void * vobj)
     if (!obj) return -1;
  
     ht_free_member(obj->objtab, kvpair_item_free);
+
+    kvpair_slice_zero(obj);
  
     return 0;
 }
 
+int kvpair_set_lazy (void * vobj, int lazy, int urldec)
+{
+    KVPairObj * obj = (KVPairObj *)vobj;
+
+    if (!obj) return -1;
+
+    if (!lazy) kvpair_slice_flush(obj);
+
+    obj->lazy = lazy ? 1 : 0;
+    obj->urldec = urldec ? 1 : 0;
+
+    return 0;
+}
+
 void * kvpair_get_item (void * vobj, void * name, int namelen)
 {
     KVPairObj  * obj = (KVPairObj *)vobj;
@@ -328,6 +510,7 @@ int kvpair_valuenum (void * vobj, void * key, int keylen)
 {
     KVPairObj   * obj = (KVPairObj *)vobj;
     KVPairItem  * item = NULL;
+    int           num = 0;
  
     if (!obj) return -1;
  
@@ -335,6 +518,20 @@ int kvpair_valuenum (void * vobj, void * key, int keylen)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
+    if (obj->slicenum > 0) {
+        if (ht_num(obj->objtab) > 0) {
+            kvpair_slice_flush(obj);
+        } else {
+            KVPairSlice * slice = NULL;
+
+            EnterCriticalSection(&obj->objCS);
+            num = kvpair_slice_find(obj, key, keylen, 0, &slice);
+            LeaveCriticalSection(&obj->objCS);
+
+            return num > 0 ? num : -100;
+        }
+    }
+
     item = kvpair_get_item(obj, key, keylen);
     if (!item) return -100;
  
@@ -347,6 +544,8 @@ int kvpair_num (void * vobj)
  
     if (!obj) return 0;
  
+    kvpair_slice_flush(obj);
+
     return ht_num(obj->objtab);
 }
 
@@ -362,6 +561,8 @@ int kvpair_seq_get (void * vobj, int seq, int index, void ** pval, int * vallen)
  
     if (!obj) return -1;
  
+    kvpair_slice_flush(obj);
+
     EnterCriticalSection(&obj->objCS);
     item = ht_value(obj->objtab, seq);
     LeaveCriticalSection(&obj->objCS);
@@ -387,6 +588,32 @@ int kvpair_seq_get (void * vobj, int seq, int index, void ** pval, int * vallen)
     return item->valnum;
 }
 
+static int kvpair_slice_getP (KVPairObj * obj, void * key, int keylen, int index,
+                              void ** pval, int * vallen)
+{
+    KVPairSlice * slice = NULL;
+    int           num = 0;
+
+    EnterCriticalSection(&obj->objCS);
+
+    num = kvpair_slice_find(obj, key, keylen, index, &slice);
+    if (num <= 0) {
+        LeaveCriticalSection(&obj->objCS);
+        return -100;
+    }
+
+    if (!slice) {
+        LeaveCriticalSection(&obj->objCS);
+        return -200;
+    }
+
+    kvpair_slice_value(obj, slice, pval, vallen);
+
+    LeaveCriticalSection(&obj->objCS);
+
+    return num;
+}
+
 int kvpair_getP (void * vobj, void * key, int keylen, int index, void ** pval, int * vallen)
 {
     KVPairObj   * obj = (KVPairObj *)vobj;
@@ -402,6 +629,14 @@ int kvpair_getP (void * vobj, void * key, int keylen, int index, void ** pval, i
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
+    if (obj->slicenum > 0) {
+        if (ht_num(obj->objtab) > 0) {
+            kvpair_slice_flush(obj);
+        } else {
+            return kvpair_slice_getP(obj, key, keylen, index, pval, vallen);
+        }
+    }
+
     item = kvpair_get_item(obj, key, keylen);
     if (!item || item->valnum <= 0) return -100;
 
@@ -461,6 +696,8 @@ int kvpair_del (void * vobj, void * key, int keylen, int index)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3; 
      
+    kvpair_slice_flush(obj);
+
     item = kvpair_get_item(obj, key, keylen);
     if (!item) return -100;
 
@@ -560,6 +797,8 @@ int kvpair_add (void * vobj, void * key, int keylen, void * val, int vallen)
 
     if (val && vallen < 0) vallen = str_len(val);
 
+    kvpair_slice_flush(obj);
+
     item = kvpair_get_item(obj, key, keylen);
     if (!item) {
         item = kvpair_item_alloc();
@@ -609,6 +848,8 @@ int kvpair_add_by_fca (void * vobj, void * fca, long keypos, int keylen, long va
     if (keylen <= 0) return -3;
     if (vallen < 0) return -100;
  
+    kvpair_slice_flush(obj);
+
     key = kzalloc(keylen + 1);
     file_cache_seek(fca, keypos);
     file_cache_read(fca, key, keylen, 0);
@@ -883,7 +1124,10 @@ int kvpair_decode (void * vobj, void * vbyte, int length)
             pbgn = pcolon;
         }
 
-        kvpair_add(obj, name, namelen, value, valuelen);
+        if (obj->lazy)
+            kvpair_slice_add(obj, name, namelen, value, valuelen);
+        else
+            kvpair_add(obj, name, namelen, value, valuelen);
 
     } while (pbgn < pend);
 
@@ -1006,6 +1250,8 @@ int kvpair_encode (void * vobj, void * vbyte, int len)
 
     if (!obj) return 0;
 
+    kvpair_slice_flush(obj);
+
     num = ht_num(obj->objtab);
     for (i = 0; i < num; i++) {
         item = (KVPairItem *)ht_value(obj->objtab, i);
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "fileop.h"
+#include "thpool.h"
+#include "lineidx.h"
+
+#ifdef UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define LINEIDX_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/* bytes mapped at a time by lineidx_seek */
+#define LINEIDX_SEEK_STEP  (4 * 1024 * 1024)
+
+typedef struct line_index_s {
+    int64          filesize;
+    int64          lines;
+    int            wide;       //8-byte offsets
+    void         * offs;
+} LineIndex;
+
+/* the newlines of range [offset, offset + len) of file. the line starts
+ * after them are recorded, or only counted when count is set */
+typedef struct line_range_s {
+    int64          offset;
+    int64          len;
+
+    int            wide;
+    int            count;
+
+    void         * offs;
+    int64          num;
+    int64          size;
+
+    int            ret;
+} LIRange;
+
+typedef struct line_build_s {
+    int            fd;
+    LIRange      * ranges;
+} LIBuild;
+
+
+static int li_range_add (LIRange * r, int64 start)
+{
+    void   * offs = NULL;
+    int64    size = 0;
+
+    if (r->num >= r->size) {
+        size = r->size > 0 ? r->size * 2 : 1024;
+
+        offs = krealloc(r->offs, size * (r->wide ? 8 : 4));
+        if (!offs) return -1;
+
+        r->offs = offs;
+        r->size = size;
+    }
+
+    if (r->wide) ((int64 *)r->offs)[r->num++] = start;
+    else ((uint32 *)r->offs)[r->num++] = (uint32)start;
+
+    return 0;
+}
+
+static int li_scan_c (LIRange * r, uint8 * pbyte, int64 len, int64 base)
+{
+    uint8  * p = pbyte;
+    uint8  * end = pbyte + len;
+
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        p++;
+
+        if (r->count) r->num++;
+        else if (li_range_add(r, base + (p - pbyte)) < 0) return -1;
+    }
+
+    return 0;
+}
+
+#ifdef LINEIDX_X86_DISPATCH
+
+__attribute__((target("avx2,popcnt")))
+static int li_scan_avx2 (LIRange * r, uint8 * pbyte, int64 len, int64 base)
+{
+    const __m256i  nl = _mm256_set1_epi8('\n');
+    __m256i        a, b;
+    uint64         mask;
+    int64          i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        a = _mm256_loadu_si256((const __m256i *)(pbyte + i));
+        b = _mm256_loadu_si256((const __m256i *)(pbyte + i + 32));
+
+        mask = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl)) |
+               ((uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32);
+        if (!mask) continue;
+
+        if (r->count) {
+            r->num += __builtin_popcountll(mask);
+            continue;
+        }
+
+        for ( ; mask; mask &= mask - 1) {
+            if (li_range_add(r, base + i + __builtin_ctzll(mask) + 1) < 0)
+                return -1;
+        }
+    }
+
+    return li_scan_c(r, pbyte + i, len - i, base + i);
+}
+
+static int li_simd_level ()
+{
+    static int level = -1;
+    int        lvl = __atomic_load_n(&level, __ATOMIC_RELAXED);
+
+    if (lvl < 0) {
+        __builtin_cpu_init();
+        lvl = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) ? 2 : 0;
+        __atomic_store_n(&level, lvl, __ATOMIC_RELAXED);
+    }
+
+    return lvl;
+}
+
+#endif
+
+static int li_scan (LIRange * r, uint8 * pbyte, int64 len, int64 base)
+{
+#ifdef LINEIDX_X86_DISPATCH
+    if (li_simd_level() >= 2) return li_scan_avx2(r, pbyte, len, base);
+#endif
+    return li_scan_c(r, pbyte, len, base);
+}
+
+
+#ifdef UNIX
+
+static void li_range_scan (int fd, LIRange * r)
+{
+    void    * pmap = NULL;
+    size_t    maplen = 0;
+    uint8   * pbyte = NULL;
+
+    pbyte = file_mmap(NULL, fd, r->offset, r->len, PROT_READ, MAP_PRIVATE, &pmap, &maplen, NULL);
+    if (!pbyte) {
+        r->ret = -10;
+        return;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(pmap, maplen, MADV_SEQUENTIAL);
+#endif
+
+    /* about 1 line in 64 bytes to start with */
+    if (!r->count && r->size == 0) {
+        r->size = r->len / 64 + 16;
+        r->offs = kalloc(r->size * (r->wide ? 8 : 4));
+        if (!r->offs) r->size = 0;
+    }
+
+    if (li_scan(r, pbyte, r->len, r->offset) < 0)
+        r->ret = -100;
+
+    file_munmap(pmap, maplen);
+}
+
+static void li_range_func (void * arg, long from, long to)
+{
+    LIBuild  * bd = (LIBuild *)arg;
+    long       i;
+
+    for (i = from; i < to; i++)
+        li_range_scan(bd->fd, &bd->ranges[i]);
+}
+
+static void li_ranges_free (LIRange * ranges, long num)
+{
+    long  i;
+
+    if (!ranges) return;
+
+    for (i = 0; i < num; i++) {
+        if (ranges[i].offs) kfree(ranges[i].offs);
+    }
+
+    kfree(ranges);
+}
+
+/* scan the ranges of file in parallel, return the number of ranges with
+ * the size of file in *pfsize, or < 0 on error */
+static long li_ranges_scan (char * file, void * vpool, int count, int64 * pfsize, LIRange ** pranges)
+{
+    LIBuild       bd;
+    LIRange     * ranges = NULL;
+    void        * pool = vpool;
+    struct stat   st;
+    int64         fsize = 0;
+    long          num = 0, i;
+    int           ret = 0;
+
+    *pfsize = 0;
+    *pranges = NULL;
+
+    if (!file) return -1;
+
+    memset(&bd, 0, sizeof(bd));
+
+    bd.fd = open(file, O_RDONLY);
+    if (bd.fd < 0) return -100;
+
+    if (fstat(bd.fd, &st) < 0) {
+        close(bd.fd);
+        return -101;
+    }
+    fsize = st.st_size;
+
+    num = (long)((fsize + LINEIDX_RANGE - 1) / LINEIDX_RANGE);
+    if (num <= 0) {
+        close(bd.fd);
+        return 0;
+    }
+
+    ranges = kzalloc(num * sizeof(LIRange));
+    if (!ranges) {
+        close(bd.fd);
+        return -102;
+    }
+
+    for (i = 0; i < num; i++) {
+        ranges[i].offset = (int64)i * LINEIDX_RANGE;
+        ranges[i].len = min(LINEIDX_RANGE, fsize - ranges[i].offset);
+        ranges[i].wide = fsize > 0xFFFFFFFFLL;
+        ranges[i].count = count;
+    }
+    bd.ranges = ranges;
+
+    if (num == 1) {
+        li_range_func(&bd, 0, 1);
+    } else {
+        if (!pool) pool = thpool_new(0, 0);
+
+        if (pool) thpool_parallel_for(pool, 0, num, 1, li_range_func, &bd);
+        else li_range_func(&bd, 0, num);
+
+        if (pool != vpool) thpool_free(pool);
+    }
+
+    close(bd.fd);
+
+    for (i = 0; i < num; i++) {
+        if (ranges[i].ret < 0 && ret >= 0) ret = ranges[i].ret;
+    }
+
+    if (ret < 0) {
+        li_ranges_free(ranges, num);
+        return ret;
+    }
+
+    *pfsize = fsize;
+    *pranges = ranges;
+
+    return num;
+}
+
+void * lineidx_build (char * file, void * vpool)
+{
+    LineIndex  * li = NULL;
+    LIRange    * ranges = NULL;
+    LIRange    * r = NULL;
+    uint8      * dst = NULL;
+    int64        fsize = 0;
+    int64        total = 0;
+    long         num, i;
+    int          esize;
+
+    num = li_ranges_scan(file, vpool, 0, &fsize, &ranges);
+    if (num < 0) return NULL;
+
+    li = kzalloc(sizeof(*li));
+    if (!li) {
+        li_ranges_free(ranges, num);
+        return NULL;
+    }
+
+    li->filesize = fsize;
+    li->wide = fsize > 0xFFFFFFFFLL;
+    esize = li->wide ? 8 : 4;
+
+    if (fsize <= 0) {
+        li_ranges_free(ranges, num);
+        return li;
+    }
+
+    /* line 0 starts at 0, each newline but the one at the end starts one */
+    for (i = 0, total = 1; i < num; i++)
+        total += ranges[i].num;
+
+    r = &ranges[num - 1];
+
+    if (r->num > 0 && (li->wide ? ((int64 *)r->offs)[r->num - 1]
+                                : (int64)((uint32 *)r->offs)[r->num - 1]) >= fsize) {
+        r->num--;
+        total--;
+    }
+
+    li->offs = kalloc(total * esize);
+    if (!li->offs) {
+        li_ranges_free(ranges, num);
+        kfree(li);
+        return NULL;
+    }
+
+    if (li->wide) ((int64 *)li->offs)[0] = 0;
+    else ((uint32 *)li->offs)[0] = 0;
+
+    dst = (uint8 *)li->offs + esize;
+
+    for (i = 0; i < num; i++) {
+        if (ranges[i].num <= 0) continue;
+
+        memcpy(dst, ranges[i].offs, ranges[i].num * esize);
+        dst += ranges[i].num * esize;
+    }
+
+    li->lines = total;
+
+    li_ranges_free(ranges, num);
+
+    return li;
+}
+
+int64 lineidx_count (char * file, void * vpool)
+{
+    LIRange    * ranges = NULL;
+    int64        fsize = 0;
+    int64        total = 0;
+    long         num, i;
+
+    num = li_ranges_scan(file, vpool, 1, &fsize, &ranges);
+
+    for (i = 0; i < num; i++)
+        total += ranges[i].num;
+
+    li_ranges_free(ranges, num);
+
+    return num < 0 ? num : total;
+}
+
+int64 lineidx_seek (char * file, int64 line)
+{
+    LIRange      r;
+    struct stat  st;
+    void       * pmap = NULL;
+    size_t       maplen = 0;
+    uint8      * pbyte = NULL;
+    uint8      * p = NULL;
+    int64        pos = 0;
+    int64        len = 0;
+    int64        found = 0;
+    int          fd;
+
+    if (!file) return -1;
+    if (line <= 0) return 0;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) return -100;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -101;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.count = 1;
+
+    for (pos = 0; pos < st.st_size; pos += len) {
+        len = min(LINEIDX_SEEK_STEP, st.st_size - pos);
+
+        pbyte = file_mmap(NULL, fd, pos, len, PROT_READ, MAP_PRIVATE, &pmap, &maplen, NULL);
+        if (!pbyte) {
+            close(fd);
+            return -102;
+        }
+
+        r.num = 0;
+        li_scan(&r, pbyte, len, pos);
+
+        if (found + r.num < line) {
+            found += r.num;
+            file_munmap(pmap, maplen);
+            continue;
+        }
+
+        /* the line starts in this step */
+        for (p = pbyte; found < line; found++)
+            p = (uint8 *)memchr(p, '\n', pbyte + len - p) + 1;
+
+        pos += p - pbyte;
+
+        file_munmap(pmap, maplen);
+        close(fd);
+
+        return pos;
+    }
+
+    close(fd);
+
+    return st.st_size;
+}
+
+#else
+
+void * lineidx_build (char * file, void * vpool)
+{
+    return NULL;
+}
+
+int64 lineidx_count (char * file, void * vpool)
+{
+    return -10;
+}
+
+int64 lineidx_seek (char * file, int64 line)
+{
+    return -10;
+}
+
+#endif
+
+void lineidx_free (void * vli)
+{
+    LineIndex * li = (LineIndex *)vli;
+
+    if (!li) return;
+
+    if (li->offs) kfree(li->offs);
+    kfree(li);
+}
+
+int64 lineidx_lines (void * vli)
+{
+    LineIndex * li = (LineIndex *)vli;
+
+    return li ? li->lines : 0;
+}
+
+int64 lineidx_filesize (void * vli)
+{
+    LineIndex * li = (LineIndex *)vli;
+
+    return li ? li->filesize : 0;
+}
+
+int64 lineidx_offset (void * vli, int64 line)
+{
+    LineIndex * li = (LineIndex *)vli;
+
+    if (!li || line < 0 || line > li->lines) return -1;
+
+    if (line == li->lines) return li->filesize;
+
+    return li->wide ? ((int64 *)li->offs)[line] : (int64)((uint32 *)li->offs)[line];
+}
+
+int64 lineidx_find (void * vli, int64 pos)
+{
+    LineIndex * li = (LineIndex *)vli;
+    int64       lo, hi, mid;
+
+    if (!li || pos < 0 || pos >= li->filesize) return -1;
+
+    /* the last line starting at or before pos */
+    for (lo = 0, hi = li->lines - 1; lo < hi; ) {
+        mid = lo + (hi - lo + 1) / 2;
+
+        if (lineidx_offset(li, mid) <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+
+    return lo;
+}
+
+int lineidx_split (void * vli, int parts, int64 * offs)
+{
+    LineIndex * li = (LineIndex *)vli;
+    int64       target, line, off;
+    int         k;
+
+    if (!li || parts <= 0 || !offs) return -1;
+
+    offs[0] = 0;
+
+    for (k = 1; k < parts; k++) {
+        target = li->filesize * k / parts;
+
+        /* the first line start at or after target */
+        line = lineidx_find(li, target);
+        if (line < 0) off = li->filesize;
+        else if ((off = lineidx_offset(li, line)) < target) off = lineidx_offset(li, line + 1);
+
+        offs[k] = max(off, offs[k-1]);
+    }
+
+    offs[parts] = li->filesize;
+
+    return parts;
+}
+
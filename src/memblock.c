@@ -8,24 +8,191 @@
 
 #include "memblock.h"
 
+#define MB_LEVELS  3
 
+/* the header keeps offsets only, so that the block works wherever the
+ * shared memory is attached in each process. bit i of level 0 is set if
+ * unit i is free, bit j of level 1 is set if word j of level 0 is not zero,
+ * and so on. the lowest free unit is found with 3 ctz operations */
 typedef struct MemBlock_ {
     int      totalsize;
     int      unused;
     int      size;
-    int      start;
     int      unitsize;
-    int      qlen;
-    uint8  * storage;
-    int      arr[1];
+    int      qlen;          //allocated units
+    int      lockfree;
+
+    int      stoff;         //offset of the unit storage
+    int      words[MB_LEVELS];
+    int      wordoff[MB_LEVELS];
+
+    uint64   bits[1];
 } MemBlock;
 
+#define MB_WORDS(n)  (((n) + 63) / 64)
+
+#define MB_STORAGE(b)  ((uint8 *)(b) + (b)->stoff)
+#define MB_LEVEL(b, l) ((b)->bits + (b)->wordoff[l])
+
+
+static int mb_ctz (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
+    int  i = 0;
+    while (!(w & 1)) { w >>= 1; i++; }
+    return i;
+#endif
+}
+
+static int mb_popcount (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    int  n = 0;
+    for ( ; w; w &= w - 1) n++;
+    return n;
+#endif
+}
+
+static uint64 mb_load (MemBlock * block, uint64 * p)
+{
+    if (block->lockfree)
+        return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+    return *p;
+}
+
+static uint64 mb_and (MemBlock * block, uint64 * p, uint64 mask)
+{
+    uint64  old;
+
+    if (block->lockfree)
+        return __atomic_fetch_and(p, mask, __ATOMIC_SEQ_CST);
+
+    old = *p;
+    *p = old & mask;
+    return old;
+}
+
+static uint64 mb_or (MemBlock * block, uint64 * p, uint64 mask)
+{
+    uint64  old;
+
+    if (block->lockfree)
+        return __atomic_fetch_or(p, mask, __ATOMIC_SEQ_CST);
+
+    old = *p;
+    *p = old | mask;
+    return old;
+}
+
+/* word ind of level l became empty, clear its bit in level l + 1. the word
+ * is checked again after clearing, a racing free may have refilled it */
+static void mb_summary_clear (MemBlock * block, int l, int ind)
+{
+    uint64 * up = NULL;
+    uint64   bit = 0;
+
+    for ( ; l + 1 < MB_LEVELS; l++, ind /= 64) {
+        up = MB_LEVEL(block, l + 1) + ind / 64;
+        bit = (uint64)1 << (ind % 64);
+
+        if ((mb_and(block, up, ~bit) & ~bit) != 0)
+            return;
+
+        if (mb_load(block, MB_LEVEL(block, l) + ind) != 0) {
+            mb_or(block, up, bit);
+            return;
+        }
+    }
+}
+
+/* set the bit of unit ind at each level, upwards until a word was not empty */
+static void mb_bits_set (MemBlock * block, int ind)
+{
+    int   l;
+
+    for (l = 0; l < MB_LEVELS; l++, ind /= 64) {
+        if (mb_or(block, MB_LEVEL(block, l) + ind / 64, (uint64)1 << (ind % 64)) != 0)
+            return;
+    }
+}
+
+/* clear the bit of unit ind. return 0 if it was set */
+static int mb_bits_clear (MemBlock * block, int ind)
+{
+    uint64   bit = (uint64)1 << (ind % 64);
+    uint64   old;
+
+    old = mb_and(block, MB_LEVEL(block, 0) + ind / 64, ~bit);
+    if (!(old & bit)) return -1;
+
+    if ((old & ~bit) == 0)
+        mb_summary_clear(block, 0, ind / 64);
+
+    return 0;
+}
+
+/* take the lowest free unit, -1 if none */
+static int mb_take (MemBlock * block)
+{
+    uint64 * p = NULL;
+    uint64   w, bit;
+    int      i, l, ind;
+
+    for (i = 0; i < block->words[MB_LEVELS - 1]; ) {
+        w = mb_load(block, MB_LEVEL(block, MB_LEVELS - 1) + i);
+        if (w == 0) {
+            i++;
+            continue;
+        }
+        ind = i * 64 + mb_ctz(w);
+
+        /* go down along the summary bits to level 0 */
+        for (l = MB_LEVELS - 2; l >= 0; l--) {
+            w = mb_load(block, MB_LEVEL(block, l) + ind);
+            if (w == 0) break;
+
+            if (l > 0) ind = ind * 64 + mb_ctz(w);
+        }
+
+        if (l >= 0) {
+            /* stale summary bit, fix it and start again from word i */
+            mb_summary_clear(block, l, ind);
+            continue;
+        }
+
+        /* ind is the word of level 0 with free units */
+        p = MB_LEVEL(block, 0) + ind;
+        bit = w & (~w + 1);
+
+        if (block->lockfree) {
+            if (!__atomic_compare_exchange_n(p, &w, w & ~bit, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                continue;
+        } else {
+            *p = w & ~bit;
+        }
+
+        if ((w & ~bit) == 0)
+            mb_summary_clear(block, 0, ind);
+
+        return ind * 64 + mb_ctz(bit);
+    }
+
+    return -1;
+}
+
 
 int mem_block_init (void * psb, int totalsize, int unitsize)
 {
     MemBlock  * block = NULL;
     int         arsize = 0;
-    int         i = 0;
+    int         hdrsize = 0;
+    int         nwords = 0;
+    int         i, l, num;
 
     if (!psb)
         return -1;
@@ -36,34 +203,52 @@ int mem_block_init (void * psb, int totalsize, int unitsize)
     if (unitsize <= 0)
         return -3;
 
-    arsize = totalsize - sizeof(MemBlock) + sizeof(int);
-    arsize /= (unitsize + 2 * sizeof(int));
+    /* each unit costs its size plus a bit and a little of the summary */
+    arsize = (int)(((int64)totalsize - (int64)sizeof(MemBlock)) * 8 / ((int64)unitsize * 8 + 1));
+
+    for ( ; arsize > 0; arsize--) {
+        nwords = 0;
+        for (l = 0, num = arsize; l < MB_LEVELS; l++, num = MB_WORDS(num))
+            nwords += MB_WORDS(num);
+
+        hdrsize = sizeof(MemBlock) - sizeof(uint64) + nwords * sizeof(uint64);
+        if ((int64)hdrsize + (int64)arsize * unitsize <= totalsize)
+            break;
+    }
     if (arsize < 1) return -4;
 
     block = (MemBlock *)psb;
 
+    memset(block, 0, hdrsize);
+
     block->totalsize = totalsize;
-    block->unused = totalsize - 
-                    ( sizeof(MemBlock) + 
-                      arsize * unitsize + 
-                      arsize*2*sizeof(int) - 
-                      sizeof(int) );
+    block->unused = totalsize - hdrsize - arsize * unitsize;
     block->size = arsize;
-    block->start = 0;
     block->unitsize = unitsize;
     block->qlen = 0;
+    block->lockfree = 0;
+    block->stoff = hdrsize;
 
-    for (i = 0; i < arsize; i++) {
-        block->arr[i] = i;
+    for (l = 0, num = arsize, nwords = 0; l < MB_LEVELS; l++, num = MB_WORDS(num)) {
+        block->words[l] = MB_WORDS(num);
+        block->wordoff[l] = nwords;
+        nwords += block->words[l];
     }
 
-    for (i = arsize; i < 2*arsize; i++) {
-        block->arr[i] = -1;
-    }
+    /* all units are free */
+    for (i = 0; i < arsize; i++)
+        mb_bits_set(block, i);
 
-    block->storage = (uint8 *)psb +
-                     sizeof(MemBlock) + 
-                     (2 * arsize - 1) * sizeof(int);
+    return 0;
+}
+
+int mem_block_set_lockfree (void * psb, int lockfree)
+{
+    MemBlock * block = (MemBlock *)psb;
+
+    if (!block) return -1;
+
+    block->lockfree = lockfree ? 1 : 0;
 
     return 0;
 }
@@ -83,7 +268,7 @@ int mem_block_restnum (void * psb)
 
     if (!block) return 0;
 
-    return block->size - block->start;
+    return block->size - mem_block_unit_num(block);
 }
 
 void * mem_block_alloc (void * psb)
@@ -96,16 +281,21 @@ void * mem_block_alloc (void * psb)
         return NULL;
 
     block = (MemBlock *)psb;
-    if (block->start >= block->size) 
-        return NULL;
 
-    ind = block->arr[block->start];
-    block->arr[block->start++] = -1;
+    for ( ; ; ) {
+        ind = mb_take(block);
+        if (ind >= 0) break;
 
-    pmem = block->storage + ind * block->unitsize;
+        /* a racing free may have set its unit before the summary bits */
+        if (!block->lockfree || mem_block_restnum(block) <= 0)
+            return NULL;
+    }
+
+    pmem = MB_STORAGE(block) + ind * block->unitsize;
     memset(pmem, 0, block->unitsize);
 
-    mem_block_unit_append(block, ind);
+    if (block->lockfree) __atomic_add_fetch(&block->qlen, 1, __ATOMIC_SEQ_CST);
+    else block->qlen++;
 
     return pmem;
 }
@@ -120,9 +310,9 @@ int mem_block_free (void * psb, void * pmem)
     if (!pmem) return -2;
 
     block = (MemBlock *)psb;
-    if (block->start <= 0) return -50;
+    if (mem_block_unit_num(block) <= 0) return -50;
 
-    offset = (uint8 *)pmem - block->storage;
+    offset = (uint8 *)pmem - MB_STORAGE(block);
     if (offset < 0) return -100;
 
     if (offset % block->unitsize != 0) return -200;
@@ -130,304 +320,69 @@ int mem_block_free (void * psb, void * pmem)
     ind = offset / block->unitsize;
     if (ind >= block->size) return -300;
 
-    mem_block_unit_remove(block, ind);
-
-    //return mem_block_bsearch_recycle(block, ind);
     return mem_block_sort_recycle(block, ind);
 }
 
 
-
-static int mem_block_key_cmp_unit (const void * a, const void * b)
-{
-    int val = *(int *)a;
-    int ubval = *(int *)b;
-
-    if (val == ubval) return 0;
-    if (val > ubval) return 1;
-    return -1;
-}
-
-/* find if the key does exist, if exist, just return position. 
- * if not exist, insert the key to correct position, return it */
 int mem_block_bsearch_recycle (void * psb, int memind)
 {
-    MemBlock  * block = (MemBlock *)psb;
-    uint8     * pbgn  = NULL;
-    int         width = sizeof(int);
-    uint8     * lo    = NULL;
-    uint8     * hi    = NULL;
-    uint8     * mid   = NULL;
-    uint8     * insp  = NULL;
-    int         insind = 0;
-    int         num   = 0;
-    int         half  = 0;
-    int         result = 0;
-
-    if (!block)
-        return -1;
-
-    if (block->start == block->size) {
-        block->arr[--block->start] = memind;
-        return 0;
-    }
-
-    pbgn = (uint8 *)&block->arr[block->start];
-
-    lo = (uint8 *)&block->arr[block->start];
-    hi = (uint8 *)&block->arr[block->size-1];
-    num = block->size - block->start;
-
-    while (lo <= hi) {
-
-        if ((half = num / 2) > 0) {
-
-            mid = lo + ((num & 1) ? half : (half - 1)) * width;
-
-            if (!(result = mem_block_key_cmp_unit(&memind, mid)))
-                return (mid - pbgn)/width;
-
-            else if (result < 0) {
-                hi = mid - width;
-                num = num & 1 ? half : half-1;
-
-                if (lo > hi) {
-                    insp = lo;
-                    break;
-                }
-
-            } else {
-                lo = mid + width;
-                num = half;
-
-                if (lo > hi) {
-                    insp = hi;
-                    break;
-                }
-            }
-
-        } else if (num > 0) {
-
-            if (!(result = mem_block_key_cmp_unit(&memind, lo)))
-                return (lo - pbgn) / width;
-
-            if (result > 0)
-                insp = lo + width;
-
-            else
-                insp = lo;
-
-            break;
-
-        } else {
-            break;
-        }
-    }
-
-    if (!insp)
-        return -100;
-
-    insind = (insp - pbgn)/width;
-
-    if (insind < 0 || insind > num) 
-        return -200;
-
-    if (insind > 0) {
-        memmove( &block->arr[block->start-1],
-                 &block->arr[block->start],
-                 insind * width);
-    }
-
-    block->start--;
-    block->arr[block->start + insind] = memind;
-
-    return insind;
-}
-
-
-static int mem_block_find_inserloc (void * pbgn, void * pend, int width, int insval)
-{
-    uint8    * lo = NULL;
-    uint8    * hi = NULL;
-    uint8    * mid = NULL;
-    uint8    * insp = NULL;
-    int        insind = 0;
-    int        num = 0;
-    int        half = 0;
-    int        result = 0;
-
-    if (!pbgn)
-        return -1;
-
-    if (!pend)
-        return -2;
-
-    if (width <= 0)
-        return -3;
-
-    num = ((uint8 *)pend - (uint8 *)pbgn)/width;
-    if (num < 0)
-        return -4;
-
-    if (num == 0)
-        return 0;
-
-    lo = (uint8 *)pbgn;
-    hi = (uint8 *)pend - width;
-
-    while (lo <= hi) {
-
-        if ((half = num / 2) > 0) {
-
-            mid = lo + ((num & 1) ? half : (half - 1)) * width;
-
-            if (!(result = mem_block_key_cmp_unit (&insval, mid)))
-                return (mid - (uint8 *)pbgn) / width;
-
-            else if (result < 0) {
-                hi = mid - width;
-                num = num & 1 ? half : half-1;
-
-                if (lo > hi) {
-                    insp = lo;
-                    break;
-                }
-
-            } else {
-                lo = mid + width;
-                num = half;
-
-                if (lo > hi) {
-                    insp = hi;
-                    break;
-                }
-            }
-
-        } else if (num > 0) {
-
-            if (!(result = mem_block_key_cmp_unit(&insval, lo)))
-                return (lo - (uint8 *)pbgn) / width;
-
-            if (result > 0)
-                insp = lo + width;
-
-            else
-                insp = lo;
-
-            break;
-
-        } else {
-            break;
-        }
-    }
-
-    if (!insp)
-        return -100;
-
-    insind = (insp - (uint8 *)pbgn) / width;
-
-    if (insind < 0 || insind > num) 
-        return -200;
-
-    return insind;
+    return mem_block_sort_recycle(psb, memind);
 }
 
-
 int mem_block_sort_recycle (void * psb, int memind)
 {
     MemBlock * block = (MemBlock *)psb;
-    int        insind = -1;
-    int        width = sizeof(int);
+    uint64     bit = 0;
 
     if (!block)
         return -1;
 
-    if (block->start == block->size) {
-        block->arr[--block->start] = memind;
-        return 0;
-    }
+    if (memind < 0 || memind >= block->size)
+        return -100;
+
+    bit = (uint64)1 << (memind % 64);
 
-    insind = mem_block_find_inserloc( &block->arr[block->start],
-                                      &block->arr[block->size],
-                                      width, memind);
-    if (insind < 0)
-        return insind;
+    /* freed twice */
+    if (mb_load(block, MB_LEVEL(block, 0) + memind / 64) & bit)
+        return -400;
 
-    if (insind > 0)
-        memmove(&block->arr[block->start-1],
-                &block->arr[block->start],
-                insind * width);
+    mb_bits_set(block, memind);
 
-    block->start--;
-    block->arr[block->start + insind] = memind;
+    /* the unit is counted after its bits are visible */
+    if (block->lockfree) __atomic_sub_fetch(&block->qlen, 1, __ATOMIC_SEQ_CST);
+    else block->qlen--;
 
-    return insind;
+    return 0;
 }
 
 
 int mem_block_unit_append (void * psb, int memind)
 {
     MemBlock * block = (MemBlock *)psb;
-    int         insind = -1;
-    int         width = sizeof(int);
 
     if (!block) return -1;
+    if (memind < 0 || memind >= block->size) return -100;
 
-    if (block->qlen == 0) {
-        block->arr[block->qlen++] = memind;
+    if (mb_bits_clear(block, memind) < 0)
         return 0;
-    }
 
-    insind = mem_block_find_inserloc(&block->arr[block->size],
-                                     &block->arr[block->size+block->qlen],
-                                     width, memind);
-    if (insind < 0)
-         return insind;
+    if (block->lockfree) __atomic_add_fetch(&block->qlen, 1, __ATOMIC_SEQ_CST);
+    else block->qlen++;
 
-    if (insind > block->qlen)
-        insind = block->qlen; 
-
-    if (insind < block->qlen)
-        memmove(&block->arr[block->size+insind+1],
-                &block->arr[block->size+insind],
-                (block->qlen-insind) * width);
-
-    block->qlen++;
-    block->arr[block->size + insind] = memind;
-
-    return insind;
+    return 0;
 }
 
 
 int mem_block_unit_remove (void * psb, int memind)
 {
     MemBlock * block = (MemBlock *)psb;
-    uint8    * insp = NULL;
-    uint8    * pbgn = NULL;
-    int        ind;
 
     if (!block) return -1;
     if (memind < 0 || memind >= block->size) return -100;
 
-    if (block->qlen <= 0) return -200;
-
-    pbgn = (uint8 *)&block->arr[block->size];
-
-    insp = bsearch(&memind, pbgn, block->qlen,
-                   sizeof(int), mem_block_key_cmp_unit);
-    if (!insp)
-        return 0;
+    if (mem_block_unit_num(block) <= 0) return -200;
 
-    ind = (insp - pbgn)/sizeof(int);
-    if (ind < 0 || ind >= block->qlen)
-        return -300;
-
-    memmove(&block->arr[block->size+ind],
-            &block->arr[block->size+ind+1],
-            (block->qlen-ind-1)*sizeof(int));
-
-    block->arr[block->qlen-1] = -1;
-    block->qlen -= 1;
+    mem_block_sort_recycle(block, memind);
 
     return 0;
 }
@@ -438,56 +393,57 @@ int mem_block_unit_num (void * psb)
     MemBlock * block = (MemBlock *)psb;
     if (!block) return -1;
 
+    if (block->lockfree)
+        return __atomic_load_n(&block->qlen, __ATOMIC_SEQ_CST);
+
     return block->qlen;
 }
 
+/* the qind-th allocated unit in ascending order. the clear bits of
+ * level 0 are counted a word at a time */
 void * mem_block_unit_get (void * psb, int qind)
 {
     MemBlock * block = (MemBlock *)psb;
-    int        memind = 0;
-    uint8    * pmem = NULL;
+    uint64     w = 0;
+    int        i, num, memind;
     
     if (!block)
         return NULL;
 
-    if (qind < 0 || qind >= block->qlen)
+    if (qind < 0 || qind >= mem_block_unit_num(block))
         return NULL;
 
-    memind = block->arr[block->size + qind];
-    if (memind < 0 || memind >= block->size)
-        return NULL;
+    for (i = 0; i < block->words[0]; i++) {
+        w = ~mb_load(block, MB_LEVEL(block, 0) + i);
 
-    pmem = block->storage + memind * block->unitsize;
+        /* the bits beyond the last unit are not allocated units */
+        if (i == block->words[0] - 1 && block->size % 64)
+            w &= ((uint64)1 << (block->size % 64)) - 1;
 
-    return pmem;
+        num = mb_popcount(w);
+        if (qind < num) break;
+        qind -= num;
+    }
+    if (i >= block->words[0]) return NULL;
+
+    for ( ; qind > 0; qind--) w &= w - 1;
+
+    memind = i * 64 + mb_ctz(w);
+
+    return MB_STORAGE(block) + memind * block->unitsize;
 }
 
 
-void mem_block_print (void * psb, FILE * fp)
+static void mem_block_print_map (MemBlock * block, FILE * fp, int freed)
 {
-    MemBlock * block = (MemBlock *)psb;
-    int         i, line, totalline, ind;
     char        buf[128];
     char        tmpb[32], tmpc[16];
     int         CHonLine = 100;
     int         BGN = 4;
     int         WIDTH = 6;
+    int         i, line, ind = 0;
+    int         isfree = 0;
 
-    if (!block) return;
-    if (!fp) fp = stdout;
-
-    fprintf(fp, "\n____________________________________________Memory Block____________________________________________\n");
-    fprintf(fp, "Control Header Basic:\n");
-    fprintf(fp, "    Total Size      : %d bytes\n", block->totalsize);
-    fprintf(fp, "    Unused Size     : %d bytes\n", block->unused);
-    fprintf(fp, "    Header Size     : %d bytes\n", 
-             (int)(sizeof(*block)-sizeof(int)+2*block->size*sizeof(int)));
-    fprintf(fp, "    MemUnit Size    : %d bytes\n", block->unitsize);
-    fprintf(fp, "    MemUnit Number  : %d\n", block->size);
-    fprintf(fp, "    MemUnit RestNum : %d\n", block->size-block->start);
-    fprintf(fp, "    MemUnit AllocNum: %d\n", block->qlen);
-
-    fprintf(fp, "Unallocated Memory Unit Map:\n");
     memset(buf, 0, sizeof(buf));
 
     memset(buf, ' ', CHonLine); 
@@ -498,50 +454,47 @@ void mem_block_print (void * psb, FILE * fp)
     }
     fprintf(fp, "%s\n", buf);
 
-    totalline = (block->size + 15)/16;
-    for (line=0; line<totalline; line++) {
+    for (line=0; ind < block->size; line++) {
         memset(buf, ' ', CHonLine); 
         sprintf(tmpb, "%04d", line);
         memcpy(buf, tmpb, 4);
-        for (i=0; i<15; i++) {
-            ind = 16 * line + i;
-            if (ind >= block->size) break;
-            sprintf(tmpb, "%d", block->arr[ind]);
+        for (i=0; i<15 && ind < block->size; ind++) {
+            isfree = (mb_load(block, MB_LEVEL(block, 0) + ind / 64) >> (ind % 64)) & 1;
+            if (isfree != freed) continue;
+
+            sprintf(tmpb, "%d", ind);
             memset(tmpc, 0, sizeof(tmpc)); memset(tmpc, ' ', WIDTH);
             memcpy(tmpc+WIDTH-strlen(tmpb), tmpb, strlen(tmpb));
             memcpy(&buf[BGN+i*WIDTH], tmpc, WIDTH);
+            i++;
         }
-        fprintf(fp, "%s\n", buf);
-        if (ind >= block->size) break;
+        if (i > 0) fprintf(fp, "%s\n", buf);
     }
+}
 
-    fprintf(fp, "Allocated Memory Unit Map:\n");
-    memset(buf, 0, sizeof(buf));
+void mem_block_print (void * psb, FILE * fp)
+{
+    MemBlock * block = (MemBlock *)psb;
 
-    memset(buf, ' ', CHonLine); 
-    for (i=0; i<15; i++) {
-        if (i<10) sprintf(tmpb, "     %d", i);
-        else sprintf(tmpb, "    %d", i);
-        memcpy(&buf[BGN+i*WIDTH], tmpb, WIDTH);
-    }
-    fprintf(fp, "%s\n", buf);
+    if (!block) return;
+    if (!fp) fp = stdout;
 
-    totalline = (block->size + 15)/16;
-    for (line=0; line<totalline; line++) {
-        memset(buf, ' ', CHonLine); 
-        sprintf(tmpb, "%04d", line);
-        memcpy(buf, tmpb, 4);
-        for (i=0; i<15; i++) {
-            ind = 16 * line + i;
-            if (ind >= block->size) break;
-            sprintf(tmpb, "%d", block->arr[block->size+ind]);
-            memset(tmpc, 0, sizeof(tmpc)); memset(tmpc, ' ', WIDTH);
-            memcpy(tmpc+WIDTH-strlen(tmpb), tmpb, strlen(tmpb));
-            memcpy(&buf[BGN+i*WIDTH], tmpc, WIDTH);
-        }
-        fprintf(fp, "%s\n", buf);
-        if (ind >= block->size) break;
-    }
+    fprintf(fp, "\n____________________________________________Memory Block____________________________________________\n");
+    fprintf(fp, "Control Header Basic:\n");
+    fprintf(fp, "    Total Size      : %d bytes\n", block->totalsize);
+    fprintf(fp, "    Unused Size     : %d bytes\n", block->unused);
+    fprintf(fp, "    Header Size     : %d bytes\n", block->stoff);
+    fprintf(fp, "    MemUnit Size    : %d bytes\n", block->unitsize);
+    fprintf(fp, "    MemUnit Number  : %d\n", block->size);
+    fprintf(fp, "    MemUnit RestNum : %d\n", mem_block_restnum(block));
+    fprintf(fp, "    MemUnit AllocNum: %d\n", mem_block_unit_num(block));
+    fprintf(fp, "    Lock-free       : %d\n", block->lockfree);
+
+    fprintf(fp, "Unallocated Memory Unit Map:\n");
+    mem_block_print_map(block, fp, 1);
+
+    fprintf(fp, "Allocated Memory Unit Map:\n");
+    mem_block_print_map(block, fp, 0);
 
     fprintf(fp, "\n----------------------------------------------------------------------------------------------------\n");
 }
@@ -3,99 +3,329 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "btype.h"
 #include "memory.h"
 #include "mthread.h"
 #include "dynarr.h"
 #include "mpool.h"
+#include "trace.h"
+
+#if defined(_LINUX_)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef UNIX
+#include <sys/mman.h>
+#endif
 
 #ifdef _MEMDBG
 
-CRITICAL_SECTION  kmemCS;
-uint64            kmemid = 0;
-arr_t           * kmem_list = NULL;
-char              kmem_init = 0;
+/* the allocations are tracked in KMEM_SHARDS hash tables keyed by pointer.
+ * each shard has its own lock, so that threads allocating concurrently
+ * rarely contend. the tracking structures are allocated via malloc/free
+ * directly and never recurse into kalloc */
 
-uint16  mflag = 0xb05a;
+#define KMEM_SHARDS      64
+#define KMEM_SITE_SLOTS  4096
+
+struct kmem_site_;
 
 #pragma pack(1)
 
 typedef struct kmemhdr_ {
-    uint64          memid;
-    uint32          size;
-    uint16          kflag;
-    int             line;
-    char            file[32];
-    uint16          reallocate;
+    uint64             memid;
+    uint32             size;
+    uint16             kflag;
+    int                line;
+    char               file[32];
+    uint16             reallocate;
+
+    struct kmemhdr_  * hnext;
+    struct kmem_site_ * site;
 } KmemHdr;
 
 #pragma pack()
 
+/* aggregated counters for one allocating call-site file:line */
+typedef struct kmem_site_ {
+    struct kmem_site_ * next;
+    char               file[32];
+    int                line;
+
+    uint64             alloc_num;
+    uint64             free_num;
+    uint64             alloc_size;
+    int64              cur_num;
+    int64              cur_size;
+} KmemSite;
+
+typedef struct kmem_shard_ {
+    CRITICAL_SECTION   shCS;
+    ulong              num;
+    ulong              len;      /* power of 2 */
+    KmemHdr         ** ptab;
+} KmemShard;
+
+typedef struct kmem_snap_ {
+    time_t             stamp;
+    uint64             memid;
+    int                num;
+    KmemSite           site[1];
+} KmemSnap;
+
+static KmemShard   kmem_shard[KMEM_SHARDS];
+static KmemSite  * kmem_site[KMEM_SITE_SLOTS];
+static CRITICAL_SECTION kmem_siteCS[KMEM_SHARDS];
+
+uint64            kmemid = 0;
+char              kmem_init = 0;
+
+uint16  mflag = 0xb05a;
+
+static void kmem_init_all ()
+{
+    int i;
+
+    for (i = 0; i < KMEM_SHARDS; i++) {
+        InitializeCriticalSection(&kmem_shard[i].shCS);
+        kmem_shard[i].num = 0;
+        kmem_shard[i].len = 1024;
+        kmem_shard[i].ptab = calloc(kmem_shard[i].len, sizeof(KmemHdr *));
+
+        InitializeCriticalSection(&kmem_siteCS[i]);
+    }
+
+    memset(kmem_site, 0, sizeof(kmem_site));
+    kmemid = 0;
+    kmem_init = 1;
+}
+
+static ulong kmem_ptr_hash (void * ptr)
+{
+    ulong h = (ulong)ptr;
+
+    /* malloc pointers are aligned, mix the higher bits down */
+    h ^= h >> 17;
+    h *= 0x9E3779B1UL;
+    h ^= h >> 13;
+    return h;
+}
+
 uint64 getmemid() {
+#if defined(__GNUC__)
+    return __sync_fetch_and_add(&kmemid, 1);
+#else
     uint64 id = 0;
-    EnterCriticalSection(&kmemCS);
+    EnterCriticalSection(&kmem_shard[0].shCS);
     id = kmemid++;
-    LeaveCriticalSection(&kmemCS);
+    LeaveCriticalSection(&kmem_shard[0].shCS);
     return id;
+#endif
+}
+
+static KmemSite * kmem_site_get (char * file, int line)
+{
+    KmemSite * site = NULL;
+    ulong      hash, idx;
+    int        stripe;
+
+    hash = (ulong)line * 31;
+    for (idx = 0; file[idx] && idx < sizeof(site->file) - 1; idx++)
+        hash = hash * 131 + (uint8)file[idx];
+
+    idx = hash % KMEM_SITE_SLOTS;
+    stripe = idx % KMEM_SHARDS;
+
+    EnterCriticalSection(&kmem_siteCS[stripe]);
+
+    for (site = kmem_site[idx]; site; site = site->next) {
+        if (site->line == line && strncmp(site->file, file, sizeof(site->file)-1) == 0)
+            break;
+    }
+
+    if (!site) {
+        site = calloc(1, sizeof(*site));
+        if (site) {
+            memcpy(site->file, file, sizeof(site->file)-1);
+            site->line = line;
+            site->next = kmem_site[idx];
+            kmem_site[idx] = site;
+        }
+    }
+
+    LeaveCriticalSection(&kmem_siteCS[stripe]);
+
+    return site;
 }
 
-int kmem_cmp_kmem_by_id (void * a, void * b) {
-    KmemHdr * mema = (KmemHdr *)a;
-    KmemHdr * memb = (KmemHdr *)b;
+static void kmem_site_update (KmemSite * site, uint32 size, int add)
+{
+    if (!site) return;
+
+#if defined(__GNUC__)
+    if (add) {
+        __sync_fetch_and_add(&site->alloc_num, 1);
+        __sync_fetch_and_add(&site->alloc_size, size);
+        __sync_fetch_and_add(&site->cur_num, 1);
+        __sync_fetch_and_add(&site->cur_size, size);
+    } else {
+        __sync_fetch_and_add(&site->free_num, 1);
+        __sync_fetch_and_sub(&site->cur_num, 1);
+        __sync_fetch_and_sub(&site->cur_size, size);
+    }
+#else
+    EnterCriticalSection(&kmem_siteCS[0]);
+    if (add) {
+        site->alloc_num++;
+        site->alloc_size += size;
+        site->cur_num++;
+        site->cur_size += size;
+    } else {
+        site->free_num++;
+        site->cur_num--;
+        site->cur_size -= size;
+    }
+    LeaveCriticalSection(&kmem_siteCS[0]);
+#endif
+}
 
-    if (!a) return -1;
-    if (!b) return 1;
+static void kmem_shard_grow (KmemShard * shard)
+{
+    KmemHdr ** ptab = NULL;
+    KmemHdr  * hdr = NULL;
+    KmemHdr  * next = NULL;
+    ulong      len, i, idx;
+
+    len = shard->len * 2;
+    ptab = calloc(len, sizeof(KmemHdr *));
+    if (!ptab) return;
+
+    for (i = 0; i < shard->len; i++) {
+        for (hdr = shard->ptab[i]; hdr; hdr = next) {
+            next = hdr->hnext;
+            idx = (kmem_ptr_hash(hdr) / KMEM_SHARDS) & (len - 1);
+            hdr->hnext = ptab[idx];
+            ptab[idx] = hdr;
+        }
+    }
 
-    if (mema->memid > memb->memid) return 1;
-    if (mema->memid < memb->memid) return -1;
-    return 0;
+    free(shard->ptab);
+    shard->ptab = ptab;
+    shard->len = len;
 }
 
 int kmem_add(void * ptr) {
-    KmemHdr * hdr = (KmemHdr *)ptr;
-    if (kmem_init == 0) {
-        kmem_init = 1;
-        InitializeCriticalSection(&kmemCS);
-        kmem_list = arr_new(8*1024*1024);
-        kmemid = 0;
-    }
+    KmemHdr   * hdr = (KmemHdr *)ptr;
+    KmemShard * shard = NULL;
+    ulong       hash, idx;
+
+    if (kmem_init == 0) kmem_init_all();
+
     if (!ptr) return -1;
 
-    EnterCriticalSection(&kmemCS);
-    arr_insert_by(kmem_list, hdr, kmem_cmp_kmem_by_id);
-    LeaveCriticalSection(&kmemCS);
+    hdr->site = kmem_site_get(hdr->file, hdr->line);
+    kmem_site_update(hdr->site, hdr->size, 1);
+
+    hash = kmem_ptr_hash(hdr);
+    shard = &kmem_shard[hash % KMEM_SHARDS];
+
+    EnterCriticalSection(&shard->shCS);
+
+    if (shard->num >= shard->len * 2)
+        kmem_shard_grow(shard);
+
+    idx = (hash / KMEM_SHARDS) & (shard->len - 1);
+    hdr->hnext = shard->ptab[idx];
+    shard->ptab[idx] = hdr;
+    shard->num++;
+
+    LeaveCriticalSection(&shard->shCS);
 
     return 0;
 }
 
 int kmem_del(void * ptr) {        
-    KmemHdr * hdr = (KmemHdr *)ptr;
-    if (!ptr) return -1;
+    KmemHdr   * hdr = (KmemHdr *)ptr;
+    KmemHdr  ** pp = NULL;
+    KmemShard * shard = NULL;
+    ulong       hash, idx;
+    int         found = 0;
 
-    EnterCriticalSection(&kmemCS);
-    arr_delete_by(kmem_list, hdr, kmem_cmp_kmem_by_id);
-    LeaveCriticalSection(&kmemCS);
+    if (!ptr || kmem_init == 0) return -1;
+
+    hash = kmem_ptr_hash(hdr);
+    shard = &kmem_shard[hash % KMEM_SHARDS];
+
+    EnterCriticalSection(&shard->shCS);
+
+    idx = (hash / KMEM_SHARDS) & (shard->len - 1);
+    for (pp = &shard->ptab[idx]; *pp; pp = &(*pp)->hnext) {
+        if (*pp == hdr) {
+            *pp = hdr->hnext;
+            shard->num--;
+            found = 1;
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&shard->shCS);
+
+    if (!found) return -100;
+
+    kmem_site_update(hdr->site, hdr->size, 0);
+    hdr->hnext = NULL;
+    hdr->site = NULL;
 
     return 0;
 }        
 
+static int kmem_cmp_kmem_by_id (const void * a, const void * b) {
+    KmemHdr * mema = *(KmemHdr **)a;
+    KmemHdr * memb = *(KmemHdr **)b;
+
+    if (mema->memid > memb->memid) return 1;
+    if (mema->memid < memb->memid) return -1;
+    return 0;
+}
+
 void kmem_print() {
     time_t curt = time(0);
     FILE  * fp = NULL;
-    int     i, num;
+    ulong   i, j, num = 0, total = 0;
     char  file[32];
-    KmemHdr * hdr = NULL;
+    KmemHdr  * hdr = NULL;
+    KmemHdr ** list = NULL;
     uint64    msize = 0;
 
+    if (kmem_init == 0) return;
+
     sprintf(file, "kmem-%lu.txt", curt);
     fp = fopen(file, "w");
+    if (!fp) return;
 
-    EnterCriticalSection(&kmemCS);
+    /* all shards are locked in order while printing, the blocks are
+     * listed in the order of allocation */
+    for (i = 0; i < KMEM_SHARDS; i++) {
+        EnterCriticalSection(&kmem_shard[i].shCS);
+        total += kmem_shard[i].num;
+    }
+
+    list = malloc((total + 1) * sizeof(KmemHdr *));
+    for (i = 0; list && i < KMEM_SHARDS; i++) {
+        for (j = 0; j < kmem_shard[i].len; j++) {
+            for (hdr = kmem_shard[i].ptab[j]; hdr && num < total; hdr = hdr->hnext)
+                list[num++] = hdr;
+        }
+    }
+    if (list) qsort(list, num, sizeof(KmemHdr *), kmem_cmp_kmem_by_id);
 
-    num = arr_num(kmem_list);
     for (i = 0;  i < num; i++) {
-        hdr = arr_value(kmem_list, i);
-        if (!hdr) continue;
+        hdr = list[i];
 
         if (hdr->kflag != mflag) {
             fprintf(fp, "%p, %uB, is corrupted\n", hdr, hdr->size);
@@ -107,17 +337,232 @@ void kmem_print() {
                 hdr->reallocate, hdr->line, hdr->file);
         msize += hdr->size;
     }
-    fprintf(fp, "Total Number: %u    Total MemSize: %llu\n", num, msize);
+    fprintf(fp, "Total Number: %lu    Total MemSize: %llu\n", num, msize);
+
+    for (i = KMEM_SHARDS; i > 0; i--)
+        LeaveCriticalSection(&kmem_shard[i-1].shCS);
+
+    if (list) free(list);
+
+    fprintf(fp, "\n");
+    kmem_site_print(fp);
 
-    LeaveCriticalSection(&kmemCS);
     fclose(fp);
 }
+
+void kmem_site_print (FILE * fp)
+{
+    KmemSite * site = NULL;
+    int        i;
+
+    if (!fp || kmem_init == 0) return;
+
+    fprintf(fp, "%-32s %6s %10s %10s %10s %14s\n",
+            "File", "Line", "Alloc", "Free", "Live", "LiveSize");
+
+    for (i = 0; i < KMEM_SITE_SLOTS; i++) {
+        EnterCriticalSection(&kmem_siteCS[i % KMEM_SHARDS]);
+        for (site = kmem_site[i]; site; site = site->next) {
+            fprintf(fp, "%-32s %6d %10llu %10llu %10lld %14lld\n",
+                    site->file, site->line, site->alloc_num, site->free_num,
+                    site->cur_num, site->cur_size);
+        }
+        LeaveCriticalSection(&kmem_siteCS[i % KMEM_SHARDS]);
+    }
+}
+
+void * kmem_snapshot ()
+{
+    KmemSnap * snap = NULL;
+    KmemSite * site = NULL;
+    int        i, num = 0, alloc = 256;
+
+    if (kmem_init == 0) kmem_init_all();
+
+    snap = malloc(sizeof(*snap) + alloc * sizeof(KmemSite));
+    if (!snap) return NULL;
+
+    snap->stamp = time(0);
+    snap->memid = kmemid;
+
+    for (i = 0; i < KMEM_SITE_SLOTS; i++) {
+        EnterCriticalSection(&kmem_siteCS[i % KMEM_SHARDS]);
+        for (site = kmem_site[i]; site; site = site->next) {
+            if (num >= alloc) {
+                KmemSnap * tmp = realloc(snap, sizeof(*snap) + alloc * 2 * sizeof(KmemSite));
+                if (!tmp) break;
+                snap = tmp;
+                alloc *= 2;
+            }
+            snap->site[num] = *site;
+            snap->site[num].next = site;   /* identifies the site in diff */
+            num++;
+        }
+        LeaveCriticalSection(&kmem_siteCS[i % KMEM_SHARDS]);
+    }
+
+    snap->num = num;
+    return snap;
+}
+
+void kmem_snapshot_free (void * vsnap)
+{
+    if (vsnap) free(vsnap);
+}
+
+int kmem_snapshot_diff (void * vold, void * vnew, FILE * fp)
+{
+    KmemSnap * olds = (KmemSnap *)vold;
+    KmemSnap * news = (KmemSnap *)vnew;
+    KmemSite * os = NULL;
+    KmemSite * ns = NULL;
+    int64      dnum, dsize;
+    int        i, j, changed = 0;
+
+    if (!olds || !news || !fp) return -1;
+
+    fprintf(fp, "kmem diff over %ld seconds, %llu allocations\n",
+            (long)(news->stamp - olds->stamp), news->memid - olds->memid);
+    fprintf(fp, "%-32s %6s %10s %10s %10s %14s\n",
+            "File", "Line", "Alloc", "Free", "LiveDiff", "LiveSizeDiff");
+
+    for (i = 0; i < news->num; i++) {
+        ns = &news->site[i];
+        os = NULL;
+
+        for (j = 0; j < olds->num; j++) {
+            if (olds->site[j].next == ns->next) {
+                os = &olds->site[j];
+                break;
+            }
+        }
+
+        dnum = ns->cur_num - (os ? os->cur_num : 0);
+        dsize = ns->cur_size - (os ? os->cur_size : 0);
+        if (dnum == 0 && dsize == 0) continue;
+
+        fprintf(fp, "%-32s %6d %10llu %10llu %+10lld %+14lld\n",
+                ns->file, ns->line,
+                ns->alloc_num - (os ? os->alloc_num : 0),
+                ns->free_num - (os ? os->free_num : 0),
+                dnum, dsize);
+        changed++;
+    }
+
+    return changed;
+}
+
 #else
 void kmem_print() {
 }
+
+void kmem_site_print (FILE * fp) {
+}
+
+void * kmem_snapshot () {
+    return NULL;
+}
+
+void kmem_snapshot_free (void * vsnap) {
+}
+
+int kmem_snapshot_diff (void * vold, void * vnew, FILE * fp) {
+    return 0;
+}
 #endif
 
 
+/* the backend under kalloc, libc by default. the default is called directly
+ * rather than via the function pointers, so it costs one compare */
+
+static void * libc_alloc (void * ctx, size_t size)
+{
+    return malloc(size);
+}
+
+static void * libc_zalloc (void * ctx, size_t size)
+{
+    return calloc(1, size);
+}
+
+static void * libc_realloc (void * ctx, void * ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void libc_free (void * ctx, void * ptr)
+{
+    free(ptr);
+}
+
+static KmemBackend   kmem_libc = { libc_alloc, libc_zalloc, libc_realloc, libc_free, NULL, NULL };
+static KmemBackend * g_kmem = &kmem_libc;
+
+int kmem_set_backend (KmemBackend * backend)
+{
+    if (!backend) backend = &kmem_libc;
+
+    if (!backend->alloc || !backend->realloc || !backend->free)
+        return -1;
+
+    __atomic_store_n(&g_kmem, backend, __ATOMIC_RELEASE);
+    return 0;
+}
+
+KmemBackend * kmem_get_backend ()
+{
+    return __atomic_load_n(&g_kmem, __ATOMIC_ACQUIRE);
+}
+
+static inline void * kmem_raw_alloc (size_t size)
+{
+    KmemBackend * be = __atomic_load_n(&g_kmem, __ATOMIC_ACQUIRE);
+
+    if (be == &kmem_libc) return malloc(size);
+
+    return be->alloc(be->ctx, size);
+}
+
+static inline void * kmem_raw_zalloc (size_t size)
+{
+    KmemBackend * be = __atomic_load_n(&g_kmem, __ATOMIC_ACQUIRE);
+    void        * ptr = NULL;
+
+    if (be == &kmem_libc) return calloc(1, size);
+
+    if (be->zalloc) return be->zalloc(be->ctx, size);
+
+    ptr = be->alloc(be->ctx, size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+static inline void * kmem_raw_realloc (void * ptr, size_t size)
+{
+    KmemBackend * be = __atomic_load_n(&g_kmem, __ATOMIC_ACQUIRE);
+
+    if (be == &kmem_libc) return realloc(ptr, size);
+
+    return be->realloc(be->ctx, ptr, size);
+}
+
+/* size 0 if not known */
+static inline void kmem_raw_free (void * ptr, size_t size)
+{
+    KmemBackend * be = __atomic_load_n(&g_kmem, __ATOMIC_ACQUIRE);
+
+    if (be == &kmem_libc) {
+        free(ptr);
+        return;
+    }
+
+    if (size > 0 && be->free_sized)
+        be->free_sized(be->ctx, ptr, size);
+    else
+        be->free(be->ctx, ptr);
+}
+
+
 void * kalloc_dbg (size_t size, char * file, int line)
 {
     void * ptr = NULL;
@@ -126,7 +571,8 @@ void * kalloc_dbg (size_t size, char * file, int line)
 
     if (size <= 0) return NULL;
 
-    ptr = malloc(size + sizeof(KmemHdr));
+    ptr = kmem_raw_alloc(size + sizeof(KmemHdr));
+    if (!ptr) return NULL;
 
     hdr = (KmemHdr *)ptr;
     memset(hdr, 0, sizeof(*hdr));
@@ -140,7 +586,7 @@ void * kalloc_dbg (size_t size, char * file, int line)
     return (uint8 *)ptr + sizeof(KmemHdr);
 #else
     if (size <= 0) return NULL;
-    ptr = malloc(size);
+    ptr = kmem_raw_alloc(size);
     return ptr;
 #endif
 }
@@ -154,9 +600,8 @@ void * kzalloc_dbg (size_t size, char * file, int line)
 
     if (size <= 0) return NULL;
 
-    ptr = malloc(size + sizeof(KmemHdr));
-    if (ptr)
-        memset(ptr, 0, size + sizeof(KmemHdr));
+    ptr = kmem_raw_zalloc(size + sizeof(KmemHdr));
+    if (!ptr) return NULL;
 
     hdr = (KmemHdr *)ptr;
     hdr->size = size;
@@ -170,8 +615,7 @@ void * kzalloc_dbg (size_t size, char * file, int line)
 #else
 
     if (size <= 0) return NULL;
-    ptr = malloc(size);
-    if (ptr) memset(ptr, 0, size);
+    ptr = kmem_raw_zalloc(size);
     return ptr;
 #endif
 } 
@@ -191,15 +635,15 @@ void * krealloc_dbg(void * ptr, size_t size, char * file, int line)
         kmem_del(hdr);
 
         if (hdr->kflag != mflag)
-            tolog("###Panic: %s:%d krealloc %ld bytes, old %p:%llu %u bytes alloc by %s:%d ruined\n",
+            tolog(1, "###Panic: %s:%d krealloc %ld bytes, old %p:%llu %u bytes alloc by %s:%d ruined\n",
                      file, line, size, ptr, memid, hdr->size, hdr->file, hdr->line);
 
-        ptr = realloc((uint8 *)ptr - sizeof(KmemHdr), size + sizeof(KmemHdr));
+        ptr = kmem_raw_realloc((uint8 *)ptr - sizeof(KmemHdr), size + sizeof(KmemHdr));
     } else
-        ptr = malloc(size + sizeof(KmemHdr));
+        ptr = kmem_raw_alloc(size + sizeof(KmemHdr));
  
     if (ptr == NULL) {
-        if (oldp) free((uint8 *)oldp - sizeof(KmemHdr));
+        if (oldp) kmem_raw_free((uint8 *)oldp - sizeof(KmemHdr), 0);
         return NULL;
     }
 
@@ -216,9 +660,9 @@ void * krealloc_dbg(void * ptr, size_t size, char * file, int line)
 #else
     oldp = ptr;
     if (ptr != NULL) 
-        ptr = realloc((uint8 *)ptr, size);
+        ptr = kmem_raw_realloc((uint8 *)ptr, size);
     else
-        ptr = realloc(ptr, size);
+        ptr = kmem_raw_alloc(size);
 
     if (ptr == NULL) {
         if (oldp) kfree(oldp);
@@ -236,13 +680,34 @@ void  kfree_dbg (void * ptr, char * file, int line)
         KmemHdr * hdr = (KmemHdr *)((uint8 *)ptr - sizeof(KmemHdr));
         kmem_del(hdr);
         if (hdr->kflag != mflag) {
-            tolog("###Panic: %s:%d kfree %p:%llu %u bytes alloc by %s:%d ruined\n", 
+            tolog(1, "###Panic: %s:%d kfree %p:%llu %u bytes alloc by %s:%d ruined\n", 
                   file, line, ptr, hdr->memid, hdr->size, hdr->file, hdr->line);
             return;
         }
-        free(hdr);
+        kmem_raw_free(hdr, 0);
 #else
-        free(ptr);
+        kmem_raw_free(ptr, 0);
+#endif
+    }
+}
+
+void  kfree_sz_dbg (void * ptr, size_t size, char * file, int line)
+{
+    if (ptr) {
+#ifdef _MEMDBG
+        KmemHdr * hdr = (KmemHdr *)((uint8 *)ptr - sizeof(KmemHdr));
+        kmem_del(hdr);
+        if (hdr->kflag != mflag) {
+            tolog(1, "###Panic: %s:%d kfree_sz %p:%llu %u bytes alloc by %s:%d ruined\n", 
+                  file, line, ptr, hdr->memid, hdr->size, hdr->file, hdr->line);
+            return;
+        }
+        if (hdr->size != size)
+            tolog(1, "###Panic: %s:%d kfree_sz %p:%llu %lu bytes, alloc %u bytes by %s:%d\n", 
+                  file, line, ptr, hdr->memid, (ulong)size, hdr->size, hdr->file, hdr->line);
+        kmem_raw_free(hdr, hdr->size + sizeof(KmemHdr));
+#else
+        kmem_raw_free(ptr, size);
 #endif
     }
 }
@@ -1265,6 +1730,11 @@ typedef struct MemBlkPool_ {
     arr_t            * mem_blk_list;
     void             * blk_pool;
     CRITICAL_SECTION   blklistCS;
+
+    /* the new blocks are bound to node, -1 for the node of the thread
+       growing the pool */
+    uint8              numa;
+    int                node;
 } mupool_t, *mupool_p;
  
 
@@ -1288,6 +1758,21 @@ int mem_blk_cmp_pmem (void * a, void * b)
 }
 
 
+static void * mupool_blk_fetch (mupool_t * pool)
+{
+    void * mblk = NULL;
+
+    if (pool->blk_pool)
+        mblk = mpool_fetch(pool->blk_pool);
+    else
+        mblk = kalloc(pool->blksize);
+
+    if (mblk && pool->numa)
+        mem_numa_bind(mblk, pool->blksize, pool->node);
+
+    return mblk;
+}
+
 void * mupool_init (size_t blksize, void * mpool)
 {
     mupool_t * pool = NULL;
@@ -1307,6 +1792,20 @@ void * mupool_init (size_t blksize, void * mpool)
     return pool;
 }
 
+int mupool_set_numa (void * vpool, int on, int node)
+{
+    mupool_t * pool = (mupool_t *)vpool;
+
+    if (!pool) return -1;
+
+    if (node < -1) return -2;
+
+    pool->numa = on ? 1 : 0;
+    pool->node = node;
+
+    return 0;
+}
+
 void mupool_clean (void * vpool)
 {
     mupool_t * pool = (mupool_t *)vpool;
@@ -1385,11 +1884,7 @@ void * mupool_alloc (void * vpool, size_t size)
         }
     }
 
-    if (pool->blk_pool)
-        mblk = mpool_fetch(pool->blk_pool);
-    else
-        mblk = kalloc(pool->blksize);
- 
+    mblk = mupool_blk_fetch(pool);
     if (!mblk) {
         LeaveCriticalSection(&pool->blklistCS);
         return NULL;
@@ -1453,11 +1948,7 @@ void * mupool_realloc (void * vpool, void * pmem, size_t size)
     }
  
     if (i >= num) { //not found in list
-        if (pool->blk_pool)
-            iblk = mpool_fetch(pool->blk_pool);
-        else
-            iblk = kalloc(pool->blksize);
-
+        iblk = mupool_blk_fetch(pool);
         if (!iblk) {
             LeaveCriticalSection(&pool->blklistCS);
             return NULL;
@@ -1625,3 +2116,609 @@ void mupool_print (FILE * fp, void * vpool)
     LeaveCriticalSection(&pool->blklistCS);
 }
 
+
+
+/* bump-pointer arena. the blocks are chained and never freed individually.
+ * arena_reset rewinds to the first block and keeps all the blocks for
+ * reusing. no lock is taken, an arena is owned by one request or thread */
+
+#define ARENA_ALIGN   8
+#define arena_align(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_blk_ {
+    struct arena_blk_ * next;
+    size_t              size;
+    size_t              used;
+    uint8               frompool;
+    uint8               resv[ARENA_ALIGN - 1];
+} ArenaBlk;
+
+typedef struct arena_s {
+    size_t             blksize;
+    void             * blk_pool;
+    int                grow;
+
+    ArenaBlk         * head;
+    ArenaBlk         * cur;
+
+    size_t             allocsize;
+} arena_t;
+
+#define arena_blk_data(blk) ((uint8 *)(blk) + arena_align(sizeof(ArenaBlk)))
+
+static ArenaBlk * arena_blk_new (arena_t * arena, size_t size)
+{
+    ArenaBlk * blk = NULL;
+    size_t     blksize = arena->blksize;
+    uint8      frompool = 0;
+
+    if (size + arena_align(sizeof(ArenaBlk)) > blksize)
+        blksize = size + arena_align(sizeof(ArenaBlk));
+
+    if (arena->blk_pool && blksize <= arena->blksize) {
+        blk = mpool_fetch(arena->blk_pool);
+        frompool = 1;
+    } else {
+        blk = kalloc(blksize);
+    }
+    if (!blk) return NULL;
+
+    blk->next = NULL;
+    blk->size = blksize - arena_align(sizeof(ArenaBlk));
+    blk->used = 0;
+    blk->frompool = frompool;
+
+    return blk;
+}
+
+void * arena_init (size_t blksize, void * mpool, int grow)
+{
+    arena_t * arena = NULL;
+
+    arena = kzalloc(sizeof(*arena));
+    if (!arena) return NULL;
+
+    if (mpool) blksize = mpool_unitsize(mpool);
+    if (blksize <= arena_align(sizeof(ArenaBlk)))
+        blksize = 8192;
+
+    arena->blksize = blksize;
+    arena->blk_pool = mpool;
+    arena->grow = grow;
+
+    arena->head = arena_blk_new(arena, 0);
+    if (!arena->head) {
+        kfree(arena);
+        return NULL;
+    }
+    arena->cur = arena->head;
+
+    return arena;
+}
+
+void arena_clean (void * varena)
+{
+    arena_t  * arena = (arena_t *)varena;
+    ArenaBlk * blk = NULL;
+    ArenaBlk * next = NULL;
+
+    if (!arena) return;
+
+    for (blk = arena->head; blk; blk = next) {
+        next = blk->next;
+
+        if (blk->frompool)
+            mpool_recycle(arena->blk_pool, blk);
+        else
+            kfree(blk);
+    }
+
+    kfree(arena);
+}
+
+void arena_reset (void * varena)
+{
+    arena_t * arena = (arena_t *)varena;
+
+    if (!arena) return;
+
+    arena->cur = arena->head;
+    arena->cur->used = 0;
+    arena->allocsize = 0;
+}
+
+void * arena_alloc (void * varena, size_t size)
+{
+    arena_t  * arena = (arena_t *)varena;
+    ArenaBlk * blk = NULL;
+    void     * pmem = NULL;
+
+    if (!arena || size == 0) return NULL;
+
+    size = arena_align(size);
+
+    blk = arena->cur;
+    if (blk->size - blk->used < size) {
+        /* move to the retained blocks after a reset, skipping small ones */
+        for (blk = blk->next; blk && blk->size < size; blk = blk->next);
+
+        if (blk) {
+            blk->used = 0;
+
+        } else {
+            if (!arena->grow) return NULL;
+
+            blk = arena_blk_new(arena, size);
+            if (!blk) return NULL;
+
+            blk->next = arena->cur->next;
+            arena->cur->next = blk;
+        }
+
+        arena->cur = blk;
+    }
+
+    pmem = arena_blk_data(blk) + blk->used;
+    blk->used += size;
+    arena->allocsize += size;
+
+    return pmem;
+}
+
+void * arena_zalloc (void * varena, size_t size)
+{
+    void * pmem = NULL;
+
+    pmem = arena_alloc(varena, size);
+    if (pmem) memset(pmem, 0, size);
+
+    return pmem;
+}
+
+void * arena_realloc (void * varena, void * pmem, size_t oldsize, size_t size)
+{
+    arena_t  * arena = (arena_t *)varena;
+    ArenaBlk * blk = NULL;
+    void     * pnew = NULL;
+
+    if (!arena) return NULL;
+
+    /* the last allocation of current block can be extended in place */
+    blk = arena->cur;
+    if (pmem && (uint8 *)pmem + arena_align(oldsize) == arena_blk_data(blk) + blk->used &&
+        arena_align(size) - arena_align(oldsize) <= blk->size - blk->used)
+    {
+        blk->used += arena_align(size) - arena_align(oldsize);
+        arena->allocsize += arena_align(size) - arena_align(oldsize);
+        return pmem;
+    }
+
+    if (pmem && size <= oldsize) return pmem;
+
+    pnew = arena_alloc(arena, size);
+    if (pnew && pmem && oldsize > 0)
+        memcpy(pnew, pmem, oldsize);
+
+    return pnew;
+}
+
+char * arena_strdup (void * varena, char * str, int len)
+{
+    char * p = NULL;
+
+    if (!str) return NULL;
+    if (len < 0) len = strlen(str);
+
+    p = arena_alloc(varena, len + 1);
+    if (!p) return NULL;
+
+    memcpy(p, str, len);
+    p[len] = '\0';
+
+    return p;
+}
+
+size_t arena_allocsize (void * varena)
+{
+    arena_t * arena = (arena_t *)varena;
+
+    if (!arena) return 0;
+
+    return arena->allocsize;
+}
+
+size_t arena_totalsize (void * varena)
+{
+    arena_t  * arena = (arena_t *)varena;
+    ArenaBlk * blk = NULL;
+    size_t     total = 0;
+
+    if (!arena) return 0;
+
+    for (blk = arena->head; blk; blk = blk->next)
+        total += blk->size;
+
+    return total;
+}
+
+
+/* NUMA topology is probed once from /sys/devices/system/node. the cpu to
+ * node map lets the node of the calling thread be found by sched_getcpu,
+ * without a syscall. memory is bound by the raw mbind syscall, so libnuma
+ * is not needed */
+
+#define NUMA_MAX_NODES     64
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_MF_MOVE   (1 << 1)
+
+static int     g_numa_nodes = 0;    //0 if not probed yet
+static int     g_numa_cpus = 0;
+static uint8 * g_numa_cpu_node = NULL;
+
+#if defined(_LINUX_)
+static int numa_cpulist_parse (char * list, uint8 * map, int mapnum, int node)
+{
+    char * p = list;
+    long   from, to, cpu;
+    int    maxcpu = -1;
+
+    while (*p) {
+        from = strtol(p, &p, 10);
+        to = from;
+        if (*p == '-') to = strtol(p + 1, &p, 10);
+
+        for (cpu = from; cpu <= to && cpu < mapnum; cpu++) {
+            map[cpu] = (uint8)node;
+            if (cpu > maxcpu) maxcpu = (int)cpu;
+        }
+
+        if (*p != ',') break;
+        p++;
+    }
+
+    return maxcpu;
+}
+#endif
+
+static void numa_probe ()
+{
+#if defined(_LINUX_)
+    char    path[128];
+    char    list[1024];
+    FILE  * fp = NULL;
+    uint8 * map = NULL;
+    uint8 * p = NULL;
+    int     mapnum = 0;
+    int     node, cpu, nodes = 0, cpus = 0;
+
+    mapnum = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (mapnum < 1) mapnum = 1;
+    mapnum *= 2;  //cpu ids may have holes
+
+    map = calloc(mapnum, 1);
+    if (!map) goto single;
+
+    for (node = 0; node < NUMA_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        fp = fopen(path, "r");
+        if (!fp) break;
+
+        if (fgets(list, sizeof(list), fp)) {
+            cpu = numa_cpulist_parse(list, map, mapnum, node);
+            if (cpu >= cpus) cpus = cpu + 1;
+        }
+        fclose(fp);
+
+        nodes++;
+    }
+
+    if (nodes <= 1) {
+        free(map);
+        goto single;
+    }
+
+    /* racing probers compute the same map, only the first is kept */
+    p = NULL;
+    if (!__atomic_compare_exchange_n(&g_numa_cpu_node, &p, map, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        free(map);
+    g_numa_cpus = cpus;
+
+    __atomic_store_n(&g_numa_nodes, nodes, __ATOMIC_RELEASE);
+    return;
+
+single:
+#endif
+    __atomic_store_n(&g_numa_nodes, 1, __ATOMIC_RELEASE);
+}
+
+int mem_numa_nodes ()
+{
+    int  nodes = __atomic_load_n(&g_numa_nodes, __ATOMIC_ACQUIRE);
+
+    if (nodes == 0) {
+        numa_probe();
+        nodes = __atomic_load_n(&g_numa_nodes, __ATOMIC_ACQUIRE);
+    }
+
+    return nodes;
+}
+
+int mem_numa_node ()
+{
+#if defined(_LINUX_)
+    int  cpu;
+
+    if (mem_numa_nodes() <= 1) return 0;
+
+    cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= g_numa_cpus) return 0;
+
+    return g_numa_cpu_node[cpu];
+#else
+    return 0;
+#endif
+}
+
+int mem_numa_bind (void * pmem, size_t size, int node)
+{
+#if defined(_LINUX_) && defined(SYS_mbind)
+    ulong   mask[NUMA_MAX_NODES / (8 * sizeof(ulong))] = {0};
+    ulong   pgsize = (ulong)sysconf(_SC_PAGESIZE);
+    ulong   start, end;
+
+    if (!pmem || size == 0) return -1;
+
+    if (mem_numa_nodes() <= 1) return 0;
+
+    if (node < 0) node = mem_numa_node();
+    if (node >= NUMA_MAX_NODES) return -2;
+
+    /* only the whole pages inside are bound, the partial pages at both ends
+     * may be shared with other allocations */
+    start = ((ulong)pmem + pgsize - 1) & ~(pgsize - 1);
+    end = ((ulong)pmem + size) & ~(pgsize - 1);
+    if (end <= start) return 0;
+
+    mask[node / (8 * sizeof(ulong))] |= 1UL << (node % (8 * sizeof(ulong)));
+
+    if (syscall(SYS_mbind, start, end - start, NUMA_MPOL_PREFERRED,
+                mask, (ulong)NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) != 0)
+        return -100;
+
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+int mem_numa_prefer (int node)
+{
+#if defined(_LINUX_) && defined(SYS_set_mempolicy)
+    ulong   mask[NUMA_MAX_NODES / (8 * sizeof(ulong))] = {0};
+
+    if (mem_numa_nodes() <= 1) return 0;
+
+    if (node < 0) node = mem_numa_node();
+    if (node >= NUMA_MAX_NODES) return -2;
+
+    mask[node / (8 * sizeof(ulong))] |= 1UL << (node % (8 * sizeof(ulong)));
+
+    if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, (ulong)NUMA_MAX_NODES + 1) != 0)
+        return -100;
+
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+
+/* the large tables are backed by huge pages to cut the TLB misses of random
+ * lookups. every allocation has a header of 64 bytes in front, recording
+ * how it was allocated, so the data stays aligned to the cache line.
+ *
+ * MEM_HUGE_TLB maps the reserved pages of hugetlbfs by MAP_HUGETLB, which
+ * fails when the pool of /proc/sys/vm/nr_hugepages is used up and falls
+ * back to MEM_HUGE_THP. MEM_HUGE_THP maps the anonymous memory aligned to
+ * the huge page and asks khugepaged to back it by madvise(MADV_HUGEPAGE),
+ * it falls back to kalloc when mmap fails. the mapped memory is zeroed by
+ * the kernel, so the pages untouched are not committed */
+
+#define HUGE_PAGE_SIZE   (2UL << 20)
+#define HUGE_HDR_SIZE    64
+#define HUGE_MAGIC       0x48554745
+
+#define HUGE_KIND_HEAP   0
+#define HUGE_KIND_MMAP   1
+
+typedef struct huge_hdr_s {
+    size_t   size;      //bytes requested
+    size_t   maplen;    //bytes mapped from base, 0 for heap
+    void   * base;
+    uint32   magic;
+    uint32   kind;
+} HugeHdr;
+
+static int    g_huge_policy = MEM_HUGE_THP;
+static size_t g_huge_threshold = 8UL << 20;
+
+int mem_huge_set (int policy, size_t threshold)
+{
+    if (policy < MEM_HUGE_NONE || policy > MEM_HUGE_TLB)
+        return -1;
+
+    if (threshold < HUGE_PAGE_SIZE) threshold = HUGE_PAGE_SIZE;
+
+    __atomic_store_n(&g_huge_threshold, threshold, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_huge_policy, policy, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int mem_huge_get (size_t * pthreshold)
+{
+    if (pthreshold)
+        *pthreshold = __atomic_load_n(&g_huge_threshold, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&g_huge_policy, __ATOMIC_RELAXED);
+}
+
+#ifdef UNIX
+static void * huge_map (size_t len, int policy, size_t * pmaplen)
+{
+    uint8  * pmap = NULL;
+    uint8  * pbgn = NULL;
+    size_t   maplen = 0;
+    size_t   head = 0;
+
+    maplen = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    if (policy == MEM_HUGE_TLB) {
+        pmap = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pmap != MAP_FAILED) {
+            *pmaplen = maplen;
+            return pmap;
+        }
+    }
+#endif
+
+    /* map one huge page more and cut the unaligned head and tail, so that
+     * the whole range can be backed by huge pages */
+    pmap = mmap(NULL, maplen + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pmap == MAP_FAILED)
+        return NULL;
+
+    pbgn = (uint8 *)(((ulong)pmap + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    head = pbgn - pmap;
+
+    if (head > 0)
+        munmap(pmap, head);
+    munmap(pbgn + maplen, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(pbgn, maplen, MADV_HUGEPAGE);
+#endif
+
+    *pmaplen = maplen;
+    return pbgn;
+}
+#endif
+
+static void * huge_alloc (size_t size, int zero)
+{
+    HugeHdr * hdr = NULL;
+    uint8   * pbase = NULL;
+    size_t    maplen = 0;
+    size_t    threshold = 0;
+    int       policy = 0;
+
+    policy = mem_huge_get(&threshold);
+
+#ifdef UNIX
+    if (policy != MEM_HUGE_NONE && size >= threshold) {
+        pbase = huge_map(size + HUGE_HDR_SIZE, policy, &maplen);
+    }
+#endif
+
+    if (pbase == NULL) {
+        pbase = zero ? kzalloc(size + HUGE_HDR_SIZE) : kalloc(size + HUGE_HDR_SIZE);
+        if (!pbase) return NULL;
+        maplen = 0;
+    }
+
+    hdr = (HugeHdr *)pbase;
+    hdr->size = size;
+    hdr->maplen = maplen;
+    hdr->base = pbase;
+    hdr->magic = HUGE_MAGIC;
+    hdr->kind = maplen > 0 ? HUGE_KIND_MMAP : HUGE_KIND_HEAP;
+
+    return pbase + HUGE_HDR_SIZE;
+}
+
+void * kalloc_huge (size_t size)
+{
+    return huge_alloc(size, 0);
+}
+
+void * kzalloc_huge (size_t size)
+{
+    return huge_alloc(size, 1);
+}
+
+void kfree_huge (void * ptr)
+{
+    HugeHdr * hdr = NULL;
+
+    if (!ptr) return;
+
+    hdr = (HugeHdr *)((uint8 *)ptr - HUGE_HDR_SIZE);
+    if (hdr->magic != HUGE_MAGIC) {
+        tolog(1, "Panic: kfree_huge %p not allocated by kalloc_huge\n", ptr);
+        return;
+    }
+    hdr->magic = 0;
+
+#ifdef UNIX
+    if (hdr->kind == HUGE_KIND_MMAP) {
+        munmap(hdr->base, hdr->maplen);
+        return;
+    }
+#endif
+
+    kfree_sz(hdr->base, hdr->size + HUGE_HDR_SIZE);
+}
+
+void * krealloc_huge (void * ptr, size_t size)
+{
+    HugeHdr * hdr = NULL;
+    void    * pnew = NULL;
+    size_t    threshold = 0;
+
+    if (!ptr) return kalloc_huge(size);
+
+    hdr = (HugeHdr *)((uint8 *)ptr - HUGE_HDR_SIZE);
+
+    if (hdr->kind == HUGE_KIND_MMAP) {
+        /* still fits in the pages mapped */
+        if (size + HUGE_HDR_SIZE <= hdr->maplen) {
+            hdr->size = size;
+            return ptr;
+        }
+
+    } else if (mem_huge_get(&threshold) == MEM_HUGE_NONE || size < threshold) {
+        hdr = krealloc(hdr->base, size + HUGE_HDR_SIZE);
+        if (!hdr) return NULL;
+
+        hdr->size = size;
+        hdr->base = hdr;
+        return (uint8 *)hdr + HUGE_HDR_SIZE;
+    }
+
+    pnew = kalloc_huge(size);
+    if (!pnew) return NULL;
+
+    memcpy(pnew, ptr, hdr->size < size ? hdr->size : size);
+    kfree_huge(ptr);
+
+    return pnew;
+}
+
+size_t khuge_size (void * ptr)
+{
+    if (!ptr) return 0;
+
+    return ((HugeHdr *)((uint8 *)ptr - HUGE_HDR_SIZE))->size;
+}
+
+int khuge_mapped (void * ptr)
+{
+    if (!ptr) return 0;
+
+    return ((HugeHdr *)((uint8 *)ptr - HUGE_HDR_SIZE))->kind == HUGE_KIND_MMAP;
+}
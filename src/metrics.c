@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "dynarr.h"
+#include "frame.h"
+#include "metrics.h"
+
+#define METRICS_LINE  64
+
+typedef struct metric_hist_s {
+    uint64    count;
+    uint64    sum;
+    uint64    max;
+    uint64    bucket[METRICS_BUCKETS];
+} MetricHist;
+
+/* the leading pad keeps the counters off the line of the memory before
+ * the slab, the size is rounded up to the cache line for the memory after */
+typedef struct metric_slab_s {
+    uint8       pad0[METRICS_LINE];
+    uint64      counter[MC_NUM];
+    MetricHist  hist[MH_NUM];
+    uint8       pad1[METRICS_LINE];
+} MetricSlab;
+
+int metrics_on = 0;
+
+static char * mc_names[MC_NUM] = {
+    "mpool_hit", "mpool_miss", "mpool_grow_bytes",
+    "bpool_hit", "bpool_miss", "bpool_grow_bytes",
+    "ht_get",
+    "frame_realloc", "frame_realloc_bytes",
+    "filecache_hit", "filecache_miss",
+    "tsock_recv_eagain", "tsock_send_eagain"
+};
+
+static char * mh_names[MH_NUM] = {
+    "ht_probe", "frame_realloc_size"
+};
+
+static CRITICAL_SECTION  mt_CS;
+static arr_t           * mt_slabs = NULL;     //the slabs of live threads
+static MetricSlab        mt_retired;          //the sum of the exited threads
+
+#ifdef UNIX
+static pthread_key_t     mt_key;
+static pthread_once_t    mt_once = PTHREAD_ONCE_INIT;
+#else
+static int               mt_inited = 0;
+#endif
+
+
+static void mt_add (uint64 * p, uint64 n)
+{
+    /* only the owner thread writes, the relaxed store keeps the readers
+     * from seeing the torn value */
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static uint64 mt_get (uint64 * p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void mt_slab_fold (MetricSlab * dst, MetricSlab * src)
+{
+    MetricHist * dh = NULL;
+    MetricHist * sh = NULL;
+    uint64       v;
+    int          i, k;
+
+    for (i = 0; i < MC_NUM; i++)
+        dst->counter[i] += mt_get(&src->counter[i]);
+
+    for (i = 0; i < MH_NUM; i++) {
+        dh = &dst->hist[i];
+        sh = &src->hist[i];
+
+        dh->count += mt_get(&sh->count);
+        dh->sum += mt_get(&sh->sum);
+        v = mt_get(&sh->max);
+        if (v > dh->max) dh->max = v;
+
+        for (k = 0; k < METRICS_BUCKETS; k++)
+            dh->bucket[k] += mt_get(&sh->bucket[k]);
+    }
+}
+
+#ifdef UNIX
+static void mt_slab_destroy (void * vslab)
+{
+    MetricSlab * slab = (MetricSlab *)vslab;
+
+    if (!slab) return;
+
+    EnterCriticalSection(&mt_CS);
+    mt_slab_fold(&mt_retired, slab);
+    arr_delete_ptr(mt_slabs, slab);
+    LeaveCriticalSection(&mt_CS);
+
+    kfree(slab);
+}
+#endif
+
+static void mt_init ()
+{
+    InitializeCriticalSection(&mt_CS);
+    mt_slabs = arr_new(16);
+
+#ifdef UNIX
+    pthread_key_create(&mt_key, mt_slab_destroy);
+#endif
+}
+
+static MetricSlab * mt_slab_get ()
+{
+    MetricSlab * slab = NULL;
+
+#ifdef UNIX
+    pthread_once(&mt_once, mt_init);
+
+    slab = pthread_getspecific(mt_key);
+    if (slab) return slab;
+
+    slab = kzalloc(sizeof(*slab));
+    if (!slab) return NULL;
+
+    EnterCriticalSection(&mt_CS);
+    arr_push(mt_slabs, slab);
+    LeaveCriticalSection(&mt_CS);
+
+    pthread_setspecific(mt_key, slab);
+#else
+    /* one slab shared by all threads */
+    if (!__atomic_exchange_n(&mt_inited, 1, __ATOMIC_ACQ_REL)) mt_init();
+    slab = &mt_retired;
+#endif
+
+    return slab;
+}
+
+/* the bucket of val, and the upper bound of the values of a bucket */
+static int mt_bucket (uint64 val)
+{
+    int  e;
+
+    if (val < 8) return (int)val;
+
+    e = 63 - __builtin_clzll(val);
+
+    return (e - 2) * 8 + (int)((val >> (e - 3)) & 7);
+}
+
+static uint64 mt_bucket_upper (int idx)
+{
+    int  e;
+
+    if (idx < 8) return idx;
+
+    e = idx / 8 + 2;
+
+    return (((uint64)(8 + idx % 8) << (e - 3)) - 1) + ((uint64)1 << (e - 3));
+}
+
+
+void metrics_enable (int on)
+{
+#ifdef UNIX
+    pthread_once(&mt_once, mt_init);
+#endif
+    __atomic_store_n(&metrics_on, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void metrics_counter_add (int id, uint64 n)
+{
+    MetricSlab * slab = NULL;
+
+    if (id < 0 || id >= MC_NUM) return;
+
+    slab = mt_slab_get();
+    if (!slab) return;
+
+#ifdef UNIX
+    mt_add(&slab->counter[id], n);
+#else
+    __atomic_fetch_add(&slab->counter[id], n, __ATOMIC_RELAXED);
+#endif
+}
+
+void metrics_hist_record (int id, uint64 val)
+{
+    MetricSlab * slab = NULL;
+    MetricHist * hist = NULL;
+
+    if (id < 0 || id >= MH_NUM) return;
+
+    slab = mt_slab_get();
+    if (!slab) return;
+
+    hist = &slab->hist[id];
+
+#ifdef UNIX
+    mt_add(&hist->count, 1);
+    mt_add(&hist->sum, val);
+    mt_add(&hist->bucket[mt_bucket(val)], 1);
+    if (val > hist->max) __atomic_store_n(&hist->max, val, __ATOMIC_RELAXED);
+#else
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, val, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->bucket[mt_bucket(val)], 1, __ATOMIC_RELAXED);
+    if (val > hist->max) hist->max = val;
+#endif
+}
+
+/* the sum of the retired and the live slabs into snap */
+static void mt_snapshot (MetricSlab * snap)
+{
+    int  i;
+
+    memset(snap, 0, sizeof(*snap));
+
+#ifdef UNIX
+    pthread_once(&mt_once, mt_init);
+#else
+    if (!__atomic_exchange_n(&mt_inited, 1, __ATOMIC_ACQ_REL)) mt_init();
+#endif
+
+    EnterCriticalSection(&mt_CS);
+    mt_slab_fold(snap, &mt_retired);
+    for (i = 0; i < arr_num(mt_slabs); i++)
+        mt_slab_fold(snap, arr_value(mt_slabs, i));
+    LeaveCriticalSection(&mt_CS);
+}
+
+static void mt_slab_zero (MetricSlab * slab)
+{
+    uint64 * p = slab->counter;
+    int      i, n;
+
+    n = (int)(((uint8 *)slab->pad1 - (uint8 *)slab->counter) / sizeof(uint64));
+
+    for (i = 0; i < n; i++) __atomic_store_n(&p[i], 0, __ATOMIC_RELAXED);
+}
+
+void metrics_reset ()
+{
+    int  i;
+
+#ifdef UNIX
+    pthread_once(&mt_once, mt_init);
+#else
+    if (!__atomic_exchange_n(&mt_inited, 1, __ATOMIC_ACQ_REL)) mt_init();
+#endif
+
+    EnterCriticalSection(&mt_CS);
+    mt_slab_zero(&mt_retired);
+    for (i = 0; i < arr_num(mt_slabs); i++)
+        mt_slab_zero(arr_value(mt_slabs, i));
+    LeaveCriticalSection(&mt_CS);
+}
+
+uint64 metrics_counter (int id)
+{
+    MetricSlab * snap = NULL;
+    uint64       val = 0;
+
+    if (id < 0 || id >= MC_NUM) return 0;
+
+    snap = kalloc(sizeof(*snap));
+    if (!snap) return 0;
+
+    mt_snapshot(snap);
+    val = snap->counter[id];
+
+    kfree(snap);
+    return val;
+}
+
+static uint64 mt_quantile (MetricHist * hist, double q)
+{
+    uint64  rank, acc = 0;
+    int     i;
+
+    if (hist->count == 0) return 0;
+
+    if (q <= 0) q = 0;
+    if (q >= 1) return hist->max;
+
+    rank = (uint64)(q * hist->count);
+    if (rank >= hist->count) rank = hist->count - 1;
+
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        acc += hist->bucket[i];
+        if (acc > rank) {
+            return mt_bucket_upper(i) < hist->max ? mt_bucket_upper(i) : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+uint64 metrics_hist_count (int id, uint64 * psum, uint64 * pmax)
+{
+    MetricSlab * snap = NULL;
+    uint64       count = 0;
+
+    if (id < 0 || id >= MH_NUM) return 0;
+
+    snap = kalloc(sizeof(*snap));
+    if (!snap) return 0;
+
+    mt_snapshot(snap);
+    count = snap->hist[id].count;
+    if (psum) *psum = snap->hist[id].sum;
+    if (pmax) *pmax = snap->hist[id].max;
+
+    kfree(snap);
+    return count;
+}
+
+uint64 metrics_hist_quantile (int id, double q)
+{
+    MetricSlab * snap = NULL;
+    uint64       val = 0;
+
+    if (id < 0 || id >= MH_NUM) return 0;
+
+    snap = kalloc(sizeof(*snap));
+    if (!snap) return 0;
+
+    mt_snapshot(snap);
+    val = mt_quantile(&snap->hist[id], q);
+
+    kfree(snap);
+    return val;
+}
+
+char * metrics_counter_name (int id)
+{
+    if (id < 0 || id >= MC_NUM) return NULL;
+
+    return mc_names[id];
+}
+
+char * metrics_hist_name (int id)
+{
+    if (id < 0 || id >= MH_NUM) return NULL;
+
+    return mh_names[id];
+}
+
+
+int metrics_json (frame_p frm)
+{
+    MetricSlab * snap = NULL;
+    MetricHist * hist = NULL;
+    int          len, i;
+
+    if (!frm) return -1;
+
+    snap = kalloc(sizeof(*snap));
+    if (!snap) return -100;
+
+    mt_snapshot(snap);
+    len = frameL(frm);
+
+    frame_appendf(frm, "{\"enabled\": %d, \"counters\": {", metrics_on);
+    for (i = 0; i < MC_NUM; i++) {
+        frame_appendf(frm, "%s\"%s\": %llu", i > 0 ? ", " : "", mc_names[i],
+                      (unsigned long long)snap->counter[i]);
+    }
+
+    frame_append(frm, "}, \"histograms\": {");
+    for (i = 0; i < MH_NUM; i++) {
+        hist = &snap->hist[i];
+        frame_appendf(frm, "%s\"%s\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu, "
+                      "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu}",
+                      i > 0 ? ", " : "", mh_names[i],
+                      (unsigned long long)hist->count, (unsigned long long)hist->sum,
+                      (unsigned long long)hist->max,
+                      (unsigned long long)mt_quantile(hist, 0.5),
+                      (unsigned long long)mt_quantile(hist, 0.9),
+                      (unsigned long long)mt_quantile(hist, 0.99),
+                      (unsigned long long)mt_quantile(hist, 0.999));
+    }
+    frame_append(frm, "}}");
+
+    kfree(snap);
+    return frameL(frm) - len;
+}
+
+/* the buckets of Prometheus are the powers of 2, the same in every scrape */
+int metrics_prometheus (frame_p frm)
+{
+    MetricSlab * snap = NULL;
+    MetricHist * hist = NULL;
+    uint64       acc, le;
+    int          len, i, k, b;
+
+    if (!frm) return -1;
+
+    snap = kalloc(sizeof(*snap));
+    if (!snap) return -100;
+
+    mt_snapshot(snap);
+    len = frameL(frm);
+
+    for (i = 0; i < MC_NUM; i++) {
+        frame_appendf(frm, "# TYPE adif_%s_total counter\nadif_%s_total %llu\n",
+                      mc_names[i], mc_names[i], (unsigned long long)snap->counter[i]);
+    }
+
+    for (i = 0; i < MH_NUM; i++) {
+        hist = &snap->hist[i];
+        frame_appendf(frm, "# TYPE adif_%s histogram\n", mh_names[i]);
+
+        /* le = 2^k - 1 ends at the bucket whose upper bound is it */
+        for (acc = 0, b = 0, k = 0; k <= 32; k++) {
+            le = ((uint64)1 << k) - 1;
+            for ( ; b < METRICS_BUCKETS && mt_bucket_upper(b) <= le; b++)
+                acc += hist->bucket[b];
+
+            frame_appendf(frm, "adif_%s_bucket{le=\"%llu\"} %llu\n", mh_names[i],
+                          (unsigned long long)le, (unsigned long long)acc);
+        }
+
+        frame_appendf(frm, "adif_%s_bucket{le=\"+Inf\"} %llu\n", mh_names[i],
+                      (unsigned long long)hist->count);
+        frame_appendf(frm, "adif_%s_sum %llu\nadif_%s_count %llu\n",
+                      mh_names[i], (unsigned long long)hist->sum,
+                      mh_names[i], (unsigned long long)hist->count);
+    }
+
+    kfree(snap);
+    return frameL(frm) - len;
+}
+
@@ -8,6 +8,7 @@
 #include "memory.h"
 #include "hashtab.h"
 #include "strutil.h"
+#include "epoch.h"
 #include "mimetype.h"
 
 typedef struct MimeMgmt_ {
@@ -16,6 +17,9 @@ typedef struct MimeMgmt_ {
     hashtab_t          * mimeid_tab;    //key is mimeid 
     hashtab_t          * mimetype_tab;  //key is mime type
 
+    /* built-in extnames are in the perfect hash, mime_tab has the added */
+    int                  builtin;
+
 } MimeMgmt;
 
 MimeMgmt * g_mimemgmt = NULL;
@@ -1146,6 +1150,191 @@ static MimeItem g_mime[] = {
 #define MIMENUM (sizeof(g_mime)/sizeof(g_mime[0]))
 
 
+/* the extnames of the built-in table are located by a minimal perfect hash
+ * in the way of CHD (compress, hash and displace), built once by
+ * mime_type_init into static arrays. the hash of an extname selects its
+ * bucket, the displacement d searched for the bucket puts every key of it
+ * into a slot of its own, the slot being the low 32 bits of hash mixed by
+ * d and mapped to 0..n-1 by multiply and shift instead of division. the
+ * buckets of more keys are placed first while the slots are mostly free.
+ * a lookup costs one hash, one slot and one compare */
+
+#define MPH_LAMBDA  4
+
+static uint16  g_mph_slot[MIMENUM];        //index of g_mime in each slot
+static uint32  g_mph_disp[MIMENUM];        //displacement of each bucket
+static uint64  g_mph_seed = 0;
+static uint32  g_mph_num = 0;
+static uint32  g_mph_buckets = 0;
+
+/* the scratch of building */
+static uint64  g_mph_hash[MIMENUM];
+static uint16  g_mph_ord[MIMENUM];
+static uint16  g_mph_member[MIMENUM];
+static uint16  g_mph_bstart[MIMENUM + 1];
+static uint16  g_mph_border[MIMENUM];
+static uint8   g_mph_used[MIMENUM];
+
+#define mph_range(x, n)  (uint32)(((uint64)(uint32)(x) * (n)) >> 32)
+#define mph_bucket(h)    mph_range((h) >> 32, g_mph_buckets)
+#define mph_pos(h, d)    mph_range((uint32)(h) ^ ((d) * 0x9E3779B1U), g_mph_num)
+
+static int mph_cmp_ord (const void * a, const void * b)
+{
+    uint16  ia = *(uint16 *)a;
+    uint16  ib = *(uint16 *)b;
+
+    if (g_mph_hash[ia] != g_mph_hash[ib])
+        return g_mph_hash[ia] < g_mph_hash[ib] ? -1 : 1;
+
+    return (int)ia - (int)ib;
+}
+
+static int mph_cmp_bucket (const void * a, const void * b)
+{
+    uint16  ba = *(uint16 *)a;
+    uint16  bb = *(uint16 *)b;
+    int     sa = g_mph_bstart[ba + 1] - g_mph_bstart[ba];
+    int     sb = g_mph_bstart[bb + 1] - g_mph_bstart[bb];
+
+    if (sa != sb) return sb - sa;
+    return (int)ba - (int)bb;
+}
+
+/* try placing the keys of bucket b by displacement d */
+static int mph_place (uint32 b, uint32 d)
+{
+    uint32  i, j, pos;
+    uint32  bgn = g_mph_bstart[b];
+    uint32  end = g_mph_bstart[b + 1];
+
+    for (i = bgn; i < end; i++) {
+        pos = mph_pos(g_mph_hash[g_mph_member[i]], d);
+        if (g_mph_used[pos]) break;
+        g_mph_used[pos] = 1;
+    }
+
+    if (i == end) return 0;
+
+    /* undo the slots taken by the keys before the collision */
+    for (j = bgn; j < i; j++)
+        g_mph_used[mph_pos(g_mph_hash[g_mph_member[j]], d)] = 0;
+
+    return -1;
+}
+
+static int mph_build (uint64 seed)
+{
+    uint32  i, k, n = 0, b, d;
+    uint16  kidx;
+
+    g_mph_seed = seed;
+
+    for (i = 0; i < MIMENUM; i++) {
+        g_mph_hash[i] = wy_hash_nocase(g_mime[i].extname, -1, seed);
+        g_mph_ord[i] = (uint16)i;
+    }
+
+    /* the duplicate extnames have the same hash, the first one is kept */
+    qsort(g_mph_ord, MIMENUM, sizeof(uint16), mph_cmp_ord);
+
+    for (i = 0; i < MIMENUM; i++) {
+        if (i > 0 && g_mph_hash[g_mph_ord[i]] == g_mph_hash[g_mph_member[n - 1]]) {
+            if (strcasecmp(g_mime[g_mph_ord[i]].extname, g_mime[g_mph_member[n - 1]].extname) != 0)
+                return -1;      /* two extnames of one 64-bit hash, try another seed */
+            continue;
+        }
+        g_mph_member[n++] = g_mph_ord[i];
+    }
+
+    g_mph_num = n;
+    g_mph_buckets = n / MPH_LAMBDA + 1;
+
+    /* group the keys by bucket, g_mph_ord keeps the unique keys meanwhile */
+    memcpy(g_mph_ord, g_mph_member, n * sizeof(uint16));
+    memset(g_mph_bstart, 0, sizeof(g_mph_bstart));
+
+    for (i = 0; i < n; i++)
+        g_mph_bstart[mph_bucket(g_mph_hash[g_mph_ord[i]]) + 1]++;
+    for (b = 0; b < g_mph_buckets; b++)
+        g_mph_bstart[b + 1] += g_mph_bstart[b];
+
+    memcpy(g_mph_border, g_mph_bstart, g_mph_buckets * sizeof(uint16));
+    for (i = 0; i < n; i++) {
+        kidx = g_mph_ord[i];
+        b = mph_bucket(g_mph_hash[kidx]);
+        g_mph_member[g_mph_border[b]++] = kidx;
+    }
+
+    for (b = 0; b < g_mph_buckets; b++)
+        g_mph_border[b] = (uint16)b;
+    qsort(g_mph_border, g_mph_buckets, sizeof(uint16), mph_cmp_bucket);
+
+    memset(g_mph_used, 0, sizeof(g_mph_used));
+
+    for (k = 0; k < g_mph_buckets; k++) {
+        b = g_mph_border[k];
+        g_mph_disp[b] = 0;
+
+        if (g_mph_bstart[b + 1] == g_mph_bstart[b])
+            continue;
+
+        for (d = 0; d < (1U << 20); d++) {
+            if (mph_place(b, d) == 0) break;
+        }
+        if (d >= (1U << 20)) return -2;
+
+        g_mph_disp[b] = d;
+    }
+
+    for (b = 0; b < g_mph_buckets; b++) {
+        for (i = g_mph_bstart[b]; i < g_mph_bstart[b + 1]; i++) {
+            kidx = g_mph_member[i];
+            g_mph_slot[mph_pos(g_mph_hash[kidx], g_mph_disp[b])] = kidx;
+        }
+    }
+
+    return 0;
+}
+
+static void mph_init ()
+{
+    uint64  seed;
+
+    if (g_mph_num > 0) return;
+
+    for (seed = 0x6D696D6574797065ULL; seed < 0x6D696D6574797065ULL + 64; seed++) {
+        if (mph_build(seed) == 0) return;
+    }
+
+    g_mph_num = 0;
+}
+
+static MimeItem * mph_get (char * ext)
+{
+    MimeItem * item = NULL;
+    uint64     h;
+
+    if (g_mph_num == 0) return NULL;
+
+    h = wy_hash_nocase(ext, -1, g_mph_seed);
+    item = &g_mime[g_mph_slot[mph_pos(h, g_mph_disp[mph_bucket(h)])]];
+
+    return strcasecmp(item->extname, ext) == 0 ? item : NULL;
+}
+
+/* the built-in extnames first, then the ones added later */
+static MimeItem * mime_ext_find (MimeMgmt * mgmt, char * ext)
+{
+    MimeItem * item = NULL;
+
+    if (mgmt->builtin && (item = mph_get(ext)))
+        return item;
+
+    return ht_get(mgmt->mime_tab, ext);
+}
+
+
 static int mime_item_cmp_extname (void * a, void * b)
 {
     MimeItem * item = (MimeItem *)a;
@@ -1209,10 +1398,13 @@ void * mime_type_init ()
 
     mgmt->mimetype_tab = ht_only_new(1200, mime_item_cmp_mimetype);
 
+    mph_init();
+    mgmt->builtin = g_mph_num > 0;
+
     for (i = 0; i < MIMENUM; i++) {
         item = &g_mime[i];
 
-        if (ht_get(mgmt->mime_tab, item->extname) == NULL)
+        if (!mgmt->builtin && ht_get(mgmt->mime_tab, item->extname) == NULL)
             ht_set(mgmt->mime_tab, item->extname, item);
 
         ht_set(mgmt->mimeid_tab, &item->mimeid, item);
@@ -1311,7 +1503,7 @@ int mime_type_add (void * vmgmt, char * mime, char * ext, uint32 mimeid, uint32
         setflag |= 0x01;
     }
 
-    if (ht_get(mgmt->mime_tab, ext) == NULL) {
+    if (mime_ext_find(mgmt, ext) == NULL) {
         ht_set(mgmt->mime_tab, item->extname, item);
         setflag |= 0x02;
     }
@@ -1343,7 +1535,7 @@ int mime_type_get_by_extname (void * vmgmt, char * ext, char ** pmime, uint32 *
 
     p = ext;
     if (*p != '.') p = rskipTo(p+strlen(ext)-1, strlen(ext), ".", 1);
-    if (*p == '.') item = ht_get(mgmt->mime_tab, p);
+    if (*p == '.') item = mime_ext_find(mgmt, p);
     if (!item) return -100;
     
     if (pmime) *pmime = item->mime;
@@ -1423,8 +1615,82 @@ void * mime_type_get (void * vmgmt, char * mime, uint32 mimeid, char * ext)
 
     if (!item && mime) item = ht_get(mgmt->mimetype_tab, mime);
     if (!item && mimeid > 0) item = ht_get(mgmt->mimeid_tab, &mimeid);
-    if (!item && ext) item = ht_get(mgmt->mime_tab, ext);
+    if (!item && ext) item = mime_ext_find(mgmt, ext);
 
     return item;
 }
 
+
+typedef struct mime_snap_ {
+    void      * epoch;
+    void      * mgmt;
+} MimeSnap;
+
+/* the built-in table refers to the static items */
+static void mime_snap_table_free (void * vmgmt)
+{
+    if (vmgmt == g_mimemgmt)
+        mime_type_clean(vmgmt);
+    else
+        mime_type_free(vmgmt);
+}
+
+void * mime_snap_new (void * vmgmt)
+{
+    MimeSnap * snap = NULL;
+
+    snap = kzalloc(sizeof(*snap));
+    if (!snap) return NULL;
+
+    snap->epoch = epoch_new();
+    if (!snap->epoch) {
+        kfree(snap);
+        return NULL;
+    }
+
+    if (!vmgmt) vmgmt = mime_type_init();
+    snap->mgmt = vmgmt;
+
+    return snap;
+}
+
+void mime_snap_free (void * vsnap)
+{
+    MimeSnap * snap = (MimeSnap *)vsnap;
+
+    if (!snap) return;
+
+    epoch_free(snap->epoch);
+    if (snap->mgmt) mime_snap_table_free(snap->mgmt);
+
+    kfree(snap);
+}
+
+int mime_snap_publish (void * vsnap, void * vmgmt)
+{
+    MimeSnap * snap = (MimeSnap *)vsnap;
+
+    if (!snap || !vmgmt) return -1;
+
+    return epoch_publish(snap->epoch, &snap->mgmt, vmgmt, mime_snap_table_free);
+}
+
+void * mime_snap_enter (void * vsnap)
+{
+    MimeSnap * snap = (MimeSnap *)vsnap;
+
+    if (!snap) return NULL;
+
+    epoch_enter(snap->epoch);
+
+    return epoch_deref(&snap->mgmt);
+}
+
+void mime_snap_leave (void * vsnap)
+{
+    MimeSnap * snap = (MimeSnap *)vsnap;
+
+    if (!snap) return;
+
+    epoch_leave(snap->epoch);
+}
@@ -8,8 +8,25 @@
 #include "memory.h"
 #include "dynarr.h"
 #include "filecache.h"
+#include "fileop.h"
+#include "thpool.h"
 #include "mpatwm.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define WM_TEDDY 1
+#include <immintrin.h>
+#endif
+
+#define WM_TEDDY_MAXPAT   48      //more patterns flood the 8 buckets with candidates
+#define WM_TEDDY_BLOCK    4096    //bytes read from file cache by one scan
+
 
 typedef struct prefix_item {
     uint32     hash;
@@ -49,6 +66,9 @@ typedef struct wu_manber_body {
     uint8       * shifttab;
     void       ** prefixtab;
 
+    int           ignorecase;
+    void        * teddy;
+
 } WMBody;
 
 
@@ -94,6 +114,11 @@ int wm_tab_clean (void * vbody)
         body->prefixtab = NULL;
     }
 
+    if (body->teddy) {
+        kfree(body->teddy);
+        body->teddy = NULL;
+    }
+
     return 0;
 }
 
@@ -113,6 +138,7 @@ void * wm_init (int isascii, int ignorecase)
     body->patnum = 0;
 
     body->patlist = arr_new(16);
+    body->ignorecase = ignorecase;
 
     body->alphasize = 0;
     body->alphatab[0].letter = 0;
@@ -264,6 +290,390 @@ int wm_adjust_shifttab (void * vbody, uint8 * suffb, int L)
 }
 
 
+#ifdef WM_TEDDY
+
+/* Teddy prefilter of Hyperscan for the sets of a few patterns. the
+ * patterns are put into 8 buckets, and each of the first 1 - 3 bytes of a
+ * pattern sets its bucket bit in the masks indexed by the low and the high
+ * nibble of the byte. pshufb looks up the nibbles of 32 bytes of text at a
+ * time, and the AND of the masks of the 3 shifted text blocks leaves the
+ * bits of the buckets that may start a match at each byte. the candidates
+ * are then compared with the patterns of their buckets.
+ *
+ * the patterns are sorted by their first bytes before being cut into the
+ * buckets, so the ones of common prefix share the mask bits of a bucket.
+ * the matches at one position are called back in the order of adding as
+ * the hash chains of Wu-Manber give */
+typedef struct teddy_s {
+    uint8      lomask[3][32];              //repeated for the 2 lanes of vpshufb
+    uint8      himask[3][32];
+    int        minlen;
+    int        maxlen;
+    uint16     bstart[9];                  //bucket b holds order[bstart[b] .. bstart[b+1]-1]
+    uint16     order[WM_TEDDY_MAXPAT];     //pattern indexes sorted by prefix
+    uint16     length[WM_TEDDY_MAXPAT];
+    uint32     head[WM_TEDDY_MAXPAT];      //first 4 bytes of the pattern
+    uint32     fold[WM_TEDDY_MAXPAT];      //0x20 at the letters of head ignoring case
+} Teddy;
+
+static void wm_teddy_set (Teddy * td, int j, uint8 c, uint8 bit)
+{
+    td->lomask[j][c & 0x0F] |= bit;
+    td->lomask[j][16 + (c & 0x0F)] |= bit;
+    td->himask[j][c >> 4] |= bit;
+    td->himask[j][16 + (c >> 4)] |= bit;
+}
+
+static int wm_teddy_avail ()
+{
+    static int avail = -1;
+    int        ok = __atomic_load_n(&avail, __ATOMIC_RELAXED);
+
+    if (ok < 0) {
+        __builtin_cpu_init();
+        ok = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&avail, ok, __ATOMIC_RELAXED);
+    }
+
+    return ok;
+}
+
+static int wm_teddy_key_cmp (const void * a, const void * b)
+{
+    uint64  ka = *(const uint64 *)a;
+    uint64  kb = *(const uint64 *)b;
+
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+static int wm_teddy_build (WMBody * body)
+{
+    Teddy       * td = NULL;
+    PatternItem * patitem = NULL;
+    uint64        key[WM_TEDDY_MAXPAT];
+    uint32        k;
+    uint8         c;
+    int           M, b, i, j;
+
+    if (body->teddy) {
+        kfree(body->teddy);
+        body->teddy = NULL;
+    }
+
+    if (body->patnum <= 0 || body->patnum > WM_TEDDY_MAXPAT || !wm_teddy_avail())
+        return 0;
+
+    td = kzalloc(sizeof(*td));
+    if (!td) return -1;
+
+    td->minlen = body->patslen;
+    M = min(3, body->patslen);
+
+    /* sort by the folded first 3 bytes, the index breaks the tie */
+    for (i = 0; i < body->patnum; i++) {
+        patitem = arr_value(body->patlist, i);
+
+        for (j = 0, k = 0; j < 3; j++) {
+            k <<= 8;
+            if (j < patitem->length) k |= body->alphatab[patitem->pattern[j]].letter;
+        }
+        key[i] = ((uint64)k << 16) | i;
+    }
+    qsort(key, body->patnum, sizeof(uint64), wm_teddy_key_cmp);
+
+    /* the bytes beyond the shortest pattern pass all the buckets */
+    for (j = M; j < 3; j++) {
+        memset(td->lomask[j], 0xFF, 32);
+        memset(td->himask[j], 0xFF, 32);
+    }
+
+    for (b = 0; b <= 8; b++)
+        td->bstart[b] = b * body->patnum / 8;
+
+    for (b = 0; b < 8; b++) {
+        for (i = td->bstart[b]; i < td->bstart[b+1]; i++) {
+            td->order[i] = (uint16)(key[i] & 0xFFFF);
+
+            patitem = arr_value(body->patlist, td->order[i]);
+            td->length[i] = patitem->length;
+            if (td->maxlen < patitem->length) td->maxlen = patitem->length;
+
+            for (j = 0; j < 4 && j < patitem->length; j++) {
+                c = patitem->pattern[j];
+                if (body->ignorecase && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+                    c |= 0x20;
+                    td->fold[i] |= 0x20U << (j * 8);
+                }
+                td->head[i] |= (uint32)c << (j * 8);
+            }
+
+            for (j = 0; j < M; j++) {
+                c = patitem->pattern[j];
+                wm_teddy_set(td, j, c, 1 << b);
+
+                if (body->ignorecase && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+                    wm_teddy_set(td, j, c ^ 0x20, 1 << b);
+            }
+        }
+    }
+
+    body->teddy = td;
+    return 0;
+}
+
+/* find the first block of 32 positions from pos on holding candidates
+ * that start before end, return the block position with the candidates
+ * in *pmask and their bucket bits in res, or -1 if none. pbyte has bytelen
+ * bytes and end is at most bytelen - minlen + 1 */
+__attribute__((target("avx2")))
+static long wm_teddy_next (Teddy * td, uint8 * pbyte, long bytelen, long pos, long end,
+                           uint8 * res, uint32 * pmask)
+{
+    const __m256i  low = _mm256_set1_epi8(0x0F);
+    __m256i        lo0, lo1, lo2, hi0, hi1, hi2;
+    __m256i        v0, v1, v2, acc;
+    uint8          tail[64];
+    uint8        * p = NULL;
+    uint32         mask;
+
+    lo0 = _mm256_loadu_si256((const __m256i *)td->lomask[0]);
+    lo1 = _mm256_loadu_si256((const __m256i *)td->lomask[1]);
+    lo2 = _mm256_loadu_si256((const __m256i *)td->lomask[2]);
+    hi0 = _mm256_loadu_si256((const __m256i *)td->himask[0]);
+    hi1 = _mm256_loadu_si256((const __m256i *)td->himask[1]);
+    hi2 = _mm256_loadu_si256((const __m256i *)td->himask[2]);
+
+    for ( ; pos < end; pos += 32) {
+        if (pos + 34 <= bytelen) {
+            p = pbyte + pos;
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, pbyte + pos, bytelen - pos);
+            p = tail;
+        }
+
+        v0 = _mm256_loadu_si256((const __m256i *)p);
+        v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        v2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+
+        acc = _mm256_and_si256(
+                  _mm256_shuffle_epi8(lo0, _mm256_and_si256(v0, low)),
+                  _mm256_shuffle_epi8(hi0, _mm256_and_si256(_mm256_srli_epi16(v0, 4), low)));
+        acc = _mm256_and_si256(acc, _mm256_and_si256(
+                  _mm256_shuffle_epi8(lo1, _mm256_and_si256(v1, low)),
+                  _mm256_shuffle_epi8(hi1, _mm256_and_si256(_mm256_srli_epi16(v1, 4), low))));
+        acc = _mm256_and_si256(acc, _mm256_and_si256(
+                  _mm256_shuffle_epi8(lo2, _mm256_and_si256(v2, low)),
+                  _mm256_shuffle_epi8(hi2, _mm256_and_si256(_mm256_srli_epi16(v2, 4), low))));
+
+        mask = ~(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(acc, _mm256_setzero_si256()));
+        if (end - pos < 32) mask &= (1U << (end - pos)) - 1;
+
+        if (mask) {
+            _mm256_storeu_si256((__m256i *)res, acc);
+            *pmask = mask;
+            return pos;
+        }
+    }
+
+    return -1;
+}
+
+/* compare the patterns of the buckets in bits with p of avail bytes,
+ * fill idx with the indexes of the matched ones in ascending order. the
+ * first 4 bytes are compared as one word, ORed with 0x20 at the letters
+ * when case is ignored */
+static int wm_teddy_verify (WMBody * body, uint8 * p, long avail, uint32 bits, int * idx)
+{
+    Teddy       * td = (Teddy *)body->teddy;
+    PatternItem * patitem = NULL;
+    uint32        word = 0;
+    int           num = 0;
+    int           b, i, k, n, v;
+
+    if (avail >= 4) memcpy(&word, p, 4);
+
+    for ( ; bits; bits &= bits - 1) {
+        b = __builtin_ctz(bits);
+
+        for (i = td->bstart[b]; i < td->bstart[b+1]; i++) {
+            if (td->length[i] > avail) continue;
+
+            k = 0;
+            if (td->length[i] >= 4) {
+                if ((word | td->fold[i]) != td->head[i]) continue;
+                k = 4;
+            }
+
+            patitem = arr_value(body->patlist, td->order[i]);
+
+            for ( ; k < patitem->length; k++) {
+                if (body->alphatab[patitem->pattern[k]].letter != body->alphatab[p[k]].letter)
+                    break;
+            }
+            if (k < patitem->length) continue;
+
+            /* insert in index order */
+            v = td->order[i];
+            for (n = num++; n > 0 && idx[n-1] > v; n--)
+                idx[n] = idx[n-1];
+            idx[n] = v;
+        }
+    }
+
+    return num;
+}
+
+/* wm_bytes_search by the prefilter, same results and callbacks */
+static long wm_teddy_bytes_search (WMBody * body, uint8 * pbyte, long bytelen,
+                                   void ** foundobj, int foundexit)
+{
+    Teddy       * td = (Teddy *)body->teddy;
+    PatternItem * patitem = NULL;
+    int           idx[WM_TEDDY_MAXPAT];
+    uint8         res[32];
+    uint32        mask = 0;
+    long          pos = 0, next = 0, start = 0;
+    long          end = bytelen - td->minlen + 1;
+    int           matchnum = 0;
+    int           maxlen = 0;
+    int           skipnum = 0;
+    int           num, i, k;
+
+    while ((pos = wm_teddy_next(td, pbyte, bytelen, pos, end, res, &mask)) >= 0) {
+        next = pos + 32;
+
+        for ( ; mask; mask &= mask - 1) {
+            k = __builtin_ctz(mask);
+            start = pos + k;
+
+            num = wm_teddy_verify(body, pbyte + start, bytelen - start, res[k], idx);
+
+            for (i = 0, skipnum = 0; i < num; i++) {
+                patitem = arr_value(body->patlist, idx[i]);
+
+                matchnum++;
+                if (maxlen < patitem->length) {
+                    maxlen = patitem->length;
+                    if (foundobj) *foundobj = patitem->para;
+                }
+
+                if (patitem->matchsucc) {
+                    (*patitem->matchsucc)(patitem->para, WM_SRC_BYTES,
+                               pbyte, bytelen, start,
+                               &skipnum, patitem->pattern, patitem->length,
+                               NULL, 0, NULL);
+
+                    if (skipnum > 0) break;
+                }
+            }
+
+            if (num > 0 && foundexit)
+                return start;
+
+            if (num > 0 && skipnum > 0) {
+                next = start + skipnum;
+                break;
+            }
+        }
+
+        pos = next;
+    }
+
+    if (foundexit && matchnum <= 0)
+        return -200;
+
+    return bytelen;
+}
+
+/* wm_filecache_search by the prefilter. the file is read into a block of
+ * WM_TEDDY_BLOCK bytes that overlaps the next one by the longest pattern
+ * length - 1, so the matches across 2 blocks are found in the first one */
+static long wm_teddy_filecache_search (WMBody * body, void * fca, long pos,
+                                       void ** foundobj, int foundexit)
+{
+    Teddy       * td = (Teddy *)body->teddy;
+    PatternItem * patitem = NULL;
+    int           idx[WM_TEDDY_MAXPAT];
+    uint8         buf[WM_TEDDY_BLOCK + sizeof(patitem->pattern)];
+    uint8         res[32];
+    uint32        mask = 0;
+    long          filesize = file_cache_filesize(fca);
+    long          off = 0, iter = 0, next = 0, start = 0;
+    long          len = 0, own = 0, end = 0, adv = 0;
+    int           matchnum = 0;
+    int           maxlen = 0;
+    int           skipnum = 0;
+    int           num, i, k;
+
+    for (off = pos; off + td->minlen <= filesize; ) {
+        len = min(WM_TEDDY_BLOCK + td->maxlen - 1, filesize - off);
+
+        if (file_cache_seek(fca, off) < 0) break;
+        len = file_cache_read(fca, buf, len, 0);
+        if (len < td->minlen) break;
+
+        /* the starts below own belong to this block */
+        own = off + len < filesize ? len - td->maxlen + 1 : len;
+        if (own < 1) own = 1;
+
+        end = min(own, len - td->minlen + 1);
+        adv = own;
+
+        for (iter = 0; (iter = wm_teddy_next(td, buf, len, iter, end, res, &mask)) >= 0; ) {
+            next = iter + 32;
+
+            for ( ; mask; mask &= mask - 1) {
+                k = __builtin_ctz(mask);
+                start = iter + k;
+
+                num = wm_teddy_verify(body, buf + start, len - start, res[k], idx);
+
+                for (i = 0, skipnum = 0; i < num; i++) {
+                    patitem = arr_value(body->patlist, idx[i]);
+
+                    matchnum++;
+                    if (maxlen < patitem->length) {
+                        maxlen = patitem->length;
+                        if (foundobj) *foundobj = patitem->para;
+                    }
+
+                    if (patitem->matchsucc) {
+                        (*patitem->matchsucc)(patitem->para, WM_SRC_FILECACHE,
+                                   fca, filesize, off + start,
+                                   &skipnum, patitem->pattern, patitem->length,
+                                   NULL, 0, NULL);
+
+                        if (skipnum > 0) break;
+                    }
+                }
+
+                if (num > 0 && foundexit)
+                    return off + start;
+
+                if (num > 0 && skipnum > 0) {
+                    next = start + skipnum;
+                    if (next > own) adv = next;
+                    break;
+                }
+            }
+
+            if (next >= end) break;
+            iter = next;
+        }
+
+        off += adv;
+    }
+
+    if (foundexit && matchnum <= 0)
+        return -200;
+
+    return filesize;
+}
+
+#endif
+
+
 int wm_pattern_precalc (void * vbody)
 {
     WMBody      * body = (WMBody *)vbody;
@@ -332,6 +742,10 @@ int wm_pattern_precalc (void * vbody)
         }
     }
 
+#ifdef WM_TEDDY
+    wm_teddy_build(body);
+#endif
+
     return 0;
 }
 
@@ -360,6 +774,11 @@ long wm_bytes_search (void * vbody, void * vbyte, long bytelen, void ** foundobj
 
     if (bytelen < body->patslen) return -100;
 
+#ifdef WM_TEDDY
+    if (body->teddy)
+        return wm_teddy_bytes_search(body, pbyte, bytelen, foundobj, foundexit);
+#endif
+
     iter = body->patslen;
     while (iter <= bytelen) {
         hash1 = wm_hash_func(body, pbyte + iter - body->B, body->B);
@@ -406,7 +825,7 @@ long wm_bytes_search (void * vbody, void * vbyte, long bytelen, void ** foundobj
                         }
 
                         if (patitem->matchsucc) {
-                            (*patitem->matchsucc)(patitem->para, 0,
+                            (*patitem->matchsucc)(patitem->para, WM_SRC_BYTES,
                                        pbyte, bytelen, iter - body->patslen,
                                        &skipnum, patitem->pattern, patitem->length,
                                        NULL, 0, NULL);
@@ -482,6 +901,11 @@ long wm_filecache_search (void * vbody, void * fca, long pos, void ** foundobj,
     filesize = file_cache_filesize(fca);
     if (filesize < body->patslen) return -100;
 
+#ifdef WM_TEDDY
+    if (body->teddy)
+        return wm_teddy_filecache_search(body, fca, pos, foundobj, foundexit);
+#endif
+
     for (iter = pos + body->patslen; iter <= filesize; ) {
         hash1 = wm_filecache_hash_func(body, fca, iter - body->B, body->B);
          
@@ -527,7 +951,7 @@ long wm_filecache_search (void * vbody, void * fca, long pos, void ** foundobj,
                         }
 
                         if (patitem->matchsucc) {
-                            (*patitem->matchsucc)(patitem->para, 1,
+                            (*patitem->matchsucc)(patitem->para, WM_SRC_FILECACHE,
                                        fca, filesize, iter-body->patslen,
                                        &skipnum, patitem->pattern, patitem->length,
                                        NULL, 0, NULL);
@@ -672,7 +1096,7 @@ long wm_match_replace (void * vbody, void * fca, long pos, uint8 * pdst, int dst
  
                         if (patitem->matchsucc) {
                             repnum = 0;
-                            (*patitem->matchsucc)(patitem->para, 1,
+                            (*patitem->matchsucc)(patitem->para, WM_SRC_FILECACHE,
                                          fca, filesize, iter-body->patslen,
                                          &skipnum, patitem->pattern, patitem->length,
                                          pdst + cpnum, dstlen - cpnum, &repnum);
@@ -801,7 +1225,7 @@ long wm_bytes_replace (void * vbody, uint8 * pbyte, long bytelen, uint8 * pdst,
  
                         if (patitem->matchsucc) {
                             repnum = 0;
-                            (*patitem->matchsucc)(patitem->para, 0,
+                            (*patitem->matchsucc)(patitem->para, WM_SRC_BYTES,
                                            pbyte, bytelen, iter - body->patslen,
                                            &skipnum, patitem->pattern, patitem->length,
                                            pdst + cpnum, dstlen - cpnum, &repnum);
@@ -848,3 +1272,345 @@ long wm_bytes_replace (void * vbody, uint8 * pbyte, long bytelen, uint8 * pdst,
     return i;
 }
  
+
+
+#ifdef UNIX
+
+typedef struct wm_match_s {
+    int64          pos;
+    int            index;
+} WMMatch;
+
+/* a range of file searched by one task. the matches starting in
+ * [offset, offset + ownlen) belong to the range, the mapping extends
+ * the maximum pattern length - 1 bytes beyond for the matches across */
+typedef struct wm_range_s {
+    WMBody       * body;
+    int            fd;
+
+    int64          offset;
+    int64          ownlen;
+    int64          bytelen;
+
+    void         * pmap;
+    size_t         maplen;
+    uint8        * pbyte;
+
+    WMMatch      * matches;
+    int            num;
+    int            size;
+    int            ret;
+} WMRange;
+
+static int wm_range_add (WMRange * range, int64 pos, int index)
+{
+    WMMatch  * items = NULL;
+    int        size;
+
+    if (range->num >= range->size) {
+        size = range->size > 0 ? range->size * 2 : 64;
+
+        items = krealloc(range->matches, size * sizeof(WMMatch));
+        if (!items) return -1;
+
+        range->matches = items;
+        range->size = size;
+    }
+
+    range->matches[range->num].pos = pos;
+    range->matches[range->num].index = index;
+    range->num++;
+
+    return 0;
+}
+
+#ifdef WM_TEDDY
+
+static void wm_teddy_range_scan (WMRange * range)
+{
+    WMBody      * body = range->body;
+    Teddy       * td = (Teddy *)body->teddy;
+    int           idx[WM_TEDDY_MAXPAT];
+    uint8         res[32];
+    uint32        mask = 0;
+    long          pos = 0, start = 0;
+    long          end = min(range->ownlen, range->bytelen - td->minlen + 1);
+    int           num, i, k;
+
+    while ((pos = wm_teddy_next(td, range->pbyte, range->bytelen, pos, end, res, &mask)) >= 0) {
+        for ( ; mask; mask &= mask - 1) {
+            k = __builtin_ctz(mask);
+            start = pos + k;
+
+            num = wm_teddy_verify(body, range->pbyte + start, range->bytelen - start, res[k], idx);
+
+            for (i = 0; i < num; i++) {
+                if (wm_range_add(range, range->offset + start, idx[i]) < 0) {
+                    range->ret = -100;
+                    return;
+                }
+            }
+        }
+
+        pos += 32;
+    }
+}
+
+#endif
+
+/* the same scan as wm_bytes_search, all matches are recorded instead of
+ * calling back */
+static void wm_range_scan (WMRange * range)
+{
+    WMBody      * body = range->body;
+    uint8       * pbyte = range->pbyte;
+    long          bytelen = range->bytelen;
+    long          iter = 0;
+    long          start = 0;
+    int           hash1 = 0;
+    int           hash2 = 0;
+    int           shift = 0;
+    PrefixItem  * prenode = NULL;
+    PatternItem * patitem = NULL;
+    uint8       * target = NULL;
+    uint8       * pattern = NULL;
+    int           i = 0;
+
+#ifdef WM_TEDDY
+    if (body->teddy) {
+        wm_teddy_range_scan(range);
+        return;
+    }
+#endif
+
+    for (iter = body->patslen; iter <= bytelen; ) {
+        start = iter - body->patslen;
+        if (start >= range->ownlen) break;
+
+        hash1 = wm_hash_func(body, pbyte + iter - body->B, body->B);
+
+        shift = body->shifttab[hash1];
+        if (shift > 0) {
+            iter += shift;
+            continue;
+        }
+
+        hash2 = wm_hash_func(body, pbyte + start, body->B);
+
+        for (prenode = body->prefixtab[hash1]; prenode != NULL; prenode = prenode->next) {
+            if (hash2 != prenode->hash) continue;
+
+            patitem = arr_value(body->patlist, prenode->index);
+            if (!patitem || start + patitem->length > bytelen) continue;
+
+            pattern = patitem->pattern + body->B;
+            target = pbyte + start + body->B;
+
+            for (i = patitem->length - body->B; i > 0; i--, pattern++, target++) {
+                if (body->alphatab[*pattern].letter != body->alphatab[*target].letter)
+                    break;
+            }
+
+            if (i == 0 && wm_range_add(range, range->offset + start, prenode->index) < 0) {
+                range->ret = -100;
+                return;
+            }
+        }
+
+        if (iter >= bytelen) break;
+
+        hash1 = wm_hash_func(body, pbyte + iter - body->B + 1, body->B);
+        shift = body->shifttab[hash1];
+        iter += shift + 1;
+    }
+}
+
+static void * wm_range_task (void * arg)
+{
+    WMRange  * range = (WMRange *)arg;
+
+    range->pbyte = file_mmap(NULL, range->fd, range->offset, range->bytelen,
+                             PROT_READ, MAP_PRIVATE, &range->pmap, &range->maplen, NULL);
+    if (!range->pbyte) {
+        range->ret = -10;
+        return range;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(range->pmap, range->maplen, MADV_SEQUENTIAL);
+#endif
+
+    wm_range_scan(range);
+
+    return range;
+}
+
+static void wm_range_free (WMRange * range)
+{
+    if (!range) return;
+
+    if (range->pmap) file_munmap(range->pmap, range->maplen);
+    if (range->matches) kfree(range->matches);
+
+    kfree(range);
+}
+
+/* call back the matches of range in offset order. the skipnum returned by
+ * callback drops the matches starting before pos + skipnum */
+static long wm_range_deliver (WMRange * range, int64 * skipto)
+{
+    WMBody      * body = range->body;
+    PatternItem * patitem = NULL;
+    WMMatch     * m = NULL;
+    long          delivered = 0;
+    int64         off = 0;
+    int           skipnum = 0;
+    int           i;
+
+    for (i = 0; i < range->num; i++) {
+        m = &range->matches[i];
+        if (m->pos < *skipto) continue;
+
+        patitem = arr_value(body->patlist, m->index);
+        if (!patitem) continue;
+
+        delivered++;
+        if (!patitem->matchsucc) continue;
+
+        skipnum = 0;
+        off = m->pos - range->offset;
+
+        (*patitem->matchsucc)(patitem->para, WM_SRC_FILERANGE,
+                              range->pbyte + off, range->bytelen - off, m->pos,
+                              &skipnum, patitem->pattern, patitem->length,
+                              NULL, 0, NULL);
+
+        if (skipnum > 0) *skipto = m->pos + skipnum;
+    }
+
+    return delivered;
+}
+
+long wm_file_search_parallel (void * vbody, char * file, void * vpool, long rangelen)
+{
+    WMBody      * body = (WMBody *)vbody;
+    PatternItem * patitem = NULL;
+    void        * pool = vpool;
+    WMRange    ** ranges = NULL;
+    void       ** futs = NULL;
+    WMRange     * range = NULL;
+    struct stat   st;
+    int64         fsize = 0;
+    int64         offset = 0;
+    int64         skipto = 0;
+    long          total = 0;
+    int           maxlen = 0;
+    int           inflight = 0;
+    int           head = 0, tail = 0;
+    int           fd = -1;
+    int           i, ret = 0;
+
+    if (!body) return -1;
+    if (!file) return -2;
+    if (body->patslen <= 0 || !body->shifttab) return -3;
+
+    for (i = 0; i < arr_num(body->patlist); i++) {
+        patitem = arr_value(body->patlist, i);
+        if (patitem && patitem->length > maxlen) maxlen = patitem->length;
+    }
+
+    if (rangelen <= 0) rangelen = WM_RANGE_SIZE;
+    if (rangelen < maxlen) rangelen = maxlen;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) return -100;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -101;
+    }
+    fsize = st.st_size;
+
+    if (!pool) pool = thpool_new(0, 0);
+
+    /* the ranges are mapped and searched ahead of the delivery by at most
+     * 2 per worker, so the mapped memory is bounded */
+    inflight = pool ? thpool_num(pool) * 2 : 1;
+    if (inflight < 2) inflight = 2;
+
+    ranges = kzalloc(inflight * sizeof(WMRange *));
+    futs = kzalloc(inflight * sizeof(void *));
+    if (!ranges || !futs) {
+        ret = -102;
+        goto done;
+    }
+
+    while (ret >= 0 && (offset < fsize || tail < head)) {
+        /* post the ranges until the window is full */
+        while (offset < fsize && head - tail < inflight) {
+            range = kzalloc(sizeof(*range));
+            if (!range) {
+                ret = -103;
+                break;
+            }
+            range->body = body;
+            range->fd = fd;
+            range->offset = offset;
+            range->ownlen = min(rangelen, fsize - offset);
+            range->bytelen = min(rangelen + maxlen - 1, fsize - offset);
+
+            futs[head % inflight] = thpool_submit(pool, wm_range_task, range);
+            if (!futs[head % inflight]) {
+                wm_range_free(range);
+                ret = -104;
+                break;
+            }
+            ranges[head % inflight] = range;
+
+            offset += range->ownlen;
+            head++;
+        }
+
+        if (tail >= head) break;
+
+        /* deliver the oldest one in order */
+        i = tail % inflight;
+        thfuture_wait(futs[i], -1, NULL);
+        thfuture_free(futs[i]);
+        futs[i] = NULL;
+
+        range = ranges[i];
+        ranges[i] = NULL;
+        tail++;
+
+        if (range->ret < 0 && ret >= 0) ret = range->ret;
+        if (ret >= 0) total += wm_range_deliver(range, &skipto);
+
+        wm_range_free(range);
+    }
+
+    /* drain the ones posted before an error */
+    for ( ; tail < head; tail++) {
+        i = tail % inflight;
+        thfuture_wait(futs[i], -1, NULL);
+        thfuture_free(futs[i]);
+        wm_range_free(ranges[i]);
+    }
+
+done:
+    if (ranges) kfree(ranges);
+    if (futs) kfree(futs);
+    if (pool != vpool) thpool_free(pool);
+    close(fd);
+
+    return ret < 0 ? ret : total;
+}
+
+#else
+
+long wm_file_search_parallel (void * vbody, char * file, void * vpool, long rangelen)
+{
+    return -10;
+}
+
+#endif
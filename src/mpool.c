@@ -9,6 +9,8 @@
 #include "dynarr.h"
 #include "arfifo.h"
 #include "hashtab.h"
+#include "tlcache.h"
+#include "metrics.h"
 
 typedef int (MPUnitInit) (void *);
 typedef int (MPUnitFree) (void *);
@@ -73,6 +75,15 @@ typedef struct mem_pool_s {
     MPUnitSize       * usizefunc;
 
     hashtab_t        * rmdup_tab;
+
+    /* per-thread magazines in front of the locked fifo */
+    tlcache_t        * tlcache;
+
+    /* NUMA-aware pool is made up of the sub-pools of each node. node is
+       the node of a sub-pool, -1 for the others */
+    int                node;
+    int                nodenum;
+    struct mem_pool_s ** nodes;
 } mpool_t;
 
 
@@ -117,6 +128,8 @@ mpool_t * mpool_alloc ()
     mp->rmdup_tab = ht_only_new(4096, mpool_hash_cmp);
     ht_set_hash_func(mp->rmdup_tab, mpool_hash);
 
+    mp->node = -1;
+
     return mp;
 }
 
@@ -128,6 +141,17 @@ int mpool_free (mpool_t * mp)
 
     if (!mp) return -1;
 
+    if (mp->nodes) {
+        for (i = 0; i < mp->nodenum; i++)
+            mpool_free(mp->nodes[i]);
+        kfree(mp->nodes);
+        mp->nodes = NULL;
+    }
+
+    /* units cached by threads go back to refifo before releasing */
+    tlcache_free(mp->tlcache);
+    mp->tlcache = NULL;
+
     EnterCriticalSection(&mp->mpCS);
 
     if (mp->freefunc) {
@@ -161,35 +185,36 @@ int mpool_free (mpool_t * mp)
 }
 
  
-void * mpool_fetch (mpool_t * mp)
+static void * mpool_fetch_locked (mpool_t * mp)
 {
     void     * pca = NULL; 
     void     * unit = NULL;
     int        i = 0;
     long       size = 0;
  
-    if (!mp) return NULL;
-    if (mp->unitsize < 1) return NULL;
- 
-    EnterCriticalSection(&mp->mpCS);
-
     if (ar_fifo_num(mp->fifo) <= 0 && ar_fifo_num(mp->refifo) <= 0) {
 
         /* allocate allocnum * unitsize space as mem_cache */
 
         size = mp->unitsize * mp->allocnum;
         pca = kzalloc(size);
-        if (!pca) {
-            LeaveCriticalSection(&mp->mpCS);
-            return NULL;
-        }
+        if (!pca) return NULL;
+
+        /* the pages of the cache not touched yet by zeroing, such as those
+           freshly mapped, are kept on the node of sub-pool too */
+        if (mp->node >= 0)
+            mem_numa_bind(pca, size, mp->node);
 
         arr_insert_by(mp->cache_list, pca, mem_cache_cmp_mem_cache);
 
         for (i = 0; i < mp->allocnum; i++) {
             ar_fifo_push(mp->fifo, pca + i * mp->unitsize);
         }
-    }
+
+        metric_inc(MC_MPOOL_MISS);
+        metric_add(MC_MPOOL_GROW_BYTES, size);
+    } else
+        metric_inc(MC_MPOOL_HIT);
 
     if (ar_fifo_num(mp->fifo) > 0)
         unit = ar_fifo_out(mp->fifo); 
@@ -200,46 +225,242 @@ void * mpool_fetch (mpool_t * mp)
     if (unit) 
         ht_set(mp->rmdup_tab, unit, unit);
 
+    return unit;
+}
+
+static void mpool_check_freesize (mpool_t * mp, void * unit)
+{
+    if (mp->freefunc && mp->usizefunc && mp->freesize > 0) {
+        if ((*mp->usizefunc)(unit) >= mp->freesize)
+            (*mp->freefunc)(unit);
+    }
+}
+
+static int mpool_recycle_locked (mpool_t * mp, void * unit, int checksize)
+{
+    if (ht_delete(mp->rmdup_tab, unit) != unit)
+        return -100;
+
+#if 0
+    /* hashtab rmdup_tab assured the memory pointer is allocated by mpool */
+
+    if (arr_find_by(mp->cache_list, unit, mem_cache_cmp_unit) == NULL) {
+        return -100;
+    }
+#endif
+
+    if (checksize) mpool_check_freesize(mp, unit);
+
+    ar_fifo_push(mp->refifo, unit); 
+
+    return 0;
+}
+
+/* units held in thread magazines are recorded in rmdup_tab as fetched */
+static int mpool_refill_batch (void * vmp, void ** units, int num)
+{
+    mpool_t  * mp = (mpool_t *)vmp;
+    int        i = 0;
+
+    EnterCriticalSection(&mp->mpCS);
+
+    for (i = 0; i < num; i++) {
+        units[i] = mpool_fetch_locked(mp);
+        if (!units[i]) break;
+    }
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    return i;
+}
+
+static int mpool_flush_batch (void * vmp, void ** units, int num)
+{
+    mpool_t  * mp = (mpool_t *)vmp;
+    int        i = 0;
+
+    EnterCriticalSection(&mp->mpCS);
+
+    for (i = 0; i < num; i++) {
+        mpool_recycle_locked(mp, units[i], 0);
+    }
+
     LeaveCriticalSection(&mp->mpCS);
 
+    return 0;
+}
+
+void * mpool_fetch (mpool_t * mp)
+{
+    void     * unit = NULL;
+ 
+    if (!mp) return NULL;
+    if (mp->unitsize < 1) return NULL;
+ 
+    if (mp->nodes)
+        return mpool_fetch(mp->nodes[mem_numa_node() % mp->nodenum]);
+
+    if (mp->tlcache) {
+        unit = tlcache_fetch(mp->tlcache);
+
+    } else {
+        EnterCriticalSection(&mp->mpCS);
+        unit = mpool_fetch_locked(mp);
+        LeaveCriticalSection(&mp->mpCS);
+    }
+
     if (unit && mp->initfunc) (*mp->initfunc)(unit);
 
     return unit;
 }
 
+/* the unit goes back to the sub-pool it was fetched from. the sub-pool of
+   current node is checked first */
+static mpool_t * mpool_node_owner (mpool_t * mp, void * unit)
+{
+    mpool_t  * sub = NULL;
+    void     * found = NULL;
+    int        i, node;
+
+    node = mem_numa_node() % mp->nodenum;
+
+    for (i = 0; i < mp->nodenum; i++) {
+        sub = mp->nodes[(node + i) % mp->nodenum];
+
+        EnterCriticalSection(&sub->mpCS);
+        found = ht_get(sub->rmdup_tab, unit);
+        LeaveCriticalSection(&sub->mpCS);
+
+        if (found == unit) return sub;
+    }
+
+    return NULL;
+}
+
 int mpool_recycle (mpool_t * mp, void * unit)
 {
+    int  ret = 0;
+
     if (!mp) return -1;
     if (!unit) return -2;
 
-    EnterCriticalSection(&mp->mpCS);
+    if (mp->nodes) {
+        mp = mpool_node_owner(mp, unit);
+        if (!mp) return -100;
+    }
 
-    if (ht_delete(mp->rmdup_tab, unit) != unit) {
-        LeaveCriticalSection(&mp->mpCS);
-        return -100;
+    if (mp->tlcache) {
+        if (tlcache_recycle(mp->tlcache, unit) < 0)
+            return -100;
+
+        /* the unit stays in the magazine of current thread */
+        mpool_check_freesize(mp, unit);
+        return 0;
     }
 
-#if 0
-    /* hashtab rmdup_tab assured the memory pointer is allocated by mpool */
+    EnterCriticalSection(&mp->mpCS);
+    ret = mpool_recycle_locked(mp, unit, 1);
+    LeaveCriticalSection(&mp->mpCS);
 
-    if (arr_find_by(mp->cache_list, unit, mem_cache_cmp_unit) == NULL) {
-        LeaveCriticalSection(&mp->mpCS);
-        return -100;
+    return ret;
+}
+
+int mpool_set_tlcache (mpool_t * mp, int depth)
+{
+    int  i, ret = 0;
+
+    if (!mp) return -1;
+
+    if (mp->nodes) {
+        for (i = 0; i < mp->nodenum && ret == 0; i++)
+            ret = mpool_set_tlcache(mp->nodes[i], depth);
+        return ret;
     }
-#endif
 
-    if (mp->freefunc && mp->usizefunc && mp->freesize > 0) {
-        if ((*mp->usizefunc)(unit) >= mp->freesize)
-            (*mp->freefunc)(unit);
+    if (mp->tlcache) {
+        if (tlcache_depth(mp->tlcache) == depth)
+            return 0;
+
+        tlcache_free(mp->tlcache);
+        mp->tlcache = NULL;
     }
 
-    ar_fifo_push(mp->refifo, unit); 
+    if (depth <= 0) return 0;
 
-    LeaveCriticalSection(&mp->mpCS);
+    mp->tlcache = tlcache_new(mp, depth, mpool_refill_batch, mpool_flush_batch);
+    if (!mp->tlcache) return -2;
 
     return 0;
 }
 
+int mpool_tlcache_stat (mpool_t * mp, ulong * hit, ulong * miss,
+                        ulong * recycle, ulong * flush)
+{
+    if (!mp) return -1;
+
+    if (mp->nodes)
+        mp = mp->nodes[mem_numa_node() % mp->nodenum];
+
+    return tlcache_stat(mp->tlcache, hit, miss, recycle, flush);
+}
+
+int mpool_set_numa (mpool_t * mp, int on)
+{
+    mpool_t  * sub = NULL;
+    int        i, num;
+
+    if (!mp) return -1;
+
+    if (!on) {
+        if (mp->nodes) {
+            for (i = 0; i < mp->nodenum; i++)
+                mpool_free(mp->nodes[i]);
+            kfree(mp->nodes);
+            mp->nodes = NULL;
+            mp->nodenum = 0;
+        }
+        return 1;
+    }
+
+    if (mp->nodes) return mp->nodenum;
+
+    num = mem_numa_nodes();
+    if (num <= 1) return 1;
+
+    mp->nodes = kzalloc(sizeof(mpool_t *) * num);
+    if (!mp->nodes) return -100;
+
+    for (i = 0; i < num; i++) {
+        sub = mpool_alloc();
+        if (!sub) break;
+
+        sub->unitsize = mp->unitsize;
+        sub->allocnum = mp->allocnum;
+        sub->freesize = mp->freesize;
+        sub->initfunc = mp->initfunc;
+        sub->freefunc = mp->freefunc;
+        sub->usizefunc = mp->usizefunc;
+        sub->node = i;
+
+        if (mp->tlcache)
+            mpool_set_tlcache(sub, tlcache_depth(mp->tlcache));
+
+        mp->nodes[i] = sub;
+        mp->nodenum++;
+    }
+
+    if (mp->nodenum < num) {
+        mpool_set_numa(mp, 0);
+        return -101;
+    }
+
+    /* the magazines of the sub-pools take the place of pool's own */
+    tlcache_free(mp->tlcache);
+    mp->tlcache = NULL;
+
+    return mp->nodenum;
+}
+
  
 int mpool_set_allocnum (mpool_t * mp, int num)
 {
@@ -330,6 +330,7 @@ int event_wait (void * vevent, int millisec)
     struct timeval   tv;
     struct timespec  ts;
     int              ret = -1;
+    int              val = -1;
  
     if (!event) return -1;
     
@@ -340,11 +341,12 @@ int event_wait (void * vevent, int millisec)
     pthread_mutex_lock(&event->mutex);
     event->value = -1;
     ret = pthread_cond_timedwait (&event->cond, &event->mutex, &ts);
+    val = event->value;
     pthread_mutex_unlock(&event->mutex);
  
     if (ret == ETIMEDOUT) return -1;
  
-    return event->value;
+    return val;
 }
  
 void event_set (void * vevent, int val)
@@ -3,11 +3,16 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "btype.h"
 #include "memory.h"
 #include "nativefile.h"
 
 #ifdef UNIX
+#include <sys/uio.h>
 
 void * native_file_open (char * nfile, int flag)
 {
@@ -69,6 +74,11 @@ void * native_file_open (char * nfile, int flag)
             hfile->oflag = O_WRONLY;
     }
 
+#ifdef O_DIRECT
+    if (flag & NF_DIRECT)
+        hfile->oflag |= O_DIRECT;
+#endif
+
     if (ret < 0) { //file not exist, need create it
         hfile->oflag |= O_CREAT;
         hfile->fd = open(nfile, hfile->oflag, hfile->mode);
@@ -281,6 +291,186 @@ int native_file_fd (void * vhfile)
     return hfile->fd;
 }
 
+int native_file_pread (void * vhfile, void * pbuf, int size, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+    int          ret = 0;
+    int          len = 0;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0 || offset < 0) return -3;
+
+    for (len = 0; len < size; ) {
+        ret = pread(hfile->fd, (uint8 *)pbuf + len, size - len, offset + len);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -100;
+
+        } else if (ret == 0) { //reach end of the file
+            break;
+        }
+
+        len += ret;
+    }
+
+    return len;
+}
+
+static void native_file_size_to (NativeFile * hfile, int64 end)
+{
+    EnterCriticalSection(&hfile->fileCS);
+    if (end > hfile->size)
+        hfile->size = end;
+    LeaveCriticalSection(&hfile->fileCS);
+}
+
+int native_file_pwrite (void * vhfile, void * pbuf, int size, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+    int          ret = 0;
+    int          len = 0;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0 || offset < 0) return -3;
+
+    for (len = 0; len < size; ) {
+        ret = pwrite(hfile->fd, (uint8 *)pbuf + len, size - len, offset + len);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -100;
+        }
+
+        len += ret;
+    }
+
+    native_file_size_to(hfile, offset + len);
+
+    return len;
+}
+
+/* one system call moves all the buffers. a short transfer finishes the
+ * buffer it stopped in by pread/pwrite, then goes on with the rest of iov */
+static int64 native_file_iov (NativeFile * hfile, struct iovec * iov, int iovcnt,
+                              int64 offset, int write)
+{
+    int64   total = 0;
+    ssize_t ret = 0;
+    size_t  rest = 0;
+    int     i = 0;
+
+    while (i < iovcnt) {
+        if (write) ret = pwritev(hfile->fd, iov + i, iovcnt - i, offset);
+        else ret = preadv(hfile->fd, iov + i, iovcnt - i, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return total > 0 ? total : -100;
+        }
+        if (ret == 0) break;
+
+        total += ret;
+        offset += ret;
+
+        for ( ; i < iovcnt && (size_t)ret >= iov[i].iov_len; i++)
+            ret -= iov[i].iov_len;
+
+        if (i < iovcnt && ret > 0) {
+            rest = iov[i].iov_len - ret;
+
+            if (write) ret = native_file_pwrite(hfile, (uint8 *)iov[i].iov_base + ret, rest, offset);
+            else ret = native_file_pread(hfile, (uint8 *)iov[i].iov_base + ret, rest, offset);
+
+            if (ret < 0) return total > 0 ? total : -100;
+
+            total += ret;
+            offset += ret;
+            if ((size_t)ret < rest) break;
+
+            i++;
+        }
+    }
+
+    return total;
+}
+
+int64 native_file_preadv (void * vhfile, void * iov, int iovcnt, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (!iov || iovcnt < 0) return -2;
+    if (offset < 0) return -3;
+
+    return native_file_iov(hfile, (struct iovec *)iov, iovcnt, offset, 0);
+}
+
+int64 native_file_pwritev (void * vhfile, void * iov, int iovcnt, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+    int64        ret = 0;
+
+    if (!hfile) return -1;
+    if (!iov || iovcnt < 0) return -2;
+    if (offset < 0) return -3;
+
+    ret = native_file_iov(hfile, (struct iovec *)iov, iovcnt, offset, 1);
+    if (ret > 0)
+        native_file_size_to(hfile, offset + ret);
+
+    return ret;
+}
+
+int native_file_allocate (void * vhfile, int64 offset, int64 len)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+    int          ret = 0;
+
+    if (!hfile) return -1;
+    if (offset < 0 || len <= 0) return -2;
+
+#if defined(_LINUX_)
+    do {
+        ret = fallocate(hfile->fd, 0, offset, len);
+    } while (ret < 0 && errno == EINTR);
+
+    /* the file system does not support it, glibc emulates by writing */
+    if (ret < 0 && errno == EOPNOTSUPP)
+        ret = posix_fallocate(hfile->fd, offset, len);
+    else if (ret < 0)
+        ret = errno;
+#else
+    ret = posix_fallocate(hfile->fd, offset, len);
+#endif
+
+    if (ret != 0) return -100;
+
+    native_file_size_to(hfile, offset + len);
+
+    return 0;
+}
+
+int native_file_sync_range (void * vhfile, int64 offset, int64 len, int wait)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+    int          ret = 0;
+
+    if (!hfile) return -1;
+    if (offset < 0 || len < 0) return -2;
+
+#if defined(_LINUX_)
+    ret = sync_file_range(hfile->fd, offset, len,
+                          wait ? SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                 SYNC_FILE_RANGE_WAIT_AFTER
+                               : SYNC_FILE_RANGE_WRITE);
+#else
+    ret = wait ? fdatasync(hfile->fd) : 0;
+#endif
+
+    return ret < 0 ? -100 : 0;
+}
+
 int64 native_file_size (void * vhfile)
 {
     NativeFile * hfile = (NativeFile *)vhfile;
@@ -613,6 +803,97 @@ int native_file_fd (void * vhfile)
     return hfile->fd;
 }
 
+/* no positional I/O on win32, the offset is moved and restored in fileCS */
+static int native_file_pio (NativeFile * hfile, void * pbuf, int size, int64 offset, int write)
+{
+    int  ret = 0;
+    int  len = 0;
+
+    EnterCriticalSection(&hfile->fileCS);
+
+    if (_lseeki64(hfile->fd, offset, SEEK_SET) != offset) {
+        LeaveCriticalSection(&hfile->fileCS);
+        return -100;
+    }
+
+    for (len = 0; len < size; ) {
+        if (write) ret = _write(hfile->fd, (uint8 *)pbuf + len, size - len);
+        else ret = _read(hfile->fd, (uint8 *)pbuf + len, size - len);
+
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            len = -100;
+            break;
+        }
+        if (ret == 0) break;
+
+        len += ret;
+    }
+
+    if (write && len > 0 && offset + len > hfile->size)
+        hfile->size = offset + len;
+
+    _lseeki64(hfile->fd, hfile->offset, SEEK_SET);
+
+    LeaveCriticalSection(&hfile->fileCS);
+
+    return len;
+}
+
+int native_file_pread (void * vhfile, void * pbuf, int size, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0 || offset < 0) return -3;
+
+    return native_file_pio(hfile, pbuf, size, offset, 0);
+}
+
+int native_file_pwrite (void * vhfile, void * pbuf, int size, int64 offset)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0 || offset < 0) return -3;
+
+    return native_file_pio(hfile, pbuf, size, offset, 1);
+}
+
+/* struct iovec is not defined on win32 */
+int64 native_file_preadv (void * vhfile, void * iov, int iovcnt, int64 offset)
+{
+    return -1;
+}
+
+int64 native_file_pwritev (void * vhfile, void * iov, int iovcnt, int64 offset)
+{
+    return -1;
+}
+
+int native_file_allocate (void * vhfile, int64 offset, int64 len)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (offset < 0 || len <= 0) return -2;
+
+    if (offset + len <= hfile->size) return 0;
+
+    return native_file_resize(hfile, offset + len);
+}
+
+int native_file_sync_range (void * vhfile, int64 offset, int64 len, int wait)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+
+    return _commit(hfile->fd) < 0 ? -100 : 0;
+}
+
 int64 native_file_size (void * vhfile)
 {
     NativeFile * hfile = (NativeFile *)vhfile;
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "pagecache.h"
+
+#ifdef UNIX
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+typedef struct pc_page_s {
+    struct pc_page_s * next;     //next in the hash bucket
+
+    long               inode;
+    time_t             mtime;
+    int64              index;    //page index in file
+
+    int                len;      //valid bytes, less than pagesize at end of file
+    int                ref;      //readers copying out of the page
+    uint8              used;     //CLOCK referenced bit
+    int                slot;     //position in the clock ring, -1 if not cached
+
+    uint8              data[1];
+} PCPage;
+
+typedef struct pc_shard_s {
+    CRITICAL_SECTION   shCS;
+
+    PCPage          ** bucket;
+    int                bucketnum;   //power of 2
+
+    PCPage          ** ring;        //the clock ring of cached pages
+    int                ringnum;
+    int                ringsize;
+    int                hand;
+
+    uint64             hits;
+    uint64             misses;
+    uint64             evicts;
+} PCShard;
+
+typedef struct pcache_s {
+    int64              budget;
+    int                pagesize;
+
+    PCShard            shard[PCACHE_SHARDS];
+} PCache;
+
+static PCache * g_pcache = NULL;
+
+
+static uint64 pc_hash (long inode, time_t mtime, int64 index)
+{
+    uint64 h = 0;
+
+    h = (uint64)inode * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64)mtime * 0xC2B2AE3D27D4EB4FULL;
+    h ^= (uint64)index * 0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+
+    return h;
+}
+
+int pcache_init (int64 budget, int pagesize)
+{
+#ifdef UNIX
+    PCache  * pc = NULL;
+    PCShard * sh = NULL;
+    int       i, num;
+
+    if (g_pcache) return 0;
+    if (budget <= 0) return -1;
+
+    if (pagesize <= 0) pagesize = PCACHE_PAGESIZE;
+    pagesize = (pagesize + 4095) & ~4095;
+
+    pc = kzalloc(sizeof(*pc));
+    if (!pc) return -100;
+
+    pc->budget = budget;
+    pc->pagesize = pagesize;
+
+    num = (int)(budget / pagesize / PCACHE_SHARDS);
+    if (num < 4) num = 4;
+
+    for (i = 0; i < PCACHE_SHARDS; i++) {
+        sh = &pc->shard[i];
+
+        InitializeCriticalSection(&sh->shCS);
+
+        for (sh->bucketnum = 4; sh->bucketnum < num; sh->bucketnum <<= 1);
+        sh->bucket = kzalloc(sizeof(PCPage *) * sh->bucketnum);
+
+        sh->ringsize = num;
+        sh->ring = kzalloc(sizeof(PCPage *) * num);
+
+        if (!sh->bucket || !sh->ring) {
+            g_pcache = pc;
+            pcache_clean();
+            return -101;
+        }
+    }
+
+    g_pcache = pc;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void pcache_clean ()
+{
+    PCache  * pc = g_pcache;
+    PCShard * sh = NULL;
+    int       i, j;
+
+    if (!pc) return;
+
+    g_pcache = NULL;
+
+    for (i = 0; i < PCACHE_SHARDS; i++) {
+        sh = &pc->shard[i];
+
+        for (j = 0; sh->ring && j < sh->ringnum; j++)
+            kfree(sh->ring[j]);
+
+        if (sh->ring) kfree(sh->ring);
+        if (sh->bucket) kfree(sh->bucket);
+
+        DeleteCriticalSection(&sh->shCS);
+    }
+
+    kfree(pc);
+}
+
+int pcache_enabled ()
+{
+    return g_pcache != NULL;
+}
+
+
+static void pc_bucket_unlink (PCShard * sh, PCPage * page, uint64 h)
+{
+    PCPage ** pp = NULL;
+
+    for (pp = &sh->bucket[h & (sh->bucketnum - 1)]; *pp; pp = &(*pp)->next) {
+        if (*pp == page) {
+            *pp = page->next;
+            return;
+        }
+    }
+}
+
+/* sweep the clock hand, the pinned pages are skipped and the referenced
+ * ones get a second chance. return the freed slot, -1 if all are pinned */
+static int pc_shard_evict (PCShard * sh)
+{
+    PCPage * page = NULL;
+    int      i, slot;
+
+    for (i = 0; i < 2 * sh->ringnum; i++) {
+        slot = sh->hand;
+        sh->hand = (sh->hand + 1) % sh->ringnum;
+
+        page = sh->ring[slot];
+
+        if (page->ref > 0) continue;
+
+        if (page->used) {
+            page->used = 0;
+            continue;
+        }
+
+        pc_bucket_unlink(sh, page, pc_hash(page->inode, page->mtime, page->index));
+        kfree(page);
+
+        sh->ring[slot] = NULL;
+        sh->evicts++;
+
+        return slot;
+    }
+
+    return -1;
+}
+
+static PCPage * pc_shard_find (PCShard * sh, long inode, time_t mtime, int64 index, uint64 h)
+{
+    PCPage * page = NULL;
+
+    for (page = sh->bucket[h & (sh->bucketnum - 1)]; page; page = page->next) {
+        if (page->index == index && page->inode == inode && page->mtime == mtime)
+            return page;
+    }
+
+    return NULL;
+}
+
+#ifdef UNIX
+static int pc_pread (int fd, uint8 * pbuf, int size, int64 offset)
+{
+    int  ret = 0;
+    int  len = 0;
+
+    while (len < size) {
+        ret = pread(fd, pbuf + len, size - len, offset + len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return len > 0 ? len : -1;
+        }
+        if (ret == 0) break;
+
+        len += ret;
+    }
+
+    return len;
+}
+#endif
+
+/* return the page pinned, it is loaded from file $fd if not cached */
+static PCPage * pc_page_get (PCache * pc, int fd, long inode, time_t mtime, int64 index)
+{
+    PCShard * sh = NULL;
+    PCPage  * page = NULL;
+    PCPage  * found = NULL;
+    uint64    h = 0;
+    int       slot = 0;
+
+    h = pc_hash(inode, mtime, index);
+    sh = &pc->shard[(h >> 32) % PCACHE_SHARDS];
+
+    EnterCriticalSection(&sh->shCS);
+    page = pc_shard_find(sh, inode, mtime, index, h);
+    if (page) {
+        page->used = 1;
+        page->ref++;
+        sh->hits++;
+        LeaveCriticalSection(&sh->shCS);
+        return page;
+    }
+    sh->misses++;
+    LeaveCriticalSection(&sh->shCS);
+
+#ifdef UNIX
+    /* load out of the lock, the readers of other pages go on */
+    page = kalloc(sizeof(*page) - 1 + pc->pagesize);
+    if (!page) return NULL;
+
+    page->len = pc_pread(fd, page->data, pc->pagesize, index * pc->pagesize);
+    if (page->len < 0) {
+        kfree(page);
+        return NULL;
+    }
+#else
+    return NULL;
+#endif
+
+    page->inode = inode;
+    page->mtime = mtime;
+    page->index = index;
+    page->ref = 1;
+    page->used = 1;
+
+    EnterCriticalSection(&sh->shCS);
+
+    /* another reader may have loaded the same page meanwhile */
+    found = pc_shard_find(sh, inode, mtime, index, h);
+    if (found) {
+        found->used = 1;
+        found->ref++;
+        LeaveCriticalSection(&sh->shCS);
+        kfree(page);
+        return found;
+    }
+
+    if (sh->ringnum < sh->ringsize) slot = sh->ringnum++;
+    else slot = pc_shard_evict(sh);
+
+    page->slot = slot;
+
+    if (slot >= 0) {
+        sh->ring[slot] = page;
+        page->next = sh->bucket[h & (sh->bucketnum - 1)];
+        sh->bucket[h & (sh->bucketnum - 1)] = page;
+    }
+
+    LeaveCriticalSection(&sh->shCS);
+
+    return page;
+}
+
+static void pc_page_put (PCache * pc, PCPage * page)
+{
+    PCShard * sh = NULL;
+
+    /* the page not cached is owned by the reader only */
+    if (page->slot < 0) {
+        kfree(page);
+        return;
+    }
+
+    sh = &pc->shard[(pc_hash(page->inode, page->mtime, page->index) >> 32) % PCACHE_SHARDS];
+
+    EnterCriticalSection(&sh->shCS);
+    page->ref--;
+    LeaveCriticalSection(&sh->shCS);
+}
+
+int pcache_read (int fd, long inode, time_t mtime, int64 pos, void * pbuf, int len)
+{
+    PCache  * pc = g_pcache;
+    PCPage  * page = NULL;
+    int       readlen = 0;
+    int       off, num, plen;
+
+    if (!pc) return -1;
+    if (fd < 0 || pos < 0) return -2;
+    if (!pbuf || len <= 0) return 0;
+
+    while (readlen < len) {
+        page = pc_page_get(pc, fd, inode, mtime, pos / pc->pagesize);
+        if (!page) return readlen > 0 ? readlen : -100;
+
+        off = (int)(pos % pc->pagesize);
+        plen = page->len;
+
+        num = plen - off;
+        if (num > len - readlen) num = len - readlen;
+
+        if (num > 0)
+            memcpy((uint8 *)pbuf + readlen, page->data + off, num);
+
+        pc_page_put(pc, page);
+
+        if (num <= 0) break;
+
+        readlen += num;
+        pos += num;
+
+        /* a short page is the end of file */
+        if (plen < pc->pagesize) break;
+    }
+
+    return readlen;
+}
+
+int pcache_stat (pcache_stat_t * st)
+{
+    PCache  * pc = g_pcache;
+    PCShard * sh = NULL;
+    int       i;
+
+    if (!st) return -1;
+
+    memset(st, 0, sizeof(*st));
+
+    if (!pc) return -2;
+
+    st->budget = pc->budget;
+
+    for (i = 0; i < PCACHE_SHARDS; i++) {
+        sh = &pc->shard[i];
+
+        EnterCriticalSection(&sh->shCS);
+        st->pages += sh->ringnum;
+        st->hits += sh->hits;
+        st->misses += sh->misses;
+        st->evicts += sh->evicts;
+        LeaveCriticalSection(&sh->shCS);
+    }
+
+    st->bytes = (int64)st->pages * pc->pagesize;
+
+    return 0;
+}
+
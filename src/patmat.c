@@ -10,6 +10,14 @@
 #include "fileop.h"
 #include "arfifo.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 
 typedef struct mstr_s {
     uint8     ** pbyte;
@@ -671,7 +679,7 @@ void * bm_find_bytes  (void * pbyte, int len, void * pattern, int patlen, void *
  
     if (!patvec) return NULL;
 
-    for (pos = 0; pos < len - patlen; ) {
+    for (pos = 0; pos <= len - patlen; ) {
         for (i = patlen - 1;
              i >= 0 && pat[i] == pstr[i + pos];
              i--);
@@ -716,7 +724,7 @@ void * bm_find_string (void * pbyte, int len, void * pattern, int patlen, void *
  
     if (!patvec) return NULL;
 
-    for (pos = 0; pos < len - patlen; ) {
+    for (pos = 0; pos <= len - patlen; ) {
         for (i = patlen - 1;
              i >= 0 && adf_tolower(pat[i]) == adf_tolower(pstr[i + pos]);
              i--);
@@ -982,6 +990,7 @@ void * sun_find_bytes (void * pbyte, int len, void * pattern, int patlen, void *
             break;
 
         } else {
+            if (pos + patlen >= len) break;
             pos += patlen - patvec->chloc[ pstr[pos + patlen] ];
         }
     }
@@ -1128,3 +1137,128 @@ void * sun_find_mstring (void ** ppbyte, int * plen, int num, void * pattern, in
     return NULL;
 }
 
+
+/* vectorized search by the first and the last byte of pattern. a block of
+ * positions is tested at once for pstr[i] == pat[0] && pstr[i + k] == pat[k]
+ * where k = patlen - 1, only the candidates passing both are compared by
+ * memcmp. two distant bytes filter out almost all false positions even if
+ * the first byte is frequent in the text, such as '\r' or '-' */
+
+#if defined(__AVX2__)
+
+#define PAT_SIMD_WIDTH   32
+#define PAT_SIMD_SHIFT   0
+
+static inline uint64 pat_simd_mask (uint8 * p, int k, uint8 first, uint8 last)
+{
+    __m256i  a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i  b = _mm256_loadu_si256((const __m256i *)(p + k));
+
+    a = _mm256_cmpeq_epi8(a, _mm256_set1_epi8((char)first));
+    b = _mm256_cmpeq_epi8(b, _mm256_set1_epi8((char)last));
+
+    return (uint32)_mm256_movemask_epi8(_mm256_and_si256(a, b));
+}
+
+#elif defined(__SSE2__)
+
+#define PAT_SIMD_WIDTH   16
+#define PAT_SIMD_SHIFT   0
+
+static inline uint64 pat_simd_mask (uint8 * p, int k, uint8 first, uint8 last)
+{
+    __m128i  a = _mm_loadu_si128((const __m128i *)p);
+    __m128i  b = _mm_loadu_si128((const __m128i *)(p + k));
+
+    a = _mm_cmpeq_epi8(a, _mm_set1_epi8((char)first));
+    b = _mm_cmpeq_epi8(b, _mm_set1_epi8((char)last));
+
+    return (uint32)_mm_movemask_epi8(_mm_and_si128(a, b));
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+/* NEON has no movemask, narrowing shift leaves 4 bits for each byte */
+#define PAT_SIMD_WIDTH   16
+#define PAT_SIMD_SHIFT   2
+
+static inline uint64 pat_simd_mask (uint8 * p, int k, uint8 first, uint8 last)
+{
+    uint8x16_t  a = vceqq_u8(vld1q_u8(p), vdupq_n_u8(first));
+    uint8x16_t  b = vceqq_u8(vld1q_u8(p + k), vdupq_n_u8(last));
+    uint8x8_t   m = vshrn_n_u16(vreinterpretq_u16_u8(vandq_u8(a, b)), 4);
+
+    return vget_lane_u64(vreinterpret_u64_u8(m), 0);
+}
+
+#endif
+
+void * simd_find_bytes (void * pbyte, int len, void * pattern, int patlen)
+{
+    uint8  * pstr = (uint8 *)pbyte;
+    uint8  * pat = (uint8 *)pattern;
+    uint8    first, last;
+    int      i = 0, k;
+#ifdef PAT_SIMD_WIDTH
+    uint64   mask;
+    int      bit;
+#endif
+
+    if (!pstr || len <= 0 || !pat || patlen <= 0)
+        return NULL;
+
+    if (patlen > len) return NULL;
+
+    if (patlen == 1) return memchr(pstr, pat[0], len);
+
+    k = patlen - 1;
+    first = pat[0];
+    last = pat[k];
+
+#ifdef PAT_SIMD_WIDTH
+    for ( ; i + k + PAT_SIMD_WIDTH <= len; i += PAT_SIMD_WIDTH) {
+        mask = pat_simd_mask(pstr + i, k, first, last);
+
+        while (mask) {
+            bit = __builtin_ctzll(mask) >> PAT_SIMD_SHIFT;
+
+            if (memcmp(pstr + i + bit + 1, pat + 1, k - 1) == 0)
+                return pstr + i + bit;
+
+            mask &= ~((((uint64)1 << (1 << PAT_SIMD_SHIFT)) - 1) << (bit << PAT_SIMD_SHIFT));
+        }
+    }
+#endif
+
+    for ( ; i <= len - patlen; i++) {
+        if (pstr[i] == first && pstr[i + k] == last &&
+            memcmp(pstr + i + 1, pat + 1, k - 1) == 0)
+            return pstr + i;
+    }
+
+    return NULL;
+}
+
+/* short patterns are searched by the SIMD filter, its cost is linear in
+ * the text length. Sunday and Boyer-Moore skip over the text by up to
+ * patlen bytes, which wins when the pattern gets long */
+
+void * pat_find (void * pbyte, int len, void * pattern, int patlen)
+{
+    if (!pbyte || len <= 0 || !pattern)
+        return NULL;
+
+    if (patlen < 0) patlen = strlen((const char *)pattern);
+    if (patlen <= 0 || patlen > len) return NULL;
+
+    if (patlen == 1)
+        return memchr(pbyte, ((uint8 *)pattern)[0], len);
+
+    if (patlen <= PAT_SIMD_MAXLEN)
+        return simd_find_bytes(pbyte, len, pattern, patlen);
+
+    if (patlen <= PAT_SUN_MAXLEN)
+        return sun_find_bytes(pbyte, len, pattern, patlen, NULL);
+
+    return bm_find_bytes(pbyte, len, pattern, patlen, NULL);
+}
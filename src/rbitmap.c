@@ -0,0 +1,1510 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "rbitmap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define RBITMAP_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#define RB_ARRAY    0
+#define RB_BITMAP   1
+#define RB_RUN      2
+
+#define RB_WORDS    1024      //64K bits of one bitmap container
+
+#define RB_AND      0
+#define RB_OR       1
+#define RB_ANDNOT   2
+
+/* cookies of the portable format of Roaring bitmap */
+#define RB_COOKIE_NORUN   12346
+#define RB_COOKIE_RUN     12347
+
+typedef struct rb_cont_s {
+    uint16     key;           //high 16 bits of the values
+    uint8      type;
+    int        card;          //number of values
+    int        size;          //capacity of the array, or number of runs
+    void     * data;          //uint16 array, uint64 words, or uint16 pairs of run
+} RBCont;
+
+typedef struct rbitmap_s {
+    RBCont   * cont;
+    int        num;
+    int        size;
+} RBitmap;
+
+
+static int rb_popcount (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static int rb_ctz (uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
+    int  i = 0;
+    while (!(w & 1)) { w >>= 1; i++; }
+    return i;
+#endif
+}
+
+/* the index of the first item of a not less than v */
+static int rb_lower (uint16 * a, int num, uint16 v)
+{
+    int  lo = 0, hi = num, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (a[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/* the index of the container of key, or -(insert position) - 1 */
+static int rb_find (RBitmap * rb, uint16 key)
+{
+    int  lo = 0, hi = rb->num - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (rb->cont[mid].key == key) return mid;
+        if (rb->cont[mid].key < key) lo = mid + 1;
+        else hi = mid - 1;
+    }
+
+    return -lo - 1;
+}
+
+
+/* the word loops of the bitmap containers. the operation and the count of
+ * the result are done in one pass, by AVX2 where the CPU has it */
+
+static int rb_words_op_c (uint64 * dw, uint64 * sw, int op)
+{
+    int  i, n = 0;
+
+    for (i = 0; i < RB_WORDS; i++) {
+        if (op == RB_AND) dw[i] &= sw[i];
+        else if (op == RB_OR) dw[i] |= sw[i];
+        else dw[i] &= ~sw[i];
+
+        n += rb_popcount(dw[i]);
+    }
+
+    return n;
+}
+
+static int rb_words_and_count_c (uint64 * aw, uint64 * bw)
+{
+    int  i, n = 0;
+
+    for (i = 0; i < RB_WORDS; i++) n += rb_popcount(aw[i] & bw[i]);
+
+    return n;
+}
+
+#ifdef RBITMAP_X86_DISPATCH
+
+__attribute__((target("avx2")))
+static inline __m256i rb_popcnt256 (__m256i v)
+{
+    const __m256i  lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i  low = _mm256_set1_epi8(0x0F);
+    __m256i        cnt;
+
+    cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                          _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static int rb_words_op_avx2 (uint64 * dw, uint64 * sw, int op)
+{
+    __m256i  acc = _mm256_setzero_si256();
+    __m256i  a, b;
+    int      i;
+
+    for (i = 0; i < RB_WORDS; i += 4) {
+        a = _mm256_loadu_si256((const __m256i *)(dw + i));
+        b = _mm256_loadu_si256((const __m256i *)(sw + i));
+
+        if (op == RB_AND) a = _mm256_and_si256(a, b);
+        else if (op == RB_OR) a = _mm256_or_si256(a, b);
+        else a = _mm256_andnot_si256(b, a);
+
+        _mm256_storeu_si256((__m256i *)(dw + i), a);
+        acc = _mm256_add_epi64(acc, rb_popcnt256(a));
+    }
+
+    return (int)(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+}
+
+__attribute__((target("avx2")))
+static int rb_words_and_count_avx2 (uint64 * aw, uint64 * bw)
+{
+    __m256i  acc = _mm256_setzero_si256();
+    __m256i  a, b;
+    int      i;
+
+    for (i = 0; i < RB_WORDS; i += 4) {
+        a = _mm256_loadu_si256((const __m256i *)(aw + i));
+        b = _mm256_loadu_si256((const __m256i *)(bw + i));
+        acc = _mm256_add_epi64(acc, rb_popcnt256(_mm256_and_si256(a, b)));
+    }
+
+    return (int)(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+}
+
+/* intersection of sorted arrays 8 items at a time as Schlegel et al do:
+ * pcmpestrm finds the items of a found in the block of b, and the matched
+ * lanes are packed to the front by pshufb */
+static uint8  rb_shuf[256][16];
+static int    rb_shufstate = 0;    //0 not built, 1 building, 2 ready
+
+static int rb_shuf_ready ()
+{
+    int  state = __atomic_load_n(&rb_shufstate, __ATOMIC_ACQUIRE);
+    int  r, i, k;
+
+    if (state == 2) return 1;
+    if (state == 1) return 0;
+
+    if (!__atomic_compare_exchange_n(&rb_shufstate, &state, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return state == 2;
+
+    for (r = 0; r < 256; r++) {
+        memset(rb_shuf[r], 0xFF, 16);
+        for (i = 0, k = 0; i < 8; i++) {
+            if (r & (1 << i)) {
+                rb_shuf[r][2 * k] = 2 * i;
+                rb_shuf[r][2 * k + 1] = 2 * i + 1;
+                k++;
+            }
+        }
+    }
+
+    __atomic_store_n(&rb_shufstate, 2, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/* out has room for 8 items more than the result */
+__attribute__((target("sse4.2,popcnt")))
+static int rb_and_array_sse42 (uint16 * a, int na, uint16 * b, int nb, uint16 * out)
+{
+    __m128i  va, vb, res, sm;
+    int      ia = 0, ib = 0, n = 0;
+    int      sta = na / 8 * 8, stb = nb / 8 * 8;
+    int      r;
+    uint16   amax, bmax;
+
+    if (ia < sta && ib < stb) {
+        va = _mm_loadu_si128((const __m128i *)(a + ia));
+        vb = _mm_loadu_si128((const __m128i *)(b + ib));
+
+        for ( ; ; ) {
+            res = _mm_cmpestrm(vb, 8, va, 8, _SIDD_UWORD_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+            r = _mm_extract_epi32(res, 0);
+
+            sm = _mm_loadu_si128((const __m128i *)rb_shuf[r]);
+            _mm_storeu_si128((__m128i *)(out + n), _mm_shuffle_epi8(va, sm));
+            n += __builtin_popcount(r);
+
+            amax = a[ia + 7];
+            bmax = b[ib + 7];
+
+            if (amax <= bmax) {
+                ia += 8;
+                if (ia >= sta) break;
+                va = _mm_loadu_si128((const __m128i *)(a + ia));
+            }
+            if (bmax <= amax) {
+                ib += 8;
+                if (ib >= stb) break;
+                vb = _mm_loadu_si128((const __m128i *)(b + ib));
+            }
+        }
+    }
+
+    /* the tails by merge */
+    while (ia < na && ib < nb) {
+        if (a[ia] < b[ib]) ia++;
+        else if (a[ia] > b[ib]) ib++;
+        else { out[n++] = a[ia]; ia++; ib++; }
+    }
+
+    return n;
+}
+
+static int rb_simd_level ()
+{
+    static int level = -1;
+    int        lvl = __atomic_load_n(&level, __ATOMIC_RELAXED);
+
+    if (lvl < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) lvl = 2;
+        else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) lvl = 1;
+        else lvl = 0;
+        __atomic_store_n(&level, lvl, __ATOMIC_RELAXED);
+    }
+
+    return lvl;
+}
+
+#endif
+
+static int rb_words_op (uint64 * dw, uint64 * sw, int op)
+{
+#ifdef RBITMAP_X86_DISPATCH
+    if (rb_simd_level() >= 2) return rb_words_op_avx2(dw, sw, op);
+#endif
+    return rb_words_op_c(dw, sw, op);
+}
+
+static int rb_words_and_count (uint64 * aw, uint64 * bw)
+{
+#ifdef RBITMAP_X86_DISPATCH
+    if (rb_simd_level() >= 2) return rb_words_and_count_avx2(aw, bw);
+#endif
+    return rb_words_and_count_c(aw, bw);
+}
+
+/* the first item of a not less than v from pos on, stepping 1, 2, 4 ... */
+static int rb_gallop (uint16 * a, int pos, int num, uint16 v)
+{
+    int  step = 1, lo = pos, hi;
+
+    if (pos >= num || a[pos] >= v) return pos;
+
+    while (lo + step < num && a[lo + step] < v) {
+        lo += step;
+        step <<= 1;
+    }
+
+    hi = lo + step < num ? lo + step : num;
+
+    return lo + 1 + rb_lower(a + lo + 1, hi - lo - 1, v);
+}
+
+/* intersection of sorted arrays into out, which may be a itself when the
+ * sizes are skewed. the skewed sizes gallop the larger, the similar ones
+ * go by SIMD block compare or merge */
+static int rb_and_array (uint16 * a, int na, uint16 * b, int nb, uint16 * out)
+{
+    uint16  * t = NULL;
+    int       i, j, n = 0;
+
+    if (na > nb) {
+        t = a; a = b; b = t;
+        i = na; na = nb; nb = i;
+    }
+
+    if (na * 32 < nb) {
+        for (i = 0, j = 0; i < na && j < nb; i++) {
+            j = rb_gallop(b, j, nb, a[i]);
+            if (j < nb && b[j] == a[i]) out[n++] = a[i];
+        }
+        return n;
+    }
+
+#ifdef RBITMAP_X86_DISPATCH
+    if (rb_simd_level() >= 1 && rb_shuf_ready() && out != a && out != b)
+        return rb_and_array_sse42(a, na, b, nb, out);
+#endif
+
+    for (i = 0, j = 0; i < na && j < nb; ) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else { out[n++] = a[i]; i++; j++; }
+    }
+
+    return n;
+}
+
+static int rb_and_array_count (uint16 * a, int na, uint16 * b, int nb)
+{
+    uint16  * t = NULL;
+    int       i, j, n = 0;
+
+    if (na > nb) {
+        t = a; a = b; b = t;
+        i = na; na = nb; nb = i;
+    }
+
+    for (i = 0, j = 0; i < na && j < nb; ) {
+        if (na * 32 < nb) {
+            j = rb_gallop(b, j, nb, a[i]);
+            if (j < nb && b[j] == a[i]) n++;
+            i++;
+        } else if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else { n++; i++; j++; }
+    }
+
+    return n;
+}
+
+
+/* the run container keeps pairs of the start and the length - 1 */
+
+static int rb_run_find (uint16 * run, int nrun, uint16 low)
+{
+    int  lo = 0, hi = nrun - 1, mid, pos = -1;
+
+    /* the last run starting at or before low */
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (run[2 * mid] <= low) { pos = mid; lo = mid + 1; }
+        else hi = mid - 1;
+    }
+
+    return pos;
+}
+
+static int rb_cont_has (RBCont * c, uint16 low)
+{
+    uint16 * a = NULL;
+    int      i;
+
+    if (c->type == RB_BITMAP)
+        return (((uint64 *)c->data)[low >> 6] >> (low & 63)) & 1;
+
+    a = (uint16 *)c->data;
+
+    if (c->type == RB_RUN) {
+        i = rb_run_find(a, c->size, low);
+        return i >= 0 && (int)low <= a[2 * i] + a[2 * i + 1];
+    }
+
+    i = rb_lower(a, c->card, low);
+
+    return i < c->card && a[i] == low;
+}
+
+static int rb_to_bitmap (RBCont * c)
+{
+    uint64 * w = NULL;
+    uint16 * a = (uint16 *)c->data;
+    int      i, v, end;
+
+    w = kzalloc(RB_WORDS * sizeof(uint64));
+    if (!w) return -100;
+
+    if (c->type == RB_RUN) {
+        for (i = 0; i < c->size; i++) {
+            end = a[2 * i] + a[2 * i + 1];
+            for (v = a[2 * i]; v <= end; v++)
+                w[v >> 6] |= (uint64)1 << (v & 63);
+        }
+    } else {
+        for (i = 0; i < c->card; i++)
+            w[a[i] >> 6] |= (uint64)1 << (a[i] & 63);
+    }
+
+    if (c->data) kfree(c->data);
+
+    c->data = w;
+    c->type = RB_BITMAP;
+    c->size = 0;
+
+    return 0;
+}
+
+static int rb_to_array (RBCont * c)
+{
+    uint16 * src = (uint16 *)c->data;
+    uint64 * w = (uint64 *)c->data;
+    uint16 * a = NULL;
+    uint64   v;
+    int      i, n = 0, k, end;
+
+    a = kalloc((c->card > 0 ? c->card : 1) * sizeof(uint16));
+    if (!a) return -100;
+
+    if (c->type == RB_RUN) {
+        for (i = 0; i < c->size; i++) {
+            end = src[2 * i] + src[2 * i + 1];
+            for (k = src[2 * i]; k <= end; k++) a[n++] = (uint16)k;
+        }
+    } else {
+        for (i = 0; i < RB_WORDS; i++) {
+            for (v = w[i]; v; v &= v - 1)
+                a[n++] = (uint16)((i << 6) + rb_ctz(v));
+        }
+    }
+
+    kfree(c->data);
+
+    c->data = a;
+    c->type = RB_ARRAY;
+    c->size = c->card > 0 ? c->card : 1;
+
+    return 0;
+}
+
+/* the run container is changed back to array or bitmap before writing */
+static int rb_cont_unrun (RBCont * c)
+{
+    if (c->type != RB_RUN) return 0;
+
+    if (c->card <= RBITMAP_ARRAY_MAX) return rb_to_array(c);
+
+    return rb_to_bitmap(c);
+}
+
+static int rb_cont_nruns (RBCont * c)
+{
+    uint16 * a = (uint16 *)c->data;
+    uint64 * w = (uint64 *)c->data;
+    int      i, n = 0;
+
+    if (c->type == RB_RUN) return c->size;
+
+    if (c->type == RB_ARRAY) {
+        for (i = 0; i < c->card; i++) {
+            if (i == 0 || a[i] != a[i - 1] + 1) n++;
+        }
+        return n;
+    }
+
+    /* a run starts at each 1 whose lower neighbour is 0 */
+    for (i = 0; i < RB_WORDS; i++)
+        n += rb_popcount(w[i] & ~((w[i] << 1) | (i > 0 ? w[i - 1] >> 63 : 0)));
+
+    return n;
+}
+
+static int rb_to_run (RBCont * c, int nrun)
+{
+    uint16 * a = (uint16 *)c->data;
+    uint16 * run = NULL;
+    int      i, n = -1, v, prev = -2;
+
+    run = kalloc(nrun * 2 * sizeof(uint16));
+    if (!run) return -100;
+
+    for (i = 0, v = -1; ; ) {
+        if (c->type == RB_ARRAY) {
+            if (i >= c->card) break;
+            v = a[i++];
+        } else {
+            for (v++; v < 65536 && !((((uint64 *)c->data)[v >> 6] >> (v & 63)) & 1); v++);
+            if (v >= 65536) break;
+        }
+
+        if (v != prev + 1) {
+            n++;
+            run[2 * n] = (uint16)v;
+            run[2 * n + 1] = 0;
+        } else
+            run[2 * n + 1]++;
+
+        prev = v;
+    }
+
+    kfree(c->data);
+
+    c->data = run;
+    c->type = RB_RUN;
+    c->size = n + 1;
+
+    return 0;
+}
+
+static void rb_cont_remove (RBitmap * rb, int ind)
+{
+    if (rb->cont[ind].data) kfree(rb->cont[ind].data);
+
+    memmove(rb->cont + ind, rb->cont + ind + 1, (rb->num - ind - 1) * sizeof(RBCont));
+    rb->num--;
+}
+
+static RBCont * rb_cont_insert (RBitmap * rb, int pos, uint16 key)
+{
+    RBCont * c = NULL;
+    int      size;
+
+    if (rb->num >= rb->size) {
+        size = rb->size > 0 ? rb->size * 2 : 4;
+
+        c = krealloc(rb->cont, size * sizeof(RBCont));
+        if (!c) return NULL;
+
+        rb->cont = c;
+        rb->size = size;
+    }
+
+    memmove(rb->cont + pos + 1, rb->cont + pos, (rb->num - pos) * sizeof(RBCont));
+    rb->num++;
+
+    c = &rb->cont[pos];
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    c->type = RB_ARRAY;
+
+    return c;
+}
+
+/* copy of the container src into c, the run is copied as array or bitmap
+ * if unrun is set */
+static int rb_cont_copy (RBCont * c, RBCont * src, int unrun)
+{
+    int  bytes = 0;
+
+    *c = *src;
+
+    if (src->type == RB_BITMAP)
+        bytes = RB_WORDS * sizeof(uint64);
+    else if (src->type == RB_RUN)
+        bytes = src->size * 2 * sizeof(uint16);
+    else {
+        c->size = src->card > 0 ? src->card : 1;
+        bytes = src->card * sizeof(uint16);
+    }
+
+    c->data = kalloc(bytes > 0 ? bytes : 2);
+    if (!c->data) return -100;
+
+    memcpy(c->data, src->data, bytes);
+
+    if (unrun && rb_cont_unrun(c) < 0) {
+        kfree(c->data);
+        c->data = NULL;
+        return -100;
+    }
+
+    return 0;
+}
+
+
+void * rbitmap_new ()
+{
+    return kzalloc(sizeof(RBitmap));
+}
+
+void rbitmap_zero (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    int       i;
+
+    if (!rb) return;
+
+    for (i = 0; i < rb->num; i++) {
+        if (rb->cont[i].data) kfree(rb->cont[i].data);
+    }
+
+    rb->num = 0;
+}
+
+void rbitmap_free (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+
+    if (!rb) return;
+
+    rbitmap_zero(rb);
+
+    if (rb->cont) kfree(rb->cont);
+    kfree(rb);
+}
+
+int rbitmap_set (void * vrb, uint32 val)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint16    low = val & 0xFFFF;
+    int       ind, i, size;
+
+    if (!rb) return -1;
+
+    ind = rb_find(rb, val >> 16);
+    if (ind < 0) {
+        c = rb_cont_insert(rb, -ind - 1, val >> 16);
+        if (!c) return -100;
+    } else
+        c = &rb->cont[ind];
+
+    if (c->type == RB_RUN) {
+        if (rb_cont_has(c, low)) return 0;
+        if (rb_cont_unrun(c) < 0) return -100;
+    }
+
+    if (c->type == RB_ARRAY) {
+        a = (uint16 *)c->data;
+        i = rb_lower(a, c->card, low);
+        if (i < c->card && a[i] == low) return 0;
+
+        if (c->card < RBITMAP_ARRAY_MAX) {
+            if (c->card >= c->size) {
+                size = c->size > 0 ? c->size * 2 : 4;
+                if (size > RBITMAP_ARRAY_MAX) size = RBITMAP_ARRAY_MAX;
+
+                a = krealloc(c->data, size * sizeof(uint16));
+                if (!a) return -100;
+
+                c->data = a;
+                c->size = size;
+            }
+
+            memmove(a + i + 1, a + i, (c->card - i) * sizeof(uint16));
+            a[i] = low;
+            c->card++;
+
+            return 1;
+        }
+
+        /* the full array turns into bitmap */
+        if (rb_to_bitmap(c) < 0) return -100;
+    }
+
+    w = (uint64 *)c->data;
+    if (w[low >> 6] & ((uint64)1 << (low & 63))) return 0;
+
+    w[low >> 6] |= (uint64)1 << (low & 63);
+    c->card++;
+
+    return 1;
+}
+
+int rbitmap_unset (void * vrb, uint32 val)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint16    low = val & 0xFFFF;
+    int       ind, i;
+
+    if (!rb) return -1;
+
+    ind = rb_find(rb, val >> 16);
+    if (ind < 0) return 0;
+
+    c = &rb->cont[ind];
+
+    if (c->type == RB_RUN) {
+        if (!rb_cont_has(c, low)) return 0;
+        if (rb_cont_unrun(c) < 0) return -100;
+    }
+
+    if (c->type == RB_ARRAY) {
+        a = (uint16 *)c->data;
+        i = rb_lower(a, c->card, low);
+        if (i >= c->card || a[i] != low) return 0;
+
+        memmove(a + i, a + i + 1, (c->card - i - 1) * sizeof(uint16));
+        c->card--;
+
+    } else {
+        w = (uint64 *)c->data;
+        if (!(w[low >> 6] & ((uint64)1 << (low & 63)))) return 0;
+
+        w[low >> 6] &= ~((uint64)1 << (low & 63));
+        c->card--;
+
+        /* back to the array, it fails only on no memory and is then kept */
+        if (c->card <= RBITMAP_ARRAY_MAX / 2) rb_to_array(c);
+    }
+
+    if (c->card == 0) rb_cont_remove(rb, ind);
+
+    return 1;
+}
+
+int rbitmap_get (void * vrb, uint32 val)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    int       ind;
+
+    if (!rb) return 0;
+
+    ind = rb_find(rb, val >> 16);
+    if (ind < 0) return 0;
+
+    return rb_cont_has(&rb->cont[ind], val & 0xFFFF);
+}
+
+int64 rbitmap_count (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    int64     cnt = 0;
+    int       i;
+
+    if (!rb) return 0;
+
+    for (i = 0; i < rb->num; i++) cnt += rb->cont[i].card;
+
+    return cnt;
+}
+
+/* the first low value at or after low in the container, or -1 */
+static int rb_cont_next (RBCont * c, uint32 low)
+{
+    uint16  * a = (uint16 *)c->data;
+    uint64  * w = (uint64 *)c->data;
+    uint64    v;
+    int       i;
+
+    if (c->type == RB_ARRAY) {
+        i = rb_lower(a, c->card, (uint16)low);
+        return i < c->card ? a[i] : -1;
+    }
+
+    if (c->type == RB_RUN) {
+        i = rb_run_find(a, c->size, (uint16)low);
+        if (i >= 0 && low <= (uint32)a[2 * i] + a[2 * i + 1]) return low;
+        return i + 1 < c->size ? a[2 * (i + 1)] : -1;
+    }
+
+    i = low >> 6;
+    v = w[i] & ((uint64)~0 << (low & 63));
+
+    for ( ; ; ) {
+        if (v) return (i << 6) + rb_ctz(v);
+        if (++i >= RB_WORDS) return -1;
+        v = w[i];
+    }
+}
+
+int64 rbitmap_next (void * vrb, uint32 from)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    uint32    low = from & 0xFFFF;
+    int       ind, v;
+
+    if (!rb) return -1;
+
+    ind = rb_find(rb, from >> 16);
+    if (ind < 0) {
+        ind = -ind - 1;
+        low = 0;
+    }
+
+    for ( ; ind < rb->num; ind++, low = 0) {
+        v = rb_cont_next(&rb->cont[ind], low);
+        if (v >= 0) return ((int64)rb->cont[ind].key << 16) | v;
+    }
+
+    return -1;
+}
+
+int rbitmap_values (void * vrb, uint32 from, uint32 * vals, int num)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint64    v;
+    uint32    low = from & 0xFFFF;
+    uint32    hi;
+    int       ind, i, k, end, n = 0;
+
+    if (!rb || !vals) return -1;
+
+    ind = rb_find(rb, from >> 16);
+    if (ind < 0) {
+        ind = -ind - 1;
+        low = 0;
+    }
+
+    for ( ; ind < rb->num && n < num; ind++, low = 0) {
+        c = &rb->cont[ind];
+        hi = (uint32)c->key << 16;
+        a = (uint16 *)c->data;
+        w = (uint64 *)c->data;
+
+        if (c->type == RB_ARRAY) {
+            for (i = rb_lower(a, c->card, (uint16)low); i < c->card && n < num; i++)
+                vals[n++] = hi | a[i];
+
+        } else if (c->type == RB_RUN) {
+            i = rb_run_find(a, c->size, (uint16)low);
+            if (i < 0 || low > (uint32)a[2 * i] + a[2 * i + 1]) {
+                i++;
+                if (i < c->size) low = a[2 * i];
+            }
+            for ( ; i < c->size && n < num; i++) {
+                k = low > a[2 * i] ? (int)low : a[2 * i];
+                end = a[2 * i] + a[2 * i + 1];
+                for ( ; k <= end && n < num; k++) vals[n++] = hi | k;
+            }
+
+        } else {
+            i = low >> 6;
+            v = w[i] & ((uint64)~0 << (low & 63));
+            for ( ; ; ) {
+                for ( ; v && n < num; v &= v - 1)
+                    vals[n++] = hi | ((i << 6) + rb_ctz(v));
+                if (n >= num || ++i >= RB_WORDS) break;
+                v = w[i];
+            }
+        }
+    }
+
+    return n;
+}
+
+int64 rbitmap_rank (void * vrb, uint32 val)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint16    low = val & 0xFFFF;
+    int64     cnt = 0;
+    int       ind, i;
+
+    if (!rb) return 0;
+
+    for (ind = 0; ind < rb->num && rb->cont[ind].key < (val >> 16); ind++)
+        cnt += rb->cont[ind].card;
+
+    if (ind >= rb->num || rb->cont[ind].key != (val >> 16)) return cnt;
+
+    c = &rb->cont[ind];
+    a = (uint16 *)c->data;
+
+    if (c->type == RB_ARRAY)
+        return cnt + rb_lower(a, c->card, low);
+
+    if (c->type == RB_RUN) {
+        for (i = 0; i < c->size && a[2 * i] < low; i++) {
+            if ((int)low > a[2 * i] + a[2 * i + 1]) cnt += a[2 * i + 1] + 1;
+            else cnt += low - a[2 * i];
+        }
+        return cnt;
+    }
+
+    w = (uint64 *)c->data;
+    for (i = 0; i < (low >> 6); i++) cnt += rb_popcount(w[i]);
+
+    if (low & 63) cnt += rb_popcount(w[i] & ((uint64)~0 >> (64 - (low & 63))));
+
+    return cnt;
+}
+
+
+/* the union of dst container and src container into dst */
+static int rb_cont_or (RBCont * dst, RBCont * src)
+{
+    uint64  * dw = NULL;
+    uint16  * da = NULL;
+    uint16  * sa = NULL;
+    uint16  * a = NULL;
+    int       i, j, n;
+
+    if (dst->type == RB_ARRAY && src->type == RB_ARRAY) {
+        da = (uint16 *)dst->data;
+        sa = (uint16 *)src->data;
+
+        a = kalloc((dst->card + src->card) * sizeof(uint16));
+        if (!a) return -100;
+
+        for (i = j = n = 0; i < dst->card || j < src->card; ) {
+            if (j >= src->card || (i < dst->card && da[i] < sa[j])) a[n++] = da[i++];
+            else if (i >= dst->card || sa[j] < da[i]) a[n++] = sa[j++];
+            else { a[n++] = da[i++]; j++; }
+        }
+
+        if (dst->data) kfree(dst->data);
+        dst->data = a;
+        dst->card = n;
+        dst->size = dst->card + src->card;
+
+        if (n > RBITMAP_ARRAY_MAX) return rb_to_bitmap(dst);
+        return 0;
+    }
+
+    if (dst->type == RB_ARRAY && rb_to_bitmap(dst) < 0) return -100;
+
+    dw = (uint64 *)dst->data;
+
+    if (src->type == RB_ARRAY) {
+        sa = (uint16 *)src->data;
+        for (i = 0; i < src->card; i++) {
+            if (!(dw[sa[i] >> 6] & ((uint64)1 << (sa[i] & 63)))) {
+                dw[sa[i] >> 6] |= (uint64)1 << (sa[i] & 63);
+                dst->card++;
+            }
+        }
+        return 0;
+    }
+
+    dst->card = rb_words_op(dw, (uint64 *)src->data, RB_OR);
+
+    return 0;
+}
+
+/* the intersection of dst container and src container into dst */
+static int rb_cont_and (RBCont * dst, RBCont * src)
+{
+    uint64  * dw = NULL;
+    uint16  * da = NULL;
+    uint16  * sa = NULL;
+    int       i, n;
+
+    if (dst->type == RB_ARRAY && src->type == RB_ARRAY) {
+        da = kalloc((dst->card + 8) * sizeof(uint16));
+        if (!da) return -100;
+
+        dst->card = rb_and_array((uint16 *)dst->data, dst->card,
+                                 (uint16 *)src->data, src->card, da);
+
+        kfree(dst->data);
+        dst->data = da;
+        dst->size = dst->card + 8;
+        return 0;
+    }
+
+    if (dst->type == RB_ARRAY) {
+        /* keep the values of dst found in src, in place */
+        da = (uint16 *)dst->data;
+        for (i = n = 0; i < dst->card; i++) {
+            if (rb_cont_has(src, da[i])) da[n++] = da[i];
+        }
+        dst->card = n;
+        return 0;
+    }
+
+    dw = (uint64 *)dst->data;
+
+    if (src->type == RB_ARRAY) {
+        sa = (uint16 *)src->data;
+
+        da = kalloc((src->card > 0 ? src->card : 1) * sizeof(uint16));
+        if (!da) return -100;
+
+        for (i = n = 0; i < src->card; i++) {
+            if (dw[sa[i] >> 6] & ((uint64)1 << (sa[i] & 63))) da[n++] = sa[i];
+        }
+
+        kfree(dst->data);
+        dst->data = da;
+        dst->type = RB_ARRAY;
+        dst->card = n;
+        dst->size = src->card > 0 ? src->card : 1;
+        return 0;
+    }
+
+    dst->card = rb_words_op(dw, (uint64 *)src->data, RB_AND);
+
+    if (dst->card <= RBITMAP_ARRAY_MAX) rb_to_array(dst);
+
+    return 0;
+}
+
+/* the values of dst not in src are kept in dst */
+static int rb_cont_andnot (RBCont * dst, RBCont * src)
+{
+    uint64  * dw = NULL;
+    uint16  * da = NULL;
+    uint16  * sa = NULL;
+    int       i, n;
+
+    if (dst->type == RB_ARRAY) {
+        da = (uint16 *)dst->data;
+        for (i = n = 0; i < dst->card; i++) {
+            if (!rb_cont_has(src, da[i])) da[n++] = da[i];
+        }
+        dst->card = n;
+        return 0;
+    }
+
+    dw = (uint64 *)dst->data;
+
+    if (src->type == RB_ARRAY) {
+        sa = (uint16 *)src->data;
+        for (i = 0; i < src->card; i++) {
+            if (dw[sa[i] >> 6] & ((uint64)1 << (sa[i] & 63))) {
+                dw[sa[i] >> 6] &= ~((uint64)1 << (sa[i] & 63));
+                dst->card--;
+            }
+        }
+    } else
+        dst->card = rb_words_op(dw, (uint64 *)src->data, RB_ANDNOT);
+
+    if (dst->card <= RBITMAP_ARRAY_MAX) rb_to_array(dst);
+
+    return 0;
+}
+
+/* combine dst container with src by op. the containers of run are done
+ * on their array or bitmap form */
+static int rb_cont_op (RBCont * dst, RBCont * src, int op)
+{
+    RBCont  tmp;
+    int     ret;
+
+    if (rb_cont_unrun(dst) < 0) return -100;
+
+    if (src->type == RB_RUN) {
+        if (rb_cont_copy(&tmp, src, 1) < 0) return -100;
+        src = &tmp;
+    }
+
+    if (op == RB_AND) ret = rb_cont_and(dst, src);
+    else if (op == RB_OR) ret = rb_cont_or(dst, src);
+    else ret = rb_cont_andnot(dst, src);
+
+    if (src == &tmp) kfree(tmp.data);
+
+    return ret;
+}
+
+int rbitmap_or (void * vdst, void * vsrc)
+{
+    RBitmap * dst = (RBitmap *)vdst;
+    RBitmap * src = (RBitmap *)vsrc;
+    RBCont  * c = NULL;
+    int       i, ind;
+
+    if (!dst || !src) return -1;
+    if (dst == src) return 0;
+
+    for (i = 0; i < src->num; i++) {
+        ind = rb_find(dst, src->cont[i].key);
+
+        if (ind >= 0) {
+            if (rb_cont_op(&dst->cont[ind], &src->cont[i], RB_OR) < 0) return -100;
+            continue;
+        }
+
+        c = rb_cont_insert(dst, -ind - 1, src->cont[i].key);
+        if (!c) return -100;
+
+        if (rb_cont_copy(c, &src->cont[i], 0) < 0) {
+            c->data = NULL;
+            rb_cont_remove(dst, -ind - 1);
+            return -100;
+        }
+    }
+
+    return 0;
+}
+
+int rbitmap_and (void * vdst, void * vsrc)
+{
+    RBitmap * dst = (RBitmap *)vdst;
+    RBitmap * src = (RBitmap *)vsrc;
+    int       i, ind;
+
+    if (!dst || !src) return -1;
+    if (dst == src) return 0;
+
+    for (i = dst->num - 1; i >= 0; i--) {
+        ind = rb_find(src, dst->cont[i].key);
+
+        if (ind >= 0 && rb_cont_op(&dst->cont[i], &src->cont[ind], RB_AND) < 0)
+            return -100;
+
+        if (ind < 0 || dst->cont[i].card == 0)
+            rb_cont_remove(dst, i);
+    }
+
+    return 0;
+}
+
+int rbitmap_andnot (void * vdst, void * vsrc)
+{
+    RBitmap * dst = (RBitmap *)vdst;
+    RBitmap * src = (RBitmap *)vsrc;
+    int       i, ind;
+
+    if (!dst || !src) return -1;
+
+    if (dst == src) {
+        rbitmap_zero(dst);
+        return 0;
+    }
+
+    for (i = dst->num - 1; i >= 0; i--) {
+        ind = rb_find(src, dst->cont[i].key);
+        if (ind < 0) continue;
+
+        if (rb_cont_op(&dst->cont[i], &src->cont[ind], RB_ANDNOT) < 0)
+            return -100;
+
+        if (dst->cont[i].card == 0) rb_cont_remove(dst, i);
+    }
+
+    return 0;
+}
+
+int64 rbitmap_and_count (void * va, void * vb)
+{
+    RBitmap * a = (RBitmap *)va;
+    RBitmap * b = (RBitmap *)vb;
+    RBCont  * ca = NULL;
+    RBCont  * cb = NULL;
+    RBCont  * t = NULL;
+    uint16  * arr = NULL;
+    int64     cnt = 0;
+    int       i, j, k;
+
+    if (!a || !b) return 0;
+
+    for (i = 0, j = 0; i < a->num && j < b->num; ) {
+        ca = &a->cont[i];
+        cb = &b->cont[j];
+
+        if (ca->key < cb->key) { i++; continue; }
+        if (ca->key > cb->key) { j++; continue; }
+
+        if (ca->type == RB_BITMAP && cb->type == RB_BITMAP) {
+            cnt += rb_words_and_count((uint64 *)ca->data, (uint64 *)cb->data);
+
+        } else if (ca->type == RB_ARRAY && cb->type == RB_ARRAY) {
+            cnt += rb_and_array_count((uint16 *)ca->data, ca->card,
+                                      (uint16 *)cb->data, cb->card);
+
+        } else {
+            /* the array, or else the run, is looked up in the other */
+            if (cb->type == RB_ARRAY || (cb->type == RB_RUN && ca->type == RB_BITMAP)) {
+                t = ca; ca = cb; cb = t;
+            }
+
+            arr = (uint16 *)ca->data;
+            if (ca->type == RB_ARRAY) {
+                for (k = 0; k < ca->card; k++) cnt += rb_cont_has(cb, arr[k]);
+            } else {
+                for (k = 0; k < ca->size; k++) {
+                    int  v, end = arr[2 * k] + arr[2 * k + 1];
+                    for (v = arr[2 * k]; v <= end; v++) cnt += rb_cont_has(cb, (uint16)v);
+                }
+            }
+        }
+
+        i++; j++;
+    }
+
+    return cnt;
+}
+
+int rbitmap_optimize (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    int       i, nrun, runbytes, bytes;
+
+    if (!rb) return -1;
+
+    for (i = 0; i < rb->num; i++) {
+        c = &rb->cont[i];
+        if (c->type == RB_RUN) continue;
+
+        nrun = rb_cont_nruns(c);
+        runbytes = 2 + nrun * 4;
+        bytes = c->type == RB_BITMAP ? RB_WORDS * 8 : c->card * 2;
+
+        if (runbytes < bytes && rb_to_run(c, nrun) < 0) return -100;
+    }
+
+    return 0;
+}
+
+int64 rbitmap_bytes (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    int64     bytes = 0;
+    int       i;
+
+    if (!rb) return 0;
+
+    bytes = sizeof(*rb) + (int64)rb->size * sizeof(RBCont);
+
+    for (i = 0; i < rb->num; i++) {
+        if (rb->cont[i].type == RB_BITMAP)
+            bytes += RB_WORDS * sizeof(uint64);
+        else if (rb->cont[i].type == RB_RUN)
+            bytes += rb->cont[i].size * 2 * sizeof(uint16);
+        else
+            bytes += rb->cont[i].size * sizeof(uint16);
+    }
+
+    return bytes;
+}
+
+
+/* the portable format of Roaring bitmap, little endian:
+ *   without run:  uint32 cookie 12346, uint32 number of containers
+ *   with run:     uint32 12347 | (number - 1) << 16, the bitset of the
+ *                 run containers
+ *   then uint16 key and uint16 card - 1 of each container, the uint32
+ *   offset of each container if there is no run or 4 containers at least,
+ *   and the containers. the array of card <= 4096 is the uint16 values,
+ *   the bitmap is 1024 uint64, the run is uint16 number of runs and the
+ *   uint16 pairs of start and length - 1 */
+
+static void rb_put16 (uint8 * p, uint32 v)
+{
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF;
+}
+
+static void rb_put32 (uint8 * p, uint32 v)
+{
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+
+static uint32 rb_get16 (uint8 * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32 rb_get32 (uint8 * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static int rb_cont_serial_size (RBCont * c)
+{
+    if (c->type == RB_RUN) return 2 + c->size * 4;
+    if (c->type == RB_BITMAP) return RB_WORDS * 8;
+    return c->card * 2;
+}
+
+static int rb_has_run (RBitmap * rb)
+{
+    int  i;
+
+    for (i = 0; i < rb->num; i++) {
+        if (rb->cont[i].type == RB_RUN) return 1;
+    }
+
+    return 0;
+}
+
+int64 rbitmap_serial_size (void * vrb)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    int64     size = 0;
+    int       i, hasrun;
+
+    if (!rb) return -1;
+
+    hasrun = rb_has_run(rb);
+
+    if (hasrun) {
+        size = 4 + (rb->num + 7) / 8 + 4 * rb->num;
+        if (rb->num >= 4) size += 4 * rb->num;
+    } else
+        size = 8 + 8 * rb->num;
+
+    for (i = 0; i < rb->num; i++) size += rb_cont_serial_size(&rb->cont[i]);
+
+    return size;
+}
+
+int64 rbitmap_serialize (void * vrb, void * pbuf, int64 len)
+{
+    RBitmap * rb = (RBitmap *)vrb;
+    RBCont  * c = NULL;
+    uint8   * p = (uint8 *)pbuf;
+    uint8   * phdr = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint64    v;
+    int64     size = 0;
+    int       i, k, hasrun, ofs;
+
+    if (!rb || !pbuf) return -1;
+
+    size = rbitmap_serial_size(rb);
+    if (len < size) return -100;
+
+    hasrun = rb_has_run(rb);
+
+    if (hasrun) {
+        rb_put32(p, RB_COOKIE_RUN | ((uint32)(rb->num - 1) << 16));
+        p += 4;
+
+        memset(p, 0, (rb->num + 7) / 8);
+        for (i = 0; i < rb->num; i++) {
+            if (rb->cont[i].type == RB_RUN) p[i / 8] |= 1 << (i % 8);
+        }
+        p += (rb->num + 7) / 8;
+    } else {
+        rb_put32(p, RB_COOKIE_NORUN);
+        rb_put32(p + 4, rb->num);
+        p += 8;
+    }
+
+    for (i = 0; i < rb->num; i++) {
+        rb_put16(p, rb->cont[i].key);
+        rb_put16(p + 2, rb->cont[i].card - 1);
+        p += 4;
+    }
+
+    phdr = p;
+    if (!hasrun || rb->num >= 4) p += 4 * rb->num;
+
+    for (i = 0; i < rb->num; i++) {
+        c = &rb->cont[i];
+
+        if (!hasrun || rb->num >= 4) {
+            ofs = (int)(p - (uint8 *)pbuf);
+            rb_put32(phdr + 4 * i, ofs);
+        }
+
+        a = (uint16 *)c->data;
+        w = (uint64 *)c->data;
+
+        if (c->type == RB_RUN) {
+            rb_put16(p, c->size);
+            p += 2;
+            for (k = 0; k < c->size * 2; k++, p += 2) rb_put16(p, a[k]);
+
+        } else if (c->type == RB_BITMAP) {
+            for (k = 0; k < RB_WORDS; k++, p += 8) {
+                v = w[k];
+                rb_put32(p, (uint32)v);
+                rb_put32(p + 4, (uint32)(v >> 32));
+            }
+
+        } else {
+            /* the array of more than 4096 can not be, it is bitmap then */
+            for (k = 0; k < c->card; k++, p += 2) rb_put16(p, a[k]);
+        }
+    }
+
+    return p - (uint8 *)pbuf;
+}
+
+void * rbitmap_deserialize (void * pbuf, int64 len)
+{
+    RBitmap * rb = NULL;
+    RBCont  * c = NULL;
+    uint8   * p = (uint8 *)pbuf;
+    uint8   * pend = p + len;
+    uint8   * runset = NULL;
+    uint8   * phdr = NULL;
+    uint16  * a = NULL;
+    uint64  * w = NULL;
+    uint32    cookie;
+    int       num, i, k, n, end, prev;
+
+    if (!pbuf || len < 4) return NULL;
+
+    cookie = rb_get32(p);
+
+    if ((cookie & 0xFFFF) == RB_COOKIE_RUN) {
+        num = (cookie >> 16) + 1;
+        p += 4;
+        runset = p;
+        p += (num + 7) / 8;
+    } else if (cookie == RB_COOKIE_NORUN) {
+        if (len < 8) return NULL;
+        num = (int)rb_get32(p + 4);
+        if (num < 0 || num > 65536) return NULL;
+        p += 8;
+    } else
+        return NULL;
+
+    if (pend - p < 4 * (int64)num) return NULL;
+    phdr = p;
+    p += 4 * num;
+
+    if (!runset || num >= 4) {
+        if (pend - p < 4 * (int64)num) return NULL;
+        p += 4 * num;
+    }
+
+    rb = rbitmap_new();
+    if (!rb) return NULL;
+
+    if (num > 0) {
+        rb->cont = kzalloc(num * sizeof(RBCont));
+        if (!rb->cont) goto failed;
+        rb->size = num;
+    }
+
+    for (i = 0; i < num; i++) {
+        c = &rb->cont[i];
+        c->key = rb_get16(phdr + 4 * i);
+        c->card = rb_get16(phdr + 4 * i + 2) + 1;
+
+        if (i > 0 && c->key <= rb->cont[i - 1].key) goto failed;
+        rb->num = i + 1;
+
+        if (runset && (runset[i / 8] >> (i % 8)) & 1) {
+            if (pend - p < 2) goto failed;
+            n = rb_get16(p);
+            p += 2;
+            if (n <= 0 || pend - p < 4 * (int64)n) goto failed;
+
+            c->type = RB_RUN;
+            c->size = n;
+            c->data = a = kalloc(n * 4);
+            if (!a) goto failed;
+
+            for (k = 0, prev = -2, end = 0; k < n; k++, p += 4) {
+                a[2 * k] = rb_get16(p);
+                a[2 * k + 1] = rb_get16(p + 2);
+
+                /* the runs are sorted, not overlapped and within 64K */
+                if ((int)a[2 * k] <= prev || a[2 * k] + a[2 * k + 1] > 65535) goto failed;
+                prev = a[2 * k] + a[2 * k + 1];
+                end += a[2 * k + 1] + 1;
+            }
+            if (end != c->card) goto failed;
+
+        } else if (c->card > RBITMAP_ARRAY_MAX) {
+            if (pend - p < RB_WORDS * 8) goto failed;
+
+            c->type = RB_BITMAP;
+            c->data = w = kalloc(RB_WORDS * 8);
+            if (!w) goto failed;
+
+            for (k = 0, n = 0; k < RB_WORDS; k++, p += 8) {
+                w[k] = rb_get32(p) | (uint64)rb_get32(p + 4) << 32;
+                n += rb_popcount(w[k]);
+            }
+            if (n != c->card) goto failed;
+
+        } else {
+            if (pend - p < 2 * (int64)c->card) goto failed;
+
+            c->type = RB_ARRAY;
+            c->size = c->card;
+            c->data = a = kalloc(c->card * 2);
+            if (!a) goto failed;
+
+            for (k = 0; k < c->card; k++, p += 2) {
+                a[k] = rb_get16(p);
+                if (k > 0 && a[k] <= a[k - 1]) goto failed;
+            }
+        }
+    }
+
+    return rb;
+
+failed:
+    rbitmap_free(rb);
+    return NULL;
+}
+
@@ -6,7 +6,13 @@
 #include "btype.h"
 #include "memory.h"
 #include "arfifo.h"
+#include "mpool.h"
+#include "bpool.h"
 #include "rbtree.h"
+
+/* the caller's object of node: the allocated node refers to it, the
+ * embedded node lies nodeoff bytes inside it */
+#define rbt_obj(t, n) ((t)->alloc_node ? (n)->obj : (void *)((uint8 *)(n) - (t)->nodeoff))
  
 
 void * rbtnode_min (void * vnode)
@@ -147,17 +153,46 @@ int rbtnode_free (void * vnode, rbtfree_t * freefunc, int alloc_node)
 }
 
 
-static void rbtree_free_node (rbtnode_t * node, rbtfree_t * freefunc, int alloc_node)
+static rbtnode_t * rbtree_node_fetch (rbtree_t * ptree)
+{
+    rbtnode_t * node = NULL;
+
+    if (!ptree->pool)
+        return rbtnode_alloc();
+
+    node = (*ptree->fetch)(ptree->pool);
+    if (node) memset(node, 0, sizeof(*node));
+
+    return node;
+}
+
+/* give back the node allocated by tree, the embedded node is left */
+static void rbtree_node_release (rbtree_t * ptree, rbtnode_t * node, rbtfree_t * freefunc)
+{
+    if (!node) return;
+
+    if (freefunc)
+        (*freefunc)(rbt_obj(ptree, node));
+
+    if (!ptree->alloc_node) return;
+
+    if (ptree->pool)
+        (*ptree->recycle)(ptree->pool, node);
+    else
+        kfree(node);
+}
+
+static void rbtree_free_node (rbtree_t * ptree, rbtnode_t * node, rbtfree_t * freefunc)
 {
     if (!node) return;
 
     if (node->left)
-        rbtree_free_node(node->left, freefunc, alloc_node);
+        rbtree_free_node(ptree, node->left, freefunc);
 
     if (node->right)
-        rbtree_free_node(node->right, freefunc, alloc_node);
+        rbtree_free_node(ptree, node->right, freefunc);
 
-    rbtnode_free(node, freefunc, alloc_node);
+    rbtree_node_release(ptree, node, freefunc);
 }
 
 /* alloc_node = 1 means that:
@@ -188,6 +223,60 @@ void * rbtree_new (rbtcmp_t * cmp, int alloc_node)
     return rbt;
 }
 
+void * rbtree_new_embed (rbtcmp_t * cmp, int nodeoff)
+{
+    rbtree_t * rbt = NULL;
+
+    if (nodeoff < 0) return NULL;
+
+    rbt = rbtree_new(cmp, 0);
+    if (!rbt) return rbt;
+
+    rbt->nodeoff = nodeoff;
+
+    return rbt;
+}
+
+static int rbtree_set_pool (rbtree_t * ptree, void * pool, int unitsize,
+                            void * fetch, void * recycle)
+{
+    if (!ptree) return -1;
+
+    if (!ptree->alloc_node || ptree->num > 0)
+        return -2;
+
+    if (pool && unitsize < (int)sizeof(rbtnode_t))
+        return -3;
+
+    ptree->pool = pool;
+    ptree->fetch = fetch;
+    ptree->recycle = recycle;
+
+    return 0;
+}
+
+int rbtree_set_mpool (void * vptree, void * mpool)
+{
+    return rbtree_set_pool((rbtree_t *)vptree, mpool, mpool ? mpool_unitsize(mpool) : 0,
+                           mpool_fetch, mpool_recycle);
+}
+
+int rbtree_set_bpool (void * vptree, void * bpool)
+{
+    return rbtree_set_pool((rbtree_t *)vptree, bpool, bpool ? bpool_unitsize(bpool) : 0,
+                           bpool_fetch, bpool_recycle);
+}
+
+void * rbtree_obj (void * vptree, void * vnode)
+{
+    rbtree_t  * ptree = (rbtree_t *)vptree;
+    rbtnode_t * node = (rbtnode_t *)vnode;
+
+    if (!ptree || !node) return NULL;
+
+    return rbt_obj(ptree, node);
+}
+
 void rbtree_free (void * vptree)
 {
     rbtree_t  * ptree = (rbtree_t *)vptree;
@@ -195,7 +284,7 @@ void rbtree_free (void * vptree)
     if (!ptree) return;
 
     if (ptree->alloc_node)
-        rbtree_free_node(ptree->root, NULL, ptree->alloc_node);
+        rbtree_free_node(ptree, ptree->root, NULL);
 
     kfree(ptree);
 }
@@ -207,7 +296,7 @@ void rbtree_free_all (void * vptree, int (*freefunc)())
 
     if (!ptree) return;
 
-    rbtree_free_node(ptree->root, freefunc, ptree->alloc_node);
+    rbtree_free_node(ptree, ptree->root, freefunc);
 
     kfree(ptree);
 }
@@ -220,7 +309,7 @@ void rbtree_zero (void * vptree)
     if (!rbt) return;
 
     if (rbt->alloc_node)
-        rbtree_free_node(rbt->root, NULL, rbt->alloc_node);
+        rbtree_free_node(rbt, rbt->root, NULL);
 
     rbt->root = NULL;
     rbt->num = 0;
@@ -253,10 +342,7 @@ void * rbtree_get_node (void * vptree, void * key)
     node = ptree->root;
 
     while (node != NULL) {
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(node->obj, key);
-        else
-            ret = (*ptree->cmp)(node, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, node), key);
 
         if (ret == 0)
             return node;
@@ -282,13 +368,10 @@ void * rbtree_get (void * vptree, void * key)
     node = ptree->root;
 
     while (node != NULL) {
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(node->obj, key);
-        else
-            ret = (*ptree->cmp)(node, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, node), key);
 
         if (ret == 0) 
-            return ptree->alloc_node ? node->obj : node;
+            return rbt_obj(ptree, node);
 
         if (ret > 0)
             node = node->left;
@@ -299,6 +382,57 @@ void * rbtree_get (void * vptree, void * key)
     return NULL;
 }
 
+#define RBT_BATCH_GROUP  16
+
+int rbtree_get_batch (void * vptree, void ** keys, int num, void ** vals)
+{
+    rbtree_t  * ptree = (rbtree_t *)vptree;
+    rbtnode_t * node[RBT_BATCH_GROUP];
+    int         i, j, n, active, ret;
+    int         found = 0;
+
+    if (!ptree || !keys || !vals || num <= 0)
+        return 0;
+
+    for (i = 0; i < num; i += n) {
+        n = num - i;
+        if (n > RBT_BATCH_GROUP) n = RBT_BATCH_GROUP;
+
+        for (j = 0; j < n; j++) {
+            vals[i + j] = NULL;
+            node[j] = keys[i + j] ? ptree->root : NULL;
+        }
+
+        for (active = n; active > 0; ) {
+            /* the allocated nodes refer to the objects compared */
+            if (ptree->alloc_node) {
+                for (j = 0; j < n; j++)
+                    if (node[j]) __builtin_prefetch(node[j]->obj, 0, 1);
+            }
+
+            for (active = 0, j = 0; j < n; j++) {
+                if (!node[j]) continue;
+
+                ret = (*ptree->cmp)(rbt_obj(ptree, node[j]), keys[i + j]);
+                if (ret == 0) {
+                    vals[i + j] = rbt_obj(ptree, node[j]);
+                    node[j] = NULL;
+                    found++;
+                    continue;
+                }
+
+                node[j] = ret > 0 ? node[j]->left : node[j]->right;
+                if (node[j]) {
+                    __builtin_prefetch(node[j], 0, 1);
+                    active++;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
 
 int rbtree_mget_node (void * vptree, void * key, void ** plist, int listsize)
 {
@@ -321,10 +455,7 @@ int rbtree_mget_node (void * vptree, void * key, void ** plist, int listsize)
         iter = rbtnode_prev(iter);
         if (!iter) break;
 
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(iter->obj, key);
-        else
-            ret = (*ptree->cmp)(iter, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, iter), key);
 
         if (ret != 0) break;
 
@@ -337,10 +468,7 @@ int rbtree_mget_node (void * vptree, void * key, void ** plist, int listsize)
         iter = rbtnode_next(iter);
         if (!iter) break;
 
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(iter->obj, key);
-        else
-            ret = (*ptree->cmp)(iter, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, iter), key);
 
         if (ret != 0) break;
      
@@ -366,22 +494,19 @@ int rbtree_mget (void * vptree, void * key, void ** plist, int listsize)
     if (!node) return 0;
 
     if (plist && num < listsize)
-        plist[num] = ptree->alloc_node ? node->obj : node;
+        plist[num] = rbt_obj(ptree, node);
     num++;
 
     for (iter = node; iter != NULL; ) {
         iter = rbtnode_prev(iter);
         if (!iter) break;
 
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(iter->obj, key);
-        else
-            ret = (*ptree->cmp)(iter, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, iter), key);
 
         if (ret != 0) break;
 
         if (plist && num < listsize)
-            plist[num] = ptree->alloc_node ? iter->obj : iter;
+            plist[num] = rbt_obj(ptree, iter);
         num++;
     }
 
@@ -389,15 +514,12 @@ int rbtree_mget (void * vptree, void * key, void ** plist, int listsize)
         iter = rbtnode_next(iter);
         if (!iter) break;
 
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(iter->obj, key);
-        else
-            ret = (*ptree->cmp)(iter, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, iter), key);
 
         if (ret != 0) break;
      
         if (plist && num < listsize)
-            plist[num] = ptree->alloc_node ? iter->obj : iter;
+            plist[num] = rbt_obj(ptree, iter);
         num++;
     }
 
@@ -435,7 +557,7 @@ void * rbtree_min (void * vptree)
     while (node->left != NULL)
         node = node->left;
 
-    return ptree->alloc_node ? node->obj : node;
+    return rbt_obj(ptree, node);
 }
 
 void * rbtree_max_node (void * vptree)
@@ -469,7 +591,7 @@ void * rbtree_max (void * vptree)
     while (node->right != NULL)
         node = node->right;
 
-    return ptree->alloc_node ? node->obj : node;
+    return rbt_obj(ptree, node);
 }
 
 
@@ -645,10 +767,7 @@ int rbtree_insert (void * vptree, void * key, void * obj, void ** pnode)
     while (node != NULL) {
         parent = node;
 
-        if (ptree->alloc_node)
-            ret = (*ptree->cmp)(node->obj, key);
-        else
-            ret = (*ptree->cmp)(node, key);
+        ret = (*ptree->cmp)(rbt_obj(ptree, node), key);
 
         if (ret > 0)
             node = node->left;
@@ -657,25 +776,22 @@ int rbtree_insert (void * vptree, void * key, void * obj, void ** pnode)
         else {
             if (pnode) *pnode = node;
 
-            if (ptree->alloc_node) {
-                if (node->obj == obj) return 0;
-            } else {
-                if (node == obj) return 0;
-            }
+            if (rbt_obj(ptree, node) == obj) return 0;
 
             node = node->left;
         }
     }
 
     if (ptree->alloc_node) {
-        newnode = rbtnode_alloc();
+        newnode = rbtree_node_fetch(ptree);
         if (!newnode)
             return -100;
 
         newnode->key = key;
         newnode->obj = obj;
     } else {
-        newnode = (rbtnode_t *)obj;
+        newnode = (rbtnode_t *)((uint8 *)obj + ptree->nodeoff);
+        newnode->left = newnode->right = NULL;
     }
 
     newnode->parent = parent;
@@ -838,7 +954,7 @@ int rbtree_delete_node (void * vptree, void * vnode)
         node->color = node->depth = node->width = 0;
 
         if (ptree->alloc_node)
-            rbtnode_free(node, NULL, ptree->alloc_node);
+            rbtree_node_release(ptree, node, NULL);
 
         return 1;
     }
@@ -866,7 +982,7 @@ int rbtree_delete_node (void * vptree, void * vnode)
     node->color = node->depth = node->width = 0;
 
     if (ptree->alloc_node)
-        rbtnode_free(node, NULL, ptree->alloc_node);
+        rbtree_node_release(ptree, node, NULL);
 
     return 0;
 }
@@ -881,11 +997,10 @@ void * rbtree_delete (void * vptree, void * key)
 
     node = rbtree_get_node(ptree, key);
     if (node) {
-        if (ptree->alloc_node)
-            obj = node->obj;
+        obj = rbt_obj(ptree, node);
 
         if (rbtree_delete_node(ptree, node) >= 0) {
-            return ptree->alloc_node ? obj : node;
+            return obj;
         }
     }
 
@@ -902,12 +1017,11 @@ int rbtree_mdelete (void * vptree, void * key, void ** plist, int listnum)
     if (!ptree || !key) return -1;
  
     while ((node = rbtree_get_node(ptree, key)) != NULL) {
-        if (ptree->alloc_node)
-            obj = node->obj;
+        obj = rbt_obj(ptree, node);
 
         if (rbtree_delete_node(ptree, node) >= 0) {
             if (plist && num < listnum)
-                plist[num] = ptree->alloc_node ? obj : node;
+                plist[num] = obj;
             num++;
         } else
             break;
@@ -927,11 +1041,10 @@ void * rbtree_delete_min (void * vptree)
 
     node = rbtnode_min(ptree->root);
     if (node) {
-        if (ptree->alloc_node)
-            obj = node->obj;
+        obj = rbt_obj(ptree, node);
 
         if (rbtree_delete_node(ptree, node) >= 0) {
-            return ptree->alloc_node ? obj : node;
+            return obj;
         }
     }
 
@@ -948,11 +1061,10 @@ void * rbtree_delete_max (void * vptree)
 
     node = rbtnode_max(ptree->root);
     if (node) {
-        if (ptree->alloc_node)
-            obj = node->obj;
+        obj = rbt_obj(ptree, node);
 
         if (rbtree_delete_node(ptree, node) >= 0) {
-            return ptree->alloc_node ? obj : node;
+            return obj;
         }
     }
 
@@ -961,22 +1073,22 @@ void * rbtree_delete_max (void * vptree)
  
  
 static int rbtree_preorder_node (rbtnode_t * node, rbtcb_t * cb, 
-                   void * cbpara, int index, int alloc_node)
+                   void * cbpara, int index, rbtree_t * ptree)
 {
     if (node != NULL) {
         if (cb) {
-            if (alloc_node)
+            if (ptree->alloc_node)
                 (*cb)(cbpara, node->key, node->obj, index);
             else
-                (*cb)(cbpara, node, node, index);
+                (*cb)(cbpara, rbt_obj(ptree, node), rbt_obj(ptree, node), index);
         }
         index++;
 
         if (node->left)
-            index = rbtree_preorder_node(node->left, cb, cbpara, index, alloc_node);
+            index = rbtree_preorder_node(node->left, cb, cbpara, index, ptree);
 
         if (node->right)
-            index = rbtree_preorder_node(node->right, cb, cbpara, index, alloc_node);
+            index = rbtree_preorder_node(node->right, cb, cbpara, index, ptree);
     }
 
     return index;
@@ -988,27 +1100,27 @@ int rbtree_preorder (void * vptree, rbtcb_t * cb, void * cbpara)
 
     if (!ptree) return -1;
 
-    return rbtree_preorder_node(ptree->root, cb, cbpara, 0, ptree->alloc_node);
+    return rbtree_preorder_node(ptree->root, cb, cbpara, 0, ptree);
 }
 
 
 static int rbtree_inorder_node (rbtnode_t * node, rbtcb_t * cb,
-              void * cbpara, int index, int alloc_node)
+              void * cbpara, int index, rbtree_t * ptree)
 {
     if (node != NULL) {
         if (node->left)
-            index = rbtree_inorder_node(node->left, cb, cbpara, index, alloc_node);
+            index = rbtree_inorder_node(node->left, cb, cbpara, index, ptree);
 
         if (cb) {
-            if (alloc_node)
+            if (ptree->alloc_node)
                 (*cb)(cbpara, node->key, node->obj, index);
             else
-                (*cb)(cbpara, node, node, index);
+                (*cb)(cbpara, rbt_obj(ptree, node), rbt_obj(ptree, node), index);
         }
         index++;
 
         if (node->right)
-            index = rbtree_inorder_node(node->right, cb, cbpara, index, alloc_node);
+            index = rbtree_inorder_node(node->right, cb, cbpara, index, ptree);
     }
     return index;
 }
@@ -1020,25 +1132,25 @@ int rbtree_inorder  (void * vptree, rbtcb_t * cb, void * cbpara)
 
     if (!ptree) return -1;
 
-    return rbtree_inorder_node(ptree->root, cb, cbpara, 0, ptree->alloc_node);
+    return rbtree_inorder_node(ptree->root, cb, cbpara, 0, ptree);
 }
 
 
 static int rbtree_postorder_node (rbtnode_t * node, rbtcb_t * cb,
-             void * cbpara, int index, int alloc_node)
+             void * cbpara, int index, rbtree_t * ptree)
 {
     if (node != NULL) {
         if (node->left)
-            index = rbtree_postorder_node(node->left, cb, cbpara, index, alloc_node);
+            index = rbtree_postorder_node(node->left, cb, cbpara, index, ptree);
 
         if (node->right)
-            index = rbtree_postorder_node(node->right, cb, cbpara, index, alloc_node);
+            index = rbtree_postorder_node(node->right, cb, cbpara, index, ptree);
 
         if (cb) {
-            if (alloc_node)
+            if (ptree->alloc_node)
                 (*cb)(cbpara, node->key, node->obj, index);
             else
-                (*cb)(cbpara, node, node, index);
+                (*cb)(cbpara, rbt_obj(ptree, node), rbt_obj(ptree, node), index);
         }
         index++;
     }
@@ -1051,7 +1163,7 @@ int rbtree_postorder(void * vptree, rbtcb_t * cb, void * cbpara)
 
     if (!ptree) return -1;
 
-    return rbtree_postorder_node(ptree->root, cb, cbpara, 0, ptree->alloc_node);
+    return rbtree_postorder_node(ptree->root, cb, cbpara, 0, ptree);
 }
 
 
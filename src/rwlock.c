@@ -3,9 +3,14 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "btype.h"
 #include "memory.h"
 #include <pthread.h>
+#include <sched.h>
 
 #include "rwlock.h"
 
@@ -140,3 +145,238 @@ int rwlock_write_unlock (void * vlock)
     return 0;
 }
 
+
+static int brlock_cpu_slot (brlock_t * brl)
+{
+#if defined(_LINUX_)
+    int  cpu = sched_getcpu();
+
+    if (cpu >= 0) return cpu & (brl->nslot - 1);
+#endif
+    /* spread the threads by their id */
+    return (int)(((ulong)pthread_self() >> 6) * 2654435761UL) & (brl->nslot - 1);
+}
+
+void * brlock_init (void * vlock)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+    long       ncpu;
+    int        nslot = 1;
+
+    if (!brl) {
+        brl = kzalloc(sizeof(*brl));
+        if (!brl) return NULL;
+        brl->alloc = 1;
+    } else {
+        memset(brl, 0, sizeof(*brl));
+        brl->alloc = 0;
+    }
+
+    ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu <= 0) ncpu = 1;
+    while (nslot < ncpu && nslot < BRLOCK_MAXSLOT) nslot <<= 1;
+
+    brl->slotmem = kzalloc(sizeof(brlock_slot_t) * (nslot + 1));
+    if (!brl->slotmem) {
+        if (brl->alloc) kfree(brl);
+        return NULL;
+    }
+
+    /* each slot on its own cache line */
+    brl->slots = (brlock_slot_t *)(((ulong)brl->slotmem + 63) & ~(ulong)63);
+    brl->nslot = nslot;
+    brl->writer = 0;
+
+    pthread_mutex_init(&brl->wlock, NULL);
+
+    return brl;
+}
+
+int brlock_clean (void * vlock)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+
+    if (!brl) return -1;
+
+    pthread_mutex_destroy(&brl->wlock);
+
+    if (brl->slotmem) kfree(brl->slotmem);
+
+    if (brl->alloc) kfree(brl);
+
+    return 0;
+}
+
+int brlock_read_lock (void * vlock)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+    int        slot;
+
+    if (!brl) return -1;
+
+    for ( ; ; ) {
+        slot = brlock_cpu_slot(brl);
+
+        __atomic_add_fetch(&brl->slots[slot].count, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&brl->writer, __ATOMIC_SEQ_CST))
+            return slot;
+
+        /* back off for the writer */
+        __atomic_sub_fetch(&brl->slots[slot].count, 1, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&brl->writer, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+}
+
+int brlock_read_unlock (void * vlock, int slot)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+
+    if (!brl || slot < 0 || slot >= brl->nslot) return -1;
+
+    __atomic_sub_fetch(&brl->slots[slot].count, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int brlock_write_lock (void * vlock)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+    int        i;
+
+    if (!brl) return -1;
+
+    pthread_mutex_lock(&brl->wlock);
+
+    __atomic_store_n(&brl->writer, 1, __ATOMIC_SEQ_CST);
+
+    for (i = 0; i < brl->nslot; i++) {
+        while (__atomic_load_n(&brl->slots[i].count, __ATOMIC_ACQUIRE) > 0)
+            sched_yield();
+    }
+
+    return 0;
+}
+
+int brlock_write_unlock (void * vlock)
+{
+    brlock_t * brl = (brlock_t *)vlock;
+
+    if (!brl) return -1;
+
+    __atomic_store_n(&brl->writer, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&brl->wlock);
+
+    return 0;
+}
+
+
+void * seqlock_init (void * vlock)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+
+    if (!sl) {
+        sl = kzalloc(sizeof(*sl));
+        if (!sl) return NULL;
+        sl->alloc = 1;
+    } else {
+        sl->alloc = 0;
+    }
+
+    sl->seq = 0;
+    pthread_mutex_init(&sl->wlock, NULL);
+
+    return sl;
+}
+
+int seqlock_clean (void * vlock)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+
+    if (!sl) return -1;
+
+    pthread_mutex_destroy(&sl->wlock);
+
+    if (sl->alloc) kfree(sl);
+
+    return 0;
+}
+
+uint32 seqlock_read_begin (void * vlock)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+    uint32      seq;
+
+    if (!sl) return 0;
+
+    /* odd sequence means a writer is in progress */
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+
+    return seq;
+}
+
+int seqlock_read_retry (void * vlock, uint32 start)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+
+    if (!sl) return 0;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+int seqlock_write_lock (void * vlock)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+
+    if (!sl) return -1;
+
+    pthread_mutex_lock(&sl->wlock);
+
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int seqlock_write_unlock (void * vlock)
+{
+    seqlock_t * sl = (seqlock_t *)vlock;
+
+    if (!sl) return -1;
+
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&sl->wlock);
+
+    return 0;
+}
+
+int seqlock_read (void * vlock, void * dst, void * src, int len)
+{
+    uint32  seq;
+
+    if (!vlock || !dst || !src || len <= 0) return -1;
+
+    do {
+        seq = seqlock_read_begin(vlock);
+        memcpy(dst, src, len);
+    } while (seqlock_read_retry(vlock, seq));
+
+    return len;
+}
+
+int seqlock_write (void * vlock, void * dst, void * src, int len)
+{
+    if (!vlock || !dst || !src || len <= 0) return -1;
+
+    seqlock_write_lock(vlock);
+    memcpy(dst, src, len);
+    seqlock_write_unlock(vlock);
+
+    return len;
+}
@@ -3,8 +3,16 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "service.h"
 #include "frame.h"
+#include "memory.h"
+#include "btime.h"
+#include "confile.h"
+#include "trace.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -22,6 +30,11 @@
 #include <sys/wait.h>
 #include <sys/io.h>
 #include <pwd.h>
+#include <poll.h>
+#endif
+
+#if defined(_LINUX_)
+#include <sched.h>
 #endif
 
 
@@ -277,6 +290,503 @@ int runas(char * user)
     return 0;
 }
 
+
+/* the master and workers of prefork. the signals to the master are written
+ * into a pipe by the handlers and handled in its poll loop, the workers
+ * tell the master they are ready by writing their pid to another pipe */
+
+#define PREFORK_READY_WAIT  5000000     /* microseconds */
+#define PREFORK_RESPAWN     1000000     /* least lifetime before forked again */
+
+typedef struct prefork_slot_s {
+    pid_t            pid;
+    pid_t            oldpid;            /* the worker being replaced by pid */
+    int              ready;
+    int64            started;
+    int64            respawn;           /* time to fork again, 0 none */
+} PreforkSlot;
+
+typedef struct prefork_s {
+    int              num;
+    PreforkMain    * work;
+    void           * para;
+
+    int              affinity;
+    int              ncpu;
+    int            * cpus;
+
+    SOCKET         * shards;
+    int              shardnum;
+
+    void           * conf;
+    char             conffile[256];
+    PreforkReload  * reload;
+
+    int              grace;
+    PreforkSlot    * slots;
+
+    int              sigpipe[2];
+    int              readypipe[2];
+} Prefork;
+
+static int             g_pf_sigfd = -1;
+static int             g_pf_readyfd = -1;
+static int             g_pf_index = -1;
+static SOCKET          g_pf_shard = INVALID_SOCKET;
+static volatile int    g_pf_quit = 0;
+
+static void prefork_master_sig (int signo)
+{
+    uint8  byte = (uint8)signo;
+    int    err = errno;
+
+    if (g_pf_sigfd >= 0 && write(g_pf_sigfd, &byte, 1) < 0) {}
+    errno = err;
+}
+
+static void prefork_worker_sig (int signo)
+{
+    g_pf_quit = 1;
+}
+
+static void prefork_sigset (int signo, void (*handler)(int))
+{
+    struct sigaction  sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+
+    /* no SA_RESTART, the blocking calls of the worker return by EINTR */
+    sigaction(signo, &sa, NULL);
+}
+
+void * prefork_new (int num, PreforkMain * work, void * para)
+{
+    Prefork  * pf = NULL;
+    int        i;
+#if defined(_LINUX_)
+    cpu_set_t  cpuset;
+#endif
+
+    if (num <= 0 || !work) return NULL;
+
+    pf = kzalloc(sizeof(*pf));
+    if (!pf) return NULL;
+
+    pf->num = num;
+    pf->work = work;
+    pf->para = para;
+    pf->grace = 30;
+    pf->sigpipe[0] = pf->sigpipe[1] = -1;
+    pf->readypipe[0] = pf->readypipe[1] = -1;
+
+    pf->slots = kzalloc(sizeof(PreforkSlot) * num);
+
+    pf->ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pf->ncpu <= 0) pf->ncpu = 1;
+    pf->cpus = kzalloc(sizeof(int) * pf->ncpu);
+
+    if (!pf->slots || !pf->cpus) {
+        prefork_free(pf);
+        return NULL;
+    }
+
+    /* the cpus allowed to the master, in order */
+    for (i = 0; i < pf->ncpu; i++) pf->cpus[i] = i;
+
+#if defined(_LINUX_)
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+        int n = 0;
+
+        for (i = 0; i < CPU_SETSIZE && n < pf->ncpu; i++)
+            if (CPU_ISSET(i, &cpuset)) pf->cpus[n++] = i;
+
+        if (n > 0) pf->ncpu = n;
+    }
+#endif
+
+    return pf;
+}
+
+void prefork_free (void * vpf)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    if (!pf) return;
+
+    if (pf->slots) kfree(pf->slots);
+    if (pf->cpus) kfree(pf->cpus);
+    if (pf->shards) kfree(pf->shards);
+
+    kfree(pf);
+}
+
+int prefork_set_affinity (void * vpf, int on)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    if (!pf) return -1;
+
+    pf->affinity = on;
+    return 0;
+}
+
+int prefork_set_shards (void * vpf, SOCKET * fds, int num)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    if (!pf || num < 0 || (num > 0 && !fds)) return -1;
+
+    if (pf->shards) kfree(pf->shards);
+    pf->shards = NULL;
+    pf->shardnum = 0;
+
+    if (num == 0) return 0;
+
+    pf->shards = kalloc(sizeof(SOCKET) * num);
+    if (!pf->shards) return -2;
+
+    memcpy(pf->shards, fds, sizeof(SOCKET) * num);
+    pf->shardnum = num;
+    return 0;
+}
+
+int prefork_set_grace (void * vpf, int seconds)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    if (!pf || seconds < 0) return -1;
+
+    pf->grace = seconds;
+    return 0;
+}
+
+int prefork_set_conf (void * vpf, void * conf, char * file, PreforkReload * reload)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    if (!pf) return -1;
+
+    pf->conf = conf;
+    pf->reload = reload;
+
+    if (file) strncpy(pf->conffile, file, sizeof(pf->conffile) - 1);
+
+    return 0;
+}
+
+void * prefork_conf (void * vpf)
+{
+    Prefork * pf = (Prefork *)vpf;
+
+    return pf ? pf->conf : NULL;
+}
+
+static void prefork_child (Prefork * pf, int index)
+{
+    int   i, cpu = -1, ret;
+#if defined(_LINUX_)
+    cpu_set_t  cpuset;
+#endif
+
+    /* the master's handlers and pipes are not of the worker */
+    close(pf->sigpipe[0]);
+    close(pf->sigpipe[1]);
+    close(pf->readypipe[0]);
+    g_pf_sigfd = -1;
+    g_pf_readyfd = pf->readypipe[1];
+    g_pf_index = index;
+    g_pf_quit = 0;
+
+    prefork_sigset(SIGCHLD, SIG_DFL);
+    prefork_sigset(SIGUSR2, SIG_DFL);
+    prefork_sigset(SIGHUP, SIG_IGN);
+    prefork_sigset(SIGTERM, prefork_worker_sig);
+    prefork_sigset(SIGINT, prefork_worker_sig);
+    prefork_sigset(SIGQUIT, prefork_worker_sig);
+
+    if (pf->shardnum > 0) {
+        for (i = 0; i < pf->shardnum; i++) {
+            if (i == index % pf->shardnum)
+                g_pf_shard = pf->shards[i];
+            else
+                closesocket(pf->shards[i]);
+        }
+    }
+
+    if (pf->affinity) {
+        cpu = pf->cpus[index % pf->ncpu];
+#if defined(_LINUX_)
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == 0)
+            mem_numa_prefer(-1);
+#endif
+    }
+
+    ret = (*pf->work)(pf->para, index, cpu);
+    exit(ret);
+}
+
+static int prefork_spawn (Prefork * pf, int index)
+{
+    PreforkSlot * slot = &pf->slots[index];
+    pid_t         pid;
+
+    pid = fork();
+    if (pid < 0) {
+        tolog(1, "prefork worker %d fork failed, errno=%d\n", index, errno);
+        slot->respawn = btime_mono_coarse(NULL) + PREFORK_RESPAWN;
+        return -1;
+    }
+
+    if (pid == 0) prefork_child(pf, index);
+
+    slot->pid = pid;
+    slot->ready = 0;
+    slot->started = btime_mono_coarse(NULL);
+    slot->respawn = 0;
+
+    return 0;
+}
+
+/* fork a new worker beside each old one, the old one quits when it's ready */
+static void prefork_restart (Prefork * pf)
+{
+    PreforkSlot * slot = NULL;
+    int           i;
+
+    for (i = 0; i < pf->num; i++) {
+        slot = &pf->slots[i];
+
+        /* the slot in the middle of restarting or waiting to respawn */
+        if (slot->pid <= 0 || slot->oldpid > 0) continue;
+
+        slot->oldpid = slot->pid;
+        slot->pid = 0;
+        prefork_spawn(pf, i);
+    }
+}
+
+static void prefork_conf_reload (Prefork * pf)
+{
+    void * conf = NULL;
+
+    if (!pf->conf || !pf->conffile[0]) {
+        prefork_restart(pf);
+        return;
+    }
+
+    conf = conf_mgmt_init(NULL);
+    if (!conf) return;
+
+    if (conf_mgmt_read(conf, pf->conffile) < 0 ||
+        (pf->reload && (*pf->reload)(pf->para, conf) < 0))
+    {
+        tolog(1, "prefork reload of %s refused, workers keep the old conf\n", pf->conffile);
+        conf_mgmt_cleanup(conf);
+        return;
+    }
+
+    conf_mgmt_cleanup(pf->conf);
+    pf->conf = conf;
+
+    prefork_restart(pf);
+}
+
+static void prefork_reap (Prefork * pf, int stopping)
+{
+    PreforkSlot * slot = NULL;
+    pid_t         pid;
+    int           i, status;
+    int64         now;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        now = btime_mono_coarse(NULL);
+
+        for (i = 0; i < pf->num; i++) {
+            slot = &pf->slots[i];
+
+            if (slot->oldpid == pid) {
+                slot->oldpid = 0;
+                break;
+            }
+
+            if (slot->pid == pid) {
+                slot->pid = 0;
+                if (!stopping) {
+                    tolog(1, "prefork worker %d pid=%d exited, status=%d\n", i, (int)pid, status);
+
+                    /* a worker dying at start is not forked again at once */
+                    slot->respawn = slot->started + PREFORK_RESPAWN;
+                    if (slot->respawn < now) slot->respawn = now;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void prefork_ready_read (Prefork * pf)
+{
+    PreforkSlot * slot = NULL;
+    int           pids[64];
+    int           i, j, n;
+
+    while ((n = read(pf->readypipe[0], pids, sizeof(pids))) > 0) {
+        for (j = 0; j < n / (int)sizeof(int); j++) {
+            for (i = 0; i < pf->num; i++) {
+                slot = &pf->slots[i];
+                if (slot->pid == pids[j]) slot->ready = 1;
+            }
+        }
+    }
+}
+
+int prefork_run (void * vpf)
+{
+    Prefork       * pf = (Prefork *)vpf;
+    PreforkSlot   * slot = NULL;
+    struct pollfd   pfd[2];
+    uint8           sigs[64];
+    int             i, n, ms, alive;
+    int             term, hup, usr2;
+    int             stopping = 0;
+    int64           now, deadline = 0;
+
+    if (!pf) return -1;
+
+    if (pipe(pf->sigpipe) < 0) return -2;
+    if (pipe(pf->readypipe) < 0) {
+        close(pf->sigpipe[0]); close(pf->sigpipe[1]);
+        return -3;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(pf->sigpipe[i], F_SETFL, fcntl(pf->sigpipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(pf->readypipe[i], F_SETFL, fcntl(pf->readypipe[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    g_pf_sigfd = pf->sigpipe[1];
+    prefork_sigset(SIGCHLD, prefork_master_sig);
+    prefork_sigset(SIGHUP, prefork_master_sig);
+    prefork_sigset(SIGUSR2, prefork_master_sig);
+    prefork_sigset(SIGTERM, prefork_master_sig);
+    prefork_sigset(SIGINT, prefork_master_sig);
+
+    for (i = 0; i < pf->num; i++)
+        prefork_spawn(pf, i);
+
+    for ( ; ; ) {
+        pfd[0].fd = pf->sigpipe[0];   pfd[0].events = POLLIN;
+        pfd[1].fd = pf->readypipe[0]; pfd[1].events = POLLIN;
+
+        ms = stopping ? 100 : 500;
+        poll(pfd, 2, ms);
+
+        term = hup = usr2 = 0;
+        while ((n = read(pf->sigpipe[0], sigs, sizeof(sigs))) > 0) {
+            for (i = 0; i < n; i++) {
+                if (sigs[i] == SIGTERM || sigs[i] == SIGINT) term = 1;
+                else if (sigs[i] == SIGHUP) hup = 1;
+                else if (sigs[i] == SIGUSR2) usr2 = 1;
+            }
+        }
+
+        if (term && !stopping) {
+            stopping = 1;
+            deadline = btime_mono_coarse(NULL) + (int64)pf->grace * 1000000;
+
+            for (i = 0; i < pf->num; i++) {
+                if (pf->slots[i].pid > 0) kill(pf->slots[i].pid, SIGTERM);
+                if (pf->slots[i].oldpid > 0) kill(pf->slots[i].oldpid, SIGTERM);
+            }
+        }
+
+        if (!stopping) {
+            if (hup) prefork_conf_reload(pf);
+            else if (usr2) prefork_restart(pf);
+        }
+
+        prefork_reap(pf, stopping);
+        prefork_ready_read(pf);
+
+        now = btime_mono_coarse(NULL);
+
+        if (stopping) {
+            for (alive = 0, i = 0; i < pf->num; i++) {
+                slot = &pf->slots[i];
+                if (slot->pid > 0) alive++;
+                if (slot->oldpid > 0) alive++;
+
+                if (now >= deadline) {
+                    if (slot->pid > 0) kill(slot->pid, SIGKILL);
+                    if (slot->oldpid > 0) kill(slot->oldpid, SIGKILL);
+                }
+            }
+            if (alive == 0) break;
+            continue;
+        }
+
+        for (i = 0; i < pf->num; i++) {
+            slot = &pf->slots[i];
+
+            if (slot->pid == 0 && slot->respawn > 0 && slot->respawn <= now)
+                prefork_spawn(pf, i);
+
+            if (slot->pid > 0 && !slot->ready && now - slot->started >= PREFORK_READY_WAIT)
+                slot->ready = 1;
+
+            /* the new worker serves, the old one may quit now */
+            if (slot->ready == 1 && slot->oldpid > 0) {
+                kill(slot->oldpid, SIGTERM);
+                slot->ready = 2;
+            }
+        }
+    }
+
+    prefork_sigset(SIGCHLD, SIG_DFL);
+    prefork_sigset(SIGHUP, SIG_DFL);
+    prefork_sigset(SIGUSR2, SIG_DFL);
+    prefork_sigset(SIGTERM, SIG_DFL);
+    prefork_sigset(SIGINT, SIG_DFL);
+    g_pf_sigfd = -1;
+
+    close(pf->sigpipe[0]); close(pf->sigpipe[1]);
+    close(pf->readypipe[0]); close(pf->readypipe[1]);
+    pf->sigpipe[0] = pf->sigpipe[1] = -1;
+    pf->readypipe[0] = pf->readypipe[1] = -1;
+
+    return 0;
+}
+
+int prefork_index ()
+{
+    return g_pf_index;
+}
+
+SOCKET prefork_shard ()
+{
+    return g_pf_shard;
+}
+
+int prefork_quitting ()
+{
+    return g_pf_quit;
+}
+
+int prefork_ready ()
+{
+    int  pid = (int)getpid();
+
+    if (g_pf_readyfd < 0) return -1;
+
+    if (write(g_pf_readyfd, &pid, sizeof(pid)) != sizeof(pid))
+        return -2;
+
+    return 0;
+}
+
 #endif  //end ifdef UNIX
 
 
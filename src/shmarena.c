@@ -0,0 +1,727 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "hashtab.h"
+#include "mthread.h"
+#include "shmarena.h"
+
+#ifdef UNIX
+
+#include <unistd.h>
+#include <errno.h>
+
+#define SHM_MAGIC       0x41524E53   //"SNRA"
+#define SHM_BLK_USED    0x55534544
+#define SHM_BLK_FREE    0x46524545
+
+#define SHM_MIN_SHIFT   5            //the least block is 32 bytes
+#define SHM_CLASS_NUM   36
+
+typedef struct shm_root_s {
+    char      name[32];
+    int64     ofs;
+} ShmRoot;
+
+typedef struct shm_arena_s {
+    uint32           magic;          //set when formatted
+    uint32           hdrsize;
+
+    int64            size;
+    int64            top;            //the blocks below top are cut
+    int64            used;
+
+    pthread_mutex_t  lock;
+
+    int64            freelist[SHM_CLASS_NUM];
+    ShmRoot          root[SHM_ROOT_NUM];
+} ShmArena;
+
+/* the header of each block, 16 bytes to keep the data aligned */
+typedef struct shm_blk_s {
+    int64     next;                  //next free block of the class
+    int32     cls;
+    uint32    tag;
+} ShmBlk;
+
+typedef struct shm_ht_slot_s {
+    uint64    hash;
+    uint32    check;
+    int32     used;
+    int64     value;
+    int32     valuelen;
+    int32     res;
+} ShmHTSlot;
+
+typedef struct shm_hash_tab_s {
+    int64            self;           //offset of table in arena
+    pthread_mutex_t  lock;
+
+    uint64           seed;
+    ulong            size;           //power of 2
+    ulong            num;
+    int64            slots;
+} ShmHashTab;
+
+typedef struct shm_ring_s {
+    int64            self;
+    pthread_mutex_t  lock;
+
+    int              unitsize;
+    int              slotsize;
+    int              num;
+    int              head;
+    int              count;
+    int64            items;
+} ShmRing;
+
+#define SHM_ARENA_OF(obj)  ((ShmArena *)((uint8 *)(obj) - (obj)->self))
+
+
+static int shm_mutex_init (pthread_mutex_t * mtx)
+{
+    pthread_mutexattr_t  attr;
+    int                  ret = 0;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+    ret = pthread_mutex_init(mtx, &attr);
+
+    pthread_mutexattr_destroy(&attr);
+
+    return ret;
+}
+
+/* the lock left by a dead process is taken over */
+static void shm_lock (pthread_mutex_t * mtx)
+{
+    if (pthread_mutex_lock(mtx) == EOWNERDEAD)
+        pthread_mutex_consistent(mtx);
+}
+
+static void shm_unlock (pthread_mutex_t * mtx)
+{
+    pthread_mutex_unlock(mtx);
+}
+
+
+void * shm_arena_init (void * base, int64 size)
+{
+    ShmArena * arena = (ShmArena *)base;
+
+    if (!arena) return NULL;
+    if (size < (int64)sizeof(ShmArena) + 1024) return NULL;
+
+    memset(arena, 0, sizeof(*arena));
+
+    arena->hdrsize = (sizeof(ShmArena) + 15) & ~15;
+    arena->size = size;
+    arena->top = arena->hdrsize;
+    arena->used = 0;
+
+    if (shm_mutex_init(&arena->lock) != 0)
+        return NULL;
+
+    /* the attaching processes go on once the magic is seen */
+    __atomic_store_n(&arena->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return arena;
+}
+
+void * shm_arena_attach (void * base, int waitms)
+{
+    ShmArena * arena = (ShmArena *)base;
+    int        i;
+
+    if (!arena) return NULL;
+
+    for (i = 0; __atomic_load_n(&arena->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC; i++) {
+        if (i >= waitms) return NULL;
+        usleep(1000);
+    }
+
+    return arena;
+}
+
+void * shm_arena_open (char * path, int proj, int size, int * pshmid)
+{
+    void  * base = NULL;
+    int     shmid = 0;
+    int     created = 0;
+
+    if (pshmid) *pshmid = -1;
+
+    shmid = ipc_shm_init(path, proj, size, &base, &created);
+    if (shmid < 0 || !base || base == (void *)-1)
+        return NULL;
+
+    if (pshmid) *pshmid = shmid;
+
+    if (created)
+        return shm_arena_init(base, size);
+
+    return shm_arena_attach(base, 3000);
+}
+
+int64 shm_arena_size (void * varena)
+{
+    ShmArena * arena = (ShmArena *)varena;
+
+    if (!arena) return 0;
+
+    return arena->size;
+}
+
+int64 shm_arena_used (void * varena)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    int64      used = 0;
+
+    if (!arena) return 0;
+
+    shm_lock(&arena->lock);
+    used = arena->used;
+    shm_unlock(&arena->lock);
+
+    return used;
+}
+
+void * shm_alloc (void * varena, int size)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    ShmBlk   * blk = NULL;
+    int64      blksize = 0;
+    int64      ofs = 0;
+    int        cls = 0;
+
+    if (!arena || size < 0) return NULL;
+
+    for (blksize = 1 << SHM_MIN_SHIFT; blksize < (int64)size + (int64)sizeof(ShmBlk); blksize <<= 1)
+        cls++;
+
+    if (cls >= SHM_CLASS_NUM) return NULL;
+
+    shm_lock(&arena->lock);
+
+    ofs = arena->freelist[cls];
+    if (ofs) {
+        blk = SHM_PTR(arena, ofs);
+        arena->freelist[cls] = blk->next;
+
+    } else if (arena->top + blksize <= arena->size) {
+        ofs = arena->top;
+        arena->top += blksize;
+        blk = SHM_PTR(arena, ofs);
+
+    } else {
+        shm_unlock(&arena->lock);
+        return NULL;
+    }
+
+    blk->next = 0;
+    blk->cls = cls;
+    blk->tag = SHM_BLK_USED;
+
+    arena->used += blksize;
+
+    shm_unlock(&arena->lock);
+
+    return blk + 1;
+}
+
+void * shm_zalloc (void * arena, int size)
+{
+    void * p = NULL;
+
+    p = shm_alloc(arena, size);
+    if (p) memset(p, 0, size);
+
+    return p;
+}
+
+void shm_free (void * varena, void * p)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    ShmBlk   * blk = NULL;
+
+    if (!arena || !p) return;
+
+    blk = (ShmBlk *)p - 1;
+
+    if ((uint8 *)blk < (uint8 *)arena + arena->hdrsize ||
+        (uint8 *)p > (uint8 *)arena + arena->top)
+        return;
+
+    shm_lock(&arena->lock);
+
+    if (blk->tag == SHM_BLK_USED) {
+        blk->tag = SHM_BLK_FREE;
+        blk->next = arena->freelist[blk->cls];
+        arena->freelist[blk->cls] = SHM_OFS(arena, blk);
+
+        arena->used -= (int64)1 << (blk->cls + SHM_MIN_SHIFT);
+    }
+
+    shm_unlock(&arena->lock);
+}
+
+int shm_arena_bind (void * varena, char * name, void * obj)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    ShmRoot  * empty = NULL;
+    int        i;
+
+    if (!arena) return -1;
+    if (!name || strlen(name) >= sizeof(arena->root[0].name)) return -2;
+
+    shm_lock(&arena->lock);
+
+    for (i = 0; i < SHM_ROOT_NUM; i++) {
+        if (arena->root[i].ofs == 0) {
+            if (!empty) empty = &arena->root[i];
+            continue;
+        }
+
+        if (strcmp(arena->root[i].name, name) == 0) {
+            arena->root[i].ofs = SHM_OFS(arena, obj);
+            shm_unlock(&arena->lock);
+            return 0;
+        }
+    }
+
+    if (obj && !empty) {
+        shm_unlock(&arena->lock);
+        return -100;
+    }
+
+    if (obj) {
+        strcpy(empty->name, name);
+        empty->ofs = SHM_OFS(arena, obj);
+    }
+
+    shm_unlock(&arena->lock);
+
+    return 0;
+}
+
+void * shm_arena_lookup (void * varena, char * name)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    void     * obj = NULL;
+    int        i;
+
+    if (!arena || !name) return NULL;
+
+    shm_lock(&arena->lock);
+
+    for (i = 0; i < SHM_ROOT_NUM; i++) {
+        if (arena->root[i].ofs && strcmp(arena->root[i].name, name) == 0) {
+            obj = SHM_PTR(arena, arena->root[i].ofs);
+            break;
+        }
+    }
+
+    shm_unlock(&arena->lock);
+
+    return obj;
+}
+
+
+static void shm_ht_hash (ShmHashTab * ht, void * key, int keylen, uint64 * hash, uint32 * check)
+{
+    *hash = wy_hash(key, keylen, ht->seed);
+    *check = (uint32)wy_hash(key, keylen, ht->seed ^ 0x9E3779B97F4A7C15ULL);
+}
+
+/* the slot of hash, or the empty slot to put it */
+static ulong shm_ht_find (ShmHashTab * ht, ShmHTSlot * slots, uint64 hash, uint32 check)
+{
+    ulong  i = hash & (ht->size - 1);
+
+    while (slots[i].used) {
+        if (slots[i].hash == hash && slots[i].check == check)
+            break;
+        i = (i + 1) & (ht->size - 1);
+    }
+
+    return i;
+}
+
+static int shm_ht_grow (ShmArena * arena, ShmHashTab * ht)
+{
+    ShmHTSlot * oldslots = SHM_PTR(arena, ht->slots);
+    ShmHTSlot * slots = NULL;
+    ulong       oldsize = ht->size;
+    ulong       i, j;
+
+    if (oldsize * 2 * sizeof(ShmHTSlot) > 0x7FFFFFFF) return -1;
+
+    slots = shm_zalloc(arena, oldsize * 2 * sizeof(ShmHTSlot));
+    if (!slots) return -100;
+
+    ht->size = oldsize * 2;
+
+    for (i = 0; i < oldsize; i++) {
+        if (!oldslots[i].used) continue;
+
+        j = shm_ht_find(ht, slots, oldslots[i].hash, oldslots[i].check);
+        slots[j] = oldslots[i];
+    }
+
+    ht->slots = SHM_OFS(arena, slots);
+    shm_free(arena, oldslots);
+
+    return 0;
+}
+
+void * shm_ht_new (void * varena, ulong size)
+{
+    ShmArena   * arena = (ShmArena *)varena;
+    ShmHashTab * ht = NULL;
+    ShmHTSlot  * slots = NULL;
+    ulong        num = 16;
+
+    if (!arena) return NULL;
+
+    while (num < size + size / 3) num <<= 1;
+
+    ht = shm_zalloc(arena, sizeof(*ht));
+    if (!ht) return NULL;
+
+    slots = shm_zalloc(arena, num * sizeof(ShmHTSlot));
+    if (!slots || shm_mutex_init(&ht->lock) != 0) {
+        shm_free(arena, slots);
+        shm_free(arena, ht);
+        return NULL;
+    }
+
+    ht->self = SHM_OFS(arena, ht);
+    ht->seed = hash_random_seed() ^ (uint64)ht->self;
+    ht->size = num;
+    ht->num = 0;
+    ht->slots = SHM_OFS(arena, slots);
+
+    return ht;
+}
+
+void shm_ht_free (void * vht)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+    ShmArena   * arena = NULL;
+
+    if (!ht) return;
+
+    arena = SHM_ARENA_OF(ht);
+
+    shm_ht_zero(ht);
+
+    pthread_mutex_destroy(&ht->lock);
+
+    shm_free(arena, SHM_PTR(arena, ht->slots));
+    shm_free(arena, ht);
+}
+
+int shm_ht_num (void * vht)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+
+    if (!ht) return 0;
+
+    return (int)__atomic_load_n(&ht->num, __ATOMIC_RELAXED);
+}
+
+int shm_ht_get (void * vht, void * key, int keylen, void * pbuf, int size)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+    ShmArena   * arena = NULL;
+    ShmHTSlot  * slot = NULL;
+    uint64       hash = 0;
+    uint32       check = 0;
+    int          len = 0;
+
+    if (!ht) return -1;
+    if (!key || keylen == 0) return -2;
+
+    arena = SHM_ARENA_OF(ht);
+
+    shm_ht_hash(ht, key, keylen, &hash, &check);
+
+    shm_lock(&ht->lock);
+
+    slot = (ShmHTSlot *)SHM_PTR(arena, ht->slots);
+    slot += shm_ht_find(ht, slot, hash, check);
+
+    if (!slot->used) {
+        shm_unlock(&ht->lock);
+        return -100;
+    }
+
+    len = slot->valuelen;
+    if (pbuf && size > 0)
+        memcpy(pbuf, (uint8 *)arena + slot->value, len < size ? len : size);
+
+    shm_unlock(&ht->lock);
+
+    return len;
+}
+
+int shm_ht_set (void * vht, void * key, int keylen, void * value, int valuelen)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+    ShmArena   * arena = NULL;
+    ShmHTSlot  * slot = NULL;
+    uint64       hash = 0;
+    uint32       check = 0;
+    void       * pval = NULL;
+    void       * old = NULL;
+
+    if (!ht) return -1;
+    if (!key || keylen == 0) return -2;
+    if (valuelen < 0 || (valuelen > 0 && !value)) return -3;
+
+    arena = SHM_ARENA_OF(ht);
+
+    shm_ht_hash(ht, key, keylen, &hash, &check);
+
+    /* copy the value before locking the table */
+    pval = shm_alloc(arena, valuelen);
+    if (!pval) return -100;
+    if (valuelen > 0) memcpy(pval, value, valuelen);
+
+    shm_lock(&ht->lock);
+
+    if ((ht->num + 1) * 4 > ht->size * 3)
+        shm_ht_grow(arena, ht);
+
+    slot = (ShmHTSlot *)SHM_PTR(arena, ht->slots);
+    slot += shm_ht_find(ht, slot, hash, check);
+
+    if (slot->used) {
+        old = SHM_PTR(arena, slot->value);
+        slot->value = SHM_OFS(arena, pval);
+        slot->valuelen = valuelen;
+
+        shm_unlock(&ht->lock);
+
+        shm_free(arena, old);
+        return 0;
+    }
+
+    if (ht->num + 1 >= ht->size) {
+        shm_unlock(&ht->lock);
+        shm_free(arena, pval);
+        return -101;
+    }
+
+    slot->hash = hash;
+    slot->check = check;
+    slot->value = SHM_OFS(arena, pval);
+    slot->valuelen = valuelen;
+    slot->used = 1;
+
+    ht->num++;
+
+    shm_unlock(&ht->lock);
+
+    return 1;
+}
+
+int shm_ht_del (void * vht, void * key, int keylen)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+    ShmArena   * arena = NULL;
+    ShmHTSlot  * slots = NULL;
+    uint64       hash = 0;
+    uint32       check = 0;
+    void       * old = NULL;
+    ulong        mask, i, j, home;
+
+    if (!ht) return -1;
+    if (!key || keylen == 0) return -2;
+
+    arena = SHM_ARENA_OF(ht);
+
+    shm_ht_hash(ht, key, keylen, &hash, &check);
+
+    shm_lock(&ht->lock);
+
+    slots = SHM_PTR(arena, ht->slots);
+    mask = ht->size - 1;
+
+    i = shm_ht_find(ht, slots, hash, check);
+    if (!slots[i].used) {
+        shm_unlock(&ht->lock);
+        return -100;
+    }
+
+    old = SHM_PTR(arena, slots[i].value);
+
+    /* shift the following slots of the probe chain backward, no
+     * tombstone is left */
+    for (j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+        home = slots[j].hash & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    memset(&slots[i], 0, sizeof(slots[i]));
+    ht->num--;
+
+    shm_unlock(&ht->lock);
+
+    shm_free(arena, old);
+
+    return 0;
+}
+
+void shm_ht_zero (void * vht)
+{
+    ShmHashTab * ht = (ShmHashTab *)vht;
+    ShmArena   * arena = NULL;
+    ShmHTSlot  * slots = NULL;
+    ulong        i;
+
+    if (!ht) return;
+
+    arena = SHM_ARENA_OF(ht);
+
+    shm_lock(&ht->lock);
+
+    slots = SHM_PTR(arena, ht->slots);
+
+    for (i = 0; i < ht->size; i++) {
+        if (!slots[i].used) continue;
+
+        shm_free(arena, SHM_PTR(arena, slots[i].value));
+        memset(&slots[i], 0, sizeof(slots[i]));
+    }
+    ht->num = 0;
+
+    shm_unlock(&ht->lock);
+}
+
+
+void * shm_ring_new (void * varena, int unitsize, int num)
+{
+    ShmArena * arena = (ShmArena *)varena;
+    ShmRing  * ring = NULL;
+    void     * items = NULL;
+    int        slotsize = 0;
+
+    if (!arena || unitsize <= 0 || num <= 0) return NULL;
+
+    slotsize = (sizeof(int) + unitsize + 7) & ~7;
+    if ((int64)slotsize * num > 0x7FFFFFFF) return NULL;
+
+    ring = shm_zalloc(arena, sizeof(*ring));
+    if (!ring) return NULL;
+
+    items = shm_alloc(arena, slotsize * num);
+    if (!items || shm_mutex_init(&ring->lock) != 0) {
+        shm_free(arena, items);
+        shm_free(arena, ring);
+        return NULL;
+    }
+
+    ring->self = SHM_OFS(arena, ring);
+    ring->unitsize = unitsize;
+    ring->slotsize = slotsize;
+    ring->num = num;
+    ring->head = 0;
+    ring->count = 0;
+    ring->items = SHM_OFS(arena, items);
+
+    return ring;
+}
+
+void shm_ring_free (void * vring)
+{
+    ShmRing  * ring = (ShmRing *)vring;
+    ShmArena * arena = NULL;
+
+    if (!ring) return;
+
+    arena = SHM_ARENA_OF(ring);
+
+    pthread_mutex_destroy(&ring->lock);
+
+    shm_free(arena, SHM_PTR(arena, ring->items));
+    shm_free(arena, ring);
+}
+
+int shm_ring_num (void * vring)
+{
+    ShmRing  * ring = (ShmRing *)vring;
+
+    if (!ring) return 0;
+
+    return __atomic_load_n(&ring->count, __ATOMIC_RELAXED);
+}
+
+int shm_ring_push (void * vring, void * data, int len)
+{
+    ShmRing  * ring = (ShmRing *)vring;
+    uint8    * slot = NULL;
+
+    if (!ring) return -1;
+    if (len < 0 || (len > 0 && !data)) return -2;
+    if (len > ring->unitsize) return -101;
+
+    shm_lock(&ring->lock);
+
+    if (ring->count >= ring->num) {
+        shm_unlock(&ring->lock);
+        return -100;
+    }
+
+    slot = (uint8 *)SHM_ARENA_OF(ring) + ring->items +
+           (int64)((ring->head + ring->count) % ring->num) * ring->slotsize;
+
+    *(int *)slot = len;
+    if (len > 0) memcpy(slot + sizeof(int), data, len);
+
+    ring->count++;
+
+    shm_unlock(&ring->lock);
+
+    return 0;
+}
+
+int shm_ring_pop (void * vring, void * pbuf, int size)
+{
+    ShmRing  * ring = (ShmRing *)vring;
+    uint8    * slot = NULL;
+    int        len = 0;
+
+    if (!ring) return -1;
+
+    shm_lock(&ring->lock);
+
+    if (ring->count <= 0) {
+        shm_unlock(&ring->lock);
+        return -100;
+    }
+
+    slot = (uint8 *)SHM_ARENA_OF(ring) + ring->items + (int64)ring->head * ring->slotsize;
+
+    len = *(int *)slot;
+    if (pbuf && size > 0)
+        memcpy(pbuf, slot + sizeof(int), len < size ? len : size);
+
+    ring->head = (ring->head + 1) % ring->num;
+    ring->count--;
+
+    shm_unlock(&ring->lock);
+
+    return len;
+}
+
+#endif  //end if UNIX
+
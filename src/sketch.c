@@ -0,0 +1,1112 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include <stddef.h>
+#include <math.h>
+
+#include "btype.h"
+#include "memory.h"
+#include "heap.h"
+#include "hashtab.h"
+#include "byteiter.h"
+#include "sketch.h"
+
+#define TOPK_MAGIC   0x4B504F54   //TOPK
+#define CMS_MAGIC    0x4B534D43   //CMSK
+#define TD_MAGIC     0x47494454   //TDIG
+
+#define TOPK_MAXK    (1 << 24)
+#define CMS_MAXCELL  (1 << 28)
+#define CMS_SEED     0x5851F42D4C957F2DULL
+
+static void sk_put_double (uint8 * p, double v)
+{
+    uint64  u;
+
+    memcpy(&u, &v, sizeof(u));
+    bytes_put64LE(p, u);
+}
+
+static double sk_get_double (uint8 * p)
+{
+    uint64  u = bytes_uint64LE(p);
+    double  v;
+
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+
+/* Space-Saving top-K */
+
+typedef struct topk_entry {
+    uint64     count;
+    uint64     error;
+    uint64     hash;
+    int        heapidx;
+    int        keylen;
+    int        keycap;
+    uint8    * key;
+} TopKEntry;
+
+typedef struct topk_s {
+    int          k;
+    int          num;
+    uint64       total;
+    uint64       seed;
+
+    TopKEntry  * ent;
+    heap_t     * heap;     //min-heap of the entries by count
+
+    /* open addressing index of the entries, slot holds entry index + 1 */
+    uint32     * slot;
+    uint32       mask;
+} TopK;
+
+static int topk_cmp (void * a, void * b)
+{
+    TopKEntry * ea = (TopKEntry *)a;
+    TopKEntry * eb = (TopKEntry *)b;
+
+    if (ea->count < eb->count) return -1;
+    if (ea->count > eb->count) return 1;
+    return 0;
+}
+
+static int topk_item_cmp (const void * a, const void * b)
+{
+    const topk_item_t * ia = (const topk_item_t *)a;
+    const topk_item_t * ib = (const topk_item_t *)b;
+
+    if (ia->count > ib->count) return -1;
+    if (ia->count < ib->count) return 1;
+    if (ia->error < ib->error) return -1;
+    if (ia->error > ib->error) return 1;
+    return 0;
+}
+
+/* return the slot of key or the empty slot where it goes */
+static uint32 topk_slot_find (TopK * tk, void * key, int keylen, uint64 hash)
+{
+    TopKEntry * e = NULL;
+    uint32      i;
+
+    for (i = (uint32)hash & tk->mask; tk->slot[i]; i = (i + 1) & tk->mask) {
+        e = &tk->ent[tk->slot[i] - 1];
+        if (e->hash == hash && e->keylen == keylen && memcmp(e->key, key, keylen) == 0)
+            break;
+    }
+
+    return i;
+}
+
+/* remove the slot at i and shift back the following ones off their home */
+static void topk_slot_del (TopK * tk, uint32 i)
+{
+    uint32  j, home;
+
+    for (j = i; ; ) {
+        j = (j + 1) & tk->mask;
+        if (!tk->slot[j]) break;
+
+        home = (uint32)tk->ent[tk->slot[j] - 1].hash & tk->mask;
+        if (((j - home) & tk->mask) >= ((j - i) & tk->mask)) {
+            tk->slot[i] = tk->slot[j];
+            i = j;
+        }
+    }
+
+    tk->slot[i] = 0;
+}
+
+static int topk_entry_key (TopKEntry * e, void * key, int keylen)
+{
+    uint8  * p = NULL;
+
+    if (keylen > e->keycap || !e->key) {
+        p = kalloc(keylen > 16 ? keylen : 16);
+        if (!p) return -1;
+
+        if (e->key) kfree(e->key);
+        e->key = p;
+        e->keycap = keylen > 16 ? keylen : 16;
+    }
+
+    memcpy(e->key, key, keylen);
+    e->keylen = keylen;
+    return 0;
+}
+
+static void topk_rebuild (TopK * tk)
+{
+    TopKEntry * e = NULL;
+    int         i;
+
+    memset(tk->slot, 0, (tk->mask + 1) * sizeof(uint32));
+    heap_zero(tk->heap);
+
+    for (i = 0; i < tk->num; i++) {
+        e = &tk->ent[i];
+        e->hash = wy_hash(e->key, e->keylen, tk->seed);
+        tk->slot[topk_slot_find(tk, e->key, e->keylen, e->hash)] = i + 1;
+        heap_push(tk->heap, e);
+    }
+}
+
+void * topk_new (int k)
+{
+    TopK   * tk = NULL;
+    uint32   size = 16;
+
+    if (k <= 0 || k > TOPK_MAXK) return NULL;
+
+    tk = kzalloc(sizeof(*tk));
+    if (!tk) return NULL;
+
+    tk->k = k;
+    tk->seed = hash_random_seed();
+
+    while (size < (uint32)k * 2) size <<= 1;
+    tk->mask = size - 1;
+
+    tk->ent = kzalloc(sizeof(TopKEntry) * k);
+    tk->slot = kzalloc(sizeof(uint32) * size);
+    tk->heap = heap_new(topk_cmp, k);
+    if (!tk->ent || !tk->slot || !tk->heap) {
+        topk_free(tk);
+        return NULL;
+    }
+    heap_set_index(tk->heap, offsetof(TopKEntry, heapidx));
+
+    return tk;
+}
+
+void topk_free (void * vtk)
+{
+    TopK  * tk = (TopK *)vtk;
+    int     i;
+
+    if (!tk) return;
+
+    if (tk->ent) {
+        for (i = 0; i < tk->k; i++) {
+            if (tk->ent[i].key) kfree(tk->ent[i].key);
+        }
+        kfree(tk->ent);
+    }
+
+    if (tk->slot) kfree(tk->slot);
+    if (tk->heap) heap_free(tk->heap);
+
+    kfree(tk);
+}
+
+void topk_zero (void * vtk)
+{
+    TopK  * tk = (TopK *)vtk;
+
+    if (!tk) return;
+
+    tk->num = 0;
+    tk->total = 0;
+
+    memset(tk->slot, 0, (tk->mask + 1) * sizeof(uint32));
+    heap_zero(tk->heap);
+}
+
+int topk_add (void * vtk, void * key, int keylen, uint64 count)
+{
+    TopK      * tk = (TopK *)vtk;
+    TopKEntry * e = NULL;
+    uint64      hash;
+    uint32      i;
+
+    if (!tk) return -1;
+    if (!key) return -2;
+    if (keylen < 0) keylen = strlen(key);
+
+    hash = wy_hash(key, keylen, tk->seed);
+
+    i = topk_slot_find(tk, key, keylen, hash);
+    if (tk->slot[i]) {
+        e = &tk->ent[tk->slot[i] - 1];
+        e->count += count;
+        tk->total += count;
+        heap_update(tk->heap, e->heapidx);
+        return 0;
+    }
+
+    if (tk->num < tk->k) {
+        e = &tk->ent[tk->num];
+        if (topk_entry_key(e, key, keylen) < 0) return -5;
+
+        e->hash = hash;
+        e->count = count;
+        e->error = 0;
+        tk->slot[i] = ++tk->num;
+        tk->total += count;
+
+        heap_push(tk->heap, e);
+        return 0;
+    }
+
+    /* the least counter is taken over by key */
+    e = heap_value(tk->heap, 0);
+    topk_slot_del(tk, topk_slot_find(tk, e->key, e->keylen, e->hash));
+
+    if (topk_entry_key(e, key, keylen) < 0) {
+        /* the old key is kept in the entry */
+        tk->slot[topk_slot_find(tk, e->key, e->keylen, e->hash)] = e - tk->ent + 1;
+        return -5;
+    }
+
+    e->hash = hash;
+    e->error = e->count;
+    e->count += count;
+    tk->total += count;
+
+    tk->slot[topk_slot_find(tk, key, keylen, hash)] = e - tk->ent + 1;
+    heap_update(tk->heap, e->heapidx);
+
+    return 0;
+}
+
+uint64 topk_count (void * vtk, void * key, int keylen, uint64 * perr)
+{
+    TopK      * tk = (TopK *)vtk;
+    TopKEntry * e = NULL;
+    uint32      i;
+
+    if (perr) *perr = 0;
+
+    if (!tk || !key) return 0;
+    if (keylen < 0) keylen = strlen(key);
+
+    i = topk_slot_find(tk, key, keylen, wy_hash(key, keylen, tk->seed));
+    if (!tk->slot[i]) return 0;
+
+    e = &tk->ent[tk->slot[i] - 1];
+    if (perr) *perr = e->error;
+
+    return e->count;
+}
+
+int topk_num (void * vtk)
+{
+    TopK  * tk = (TopK *)vtk;
+
+    if (!tk) return 0;
+
+    return tk->num;
+}
+
+uint64 topk_total (void * vtk)
+{
+    TopK  * tk = (TopK *)vtk;
+
+    if (!tk) return 0;
+
+    return tk->total;
+}
+
+static topk_item_t * topk_items (TopK * tk)
+{
+    topk_item_t * items = NULL;
+    int           i;
+
+    items = kalloc(sizeof(*items) * (tk->num + 1));
+    if (!items) return NULL;
+
+    for (i = 0; i < tk->num; i++) {
+        items[i].key = tk->ent[i].key;
+        items[i].keylen = tk->ent[i].keylen;
+        items[i].count = tk->ent[i].count;
+        items[i].error = tk->ent[i].error;
+    }
+
+    return items;
+}
+
+int topk_list (void * vtk, topk_item_t * items, int num)
+{
+    TopK        * tk = (TopK *)vtk;
+    topk_item_t * sorted = NULL;
+
+    if (!tk || !items || num <= 0) return 0;
+
+    sorted = topk_items(tk);
+    if (!sorted) return -5;
+
+    qsort(sorted, tk->num, sizeof(*sorted), topk_item_cmp);
+
+    if (num > tk->num) num = tk->num;
+    memcpy(items, sorted, sizeof(*items) * num);
+
+    kfree(sorted);
+    return num;
+}
+
+int topk_merge (void * vdst, void * vsrc)
+{
+    TopK        * dst = (TopK *)vdst;
+    TopK        * src = (TopK *)vsrc;
+    topk_item_t * cand = NULL;
+    TopKEntry   * ent = NULL;
+    TopKEntry   * e = NULL;
+    uint8       * seen = NULL;
+    uint64        dstmin = 0, srcmin = 0;
+    uint32        j;
+    int           i, num;
+
+    if (!dst || !src || dst == src) return -1;
+
+    if (src->num == 0) return 0;
+
+    if (dst->num >= dst->k) dstmin = ((TopKEntry *)heap_value(dst->heap, 0))->count;
+    if (src->num >= src->k) srcmin = ((TopKEntry *)heap_value(src->heap, 0))->count;
+
+    cand = kalloc(sizeof(*cand) * (dst->num + src->num));
+    seen = kzalloc(src->num);
+    ent = kzalloc(sizeof(TopKEntry) * dst->k);
+    if (!cand || !seen || !ent) goto nomem;
+
+    for (i = num = 0; i < dst->num; i++, num++) {
+        e = &dst->ent[i];
+        cand[num].key = e->key;
+        cand[num].keylen = e->keylen;
+        cand[num].count = e->count + srcmin;
+        cand[num].error = e->error + srcmin;
+
+        j = topk_slot_find(src, e->key, e->keylen, wy_hash(e->key, e->keylen, src->seed));
+        if (src->slot[j]) {
+            seen[src->slot[j] - 1] = 1;
+            cand[num].count = e->count + src->ent[src->slot[j] - 1].count;
+            cand[num].error = e->error + src->ent[src->slot[j] - 1].error;
+        }
+    }
+
+    for (i = 0; i < src->num; i++) {
+        if (seen[i]) continue;
+
+        e = &src->ent[i];
+        cand[num].key = e->key;
+        cand[num].keylen = e->keylen;
+        cand[num].count = e->count + dstmin;
+        cand[num].error = e->error + dstmin;
+        num++;
+    }
+
+    qsort(cand, num, sizeof(*cand), topk_item_cmp);
+    if (num > dst->k) num = dst->k;
+
+    for (i = 0; i < num; i++) {
+        if (topk_entry_key(&ent[i], cand[i].key, cand[i].keylen) < 0) goto nomem;
+        ent[i].count = cand[i].count;
+        ent[i].error = cand[i].error;
+    }
+
+    for (i = 0; i < dst->k; i++) {
+        if (dst->ent[i].key) kfree(dst->ent[i].key);
+    }
+    kfree(dst->ent);
+
+    dst->ent = ent;
+    dst->num = num;
+    dst->total += src->total;
+    topk_rebuild(dst);
+
+    kfree(cand);
+    kfree(seen);
+    return 0;
+
+nomem:
+    if (ent) {
+        for (i = 0; i < dst->k; i++) {
+            if (ent[i].key) kfree(ent[i].key);
+        }
+        kfree(ent);
+    }
+    if (cand) kfree(cand);
+    if (seen) kfree(seen);
+    return -5;
+}
+
+int64 topk_serial_size (void * vtk)
+{
+    TopK   * tk = (TopK *)vtk;
+    int64    size = 20;
+    int      i;
+
+    if (!tk) return 0;
+
+    for (i = 0; i < tk->num; i++)
+        size += 20 + tk->ent[i].keylen;
+
+    return size;
+}
+
+int64 topk_serialize (void * vtk, void * pbuf, int64 len)
+{
+    TopK      * tk = (TopK *)vtk;
+    TopKEntry * e = NULL;
+    uint8     * p = (uint8 *)pbuf;
+    int         i;
+
+    if (!tk || !pbuf) return -1;
+
+    if (len < topk_serial_size(tk)) return -100;
+
+    bytes_put32LE(p, TOPK_MAGIC);
+    bytes_put32LE(p + 4, (uint32)tk->k);
+    bytes_put32LE(p + 8, (uint32)tk->num);
+    bytes_put64LE(p + 12, tk->total);
+    p += 20;
+
+    for (i = 0; i < tk->num; i++) {
+        e = &tk->ent[i];
+        bytes_put64LE(p, e->count);
+        bytes_put64LE(p + 8, e->error);
+        bytes_put32LE(p + 16, (uint32)e->keylen);
+        memcpy(p + 20, e->key, e->keylen);
+        p += 20 + e->keylen;
+    }
+
+    return p - (uint8 *)pbuf;
+}
+
+void * topk_deserialize (void * pbuf, int64 len)
+{
+    TopK      * tk = NULL;
+    TopKEntry * e = NULL;
+    uint8     * p = (uint8 *)pbuf;
+    uint8     * pend = p + len;
+    uint32      k, num, keylen, i, j;
+
+    if (!pbuf || len < 20) return NULL;
+
+    if (bytes_uint32LE(p) != TOPK_MAGIC) return NULL;
+
+    k = bytes_uint32LE(p + 4);
+    num = bytes_uint32LE(p + 8);
+    if (k == 0 || k > TOPK_MAXK || num > k) return NULL;
+
+    tk = topk_new((int)k);
+    if (!tk) return NULL;
+
+    tk->total = bytes_uint64LE(p + 12);
+    p += 20;
+
+    for (i = 0; i < num; i++) {
+        if (pend - p < 20) goto bad;
+
+        keylen = bytes_uint32LE(p + 16);
+        if ((uint64)(pend - p - 20) < keylen) goto bad;
+
+        e = &tk->ent[i];
+        e->hash = wy_hash(p + 20, keylen, tk->seed);
+
+        j = topk_slot_find(tk, p + 20, keylen, e->hash);
+        if (tk->slot[j]) goto bad;
+
+        if (topk_entry_key(e, p + 20, keylen) < 0) goto bad;
+        e->count = bytes_uint64LE(p);
+        e->error = bytes_uint64LE(p + 8);
+        if (e->error > e->count) goto bad;
+
+        tk->slot[j] = ++tk->num;
+        heap_push(tk->heap, e);
+
+        p += 20 + keylen;
+    }
+
+    if (p != pend) goto bad;
+
+    return tk;
+
+bad:
+    topk_free(tk);
+    return NULL;
+}
+
+
+/* Count-Min sketch */
+
+typedef struct cms_s {
+    int        width;
+    int        depth;
+    uint64     total;
+    uint64   * cnt;
+} CMSketch;
+
+void * cms_new (int width, int depth)
+{
+    CMSketch * cm = NULL;
+
+    if (width <= 0 || depth <= 0 || depth > 64) return NULL;
+    if ((int64)width * depth > CMS_MAXCELL) return NULL;
+
+    cm = kzalloc(sizeof(*cm));
+    if (!cm) return NULL;
+
+    cm->width = width;
+    cm->depth = depth;
+
+    cm->cnt = kzalloc(sizeof(uint64) * width * depth);
+    if (!cm->cnt) {
+        kfree(cm);
+        return NULL;
+    }
+
+    return cm;
+}
+
+void cms_free (void * vcm)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+
+    if (!cm) return;
+
+    kfree(cm->cnt);
+    kfree(cm);
+}
+
+void cms_zero (void * vcm)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+
+    if (!cm) return;
+
+    cm->total = 0;
+    memset(cm->cnt, 0, sizeof(uint64) * cm->width * cm->depth);
+}
+
+/* the column of row i by the double hashing of one 64-bit hash, mapped
+ * into width by multiply and shift instead of modulo */
+#define cms_col(cm, a, b, i)  ((int)(((uint64)(uint32)((a) + (uint32)(i) * (b)) * (uint32)(cm)->width) >> 32))
+
+int cms_add (void * vcm, void * key, int keylen, uint64 count)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+    uint64     hash;
+    uint32     a, b;
+    int        i;
+
+    if (!cm) return -1;
+    if (!key) return -2;
+    if (keylen < 0) keylen = strlen(key);
+
+    hash = wy_hash(key, keylen, CMS_SEED);
+    a = (uint32)hash;
+    b = (uint32)(hash >> 32) | 1;
+
+    for (i = 0; i < cm->depth; i++)
+        cm->cnt[(int64)i * cm->width + cms_col(cm, a, b, i)] += count;
+
+    cm->total += count;
+    return 0;
+}
+
+uint64 cms_count (void * vcm, void * key, int keylen)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+    uint64     hash, val, minval = 0;
+    uint32     a, b;
+    int        i;
+
+    if (!cm || !key) return 0;
+    if (keylen < 0) keylen = strlen(key);
+
+    hash = wy_hash(key, keylen, CMS_SEED);
+    a = (uint32)hash;
+    b = (uint32)(hash >> 32) | 1;
+
+    for (i = 0; i < cm->depth; i++) {
+        val = cm->cnt[(int64)i * cm->width + cms_col(cm, a, b, i)];
+        if (i == 0 || val < minval) minval = val;
+    }
+
+    return minval;
+}
+
+uint64 cms_total (void * vcm)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+
+    if (!cm) return 0;
+
+    return cm->total;
+}
+
+int cms_merge (void * vdst, void * vsrc)
+{
+    CMSketch * dst = (CMSketch *)vdst;
+    CMSketch * src = (CMSketch *)vsrc;
+    int64      i, num;
+
+    if (!dst || !src || dst == src) return -1;
+
+    if (dst->width != src->width || dst->depth != src->depth) return -100;
+
+    num = (int64)dst->width * dst->depth;
+    for (i = 0; i < num; i++)
+        dst->cnt[i] += src->cnt[i];
+
+    dst->total += src->total;
+    return 0;
+}
+
+int64 cms_serial_size (void * vcm)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+
+    if (!cm) return 0;
+
+    return 20 + (int64)cm->width * cm->depth * 8;
+}
+
+int64 cms_serialize (void * vcm, void * pbuf, int64 len)
+{
+    CMSketch * cm = (CMSketch *)vcm;
+    uint8    * p = (uint8 *)pbuf;
+    int64      i, num;
+
+    if (!cm || !pbuf) return -1;
+
+    if (len < cms_serial_size(cm)) return -100;
+
+    bytes_put32LE(p, CMS_MAGIC);
+    bytes_put32LE(p + 4, (uint32)cm->width);
+    bytes_put32LE(p + 8, (uint32)cm->depth);
+    bytes_put64LE(p + 12, cm->total);
+    p += 20;
+
+    num = (int64)cm->width * cm->depth;
+    for (i = 0; i < num; i++, p += 8)
+        bytes_put64LE(p, cm->cnt[i]);
+
+    return p - (uint8 *)pbuf;
+}
+
+void * cms_deserialize (void * pbuf, int64 len)
+{
+    CMSketch * cm = NULL;
+    uint8    * p = (uint8 *)pbuf;
+    uint32     width, depth;
+    int64      i, num;
+
+    if (!pbuf || len < 20) return NULL;
+
+    if (bytes_uint32LE(p) != CMS_MAGIC) return NULL;
+
+    width = bytes_uint32LE(p + 4);
+    depth = bytes_uint32LE(p + 8);
+    if (width == 0 || width > CMS_MAXCELL || depth == 0 || depth > 64) return NULL;
+
+    num = (int64)width * depth;
+    if (len != 20 + num * 8) return NULL;
+
+    cm = cms_new((int)width, (int)depth);
+    if (!cm) return NULL;
+
+    cm->total = bytes_uint64LE(p + 12);
+    p += 20;
+
+    for (i = 0; i < num; i++, p += 8)
+        cm->cnt[i] = bytes_uint64LE(p);
+
+    return cm;
+}
+
+
+/* merging t-digest */
+
+typedef struct td_centroid {
+    double     mean;
+    double     weight;
+} TDCentroid;
+
+typedef struct tdigest_s {
+    double       compression;
+    double       total;      //weight in the centroids
+    double       unmerged;   //weight in the buffer
+    double       min;
+    double       max;
+
+    TDCentroid * cent;
+    int          num;
+    int          cap;
+
+    /* values added since the last merge */
+    TDCentroid * buf;
+    int          bufnum;
+    int          bufcap;
+
+    TDCentroid * tmp;
+} TDigest;
+
+/* quick sort by mean with the compares inlined, insertion sort for the
+ * short ranges, recursing into the smaller part */
+static void td_sort (TDCentroid * a, int n)
+{
+    TDCentroid  t;
+    double      pivot;
+    int         i, j;
+
+    while (n > 16) {
+        i = n / 2;
+        if (a[i].mean < a[0].mean) { t = a[i]; a[i] = a[0]; a[0] = t; }
+        if (a[n - 1].mean < a[0].mean) { t = a[n - 1]; a[n - 1] = a[0]; a[0] = t; }
+        if (a[n - 1].mean < a[i].mean) { t = a[n - 1]; a[n - 1] = a[i]; a[i] = t; }
+        pivot = a[i].mean;
+
+        for (i = 0, j = n - 1; ; i++, j--) {
+            while (a[i].mean < pivot) i++;
+            while (a[j].mean > pivot) j--;
+            if (i >= j) break;
+            t = a[i]; a[i] = a[j]; a[j] = t;
+        }
+
+        if (j + 1 < n - j - 1) {
+            td_sort(a, j + 1);
+            a += j + 1; n -= j + 1;
+        } else {
+            td_sort(a + j + 1, n - j - 1);
+            n = j + 1;
+        }
+    }
+
+    for (i = 1; i < n; i++) {
+        t = a[i];
+        for (j = i; j > 0 && a[j - 1].mean > t.mean; j--) a[j] = a[j - 1];
+        a[j] = t;
+    }
+}
+
+/* the quantile a centroid starting at q may reach, one step of the scale
+ * k(q) = compression / (2 pi) * asin(2q - 1) */
+static double td_qlimit (TDigest * td, double q)
+{
+    double  k;
+
+    k = td->compression / (2 * M_PI) * asin(2 * q - 1 < -1 ? -1 : (2 * q - 1 > 1 ? 1 : 2 * q - 1));
+    k += 1;
+    if (k >= td->compression / 4) return 1;
+
+    return (sin(k * 2 * M_PI / td->compression) + 1) / 2;
+}
+
+static void td_compress (TDigest * td)
+{
+    TDCentroid   cur;
+    double       total, sofar, limit;
+    int          i, j, n, out;
+
+    if (td->bufnum == 0) return;
+
+    td_sort(td->buf, td->bufnum);
+
+    for (i = j = n = 0; i < td->num || j < td->bufnum; n++) {
+        if (j >= td->bufnum || (i < td->num && td->cent[i].mean <= td->buf[j].mean))
+            td->tmp[n] = td->cent[i++];
+        else
+            td->tmp[n] = td->buf[j++];
+    }
+
+    total = td->total + td->unmerged;
+    sofar = 0;
+    limit = total * td_qlimit(td, 0);
+
+    cur = td->tmp[0];
+    for (i = 1, out = 0; i < n; i++) {
+        if (sofar + cur.weight + td->tmp[i].weight <= limit || out >= td->cap - 1) {
+            cur.weight += td->tmp[i].weight;
+            cur.mean += (td->tmp[i].mean - cur.mean) * td->tmp[i].weight / cur.weight;
+            continue;
+        }
+
+        td->cent[out++] = cur;
+        sofar += cur.weight;
+        limit = total * td_qlimit(td, sofar / total);
+        cur = td->tmp[i];
+    }
+    td->cent[out++] = cur;
+
+    td->num = out;
+    td->total = total;
+    td->unmerged = 0;
+    td->bufnum = 0;
+}
+
+void * tdigest_new (double compression)
+{
+    TDigest * td = NULL;
+
+    if (isnan(compression) || compression <= 0) compression = 100;
+    if (compression < 10) compression = 10;
+    if (compression > 100000) return NULL;
+
+    td = kzalloc(sizeof(*td));
+    if (!td) return NULL;
+
+    td->compression = compression;
+
+    /* the arcsine scale spans compression / 2, any two adjacent centroids
+     * span more than 1 of it */
+    td->cap = (int)ceil(compression) + 8;
+    td->bufcap = (int)ceil(compression) * 5;
+
+    td->cent = kalloc(sizeof(TDCentroid) * td->cap);
+    td->buf = kalloc(sizeof(TDCentroid) * td->bufcap);
+    td->tmp = kalloc(sizeof(TDCentroid) * (td->cap + td->bufcap));
+    if (!td->cent || !td->buf || !td->tmp) {
+        tdigest_free(td);
+        return NULL;
+    }
+
+    return td;
+}
+
+void tdigest_free (void * vtd)
+{
+    TDigest * td = (TDigest *)vtd;
+
+    if (!td) return;
+
+    if (td->cent) kfree(td->cent);
+    if (td->buf) kfree(td->buf);
+    if (td->tmp) kfree(td->tmp);
+
+    kfree(td);
+}
+
+void tdigest_zero (void * vtd)
+{
+    TDigest * td = (TDigest *)vtd;
+
+    if (!td) return;
+
+    td->total = td->unmerged = 0;
+    td->min = td->max = 0;
+    td->num = td->bufnum = 0;
+}
+
+int tdigest_add (void * vtd, double value, double weight)
+{
+    TDigest * td = (TDigest *)vtd;
+
+    if (!td) return -1;
+
+    if (isnan(value) || !(weight > 0)) return -2;
+
+    if (td->total + td->unmerged == 0) {
+        td->min = td->max = value;
+    } else {
+        if (value < td->min) td->min = value;
+        if (value > td->max) td->max = value;
+    }
+
+    if (td->bufnum >= td->bufcap) td_compress(td);
+
+    td->buf[td->bufnum].mean = value;
+    td->buf[td->bufnum].weight = weight;
+    td->bufnum++;
+    td->unmerged += weight;
+
+    return 0;
+}
+
+double tdigest_quantile (void * vtd, double q)
+{
+    TDigest    * td = (TDigest *)vtd;
+    TDCentroid * c = NULL;
+    double       index, cum, gap;
+    int          i;
+
+    if (!td) return 0;
+
+    td_compress(td);
+    if (td->num == 0) return 0;
+
+    if (q <= 0) return td->min;
+    if (q >= 1) return td->max;
+
+    index = q * td->total;
+    c = td->cent;
+
+    /* from the minimum to the center of the first centroid */
+    if (index < c[0].weight / 2)
+        return td->min + index / (c[0].weight / 2) * (c[0].mean - td->min);
+
+    /* between the centers of two adjacent centroids */
+    for (i = 0, cum = c[0].weight / 2; i < td->num - 1; i++, cum += gap) {
+        gap = (c[i].weight + c[i + 1].weight) / 2;
+        if (index < cum + gap)
+            return c[i].mean + (index - cum) / gap * (c[i + 1].mean - c[i].mean);
+    }
+
+    /* from the center of the last centroid to the maximum */
+    c = &td->cent[td->num - 1];
+    index = (index - cum) / (c->weight / 2);
+    if (index > 1) index = 1;
+
+    return c->mean + index * (td->max - c->mean);
+}
+
+double tdigest_cdf (void * vtd, double value)
+{
+    TDigest    * td = (TDigest *)vtd;
+    TDCentroid * c = NULL;
+    double       cum, gap;
+    int          i;
+
+    if (!td) return 0;
+
+    td_compress(td);
+    if (td->num == 0) return 0;
+
+    if (value < td->min) return 0;
+    if (value >= td->max) return 1;
+
+    c = td->cent;
+
+    if (value < c[0].mean)
+        return c[0].weight / 2 * (value - td->min) / (c[0].mean - td->min) / td->total;
+
+    for (i = 0, cum = c[0].weight / 2; i < td->num - 1; i++, cum += gap) {
+        gap = (c[i].weight + c[i + 1].weight) / 2;
+        if (value < c[i + 1].mean)
+            return (cum + (value - c[i].mean) / (c[i + 1].mean - c[i].mean) * gap) / td->total;
+    }
+
+    c = &td->cent[td->num - 1];
+    return (cum + (value - c->mean) / (td->max - c->mean) * c->weight / 2) / td->total;
+}
+
+double tdigest_count (void * vtd)
+{
+    TDigest * td = (TDigest *)vtd;
+
+    if (!td) return 0;
+
+    return td->total + td->unmerged;
+}
+
+static void td_add_centroid (TDigest * td, double mean, double weight)
+{
+    if (td->bufnum >= td->bufcap) td_compress(td);
+
+    td->buf[td->bufnum].mean = mean;
+    td->buf[td->bufnum].weight = weight;
+    td->bufnum++;
+    td->unmerged += weight;
+}
+
+int tdigest_merge (void * vdst, void * vsrc)
+{
+    TDigest * dst = (TDigest *)vdst;
+    TDigest * src = (TDigest *)vsrc;
+    int       i;
+
+    if (!dst || !src || dst == src) return -1;
+
+    if (src->total + src->unmerged == 0) return 0;
+
+    if (dst->total + dst->unmerged == 0) {
+        dst->min = src->min;
+        dst->max = src->max;
+    } else {
+        if (src->min < dst->min) dst->min = src->min;
+        if (src->max > dst->max) dst->max = src->max;
+    }
+
+    for (i = 0; i < src->num; i++)
+        td_add_centroid(dst, src->cent[i].mean, src->cent[i].weight);
+
+    for (i = 0; i < src->bufnum; i++)
+        td_add_centroid(dst, src->buf[i].mean, src->buf[i].weight);
+
+    return 0;
+}
+
+int64 tdigest_serial_size (void * vtd)
+{
+    TDigest * td = (TDigest *)vtd;
+
+    if (!td) return 0;
+
+    td_compress(td);
+
+    return 32 + (int64)td->num * 16;
+}
+
+int64 tdigest_serialize (void * vtd, void * pbuf, int64 len)
+{
+    TDigest * td = (TDigest *)vtd;
+    uint8   * p = (uint8 *)pbuf;
+    int       i;
+
+    if (!td || !pbuf) return -1;
+
+    if (len < tdigest_serial_size(td)) return -100;
+
+    bytes_put32LE(p, TD_MAGIC);
+    bytes_put32LE(p + 4, (uint32)td->num);
+    sk_put_double(p + 8, td->compression);
+    sk_put_double(p + 16, td->min);
+    sk_put_double(p + 24, td->max);
+    p += 32;
+
+    for (i = 0; i < td->num; i++, p += 16) {
+        sk_put_double(p, td->cent[i].mean);
+        sk_put_double(p + 8, td->cent[i].weight);
+    }
+
+    return p - (uint8 *)pbuf;
+}
+
+void * tdigest_deserialize (void * pbuf, int64 len)
+{
+    TDigest * td = NULL;
+    uint8   * p = (uint8 *)pbuf;
+    double    mean, weight;
+    uint32    num, i;
+
+    if (!pbuf || len < 32) return NULL;
+
+    if (bytes_uint32LE(p) != TD_MAGIC) return NULL;
+
+    num = bytes_uint32LE(p + 4);
+    if (len != 32 + (int64)num * 16) return NULL;
+
+    td = tdigest_new(sk_get_double(p + 8));
+    if (!td) return NULL;
+
+    if (num > (uint32)td->cap) goto bad;
+
+    td->min = sk_get_double(p + 16);
+    td->max = sk_get_double(p + 24);
+    if (num > 0 && !(td->min <= td->max)) goto bad;
+    p += 32;
+
+    for (i = 0; i < num; i++, p += 16) {
+        mean = sk_get_double(p);
+        weight = sk_get_double(p + 8);
+
+        if (!(weight > 0) || !(mean >= td->min && mean <= td->max)) goto bad;
+        if (i > 0 && mean < td->cent[i - 1].mean) goto bad;
+
+        td->cent[i].mean = mean;
+        td->cent[i].weight = weight;
+        td->total += weight;
+    }
+    td->num = num;
+
+    return td;
+
+bad:
+    tdigest_free(td);
+    return NULL;
+}
+
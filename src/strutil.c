@@ -7,9 +7,11 @@
 #include "strutil.h"
 #include "memory.h"
 #include "patmat.h"
+#include "frame.h"
+#include "charconv.h"
+#include "btime.h"
 
 #ifdef UNIX
-#include <iconv.h>
 #include <ctype.h>
 #include <sys/time.h>
 #endif
@@ -20,6 +22,14 @@
 #include <WinNT.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 
 #ifdef _WIN32
 void ansi_2_unicode(wchar_t * wcrt, char * pstr)
@@ -297,16 +307,13 @@ void * str_str2 (void * vstr, int len, void * vsub, int sublen)
     return NULL;
 }
 
+/* the search is done by pat_find, it picks the SIMD filter for short
+ * patterns and Sunday or Boyer-Moore for long ones */
 void * str_str (void * vstr, int len, void * vsub, int sublen)
 {
     uint8 * pstr = (uint8 *)vstr;
     uint8 * psub = (uint8 *)vsub;
 
-    int     BASE = 1000000;
-    int     i, power = 1;
-    int     code = 0;
-    int     hash = 0;
-
     if (!pstr) return NULL;
     if (len < 0) len = str_len(pstr);
 
@@ -314,30 +321,9 @@ void * str_str (void * vstr, int len, void * vsub, int sublen)
     if (sublen < 0) sublen = str_len(psub);
 
     if (len < sublen) return NULL;
+    if (sublen == 0) return pstr;
 
-    for (i = 0; i < sublen; i++) {
-        power = (power * 31) % BASE;
-    }
-
-    for (i = 0; i < sublen; i++) {
-        code = (code * 31 + psub[i]) % BASE;
-    }
-
-    for (i = 0; i < len; i++) {
-        hash = (hash * 31 + pstr[i]) % BASE;
-        if (i < sublen - 1) continue;
-
-        if (i >= sublen) {
-            hash = hash - (pstr[i - sublen] * power) % BASE;
-            if (hash < 0) hash += BASE;
-        }
-
-        if (hash == code) {
-            if (memcmp(pstr + i - sublen + 1, psub, sublen) == 0)
-                return pstr + i - sublen + 1;
-        }
-    }
-    return NULL;
+    return pat_find(pstr, len, psub, sublen);
 }
 
 
@@ -607,6 +593,155 @@ int str_hextou (void * p, int len, uint32 * pval)
     return i;
 }
 
+/* the calendar arithmetic of proleptic Gregorian days since 1970-01-01,
+ * in place of gmtime and mktime which take locks and the time zone */
+static int64 days_from_civil (int y, int m, int d)
+{
+    int64  era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days (int64 z, int * py, int * pm, int * pd)
+{
+    int64  era, doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+
+    *pd = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *pm = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *py = (int)(yoe + era * 400 + (*pm <= 2));
+}
+
+/* the month of the 3 letters at p in any case, or -1 */
+static int month_of (uint8 * p)
+{
+    static uint32 mon[12] = {
+        'j'<<16|'a'<<8|'n', 'f'<<16|'e'<<8|'b', 'm'<<16|'a'<<8|'r',
+        'a'<<16|'p'<<8|'r', 'm'<<16|'a'<<8|'y', 'j'<<16|'u'<<8|'n',
+        'j'<<16|'u'<<8|'l', 'a'<<16|'u'<<8|'g', 's'<<16|'e'<<8|'p',
+        'o'<<16|'c'<<8|'t', 'n'<<16|'o'<<8|'v', 'd'<<16|'e'<<8|'c' };
+    uint32  v;
+    int     i;
+
+    v = (uint32)(p[0] | 0x20) << 16 | (p[1] | 0x20) << 8 | (p[2] | 0x20);
+
+    for (i = 0; i < 12; i++) {
+        if (mon[i] == v) return i;
+    }
+
+    return -1;
+}
+
+#define DIG2(p)  (((p)[0] - '0') * 10 + (p)[1] - '0')
+#define ISDIG(c) ((uint8)((c) - '0') <= 9)
+
+/* the fixed layouts of HTTP-date in RFC 7231, parsed by the positions:
+     RFC1123:  Sun, 06 Nov 1994 08:49:37 GMT
+     RFC850:   Sunday, 06-Nov-94 08:49:37 GMT
+     asctime:  Sun Nov  6 08:49:37 1994
+   return the bytes parsed, or -1 if p is not one of them */
+static int str_httpdate_parse (uint8 * p, int len, time_t * ptm)
+{
+    uint8  * pbgn = p;
+    uint8  * pend = p + len;
+    int      year, mon, day, hour, min, sec;
+    int      i, tail;
+
+    while (pbgn < pend && (*pbgn == ' ' || *pbgn == '\t')) pbgn++;
+
+    /* the weekday name is not checked, it adds nothing to the time */
+    for (i = 0; pbgn + i < pend && i < 10 && ((pbgn[i] | 0x20) >= 'a' && (pbgn[i] | 0x20) <= 'z'); i++);
+    if (i < 3 || pbgn + i >= pend) return -1;
+
+    if (pbgn[i] == ',' && i == 3) {
+        p = pbgn + i;
+        if (pend - p < 26 || memcmp(p, ", ", 2) != 0 || p[4] != ' ' || p[8] != ' ' ||
+            p[13] != ' ' || p[16] != ':' || p[19] != ':' || p[22] != ' ' ||
+            strncasecmp((char *)p + 23, "GMT", 3) != 0)
+            return -1;
+
+        if (!ISDIG(p[2]) || !ISDIG(p[3]) || !ISDIG(p[9]) || !ISDIG(p[10]) ||
+            !ISDIG(p[11]) || !ISDIG(p[12]))
+            return -1;
+
+        day = DIG2(p + 2);
+        mon = month_of(p + 5);
+        year = DIG2(p + 9) * 100 + DIG2(p + 11);
+        p += 14; tail = 12;
+
+    } else if (pbgn[i] == ',') {
+        /* the year of 2 digits, or 4 digits as str_time2gmt writes */
+        p = pbgn + i;
+        if (pend - p < 24 || p[1] != ' ' || p[4] != '-' || p[8] != '-' ||
+            !ISDIG(p[2]) || !ISDIG(p[3]) || !ISDIG(p[9]) || !ISDIG(p[10]))
+            return -1;
+
+        day = DIG2(p + 2);
+        mon = month_of(p + 5);
+        year = DIG2(p + 9);
+
+        if (p[11] != ' ') {
+            if (pend - p < 26 || !ISDIG(p[11]) || !ISDIG(p[12])) return -1;
+            year = year * 100 + DIG2(p + 11);
+            p += 2;
+        } else
+            year += year < 70 ? 2000 : 1900;
+
+        if (p[11] != ' ' || p[14] != ':' || p[17] != ':' || p[20] != ' ' ||
+            strncasecmp((char *)p + 21, "GMT", 3) != 0)
+            return -1;
+
+        p += 12; tail = 12;
+
+    } else if (pbgn[i] == ' ' && i == 3) {
+        p = pbgn + i;
+        if (pend - p < 21 || p[4] != ' ' || p[7] != ' ' || p[10] != ':' ||
+            p[13] != ':' || p[16] != ' ')
+            return -1;
+
+        if (!ISDIG(p[6]) || (p[5] != ' ' && !ISDIG(p[5])) || !ISDIG(p[17]) ||
+            !ISDIG(p[18]) || !ISDIG(p[19]) || !ISDIG(p[20]))
+            return -1;
+
+        day = (p[5] == ' ' ? 0 : (p[5] - '0') * 10) + p[6] - '0';
+        mon = month_of(p + 1);
+        year = DIG2(p + 17) * 100 + DIG2(p + 19);
+        p += 8; tail = 13;
+
+    } else
+        return -1;
+
+    /* hh:mm:ss at p */
+    if (!ISDIG(p[0]) || !ISDIG(p[1]) || !ISDIG(p[3]) || !ISDIG(p[4]) ||
+        !ISDIG(p[6]) || !ISDIG(p[7]))
+        return -1;
+
+    hour = DIG2(p);
+    min = DIG2(p + 3);
+    sec = DIG2(p + 6);
+
+    if (mon < 0 || day < 1 || day > 31 || year < 1970 || hour > 23 || min > 59 || sec > 60)
+        return -1;
+
+    if (ptm) *ptm = (time_t)(days_from_civil(year, mon + 1, day) * 86400 +
+                             hour * 3600 + min * 60 + sec);
+
+    /* RFC1123 and RFC850 end at GMT, asctime at the year */
+    return (int)(p + tail - (pend - len));
+}
+
 /* 2004-12-08 17:45:56+08
    Mon, 04 Jul 2050 07:07:07 GMT
    Mon, 24 Feb 2003 03:53:54 GMT       <=== subfmt=0 fmt=0 RFC1123 updated from RFC822
@@ -634,6 +769,10 @@ int str_gmt2time (void * p, int timelen, time_t * ptm)
     if (!ptime) return -1;
     if (timelen < 0) timelen = str_len(ptime);
     if (timelen <= 0) return -2;
+
+    /* the HTTP-date of If-Modified-Since etc. goes without mktime */
+    if ((i = str_httpdate_parse((uint8 *)ptime, timelen, ptm)) > 0)
+        return i;
  
     time(&tick);
     ts = *localtime(&tick);
@@ -825,38 +964,61 @@ int str_gmt2time (void * p, int timelen, time_t * ptm)
 int str_time2gmt (time_t * ptm, void * gmtbuf, int len, int fmt)
 {
     char        * timbuf = (char *)gmtbuf;
-    time_t        tick;
-    struct tm     gmtval;
+    char        * pcache = NULL;
+    int64         tick, days;
+    int           year, mon, day, wday, secs;
+    int           n;
     static char * monthname[12] = {
                        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
     static char * weekname[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
     static char * weekname2[7] = {"Sunday", "Monday", "Tuesday", "Wednesday",
                                   "Thursday", "Friday", "Saturday"};
+    char        * p = NULL;
 
  
     if (!timbuf || len < 36) return -1;
  
     memset(timbuf, 0, 36);
  
-    if (!ptm) {
-        tick = time(0);
-        ptm = &tick;
+    /* the current time is formatted once per second */
+    if (!ptm && fmt == 0) {
+        pcache = btime_gmtstr(&n);
+        memcpy(timbuf, pcache, n);
+        return 0;
     }
-    gmtval = *gmtime(ptm);
- 
+
+    tick = ptm ? (int64)*ptm : (int64)time(0);
+
+    days = tick / 86400;
+    secs = (int)(tick % 86400);
+    if (secs < 0) { secs += 86400; days--; }
+
+    civil_from_days(days, &year, &mon, &day);
+    wday = (int)((days % 7 + 11) % 7);  //1970-01-01 is Thursday
+
+    p = timbuf;
     if (fmt == 0) {
-        sprintf(timbuf, "%s, %02d %s %4d %02d:%02d:%02d GMT",
-                weekname[gmtval.tm_wday], gmtval.tm_mday,
-                monthname[gmtval.tm_mon], gmtval.tm_year + 1900,
-                gmtval.tm_hour, gmtval.tm_min, gmtval.tm_sec);
+        memcpy(p, weekname[wday], 3);  p += 3;
+        *p++ = ','; *p++ = ' ';
+        *p++ = '0' + day / 10; *p++ = '0' + day % 10; *p++ = ' ';
+        memcpy(p, monthname[mon - 1], 3); p += 3; *p++ = ' ';
     } else {
-        sprintf(timbuf, "%s, %02d-%s-%4d %02d:%02d:%02d GMT",
-                weekname2[gmtval.tm_wday], gmtval.tm_mday,
-                monthname[gmtval.tm_mon], gmtval.tm_year + 1900,
-                gmtval.tm_hour, gmtval.tm_min, gmtval.tm_sec);
-
+        n = str_len(weekname2[wday]);
+        memcpy(p, weekname2[wday], n);  p += n;
+        *p++ = ','; *p++ = ' ';
+        *p++ = '0' + day / 10; *p++ = '0' + day % 10; *p++ = '-';
+        memcpy(p, monthname[mon - 1], 3); p += 3; *p++ = '-';
     }
+
+    if (year < 0 || year > 9999) return -2;
+
+    *p++ = '0' + year / 1000; *p++ = '0' + year / 100 % 10;
+    *p++ = '0' + year / 10 % 10; *p++ = '0' + year % 10; *p++ = ' ';
+    *p++ = '0' + secs / 36000; *p++ = '0' + secs / 3600 % 10; *p++ = ':';
+    *p++ = '0' + secs / 600 % 6; *p++ = '0' + secs / 60 % 10; *p++ = ':';
+    *p++ = '0' + secs % 60 / 10; *p++ = '0' + secs % 10;
+    memcpy(p, " GMT", 4);
  
     return 0;
 }
@@ -872,6 +1034,11 @@ int str_datetime (time_t * ptm, void * dtbuf, int len, int fmt)
 
     memset(timbuf, 0, 20);
 
+    if (!ptm && fmt == 0) {
+        memcpy(timbuf, btime_localstr(NULL), 19);
+        return 0;
+    }
+
     if (!ptm) {
         time(&curt);
         ptm = &curt;
@@ -967,40 +1134,12 @@ void * str_rk_find (void * pbyte, int len, void * pattern, int patlen)
 
 void * str_find_bytes (void * pbyte, int len, void * pattern, int patlen)
 {
-    uint8 * pstr = (uint8 *)pbyte;
-    uint8 * pat = (uint8 *)pattern;
-    int     i, pos;
-    uint8 * p = NULL;
-
-    if (!pstr || len <= 0 || !pat || patlen <= 0) 
+    if (!pbyte || len <= 0 || !pattern || patlen <= 0)
         return NULL;
 
     if (patlen > len) return NULL;
 
-    pos = 0;
-
-    do {
-        p = memchr (pstr + pos, pat[0], len - pos);
-        if (!p) return NULL;
-
-        if (patlen > 1) {
-            for (i = 1; i < patlen; i++) {
-                if (pat[i] != p[i]) break;
-            }
-            if (i >= patlen) return p; /*match the string*/
-            else pos = (int)(p - pstr + 1);  /*do not match*/
-
-            /**************************************
-            if (memcmp(&pat[1], &p[1], patlen-1) == 0)
-                return p;
-            else
-                pos = p - pstr + 1;
-            **************************************/
-        } else
-            return p;
-    } while (pos <= len - patlen);
-
-    return NULL;
+    return pat_find(pbyte, len, pattern, patlen);
 }
 
 
@@ -1035,6 +1174,533 @@ void * str_rfind_bytes (void * pbyte, int pos, void * pattern, int patlen)
 }
 
 
+/* vector kernels of the hex and base64 codecs. each kernel converts the
+ * whole blocks at the head of the input and returns the input bytes
+ * consumed, the tail is left to the scalar loop. the x86 kernels are
+ * compiled for SSSE3 and AVX2 by target attributes and selected at runtime,
+ * the NEON kernels are built on aarch64 where NEON is always present.
+ * base64 follows the shuffle/multiply-add scheme of Mula and Lemire */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define CODEC_X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define CODEC_NEON 1
+#endif
+
+static const uint8 base64_chars[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef CODEC_X86_DISPATCH
+
+#define CODEC_SCALAR  0
+#define CODEC_SSSE3   1
+#define CODEC_AVX2    2
+
+static int codec_level = -1;
+
+static int codec_simd_level ()
+{
+    int  level = __atomic_load_n(&codec_level, __ATOMIC_RELAXED);
+
+    if (level >= 0) return level;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) level = CODEC_AVX2;
+    else if (__builtin_cpu_supports("ssse3")) level = CODEC_SSSE3;
+    else level = CODEC_SCALAR;
+
+    __atomic_store_n(&codec_level, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+/* 12 bytes in the low 3/4 of in to 16 6-bit indice */
+__attribute__((target("ssse3")))
+static inline __m128i b64_enc_reshuffle (__m128i in)
+{
+    __m128i  t0, t1, t2, t3;
+
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(t1, t3);
+}
+
+/* the offset from index to char is picked by the range of index */
+__attribute__((target("ssse3")))
+static inline __m128i b64_enc_translate (__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                                      -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i  idx;
+
+    idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    idx = _mm_sub_epi8(idx, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+__attribute__((target("ssse3")))
+static int b64_enc_ssse3 (uint8 * src, int len, uint8 * dst)
+{
+    __m128i  v;
+    int      i = 0;
+
+    for ( ; i + 16 <= len; i += 12, dst += 16) {
+        v = _mm_loadu_si128((__m128i *)(src + i));
+        v = b64_enc_translate(b64_enc_reshuffle(v));
+        _mm_storeu_si128((__m128i *)dst, v);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int b64_enc_avx2 (uint8 * src, int len, uint8 * dst)
+{
+    const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                                         -4, -4, -4, -4, -19, -16, 0, 0,
+                                         65, 71, -4, -4, -4, -4, -4, -4,
+                                         -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i  v, t0, t1, t2, t3, idx;
+    int      i = 0;
+
+    /* 12 bytes in each 128-bit lane */
+    for ( ; i + 28 <= len; i += 24, dst += 32) {
+        v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)(src + i))),
+                _mm_loadu_si128((__m128i *)(src + i + 12)), 1);
+
+        v = _mm256_shuffle_epi8(v, _mm256_set_epi8(
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+        t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t1, t3);
+
+        idx = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        idx = _mm256_sub_epi8(idx, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25)));
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, idx));
+
+        _mm256_storeu_si256((__m256i *)dst, v);
+    }
+
+    return i + b64_enc_ssse3(src + i, len - i, dst);
+}
+
+/* the chars not of the alphabet, including '=' and the spaces, make the
+   kernel stop at the block containing them. dst has room bytes writable */
+__attribute__((target("ssse3")))
+static int b64_dec_ssse3 (uint8 * src, int len, uint8 * dst, int room)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    __m128i  v, hi_nib, lo_nib, hi, lo, roll;
+    int      i = 0;
+
+    for ( ; i + 16 <= len && room >= 16; i += 16, dst += 12, room -= 12) {
+        v = _mm_loadu_si128((__m128i *)(src + i));
+
+        hi_nib = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+        lo_nib = _mm_and_si128(v, mask_2f);
+        hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+        lo = _mm_shuffle_epi8(lut_lo, lo_nib);
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+            break;
+
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nib));
+        v = _mm_add_epi8(v, roll);
+
+        /* pack 4 x 6 bits into 3 bytes */
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                              -1, -1, -1, -1));
+
+        _mm_storeu_si128((__m128i *)dst, v);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int b64_dec_avx2 (uint8 * src, int len, uint8 * dst, int room)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+    __m256i  v, hi_nib, lo_nib, hi, lo, roll;
+    int      i = 0;
+
+    for ( ; i + 32 <= len && room >= 32; i += 32, dst += 24, room -= 24) {
+        v = _mm256_loadu_si256((__m256i *)(src + i));
+
+        hi_nib = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+        lo_nib = _mm256_and_si256(v, mask_2f);
+        hi = _mm256_shuffle_epi8(lut_hi, hi_nib);
+        lo = _mm256_shuffle_epi8(lut_lo, lo_nib);
+
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask_2f), hi_nib));
+        v = _mm256_add_epi8(v, roll);
+
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+        /* join the 12 bytes of both lanes */
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+        _mm256_storeu_si256((__m256i *)dst, v);
+    }
+
+    return i + b64_dec_ssse3(src + i, len - i, dst, room);
+}
+
+__attribute__((target("ssse3")))
+static int hex_enc_ssse3 (uint8 * src, int len, uint8 * dst, int upper)
+{
+    const __m128i lut = upper ? _mm_loadu_si128((__m128i *)"0123456789ABCDEF")
+                              : _mm_loadu_si128((__m128i *)"0123456789abcdef");
+    const __m128i mask_0f = _mm_set1_epi8(0x0F);
+    __m128i  v, hi, lo;
+    int      i = 0;
+
+    for ( ; i + 16 <= len; i += 16, dst += 32) {
+        v = _mm_loadu_si128((__m128i *)(src + i));
+
+        hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask_0f));
+        lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask_0f));
+
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int hex_enc_avx2 (uint8 * src, int len, uint8 * dst, int upper)
+{
+    const __m256i lut = upper ? _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)"0123456789ABCDEF"))
+                              : _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)"0123456789abcdef"));
+    const __m256i mask_0f = _mm256_set1_epi8(0x0F);
+    __m256i  v, hi, lo;
+    int      i = 0;
+
+    for ( ; i + 32 <= len; i += 32, dst += 64) {
+        /* quadwords 0 2 1 3, so that the in-lane unpacking keeps order */
+        v = _mm256_loadu_si256((__m256i *)(src + i));
+        v = _mm256_permute4x64_epi64(v, 0xD8);
+
+        hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask_0f));
+        lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask_0f));
+
+        _mm256_storeu_si256((__m256i *)dst, _mm256_unpacklo_epi8(hi, lo));
+        _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_unpackhi_epi8(hi, lo));
+    }
+
+    return i + hex_enc_ssse3(src + i, len - i, dst, upper);
+}
+
+/* hex chars to nibbles, all bits of *bad set if any is not a hex digit */
+__attribute__((target("ssse3")))
+static inline __m128i hex_dec_nibble (__m128i v, __m128i * bad)
+{
+    __m128i  d, l, isd, isl;
+
+    d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+    isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+    *bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(isd, isl), _mm_set1_epi8(-1)));
+
+    return _mm_or_si128(_mm_and_si128(isd, d),
+                        _mm_and_si128(isl, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3")))
+static int hex_dec_ssse3 (uint8 * src, int len, uint8 * dst)
+{
+    const __m128i weight = _mm_set1_epi16(0x0110);
+    __m128i  a, b, bad;
+    int      i = 0;
+
+    for ( ; i + 32 <= len; i += 32, dst += 16) {
+        bad = _mm_setzero_si128();
+        a = hex_dec_nibble(_mm_loadu_si128((__m128i *)(src + i)), &bad);
+        b = hex_dec_nibble(_mm_loadu_si128((__m128i *)(src + i + 16)), &bad);
+
+        if (_mm_movemask_epi8(bad) != 0) break;
+
+        /* high nibble * 16 + low nibble */
+        a = _mm_maddubs_epi16(a, weight);
+        b = _mm_maddubs_epi16(b, weight);
+
+        _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(a, b));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_dec_nibble_avx2 (__m256i v, __m256i * bad)
+{
+    __m256i  d, l, isd, isl;
+
+    d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+
+    isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    isl = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+    *bad = _mm256_or_si256(*bad, _mm256_andnot_si256(_mm256_or_si256(isd, isl), _mm256_set1_epi8(-1)));
+
+    return _mm256_or_si256(_mm256_and_si256(isd, d),
+                           _mm256_and_si256(isl, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static int hex_dec_avx2 (uint8 * src, int len, uint8 * dst)
+{
+    const __m256i weight = _mm256_set1_epi16(0x0110);
+    __m256i  a, b, bad;
+    int      i = 0;
+
+    for ( ; i + 64 <= len; i += 64, dst += 32) {
+        bad = _mm256_setzero_si256();
+        a = hex_dec_nibble_avx2(_mm256_loadu_si256((__m256i *)(src + i)), &bad);
+        b = hex_dec_nibble_avx2(_mm256_loadu_si256((__m256i *)(src + i + 32)), &bad);
+
+        if (_mm256_movemask_epi8(bad) != 0) break;
+
+        a = _mm256_maddubs_epi16(a, weight);
+        b = _mm256_maddubs_epi16(b, weight);
+
+        /* in-lane packing leaves the quadwords as 0 2 1 3 */
+        a = _mm256_packus_epi16(a, b);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_permute4x64_epi64(a, 0xD8));
+    }
+
+    return i + hex_dec_ssse3(src + i, len - i, dst);
+}
+
+static int b64_enc_simd (uint8 * src, int len, uint8 * dst)
+{
+    switch (codec_simd_level()) {
+    case CODEC_AVX2:  return b64_enc_avx2(src, len, dst);
+    case CODEC_SSSE3: return b64_enc_ssse3(src, len, dst);
+    }
+    return 0;
+}
+
+static int b64_dec_simd (uint8 * src, int len, uint8 * dst, int room)
+{
+    switch (codec_simd_level()) {
+    case CODEC_AVX2:  return b64_dec_avx2(src, len, dst, room);
+    case CODEC_SSSE3: return b64_dec_ssse3(src, len, dst, room);
+    }
+    return 0;
+}
+
+static int hex_enc_simd (uint8 * src, int len, uint8 * dst, int upper)
+{
+    switch (codec_simd_level()) {
+    case CODEC_AVX2:  return hex_enc_avx2(src, len, dst, upper);
+    case CODEC_SSSE3: return hex_enc_ssse3(src, len, dst, upper);
+    }
+    return 0;
+}
+
+static int hex_dec_simd (uint8 * src, int len, uint8 * dst)
+{
+    switch (codec_simd_level()) {
+    case CODEC_AVX2:  return hex_dec_avx2(src, len, dst);
+    case CODEC_SSSE3: return hex_dec_ssse3(src, len, dst);
+    }
+    return 0;
+}
+
+#elif defined(CODEC_NEON)
+
+static int b64_enc_simd (uint8 * src, int len, uint8 * dst)
+{
+    uint8x16x4_t  lut, out;
+    uint8x16x3_t  in;
+    int           i = 0;
+
+    lut.val[0] = vld1q_u8(base64_chars);
+    lut.val[1] = vld1q_u8(base64_chars + 16);
+    lut.val[2] = vld1q_u8(base64_chars + 32);
+    lut.val[3] = vld1q_u8(base64_chars + 48);
+
+    for ( ; i + 48 <= len; i += 48, dst += 64) {
+        in = vld3q_u8(src + i);
+
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4),
+                              vshrq_n_u8(in.val[1], 4));
+        out.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0F)), 2),
+                              vshrq_n_u8(in.val[2], 6));
+        out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+
+        out.val[0] = vqtbl4q_u8(lut, out.val[0]);
+        out.val[1] = vqtbl4q_u8(lut, out.val[1]);
+        out.val[2] = vqtbl4q_u8(lut, out.val[2]);
+        out.val[3] = vqtbl4q_u8(lut, out.val[3]);
+
+        vst4q_u8(dst, out);
+    }
+
+    return i;
+}
+
+/* the 6-bit value of char, 0xFF if not in the alphabet */
+static uint8 b64_dec_tab[128];
+static volatile int b64_dec_tab_init = 0;
+
+static inline uint8x16_t b64_dec_lookup (uint8x16x4_t * t0, uint8x16x4_t * t1, uint8x16_t c)
+{
+    uint8x16_t  v;
+
+    v = vqtbx4q_u8(vqtbl4q_u8(*t0, c), *t1, vsubq_u8(c, vdupq_n_u8(64)));
+
+    /* the chars of 128 and above are out of both tables */
+    return vorrq_u8(v, vcgeq_u8(c, vdupq_n_u8(128)));
+}
+
+static int b64_dec_simd (uint8 * src, int len, uint8 * dst, int room)
+{
+    uint8x16x4_t  t0, t1, in;
+    uint8x16x3_t  out;
+    int           i;
+
+    if (!b64_dec_tab_init) {
+        memset(b64_dec_tab, 0xFF, sizeof(b64_dec_tab));
+        for (i = 0; i < 64; i++) b64_dec_tab[base64_chars[i]] = (uint8)i;
+        __sync_synchronize();
+        b64_dec_tab_init = 1;
+    }
+
+    t0 = vld1q_u8_x4(b64_dec_tab);
+    t1 = vld1q_u8_x4(b64_dec_tab + 64);
+
+    for (i = 0; i + 64 <= len && room >= 48; i += 64, dst += 48, room -= 48) {
+        in = vld4q_u8(src + i);
+
+        in.val[0] = b64_dec_lookup(&t0, &t1, in.val[0]);
+        in.val[1] = b64_dec_lookup(&t0, &t1, in.val[1]);
+        in.val[2] = b64_dec_lookup(&t0, &t1, in.val[2]);
+        in.val[3] = b64_dec_lookup(&t0, &t1, in.val[3]);
+
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(in.val[0], in.val[1]),
+                               vorrq_u8(in.val[2], in.val[3]))) >= 64)
+            break;
+
+        out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+
+        vst3q_u8(dst, out);
+    }
+
+    return i;
+}
+
+static int hex_enc_simd (uint8 * src, int len, uint8 * dst, int upper)
+{
+    uint8x16_t    lut, v;
+    uint8x16x2_t  out;
+    int           i = 0;
+
+    lut = vld1q_u8((const uint8 *)(upper ? "0123456789ABCDEF" : "0123456789abcdef"));
+
+    for ( ; i + 16 <= len; i += 16, dst += 32) {
+        v = vld1q_u8(src + i);
+
+        out.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(v, 4));
+        out.val[1] = vqtbl1q_u8(lut, vandq_u8(v, vdupq_n_u8(0x0F)));
+
+        vst2q_u8(dst, out);
+    }
+
+    return i;
+}
+
+static inline uint8x16_t hex_dec_nibble (uint8x16_t v, uint8x16_t * ok)
+{
+    uint8x16_t  d, l, isd, isl;
+
+    d = vsubq_u8(v, vdupq_n_u8('0'));
+    l = vsubq_u8(vorrq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+
+    isd = vcleq_u8(d, vdupq_n_u8(9));
+    isl = vcleq_u8(l, vdupq_n_u8(5));
+
+    *ok = vandq_u8(*ok, vorrq_u8(isd, isl));
+
+    return vbslq_u8(isd, d, vaddq_u8(l, vdupq_n_u8(10)));
+}
+
+static int hex_dec_simd (uint8 * src, int len, uint8 * dst)
+{
+    uint8x16x2_t  in;
+    uint8x16_t    ok, hi, lo;
+    int           i = 0;
+
+    for ( ; i + 32 <= len; i += 32, dst += 16) {
+        in = vld2q_u8(src + i);
+
+        ok = vdupq_n_u8(0xFF);
+        hi = hex_dec_nibble(in.val[0], &ok);
+        lo = hex_dec_nibble(in.val[1], &ok);
+
+        if (vminvq_u8(ok) != 0xFF) break;
+
+        vst1q_u8(dst, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+    }
+
+    return i;
+}
+
+#else
+
+#define b64_enc_simd(src, len, dst)        0
+#define b64_dec_simd(src, len, dst, room)  0
+#define hex_enc_simd(src, len, dst, upper) 0
+#define hex_dec_simd(src, len, dst)        0
+
+#endif
+
+
 int bin_to_ascii (void * psrc, int binlen, void * pdst, int * asclen, int uppercase)
 {   
     uint8  * pbin = (uint8 *)psrc;
@@ -1045,7 +1711,9 @@ int bin_to_ascii (void * psrc, int binlen, void * pdst, int * asclen, int upperc
     if (!pbin || binlen < 1) return -1;
     if (!pascii) return -2;
     
-    for (i = 0, covind = 0; i < binlen; i++) {
+    i = hex_enc_simd(pbin, binlen, pascii, uppercase);
+
+    for (covind = i * 2; i < binlen; i++) {
         byte = ((pbin[i] >> 4) & 0x0F);
         pascii[covind++] = toHex(byte, uppercase);
 
@@ -1067,7 +1735,10 @@ int ascii_to_bin (void * psrc, int asciilen, void * pdst, int * binlen)
 
     if (!pascii || asciilen < 1) return -1;
 
-    for (i = 0, conind = 0; i < asciilen; i++) {
+    /* the block with a bad char is left to the loop reporting it */
+    i = hex_dec_simd(pascii, asciilen, pbin);
+
+    for (conind = i / 2; i < asciilen; i++) {
         byte <<= 4;
         if (pascii[i] >= 'a' && pascii[i] <= 'f') 
             byte |= pascii[i] - 'a' + 10;
@@ -1090,206 +1761,650 @@ int ascii_to_bin (void * psrc, int asciilen, void * pdst, int * binlen)
 }
 
 
-int base64_to_bin (void * psrc, int asclen, void * pdst, int *binlen)
+void base64_state_init (base64_state_t * st)
+{
+    if (st) memset(st, 0, sizeof(*st));
+}
+
+/* decode into pbin, keeping the partial quad in st. room is the bytes
+   writable in pbin. return the bytes written */
+static int base64_decode_run (base64_state_t * st, uint8 * pasc, int asclen, uint8 * pbin, int room)
 {
-    uint8  * pasc = (uint8 *)psrc;
-    uint8  * pbin = (uint8 *)pdst;
-    uint32   triplet = 0;
     int      pos = 0, to = 0;
-    int      quadpos = 0;
-    int      warned = 0;
     int      sixbits;
     int      c;
 
+    for (pos = 0; pos < asclen && !st->ended; pos++) {
+        /* the vector kernel runs on quad boundary, until it meets a char
+           not of the alphabet, such as the line break or the padding */
+        if (st->quadpos == 0 && asclen - pos >= 32) {
+            c = b64_dec_simd(pasc + pos, asclen - pos, pbin + to, room - to);
+            if (c > 0) {
+                to += c / 4 * 3;
+                pos += c - 1;
+                continue;
+            }
+        }
+
+        c = pasc[pos];
+
+        if (c >= 'A' && c <= 'Z') {
+            sixbits = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            sixbits = 26 + c - 'a';
+        } else if (c >= '0' && c <= '9') {
+            sixbits = 52 + c - '0';
+        } else if (c == '+') {
+            sixbits = 62;
+        } else if (c == '/') {
+            sixbits = 63;
+        } else if (c == '=') {
+            /* These can only occur at the end of encoded text.  RFC 2045 
+             * says we can assume it really is the end. */
+            st->ended = 1;
+            break;
+        } else if (ISSPACE(c)) {
+            /* skip whitespace */
+            continue;
+        } else {
+            st->invalid++;
+            continue;
+        }
+
+        st->triplet = (st->triplet << 6) | sixbits;
+        st->quadpos++;
+
+        if (st->quadpos == 4) {
+            pbin[to++] = (uint8)((st->triplet >> 16) & 0xff);
+            pbin[to++] = (uint8)((st->triplet >> 8) & 0xff);
+            pbin[to++] = (uint8)(st->triplet & 0xff);
+            st->quadpos = 0;
+        }
+    }
+
+    return to;
+}
+
+int base64_to_bin_update (base64_state_t * st, void * pasc, int asclen, void * pbin)
+{
+    if (!st || !pasc || asclen <= 0) return 0;
+    if (!pbin) return -1;
+
+    return base64_decode_run(st, (uint8 *)pasc, asclen, (uint8 *)pbin,
+                             (st->quadpos + asclen) / 4 * 3);
+}
+
+int base64_to_bin_final (base64_state_t * st, void * vbin)
+{
+    uint8  * pbin = (uint8 *)vbin;
+    int      to = 0;
+
+    if (!st || !pbin) return -1;
+
+    /* Deal with leftover octets */
+    switch (st->quadpos) {
+    case 0:
+        break;
+    case 3:  /* triplet has 18 bits, we want the first 16 */
+        pbin[to++] = (uint8)((st->triplet >> 10) & 0xff);
+        pbin[to++] = (uint8)((st->triplet >> 2) & 0xff);
+        break;
+    case 2:  /* triplet has 12 bits, we want the first 8 */
+        pbin[to++] = (uint8)((st->triplet >> 4) & 0xff);
+        break;
+    case 1:
+        st->badpad = 1;
+        //warning("Bad padding in base64 encoded text.");
+        break;
+    }
+
+    st->quadpos = 0;
+    st->triplet = 0;
+
+    return to;
+}
+
+int base64_to_bin (void * psrc, int asclen, void * pdst, int *binlen)
+{
+    uint8  * pasc = (uint8 *)psrc;
+    uint8  * pbin = (uint8 *)pdst;
+    base64_state_t st;
+    int      to = 0;
+
     if (!pasc || asclen <= 0) return -1;
     if (!pbin || !binlen || *binlen <= 0) return -2;
     
     if (*binlen < (asclen + 3)/4 * 3) return -100;
 
-    to = triplet = quadpos = 0;
-    for (pos = 0; pos < asclen; pos++) {
-        c = pasc[pos];
+    memset(&st, 0, sizeof(st));
+
+    to = base64_decode_run(&st, pasc, asclen, pbin, *binlen);
+    to += base64_to_bin_final(&st, pbin + to);
+
+    *binlen = to;
+    pbin[to] = '\0';
+
+    return (st.invalid ? 1 : 0) + st.badpad;
+}
+
+
+/* encode the whole triplets of src, num is a multiple of 3 */
+static int base64_encode_run (uint8 * src, int num, uint8 * dst)
+{
+    uint32  tripval = 0;
+    int     from = 0; 
+    int     to = 0;
+
+    from = b64_enc_simd(src, num, dst);
+    to = from / 3 * 4;
+
+    for ( ; from < num; from += 3) {
+        tripval = (src[from] << 16) | (src[from+1] << 8) | src[from+2];
+
+        dst[to++] = base64_chars[(tripval >> 18) % 64];
+        dst[to++] = base64_chars[(tripval >> 12) % 64];
+        dst[to++] = base64_chars[(tripval >> 6) % 64];
+        dst[to++] = base64_chars[(tripval) % 64];
+    }
+
+    return to;
+}
+
+/* encode the 1 or 2 leftover octets with padding */
+static int base64_encode_tail (uint8 * src, int num, uint8 * dst)
+{
+    uint32  tripval = 0;
+
+    if (num <= 0) return 0;
+
+    tripval = src[0] << 16;
+    if (num > 1) tripval |= src[1] << 8;
+
+    dst[0] = base64_chars[(tripval >> 18) % 64];
+    dst[1] = base64_chars[(tripval >> 12) % 64];
+    dst[2] = num > 1 ? base64_chars[(tripval >> 6) % 64] : '=';
+    dst[3] = '=';
+
+    return 4;
+}
+
+int bin_to_base64 (void * psrc, int binlen, void * pdst, int * asclen)
+{
+    uint8  * pbin = (uint8 *)psrc;
+    uint8  * pasc = (uint8 *)pdst;
+    int     triplets;
+    int     whole = 0; 
+    int     to = 0;
+    
+    if (!pbin || binlen <= 0) return -1;
+    if (!pasc || !asclen || *asclen <= 0) return -2;
+
+    /* The lines must be 76 characters each (or less), and each
+     * triplet will expand to 4 characters, so we can fit 19
+     * triplets on one line.  We need a CR LF after each line,
+     * which will add 2 octets per 19 triplets (rounded up). */
+    triplets = (binlen + 2)/3;
+    if (*asclen < triplets * 4 + (triplets + 18)/19 * 2 + 1) 
+        return -100;
+
+    /* no line break is inserted */
+    whole = binlen / 3 * 3;
+
+    to = base64_encode_run(pbin, whole, pasc);
+    to += base64_encode_tail(pbin + whole, binlen - whole, pasc + to);
+
+    pasc[to] = 0x00;
+    *asclen = to;
+    return 0;
+}
+
+int bin_to_base64_update (base64_state_t * st, void * psrc, int binlen, void * pdst)
+{
+    uint8  * pbin = (uint8 *)psrc;
+    uint8  * pasc = (uint8 *)pdst;
+    int      to = 0, whole;
+
+    if (!st || !pbin || binlen <= 0) return 0;
+    if (!pasc) return -1;
+
+    /* complete the triplet kept from last call */
+    if (st->carrynum > 0) {
+        while (st->carrynum < 3 && binlen > 0) {
+            st->carry[st->carrynum++] = *pbin++;
+            binlen--;
+        }
+        if (st->carrynum < 3) return 0;
+
+        to = base64_encode_run(st->carry, 3, pasc);
+        st->carrynum = 0;
+    }
+
+    whole = binlen / 3 * 3;
+    to += base64_encode_run(pbin, whole, pasc + to);
+
+    for ( ; whole < binlen; whole++)
+        st->carry[st->carrynum++] = pbin[whole];
+
+    return to;
+}
+
+int bin_to_base64_final (base64_state_t * st, void * pdst)
+{
+    int  to = 0;
+
+    if (!st || !pdst) return -1;
+
+    to = base64_encode_tail(st->carry, st->carrynum, (uint8 *)pdst);
+    st->carrynum = 0;
+
+    return to;
+}
+
+
+static int QuotedStrlen (void * p, int len, int start)
+{
+    uint8 * poct = (uint8 *)p;
+    uint8   quote = 0;
+    int     i = 0;
+
+    if (!poct || len < 1) return 0;
+    if (start >= len) return 0;
+
+    quote = poct[start];
+    if (quote != '"' && quote != '\'') return 0;
+
+    for (i = start + 1; i < len; i++) {
+        if (poct[i] == '\\') i++;
+        else if (poct[i] == quote)
+            return i - start + 1;
+    }
+
+    return 1; //only one quote
+}       
+        
+
+void chset_init (chset_t * set, void * chars, int num)
+{
+    uint8 * pch = (uint8 *)chars;
+    int     i;
+
+    if (!set) return;
+
+    memset(set, 0, sizeof(*set));
+
+    for (i = 0; pch && i < num; i++)
+        chset_add(set, pch[i]);
+}
+
+void chset_add (chset_t * set, int ch)
+{
+    if (!set) return;
+
+    ch &= 0xFF;
+    if (chset_has(set, ch)) return;
+
+    set->bitmap[ch >> 3] |= 1 << (ch & 7);
+
+    if (ch < 0x80) set->lorow[ch & 0x0F] |= 1 << (ch >> 4);
+    else set->hirow[ch & 0x0F] |= 1 << ((ch >> 4) - 8);
+
+    if (set->num < CHSET_VECMAX)
+        set->chars[set->num] = (uint8)ch;
+    set->num++;
+}
+
+void chset_init_map (chset_t * set, uint32 * bitvec)
+{
+    int  ch;
+
+    if (!set) return;
+
+    memset(set, 0, sizeof(*set));
+
+    for (ch = 0; bitvec && ch < 256; ch++) {
+        if (bitvec[ch >> 5] & (1U << (ch & 0x1f)))
+            chset_add(set, ch);
+    }
+}
+
+
+/* mask of the bytes in a block of CHSET_WIDTH that belong to set. the
+ * block compares apply to the sets of up to CHSET_VECMAX chars */
+
+#if defined(__SSE2__)
+
+#if defined(__AVX2__)
+#define CHSET_WIDTH   32
+#define CHSET_FULL    0xFFFFFFFFULL
+#else
+#define CHSET_WIDTH   16
+#define CHSET_FULL    0xFFFFULL
+#endif
+#define CHSET_SHIFT   0
+
+static inline uint64 chset_block (uint8 * p, chset_t * set)
+{
+#if defined(__AVX2__)
+    __m256i  v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i  m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)set->chars[0]));
+    int      i;
+
+    for (i = 1; i < set->num; i++)
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)set->chars[i])));
+
+    return (uint32)_mm256_movemask_epi8(m);
+#else
+    __m128i  v = _mm_loadu_si128((const __m128i *)p);
+    __m128i  m = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->chars[0]));
+    int      i;
+
+    for (i = 1; i < set->num; i++)
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->chars[i])));
+
+    return (uint32)_mm_movemask_epi8(m);
+#endif
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+/* 4 bits for each byte after the narrowing shift */
+#define CHSET_WIDTH   16
+#define CHSET_FULL    0xFFFFFFFFFFFFFFFFULL
+#define CHSET_SHIFT   2
+
+static inline uint64 chset_block (uint8 * p, chset_t * set)
+{
+    uint8x16_t  v = vld1q_u8(p);
+    uint8x16_t  m = vceqq_u8(v, vdupq_n_u8(set->chars[0]));
+    int         i;
+
+    for (i = 1; i < set->num; i++)
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(set->chars[i])));
+
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+#endif
+
+/* the nibble table scan of the sets over CHSET_VECMAX chars. the row of
+ * the low nibble is taken from lorow or hirow by the top bit of the byte,
+ * and the byte is in set if the row has bit (high nibble & 7). the kernels
+ * return the index of the first byte found in the whole blocks, or where
+ * the whole blocks end, the rest is left to the scalar loop */
+
+#ifdef CODEC_X86_DISPATCH
+
+__attribute__((target("ssse3")))
+static int chset_nibble_ssse3 (uint8 * p, int len, chset_t * set, int negate)
+{
+    __m128i  lorow = _mm_loadu_si128((const __m128i *)set->lorow);
+    __m128i  hirow = _mm_loadu_si128((const __m128i *)set->hirow);
+    __m128i  bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                  1, 2, 4, 8, 16, 32, 64, -128);
+    __m128i  nib = _mm_set1_epi8(0x0F);
+    __m128i  v, lo, hi, row, bit, top;
+    int      i, mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+
+        lo = _mm_and_si128(v, nib);
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+        top = _mm_cmplt_epi8(v, _mm_setzero_si128());
+
+        row = _mm_or_si128(_mm_and_si128(top, _mm_shuffle_epi8(hirow, lo)),
+                           _mm_andnot_si128(top, _mm_shuffle_epi8(lorow, lo)));
+        bit = _mm_shuffle_epi8(bits, hi);
+
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+        if (negate) mask ^= 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int chset_nibble_avx2 (uint8 * p, int len, chset_t * set, int negate)
+{
+    __m256i  lorow = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lorow));
+    __m256i  hirow = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hirow));
+    __m256i  bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                     1, 2, 4, 8, 16, 32, 64, -128,
+                                     1, 2, 4, 8, 16, 32, 64, -128,
+                                     1, 2, 4, 8, 16, 32, 64, -128);
+    __m256i  nib = _mm256_set1_epi8(0x0F);
+    __m256i  v, lo, hi, row, bit;
+    uint32   mask;
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+
+        lo = _mm256_and_si256(v, nib);
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nib);
+
+        row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lorow, lo),
+                                 _mm256_shuffle_epi8(hirow, lo), v);
+        bit = _mm256_shuffle_epi8(bits, hi);
+
+        mask = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+        if (negate) mask ^= 0xFFFFFFFFU;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i;
+}
+
+static int chset_nibble_find (uint8 * p, int len, chset_t * set, int negate)
+{
+    int  level = codec_simd_level();
+
+    if (level >= CODEC_AVX2) return chset_nibble_avx2(p, len, set, negate);
+    if (level >= CODEC_SSSE3) return chset_nibble_ssse3(p, len, set, negate);
+
+    return 0;
+}
+
+#elif defined(CODEC_NEON)
+
+static int chset_nibble_find (uint8 * p, int len, chset_t * set, int negate)
+{
+    static const uint8 bittab[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t  lorow = vld1q_u8(set->lorow);
+    uint8x16_t  hirow = vld1q_u8(set->hirow);
+    uint8x16_t  bits = vld1q_u8(bittab);
+    uint8x16_t  v, lo, row, m;
+    uint64      mask;
+    int         i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = vld1q_u8(p + i);
+
+        lo = vandq_u8(v, vdupq_n_u8(0x0F));
+        row = vbslq_u8(vcltzq_s8(vreinterpretq_s8_u8(v)),
+                       vqtbl1q_u8(hirow, lo), vqtbl1q_u8(lorow, lo));
+        m = vtstq_u8(row, vqtbl1q_u8(bits, vshrq_n_u8(v, 4)));
+        if (negate) m = vmvnq_u8(m);
+
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (mask) return i + (__builtin_ctzll(mask) >> 2);
+    }
+
+    return i;
+}
 
-        if (c >= 'A' && c <= 'Z') {
-            sixbits = c - 'A';
-        } else if (c >= 'a' && c <= 'z') {
-            sixbits = 26 + c - 'a';
-        } else if (c >= '0' && c <= '9') {
-            sixbits = 52 + c - '0';
-        } else if (c == '+') {
-            sixbits = 62;
-        } else if (c == '/') {
-            sixbits = 63;
-        } else if (c == '=') {
-            /* These can only occur at the end of encoded text.  RFC 2045 
-             * says we can assume it really is the end. */
-            break;
-        } else if (ISSPACE(c)) {
-            /* skip whitespace */
-            continue;
-        } else {
-            if (!warned) {
-                warned++;
-            }
-            continue;
-        }
+#else
+#define chset_nibble_find(p, len, set, negate)  0
+#endif
 
-        triplet = (triplet << 6) | sixbits;
-        quadpos++;
+/* index of the first byte that is in set, or not in set if negate is 1.
+ * len is returned if none */
+static int chset_find (uint8 * p, int len, chset_t * set, int negate)
+{
+    int      i = 0;
+#ifdef CHSET_WIDTH
+    uint64   mask;
 
-        if (quadpos == 4) {
-            pbin[to++] = (char)((triplet >> 16) & 0xff);
-            pbin[to++] = (char)((triplet >> 8) & 0xff);
-            pbin[to++] = (char)(triplet & 0xff);
-            quadpos = 0;
+    if (set->num > 0 && set->num <= CHSET_VECMAX) {
+        for ( ; i + CHSET_WIDTH <= len; i += CHSET_WIDTH) {
+            mask = chset_block(p + i, set);
+            if (negate) mask ^= CHSET_FULL;
+            if (mask) return i + (__builtin_ctzll(mask) >> CHSET_SHIFT);
         }
     }
+#endif
 
-    /* Deal with leftover octets */
-    switch (quadpos) {
-    case 0:
-        break;
-    case 3:  /* triplet has 18 bits, we want the first 16 */
-        pbin[to++] = (char)((triplet >> 10) & 0xff);
-        pbin[to++] = (char)((triplet >> 2) & 0xff);
-        break;
-    case 2:  /* triplet has 12 bits, we want the first 8 */
-        pbin[to++] = (char)((triplet >> 4) & 0xff);
-        break;
-    case 1:
-        warned++;
-        //warning("Bad padding in base64 encoded text.");
-        break;
+    if (set->num > CHSET_VECMAX && len >= 16) {
+        i = chset_nibble_find(p, len, set, negate);
+        if (i < len && (chset_has(set, p[i]) ? 1 : 0) != negate) return i;
     }
 
-    *binlen = to;
-    pbin[to] = '\0';
+    for ( ; i < len; i++) {
+        if ((chset_has(set, p[i]) ? 1 : 0) != negate) return i;
+    }
 
-    return warned;
+    return len;
 }
 
-int bin_to_base64 (void * psrc, int binlen, void * pdst, int * asclen)
+/* scan backward from p to p - len + 1, return the distance of the byte
+ * found from p, or len if none */
+static int chset_rfind (uint8 * p, int len, chset_t * set, int negate)
 {
-    uint8  * pbin = (uint8 *)psrc;
-    uint8  * pasc = (uint8 *)pdst;
-    static const uint8 base64[65] =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    int     triplets;
-    uint32  tripval = 0;
-    int     from = 0; 
-    int     to = 0;
-    
-    if (!pbin || binlen <= 0) return -1;
-    if (!pasc || !asclen || *asclen <= 0) return -2;
-
-    triplets = (binlen + 2)/3;
-    if (*asclen < triplets * 4 + (triplets + 18)/19 * 2 + 1) 
-        return -100;
+    int      i = 0;
+#ifdef CHSET_WIDTH
+    uint64   mask;
 
-    /* The lines must be 76 characters each (or less), and each
-     * triplet will expand to 4 characters, so we can fit 19
-     * triplets on one line.  We need a CR LF after each line,
-     * which will add 2 octets per 19 triplets (rounded up). */
-    triplets = binlen / 3;   /* round up */
-
-    for (to=0, from = 0; triplets > 0; triplets--) {
-        tripval = (pbin[from] << 16) | 
-                  (pbin[from+1] << 8)  |
-                   pbin[from+2];
-        from += 3;
-        pasc[to++] = base64[(tripval >> 18) % 64];
-        pasc[to++] = base64[(tripval >> 12) % 64];
-        pasc[to++] = base64[(tripval >> 6) % 64];
-        pasc[to++] = base64[(tripval) % 64];
-
-        if (from % 57 == 0) {
-            //pasc[to++] = 0x0D;
-            //pasc[to++] = 0x0A;
+    if (set->num > 0 && set->num <= CHSET_VECMAX) {
+        for ( ; i + CHSET_WIDTH <= len; i += CHSET_WIDTH) {
+            mask = chset_block(p - i - CHSET_WIDTH + 1, set);
+            if (negate) mask ^= CHSET_FULL;
+            if (mask)
+                return i + CHSET_WIDTH - 1 - ((63 - __builtin_clzll(mask)) >> CHSET_SHIFT);
         }
     }
+#endif
 
-    switch (binlen % 3) {   
-    case 0:
-        break;
-    case 1:
-        tripval = pbin[from] << 16;
-        pasc[to++] = base64[(tripval >> 18) % 64];
-        pasc[to++] = base64[(tripval >> 12) % 64];
-        pasc[to++] = '=';
-        pasc[to++] = '=';
-        //pasc[to++] = 0x0D;
-        //pasc[to++] = 0x0A;
-        break;
-    case 2:
-        tripval = (pbin[from] << 16) | 
-                  (pbin[from+1] << 8);
-        from += 2;
-        pasc[to++] = base64[(tripval >> 18) % 64];
-        pasc[to++] = base64[(tripval >> 12) % 64];
-        pasc[to++] = base64[(tripval >> 6) % 64];
-        pasc[to++] = '=';
-        //pasc[to++] = 0x0D;
-        //pasc[to++] = 0x0A;
-        break;
+    for ( ; i < len; i++) {
+        if ((chset_has(set, *(p - i)) ? 1 : 0) != negate) return i;
     }
 
-    pasc[to] = 0x00;
-    *asclen = to;
-    return 0;
+    return len;
 }
 
+void * skip_to_set (void * p, int len, chset_t * set)
+{
+    uint8 * pbyte = (uint8 *)p;
 
-static int QuotedStrlen (void * p, int len, int start)
+    if (!pbyte) return NULL;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
+
+    return pbyte + chset_find(pbyte, len, set, 0);
+}
+
+void * skip_over_set (void * p, int len, chset_t * set)
 {
-    uint8 * poct = (uint8 *)p;
-    uint8   quote = 0;
-    int     i = 0;
+    uint8 * pbyte = (uint8 *)p;
 
-    if (!poct || len < 1) return 0;
-    if (start >= len) return 0;
+    if (!pbyte) return NULL;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
 
-    quote = poct[start];
-    if (quote != '"' && quote != '\'') return 0;
+    return pbyte + chset_find(pbyte, len, set, 1);
+}
 
-    for (i = start + 1; i < len; i++) {
-        if (poct[i] == '\\') i++;
-        else if (poct[i] == quote)
-            return i - start + 1;
-    }
+void * rskip_to_set (void * p, int len, chset_t * set)
+{
+    uint8 * pbyte = (uint8 *)p;
 
-    return 1; //only one quote
-}       
-        
+    if (!pbyte) return NULL;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
 
-void * skipQuoteTo (void * p, int len, void * toch, int num)
+    return pbyte - chset_rfind(pbyte, len, set, 0);
+}
+
+void * rskip_over_set (void * p, int len, chset_t * set)
 {
     uint8 * pbyte = (uint8 *)p;
-    uint8 * tochars = (uint8 *)toch;
-    int     i = 0, j = 0;
-    int     qlen = 0;
 
     if (!pbyte) return NULL;
-    if (len <= 0) return pbyte;
-    if (!tochars || num <= 0) return pbyte;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
+
+    return pbyte - chset_rfind(pbyte, len, set, 1);
+}
+
+/* the char following '\\' is skipped. as skipEscTo, a '\\' at the end
+ * makes the result one byte beyond pbyte + len */
+void * skip_esc_to_set (void * p, int len, chset_t * set)
+{
+    uint8   * pbyte = (uint8 *)p;
+    chset_t   stop;
+    int       i = 0;
+
+    if (!pbyte) return NULL;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
+
+    stop = *set;
+    chset_add(&stop, '\\');
+
+    while (i < len) {
+        i += chset_find(pbyte + i, len - i, &stop, 0);
+        if (i >= len) break;
+
+        if (pbyte[i] != '\\') return pbyte + i;
+        i += 2;
+    }
+
+    return pbyte + i;
+}
+
+void * skip_quote_to_set (void * p, int len, chset_t * set)
+{
+    uint8   * pbyte = (uint8 *)p;
+    chset_t   stop;
+    int       i = 0;
+
+    if (!pbyte) return NULL;
+    if (len <= 0 || !set || set->num <= 0) return pbyte;
+
+    stop = *set;
+    chset_add(&stop, '\\');
+    chset_add(&stop, '"');
+    chset_add(&stop, '\'');
+
+    while (i < len) {
+        i += chset_find(pbyte + i, len - i, &stop, 0);
+        if (i >= len) break;
 
-    for (i = 0; i < len; ) {
         if (pbyte[i] == '\\' && i + 1 < len) {
             i += 2;
             continue;
         }
 
-        for (j = 0; j < num; j++) {
-            if (tochars[j] == pbyte[i]) return &pbyte[i];
-        }
+        if (chset_has(set, pbyte[i])) return pbyte + i;
+
         if (pbyte[i] == '"' || pbyte[i] == '\'') {
-            qlen = QuotedStrlen(pbyte, len, i);
-            i += qlen;
+            i += QuotedStrlen(pbyte, len, i);
             continue;
         }
         i++;
     }
 
-    return &pbyte[i];
+    return pbyte + i;
+}
+
+
+void * skipQuoteTo (void * p, int len, void * toch, int num)
+{
+    chset_t  set;
+
+    if (!p) return NULL;
+    if (len <= 0) return p;
+    if (!toch || num <= 0) return p;
+
+    chset_init(&set, toch, num);
+
+    return skip_quote_to_set(p, len, &set);
 }
 
 void * skipToPeer (void * p, int len, int leftch, int rightch)
@@ -1324,101 +2439,79 @@ void * skipToPeer (void * p, int len, int leftch, int rightch)
 void * skipTo (void * p, int len, void * toch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
-    uint8 * tochars = (uint8 *)toch;
-    int     i = 0, j = 0;
+    chset_t set;
         
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
-    if (!tochars || num <= 0) return pbyte;
-    
-    for (i = 0; i < len; ) {
-        for (j = 0; j < num; j++) {
-            if (tochars[j] == pbyte[i]) return &pbyte[i]; 
-        }
-        i++; 
-    }
+    if (!toch || num <= 0) return pbyte;
     
-    return &pbyte[i];
+    /* most calls stop at once, avoid compiling the set for them */
+    if (memchr(toch, pbyte[0], num)) return pbyte;
+
+    chset_init(&set, toch, num);
+
+    return skip_to_set(pbyte, len, &set);
 }
 
 void * skipEscTo (void * p, int len, void * toch, int num)
 {
-    uint8 * pbyte = (uint8 *)p;
-    uint8 * tochars = (uint8 *)toch;
-    int  i = 0, j = 0;
+    chset_t  set;
  
-    if (!pbyte) return NULL;
-    if (len <= 0) return pbyte;
-    if (!tochars || num <= 0) return pbyte;
+    if (!p) return NULL;
+    if (len <= 0) return p;
+    if (!toch || num <= 0) return p;
  
-    for (i = 0; i < len; i++) {
-        if (pbyte[i] == '\\') { i++; continue; }
+    chset_init(&set, toch, num);
 
-        for (j = 0; j < num; j++) {
-            if (tochars[j] == pbyte[i]) return &pbyte[i];
-        }
-    }
- 
-    return &pbyte[i];
+    return skip_esc_to_set(p, len, &set);
 }
  
 void * rskipTo (void * p, int len, void * toch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
-    uint8 * tochars = (uint8 *)toch;
-    int     i = 0, j = 0;
+    chset_t set;
 
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
-    if (!tochars || num <= 0) return pbyte;
+    if (!toch || num <= 0) return pbyte;
 
-    for (i = 0; i < len; i++) {
-        for (j = 0; j < num; j++) {
-            if (tochars[j] == *(pbyte-i)) return pbyte-i;
-        }
-    }
+    if (memchr(toch, pbyte[0], num)) return pbyte;
 
-    return pbyte-i;
+    chset_init(&set, toch, num);
+
+    return rskip_to_set(pbyte, len, &set);
 }
 
 void * skipOver (void * p, int len, void * skipch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
-    uint8 * skippedchs = (uint8 *)skipch;
-    int     i = 0, j = 0;
+    chset_t set;
 
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
-    if (!skippedchs || num <= 0) return pbyte;
+    if (!skipch || num <= 0) return pbyte;
 
-    for (i = 0; i < len; i++) {
-        for (j = 0; j < num; j++) {
-            if (skippedchs[j] == pbyte[i]) break;
-        }
-        if (j >= num) return &pbyte[i];
-    }
+    if (!memchr(skipch, pbyte[0], num)) return pbyte;
 
-    return &pbyte[i];
+    chset_init(&set, skipch, num);
+
+    return skip_over_set(pbyte, len, &set);
 }
 
 void * rskipOver (void * p, int rlen, void * skipch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
-    uint8 * skippedchs = (uint8 *)skipch;
-    int     i = 0, j = 0;
+    chset_t set;
 
     if (!pbyte) return NULL;
     if (rlen <= 0) return pbyte;
-    if (!skippedchs || num <= 0) return pbyte;
+    if (!skipch || num <= 0) return pbyte;
 
-    for (i = 0; i < rlen; i++) {
-        for (j = 0; j < num; j++) {
-            if (skippedchs[j] == *(pbyte - i)) break;
-        }
-        if (j >= num) return pbyte - i;
-    }
+    if (!memchr(skipch, pbyte[0], num)) return pbyte;
+
+    chset_init(&set, skipch, num);
 
-    return pbyte - i;
+    return rskip_over_set(pbyte, rlen, &set);
 }
 
 /* get the value pointer: username = 'hellokitty'    password = '#$!7798' */
@@ -1748,18 +2841,65 @@ void * string_strip_dup (void * p, int bytelen, void * pat, int chlen)
     return pdup;
 }
 
+/* return the number of leading bytes which need no escaping, 16 bytes are
+ * checked at once for quote, backslash and control chars */
+static size_t json_escape_span (uint8 * src, size_t size)
+{
+    size_t   i = 0;
+    uint8    ch;
+
+#if defined(__SSE2__)
+    __m128i  quote = _mm_set1_epi8('"');
+    __m128i  bslash = _mm_set1_epi8('\\');
+    __m128i  ctl = _mm_set1_epi8(0x1F);
+    __m128i  v, m;
+
+    for ( ; i + 16 <= size; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        /* v <= 0x1F as unsigned if max(v, 0x1F) equals to 0x1F */
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                         _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+        if (_mm_movemask_epi8(m)) break;
+    }
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t  v, m;
+
+    for ( ; i + 16 <= size; i += 16) {
+        v = vld1q_u8(src + i);
+
+        m = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\'))),
+                     vcleq_u8(v, vdupq_n_u8(0x1F)));
+        if (vmaxvq_u8(m)) break;
+    }
+#endif
+
+    for ( ; i < size; i++) {
+        ch = src[i];
+        if (ch == '"' || ch == '\\' || ch <= 0x1f) break;
+    }
+
+    return i;
+}
+
 int json_escape (void * psrc, size_t size, void * pdst, size_t dstlen)
 {
     uint8   * dst = (uint8 *)pdst;
     uint8   * src = (uint8 *)psrc;
     uint8     ch;
     int       len = 0;
+    size_t    num = 0;
  
     if (!src || size <= 0)
         return 0;
 
     if (dst == NULL) {
         while (size) {
+            num = json_escape_span(src, size);
+            len += num; src += num; size -= num;
+            if (size == 0) break;
+
             ch = *src++;
  
             if (ch == '\\' || ch == '"') {
@@ -1785,6 +2925,14 @@ int json_escape (void * psrc, size_t size, void * pdst, size_t dstlen)
     }
  
     while (size > 0 && len < dstlen) {
+        num = json_escape_span(src, size);
+        if (num > dstlen - len) num = dstlen - len;
+        if (num > 0) {
+            memcpy(dst, src, num);
+            dst += num; src += num; size -= num; len += num;
+            continue;
+        }
+
         ch = *src++;
         size--;
  
@@ -2098,6 +3246,55 @@ void * json_strip_dup (void * psrc, size_t size)
     return dst;
 }
 
+/* the runs of bytes not in the escape map are counted or copied at once
+ * when the compiled set is given */
+static int uri_encode_run (uint8 * src, size_t size, uint8 * dst, size_t dstlen,
+                           uint32 * escape, chset_t * set)
+{
+    static uint8   hex[] = "0123456789ABCDEF";
+    uint8          ch = 0;
+    size_t         num = 0;
+    int            n = 0;
+
+    if (!src) return 0;
+
+    while (size) {
+        if (set && size >= 16) {
+            num = chset_find(src, size, set, 0);
+            if (num > 0) {
+                if (dst && n + num <= dstlen) {
+                    memcpy(dst, src, num);
+                    dst += num;
+                } else if (dst && n < dstlen) {
+                    /* as the byte loop, stop writing once dst is full */
+                    memcpy(dst, src, dstlen - n);
+                    dst += dstlen - n;
+                }
+                n += num; src += num; size -= num;
+                continue;
+            }
+        }
+
+        ch = *src++;
+        size--;
+
+        if (escape[ch >> 5] & (1U << (ch & 0x1f))) {
+            n += 3;
+            if (dst && n <= dstlen) {
+                *dst++ = '%';
+                *dst++ = hex[ch >> 4];
+                *dst++ = hex[ch & 0xf];
+            }
+        } else {
+            n++;
+            if (dst && n <= dstlen)
+                *dst++ = ch;
+        }
+    }
+
+    return n;
+}
+
 /*  escape type value:
       ESCAPE_URI            0
       ESCAPE_ARGS           1
@@ -2109,12 +3306,7 @@ void * json_strip_dup (void * psrc, size_t size)
  */
 int uri_encode (void * psrc, size_t size, void * pdst, size_t dstlen, int type)
 {
-    uint8        * dst = (uint8 *)pdst;
-    uint8        * src = (uint8 *)psrc;
-    uint8          ch = 0;
-    int            n = 0;
     uint32       * escape;
-    static uint8   hex[] = "0123456789ABCDEF";
  
                     /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
  
@@ -2242,46 +3434,46 @@ int uri_encode (void * psrc, size_t size, void * pdst, size_t dstlen, int type)
         { uri, args, uri_component, html, refresh, memcached, memcached };
  
  
+    /* the compiled sets of the maps are built once, the callers racing
+     * with the builder go on with the bitmap test */
+    static chset_t  sets[7];
+    static int      setstate[7];
+    chset_t       * set = NULL;
+    int             state = 0;
+
+    if (type < 0 || type >= 7) type = 0;
+
     escape = map[type];
- 
-    if (dst == NULL) {
- 
-        /* find the number of the characters to be escaped */
- 
-        while (size) {
-            if (escape[*src >> 5] & (1U << (*src & 0x1f))) {
-                n += 2;
-            }
-            src++;
-            size--;
-            n++;
+
+    if (size >= 16) {
+        state = __atomic_load_n(&setstate[type], __ATOMIC_ACQUIRE);
+        if (state == 2) {
+            set = &sets[type];
+        } else if (state == 0 &&
+                   __atomic_compare_exchange_n(&setstate[type], &state, 1, 0,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            chset_init_map(&sets[type], escape);
+            __atomic_store_n(&setstate[type], 2, __ATOMIC_RELEASE);
+            set = &sets[type];
         }
- 
-        return n;
     }
- 
-    while (size) {
 
-        ch = *src++;
+    return uri_encode_run(psrc, size, pdst, dstlen, escape, set);
+}
 
-        if (escape[ch >> 5] & (1U << (ch & 0x1f))) {
-            n += 3;
-            if (n <= dstlen) {
-                *dst++ = '%'; 
-                *dst++ = hex[ch >> 4];
-                *dst++ = hex[ch & 0xf];
-            }
- 
-        } else {
-            n++;
-            if (n <= dstlen)
-                *dst++ = ch;
-        }
+int uri_encode_vec (void * psrc, size_t size, void * pdst, size_t dstlen, uint32 * escvec)
+{
+    chset_t  set;
 
-        size--;
-    }
- 
-    return n;
+    if (!escvec) return uri_encode(psrc, size, pdst, dstlen, ESCAPE_URI);
+
+    /* compiling the set costs about as much as scanning 256 bytes */
+    if (size < 256)
+        return uri_encode_run(psrc, size, pdst, dstlen, escvec, NULL);
+
+    chset_init_map(&set, escvec);
+
+    return uri_encode_run(psrc, size, pdst, dstlen, escvec, &set);
 }
  
 int uri_decode (void * psrc, int size, void * pdst, int dstlen)
@@ -2289,7 +3481,9 @@ int uri_decode (void * psrc, int size, void * pdst, int dstlen)
     uint8  * s = (uint8 *)psrc;
     uint8  * d = (uint8 *)pdst;
     int      len = 0;
+    int      num = 0, cnt = 0;
     uint8    ch, c, decoded;
+    chset_t  stop;
     enum {
         sw_usual = 0,
         sw_quoted,
@@ -2302,10 +3496,27 @@ int uri_decode (void * psrc, int size, void * pdst, int dstlen)
  
     state = 0;
     decoded = 0;
+
+    chset_init(&stop, "%+", 2);
  
-    while (size--) {
- 
+    while (size > 0) {
+
+        /* the plain run before next '%' or '+' is copied at once */
+        if (state == sw_usual && size >= 16) {
+            num = chset_find(s, size, &stop, 0);
+            if (num > 0) {
+                if (len < dstlen) {
+                    cnt = num < dstlen - len ? num : dstlen - len;
+                    memcpy(d, s, cnt);
+                    d += cnt;
+                }
+                len += num; s += num; size -= num;
+                continue;
+            }
+        }
+
         ch = *s++;
+        size--;
  
         switch (state) {
         case sw_usual:
@@ -2634,58 +3845,22 @@ int conv_charset (void * srcst, void * dstst,
 {
     char    * srcchst = (char *)srcst;
     char    * dstchst = (char *)dstst;
-    char    * orig = (char *)psrc;
-    char    * dest = (char *)pdst;
-    iconv_t   hconv = 0;
-    char    * pin = NULL;
-    size_t    inlen = 0;
-    char    * pout = NULL;
-    size_t    outlen = 0;
+    void    * hconv = NULL;
     int       ret = 0;
 
     if (!srcchst || !dstchst) return -1;
 
-    if (!orig || origlen <= 0) return -2;
-    if (!dest || !destlen || *destlen <= 0) return -3;
-
-    hconv = iconv_open(dstchst, srcchst);
-    if (hconv == (iconv_t)-1) return -100;
-
-    pin = orig;  inlen = origlen;
-    pout = dest; outlen = *destlen;
-
-    for (; inlen > 0 && outlen > 0; ) {
-        ret = iconv(hconv, (char **)&pin, (size_t *)&inlen, (char **)&pout, (size_t *)&outlen);
-        if (ret < 0) {
-            if (errno == E2BIG) {
-                /* The output buffer has no more room
-                 * for the next converted character */
-                iconv_close(hconv);
-                return origlen - inlen; //return actual converted bytes in orignal stream
-            } else if (errno == EINVAL) {
-                /* An incomplete multibyte sequence is encountered
-                 * in the input, and the input byte sequence terminates after it.*/
-                *pout = *pin;
-                pin++; pout++;
-                inlen--; outlen--;
-                continue;
-            } else if (errno == EILSEQ) {
-                /* An  invalid multibyte sequence is encountered in the input.
-                 * *inbuf  is  left pointing to the beginning of the
-                 * invalid multibyte sequence. */
-                *pout = *pin;
-                pin++; pout++;
-                inlen--; outlen--;
-                continue;
-            } else break;
-        }
-    }
+    if (!psrc || origlen <= 0) return -2;
+    if (!pdst || !destlen || *destlen <= 0) return -3;
 
-    iconv_close(hconv);
+    /* the converter of the pair is cached by thread, not opened each call */
+    hconv = charconv_get(srcchst, dstchst);
+    if (!hconv) return -100;
 
-    *destlen = *destlen - outlen;
-    return origlen - inlen;
+    ret = charconv_run(hconv, psrc, origlen, pdst, destlen, 1);
+    if (ret < 0) return -100;
 
+    return ret;
 }
 
 #endif
@@ -0,0 +1,750 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "btype.h"
+#include "memory.h"
+#include "btime.h"
+#include "mthread.h"
+#include "thpool.h"
+
+#ifdef UNIX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define THDEQ_INITSIZE   256
+#define THPOOL_SPINS     64
+
+typedef struct th_future_s {
+    void         * pool;
+    void         * result;
+    int            done;
+    int            refcnt;   //freed when both caller and task release it
+    void         * event;
+} ThFuture;
+
+typedef struct th_group_s {
+    long           remain;
+} ThGroup;
+
+typedef struct th_task_s {
+    struct th_task_s * next;
+
+    ThTaskFunc   * func;
+    void         * arg;
+    ThFuture     * fut;
+
+    /* range task of parallel_for */
+    ThRangeFunc  * rfunc;
+    long           from;
+    long           to;
+    ThGroup      * group;
+} ThTask;
+
+
+static void thfuture_unref (ThFuture * fut)
+{
+    if (__atomic_sub_fetch(&fut->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    event_destroy(fut->event);
+    kfree(fut);
+}
+
+static void thtask_exec (ThTask * task)
+{
+    void  * res = NULL;
+
+    if (task->rfunc) {
+        (*task->rfunc)(task->arg, task->from, task->to);
+        __atomic_sub_fetch(&task->group->remain, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    res = (*task->func)(task->arg);
+
+    if (task->fut) {
+        task->fut->result = res;
+        __atomic_store_n(&task->fut->done, 1, __ATOMIC_RELEASE);
+        event_set(task->fut->event, 1);
+        thfuture_unref(task->fut);
+    }
+}
+
+
+#ifdef UNIX
+
+/* Chase-Lev deque. the owner pushes and pops at the bottom, thieves take
+ * the top by CAS. the retired arrays are kept till the pool is freed since
+ * a thief may still be reading them */
+typedef struct th_array_s {
+    struct th_array_s * prev;
+    long                size;
+    ThTask            * slots[1];
+} ThArray;
+
+typedef struct th_deque_s {
+    long           top;
+    uint8          pad0[64 - sizeof(long)];
+    long           bottom;
+    ThArray      * arr;
+    uint8          pad1[64 - sizeof(long) - sizeof(void *)];
+} ThDeque;
+
+typedef struct th_worker_s {
+    ThDeque        dq;
+    void         * pool;
+    int            index;
+    uint32         seed;
+    pthread_t      tid;
+    int            started;
+} ThWorker;
+
+typedef struct th_pool_s {
+    int              num;
+    ThWorker       * workers;
+    pthread_key_t    key;
+
+    CRITICAL_SECTION injCS;
+    ThTask         * injhead;
+    ThTask         * injtail;
+
+    long             queued;    //tasks not yet taken by workers
+    long             pending;   //tasks not yet finished
+    int              idle;
+    int              quit;
+
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    pthread_cond_t   donecond;
+} ThPool;
+
+
+static ThArray * tharray_alloc (long size)
+{
+    ThArray * arr = NULL;
+
+    arr = kzalloc(sizeof(*arr) + sizeof(ThTask *) * (size - 1));
+    if (arr) arr->size = size;
+
+    return arr;
+}
+
+static int thdeque_init (ThDeque * dq)
+{
+    dq->top = dq->bottom = 0;
+    dq->arr = tharray_alloc(THDEQ_INITSIZE);
+
+    return dq->arr ? 0 : -1;
+}
+
+static void thdeque_clean (ThDeque * dq)
+{
+    ThArray * arr = NULL;
+
+    while ((arr = dq->arr) != NULL) {
+        dq->arr = arr->prev;
+        kfree(arr);
+    }
+}
+
+static int thdeque_push (ThDeque * dq, ThTask * task)
+{
+    ThArray * arr = NULL;
+    ThArray * narr = NULL;
+    long      b, t, i;
+
+    b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    arr = __atomic_load_n(&dq->arr, __ATOMIC_RELAXED);
+
+    if (b - t > arr->size - 1) {
+        narr = tharray_alloc(arr->size * 2);
+        if (!narr) return -1;
+
+        for (i = t; i < b; i++)
+            narr->slots[i & (narr->size - 1)] =
+                __atomic_load_n(&arr->slots[i & (arr->size - 1)], __ATOMIC_RELAXED);
+
+        narr->prev = arr;
+        __atomic_store_n(&dq->arr, narr, __ATOMIC_RELEASE);
+        arr = narr;
+    }
+
+    __atomic_store_n(&arr->slots[b & (arr->size - 1)], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static ThTask * thdeque_pop (ThDeque * dq)
+{
+    ThArray * arr = NULL;
+    ThTask  * task = NULL;
+    long      b, t;
+
+    b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    arr = __atomic_load_n(&dq->arr, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    task = __atomic_load_n(&arr->slots[b & (arr->size - 1)], __ATOMIC_RELAXED);
+
+    if (t == b) {
+        /* the last one, race with thieves */
+        if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+static ThTask * thdeque_steal (ThDeque * dq)
+{
+    ThArray * arr = NULL;
+    ThTask  * task = NULL;
+    long      b, t;
+
+    t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) return NULL;
+
+    arr = __atomic_load_n(&dq->arr, __ATOMIC_ACQUIRE);
+    task = __atomic_load_n(&arr->slots[t & (arr->size - 1)], __ATOMIC_RELAXED);
+
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+
+    return task;
+}
+
+
+static ThWorker * thpool_self (ThPool * pool)
+{
+    return pthread_getspecific(pool->key);
+}
+
+static void thpool_wake (ThPool * pool, int num)
+{
+    if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) <= 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (num > 1) pthread_cond_broadcast(&pool->cond);
+    else pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* tasks are linked by next, pushed to own deque when called by a worker */
+static int thpool_push (ThPool * pool, ThTask * list, int num)
+{
+    ThWorker * self = thpool_self(pool);
+    ThTask   * task = NULL;
+    ThTask   * tail = NULL;
+
+    __atomic_add_fetch(&pool->pending, num, __ATOMIC_SEQ_CST);
+
+    if (self) {
+        while ((task = list) != NULL) {
+            list = task->next;
+            task->next = NULL;
+            if (thdeque_push(&self->dq, task) < 0) {
+                task->next = list;
+                list = task;
+                break;
+            }
+        }
+    }
+
+    if (list) {
+        for (tail = list; tail->next; tail = tail->next);
+
+        EnterCriticalSection(&pool->injCS);
+        if (pool->injtail) pool->injtail->next = list;
+        else __atomic_store_n(&pool->injhead, list, __ATOMIC_RELAXED);
+        pool->injtail = tail;
+        LeaveCriticalSection(&pool->injCS);
+    }
+
+    __atomic_add_fetch(&pool->queued, num, __ATOMIC_SEQ_CST);
+
+    thpool_wake(pool, num);
+
+    return 0;
+}
+
+static ThTask * thpool_take (ThPool * pool, ThWorker * self)
+{
+    ThTask  * task = NULL;
+    int       i, start;
+
+    if (self && (task = thdeque_pop(&self->dq)) != NULL)
+        goto got;
+
+    if (__atomic_load_n(&pool->injhead, __ATOMIC_RELAXED)) {
+        EnterCriticalSection(&pool->injCS);
+        task = pool->injhead;
+        if (task) {
+            __atomic_store_n(&pool->injhead, task->next, __ATOMIC_RELAXED);
+            if (!task->next) pool->injtail = NULL;
+            task->next = NULL;
+        }
+        LeaveCriticalSection(&pool->injCS);
+        if (task) goto got;
+    }
+
+    if (self) {
+        self->seed = self->seed * 1103515245 + 12345;
+        start = (self->seed >> 16) % pool->num;
+    } else {
+        start = 0;
+    }
+
+    for (i = 0; i < pool->num; i++) {
+        ThWorker * w = &pool->workers[(start + i) % pool->num];
+        if (w == self) continue;
+
+        task = thdeque_steal(&w->dq);
+        if (task) goto got;
+    }
+
+    return NULL;
+
+got:
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+static void thpool_run (ThPool * pool, ThTask * task)
+{
+    thtask_exec(task);
+    kfree(task);
+
+    if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->donecond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/* execute the queued tasks till the counter drops to 0 */
+static void thpool_help (ThPool * pool, long * counter)
+{
+    ThWorker * self = thpool_self(pool);
+    ThTask   * task = NULL;
+
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) > 0) {
+        task = thpool_take(pool, self);
+        if (task) thpool_run(pool, task);
+        else sched_yield();
+    }
+}
+
+static void * thpool_worker (void * arg)
+{
+    ThWorker * self = (ThWorker *)arg;
+    ThPool   * pool = (ThPool *)self->pool;
+    ThTask   * task = NULL;
+    int        spins = 0;
+
+    pthread_setspecific(pool->key, self);
+
+    for ( ; ; ) {
+        task = thpool_take(pool, self);
+        if (task) {
+            thpool_run(pool, task);
+            spins = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE))
+            break;
+
+        if (++spins < THPOOL_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) <= 0 &&
+               !__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->mutex);
+
+        spins = 0;
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+void * thpool_new (int num, int flags)
+{
+#ifdef UNIX
+    ThPool   * pool = NULL;
+    ThWorker * w = NULL;
+    int        ncpu, i;
+#if defined(_LINUX_)
+    cpu_set_t  cpuset;
+#endif
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 1;
+
+    if (num <= 0) num = ncpu;
+
+    pool = kzalloc(sizeof(*pool));
+    if (!pool) return NULL;
+
+    pool->workers = kzalloc(sizeof(ThWorker) * num);
+    if (!pool->workers) {
+        kfree(pool);
+        return NULL;
+    }
+
+    if (pthread_key_create(&pool->key, NULL) != 0) {
+        kfree(pool->workers);
+        kfree(pool);
+        return NULL;
+    }
+
+    InitializeCriticalSection(&pool->injCS);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pthread_cond_init(&pool->donecond, NULL);
+
+    pool->num = num;
+
+    for (i = 0; i < num; i++) {
+        w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->seed = i * 2654435761U + 1;
+        if (thdeque_init(&w->dq) < 0) goto failed;
+    }
+
+    for (i = 0; i < num; i++) {
+        w = &pool->workers[i];
+        if (pthread_create(&w->tid, NULL, thpool_worker, w) != 0)
+            goto failed;
+        w->started = 1;
+
+#if defined(_LINUX_)
+        if (flags & THPOOL_AFFINITY) {
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % ncpu, &cpuset);
+            pthread_setaffinity_np(w->tid, sizeof(cpuset), &cpuset);
+        }
+#endif
+    }
+
+    return pool;
+
+failed:
+    thpool_free(pool);
+    return NULL;
+#else
+    return NULL;
+#endif
+}
+
+void thpool_free (void * vpool)
+{
+#ifdef UNIX
+    ThPool * pool = (ThPool *)vpool;
+    int      i;
+
+    if (!pool) return;
+
+    thpool_wait(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_store_n(&pool->quit, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->num; i++) {
+        if (pool->workers[i].started)
+            pthread_join(pool->workers[i].tid, NULL);
+    }
+
+    for (i = 0; i < pool->num; i++)
+        thdeque_clean(&pool->workers[i].dq);
+
+    pthread_key_delete(pool->key);
+    DeleteCriticalSection(&pool->injCS);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+    pthread_cond_destroy(&pool->donecond);
+
+    kfree(pool->workers);
+    kfree(pool);
+#endif
+}
+
+int thpool_num (void * vpool)
+{
+#ifdef UNIX
+    ThPool * pool = (ThPool *)vpool;
+
+    if (pool) return pool->num;
+#endif
+    return 0;
+}
+
+long thpool_pending (void * vpool)
+{
+#ifdef UNIX
+    ThPool * pool = (ThPool *)vpool;
+
+    if (pool) return __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE);
+#endif
+    return 0;
+}
+
+int thpool_post (void * vpool, ThTaskFunc * func, void * arg)
+{
+    return thpool_post_batch(vpool, func, &arg, 1);
+}
+
+int thpool_post_batch (void * vpool, ThTaskFunc * func, void ** args, int num)
+{
+#ifdef UNIX
+    ThPool * pool = (ThPool *)vpool;
+    ThTask * list = NULL;
+    ThTask * task = NULL;
+#endif
+    int      i;
+
+    if (!func || (num > 0 && !args)) return -1;
+    if (num <= 0) return 0;
+
+#ifdef UNIX
+    if (pool) {
+        for (i = num - 1; i >= 0; i--) {
+            task = kzalloc(sizeof(*task));
+            if (!task) {
+                while ((task = list) != NULL) {
+                    list = task->next;
+                    kfree(task);
+                }
+                return -2;
+            }
+            task->func = func;
+            task->arg = args[i];
+            task->next = list;
+            list = task;
+        }
+
+        return thpool_push(pool, list, num);
+    }
+#endif
+
+    for (i = 0; i < num; i++)
+        (*func)(args[i]);
+
+    return 0;
+}
+
+void thpool_wait (void * vpool)
+{
+#ifdef UNIX
+    ThPool * pool = (ThPool *)vpool;
+
+    if (!pool) return;
+
+    /* a task waiting for all tasks including itself never returns */
+    if (thpool_self(pool)) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+        pthread_cond_wait(&pool->donecond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+#endif
+}
+
+int thpool_parallel_for (void * vpool, long begin, long end, long grain,
+                         ThRangeFunc * func, void * arg)
+{
+#ifdef UNIX
+    ThPool  * pool = (ThPool *)vpool;
+    ThTask  * list = NULL;
+    ThTask  * task = NULL;
+    ThGroup   group;
+    long      from, to;
+    int       num = 0;
+#endif
+
+    if (!func) return -1;
+    if (begin >= end) return 0;
+
+#ifdef UNIX
+    if (pool && pool->num > 0) {
+        if (grain <= 0) {
+            grain = (end - begin) / (pool->num * 4);
+            if (grain < 1) grain = 1;
+        }
+
+        /* the first range is run by the caller */
+        group.remain = 0;
+        for (from = begin + grain; from < end; from = to) {
+            to = (end - from > grain) ? from + grain : end;
+
+            task = kzalloc(sizeof(*task));
+            if (!task) break;
+
+            task->rfunc = func;
+            task->arg = arg;
+            task->from = from;
+            task->to = to;
+            task->group = &group;
+            task->next = list;
+            list = task;
+            num++;
+        }
+
+        if (task == NULL && from < end) {
+            /* run the ranges that are not queued by the caller */
+            (*func)(arg, from, end);
+        }
+
+        group.remain = num;
+        if (num > 0) thpool_push(pool, list, num);
+
+        (*func)(arg, begin, (end - begin > grain) ? begin + grain : end);
+
+        thpool_help(pool, &group.remain);
+        return 0;
+    }
+#endif
+
+    (*func)(arg, begin, end);
+    return 0;
+}
+
+
+void * thpool_submit (void * vpool, ThTaskFunc * func, void * arg)
+{
+    ThFuture * fut = NULL;
+    ThTask   * task = NULL;
+
+    if (!func) return NULL;
+
+    fut = kzalloc(sizeof(*fut));
+    if (!fut) return NULL;
+
+    fut->pool = vpool;
+    fut->event = event_create();
+    fut->refcnt = 2;
+
+    task = kzalloc(sizeof(*task));
+    if (!task || !fut->event) {
+        if (task) kfree(task);
+        if (fut->event) event_destroy(fut->event);
+        kfree(fut);
+        return NULL;
+    }
+
+    task->func = func;
+    task->arg = arg;
+    task->fut = fut;
+
+#ifdef UNIX
+    if (vpool) {
+        thpool_push((ThPool *)vpool, task, 1);
+        return fut;
+    }
+#endif
+
+    thtask_exec(task);
+    kfree(task);
+
+    return fut;
+}
+
+int thfuture_wait (void * vfut, int millisec, void ** result)
+{
+    ThFuture * fut = (ThFuture *)vfut;
+    btime_t    deadline, now;
+#ifdef UNIX
+    ThPool   * pool = NULL;
+    ThTask   * task = NULL;
+    ThWorker * self = NULL;
+#endif
+
+    if (!fut) return -1;
+
+    if (millisec >= 0) btime_mono_add(&deadline, millisec);
+
+#ifdef UNIX
+    /* a worker runs other tasks instead of blocking */
+    pool = (ThPool *)fut->pool;
+    if (pool && (self = thpool_self(pool)) != NULL) {
+        while (!__atomic_load_n(&fut->done, __ATOMIC_ACQUIRE)) {
+            if (millisec >= 0) {
+                btime_mono(&now);
+                if (btime_cmp(&now, >=, &deadline)) return -1;
+            }
+
+            task = thpool_take(pool, self);
+            if (task) thpool_run(pool, task);
+            else sched_yield();
+        }
+    }
+#endif
+
+    /* the event value may be reset by event_wait after being set,
+     * so it is waited in short slices and the done flag is checked */
+    while (!__atomic_load_n(&fut->done, __ATOMIC_ACQUIRE)) {
+        if (millisec >= 0) {
+            btime_mono(&now);
+            if (btime_cmp(&now, >=, &deadline)) return -1;
+        }
+        event_wait(fut->event, 10);
+    }
+
+    if (result) *result = fut->result;
+
+    return 0;
+}
+
+int thfuture_done (void * vfut)
+{
+    ThFuture * fut = (ThFuture *)vfut;
+
+    if (!fut) return 0;
+
+    return __atomic_load_n(&fut->done, __ATOMIC_ACQUIRE);
+}
+
+void thfuture_free (void * vfut)
+{
+    ThFuture * fut = (ThFuture *)vfut;
+
+    if (!fut) return;
+
+    thfuture_unref(fut);
+}
+
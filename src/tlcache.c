@@ -0,0 +1,255 @@
+/*  
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution. 
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "dynarr.h"
+#include "tlcache.h"
+
+typedef struct tl_magazine_s {
+    struct tl_cache_s * tc;
+
+    ulong     hit;      /* fetched from magazine */
+    ulong     miss;     /* refilled from pool */
+    ulong     recycle;  /* recycled into magazine */
+    ulong     flush;    /* flushed back to pool */
+
+    int       num;
+    void    * units[1];
+} tlmag_t;
+
+typedef struct tl_cache_s {
+    void            * pool;
+    int               depth;
+
+    TLCacheRefill   * refill;
+    TLCacheFlush    * flush;
+
+#ifdef UNIX
+    pthread_key_t     key;
+#endif
+
+    /* all the magazines created by threads, protected by magCS */
+    CRITICAL_SECTION  magCS;
+    arr_t           * maglist;
+} tlcache_t;
+
+
+static void tlmag_flush (tlmag_t * mag, int num)
+{
+    tlcache_t * tc = mag->tc;
+
+    if (num > mag->num) num = mag->num;
+    if (num <= 0) return;
+
+    /* the oldest units at the bottom go back to pool */
+    (*tc->flush)(tc->pool, mag->units, num);
+
+    mag->num -= num;
+    if (mag->num > 0)
+        memmove(&mag->units[0], &mag->units[num], mag->num * sizeof(void *));
+
+    mag->flush += num;
+}
+
+#ifdef UNIX
+static void tlmag_destroy (void * vmag)
+{
+    tlmag_t   * mag = (tlmag_t *)vmag;
+    tlcache_t * tc = NULL;
+
+    if (!mag) return;
+
+    tc = mag->tc;
+
+    tlmag_flush(mag, mag->num);
+
+    EnterCriticalSection(&tc->magCS);
+    arr_delete_ptr(tc->maglist, mag);
+    LeaveCriticalSection(&tc->magCS);
+
+    kfree(mag);
+}
+#endif
+
+static tlmag_t * tlmag_get (tlcache_t * tc)
+{
+    tlmag_t * mag = NULL;
+
+#ifdef UNIX
+    mag = pthread_getspecific(tc->key);
+    if (mag) return mag;
+
+    mag = kzalloc(sizeof(*mag) + tc->depth * sizeof(void *));
+    if (!mag) return NULL;
+
+    mag->tc = tc;
+    mag->num = 0;
+
+    EnterCriticalSection(&tc->magCS);
+    arr_push(tc->maglist, mag);
+    LeaveCriticalSection(&tc->magCS);
+
+    pthread_setspecific(tc->key, mag);
+#endif
+
+    return mag;
+}
+
+
+tlcache_t * tlcache_new (void * pool, int depth, void * refill, void * flush)
+{
+#ifdef UNIX
+    tlcache_t * tc = NULL;
+
+    if (!pool || !refill || !flush) return NULL;
+    if (depth < 2) return NULL;
+
+    tc = kzalloc(sizeof(*tc));
+    if (!tc) return NULL;
+
+    if (pthread_key_create(&tc->key, tlmag_destroy) != 0) {
+        kfree(tc);
+        return NULL;
+    }
+
+    tc->pool = pool;
+    tc->depth = depth;
+    tc->refill = (TLCacheRefill *)refill;
+    tc->flush = (TLCacheFlush *)flush;
+
+    InitializeCriticalSection(&tc->magCS);
+    tc->maglist = arr_new(8);
+
+    return tc;
+#else
+    return NULL;
+#endif
+}
+
+void tlcache_free (tlcache_t * tc)
+{
+    tlmag_t * mag = NULL;
+
+    if (!tc) return;
+
+#ifdef UNIX
+    /* no destructor will be called for exiting threads after key deleted */
+    pthread_key_delete(tc->key);
+#endif
+
+    EnterCriticalSection(&tc->magCS);
+    while ((mag = arr_pop(tc->maglist)) != NULL) {
+        tlmag_flush(mag, mag->num);
+        kfree(mag);
+    }
+    LeaveCriticalSection(&tc->magCS);
+
+    arr_free(tc->maglist);
+    DeleteCriticalSection(&tc->magCS);
+
+    kfree(tc);
+}
+
+void * tlcache_fetch (tlcache_t * tc)
+{
+    tlmag_t * mag = NULL;
+
+    if (!tc) return NULL;
+
+    mag = tlmag_get(tc);
+    if (!mag) return NULL;
+
+    if (mag->num > 0) {
+        mag->hit++;
+        return mag->units[--mag->num];
+    }
+
+    mag->num = (*tc->refill)(tc->pool, mag->units, tc->depth / 2);
+    if (mag->num <= 0) {
+        mag->num = 0;
+        return NULL;
+    }
+
+    mag->miss++;
+    return mag->units[--mag->num];
+}
+
+int tlcache_recycle (tlcache_t * tc, void * unit)
+{
+    tlmag_t * mag = NULL;
+    int       i;
+
+    if (!tc) return -1;
+    if (!unit) return -2;
+
+    mag = tlmag_get(tc);
+    if (!mag) {
+        (*tc->flush)(tc->pool, &unit, 1);
+        return 0;
+    }
+
+    /* a cheap check against recycling the same unit twice in a row */
+    for (i = mag->num - 1; i >= 0; i--) {
+        if (mag->units[i] == unit) return -100;
+    }
+
+    if (mag->num >= tc->depth)
+        tlmag_flush(mag, tc->depth / 2);
+
+    mag->units[mag->num++] = unit;
+    mag->recycle++;
+
+    return 0;
+}
+
+int tlcache_flush (tlcache_t * tc)
+{
+    tlmag_t * mag = NULL;
+
+    if (!tc) return -1;
+
+#ifdef UNIX
+    mag = pthread_getspecific(tc->key);
+#endif
+    if (!mag) return 0;
+
+    tlmag_flush(mag, mag->num);
+    return 0;
+}
+
+int tlcache_depth (tlcache_t * tc)
+{
+    if (!tc) return 0;
+
+    return tc->depth;
+}
+
+int tlcache_stat (tlcache_t * tc, ulong * hit, ulong * miss,
+                  ulong * recycle, ulong * flush)
+{
+    tlmag_t * mag = NULL;
+
+    if (hit) *hit = 0;
+    if (miss) *miss = 0;
+    if (recycle) *recycle = 0;
+    if (flush) *flush = 0;
+
+    if (!tc) return -1;
+
+#ifdef UNIX
+    mag = pthread_getspecific(tc->key);
+#endif
+    if (!mag) return 0;
+
+    if (hit) *hit = mag->hit;
+    if (miss) *miss = mag->miss;
+    if (recycle) *recycle = mag->recycle;
+    if (flush) *flush = mag->flush;
+
+    return mag->num;
+}
+
@@ -11,20 +11,64 @@
 #include "memory.h"
 #include "fileop.h"
 #include "frame.h"
+#include "dynarr.h"
+#include "strutil.h"
+#include "btime.h"
+#include "trace.h"
  
 #ifdef UNIX
 #include "mthread.h"
+#include <sched.h>
+#include <sys/uio.h>
 #endif
 
+#define TRLOG_RECMAX    4096
+#define TRLOG_IOVMAX    64
+
+/* per-thread ring of formatted records, only the owner thread writes into
+ * it and only the writer thread consumes from it */
+typedef struct trlog_ring_ {
+    struct trlog_ring_ * next;
+
+    uint8            * buf;
+    uint32             size;
+    uint32             head;     //consumed by writer thread
+    uint32             tail;     //produced by owner thread
+    uint32             records;
+    uint32             lastrec;
+    int                closed;   //owner thread exited
+} trlog_ring_t;
+
 typedef struct trace_log_ {
     char               logfile[128];
     FILE             * logfp;
     int                logline;
     CRITICAL_SECTION   logCS;
+
+    /* asynchronous mode */
+    uint8              async;
+    int                quit;
+    int                ringsize;
+    int                maxline;
+    int                waitus;
+    uint64             drops;
+#ifdef UNIX
+    pthread_key_t      ringkey;
+    pthread_t          writer;
+#endif
+    CRITICAL_SECTION   ringCS;
+    trlog_ring_t     * rings;
+
+    /* binary records */
+    FILE             * binfp;
+    arr_t            * binfmts;
+    CRITICAL_SECTION   binCS;
 } trlog_t;
 
 void * g_trace_log = NULL;
 
+static void trlog_bin_clean (trlog_t * hlog);
+
 
 void * trlog_init (char * logfile, int calcline)
 {
@@ -45,6 +89,7 @@ void * trlog_init (char * logfile, int calcline)
         hlog->logline = 0;
 
     InitializeCriticalSection(&hlog->logCS);
+    InitializeCriticalSection(&hlog->binCS);
 
     strncpy(hlog->logfile, logfile, sizeof(hlog->logfile)-1);
     hlog->logfp = fopen(hlog->logfile, "a+");
@@ -63,6 +108,12 @@ void trlog_clean (void * vlog)
     if (g_trace_log == hlog)
         g_trace_log = NULL;
 
+#ifdef UNIX
+    if (hlog->async) trlog_async_stop(hlog);
+#endif
+
+    trlog_bin_clean(hlog);
+
     DeleteCriticalSection(&hlog->logCS);
 
     if (hlog->logfp) {
@@ -82,12 +133,9 @@ int trlog_line (void * vlog)
     return hlog->logline;
 }
 
-void trlog_rollover (void * vlog, int line)
+static void trlog_rollover_nolock (trlog_t * hlog, int line)
 {
-    trlog_t   * hlog = (trlog_t *)vlog;
-    int         ret;
-
-    EnterCriticalSection(&hlog->logCS);
+    int  ret;
 
     if (hlog->logfp) fclose(hlog->logfp);
  
@@ -96,28 +144,311 @@ void trlog_rollover (void * vlog, int line)
     if (hlog->logline < 0) hlog->logline = 0;
  
     hlog->logfp = fopen(hlog->logfile, "a+");
+}
 
+void trlog_rollover (void * vlog, int line)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+
+    if (!hlog) return;
+
+    EnterCriticalSection(&hlog->logCS);
+    trlog_rollover_nolock(hlog, line);
     LeaveCriticalSection(&hlog->logCS);
 }
 
 
+#ifdef UNIX
+
+static void trlog_ring_exit (void * vring)
+{
+    trlog_ring_t * ring = (trlog_ring_t *)vring;
+
+    if (ring) __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static trlog_ring_t * trlog_ring_get (trlog_t * hlog)
+{
+    trlog_ring_t * ring = NULL;
+
+    ring = pthread_getspecific(hlog->ringkey);
+    if (ring) return ring;
+
+    ring = kzalloc(sizeof(*ring) + hlog->ringsize);
+    if (!ring) return NULL;
+
+    ring->buf = (uint8 *)(ring + 1);
+    ring->size = hlog->ringsize;
+
+    EnterCriticalSection(&hlog->ringCS);
+    ring->next = hlog->rings;
+    __atomic_store_n(&hlog->rings, ring, __ATOMIC_RELEASE);
+    LeaveCriticalSection(&hlog->ringCS);
+
+    pthread_setspecific(hlog->ringkey, ring);
+
+    return ring;
+}
+
+/* write the records of all rings by writev in batches, then do rollover
+ * if the lines exceed maxline. return the bytes written */
+static long trlog_drain (trlog_t * hlog)
+{
+    trlog_ring_t  * ring = NULL;
+    trlog_ring_t  * rings[TRLOG_IOVMAX / 2];
+    trlog_ring_t ** pprev = NULL;
+    struct iovec    iov[TRLOG_IOVMAX];
+    uint32          tails[TRLOG_IOVMAX / 2];
+    uint32          recs[TRLOG_IOVMAX / 2];
+    uint32          head, tail, off, len;
+    long            total = 0;
+    int             i, n, iovcnt, ret;
+
+    EnterCriticalSection(&hlog->logCS);
+
+    ring = __atomic_load_n(&hlog->rings, __ATOMIC_ACQUIRE);
+
+    while (ring) {
+        for (n = 0, iovcnt = 0; ring && n < TRLOG_IOVMAX / 2; ring = ring->next) {
+            recs[n] = __atomic_load_n(&ring->records, __ATOMIC_ACQUIRE);
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            head = ring->head;
+            if (tail == head) continue;
+
+            off = head & (ring->size - 1);
+            len = tail - head;
+
+            iov[iovcnt].iov_base = ring->buf + off;
+            iov[iovcnt].iov_len = min(len, ring->size - off);
+            iovcnt++;
+
+            if (len > ring->size - off) {
+                iov[iovcnt].iov_base = ring->buf;
+                iov[iovcnt].iov_len = len - (ring->size - off);
+                iovcnt++;
+            }
+
+            rings[n] = ring;
+            tails[n] = tail;
+            n++;
+        }
+
+        if (n == 0) break;
+
+        if (hlog->logfp) {
+            for (i = 0; i < iovcnt; ) {
+                ret = writev(fileno(hlog->logfp), iov + i, iovcnt - i);
+                if (ret < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                total += ret;
+
+                while (i < iovcnt && ret >= (int)iov[i].iov_len)
+                    ret -= iov[i++].iov_len;
+
+                if (i < iovcnt) {
+                    iov[i].iov_base = (uint8 *)iov[i].iov_base + ret;
+                    iov[i].iov_len -= ret;
+                }
+            }
+        }
+
+        /* the records are released to owner threads even if writing failed */
+        for (i = 0; i < n; i++) {
+            hlog->logline += recs[i] - rings[i]->lastrec;
+            rings[i]->lastrec = recs[i];
+            __atomic_store_n(&rings[i]->head, tails[i], __ATOMIC_RELEASE);
+        }
+    }
+
+    /* free the rings of exited threads after drained */
+    EnterCriticalSection(&hlog->ringCS);
+    for (pprev = &hlog->rings; (ring = *pprev) != NULL; ) {
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+            ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        {
+            *pprev = ring->next;
+            kfree(ring);
+            continue;
+        }
+        pprev = &ring->next;
+    }
+    LeaveCriticalSection(&hlog->ringCS);
+
+    /* drop the oldest quarter of lines */
+    if (hlog->maxline > 0 && hlog->logline > hlog->maxline)
+        trlog_rollover_nolock(hlog, hlog->logline - hlog->maxline * 3 / 4);
+
+    LeaveCriticalSection(&hlog->logCS);
+
+    return total;
+}
+
+static void * trlog_writer (void * arg)
+{
+    trlog_t  * hlog = (trlog_t *)arg;
+
+    while (!__atomic_load_n(&hlog->quit, __ATOMIC_ACQUIRE)) {
+        if (trlog_drain(hlog) == 0)
+            usleep(2000);
+    }
+
+    trlog_drain(hlog);
+
+    return NULL;
+}
+
+int trlog_async (void * vlog, int ringsize, int maxline, int waitus)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+    int         size;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog) return -1;
+
+    if (hlog->async) return 0;
+
+    if (ringsize <= 0) ringsize = 256 * 1024;
+    for (size = TRLOG_RECMAX * 2; size < ringsize; size <<= 1);
+
+    hlog->ringsize = size;
+    hlog->maxline = maxline;
+    hlog->waitus = waitus;
+    hlog->quit = 0;
+
+    InitializeCriticalSection(&hlog->ringCS);
+
+    if (pthread_key_create(&hlog->ringkey, trlog_ring_exit) != 0) {
+        DeleteCriticalSection(&hlog->ringCS);
+        return -2;
+    }
+
+    EnterCriticalSection(&hlog->logCS);
+    if (hlog->logfp) fflush(hlog->logfp);
+    LeaveCriticalSection(&hlog->logCS);
+
+    if (pthread_create(&hlog->writer, NULL, trlog_writer, hlog) != 0) {
+        pthread_key_delete(hlog->ringkey);
+        DeleteCriticalSection(&hlog->ringCS);
+        return -3;
+    }
+
+    __atomic_store_n(&hlog->async, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void trlog_async_stop (void * vlog)
+{
+    trlog_t      * hlog = (trlog_t *)vlog;
+    trlog_ring_t * ring = NULL;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog || !hlog->async) return;
+
+    __atomic_store_n(&hlog->async, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&hlog->quit, 1, __ATOMIC_RELEASE);
+
+    pthread_join(hlog->writer, NULL);
+
+    pthread_key_delete(hlog->ringkey);
+
+    while ((ring = hlog->rings) != NULL) {
+        hlog->rings = ring->next;
+        kfree(ring);
+    }
+
+    DeleteCriticalSection(&hlog->ringCS);
+}
+
+uint64 trlog_drops (void * vlog)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog) return 0;
+
+    return __atomic_load_n(&hlog->drops, __ATOMIC_RELAXED);
+}
+
+static void trlog_async_put (trlog_t * hlog, int rectime, char * file, int line, char * fmt, va_list args)
+{
+    trlog_ring_t * ring = NULL;
+    char           rec[TRLOG_RECMAX];
+    uint32         head, off, first;
+    int            n = 0, ret;
+    int            waited = 0;
+
+    ring = trlog_ring_get(hlog);
+    if (!ring) {
+        __atomic_fetch_add(&hlog->drops, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (rectime) {
+        /* the timestamp is formatted once per second for all threads */
+        memcpy(rec, btime_localstr(&n), n);
+        rec[n++] = ' ';
+
+        if (file) {
+            ret = snprintf(rec + n, sizeof(rec) - n, "%s:%d ", file, line);
+            if (ret > 0) n = min(n + ret, (int)sizeof(rec) - 1);
+        }
+    }
+
+    ret = vsnprintf(rec + n, sizeof(rec) - n, fmt, args);
+    if (ret > 0) n = min(n + ret, (int)sizeof(rec) - 1);
+    if (n <= 0) return;
+
+    /* ring full, wait for the writer at most waitus, then drop the record */
+    for ( ; ; ) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->size - (ring->tail - head) >= (uint32)n)
+            break;
+
+        if (waited >= hlog->waitus) {
+            __atomic_fetch_add(&hlog->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+        waited += 10;
+    }
+
+    off = ring->tail & (ring->size - 1);
+    first = min((uint32)n, ring->size - off);
+
+    memcpy(ring->buf + off, rec, first);
+    if (first < (uint32)n)
+        memcpy(ring->buf, rec + first, n - first);
+
+    __atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->records, ring->records + 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+
 void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...)
 {
     trlog_t   * hlog = (trlog_t *)vlog;
     va_list     args;
-    time_t      curt = 0;
-    struct tm   st;
  
     if (!hlog) return;
  
+#ifdef UNIX
+    if (__atomic_load_n(&hlog->async, __ATOMIC_ACQUIRE)) {
+        va_start(args, fmt);
+        trlog_async_put(hlog, rectime, file, line, fmt, args);
+        va_end(args);
+        return;
+    }
+#endif
+
     EnterCriticalSection(&hlog->logCS);
  
     if (rectime) {
-        time(&curt);
-        st = *localtime(&curt);
- 
-        fprintf(hlog->logfp, "%04d-%02d-%02d %02d:%02d:%02d ",
-                st.tm_year+1900, st.tm_mon+1, st.tm_mday, st.tm_hour, st.tm_min, st.tm_sec);
+        fprintf(hlog->logfp, "%s ", btime_localstr(NULL));
         if (file) fprintf(hlog->logfp, "%s:%d ", file, line);
     }
  
@@ -131,7 +462,515 @@ void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...
     LeaveCriticalSection(&hlog->logCS);
 }
 
- 
+/* binary trace records. the format string is registered once and written
+ * to the binary file as a definition record, each trace call then writes
+ * the format id and the raw arguments. trlog_bin_decode renders them back
+ * to the text of trlogfile offline.
+ *
+ * record: uint8 type, uint8 rectime, uint16 argnum, uint32 len, body
+ *   TRBIN_RESET  body "TRBN" + uint32 version, the format table is reset
+ *   TRBIN_FMT    uint32 id, uint32 line, uint16 filelen, uint16 typelen,
+ *                uint32 fmtlen, file, types, fmt
+ *   TRBIN_EVENT  uint32 id, int64 time, args
+ * args are int32, int64, double, pointer as uint64, or string by uint16
+ * length and the bytes */
+
+#define TRBIN_RESET     0
+#define TRBIN_FMT       1
+#define TRBIN_EVENT     2
+
+#define TRBIN_VERSION   1
+#define TRBIN_MAXARG    32
+#define TRBIN_HDRLEN    8
+
+typedef struct trbin_fmt_ {
+    int       id;
+    int       line;
+    char    * file;
+    char    * fmt;
+    int       argnum;
+    char      types[TRBIN_MAXARG];
+} trbin_fmt_t;
+
+/* parse the printf conversions of fmt into the argument types:
+ *   'i' int, 'l' long/size_t, 'q' long long, 'd' double, 's' string, 'p' pointer */
+static int trbin_parse (char * fmt, char * types, int max)
+{
+    char  * p = fmt;
+    int     num = 0;
+    int     lmod;
+
+    while (p && *p) {
+        if (*p++ != '%') continue;
+        if (*p == '%') { p++; continue; }
+
+        while (*p && strchr("-+ #0'", *p)) p++;
+        if (*p == '*') { if (num < max) types[num++] = 'i'; p++; }
+        else while (*p >= '0' && *p <= '9') p++;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') { if (num < max) types[num++] = 'i'; p++; }
+            else while (*p >= '0' && *p <= '9') p++;
+        }
+
+        lmod = 0;
+        while (*p && strchr("hlLqjzt", *p)) {
+            if (*p == 'l' || *p == 'z' || *p == 't') lmod++;
+            else if (*p != 'h') lmod += 2;
+            p++;
+        }
+        if (!*p) break;
+
+        if (num >= max) return -1;
+
+        switch (*p++) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            types[num++] = lmod >= 2 ? 'q' : (lmod ? 'l' : 'i');
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            types[num++] = 'd';
+            break;
+        case 's':
+            types[num++] = 's';
+            break;
+        case 'p': case 'n':
+            types[num++] = 'p';
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return num;
+}
+
+static int trbin_putfmt (trlog_t * hlog, trbin_fmt_t * tf)
+{
+    uint8    hdr[TRBIN_HDRLEN + 16];
+    uint32   val32, len;
+    uint16   val16;
+    int      flen = strlen(tf->file);
+    int      mlen = strlen(tf->fmt);
+
+    if (!hlog->binfp) return -1;
+
+    if (flen > 65535) flen = 65535;
+
+    len = sizeof(hdr) + flen + tf->argnum + mlen;
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = TRBIN_FMT;
+    memcpy(hdr + 4, &len, 4);
+    val32 = tf->id;     memcpy(hdr + 8, &val32, 4);
+    val32 = tf->line;   memcpy(hdr + 12, &val32, 4);
+    val16 = flen;       memcpy(hdr + 16, &val16, 2);
+    val16 = tf->argnum; memcpy(hdr + 18, &val16, 2);
+    val32 = mlen;       memcpy(hdr + 20, &val32, 4);
+
+    fwrite(hdr, 1, sizeof(hdr), hlog->binfp);
+    fwrite(tf->file, 1, flen, hlog->binfp);
+    fwrite(tf->types, 1, tf->argnum, hlog->binfp);
+    fwrite(tf->fmt, 1, mlen, hlog->binfp);
+
+    return 0;
+}
+
+int trlog_bin_open (void * vlog, char * binfile)
+{
+    trlog_t     * hlog = (trlog_t *)vlog;
+    trbin_fmt_t * tf = NULL;
+    uint8         hdr[TRBIN_HDRLEN + 8];
+    uint32        val;
+    int           i, num;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog || !binfile) return -1;
+
+    EnterCriticalSection(&hlog->binCS);
+
+    if (hlog->binfp) fclose(hlog->binfp);
+
+    hlog->binfp = fopen(binfile, "ab");
+    if (!hlog->binfp) {
+        LeaveCriticalSection(&hlog->binCS);
+        return -2;
+    }
+    setvbuf(hlog->binfp, NULL, _IOFBF, 64 * 1024);
+
+    /* the file may be appended by many runs, each starts by reset record
+     * and the definitions of formats registered so far */
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = TRBIN_RESET;
+    val = sizeof(hdr);      memcpy(hdr + 4, &val, 4);
+    memcpy(hdr + 8, "TRBN", 4);
+    val = TRBIN_VERSION;    memcpy(hdr + 12, &val, 4);
+    fwrite(hdr, 1, sizeof(hdr), hlog->binfp);
+
+    num = arr_num(hlog->binfmts);
+    for (i = 0; i < num; i++) {
+        tf = arr_value(hlog->binfmts, i);
+        trbin_putfmt(hlog, tf);
+    }
+
+    LeaveCriticalSection(&hlog->binCS);
+    return 0;
+}
+
+void trlog_bin_flush (void * vlog)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog) return;
+
+    EnterCriticalSection(&hlog->binCS);
+    if (hlog->binfp) fflush(hlog->binfp);
+    LeaveCriticalSection(&hlog->binCS);
+}
+
+static void trbin_fmt_free (void * vfmt)
+{
+    trbin_fmt_t * tf = (trbin_fmt_t *)vfmt;
+
+    if (!tf) return;
+
+    if (tf->file) kfree(tf->file);
+    if (tf->fmt) kfree(tf->fmt);
+    kfree(tf);
+}
+
+static void trlog_bin_clean (trlog_t * hlog)
+{
+    if (hlog->binfp) {
+        fflush(hlog->binfp);
+        fclose(hlog->binfp);
+        hlog->binfp = NULL;
+    }
+
+    arr_pop_free(hlog->binfmts, trbin_fmt_free);
+    hlog->binfmts = NULL;
+
+    DeleteCriticalSection(&hlog->binCS);
+}
+
+int trlog_bin_fmtid (void * vlog, char * file, int line, char * fmt)
+{
+    trlog_t     * hlog = (trlog_t *)vlog;
+    trbin_fmt_t * tf = NULL;
+    int           id;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog || !fmt) return -1;
+
+    if (!file) file = "";
+
+    tf = kzalloc(sizeof(*tf));
+    if (!tf) return -2;
+
+    tf->argnum = trbin_parse(fmt, tf->types, TRBIN_MAXARG);
+    if (tf->argnum < 0) {
+        kfree(tf);
+        return -3;
+    }
+
+    tf->line = line;
+    tf->file = str_dup(file, strlen(file));
+    tf->fmt = str_dup(fmt, strlen(fmt));
+
+    EnterCriticalSection(&hlog->binCS);
+
+    if (!hlog->binfmts) hlog->binfmts = arr_new(16);
+
+    id = tf->id = arr_num(hlog->binfmts);
+    arr_push(hlog->binfmts, tf);
+
+    trbin_putfmt(hlog, tf);
+
+    LeaveCriticalSection(&hlog->binCS);
+
+    return id;
+}
+
+void trlog_bin (void * vlog, int fmtid, int rectime, ...)
+{
+    trlog_t     * hlog = (trlog_t *)vlog;
+    trbin_fmt_t * tf = NULL;
+    va_list       args;
+    uint8         rec[TRLOG_RECMAX];
+    int           i, len, slen;
+    uint32        val32;
+    int64         val64;
+    double        dval;
+    char        * str;
+    uint16        val16;
+
+    if (!hlog) hlog = g_trace_log;
+    if (!hlog || !hlog->binfp || fmtid < 0) return;
+
+    EnterCriticalSection(&hlog->binCS);
+    tf = arr_value(hlog->binfmts, fmtid);
+    LeaveCriticalSection(&hlog->binCS);
+    if (!tf) return;
+
+    memset(rec, 0, TRBIN_HDRLEN);
+    rec[0] = TRBIN_EVENT;
+    rec[1] = rectime ? 1 : 0;
+    val16 = tf->argnum; memcpy(rec + 2, &val16, 2);
+    val32 = fmtid;      memcpy(rec + 8, &val32, 4);
+    val64 = rectime ? (int64)time(NULL) : 0;
+    memcpy(rec + 12, &val64, 8);
+    len = 20;
+
+    va_start(args, rectime);
+    for (i = 0; i < tf->argnum; i++) {
+        switch (tf->types[i]) {
+        case 'i':
+            val32 = va_arg(args, int);
+            memcpy(rec + len, &val32, 4); len += 4;
+            break;
+        case 'l':
+            val64 = va_arg(args, long);
+            memcpy(rec + len, &val64, 8); len += 8;
+            break;
+        case 'q':
+            val64 = va_arg(args, long long);
+            memcpy(rec + len, &val64, 8); len += 8;
+            break;
+        case 'd':
+            dval = va_arg(args, double);
+            memcpy(rec + len, &dval, 8); len += 8;
+            break;
+        case 'p':
+            val64 = (int64)(ulong)va_arg(args, void *);
+            memcpy(rec + len, &val64, 8); len += 8;
+            break;
+        case 's':
+            str = va_arg(args, char *);
+            if (!str) str = "(null)";
+            slen = strlen(str);
+            /* keep room for the rest arguments, 8 bytes at most each */
+            if (slen > (int)sizeof(rec) - len - 2 - (tf->argnum - i - 1) * 10)
+                slen = sizeof(rec) - len - 2 - (tf->argnum - i - 1) * 10;
+            if (slen < 0) slen = 0;
+            val16 = slen;
+            memcpy(rec + len, &val16, 2); len += 2;
+            memcpy(rec + len, str, slen); len += slen;
+            break;
+        }
+    }
+    va_end(args);
+
+    val32 = len; memcpy(rec + 4, &val32, 4);
+
+    EnterCriticalSection(&hlog->binCS);
+    if (hlog->binfp) fwrite(rec, 1, len, hlog->binfp);
+    LeaveCriticalSection(&hlog->binCS);
+}
+
+/* print one conversion spec of fmt with the decoded arguments */
+static int trbin_print (FILE * out, char * spec, char type, int * stars, int nstar,
+                        int64 ival, double dval, char * str)
+{
+    if (type == 's') {
+        if (nstar == 2) return fprintf(out, spec, stars[0], stars[1], str);
+        if (nstar == 1) return fprintf(out, spec, stars[0], str);
+        return fprintf(out, spec, str);
+    }
+    if (type == 'd') {
+        if (nstar == 2) return fprintf(out, spec, stars[0], stars[1], dval);
+        if (nstar == 1) return fprintf(out, spec, stars[0], dval);
+        return fprintf(out, spec, dval);
+    }
+    if (type == 'p') {
+        return fprintf(out, "%p", (void *)(ulong)ival);
+    }
+    if (type == 'l' || type == 'q') {
+        if (nstar == 2) return fprintf(out, spec, stars[0], stars[1], (long long)ival);
+        if (nstar == 1) return fprintf(out, spec, stars[0], (long long)ival);
+        return fprintf(out, spec, (long long)ival);
+    }
+    if (nstar == 2) return fprintf(out, spec, stars[0], stars[1], (int)ival);
+    if (nstar == 1) return fprintf(out, spec, stars[0], (int)ival);
+    return fprintf(out, spec, (int)ival);
+}
+
+static void trbin_render (FILE * out, trbin_fmt_t * tf, int rectime, int64 tick,
+                          uint8 * pbyte, int len)
+{
+    char      spec[64];
+    char    * p, * s;
+    struct tm st;
+    time_t    curt;
+    int       argi = 0, pos = 0, nstar, slen, speclen;
+    int       stars[2];
+    int64     ival = 0;
+    double    dval = 0;
+    int32     val32;
+    uint16    val16;
+    char      type;
+    char    * str = NULL;
+
+    if (rectime) {
+        curt = (time_t)tick;
+        st = *localtime(&curt);
+        fprintf(out, "%04d-%02d-%02d %02d:%02d:%02d ",
+                st.tm_year+1900, st.tm_mon+1, st.tm_mday, st.tm_hour, st.tm_min, st.tm_sec);
+        if (tf->file[0]) fprintf(out, "%s:%d ", tf->file, tf->line);
+    }
+
+    for (p = tf->fmt; *p; ) {
+        if (*p != '%') { fputc(*p++, out); continue; }
+        if (p[1] == '%') { fputc('%', out); p += 2; continue; }
+
+        /* copy the conversion spec, ll/L/z/j/t/q modifiers become ll */
+        s = p++;
+        speclen = 0;
+        spec[speclen++] = '%';
+        nstar = 0;
+        while (*p && strchr("-+ #0'.*0123456789", *p)) {
+            if (*p == '*' && argi < tf->argnum && nstar < 2 && pos + 4 <= len) {
+                memcpy(&val32, pbyte + pos, 4); pos += 4; argi++;
+                stars[nstar++] = val32;
+            }
+            if (speclen < (int)sizeof(spec) - 4) spec[speclen++] = *p;
+            p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        if (!*p || argi >= tf->argnum) {
+            fwrite(s, 1, p - s, out);
+            continue;
+        }
+
+        type = tf->types[argi++];
+        if (type == 'l' || type == 'q') { spec[speclen++] = 'l'; spec[speclen++] = 'l'; }
+        spec[speclen++] = *p++;
+        spec[speclen] = '\0';
+
+        switch (type) {
+        case 'i':
+            if (pos + 4 > len) return;
+            memcpy(&val32, pbyte + pos, 4); pos += 4;
+            ival = val32;
+            break;
+        case 'l': case 'q': case 'p':
+            if (pos + 8 > len) return;
+            memcpy(&ival, pbyte + pos, 8); pos += 8;
+            break;
+        case 'd':
+            if (pos + 8 > len) return;
+            memcpy(&dval, pbyte + pos, 8); pos += 8;
+            break;
+        case 's':
+            if (pos + 2 > len) return;
+            memcpy(&val16, pbyte + pos, 2); pos += 2;
+            slen = val16;
+            if (pos + slen > len) return;
+            str = kalloc(slen + 1);
+            if (!str) return;
+            memcpy(str, pbyte + pos, slen); str[slen] = '\0';
+            pos += slen;
+            break;
+        }
+
+        if (spec[speclen-1] == 'n') {
+            /* %n is not rendered */
+        } else {
+            trbin_print(out, spec, type, stars, nstar, ival, dval, str);
+        }
+
+        if (str) { kfree(str); str = NULL; }
+    }
+}
+
+/* render the binary trace file to out in the text format of trlogfile,
+ * return the number of events rendered */
+long trlog_bin_decode (char * binfile, FILE * out)
+{
+    FILE        * fp = NULL;
+    arr_t       * fmts = NULL;
+    trbin_fmt_t * tf = NULL;
+    uint8         hdr[TRBIN_HDRLEN];
+    uint8       * body = NULL;
+    uint32        len, id, val32;
+    uint16        flen, tlen;
+    int64         tick;
+    long          events = 0;
+
+    if (!binfile || !out) return -1;
+
+    fp = fopen(binfile, "rb");
+    if (!fp) return -2;
+
+    fmts = arr_new(16);
+
+    while (fread(hdr, 1, TRBIN_HDRLEN, fp) == TRBIN_HDRLEN) {
+        memcpy(&len, hdr + 4, 4);
+        if (len < TRBIN_HDRLEN || len > 16 * 1024 * 1024) break;
+
+        len -= TRBIN_HDRLEN;
+        body = kalloc(len + 1);
+        if (!body) break;
+        if (fread(body, 1, len, fp) != len) { kfree(body); break; }
+
+        switch (hdr[0]) {
+        case TRBIN_RESET:
+            if (len < 8 || memcmp(body, "TRBN", 4) != 0) {
+                kfree(body); goto end;
+            }
+            arr_pop_free(fmts, trbin_fmt_free);
+            fmts = arr_new(16);
+            break;
+
+        case TRBIN_FMT:
+            if (len < 16) break;
+            memcpy(&id, body, 4);
+            memcpy(&flen, body + 8, 2);
+            memcpy(&tlen, body + 10, 2);
+            memcpy(&val32, body + 12, 4);
+            if (16 + flen + tlen + val32 > len || tlen > TRBIN_MAXARG) break;
+
+            tf = kzalloc(sizeof(*tf));
+            if (!tf) break;
+            tf->id = id;
+            memcpy(&val32, body + 4, 4); tf->line = val32;
+            tf->file = str_dup((char *)body + 16, flen);
+            tf->argnum = tlen;
+            memcpy(tf->types, body + 16 + flen, tlen);
+            memcpy(&val32, body + 12, 4);
+            tf->fmt = str_dup((char *)body + 16 + flen + tlen, val32);
+
+            while (arr_num(fmts) < (int)id) arr_push(fmts, NULL);
+            if (arr_num(fmts) == (int)id) {
+                arr_push(fmts, tf);
+            } else {
+                trbin_fmt_free(arr_value(fmts, id));
+                arr_set(fmts, id, tf);
+            }
+            break;
+
+        case TRBIN_EVENT:
+            if (len < 12) break;
+            memcpy(&id, body, 4);
+            memcpy(&tick, body + 4, 8);
+            tf = arr_value(fmts, id);
+            if (!tf) break;
+
+            trbin_render(out, tf, hdr[1], tick, body + 12, len - 12);
+            events++;
+            break;
+        }
+
+        kfree(body);
+    }
+
+end:
+    arr_pop_free(fmts, trbin_fmt_free);
+    fclose(fp);
+
+    return events;
+}
+
+
 void printOctet (FILE * fp, void * data, int start, int count, int margin)
 {
 #define CHARS_ON_LINE 16
@@ -3,11 +3,17 @@
  * All rights reserved. See MIT LICENSE for redistribution.
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "btype.h"
 #include "memory.h"
+#include "bpool.h"
 #include "tsock.h"
 #include "strutil.h"
 #include "trace.h"
+#include "metrics.h"
 
 #include <signal.h>
 
@@ -33,6 +39,10 @@
 
 #define SENDFILE_MAXSIZE  2147479552L
 
+#if defined(_LINUX_)
+#include <linux/filter.h>
+#endif
+
 #endif
 
 #ifdef _WIN32
@@ -1019,6 +1029,130 @@ SOCKET tcp_listen (char * localip, int port, void * psockopt)
     return listenfd;
 }
 
+/* the kernel picks the listener of index A in the reuseport group, the
+ * index being the order the sockets joined the group */
+static int tcp_listen_steer (SOCKET fd, int num)
+{
+#if defined(_LINUX_) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32)num },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0)
+        return -1;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int tcp_listen_sharded (char * localip, int port, void * psockopt, int num,
+                        int cpusteer, SOCKET * fds)
+{
+    sockopt_t   opt;
+    int         i;
+
+    if (num <= 0 || !fds) return -1;
+
+#ifndef SO_REUSEPORT
+    if (num > 1) return -2;
+#endif
+
+    if (psockopt) {
+        memcpy(&opt, psockopt, sizeof(opt));
+    } else {
+        memset(&opt, 0, sizeof(opt));
+        opt.mask = SOM_REUSEADDR | SOM_KEEPALIVE;
+        opt.reuseaddr = 1;
+        opt.keepalive = 1;
+    }
+    opt.mask |= SOM_REUSEPORT;
+    opt.reuseport = 1;
+
+    for (i = 0; i < num; i++) {
+        fds[i] = tcp_listen(localip, port, &opt);
+        if (fds[i] == INVALID_SOCKET || fds[i] < 0)
+            goto failed;
+    }
+
+    if (cpusteer && num > 1 && tcp_listen_steer(fds[0], num) < 0)
+        tolog(1, "tcp_listen_sharded %s:%d CPU steering not attached\n",
+              localip ? localip : "", port);
+
+    return num;
+
+failed:
+    tolog(1, "tcp_listen_sharded %s:%d listener %d of %d failed\n",
+          localip ? localip : "", port, i, num);
+
+    while (--i >= 0) {
+        closesocket(fds[i]);
+        fds[i] = INVALID_SOCKET;
+    }
+    return -100;
+}
+
+int tcp_accept_batch (SOCKET listenfd, SOCKET * fds, ep_sockaddr_t * addrs, int num,
+                      int nonblk, int * perr)
+{
+    struct sockaddr_storage  ss;
+    socklen_t                sslen;
+    SOCKET                   fd;
+    int                      got = 0;
+
+    if (perr) *perr = 0;
+
+    if (listenfd == INVALID_SOCKET || !fds) return -1;
+
+    while (got < num) {
+        sslen = sizeof(ss);
+
+#if defined(_LINUX_)
+        fd = accept4(listenfd, (struct sockaddr *)&ss, &sslen,
+                     SOCK_CLOEXEC | (nonblk ? SOCK_NONBLOCK : 0));
+#else
+        fd = accept(listenfd, (struct sockaddr *)&ss, &sslen);
+#endif
+        if (fd == INVALID_SOCKET) {
+            if (errno == EINTR) continue;
+
+            /* the pending connection was reset before accepted */
+            if (errno == ECONNABORTED || errno == EPROTO) continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK && perr)
+                *perr = errno;
+            break;
+        }
+
+#if !defined(_LINUX_)
+#ifdef UNIX
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+        if (nonblk) sock_nonblock_set(fd, 1);
+#endif
+
+        if (addrs) {
+            memset(&addrs[got], 0, sizeof(ep_sockaddr_t));
+            if (sslen > sizeof(addrs[got].u)) sslen = sizeof(addrs[got].u);
+            memcpy(&addrs[got].u, &ss, sslen);
+            addrs[got].socklen = sslen;
+            addrs[got].family = ss.ss_family;
+            addrs[got].socktype = SOCK_STREAM;
+        }
+
+        fds[got++] = fd;
+    }
+
+    return got;
+}
+
 SOCKET tcp_connect_full (char * host, int port, int nonblk, char * lip, int lport, int * succ)
 {
     struct addrinfo    hints;
@@ -1265,6 +1399,7 @@ beginrecv:
 #ifdef _WIN32
             errcode = WSAGetLastError();
             if (errcode == WSAEINTR || errcode == WSAEWOULDBLOCK) {
+                if (errcode != WSAEINTR) metric_inc(MC_TSOCK_RECV_EAGAIN);
                 if (toread <= 0 && waitms <= 0) break;
                 continue;
             }
@@ -1272,6 +1407,7 @@ beginrecv:
 #ifdef UNIX
             errcode = errno;
             if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (errcode != EINTR) metric_inc(MC_TSOCK_RECV_EAGAIN);
                 if (toread <= 0 && waitms <= 0) break;
                 continue;
             }
@@ -1396,12 +1532,14 @@ int tcp_send (SOCKET fd, void * psendbuf, int towrite, long waitms, int * actnum
 #ifdef _WIN32
             errcode = WSAGetLastError();
             if (errcode == WSAEINTR || errcode == WSAEWOULDBLOCK) {
+                if (errcode != WSAEINTR) metric_inc(MC_TSOCK_SEND_EAGAIN);
                 continue;
             }
 #endif
 #ifdef UNIX
             errcode = errno;
             if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (errcode != EINTR) metric_inc(MC_TSOCK_SEND_EAGAIN);
                 continue;
             }
     #ifdef _SOLARIS_
@@ -1486,6 +1624,7 @@ int tcp_nb_recv (SOCKET fd, void * prcvbuf, int bufsize, int * actnum)
                 continue;
             }
             if (errcode == WSAEWOULDBLOCK) {
+                metric_inc(MC_TSOCK_RECV_EAGAIN);
                 if (++errtimes >= 1) break;
                 continue;
             }
@@ -1496,6 +1635,7 @@ int tcp_nb_recv (SOCKET fd, void * prcvbuf, int bufsize, int * actnum)
                 continue;
             }
             if (errcode == EAGAIN || errcode == EWOULDBLOCK) {
+                metric_inc(MC_TSOCK_RECV_EAGAIN);
                 if (++errtimes >= 1) break;
                 continue;
             }
@@ -1549,6 +1689,7 @@ int tcp_nb_send (SOCKET fd, void * psendbuf, int towrite, int * actnum)
 #ifdef _WIN32
             errcode = WSAGetLastError();
             if (errcode == WSAEINTR || errcode == WSAEWOULDBLOCK) {
+                if (errcode != WSAEINTR) metric_inc(MC_TSOCK_SEND_EAGAIN);
                 if (++errtimes >= 1) break;
                 continue;
             }
@@ -1556,6 +1697,7 @@ int tcp_nb_send (SOCKET fd, void * psendbuf, int towrite, int * actnum)
 #ifdef UNIX
             errcode = errno;
             if (errcode == EINTR || errcode == EAGAIN || errcode == EWOULDBLOCK) {
+                if (errcode != EINTR) metric_inc(MC_TSOCK_SEND_EAGAIN);
                 if (++errtimes >= 1) break;
                 continue;
             }
@@ -1803,6 +1945,263 @@ SOCKET udp_listen (char * localip, int port, void * psockopt)
 }
 
 
+#if defined(_LINUX_)
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT  103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO      104
+#endif
+#endif
+
+int udp_gro_set (SOCKET fd, int onoff)
+{
+#if defined(_LINUX_)
+    int  val = onoff ? 1 : 0;
+
+    return setsockopt(fd, IPPROTO_UDP, UDP_GRO, (void *)&val, sizeof(val));
+#else
+    return -1;
+#endif
+}
+
+/* datagrams are received one by one when recvmmsg is not available */
+static int udp_recv_loop (SOCKET fd, udp_msg_t * msgs, int num, int * perr)
+{
+    int   i, ret;
+
+    for (i = 0; i < num; i++) {
+        msgs[i].addrlen = sizeof(msgs[i].addr);
+        msgs[i].segsize = 0;
+        msgs[i].flags = 0;
+
+        ret = recvfrom(fd, msgs[i].pbuf, msgs[i].size, 0,
+                       (struct sockaddr *)&msgs[i].addr, &msgs[i].addrlen);
+        if (ret < 0) {
+#ifdef UNIX
+            if (errno == EINTR) { i--; continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (perr) *perr = errno;
+#endif
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEWOULDBLOCK) break;
+            if (perr) *perr = WSAGetLastError();
+#endif
+            return i > 0 ? i : -30;
+        }
+        msgs[i].len = ret;
+    }
+
+    return i;
+}
+
+static int udp_send_loop (SOCKET fd, udp_msg_t * msgs, int num, int * perr)
+{
+    uint8  * p = NULL;
+    int      i, len, seg, ret;
+
+    for (i = 0; i < num; i++) {
+        /* segments are sent as separate datagrams without GSO */
+        seg = msgs[i].segsize > 0 ? msgs[i].segsize : msgs[i].len;
+        if (seg <= 0) seg = 1;
+
+        for (p = msgs[i].pbuf, len = msgs[i].len; len > 0 || msgs[i].len == 0; ) {
+            ret = sendto(fd, p, min(len, seg), MSG_NOSIGNAL,
+                         (struct sockaddr *)&msgs[i].addr, msgs[i].addrlen);
+            if (ret < 0) {
+#ifdef UNIX
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return i;
+                if (perr) *perr = errno;
+#endif
+#ifdef _WIN32
+                if (WSAGetLastError() == WSAEWOULDBLOCK) return i;
+                if (perr) *perr = WSAGetLastError();
+#endif
+                return i > 0 ? i : -30;
+            }
+            if (msgs[i].len == 0) break;
+
+            p += ret;
+            len -= ret;
+        }
+    }
+
+    return i;
+}
+
+/* receive at most num datagrams by one recvmmsg. with UDP_GRO enabled,
+ * a message may hold several datagrams of segsize coalesced by kernel.
+ * return the number of messages received, 0 if no data */
+int udp_recv_batch (SOCKET fd, udp_msg_t * msgs, int num, int * perr)
+{
+#if defined(_LINUX_)
+    struct mmsghdr   mmsg[UDP_BATCH_MAX];
+    struct iovec     iov[UDP_BATCH_MAX];
+    uint8            control[UDP_BATCH_MAX][CMSG_SPACE(sizeof(int))];
+    struct cmsghdr * cm = NULL;
+    int              i, ret;
+#endif
+
+    if (perr) *perr = 0;
+
+    if (fd == INVALID_SOCKET) return -1;
+    if (!msgs || num <= 0) return 0;
+
+#if defined(_LINUX_)
+    if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+    memset(mmsg, 0, sizeof(struct mmsghdr) * num);
+
+    for (i = 0; i < num; i++) {
+        iov[i].iov_base = msgs[i].pbuf;
+        iov[i].iov_len = msgs[i].size;
+
+        mmsg[i].msg_hdr.msg_name = &msgs[i].addr;
+        mmsg[i].msg_hdr.msg_namelen = sizeof(msgs[i].addr);
+        mmsg[i].msg_hdr.msg_iov = &iov[i];
+        mmsg[i].msg_hdr.msg_iovlen = 1;
+        mmsg[i].msg_hdr.msg_control = control[i];
+        mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    for ( ; ; ) {
+        ret = recvmmsg(fd, mmsg, num, MSG_DONTWAIT, NULL);
+        if (ret >= 0) break;
+
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == ENOSYS) return udp_recv_loop(fd, msgs, num, perr);
+
+        if (perr) *perr = errno;
+        return -30;
+    }
+
+    for (i = 0; i < ret; i++) {
+        msgs[i].len = mmsg[i].msg_len;
+        msgs[i].addrlen = mmsg[i].msg_hdr.msg_namelen;
+        msgs[i].flags = mmsg[i].msg_hdr.msg_flags;
+        msgs[i].segsize = 0;
+
+        for (cm = CMSG_FIRSTHDR(&mmsg[i].msg_hdr); cm; cm = CMSG_NXTHDR(&mmsg[i].msg_hdr, cm)) {
+            if (cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO)
+                memcpy(&msgs[i].segsize, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+
+    return ret;
+#else
+    return udp_recv_loop(fd, msgs, num, perr);
+#endif
+}
+
+/* send num messages by one sendmmsg. a message with segsize > 0 is split
+ * into datagrams of segsize by UDP_SEGMENT (GSO) in kernel.
+ * return the number of messages sent, less than num if socket buffer full */
+int udp_send_batch (SOCKET fd, udp_msg_t * msgs, int num, int * perr)
+{
+#if defined(_LINUX_)
+    struct mmsghdr   mmsg[UDP_BATCH_MAX];
+    struct iovec     iov[UDP_BATCH_MAX];
+    uint8            control[UDP_BATCH_MAX][CMSG_SPACE(sizeof(uint16))];
+    struct cmsghdr * cm = NULL;
+    uint16           gso;
+    int              i, ret, sent = 0;
+#endif
+
+    if (perr) *perr = 0;
+
+    if (fd == INVALID_SOCKET) return -1;
+    if (!msgs || num <= 0) return 0;
+
+#if defined(_LINUX_)
+    while (sent < num) {
+        int n = min(num - sent, UDP_BATCH_MAX);
+        udp_msg_t * pmsg = msgs + sent;
+
+        memset(mmsg, 0, sizeof(struct mmsghdr) * n);
+
+        for (i = 0; i < n; i++) {
+            iov[i].iov_base = pmsg[i].pbuf;
+            iov[i].iov_len = pmsg[i].len;
+
+            mmsg[i].msg_hdr.msg_name = pmsg[i].addrlen > 0 ? &pmsg[i].addr : NULL;
+            mmsg[i].msg_hdr.msg_namelen = pmsg[i].addrlen;
+            mmsg[i].msg_hdr.msg_iov = &iov[i];
+            mmsg[i].msg_hdr.msg_iovlen = 1;
+
+            if (pmsg[i].segsize > 0 && pmsg[i].segsize < pmsg[i].len) {
+                mmsg[i].msg_hdr.msg_control = control[i];
+                mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+
+                cm = CMSG_FIRSTHDR(&mmsg[i].msg_hdr);
+                cm->cmsg_level = IPPROTO_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16));
+                gso = (uint16)pmsg[i].segsize;
+                memcpy(CMSG_DATA(cm), &gso, sizeof(gso));
+            }
+        }
+
+        ret = sendmmsg(fd, mmsg, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            if (errno == ENOSYS) {
+                ret = udp_send_loop(fd, pmsg, num - sent, perr);
+                return ret < 0 ? (sent > 0 ? sent : ret) : sent + ret;
+            }
+
+            if (perr) *perr = errno;
+            return sent > 0 ? sent : -30;
+        }
+
+        sent += ret;
+        if (ret < n) break;
+    }
+
+    return sent;
+#else
+    return udp_send_loop(fd, msgs, num, perr);
+#endif
+}
+
+/* the buffers of messages are units fetched from bpool */
+int udp_msg_bpool (udp_msg_t * msgs, int num, void * pool)
+{
+    int   i, size;
+
+    if (!msgs || !pool) return 0;
+
+    size = bpool_unitsize(pool);
+
+    for (i = 0; i < num; i++) {
+        msgs[i].pbuf = bpool_fetch(pool);
+        if (!msgs[i].pbuf) break;
+
+        msgs[i].size = size;
+        msgs[i].len = 0;
+    }
+
+    return i;
+}
+
+void udp_msg_recycle (udp_msg_t * msgs, int num, void * pool)
+{
+    int   i;
+
+    if (!msgs || !pool) return;
+
+    for (i = 0; i < num; i++) {
+        if (msgs[i].pbuf) bpool_recycle(pool, msgs[i].pbuf);
+        msgs[i].pbuf = NULL;
+        msgs[i].size = 0;
+    }
+}
+
+
 
 #ifdef UNIX
 #ifndef _SOLARIS_
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mpool.h"
+#include "btime.h"
+#include "twheel.h"
+
+#define TWT_IDLE      0
+#define TWT_PENDING   1
+#define TWT_FIRING    2
+
+#define TW_SLOTS      (TW_ROOT_SLOTS + (TW_LEVELS - 1) * TW_LEVEL_SLOTS)
+
+/* the ticks beyond are kept in the last slots of top wheel */
+#define TW_MAXDELTA   ((((uint64)1) << (TW_ROOT_BITS + (TW_LEVELS - 1) * TW_LEVEL_BITS)) - 1)
+
+typedef struct tw_link_s {
+    struct tw_link_s * prev;
+    struct tw_link_s * next;
+} TWLink;
+
+typedef struct tw_timer_s {
+    TWLink       link;
+
+    uint64       expire;
+    int          state;
+
+    TWTimerCB  * cb;
+    void       * para;
+} TWTimer;
+
+typedef struct twheel_s {
+    int          tickms;
+    btime_t      start;
+    btime_t      now;
+
+    /* the next tick to be turned to */
+    uint64       curtick;
+    int          num;
+
+    TWLink       slot[TW_SLOTS];
+
+    /* the timer being called back */
+    TWTimer    * firing;
+
+    mpool_t    * mp;
+
+    TWBatchCB  * batchcb;
+    void       * batchpara;
+} TWheel;
+
+
+static void tw_list_init (TWLink * head)
+{
+    head->prev = head->next = head;
+}
+
+static void tw_list_add (TWLink * head, TWLink * link)
+{
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static void tw_list_del (TWLink * link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = link;
+}
+
+/* move all links of src to the empty list dst */
+static void tw_list_splice (TWLink * src, TWLink * dst)
+{
+    if (src->next == src) {
+        tw_list_init(dst);
+        return;
+    }
+
+    dst->next = src->next;
+    dst->prev = src->prev;
+    dst->next->prev = dst;
+    dst->prev->next = dst;
+
+    tw_list_init(src);
+}
+
+static void tw_place (TWheel * tw, TWTimer * timer)
+{
+    uint64   expire = timer->expire;
+    uint64   delta;
+    int      level, shift, index;
+
+    if (expire < tw->curtick)
+        expire = tw->curtick;
+
+    delta = expire - tw->curtick;
+    if (delta > TW_MAXDELTA) {
+        delta = TW_MAXDELTA;
+        expire = tw->curtick + delta;
+    }
+
+    if (delta < TW_ROOT_SLOTS) {
+        index = expire & (TW_ROOT_SLOTS - 1);
+
+    } else {
+        for (level = 1, shift = TW_ROOT_BITS; level < TW_LEVELS - 1; level++, shift += TW_LEVEL_BITS) {
+            if (delta < ((uint64)1 << (shift + TW_LEVEL_BITS)))
+                break;
+        }
+
+        index = TW_ROOT_SLOTS + (level - 1) * TW_LEVEL_SLOTS
+              + ((expire >> shift) & (TW_LEVEL_SLOTS - 1));
+    }
+
+    tw_list_add(&tw->slot[index], &timer->link);
+}
+
+/* move the timers of slot index of upper wheel level down */
+static int tw_cascade (TWheel * tw, int level, int index)
+{
+    TWLink    list;
+    TWTimer * timer = NULL;
+
+    tw_list_splice(&tw->slot[TW_ROOT_SLOTS + (level - 1) * TW_LEVEL_SLOTS + index], &list);
+
+    while (list.next != &list) {
+        timer = (TWTimer *)list.next;
+        tw_list_del(&timer->link);
+        tw_place(tw, timer);
+    }
+
+    return index;
+}
+
+static uint64 tw_elapsed_tick (TWheel * tw, btime_t * now)
+{
+    long   ms;
+
+    ms = btime_diff_ms(&tw->start, now);
+    if (ms < 0) return 0;
+
+    return (uint64)ms / tw->tickms;
+}
+
+
+void * twheel_new (int tickms)
+{
+    TWheel * tw = NULL;
+    int      i;
+
+    if (tickms <= 0) tickms = 1;
+
+    tw = kzalloc(sizeof(*tw));
+    if (!tw) return NULL;
+
+    tw->tickms = tickms;
+    btime_mono(&tw->start);
+    tw->now = tw->start;
+    tw->curtick = 1;
+
+    for (i = 0; i < TW_SLOTS; i++)
+        tw_list_init(&tw->slot[i]);
+
+    tw->mp = mpool_alloc();
+    if (!tw->mp) {
+        kfree(tw);
+        return NULL;
+    }
+    mpool_set_unitsize(tw->mp, sizeof(TWTimer));
+    mpool_set_allocnum(tw->mp, 256);
+
+    return tw;
+}
+
+void twheel_free (void * vtw)
+{
+    TWheel * tw = (TWheel *)vtw;
+
+    if (!tw) return;
+
+    /* the pending timers are released with the pool */
+    mpool_free(tw->mp);
+
+    kfree(tw);
+}
+
+void twheel_set_batch (void * vtw, TWBatchCB * cb, void * cbpara)
+{
+    TWheel * tw = (TWheel *)vtw;
+
+    if (!tw) return;
+
+    tw->batchcb = cb;
+    tw->batchpara = cbpara;
+}
+
+int twheel_num (void * vtw)
+{
+    TWheel * tw = (TWheel *)vtw;
+
+    if (!tw) return 0;
+
+    return tw->num;
+}
+
+void * twheel_add (void * vtw, long ms, TWTimerCB * cb, void * para)
+{
+    TWheel  * tw = (TWheel *)vtw;
+    TWTimer * timer = NULL;
+
+    if (!tw) return NULL;
+
+    timer = mpool_fetch(tw->mp);
+    if (!timer) return NULL;
+
+    if (ms < 0) ms = 0;
+
+    timer->expire = tw->curtick + ((uint64)ms + tw->tickms - 1) / tw->tickms;
+    timer->state = TWT_PENDING;
+    timer->cb = cb;
+    timer->para = para;
+
+    tw_place(tw, timer);
+    tw->num++;
+
+    return timer;
+}
+
+int twheel_del (void * vtw, void * vtimer)
+{
+    TWheel  * tw = (TWheel *)vtw;
+    TWTimer * timer = (TWTimer *)vtimer;
+
+    if (!tw || !timer) return -1;
+
+    if (timer->state == TWT_FIRING) {
+        /* cancelled in its own callback, freed after it returns */
+        timer->state = TWT_IDLE;
+        return 0;
+    }
+
+    if (timer->state != TWT_PENDING) return -2;
+
+    tw_list_del(&timer->link);
+    timer->state = TWT_IDLE;
+    tw->num--;
+
+    /* re-armed and cancelled again in its own callback */
+    if (timer != tw->firing)
+        mpool_recycle(tw->mp, timer);
+
+    return 0;
+}
+
+int twheel_reset (void * vtw, void * vtimer, long ms)
+{
+    TWheel  * tw = (TWheel *)vtw;
+    TWTimer * timer = (TWTimer *)vtimer;
+
+    if (!tw || !timer) return -1;
+
+    if (timer->state == TWT_PENDING)
+        tw_list_del(&timer->link);
+    else if (timer->state == TWT_FIRING)
+        tw->num++;
+    else
+        return -2;
+
+    if (ms < 0) ms = 0;
+
+    timer->expire = tw->curtick + ((uint64)ms + tw->tickms - 1) / tw->tickms;
+    timer->state = TWT_PENDING;
+
+    tw_place(tw, timer);
+
+    return 0;
+}
+
+void * twheel_para (void * vtimer)
+{
+    TWTimer * timer = (TWTimer *)vtimer;
+
+    if (!timer) return NULL;
+
+    return timer->para;
+}
+
+int twheel_run (void * vtw, btime_t * now)
+{
+    TWheel  * tw = (TWheel *)vtw;
+    TWTimer * timer = NULL;
+    TWLink    expired, list;
+    btime_t   curt;
+    uint64    nowtick;
+    void    * paras[TW_BATCH];
+    int       index, level, shift;
+    int       num = 0, bnum = 0;
+
+    if (!tw) return -1;
+
+    if (!now) {
+        btime_mono(&curt);
+        now = &curt;
+    }
+    tw->now = *now;
+
+    nowtick = tw_elapsed_tick(tw, now);
+
+    tw_list_init(&expired);
+
+    for ( ; tw->curtick <= nowtick; tw->curtick++) {
+        if (tw->num <= 0) {
+            tw->curtick = nowtick + 1;
+            break;
+        }
+
+        index = tw->curtick & (TW_ROOT_SLOTS - 1);
+
+        if (index == 0) {
+            for (level = 1, shift = TW_ROOT_BITS; level < TW_LEVELS; level++, shift += TW_LEVEL_BITS) {
+                if (tw_cascade(tw, level, (tw->curtick >> shift) & (TW_LEVEL_SLOTS - 1)) != 0)
+                    break;
+            }
+        }
+
+        if (tw->slot[index].next == &tw->slot[index])
+            continue;
+
+        /* the expired timers of all ticks are called back after turning */
+        tw_list_splice(&tw->slot[index], &list);
+        list.next->prev = expired.prev;
+        expired.prev->next = list.next;
+        list.prev->next = &expired;
+        expired.prev = list.prev;
+    }
+
+    while (expired.next != &expired) {
+        timer = (TWTimer *)expired.next;
+        tw_list_del(&timer->link);
+
+        tw->num--;
+        num++;
+
+        if (!timer->cb) {
+            paras[bnum++] = timer->para;
+            timer->state = TWT_IDLE;
+            mpool_recycle(tw->mp, timer);
+
+            if (bnum == TW_BATCH) {
+                if (tw->batchcb) (*tw->batchcb)(tw->batchpara, paras, bnum);
+                bnum = 0;
+            }
+            continue;
+        }
+
+        timer->state = TWT_FIRING;
+        tw->firing = timer;
+        (*timer->cb)(timer->para, timer);
+        tw->firing = NULL;
+
+        /* re-armed in callback */
+        if (timer->state == TWT_PENDING) continue;
+
+        timer->state = TWT_IDLE;
+        mpool_recycle(tw->mp, timer);
+    }
+
+    if (bnum > 0 && tw->batchcb)
+        (*tw->batchcb)(tw->batchpara, paras, bnum);
+
+    return num;
+}
+
+long twheel_next_ms (void * vtw, btime_t * now)
+{
+    TWheel  * tw = (TWheel *)vtw;
+    btime_t   curt;
+    uint64    tick;
+    long      ms;
+    int       i, index, rest;
+
+    if (!tw) return -1;
+
+    if (tw->num <= 0) return -1;
+
+    if (!now) {
+        btime_mono(&curt);
+        now = &curt;
+    }
+
+    /* till the root wheel turns around and upper timers are moved down */
+    index = tw->curtick & (TW_ROOT_SLOTS - 1);
+    rest = index == 0 ? 0 : TW_ROOT_SLOTS - index;
+    tick = tw->curtick + rest;
+
+    for (i = 0; i < rest; i++) {
+        if (tw->slot[index + i].next != &tw->slot[index + i]) {
+            tick = tw->curtick + i;
+            break;
+        }
+    }
+
+    ms = (long)(tick * tw->tickms) - btime_diff_ms(&tw->start, now);
+
+    return ms < 0 ? 0 : ms;
+}
+
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2003-2020 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mpool.h"
+#include "ulist.h"
+
+typedef void ulfree (void *);
+
+/* 2 links, 2 indice and 13 pointers make up 128 bytes, 2 cache lines */
+typedef struct ul_chunk_s {
+    struct ul_chunk_s * prev;
+    struct ul_chunk_s * next;
+
+    /* the data are in item[head] to item[tail - 1] */
+    int                 head;
+    int                 tail;
+
+    void              * item[UL_CHUNK_ITEMS];
+} ULChunk;
+
+struct ulist_st {
+    int        num;
+    ULChunk  * first;
+    ULChunk  * last;
+
+    mpool_t  * mp;
+};
+
+
+static ULChunk * ul_chunk_fetch (ulist_t * ul, int pos)
+{
+    ULChunk * chunk = NULL;
+
+    chunk = mpool_fetch(ul->mp);
+    if (!chunk) return NULL;
+
+    chunk->prev = chunk->next = NULL;
+    chunk->head = chunk->tail = pos;
+
+    return chunk;
+}
+
+static void ul_chunk_unlink (ulist_t * ul, ULChunk * chunk)
+{
+    if (chunk->prev) chunk->prev->next = chunk->next;
+    else ul->first = chunk->next;
+
+    if (chunk->next) chunk->next->prev = chunk->prev;
+    else ul->last = chunk->prev;
+
+    mpool_recycle(ul->mp, chunk);
+}
+
+
+ulist_t * ul_new ()
+{
+    ulist_t * ul = NULL;
+
+    ul = kzalloc(sizeof(*ul));
+    if (!ul) return NULL;
+
+    ul->mp = mpool_alloc();
+    if (!ul->mp) {
+        kfree(ul);
+        return NULL;
+    }
+    mpool_set_unitsize(ul->mp, sizeof(ULChunk));
+    mpool_set_allocnum(ul->mp, 64);
+
+    return ul;
+}
+
+void ul_free (ulist_t * ul)
+{
+    if (!ul) return;
+
+    /* the chunks are released with the pool */
+    mpool_free(ul->mp);
+
+    kfree(ul);
+}
+
+void ul_free_all (ulist_t * ul, void * vfunc)
+{
+    ulfree  * func = (ulfree *)vfunc;
+    ULChunk * chunk = NULL;
+    int       i;
+
+    if (!ul) return;
+
+    for (chunk = ul->first; chunk && func; chunk = chunk->next) {
+        for (i = chunk->head; i < chunk->tail; i++)
+            (*func)(chunk->item[i]);
+    }
+
+    ul_free(ul);
+}
+
+void ul_zero (ulist_t * ul)
+{
+    ULChunk * chunk = NULL;
+
+    if (!ul) return;
+
+    while ((chunk = ul->first) != NULL) {
+        ul->first = chunk->next;
+        mpool_recycle(ul->mp, chunk);
+    }
+
+    ul->last = NULL;
+    ul->num = 0;
+}
+
+int ul_num (ulist_t * ul)
+{
+    if (!ul) return 0;
+
+    return ul->num;
+}
+
+int ul_prepend (ulist_t * ul, void * data)
+{
+    ULChunk * chunk = NULL;
+
+    if (!ul) return -1;
+
+    chunk = ul->first;
+
+    if (!chunk || chunk->head == 0) {
+        /* the new head chunk is filled from its end towards the front */
+        chunk = ul_chunk_fetch(ul, UL_CHUNK_ITEMS);
+        if (!chunk) return -100;
+
+        chunk->next = ul->first;
+        if (ul->first) ul->first->prev = chunk;
+        else ul->last = chunk;
+        ul->first = chunk;
+    }
+
+    chunk->item[--chunk->head] = data;
+
+    return ++ul->num;
+}
+
+int ul_append (ulist_t * ul, void * data)
+{
+    ULChunk * chunk = NULL;
+
+    if (!ul) return -1;
+
+    chunk = ul->last;
+
+    if (!chunk || chunk->tail == UL_CHUNK_ITEMS) {
+        chunk = ul_chunk_fetch(ul, 0);
+        if (!chunk) return -100;
+
+        chunk->prev = ul->last;
+        if (ul->last) ul->last->next = chunk;
+        else ul->first = chunk;
+        ul->last = chunk;
+    }
+
+    chunk->item[chunk->tail++] = data;
+
+    return ++ul->num;
+}
+
+void * ul_rm_head (ulist_t * ul)
+{
+    ULChunk * chunk = NULL;
+    void    * data = NULL;
+
+    if (!ul || ul->num <= 0) return NULL;
+
+    chunk = ul->first;
+    data = chunk->item[chunk->head++];
+
+    if (chunk->head == chunk->tail)
+        ul_chunk_unlink(ul, chunk);
+
+    ul->num--;
+    return data;
+}
+
+void * ul_rm_tail (ulist_t * ul)
+{
+    ULChunk * chunk = NULL;
+    void    * data = NULL;
+
+    if (!ul || ul->num <= 0) return NULL;
+
+    chunk = ul->last;
+    data = chunk->item[--chunk->tail];
+
+    if (chunk->head == chunk->tail)
+        ul_chunk_unlink(ul, chunk);
+
+    ul->num--;
+    return data;
+}
+
+void * ul_first (ulist_t * ul)
+{
+    if (!ul || ul->num <= 0) return NULL;
+
+    return ul->first->item[ul->first->head];
+}
+
+void * ul_last (ulist_t * ul)
+{
+    if (!ul || ul->num <= 0) return NULL;
+
+    return ul->last->item[ul->last->tail - 1];
+}
+
+void * ul_get (ulist_t * ul, int loc)
+{
+    ULChunk * chunk = NULL;
+    int       cnt;
+
+    if (!ul || loc < 0 || loc >= ul->num) return NULL;
+
+    if (loc <= ul->num / 2) {
+        for (chunk = ul->first; ; chunk = chunk->next) {
+            cnt = chunk->tail - chunk->head;
+            if (loc < cnt) return chunk->item[chunk->head + loc];
+            loc -= cnt;
+        }
+    }
+
+    /* count from the tail backwards */
+    loc = ul->num - 1 - loc;
+
+    for (chunk = ul->last; ; chunk = chunk->prev) {
+        cnt = chunk->tail - chunk->head;
+        if (loc < cnt) return chunk->item[chunk->tail - 1 - loc];
+        loc -= cnt;
+    }
+
+    return NULL;
+}
+
+int ul_index (ulist_t * ul, void * data)
+{
+    ULChunk * chunk = NULL;
+    int       i, ind = 0;
+
+    if (!ul) return -1;
+
+    for (chunk = ul->first; chunk; chunk = chunk->next) {
+        for (i = chunk->head; i < chunk->tail; i++, ind++) {
+            if (chunk->item[i] == data) return ind;
+        }
+    }
+
+    return -1;
+}
+
+int ul_iterate (ulist_t * ul, int (*func)(void *, void *), void * para)
+{
+    ULChunk * chunk = NULL;
+    int       i, num = 0;
+
+    if (!ul || !func) return 0;
+
+    for (chunk = ul->first; chunk; chunk = chunk->next) {
+        for (i = chunk->head; i < chunk->tail; i++) {
+            num++;
+            if ((*func)(para, chunk->item[i]) != 0)
+                return num;
+        }
+    }
+
+    return num;
+}
+
+void * ul_search (ulist_t * ul, void * pattern, int (*cmp)(void *, void *))
+{
+    ULChunk * chunk = NULL;
+    int       i;
+
+    if (!ul || !cmp) return NULL;
+
+    for (chunk = ul->first; chunk; chunk = chunk->next) {
+        for (i = chunk->head; i < chunk->tail; i++) {
+            if ((*cmp)(chunk->item[i], pattern) == 0)
+                return chunk->item[i];
+        }
+    }
+
+    return NULL;
+}
+
@@ -3,13 +3,29 @@
  * All rights reserved. See MIT LICENSE for redistribution. 
  */
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "btype.h"
+#include "memory.h"
 #include "tsock.h"
+#include "usock.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(_LINUX_)
+#include <sys/syscall.h>
+#endif
 
 #ifdef UNIX
 
@@ -188,5 +204,543 @@ errout:
     return -1;
 }
 
+
+int usock_pair (int * fds)
+{
+    if (!fds) return -1;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifdef MSG_CMSG_CLOEXEC
+#define USOCK_RECV_FLAGS  MSG_CMSG_CLOEXEC
+#else
+#define USOCK_RECV_FLAGS  0
+#endif
+
+typedef union usock_ctl_u {
+    struct cmsghdr  cm;
+    uint8           buf[CMSG_SPACE(sizeof(int) * USOCK_FD_MAX)];
+} usock_ctl_t;
+
+/* the one byte sent as the data of a message of len 0 */
+static uint8 usock_nulbyte = 0;
+
+static int usock_msghdr_send (struct msghdr * msg, struct iovec * iov, usock_ctl_t * ctl,
+                              void * pbuf, int len, int * fds, int nfd)
+{
+    struct cmsghdr * cm = NULL;
+
+    if (len < 0 || nfd < 0 || nfd > USOCK_FD_MAX || (nfd > 0 && !fds))
+        return -1;
+
+    if (!pbuf || len == 0) {
+        pbuf = &usock_nulbyte;
+        len = 1;
+    }
+
+    memset(msg, 0, sizeof(*msg));
+    iov->iov_base = pbuf;
+    iov->iov_len = len;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+
+    if (nfd > 0) {
+        memset(ctl, 0, sizeof(*ctl));
+        msg->msg_control = ctl->buf;
+        msg->msg_controllen = CMSG_SPACE(sizeof(int) * nfd);
+
+        cm = CMSG_FIRSTHDR(msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfd);
+    }
+
+    return 0;
+}
+
+static void usock_msghdr_recv (struct msghdr * msg, struct iovec * iov, usock_ctl_t * ctl,
+                               void * pbuf, int size)
+{
+    memset(msg, 0, sizeof(*msg));
+    iov->iov_base = pbuf;
+    iov->iov_len = size;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    msg->msg_control = ctl->buf;
+    msg->msg_controllen = sizeof(ctl->buf);
+}
+
+/* move the descriptors received into fds, the ones more than fdsize are
+ * closed so they never leak. return the number moved */
+static int usock_fds_take (struct msghdr * msg, int * fds, int fdsize)
+{
+    struct cmsghdr * cm = NULL;
+    int              i, n, rfd;
+    int              num = 0;
+
+    if (msg->msg_controllen <= 0) return 0;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (i = 0; i < n; i++) {
+            memcpy(&rfd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+
+            if (!fds || num >= fdsize) {
+                close(rfd);
+                continue;
+            }
+
+#ifndef MSG_CMSG_CLOEXEC
+            fcntl(rfd, F_SETFD, FD_CLOEXEC);
+#endif
+            fds[num++] = rfd;
+        }
+    }
+
+    return num;
+}
+
+int usock_send_fd (int fd, void * data, int len, int * fds, int nfd)
+{
+    struct msghdr  msg;
+    struct iovec   iov;
+    usock_ctl_t    ctl;
+    int            ret;
+
+    if (fd < 0) return -1;
+
+    if (usock_msghdr_send(&msg, &iov, &ctl, data, len, fds, nfd) < 0)
+        return -2;
+
+    do {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -30 : ret;
+}
+
+int usock_recv_fd (int fd, void * buf, int size, int * fds, int * nfd)
+{
+    struct msghdr  msg;
+    struct iovec   iov;
+    usock_ctl_t    ctl;
+    int            ret, n;
+    int            fdsize = nfd ? *nfd : 0;
+
+    if (nfd) *nfd = 0;
+
+    if (fd < 0 || !buf || size <= 0) return -1;
+
+    usock_msghdr_recv(&msg, &iov, &ctl, buf, size);
+
+    do {
+        ret = recvmsg(fd, &msg, USOCK_RECV_FLAGS);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) return -30;
+
+    n = usock_fds_take(&msg, fds, fdsize);
+    if (nfd) *nfd = n;
+
+    return ret;
+}
+
+
+static int usock_send_loop (int fd, usock_msg_t * msgs, int num, int * perr)
+{
+    struct msghdr  msg;
+    struct iovec   iov;
+    usock_ctl_t    ctl;
+    int            i, ret;
+
+    for (i = 0; i < num; i++) {
+        if (usock_msghdr_send(&msg, &iov, &ctl, msgs[i].pbuf, msgs[i].len,
+                              msgs[i].fds, msgs[i].nfd) < 0)
+            return i > 0 ? i : -2;
+
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) { i--; continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            if (perr) *perr = errno;
+            return i > 0 ? i : -30;
+        }
+    }
+
+    return i;
+}
+
+static int usock_recv_loop (int fd, usock_msg_t * msgs, int num, int * perr)
+{
+    struct msghdr  msg;
+    struct iovec   iov;
+    usock_ctl_t    ctl;
+    int            i, ret;
+
+    for (i = 0; i < num; i++) {
+        usock_msghdr_recv(&msg, &iov, &ctl, msgs[i].pbuf, msgs[i].size);
+
+        ret = recvmsg(fd, &msg, USOCK_RECV_FLAGS | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) { i--; continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            if (perr) *perr = errno;
+            return i > 0 ? i : -30;
+        }
+        if (ret == 0 && i == 0) return -31;   /* peer closed */
+        if (ret == 0) break;
+
+        msgs[i].len = ret;
+        msgs[i].flags = msg.msg_flags;
+        msgs[i].nfd = usock_fds_take(&msg, msgs[i].fds, msgs[i].fdsize);
+    }
+
+    return i;
+}
+
+int usock_send_batch (int fd, usock_msg_t * msgs, int num, int * perr)
+{
+#if defined(_LINUX_)
+    struct mmsghdr   mmsg[USOCK_BATCH_MAX];
+    struct iovec     iov[USOCK_BATCH_MAX];
+    usock_ctl_t      ctl[USOCK_BATCH_MAX];
+    int              i, n, ret, sent = 0;
+#endif
+
+    if (perr) *perr = 0;
+
+    if (fd < 0) return -1;
+    if (!msgs || num <= 0) return 0;
+
+#if defined(_LINUX_)
+    while (sent < num) {
+        n = min(num - sent, USOCK_BATCH_MAX);
+
+        memset(mmsg, 0, sizeof(struct mmsghdr) * n);
+
+        for (i = 0; i < n; i++) {
+            if (usock_msghdr_send(&mmsg[i].msg_hdr, &iov[i], &ctl[i], msgs[sent + i].pbuf,
+                                  msgs[sent + i].len, msgs[sent + i].fds, msgs[sent + i].nfd) < 0)
+                break;
+        }
+        if (i == 0) return sent > 0 ? sent : -2;
+        n = i;
+
+        ret = sendmmsg(fd, mmsg, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            if (errno == ENOSYS) {
+                ret = usock_send_loop(fd, msgs + sent, num - sent, perr);
+                return ret < 0 ? (sent > 0 ? sent : ret) : sent + ret;
+            }
+
+            if (perr) *perr = errno;
+            return sent > 0 ? sent : -30;
+        }
+
+        sent += ret;
+        if (ret < n) break;
+    }
+
+    return sent;
+#else
+    return usock_send_loop(fd, msgs, num, perr);
+#endif
+}
+
+int usock_recv_batch (int fd, usock_msg_t * msgs, int num, int * perr)
+{
+#if defined(_LINUX_)
+    struct mmsghdr   mmsg[USOCK_BATCH_MAX];
+    struct iovec     iov[USOCK_BATCH_MAX];
+    usock_ctl_t      ctl[USOCK_BATCH_MAX];
+    int              i, ret;
+#endif
+
+    if (perr) *perr = 0;
+
+    if (fd < 0) return -1;
+    if (!msgs || num <= 0) return 0;
+
+#if defined(_LINUX_)
+    if (num > USOCK_BATCH_MAX) num = USOCK_BATCH_MAX;
+
+    memset(mmsg, 0, sizeof(struct mmsghdr) * num);
+
+    for (i = 0; i < num; i++)
+        usock_msghdr_recv(&mmsg[i].msg_hdr, &iov[i], &ctl[i], msgs[i].pbuf, msgs[i].size);
+
+    do {
+        ret = recvmmsg(fd, mmsg, num, USOCK_RECV_FLAGS | MSG_DONTWAIT, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == ENOSYS) return usock_recv_loop(fd, msgs, num, perr);
+
+        if (perr) *perr = errno;
+        return -30;
+    }
+
+    for (i = 0; i < ret; i++) {
+        msgs[i].len = mmsg[i].msg_len;
+        msgs[i].flags = mmsg[i].msg_hdr.msg_flags;
+        msgs[i].nfd = usock_fds_take(&mmsg[i].msg_hdr, msgs[i].fds, msgs[i].fdsize);
+    }
+
+    /* a stream socket at EOF gives one message of 0 byte */
+    if (ret == 1 && msgs[0].len == 0 && msgs[0].nfd == 0) return -31;
+
+    return ret;
+#else
+    return usock_recv_loop(fd, msgs, num, perr);
+#endif
+}
+
+
+/* the ring header takes the first page of the memfd, the head and the tail
+ * are written by the two sides on their own cache lines */
+
+#define USRING_MAGIC    0x474E5255   /* URNG */
+#define USRING_HDRSIZE  4096
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC  0x0001U
 #endif
 
+typedef struct usring_hdr_s {
+    uint32   magic;
+    uint32   hdrsize;
+    int64    size;
+    uint8    pad0[48];
+
+    int64    head;     /* written by the producer */
+    uint8    pad1[56];
+
+    int64    tail;     /* written by the consumer */
+    uint8    pad2[56];
+} UsRingHdr;
+
+typedef struct usring_s {
+    int          fd;
+    UsRingHdr  * hdr;
+    uint8      * data;
+    int64        size;
+    int64        maplen;
+} UsRing;
+
+static int usring_memfd (int64 len)
+{
+    char   path[] = "/tmp/usring.XXXXXX";
+    int    fd = -1;
+
+#if defined(_LINUX_) && defined(SYS_memfd_create)
+    fd = syscall(SYS_memfd_create, "adif-usring", MFD_CLOEXEC);
+#endif
+
+    /* an unlinked file where memfd is not available */
+    if (fd < 0) {
+        fd = mkstemp(path);
+        if (fd < 0) return -1;
+
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    if (ftruncate(fd, len) < 0) {
+        close(fd);
+        return -2;
+    }
+
+    return fd;
+}
+
+static UsRing * usring_map (int fd, int64 maplen)
+{
+    UsRing * ring = NULL;
+    void   * pmap = NULL;
+
+    pmap = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pmap == MAP_FAILED) return NULL;
+
+    ring = kzalloc(sizeof(*ring));
+    if (!ring) {
+        munmap(pmap, maplen);
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->hdr = (UsRingHdr *)pmap;
+    ring->data = (uint8 *)pmap + USRING_HDRSIZE;
+    ring->size = maplen - USRING_HDRSIZE;
+    ring->maplen = maplen;
+
+    return ring;
+}
+
+void * usring_create (int64 size)
+{
+    UsRing * ring = NULL;
+    int64    pgsize = sysconf(_SC_PAGESIZE);
+    int      fd = -1;
+
+    if (size <= 0) return NULL;
+    if (pgsize <= 0) pgsize = 4096;
+
+    size = (size + pgsize - 1) / pgsize * pgsize;
+
+    fd = usring_memfd(USRING_HDRSIZE + size);
+    if (fd < 0) return NULL;
+
+    ring = usring_map(fd, USRING_HDRSIZE + size);
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+
+    ring->hdr->hdrsize = USRING_HDRSIZE;
+    ring->hdr->size = size;
+    ring->hdr->head = 0;
+    ring->hdr->tail = 0;
+    __atomic_store_n(&ring->hdr->magic, USRING_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+void * usring_open (int memfd)
+{
+    UsRing      * ring = NULL;
+    struct stat   st;
+
+    if (memfd < 0) return NULL;
+
+    if (fstat(memfd, &st) < 0 || st.st_size <= USRING_HDRSIZE)
+        return NULL;
+
+    ring = usring_map(memfd, st.st_size);
+    if (!ring) return NULL;
+
+    if (__atomic_load_n(&ring->hdr->magic, __ATOMIC_ACQUIRE) != USRING_MAGIC ||
+        ring->hdr->hdrsize != USRING_HDRSIZE || ring->hdr->size != ring->size)
+    {
+        munmap(ring->hdr, ring->maplen);
+        kfree(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void usring_free (void * vring)
+{
+    UsRing * ring = (UsRing *)vring;
+
+    if (!ring) return;
+
+    munmap(ring->hdr, ring->maplen);
+    close(ring->fd);
+    kfree(ring);
+}
+
+int usring_fd (void * vring)
+{
+    UsRing * ring = (UsRing *)vring;
+
+    return ring ? ring->fd : -1;
+}
+
+int64 usring_size (void * vring)
+{
+    UsRing * ring = (UsRing *)vring;
+
+    return ring ? ring->size : 0;
+}
+
+int64 usring_used (void * vring)
+{
+    UsRing * ring = (UsRing *)vring;
+
+    if (!ring) return 0;
+
+    return __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+}
+
+int64 usring_alloc (void * vring, int len, void ** pbuf)
+{
+    UsRing * ring = (UsRing *)vring;
+    int64    pos, off, tail;
+
+    if (pbuf) *pbuf = NULL;
+
+    if (!ring || len <= 0 || len > ring->size) return -1;
+
+    pos = ring->hdr->head;
+    tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+
+    /* skip the end of the ring that the region doesn't fit in */
+    off = pos % ring->size;
+    if (off + len > ring->size) pos += ring->size - off;
+
+    if (pos + len - tail > ring->size) return -1;
+
+    __atomic_store_n(&ring->hdr->head, pos + len, __ATOMIC_RELEASE);
+
+    if (pbuf) *pbuf = ring->data + pos % ring->size;
+    return pos;
+}
+
+void * usring_ptr (void * vring, int64 pos, int len)
+{
+    UsRing * ring = (UsRing *)vring;
+    int64    off;
+
+    if (!ring || pos < 0 || len <= 0) return NULL;
+
+    /* the region given by the peer must be allocated and not released */
+    if (pos < __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE) ||
+        pos + len > __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    off = pos % ring->size;
+    if (off + len > ring->size) return NULL;
+
+    return ring->data + off;
+}
+
+int usring_release (void * vring, int64 pos, int len)
+{
+    UsRing * ring = (UsRing *)vring;
+    int64    end;
+
+    if (!ring || pos < 0 || len <= 0) return -1;
+
+    end = pos + len;
+
+    if (end <= ring->hdr->tail ||
+        end > __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE))
+        return -2;
+
+    __atomic_store_n(&ring->hdr->tail, end, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#endif
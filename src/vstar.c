@@ -226,6 +226,241 @@ void vstar_sort_by (vstar_t * ar, int (*cmp)(void *, void *))
     qsort(ar->data, ar->num, ar->unitsize, CmpFP cmp);
 }
 
+void vstar_psort_by (vstar_t * ar, int (*cmp)(void *, void *), void * pool)
+{
+    if (!ar) return;
+    if (ar->num < 2) return;
+
+    qsort_parallel(ar->data, ar->num, ar->unitsize, cmp, pool);
+}
+
+/* read the integer key at p as uint64, the signed ones are moved by 2^63
+ * so that they are ordered as unsigned */
+static uint64 vstar_int_key (uint8 * p, int keylen, int keytype)
+{
+    uint64  v = 0;
+
+    switch (keylen) {
+    case 1:
+        v = keytype == VSTAR_KEY_INT ? (uint64)(int64)*(signed char *)p : *p;
+        break;
+    case 2:
+        v = keytype == VSTAR_KEY_INT ? (uint64)(int64)*(int16 *)p : *(uint16 *)p;
+        break;
+    case 4:
+        v = keytype == VSTAR_KEY_INT ? (uint64)(int64)*(int32 *)p : *(uint32 *)p;
+        break;
+    default:
+        v = *(uint64 *)p;
+        break;
+    }
+
+    if (keytype == VSTAR_KEY_INT) v ^= (uint64)1 << 63;
+
+    return v;
+}
+
+/* fill the BFS positions from k in order of the sorted keys */
+static void eytz_fill (eytz_t * ez, uint64 * sorted, int k, int * j)
+{
+    while (k <= ez->num) {
+        eytz_fill(ez, sorted, 2 * k, j);
+
+        ez->key[k] = sorted[*j];
+        ez->loc[k] = (*j)++;
+
+        k = 2 * k + 1;
+    }
+}
+
+void * vstar_eytz_build (vstar_t * ar, int keyoff, int keylen, int keytype)
+{
+    eytz_t  * ez = NULL;
+    uint64  * sorted = NULL;
+    int       i, j = 0;
+
+    if (!ar) return NULL;
+
+    if (keytype != VSTAR_KEY_UINT && keytype != VSTAR_KEY_INT)
+        return NULL;
+
+    if (keylen != 1 && keylen != 2 && keylen != 4 && keylen != 8)
+        return NULL;
+
+    if (keyoff < 0 || keyoff + keylen > ar->unitsize)
+        return NULL;
+
+    ez = kzalloc(sizeof(*ez));
+    if (!ez) return NULL;
+
+    ez->num = ar->num;
+    ez->keytype = keytype;
+
+    /* key[0] starts a cache line, the 8 children of 3 levels down of k
+     * are in the line of key[8k] */
+    ez->mem = kalloc((ar->num + 1 + 8) * sizeof(uint64) + 64 + (ar->num + 1) * sizeof(int));
+    sorted = kalloc((ar->num + 1) * sizeof(uint64));
+    if (!ez->mem || !sorted) goto failed;
+
+    ez->key = (uint64 *)(((ulong)ez->mem + 63) & ~(ulong)63);
+    ez->loc = (int *)(ez->key + ar->num + 1 + 8);
+    memset(ez->key + ar->num + 1, 0xFF, 8 * sizeof(uint64));
+
+    for (i = 0; i < ar->num; i++) {
+        sorted[i] = vstar_int_key((uint8 *)ar->data + i * ar->unitsize + keyoff, keylen, keytype);
+        if (i > 0 && sorted[i] < sorted[i - 1])
+            goto failed;
+    }
+
+    eytz_fill(ez, sorted, 1, &j);
+
+    kfree(sorted);
+    return ez;
+
+failed:
+    if (sorted) kfree(sorted);
+    eytz_free(ez);
+    return NULL;
+}
+
+void eytz_free (void * vez)
+{
+    eytz_t * ez = (eytz_t *)vez;
+
+    if (!ez) return;
+
+    if (ez->mem) kfree(ez->mem);
+
+    kfree(ez);
+}
+
+int eytz_num (void * vez)
+{
+    eytz_t * ez = (eytz_t *)vez;
+
+    if (!ez) return 0;
+
+    return ez->num;
+}
+
+int eytz_findloc (void * vez, uint64 key, int * found)
+{
+    eytz_t  * ez = (eytz_t *)vez;
+    uint64  * b = NULL;
+    ulong     k = 1;
+    int       num;
+
+    if (found) *found = 0;
+
+    if (!ez) return 0;
+
+    b = ez->key;
+    num = ez->num;
+
+    if (ez->keytype == VSTAR_KEY_INT) key ^= (uint64)1 << 63;
+
+    while (k <= (ulong)num) {
+#if defined(__GNUC__)
+        __builtin_prefetch(b + k * 8);
+#endif
+        k = 2 * k + (b[k] < key);
+    }
+
+    /* drop the trailing right turns and the last left turn */
+#if defined(__GNUC__)
+    k >>= __builtin_ctzl(~k) + 1;
+#else
+    while (k & 1) k >>= 1;
+    k >>= 1;
+#endif
+
+    if (k == 0) return num;
+
+    if (found && b[k] == key) *found = 1;
+
+    return ez->loc[k];
+}
+
+int vstar_radix_sort (vstar_t * ar, int keyoff, int keylen, int keytype)
+{
+    uint8   * src = NULL;
+    uint8   * dst = NULL;
+    uint8   * buf = NULL;
+    uint8   * tmp = NULL;
+    long    * count = NULL;
+    long    * cnt = NULL;
+    long      sum, n;
+    uint16    endian = 1;
+    int       size, pass, bi, i;
+    uint8     flip;
+
+    if (!ar) return -1;
+
+    size = ar->unitsize;
+    if (keyoff < 0 || keylen <= 0 || keyoff + keylen > size)
+        return -2;
+
+    if (keytype != VSTAR_KEY_BYTES && keylen != 1 && keylen != 2 &&
+        keylen != 4 && keylen != 8)
+        return -3;
+
+    if (ar->num < 2) return 0;
+
+    buf = kalloc(ar->num * size);
+    count = kzalloc(keylen * 256 * sizeof(long));
+    if (!buf || !count) {
+        if (buf) kfree(buf);
+        if (count) kfree(count);
+        return -100;
+    }
+
+    /* the histograms of all key bytes in one scan */
+    src = (uint8 *)ar->data + keyoff;
+    for (n = 0; n < ar->num; n++, src += size) {
+        for (i = 0; i < keylen; i++)
+            count[i * 256 + src[i]]++;
+    }
+
+    src = ar->data;
+    dst = buf;
+
+    for (pass = 0; pass < keylen; pass++) {
+        /* the key byte of pass-th least significance */
+        if (keytype == VSTAR_KEY_BYTES || *(uint8 *)&endian == 0)
+            bi = keylen - 1 - pass;
+        else
+            bi = pass;
+
+        flip = (keytype == VSTAR_KEY_INT && pass == keylen - 1) ? 0x80 : 0;
+
+        cnt = count + bi * 256;
+
+        /* all units have the same byte */
+        for (i = 0; i < 256 && cnt[i] != ar->num; i++);
+        if (i < 256) continue;
+
+        for (sum = 0, i = 0; i < 256; i++) {
+            n = cnt[i ^ flip];
+            cnt[i ^ flip] = sum;
+            sum += n;
+        }
+
+        for (n = 0; n < ar->num; n++) {
+            i = src[n * size + keyoff + bi];
+            memcpy(dst + cnt[i]++ * size, src + n * size, size);
+        }
+
+        tmp = src; src = dst; dst = tmp;
+    }
+
+    if (src != ar->data)
+        memcpy(ar->data, src, ar->num * size);
+
+    kfree(buf);
+    kfree(count);
+    return 0;
+}
+
 int vstar_insert_by (vstar_t * ar, void * item, int (*cmp)(void *, void *))
 {
     int       lo, mid, hi;
@@ -266,6 +501,112 @@ int vstar_insert_by (vstar_t * ar, void * item, int (*cmp)(void *, void *))
     return vstar_insert(ar, item, lo);
 }
  
+/* stable merge sort of unit pointers, cmp gets the units */
+static void vstar_msort (void ** data, void ** tmp, int num, int (*cmp)(void *, void *))
+{
+    int  half, i, j, k;
+
+    if (num < 2) return;
+
+    half = num / 2;
+    vstar_msort(data, tmp, half, cmp);
+    vstar_msort(data + half, tmp, num - half, cmp);
+
+    if ((*cmp)(data[half - 1], data[half]) <= 0) return;
+
+    memcpy(tmp, data, half * sizeof(void *));
+
+    for (i = 0, j = half, k = 0; i < half && j < num; ) {
+        if ((*cmp)(tmp[i], data[j]) <= 0)
+            data[k++] = tmp[i++];
+        else
+            data[k++] = data[j++];
+    }
+
+    while (i < half) data[k++] = tmp[i++];
+}
+
+/* the position after the last unit not greater than item in [0, hi),
+ * galloping down from hi */
+static int vstar_gallop_upper (vstar_t * ar, int hi, void * item, int (*cmp)(void *, void *))
+{
+    int  gt, probe, step = 1, mid;
+
+    if (hi <= 0 || (*cmp)(vstar_get(ar, hi - 1), item) <= 0)
+        return hi;
+
+    gt = hi - 1;
+    while ((probe = gt - step) >= 0 && (*cmp)(vstar_get(ar, probe), item) > 0) {
+        gt = probe;
+        step <<= 1;
+    }
+    if (probe < 0) probe = -1;
+
+    while (probe + 1 < gt) {
+        mid = probe + (gt - probe) / 2;
+        if ((*cmp)(vstar_get(ar, mid), item) > 0) gt = mid;
+        else probe = mid;
+    }
+
+    return gt;
+}
+
+int vstar_insert_batch_by (vstar_t * ar, void * items, int num, int (*cmp)(void *, void *))
+{
+    void   ** batch = NULL;
+    void    * s = NULL;
+    int       i, j, k, pos, cnt, size;
+
+    if (!ar || !items || num < 0 || !cmp) return -1;
+
+    if (num == 0) return ar->num;
+
+    size = ar->unitsize;
+
+    batch = kalloc(num * 2 * sizeof(void *));
+    if (!batch) return -100;
+
+    for (j = 0; j < num; j++)
+        batch[j] = (uint8 *)items + j * size;
+    vstar_msort(batch, batch + num, num, cmp);
+
+    if (ar->num_alloc < ar->num + num) {
+        for (k = ar->num_alloc > 0 ? ar->num_alloc : 4; k < ar->num + num; k *= 2);
+
+        s = (void *)krealloc((void *)ar->data, size * k);
+        if (s == NULL) {
+            kfree(batch);
+            return -100;
+        }
+        ar->data = s;
+        ar->num_alloc = k;
+    }
+
+    /* merge from the end, each unit is moved once. the new one is placed
+     * after the equal units like vstar_insert_by */
+    i = ar->num;
+    k = ar->num + num;
+
+    for (j = num - 1; j >= 0; j--) {
+        pos = vstar_gallop_upper(ar, i, batch[j], cmp);
+        cnt = i - pos;
+
+        if (cnt > 0) {
+            k -= cnt;
+            memmove(ar->data + k * size, ar->data + pos * size, cnt * size);
+            i = pos;
+        }
+
+        k--;
+        memcpy(ar->data + k * size, batch[j], size);
+    }
+
+    ar->num += num;
+
+    kfree(batch);
+    return ar->num;
+}
+
 int vstar_findloc_by (vstar_t * ar, void * pattern, int (*cmp)(void *, void *), int * found)
 {
     int       lo, hi, mid;
@@ -400,6 +741,46 @@ int vstar_delete_by (vstar_t * ar, void * pattern, int (*cmp)(void *, void *))
     return -100;
 }
 
+/* the first unit in [lo, mid] equal to pattern, unit mid is equal and the
+ * ones before lo are less. gallop from mid then binary search */
+static int vstar_gallop_first (vstar_t * ar, int lo, int mid, void * pattern, int (*cmp)(void *, void *))
+{
+    int  eq = mid, probe = mid, step = 1;
+
+    while ((probe = eq - step) >= lo && (*cmp)(vstar_get(ar, probe), pattern) == 0) {
+        eq = probe;
+        step <<= 1;
+    }
+    if (probe < lo) probe = lo - 1;
+
+    while (probe + 1 < eq) {
+        mid = probe + (eq - probe) / 2;
+        if ((*cmp)(vstar_get(ar, mid), pattern) == 0) eq = mid;
+        else probe = mid;
+    }
+
+    return eq;
+}
+
+static int vstar_gallop_last (vstar_t * ar, int mid, int hi, void * pattern, int (*cmp)(void *, void *))
+{
+    int  eq = mid, probe = mid, step = 1;
+
+    while ((probe = eq + step) <= hi && (*cmp)(vstar_get(ar, probe), pattern) == 0) {
+        eq = probe;
+        step <<= 1;
+    }
+    if (probe > hi) probe = hi + 1;
+
+    while (eq + 1 < probe) {
+        mid = eq + (probe - eq) / 2;
+        if ((*cmp)(vstar_get(ar, mid), pattern) == 0) eq = mid;
+        else probe = mid;
+    }
+
+    return eq;
+}
+
 int vstar_delete_all_by (vstar_t * ar, void * pattern, int (*cmp)(void *, void *))
 {
     int       lo, hi, mid = 0, cur = 0, bgn = 0, end = 0;
@@ -414,28 +795,19 @@ int vstar_delete_all_by (vstar_t * ar, void * pattern, int (*cmp)(void *, void *
         mid = (lo + hi) / 2;
 
         if (!(result = (*cmp)(vstar_get(ar, mid), pattern))) {
+            bgn = vstar_gallop_first(ar, lo, mid, pattern, cmp);
+            end = vstar_gallop_last(ar, mid, hi, pattern, cmp);
 
-            for (cur = mid+1; cur <= hi; cur++) {
-                if ((*cmp)(vstar_get(ar, cur), pattern) != 0) {
-                    end = cur-1;
-                    break;
-                }
-            }
-
-            if (cur > hi) end = hi;
-
-            for (cur = mid-1; cur >= lo; cur--) {
-                if ((*cmp)(vstar_get(ar, cur), pattern) != 0) {
-                    bgn = cur+1;
-                    break;
-                }
+            if (ar->clean) {
+                for (cur = bgn; cur <= end; cur++)
+                    (*ar->clean)(ar->data + cur * ar->unitsize);
             }
 
-            if (cur < lo) bgn = lo;
- 
-            for (cur=bgn; cur<=end; cur++) {
-                vstar_delete(ar, bgn);
-            }
+            /* close the gap with one move */
+            memmove(ar->data + bgn * ar->unitsize,
+                    ar->data + (end + 1) * ar->unitsize,
+                    (ar->num - end - 1) * ar->unitsize);
+            ar->num -= end - bgn + 1;
 
             return 0;
 
@@ -9,8 +9,16 @@
 #include "strutil.h"
 #include "dynarr.h"
 #include "hashtab.h"
+#include "arfifo.h"
+#include "dabuild.h"
 #include "wordlib.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 
 typedef struct worditem_ {
     int        word;
@@ -28,6 +36,9 @@ typedef struct worditem_ {
 
 typedef void WordItem_FREE (void * );
 
+static void word_image_free (void * vimg);
+static int  word_image_get (WordLib * wlib, uint8 * pbyte, int bytelen, void ** pvar);
+
 
 void * word_item_alloc ();
 int    word_item_free (void * vwi);
@@ -216,6 +227,11 @@ int word_lib_clean (void *vwlib)
         wlib->itempool = NULL;
     }
 
+    if (wlib->image) {
+        word_image_free(wlib->image);
+        wlib->image = NULL;
+    }
+
     kfree(wlib);
     return 0;
 }
@@ -231,6 +247,7 @@ int word_lib_loadfile (void * vwlib, char * file)
  
     if (!wlib) return -1;
     if (!file) return -2;
+    if (wlib->image) return -20;
  
     fp = fopen(file, "r");
     if (!fp) return -10;
@@ -318,18 +335,21 @@ int word_lib_add (void * vwlib, void * vbyte, int bytelen, void * varpara, void
     if (!pbyte) return -2;
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return -3;
+
+    if (wlib->image) return -20;
  
     pend = pbyte + bytelen;
  
     memset(&item, 0, sizeof(item));
     wordlen = getword(wlib, p, pend-p, &item.word); 
     p += wordlen; phraselen += wordlen;
+    serial++;
  
     wi = ht_get(wlib->subtab, &item.word);
     if (!wi) {
         wi = word_item_fetch(wlib);
         wi->word = item.word;
-        wi->serial = ++serial;
+        wi->serial = serial;
         wi->phraselen = phraselen;
         wi->parent = wlib;
         ht_set(wlib->subtab, &item.word, wi);
@@ -339,13 +359,15 @@ int word_lib_add (void * vwlib, void * vbyte, int bytelen, void * varpara, void
         memset(&item, 0, sizeof(item));
         wordlen = getword(wlib, p, pend-p, &item.word); 
         p += wordlen; phraselen += wordlen;
+        if (serial < 255) serial++;
  
         if (!wi->sublist) wi->sublist = arr_new(4);
         subwi = arr_find_by(wi->sublist, &item, word_item_cmp_item);
         if (!subwi) {
             subwi = word_item_fetch(wlib);
             subwi->word = item.word;
-            subwi->serial = ++serial;
+            /* serial is the depth, the first level is 1 */
+            subwi->serial = serial;
             subwi->phraselen = phraselen;
             subwi->parent = wi;
             arr_insert_by(wi->sublist, subwi, word_item_cmp_item);
@@ -378,6 +400,9 @@ int word_lib_get (void * vwlib, void * vbyte, int bytelen, void ** pvar)
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return 0;
 
+    if (wlib->image)
+        return word_image_get(wlib, pbyte, bytelen, pvar);
+
     pend = pbyte + bytelen;
  
     memset(&item, 0, sizeof(item));
@@ -424,6 +449,8 @@ int word_lib_del (void * vwlib, void * vbyte, int bytelen)
     if (!pbyte) return -2;
     if (bytelen < 0) bytelen = str_len(pbyte);
     if (bytelen <= 0) return -3;
+
+    if (wlib->image) return -20;
  
     pend = pbyte + bytelen;
  
@@ -492,3 +519,478 @@ int word_lib_fwmaxmatch (void * vwlib, void * vbyte, int len, void ** pres, int
     return -100;
 }
 
+
+/* the image written by word_lib_compile:
+ *   header, value[words], cmap[hashsize], unit[size], term[size]
+ * the Unicode/GBK words are mapped to codes 1..codes ordered by frequency
+ * through the open addressing hash cmap. term is the value index of the
+ * state that ends a phrase, or -1 */
+
+#define WLIMG_MAGIC    0x41444c57   //"WLDA"
+#define WLIMG_VERSION  1
+
+typedef struct wlimg_hdr_ {
+    uint32       magic;
+    uint32       version;
+    uint32       charset;
+    uint32       codes;
+    uint32       hashsize;
+    uint32       size;
+    uint32       words;
+    uint32       res;
+} WLImgHdr;
+
+typedef struct wlvalue_ {
+    uint64       varpara;
+    int32        phraselen;
+    int32        res;
+} WLValue;
+
+typedef struct wlcode_ {
+    int32        word;
+    int32        code;
+} WLCode;
+
+typedef struct wordimage_ {
+    WLImgHdr   * hdr;
+    WLValue    * value;
+    WLCode     * cmap;
+    daunit_t   * unit;
+    int32      * term;
+    uint32       mask;
+
+    void       * mem;
+    void       * mapbase;
+    int64        maplen;
+} WordImage;
+
+static uint32 wl_code_hash (int word)
+{
+    uint32  h = (uint32)word * 0x9E3779B1U;
+
+    return h ^ (h >> 15);
+}
+
+static int wl_code_find (WLCode * tab, uint32 mask, int word)
+{
+    uint32  h = wl_code_hash(word) & mask;
+
+    while (tab[h].code != 0 && tab[h].word != word)
+        h = (h + 1) & mask;
+
+    return h;
+}
+
+static int64 word_image_len (WLImgHdr * hdr)
+{
+    return sizeof(WLImgHdr) + (int64)hdr->words * sizeof(WLValue) +
+           (int64)hdr->hashsize * sizeof(WLCode) +
+           (int64)hdr->size * (sizeof(daunit_t) + sizeof(int32));
+}
+
+static int word_item_child (WordLib * wlib, WordItem * wi, int i, WordItem ** pwi)
+{
+    if (wi == NULL) {
+        *pwi = ht_value(wlib->subtab, i);
+        return ht_num(wlib->subtab);
+    }
+
+    *pwi = arr_value(wi->sublist, i);
+    return arr_num(wi->sublist);
+}
+
+static int wl_cmp_freq (const void * a, const void * b)
+{
+    const WLCode * ca = (const WLCode *)a;
+    const WLCode * cb = (const WLCode *)b;
+
+    /* the code field holds the frequency before codes are given */
+    if (ca->code != cb->code) return ca->code > cb->code ? -1 : 1;
+    return ca->word < cb->word ? -1 : (ca->word > cb->word);
+}
+
+static int wl_cmp_key (const void * a, const void * b)
+{
+    int64   ka = *(const int64 *)a;
+    int64   kb = *(const int64 *)b;
+
+    return ka < kb ? -1 : (ka > kb);
+}
+
+/* give each word a code by frequency, return the number of codes */
+static int word_lib_codes (WordLib * wlib, void * fifo, int nodes, WLCode ** pcmap, uint32 * phsize)
+{
+    WordItem  * wi = NULL;
+    WordItem  * subwi = NULL;
+    WLCode    * tab = NULL;
+    WLCode    * cmap = NULL;
+    uint32      tsize, hsize, h;
+    int         i, j, num, ncode = 0;
+
+    for (tsize = 64; tsize < (uint32)nodes * 2; tsize <<= 1);
+
+    tab = kzalloc(tsize * sizeof(WLCode));
+    if (!tab) return -1;
+
+    /* count the words of all items, the first level included */
+    ar_fifo_zero(fifo);
+    ar_fifo_push(fifo, NULL);
+
+    while (ar_fifo_num(fifo) > 0) {
+        wi = ar_fifo_out(fifo);
+
+        num = word_item_child(wlib, wi, 0, &subwi);
+        for (i = 0; i < num; i++) {
+            word_item_child(wlib, wi, i, &subwi);
+            if (!subwi) continue;
+
+            h = wl_code_find(tab, tsize - 1, subwi->word);
+            if (tab[h].code == 0) {
+                tab[h].word = subwi->word;
+                ncode++;
+            }
+            tab[h].code++;
+
+            ar_fifo_push(fifo, subwi);
+        }
+    }
+
+    for (i = 0, j = 0; i < (int)tsize; i++) {
+        if (tab[i].code > 0) tab[j++] = tab[i];
+    }
+    qsort(tab, ncode, sizeof(WLCode), wl_cmp_freq);
+
+    for (hsize = 16; hsize < (uint32)ncode * 2; hsize <<= 1);
+
+    cmap = kzalloc(hsize * sizeof(WLCode));
+    if (!cmap) {
+        kfree(tab);
+        return -1;
+    }
+
+    for (i = 0; i < ncode; i++) {
+        h = wl_code_find(cmap, hsize - 1, tab[i].word);
+        cmap[h].word = tab[i].word;
+        cmap[h].code = i + 1;
+    }
+
+    kfree(tab);
+
+    *pcmap = cmap;
+    *phsize = hsize;
+    return ncode;
+}
+
+int word_lib_compile (void * vwlib, char * file)
+{
+    WordLib     * wlib = (WordLib *)vwlib;
+    WordItem    * wi = NULL;
+    WordItem    * subwi = NULL;
+    WLImgHdr      hdr;
+    WLValue     * value = NULL;
+    WLCode      * cmap = NULL;
+    dabuild_t     bd;
+    int32         extinit[1] = {-1};
+    void        * fifo = NULL;
+    FILE        * fp = NULL;
+    int64       * keys = NULL;
+    int         * codes = NULL;
+    WordItem   ** subs = NULL;
+    uint32        hsize = 0;
+    int           cap = 0, num, i, ncode;
+    int           nodes = 0, nword = 0, widx = 0;
+    int           s, t, base, size;
+    int           ret = 0;
+
+    if (!wlib) return -1;
+    if (!file) return -2;
+    if (wlib->image || !wlib->subtab) return -3;
+
+    memset(&bd, 0, sizeof(bd));
+
+    fifo = ar_fifo_new(4);
+    if (!fifo) return -4;
+
+    ar_fifo_push(fifo, NULL);
+
+    while (ar_fifo_num(fifo) > 0) {
+        wi = ar_fifo_out(fifo);
+
+        num = word_item_child(wlib, wi, 0, &subwi);
+        if (num > cap) cap = num;
+
+        for (i = 0; i < num; i++) {
+            word_item_child(wlib, wi, i, &subwi);
+            if (!subwi) continue;
+
+            nodes++;
+            if (subwi->phrase_end) nword++;
+            ar_fifo_push(fifo, subwi);
+        }
+    }
+
+    ncode = word_lib_codes(wlib, fifo, nodes, &cmap, &hsize);
+
+    value = kzalloc((nword + 1) * sizeof(WLValue));
+    keys = kalloc((cap + 1) * sizeof(int64));
+    codes = kalloc((cap + 1) * sizeof(int));
+    subs = kalloc((cap + 1) * sizeof(WordItem *));
+
+    if (ncode < 0 || !value || !keys || !codes || !subs || dab_init(&bd, 1, extinit) < 0) {
+        ret = -4;
+        goto end;
+    }
+
+    /* place the states in breadth-first order, the children of a state
+     * are sorted by code */
+    ar_fifo_zero(fifo);
+    ar_fifo_push(fifo, NULL);
+    ar_fifo_push(fifo, (void *)(long)0);
+
+    while (ar_fifo_num(fifo) > 0) {
+        wi = ar_fifo_out(fifo);
+        s = (int)(long)ar_fifo_out(fifo);
+
+        num = word_item_child(wlib, wi, 0, &subwi);
+        for (t = 0, i = 0; i < num; i++) {
+            word_item_child(wlib, wi, i, &subwi);
+            if (!subwi) continue;
+
+            subs[t] = subwi;
+            keys[t] = ((int64)cmap[wl_code_find(cmap, hsize - 1, subwi->word)].code << 32) | t;
+            t++;
+        }
+        num = t;
+
+        if (num == 0) continue;
+
+        qsort(keys, num, sizeof(int64), wl_cmp_key);
+
+        for (i = 0; i < num; i++)
+            codes[i] = (int)(keys[i] >> 32);
+
+        base = dab_place(&bd, s, codes, num);
+        if (base < 0) {
+            ret = -5;
+            goto end;
+        }
+
+        for (i = 0; i < num; i++) {
+            subwi = subs[keys[i] & 0xFFFFFFFF];
+            t = base + codes[i];
+
+            if (subwi->phrase_end) {
+                bd.ext[0][t] = widx;
+                value[widx].varpara = (uint64)(ulong)subwi->varpara;
+                value[widx].phraselen = subwi->phraselen;
+                widx++;
+            }
+
+            ar_fifo_push(fifo, subwi);
+            ar_fifo_push(fifo, (void *)(long)t);
+        }
+    }
+
+    size = dab_size(&bd, ncode);
+    if (dab_grow(&bd, size) < 0) {
+        ret = -4;
+        goto end;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = WLIMG_MAGIC;
+    hdr.version = WLIMG_VERSION;
+    hdr.charset = wlib->charset;
+    hdr.codes = ncode;
+    hdr.hashsize = hsize;
+    hdr.size = size;
+    hdr.words = nword;
+
+    fp = fopen(file, "wb");
+    if (!fp) {
+        ret = -10;
+        goto end;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(value, sizeof(WLValue), nword, fp) != (size_t)nword ||
+        fwrite(cmap, sizeof(WLCode), hsize, fp) != (size_t)hsize ||
+        fwrite(bd.unit, sizeof(daunit_t), size, fp) != (size_t)size ||
+        fwrite(bd.ext[0], sizeof(int32), size, fp) != (size_t)size)
+    {
+        ret = -11;
+    }
+
+    fclose(fp);
+
+end:
+    if (value) kfree(value);
+    if (cmap) kfree(cmap);
+    if (keys) kfree(keys);
+    if (codes) kfree(codes);
+    if (subs) kfree(subs);
+    ar_fifo_free(fifo);
+    dab_free(&bd);
+
+    return ret;
+}
+
+static void word_image_free (void * vimg)
+{
+    WordImage * img = (WordImage *)vimg;
+
+    if (!img) return;
+
+#ifdef UNIX
+    if (img->mapbase) munmap(img->mapbase, img->maplen);
+#endif
+
+    if (img->mem) kfree(img->mem);
+
+    kfree(img);
+}
+
+static int word_image_layout (WordImage * img, void * mem, int64 len)
+{
+    WLImgHdr  * hdr = (WLImgHdr *)mem;
+    uint8     * p = NULL;
+
+    if (len < (int64)sizeof(*hdr)) return -1;
+
+    if (hdr->magic != WLIMG_MAGIC || hdr->version != WLIMG_VERSION)
+        return -2;
+
+    if (hdr->hashsize == 0 || (hdr->hashsize & (hdr->hashsize - 1)) != 0 ||
+        hdr->hashsize <= hdr->codes || hdr->size <= hdr->codes || hdr->size > (1 << 30))
+        return -3;
+
+    if (word_image_len(hdr) != len)
+        return -4;
+
+    p = (uint8 *)mem + sizeof(*hdr);
+
+    img->hdr = hdr;
+    img->value = (WLValue *)p;  p += (int64)hdr->words * sizeof(WLValue);
+    img->cmap = (WLCode *)p;  p += (int64)hdr->hashsize * sizeof(WLCode);
+    img->unit = (daunit_t *)p;  p += (int64)hdr->size * sizeof(daunit_t);
+    img->term = (int32 *)p;
+    img->mask = hdr->hashsize - 1;
+
+    return 0;
+}
+
+void * word_lib_mmap (char * file)
+{
+    WordLib     * wlib = NULL;
+    WordImage   * img = NULL;
+    int64         fsize = 0;
+#ifdef UNIX
+    struct stat   st;
+    void        * pmap = NULL;
+    int           fd = -1;
+#else
+    FILE        * fp = NULL;
+#endif
+
+    if (!file) return NULL;
+
+    img = kzalloc(sizeof(*img));
+    if (!img) return NULL;
+
+#ifdef UNIX
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        kfree(img);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (int64)sizeof(WLImgHdr)) {
+        close(fd);
+        kfree(img);
+        return NULL;
+    }
+
+    fsize = st.st_size;
+    pmap = mmap(NULL, fsize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (pmap == MAP_FAILED) {
+        kfree(img);
+        return NULL;
+    }
+
+    img->mapbase = pmap;
+    img->maplen = fsize;
+
+    if (word_image_layout(img, pmap, fsize) < 0) {
+        word_image_free(img);
+        return NULL;
+    }
+#else
+    fp = fopen(file, "rb");
+    if (!fp) {
+        kfree(img);
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (fsize < (int64)sizeof(WLImgHdr) || (img->mem = kalloc(fsize)) == NULL ||
+        fread(img->mem, 1, fsize, fp) != (size_t)fsize ||
+        word_image_layout(img, img->mem, fsize) < 0)
+    {
+        fclose(fp);
+        word_image_free(img);
+        return NULL;
+    }
+
+    fclose(fp);
+#endif
+
+    wlib = kzalloc(sizeof(*wlib));
+    if (!wlib) {
+        word_image_free(img);
+        return NULL;
+    }
+
+    strncpy(wlib->word_file, file, sizeof(wlib->word_file) - 1);
+    wlib->charset = img->hdr->charset;
+    wlib->count = img->hdr->words;
+    wlib->image = img;
+
+    return wlib;
+}
+
+static int word_image_get (WordLib * wlib, uint8 * pbyte, int bytelen, void ** pvar)
+{
+    WordImage   * img = (WordImage *)wlib->image;
+    daunit_t    * unit = img->unit;
+    uint8       * p = pbyte;
+    uint8       * pend = pbyte + bytelen;
+    int           word = 0;
+    int32         s = 0, t, c;
+    int32         w = -1;
+
+    while (p < pend) {
+        p += getword(wlib, p, pend - p, &word);
+
+        c = img->cmap[wl_code_find(img->cmap, img->mask, word)].code;
+        if (c == 0) break;
+
+        t = unit[s].base + c;
+        if (unit[t].check != s) break;
+
+        s = t;
+        if (img->term[s] >= 0) w = img->term[s];
+    }
+
+    if (w >= 0) {
+        if (pvar) *pvar = (void *)(ulong)img->value[w].varpara;
+        return img->value[w].phraselen;
+    }
+
+    return 0;
+}
+